@@ -135,7 +135,7 @@ int anetTcpKeepAlive(char *err, int fd) {
     return ANET_OK;
 }
 
-static int anetCreateSocket(char *err, int domain) {
+static int anetCreateSocket(char *err, int domain, int type) {
     int s, on = 1;
 
     if (!max_fds) {
@@ -149,7 +149,7 @@ static int anetCreateSocket(char *err, int domain) {
         anetSetError(err, "Approaching RLIMIT: %s", strerror(errno));
         return ANET_ERR;
     }
-    if ((s = socket(domain, SOCK_STREAM, 0)) == -1) {
+    if ((s = socket(domain, type, 0)) == -1) {
         anetSetError(err, "creating socket: %s", strerror(errno));
         return ANET_ERR;
     }
@@ -191,7 +191,7 @@ static int anetTcpGenericConnect(char *err, char *addr, char *service, int flags
     }
 
     for (p = gai_result; p != NULL; p = p->ai_next) {
-        if ((s = anetCreateSocket(err, p->ai_family)) == ANET_ERR)
+        if ((s = anetCreateSocket(err, p->ai_family, SOCK_STREAM)) == ANET_ERR)
             continue;
 
         if (flags & ANET_CONNECT_NONBLOCK) {
@@ -255,7 +255,7 @@ int anetGetaddrinfo(char *err, char *addr, char *service, struct addrinfo **gai_
 int anetTcpNonBlockConnectAddr(char *err, struct addrinfo *p) {
     int s;
 
-    if ((s = anetCreateSocket(err, p->ai_family)) == ANET_ERR)
+    if ((s = anetCreateSocket(err, p->ai_family, SOCK_STREAM)) == ANET_ERR)
         return ANET_ERR;
 
     if (anetNonBlock(err, s) != ANET_OK) {
@@ -350,7 +350,7 @@ int anetTcpServer(char *err, char *service, char *bindaddr, int *fds, int nfds)
     }
 
     for (p = gai_result; p != NULL && i < nfds; p = p->ai_next) {
-        if ((s = anetCreateSocket(err, p->ai_family)) == ANET_ERR)
+        if ((s = anetCreateSocket(err, p->ai_family, SOCK_STREAM)) == ANET_ERR)
             continue;
 
         if (anetListen(err, s, p->ai_addr, p->ai_addrlen) == ANET_ERR) {
@@ -367,6 +367,122 @@ int anetTcpServer(char *err, char *service, char *bindaddr, int *fds, int nfds)
     return (i > 0 ? i : ANET_ERR);
 }
 
+// Bind UDP sockets for the bind address and port, like anetTcpServer().
+// With a multicast group, the sockets of its family join it.
+
+int anetUdpServer(char *err, char *service, char *bindaddr, char *group, int *fds, int nfds) {
+    int s;
+    int i = 0;
+    struct addrinfo gai_hints;
+    struct addrinfo *gai_result, *p, *g = NULL;
+    int gai_error;
+
+    memset(&gai_hints, 0, sizeof (gai_hints));
+    gai_hints.ai_family = AF_UNSPEC;
+    gai_hints.ai_socktype = SOCK_DGRAM;
+    gai_hints.ai_flags = AI_PASSIVE;
+
+    if (group && (gai_error = getaddrinfo(group, service, &gai_hints, &g)) != 0) {
+        anetSetError(err, "can't resolve %s: %s", group, gai_strerror(gai_error));
+        return ANET_ERR;
+    }
+
+    gai_error = getaddrinfo(bindaddr, service, &gai_hints, &gai_result);
+    if (gai_error != 0) {
+        anetSetError(err, "can't resolve %s: %s", bindaddr, gai_strerror(gai_error));
+        if (g)
+            freeaddrinfo(g);
+        return ANET_ERR;
+    }
+
+    for (p = gai_result; p != NULL && i < nfds; p = p->ai_next) {
+        if (g && p->ai_family != g->ai_family)
+            continue;
+
+        if ((s = anetCreateSocket(err, p->ai_family, SOCK_DGRAM)) == ANET_ERR)
+            continue;
+
+        if (p->ai_family == AF_INET6) {
+            int on = 1;
+            setsockopt(s, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof (on));
+        }
+
+        if (bind(s, p->ai_addr, p->ai_addrlen) == -1) {
+            anetSetError(err, "bind: %s", strerror(errno));
+            anetCloseSocket(s);
+            continue;
+        }
+
+        if (g && g->ai_family == AF_INET) {
+            struct ip_mreq mreq;
+            mreq.imr_multiaddr = ((struct sockaddr_in *) g->ai_addr)->sin_addr;
+            mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+            if (setsockopt(s, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof (mreq)) == -1) {
+                anetSetError(err, "joining %s: %s", group, strerror(errno));
+                anetCloseSocket(s);
+                continue;
+            }
+        } else if (g) {
+            struct ipv6_mreq mreq;
+            mreq.ipv6mr_multiaddr = ((struct sockaddr_in6 *) g->ai_addr)->sin6_addr;
+            mreq.ipv6mr_interface = 0;
+            if (setsockopt(s, IPPROTO_IPV6, IPV6_JOIN_GROUP, &mreq, sizeof (mreq)) == -1) {
+                anetSetError(err, "joining %s: %s", group, strerror(errno));
+                anetCloseSocket(s);
+                continue;
+            }
+        }
+
+        fds[i++] = s;
+    }
+
+    freeaddrinfo(gai_result);
+    if (g)
+        freeaddrinfo(g);
+    return (i > 0 ? i : ANET_ERR);
+}
+
+// A UDP socket sending to addr and service. Multicast datagrams go no
+// further than ttl hops.
+
+int anetUdpConnect(char *err, char *addr, char *service, int ttl) {
+    int s;
+    struct addrinfo gai_hints;
+    struct addrinfo *gai_result, *p;
+    int gai_error;
+
+    memset(&gai_hints, 0, sizeof (gai_hints));
+    gai_hints.ai_family = AF_UNSPEC;
+    gai_hints.ai_socktype = SOCK_DGRAM;
+
+    gai_error = getaddrinfo(addr, service, &gai_hints, &gai_result);
+    if (gai_error != 0) {
+        anetSetError(err, "can't resolve %s: %s", addr, gai_strerror(gai_error));
+        return ANET_ERR;
+    }
+
+    for (p = gai_result; p != NULL; p = p->ai_next) {
+        if ((s = anetCreateSocket(err, p->ai_family, SOCK_DGRAM)) == ANET_ERR)
+            continue;
+
+        if (p->ai_family == AF_INET)
+            setsockopt(s, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof (ttl));
+        else if (p->ai_family == AF_INET6)
+            setsockopt(s, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &ttl, sizeof (ttl));
+
+        if (connect(s, p->ai_addr, p->ai_addrlen) >= 0) {
+            freeaddrinfo(gai_result);
+            return s;
+        }
+
+        anetSetError(err, "connect: %s", strerror(errno));
+        anetCloseSocket(s);
+    }
+
+    freeaddrinfo(gai_result);
+    return ANET_ERR;
+}
+
 int anetGenericAccept(char *err, int s, struct sockaddr *sa, socklen_t *len) {
     int fd;
     if (!max_fds) {
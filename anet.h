@@ -72,6 +72,8 @@ int anetTcpNonBlockConnectAddr(char *err, struct addrinfo *p);
 int anetGetaddrinfo(char *err, char *addr, char *service, struct addrinfo **gai_result);
 int anetRead(int fd, char *buf, int count);
 int anetTcpServer(char *err, char *service, char *bindaddr, int *fds, int nfds);
+int anetUdpServer(char *err, char *service, char *bindaddr, char *group, int *fds, int nfds);
+int anetUdpConnect(char *err, char *addr, char *service, int ttl);
 int anetGenericAccept(char *err, int s, struct sockaddr *sa, socklen_t *len);
 int anetWrite(int fd, char *buf, int count);
 int anetNonBlock(char *err, int fd);
@@ -0,0 +1,365 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// capture.c: recording of the decoded frames and reading them back
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "readsb.h"
+
+#include <inttypes.h>
+
+// With --record every message useModesMessage() gets is appended to a
+// capture file, as it was received, to be replayed later with
+// --device-type replay or fed to the benchmarks. The main thread packs the
+// frames into blocks and hands each full one to a writer thread, which
+// writes it with a single write(), so the disk never holds up decoding.
+// If the disk can't keep up and all blocks wait to be written, frames are
+// dropped and counted rather than queued without bound.
+
+#define CAPTURE_BLOCKS 8
+#define CAPTURE_RECORD_MAX (1 + 10 + 10 + 1 + MODES_LONG_MSG_BYTES)
+#define CAPTURE_FLUSH_MS 10000 // longest a recorded frame waits for its block to fill
+
+struct capture_block {
+    unsigned char data[CAPTURE_BLOCK_BYTES];
+    size_t len; // header included
+    unsigned count;
+    uint64_t started; // mstime() of the first record
+    uint64_t timestamp; // of the previous record
+    uint64_t sys_timestamp;
+};
+
+static struct {
+    int fd;
+    bool running;
+    bool stop;
+    bool failed; // a write failed, the rest isn't written
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    struct capture_block *blocks;
+    struct capture_block *current; // being filled by the main thread, NULL if none is free
+    unsigned filled; // blocks handed to the writer
+    unsigned written; // blocks the writer is done with
+    uint64_t frames;
+    uint64_t dropped;
+} capture = {
+    .fd = -1,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static unsigned char *put_le16(unsigned char *p, uint16_t v) {
+    *p++ = v;
+    *p++ = v >> 8;
+    return p;
+}
+
+static unsigned char *put_le32(unsigned char *p, uint32_t v) {
+    p = put_le16(p, v);
+    return put_le16(p, v >> 16);
+}
+
+static unsigned char *put_le64(unsigned char *p, uint64_t v) {
+    p = put_le32(p, v);
+    return put_le32(p, v >> 32);
+}
+
+static uint64_t get_le(const unsigned char *p, int bytes) {
+    uint64_t v = 0;
+
+    while (bytes--)
+        v = v << 8 | p[bytes];
+    return v;
+}
+
+// Signed deltas as varints of (d << 1) ^ (d >> 63), so that small steps
+// either way take a byte or two
+static unsigned char *put_zigzag(unsigned char *p, int64_t d) {
+    uint64_t v = ((uint64_t) d << 1) ^ (uint64_t) (d >> 63);
+
+    while (v >= 0x80) {
+        *p++ = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    *p++ = v;
+    return p;
+}
+
+static const unsigned char *get_zigzag(const unsigned char *p, const unsigned char *end, int64_t *d) {
+    uint64_t v = 0;
+
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        unsigned char c = *p++;
+        v |= (uint64_t) (c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            *d = (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static bool write_all(int fd, const unsigned char *p, size_t len) {
+    while (len) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static void *captureWriterEntryPoint(void *arg) {
+    MODES_NOTUSED(arg);
+
+    pthread_mutex_lock(&capture.mutex);
+    while (true) {
+        if (capture.written == capture.filled) {
+            if (capture.stop)
+                break;
+            pthread_cond_wait(&capture.cond, &capture.mutex);
+            continue;
+        }
+        struct capture_block *b = &capture.blocks[capture.written % CAPTURE_BLOCKS];
+        bool failed = capture.failed;
+        pthread_mutex_unlock(&capture.mutex);
+
+        if (!failed && !write_all(capture.fd, b->data, b->len)) {
+            fprintf(stderr, "--record: writing %s failed: %s, not recording any more\n", Modes.record_file, strerror(errno));
+            failed = true;
+        }
+
+        pthread_mutex_lock(&capture.mutex);
+        capture.failed = failed;
+        capture.written++;
+    }
+    pthread_mutex_unlock(&capture.mutex);
+    return NULL;
+}
+
+// Take the next block to fill, if the writer is done with it
+static void captureNextBlock(void) {
+    pthread_mutex_lock(&capture.mutex);
+    if (capture.filled - capture.written < CAPTURE_BLOCKS) {
+        capture.current = &capture.blocks[capture.filled % CAPTURE_BLOCKS];
+        capture.current->len = CAPTURE_BLOCK_HEADER_BYTES;
+        capture.current->count = 0;
+    }
+    pthread_mutex_unlock(&capture.mutex);
+}
+
+// Fill in the block header and pass the block on to the writer
+static void captureHandOver(void) {
+    struct capture_block *b = capture.current;
+    unsigned char *p = b->data;
+
+    p = put_le32(p, CAPTURE_BLOCK_MAGIC);
+    p = put_le32(p, b->len - CAPTURE_BLOCK_HEADER_BYTES);
+    p = put_le32(p, b->count);
+    put_le32(p, 0);
+    // the base times were put in by the first record
+
+    capture.current = NULL;
+    pthread_mutex_lock(&capture.mutex);
+    capture.filled++;
+    pthread_cond_signal(&capture.cond);
+    pthread_mutex_unlock(&capture.mutex);
+
+    captureNextBlock();
+}
+
+bool captureStart(void) {
+    unsigned char header[CAPTURE_HEADER_BYTES], *p = header;
+
+    if (!Modes.record_file)
+        return true;
+
+    if (!(capture.blocks = malloc(sizeof (struct capture_block) * CAPTURE_BLOCKS))) {
+        fprintf(stderr, "--record: out of memory allocating the blocks\n");
+        return false;
+    }
+
+    if ((capture.fd = open(Modes.record_file, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        fprintf(stderr, "--record: opening %s failed: %s\n", Modes.record_file, strerror(errno));
+        return false;
+    }
+
+    p = put_le32(p, CAPTURE_MAGIC);
+    p = put_le16(p, CAPTURE_VERSION);
+    p = put_le16(p, 0);
+    put_le64(p, Modes.startup_time);
+    if (!write_all(capture.fd, header, sizeof (header))) {
+        fprintf(stderr, "--record: writing %s failed: %s\n", Modes.record_file, strerror(errno));
+        return false;
+    }
+
+    capture.stop = false;
+    int rc = pthread_create(&capture.thread, NULL, captureWriterEntryPoint, NULL);
+    if (rc) {
+        fprintf(stderr, "--record: pthread_create failed: %s\n", strerror(rc));
+        return false;
+    }
+    thread_place(capture.thread, THREAD_WRITER);
+    capture.running = true;
+
+    captureNextBlock();
+    return true;
+}
+
+void captureStop(void) {
+    if (capture.running) {
+        if (capture.current && capture.current->count)
+            captureHandOver();
+
+        pthread_mutex_lock(&capture.mutex);
+        capture.stop = true;
+        pthread_cond_signal(&capture.cond);
+        pthread_mutex_unlock(&capture.mutex);
+        pthread_join(capture.thread, NULL);
+        capture.running = false;
+
+        fprintf(stderr, "Recorded %" PRIu64 " messages to %s", capture.frames, Modes.record_file);
+        if (capture.dropped)
+            fprintf(stderr, ", dropped %" PRIu64 " the disk could not keep up with", capture.dropped);
+        fprintf(stderr, "\n");
+    }
+
+    if (capture.fd >= 0) {
+        close(capture.fd);
+        capture.fd = -1;
+    }
+    free(capture.blocks);
+    capture.blocks = NULL;
+    capture.current = NULL;
+}
+
+void captureMessage(const struct modesMessage *mm) {
+    struct capture_block *b;
+    unsigned char *p;
+    int kind, len;
+    long sig;
+
+    if (!capture.current) {
+        captureNextBlock();
+        if (!capture.current) {
+            capture.dropped++;
+            return;
+        }
+    }
+
+    if (mm->msgtype == 32) {
+        kind = CAPTURE_KIND_MODEAC;
+        len = MODEAC_MSG_BYTES;
+    } else if (mm->msgbits == MODES_SHORT_MSG_BITS) {
+        kind = CAPTURE_KIND_SHORT;
+        len = MODES_SHORT_MSG_BYTES;
+    } else {
+        kind = CAPTURE_KIND_LONG;
+        len = MODES_LONG_MSG_BYTES;
+    }
+
+    b = capture.current;
+    if (!b->count) {
+        b->started = mstime();
+        b->timestamp = mm->timestampMsg;
+        b->sys_timestamp = mm->sysTimestampMsg;
+        put_le64(put_le64(b->data + 16, b->timestamp), b->sys_timestamp);
+    }
+
+    p = b->data + b->len;
+    *p++ = kind | (mm->remote ? CAPTURE_REMOTE : 0);
+    p = put_zigzag(p, (int64_t) (mm->timestampMsg - b->timestamp));
+    p = put_zigzag(p, (int64_t) (mm->sysTimestampMsg - b->sys_timestamp));
+    sig = lround(sqrt(mm->signalLevel) * 255);
+    if (mm->signalLevel > 0 && sig < 1)
+        sig = 1;
+    *p++ = sig > 255 ? 255 : sig;
+    memcpy(p, mm->verbatim, len);
+    p += len;
+
+    b->len = p - b->data;
+    b->count++;
+    b->timestamp = mm->timestampMsg;
+    b->sys_timestamp = mm->sysTimestampMsg;
+    capture.frames++;
+
+    if (b->len + CAPTURE_RECORD_MAX > CAPTURE_BLOCK_BYTES)
+        captureHandOver();
+}
+
+void capturePeriodicWork(uint64_t now) {
+    if (capture.current && capture.current->count && now - capture.current->started >= CAPTURE_FLUSH_MS)
+        captureHandOver();
+}
+
+//
+// Reading a capture back, for the replay input and the benchmarks
+//
+
+bool captureCheckHeader(const unsigned char *p, uint64_t *start) {
+    if (get_le(p, 4) != CAPTURE_MAGIC || get_le(p + 4, 2) != CAPTURE_VERSION)
+        return false;
+    *start = get_le(p + 8, 8);
+    return true;
+}
+
+int captureBlockLength(const unsigned char *p) {
+    uint64_t len = get_le(p + 4, 4);
+
+    if (get_le(p, 4) != CAPTURE_BLOCK_MAGIC || len > CAPTURE_BLOCK_BYTES - CAPTURE_BLOCK_HEADER_BYTES)
+        return -1;
+    return (int) len;
+}
+
+bool captureReadBlock(const unsigned char *p, size_t len, void (*fn)(const struct capture_frame *, void *), void *arg) {
+    static const unsigned lengths[] = { MODEAC_MSG_BYTES, MODES_SHORT_MSG_BYTES, MODES_LONG_MSG_BYTES };
+    const unsigned char *end = p + len;
+    struct capture_frame frame;
+    int64_t delta;
+
+    if (len < CAPTURE_BLOCK_HEADER_BYTES || captureBlockLength(p) != (int) (len - CAPTURE_BLOCK_HEADER_BYTES))
+        return false;
+
+    unsigned count = get_le(p + 8, 4);
+    frame.timestamp = get_le(p + 16, 8);
+    frame.sys_timestamp = get_le(p + 24, 8);
+    p += CAPTURE_BLOCK_HEADER_BYTES;
+
+    while (count--) {
+        if (p >= end || (*p & 0x7f) > CAPTURE_KIND_LONG)
+            return false;
+        frame.remote = (*p & CAPTURE_REMOTE) != 0;
+        frame.len = lengths[*p++ & 0x7f];
+
+        if (!(p = get_zigzag(p, end, &delta)))
+            return false;
+        frame.timestamp += delta;
+        if (!(p = get_zigzag(p, end, &delta)))
+            return false;
+        frame.sys_timestamp += delta;
+
+        if (end - p < 1 + (ptrdiff_t) frame.len)
+            return false;
+        frame.signal = *p++;
+        memcpy(frame.msg, p, frame.len);
+        p += frame.len;
+
+        fn(&frame, arg);
+    }
+    return p == end;
+}
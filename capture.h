@@ -0,0 +1,74 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// capture.h: recording of the decoded frames and reading them back (header)
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+// A capture file is a file header followed by blocks, each a block header
+// and the records of up to CAPTURE_BLOCK_BYTES of frames:
+//
+//   file header   magic "RSBC", u16 version, u16 0, u64 start (ms since the epoch)
+//   block header  magic "RSBK", u32 length of the records, u32 record count,
+//                 u32 0, u64 12MHz timestamp, u64 system time (ms)
+//   record        u8 kind | remote flag, zigzag varint 12MHz timestamp delta,
+//                 zigzag varint system time delta, u8 signal, the message
+//
+// The deltas are to the previous record of the block, the first one's to
+// the block header, so that each block can be read on its own. The signal
+// is the byte of the Beast format, the message the frame as received,
+// before any error correction. All numbers are little endian.
+
+#define CAPTURE_MAGIC 0x43425352 // "RSBC"
+#define CAPTURE_BLOCK_MAGIC 0x4b425352 // "RSBK"
+#define CAPTURE_VERSION 1
+
+#define CAPTURE_HEADER_BYTES 16
+#define CAPTURE_BLOCK_HEADER_BYTES 32
+#define CAPTURE_BLOCK_BYTES (256 * 1024) // at most, header included
+
+#define CAPTURE_KIND_MODEAC 0
+#define CAPTURE_KIND_SHORT 1
+#define CAPTURE_KIND_LONG 2
+#define CAPTURE_REMOTE 0x80
+
+struct capture_frame {
+    uint64_t timestamp; // 12MHz
+    uint64_t sys_timestamp; // system time when received, ms
+    unsigned char signal; // as in the Beast format
+    bool remote;
+    unsigned len; // of msg: MODEAC_MSG_BYTES, MODES_SHORT_MSG_BYTES or MODES_LONG_MSG_BYTES
+    unsigned char msg[MODES_LONG_MSG_BYTES];
+};
+
+// --record: open Modes.record_file and start its writer thread
+bool captureStart(void);
+// Write out what has been recorded so far and close the file
+void captureStop(void);
+// Record a message passed to useModesMessage(); main thread only
+void captureMessage(const struct modesMessage *mm);
+// From the background work, flush a block that has waited too long
+void capturePeriodicWork(uint64_t now);
+
+// Reading: check a file header, returning its start time through *start
+bool captureCheckHeader(const unsigned char *p, uint64_t *start);
+// Length of the records following a block header, or -1 if it isn't one
+int captureBlockLength(const unsigned char *p);
+// Call fn for each record of the block at p, header included; false if it
+// is damaged, after the frames before the damage
+bool captureReadBlock(const unsigned char *p, size_t len, void (*fn)(const struct capture_frame *, void *), void *arg);
+
+#endif
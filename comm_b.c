@@ -36,7 +36,7 @@ static int decodeBDS40(struct modesMessage *mm, bool store);
 static int decodeBDS50(struct modesMessage *mm, bool store);
 static int decodeBDS60(struct modesMessage *mm, bool store);
 
-static CommBDecoderFn comm_b_decoders[] = {
+static CommBDecoderFn comm_b_decoders[COMMB_DECODERS] = {
     &decodeEmptyResponse,
     &decodeBDS10,
     &decodeBDS20,
@@ -47,7 +47,37 @@ static CommBDecoderFn comm_b_decoders[] = {
     &decodeBDS60
 };
 
+// Number of an aircraft's recent replies a decoder must have won before it
+// is tried first and decides ties
+#define COMMB_LIKELY_WINS 4
+
+// The most any decoder scores: from that one no other can do better, so the
+// search ends there. Lower scores are compared with all the others.
+#define COMMB_MAX_SCORE 56
+
+static void recordDecoder(struct commb_history *history, int decoder) {
+    if (++history->wins[decoder] > history->wins[history->likely])
+        history->likely = decoder;
+
+    // halve everything now and then so the history follows what the
+    // aircraft is currently being interrogated for
+    if (history->wins[decoder] >= 32) {
+        for (int i = 0; i < COMMB_DECODERS; ++i)
+            history->wins[i] >>= 1;
+    }
+}
+
 void decodeCommB(struct modesMessage *mm) {
+    decodeCommBWithHistory(mm, NULL);
+}
+
+// As decodeCommB(), using and updating the Comm-B history of the aircraft
+// that sent the reply (may be NULL). The decoder the aircraft's replies
+// usually match is tried first; if nothing can beat its score the others
+// are not tried at all, and if another one only ties with it, it wins
+// instead of the reply being ambiguous.
+
+void decodeCommBWithHistory(struct modesMessage *mm, struct commb_history *history) {
     mm->commb_format = COMMB_UNKNOWN;
 
     // If DR or UM are set, this message is _probably_ noise
@@ -59,26 +89,50 @@ void decodeCommB(struct modesMessage *mm) {
 
     // This is a bit hairy as we don't know what the requested register was
     int bestScore = 0;
-    CommBDecoderFn bestDecoder = NULL;
+    int bestDecoder = -1;
     int ambiguous = 0;
+    int likely = -1;
+    int likelyScore = 0;
+
+    if (history && history->wins[history->likely] >= COMMB_LIKELY_WINS) {
+        likely = history->likely;
+
+        likelyScore = comm_b_decoders[likely](mm, false);
+        if (likelyScore >= COMMB_MAX_SCORE) {
+            comm_b_decoders[likely](mm, true);
+            recordDecoder(history, likely);
+            return;
+        }
+    }
+
+    // the remaining decoders, in table order so the calls stay predictable
+    for (int i = 0; i < COMMB_DECODERS; ++i) {
+        if (i == likely)
+            continue;
 
-    for (unsigned i = 0; i < (sizeof (comm_b_decoders) / sizeof (comm_b_decoders[0])); ++i) {
         int score = comm_b_decoders[i](mm, false);
         if (score > bestScore) {
             bestScore = score;
-            bestDecoder = comm_b_decoders[i];
+            bestDecoder = i;
             ambiguous = 0;
         } else if (score == bestScore) {
             ambiguous = 1;
         }
     }
 
-    if (bestDecoder) {
+    if (likely >= 0 && likelyScore > 0 && likelyScore >= bestScore) {
+        bestDecoder = likely;
+        ambiguous = 0;
+    }
+
+    if (bestDecoder >= 0) {
         if (ambiguous) {
             mm->commb_format = COMMB_AMBIGUOUS;
         } else {
             // decode it
-            bestDecoder(mm, true);
+            comm_b_decoders[bestDecoder](mm, true);
+            if (history)
+                recordDecoder(history, bestDecoder);
         }
     }
 }
@@ -25,6 +25,16 @@
 #ifndef COMM_B_H
 #define COMM_B_H
 
+// Number of Comm-B decoders tried by decodeCommB()
+#define COMMB_DECODERS 8
+
+// Recent Comm-B formats of one aircraft, see decodeCommBWithHistory()
+struct commb_history {
+    uint8_t wins[COMMB_DECODERS]; // decaying count of replies won by each decoder
+    uint8_t likely; // decoder with the most wins
+};
+
 void decodeCommB(struct modesMessage *mm);
+void decodeCommBWithHistory(struct modesMessage *mm, struct commb_history *history);
 
 #endif
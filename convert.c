@@ -23,6 +23,17 @@
 
 #include "readsb.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CONVERT_X86
+#endif
+
+// the vector loads assume little endian sample data
+#if (defined(__ARM_NEON) || defined(__aarch64__)) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#include <arm_neon.h>
+#define CONVERT_NEON
+#endif
+
 struct converter_state {
     float dc_a;
     float dc_b;
@@ -422,31 +433,368 @@ static void convert_sc16q11_generic(void *iq_data,
     }
 }
 
+//
+// Vectorized converters
+//
+// These compute the magnitude directly rather than through a lookup table,
+// 8 samples at a time. The DC filter is a recursive filter and can't be
+// vectorized across samples, so with DC filtering only the filter itself
+// runs sample by sample and the magnitude is still computed 8 at a time.
+// Each kernel is written once and instantiated per input format and DC
+// filter setting with constant arguments.
+//
+
+// Read sample i from the input, scaled to -1..1
+
+static inline __attribute__ ((always_inline)) void read_iq(const void *iq_data, unsigned i, const input_format_t format, float *fI, float *fQ) {
+    if (format == INPUT_UC8) {
+        const uint8_t *in = iq_data;
+        *fI = (in[2 * i] - 127.5f) / 127.5f;
+        *fQ = (in[2 * i + 1] - 127.5f) / 127.5f;
+    } else {
+        const uint16_t *in = iq_data;
+        const float scale = (format == INPUT_SC16) ? 32768.0f : 2048.0f;
+        *fI = (int16_t) le16toh(in[2 * i]) / scale;
+        *fQ = (int16_t) le16toh(in[2 * i + 1]) / scale;
+    }
+}
+
+// Convert one sample the scalar way, used for the last nsamples % 8 samples
+
+static inline __attribute__ ((always_inline)) void convert_one(const void *iq_data, unsigned i, uint16_t *mag_data, const input_format_t format,
+        const bool filter_dc, float dc_a, float dc_b, float *z1_I, float *z1_Q, float *sum_level, float *sum_power) {
+    float fI, fQ, magsq, mag;
+
+    read_iq(iq_data, i, format, &fI, &fQ);
+
+    if (filter_dc) {
+        *z1_I = fI * dc_a + *z1_I * dc_b;
+        *z1_Q = fQ * dc_a + *z1_Q * dc_b;
+        fI -= *z1_I;
+        fQ -= *z1_Q;
+    }
+
+    magsq = fI * fI + fQ * fQ;
+    if (magsq > 1)
+        magsq = 1;
+
+    mag = sqrtf(magsq);
+    *sum_power += magsq;
+    *sum_level += mag;
+    mag_data[i] = (uint16_t) (mag * 65535.0f + 0.5f);
+}
+
+// Read and DC filter 8 samples starting at i into fI[] / fQ[]
+
+static inline __attribute__ ((always_inline)) void read_iq8_dc(const void *iq_data, unsigned i, const input_format_t format,
+        float dc_a, float dc_b, float *z1_I, float *z1_Q, float *fI, float *fQ) {
+    for (int k = 0; k < 8; ++k) {
+        read_iq(iq_data, i + k, format, &fI[k], &fQ[k]);
+        *z1_I = fI[k] * dc_a + *z1_I * dc_b;
+        *z1_Q = fQ[k] * dc_a + *z1_Q * dc_b;
+        fI[k] -= *z1_I;
+        fQ[k] -= *z1_Q;
+    }
+}
+
+#ifdef CONVERT_X86
+
+__attribute__ ((target("avx2")))
+static inline __attribute__ ((always_inline)) void convert_avx2(void *iq_data,
+        uint16_t *mag_data,
+        unsigned nsamples,
+        struct converter_state *state,
+        double *out_mean_level,
+        double *out_mean_power,
+        const input_format_t format,
+        const bool filter_dc) {
+    const __m128i deinterleave = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+    const __m256 uc8_offset = _mm256_set1_ps(127.5f);
+    const __m256 scale = _mm256_set1_ps(format == INPUT_UC8 ? 1 / 127.5f : (format == INPUT_SC16 ? 1 / 32768.0f : 1 / 2048.0f));
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 full_scale = _mm256_set1_ps(65535.0f);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    __m256 sum_level_v = _mm256_setzero_ps();
+    __m256 sum_power_v = _mm256_setzero_ps();
+    float z1_I = state->z1_I;
+    float z1_Q = state->z1_Q;
+    const float dc_a = state->dc_a;
+    const float dc_b = state->dc_b;
+    float sum_level = 0, sum_power = 0;
+    unsigned i;
+
+    for (i = 0; i + 8 <= nsamples; i += 8) {
+        __m256 fI, fQ;
+
+        if (filter_dc) {
+            float bufI[8], bufQ[8];
+            read_iq8_dc(iq_data, i, format, dc_a, dc_b, &z1_I, &z1_Q, bufI, bufQ);
+            fI = _mm256_loadu_ps(bufI);
+            fQ = _mm256_loadu_ps(bufQ);
+        } else if (format == INPUT_UC8) {
+            __m128i iq = _mm_loadu_si128((const __m128i *) ((const uint8_t *) iq_data + 2 * i));
+            iq = _mm_shuffle_epi8(iq, deinterleave);
+            fI = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(iq));
+            fQ = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(iq, 8)));
+            fI = _mm256_mul_ps(_mm256_sub_ps(fI, uc8_offset), scale);
+            fQ = _mm256_mul_ps(_mm256_sub_ps(fQ, uc8_offset), scale);
+        } else {
+            // I in the low, Q in the high half of each 32 bit lane
+            __m256i iq = _mm256_loadu_si256((const __m256i *) ((const uint16_t *) iq_data + 2 * i));
+            fI = _mm256_cvtepi32_ps(_mm256_srai_epi32(_mm256_slli_epi32(iq, 16), 16));
+            fQ = _mm256_cvtepi32_ps(_mm256_srai_epi32(iq, 16));
+            fI = _mm256_mul_ps(fI, scale);
+            fQ = _mm256_mul_ps(fQ, scale);
+        }
+
+        __m256 magsq = _mm256_min_ps(_mm256_add_ps(_mm256_mul_ps(fI, fI), _mm256_mul_ps(fQ, fQ)), one);
+        __m256 mag = _mm256_sqrt_ps(magsq);
+        sum_level_v = _mm256_add_ps(sum_level_v, mag);
+        sum_power_v = _mm256_add_ps(sum_power_v, magsq);
+
+        __m256i mag32 = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(mag, full_scale), half));
+        __m128i mag16 = _mm_packus_epi32(_mm256_castsi256_si128(mag32), _mm256_extracti128_si256(mag32, 1));
+        _mm_storeu_si128((__m128i *) &mag_data[i], mag16);
+    }
+
+    for (; i < nsamples; ++i)
+        convert_one(iq_data, i, mag_data, format, filter_dc, dc_a, dc_b, &z1_I, &z1_Q, &sum_level, &sum_power);
+
+    __m128 level4 = _mm_add_ps(_mm256_castps256_ps128(sum_level_v), _mm256_extractf128_ps(sum_level_v, 1));
+    __m128 power4 = _mm_add_ps(_mm256_castps256_ps128(sum_power_v), _mm256_extractf128_ps(sum_power_v, 1));
+    level4 = _mm_hadd_ps(level4, level4);
+    power4 = _mm_hadd_ps(power4, power4);
+    sum_level += _mm_cvtss_f32(_mm_hadd_ps(level4, level4));
+    sum_power += _mm_cvtss_f32(_mm_hadd_ps(power4, power4));
+
+    if (filter_dc) {
+        state->z1_I = z1_I;
+        state->z1_Q = z1_Q;
+    }
+
+    if (out_mean_level) {
+        *out_mean_level = sum_level / nsamples;
+    }
+
+    if (out_mean_power) {
+        *out_mean_power = sum_power / nsamples;
+    }
+}
+
+#define CONVERT_AVX2(name, format, filter_dc) \
+    __attribute__ ((target("avx2"))) \
+    static void name(void *iq_data, uint16_t *mag_data, unsigned nsamples, struct converter_state *state, \
+            double *out_mean_level, double *out_mean_power) { \
+        convert_avx2(iq_data, mag_data, nsamples, state, out_mean_level, out_mean_power, format, filter_dc); \
+    }
+
+CONVERT_AVX2(convert_uc8_nodc_avx2, INPUT_UC8, false)
+CONVERT_AVX2(convert_uc8_avx2, INPUT_UC8, true)
+CONVERT_AVX2(convert_sc16_nodc_avx2, INPUT_SC16, false)
+CONVERT_AVX2(convert_sc16_avx2, INPUT_SC16, true)
+CONVERT_AVX2(convert_sc16q11_nodc_avx2, INPUT_SC16Q11, false)
+CONVERT_AVX2(convert_sc16q11_avx2, INPUT_SC16Q11, true)
+
+#undef CONVERT_AVX2
+
+static bool cpu_has_avx2(void) {
+    return __builtin_cpu_supports("avx2");
+}
+
+#endif /* CONVERT_X86 */
+
+#ifdef CONVERT_NEON
+
+static inline __attribute__ ((always_inline)) float32x4_t sqrt_neon(float32x4_t x) {
+#ifdef __aarch64__
+    return vsqrtq_f32(x);
+#else
+    // reciprocal square root estimate refined by two Newton-Raphson steps,
+    // x == 0 gives 0 * inf and is masked to 0
+    float32x4_t r = vrsqrteq_f32(x);
+    r = vmulq_f32(r, vrsqrtsq_f32(vmulq_f32(x, r), r));
+    r = vmulq_f32(r, vrsqrtsq_f32(vmulq_f32(x, r), r));
+    uint32x4_t nonzero = vcgtq_f32(x, vdupq_n_f32(0));
+    return vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(vmulq_f32(x, r)), nonzero));
+#endif
+}
+
+static inline __attribute__ ((always_inline)) float hsum_neon(float32x4_t v) {
+    float32x2_t s = vadd_f32(vget_low_f32(v), vget_high_f32(v));
+    return vget_lane_f32(vpadd_f32(s, s), 0);
+}
+
+static inline __attribute__ ((always_inline)) uint16x4_t mag4_neon(float32x4_t fI, float32x4_t fQ, float32x4_t *sum_level, float32x4_t *sum_power) {
+    float32x4_t magsq = vminq_f32(vaddq_f32(vmulq_f32(fI, fI), vmulq_f32(fQ, fQ)), vdupq_n_f32(1.0f));
+    float32x4_t mag = sqrt_neon(magsq);
+    *sum_level = vaddq_f32(*sum_level, mag);
+    *sum_power = vaddq_f32(*sum_power, magsq);
+    return vmovn_u32(vcvtq_u32_f32(vaddq_f32(vmulq_f32(mag, vdupq_n_f32(65535.0f)), vdupq_n_f32(0.5f))));
+}
+
+static inline __attribute__ ((always_inline)) void convert_neon(void *iq_data,
+        uint16_t *mag_data,
+        unsigned nsamples,
+        struct converter_state *state,
+        double *out_mean_level,
+        double *out_mean_power,
+        const input_format_t format,
+        const bool filter_dc) {
+    const float32x4_t uc8_offset = vdupq_n_f32(127.5f);
+    const float32x4_t scale = vdupq_n_f32(format == INPUT_UC8 ? 1 / 127.5f : (format == INPUT_SC16 ? 1 / 32768.0f : 1 / 2048.0f));
+    float32x4_t sum_level_v = vdupq_n_f32(0);
+    float32x4_t sum_power_v = vdupq_n_f32(0);
+    float z1_I = state->z1_I;
+    float z1_Q = state->z1_Q;
+    const float dc_a = state->dc_a;
+    const float dc_b = state->dc_b;
+    float sum_level = 0, sum_power = 0;
+    unsigned i;
+
+    for (i = 0; i + 8 <= nsamples; i += 8) {
+        float32x4_t fI_lo, fI_hi, fQ_lo, fQ_hi;
+
+        if (filter_dc) {
+            float bufI[8], bufQ[8];
+            read_iq8_dc(iq_data, i, format, dc_a, dc_b, &z1_I, &z1_Q, bufI, bufQ);
+            fI_lo = vld1q_f32(bufI);
+            fI_hi = vld1q_f32(bufI + 4);
+            fQ_lo = vld1q_f32(bufQ);
+            fQ_hi = vld1q_f32(bufQ + 4);
+        } else if (format == INPUT_UC8) {
+            uint8x8x2_t iq = vld2_u8((const uint8_t *) iq_data + 2 * i);
+            uint16x8_t I = vmovl_u8(iq.val[0]);
+            uint16x8_t Q = vmovl_u8(iq.val[1]);
+            fI_lo = vmulq_f32(vsubq_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(I))), uc8_offset), scale);
+            fI_hi = vmulq_f32(vsubq_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(I))), uc8_offset), scale);
+            fQ_lo = vmulq_f32(vsubq_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(Q))), uc8_offset), scale);
+            fQ_hi = vmulq_f32(vsubq_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(Q))), uc8_offset), scale);
+        } else {
+            int16x8x2_t iq = vld2q_s16((const int16_t *) iq_data + 2 * i);
+            fI_lo = vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(iq.val[0]))), scale);
+            fI_hi = vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(iq.val[0]))), scale);
+            fQ_lo = vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(iq.val[1]))), scale);
+            fQ_hi = vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(iq.val[1]))), scale);
+        }
+
+        uint16x4_t lo = mag4_neon(fI_lo, fQ_lo, &sum_level_v, &sum_power_v);
+        uint16x4_t hi = mag4_neon(fI_hi, fQ_hi, &sum_level_v, &sum_power_v);
+        vst1q_u16(&mag_data[i], vcombine_u16(lo, hi));
+    }
+
+    for (; i < nsamples; ++i)
+        convert_one(iq_data, i, mag_data, format, filter_dc, dc_a, dc_b, &z1_I, &z1_Q, &sum_level, &sum_power);
+
+    sum_level += hsum_neon(sum_level_v);
+    sum_power += hsum_neon(sum_power_v);
+
+    if (filter_dc) {
+        state->z1_I = z1_I;
+        state->z1_Q = z1_Q;
+    }
+
+    if (out_mean_level) {
+        *out_mean_level = sum_level / nsamples;
+    }
+
+    if (out_mean_power) {
+        *out_mean_power = sum_power / nsamples;
+    }
+}
+
+#define CONVERT_NEON_FN(name, format, filter_dc) \
+    static void name(void *iq_data, uint16_t *mag_data, unsigned nsamples, struct converter_state *state, \
+            double *out_mean_level, double *out_mean_power) { \
+        convert_neon(iq_data, mag_data, nsamples, state, out_mean_level, out_mean_power, format, filter_dc); \
+    }
+
+CONVERT_NEON_FN(convert_uc8_nodc_neon, INPUT_UC8, false)
+CONVERT_NEON_FN(convert_uc8_neon, INPUT_UC8, true)
+CONVERT_NEON_FN(convert_sc16_nodc_neon, INPUT_SC16, false)
+CONVERT_NEON_FN(convert_sc16_neon, INPUT_SC16, true)
+CONVERT_NEON_FN(convert_sc16q11_nodc_neon, INPUT_SC16Q11, false)
+CONVERT_NEON_FN(convert_sc16q11_neon, INPUT_SC16Q11, true)
+
+#undef CONVERT_NEON_FN
+
+#endif /* CONVERT_NEON */
+
 static struct {
     input_format_t format;
     int can_filter_dc;
     iq_convert_fn fn;
     const char *description;
     bool(*init)();
+    bool (*supported)(void);
 } converters_table[] = {
     // In order of preference
-    { INPUT_UC8, 0, convert_uc8_nodc, "UC8, integer/table path", init_uc8_lookup},
-    { INPUT_UC8, 1, convert_uc8_generic, "UC8, float path", NULL},
-    { INPUT_SC16, 0, convert_sc16_nodc, "SC16, float path, no DC", NULL},
-    { INPUT_SC16, 1, convert_sc16_generic, "SC16, float path", NULL},
+#ifdef CONVERT_X86
+    { INPUT_UC8, 0, convert_uc8_nodc_avx2, "UC8, AVX2 path, no DC", NULL, cpu_has_avx2},
+#endif
+#ifdef CONVERT_NEON
+    { INPUT_UC8, 0, convert_uc8_nodc_neon, "UC8, NEON path, no DC", NULL, NULL},
+#endif
+    { INPUT_UC8, 0, convert_uc8_nodc, "UC8, integer/table path", init_uc8_lookup, NULL},
+#ifdef CONVERT_X86
+    { INPUT_UC8, 1, convert_uc8_avx2, "UC8, AVX2 path", NULL, cpu_has_avx2},
+#endif
+#ifdef CONVERT_NEON
+    { INPUT_UC8, 1, convert_uc8_neon, "UC8, NEON path", NULL, NULL},
+#endif
+    { INPUT_UC8, 1, convert_uc8_generic, "UC8, float path", NULL, NULL},
+#ifdef CONVERT_X86
+    { INPUT_SC16, 0, convert_sc16_nodc_avx2, "SC16, AVX2 path, no DC", NULL, cpu_has_avx2},
+#endif
+#ifdef CONVERT_NEON
+    { INPUT_SC16, 0, convert_sc16_nodc_neon, "SC16, NEON path, no DC", NULL, NULL},
+#endif
+    { INPUT_SC16, 0, convert_sc16_nodc, "SC16, float path, no DC", NULL, NULL},
+#ifdef CONVERT_X86
+    { INPUT_SC16, 1, convert_sc16_avx2, "SC16, AVX2 path", NULL, cpu_has_avx2},
+#endif
+#ifdef CONVERT_NEON
+    { INPUT_SC16, 1, convert_sc16_neon, "SC16, NEON path", NULL, NULL},
+#endif
+    { INPUT_SC16, 1, convert_sc16_generic, "SC16, float path", NULL, NULL},
+#ifdef CONVERT_X86
+    { INPUT_SC16Q11, 0, convert_sc16q11_nodc_avx2, "SC16Q11, AVX2 path, no DC", NULL, cpu_has_avx2},
+#endif
+#ifdef CONVERT_NEON
+    { INPUT_SC16Q11, 0, convert_sc16q11_nodc_neon, "SC16Q11, NEON path, no DC", NULL, NULL},
+#endif
 #if defined(SC16Q11_TABLE_BITS)
-    { INPUT_SC16Q11, 0, convert_sc16q11_table, "SC16Q11, integer/table path", init_sc16q11_lookup},
+    { INPUT_SC16Q11, 0, convert_sc16q11_table, "SC16Q11, integer/table path", init_sc16q11_lookup, NULL},
 #else
-    { INPUT_SC16Q11, 0, convert_sc16q11_nodc, "SC16Q11, float path, no DC", NULL},
+    { INPUT_SC16Q11, 0, convert_sc16q11_nodc, "SC16Q11, float path, no DC", NULL, NULL},
+#endif
+#ifdef CONVERT_X86
+    { INPUT_SC16Q11, 1, convert_sc16q11_avx2, "SC16Q11, AVX2 path", NULL, cpu_has_avx2},
 #endif
-    { INPUT_SC16Q11, 1, convert_sc16q11_generic, "SC16Q11, float path", NULL},
-    { 0, 0, NULL, NULL, NULL}
+#ifdef CONVERT_NEON
+    { INPUT_SC16Q11, 1, convert_sc16q11_neon, "SC16Q11, NEON path", NULL, NULL},
+#endif
+    { INPUT_SC16Q11, 1, convert_sc16q11_generic, "SC16Q11, float path", NULL, NULL},
+    { 0, 0, NULL, NULL, NULL, NULL}
 };
 
 iq_convert_fn init_converter(input_format_t format,
         double sample_rate,
         int filter_dc,
         struct converter_state **out_state) {
+    return init_converter_impl(format, sample_rate, filter_dc, 0, NULL, out_state);
+}
+
+// As init_converter(), but select the index'th of the converters usable on
+// this CPU for the format, in order of preference; 0 is the one
+// init_converter() picks. Returns NULL without complaint past the last one.
+
+iq_convert_fn init_converter_impl(input_format_t format,
+        double sample_rate,
+        int filter_dc,
+        unsigned index,
+        const char **out_description,
+        struct converter_state **out_state) {
+    unsigned found = 0;
     int i;
 
     for (i = 0; converters_table[i].fn; ++i) {
@@ -454,11 +802,15 @@ iq_convert_fn init_converter(input_format_t format,
             continue;
         if (filter_dc && !converters_table[i].can_filter_dc)
             continue;
-        break;
+        if (converters_table[i].supported && !converters_table[i].supported())
+            continue;
+        if (found++ == index)
+            break;
     }
 
     if (!converters_table[i].fn) {
-        fprintf(stderr, "no suitable converter for format=%d dc=%d\n",
+        if (index == 0)
+            fprintf(stderr, "no suitable converter for format=%d dc=%d\n",
                 format, filter_dc);
         return NULL;
     }
@@ -487,13 +839,18 @@ iq_convert_fn init_converter(input_format_t format,
         (*out_state)->dc_a = 0.0;
     }
 
+    if (out_description)
+        *out_description = converters_table[i].description;
+
     return converters_table[i].fn;
 }
 
 void cleanup_converter(struct converter_state *state) {
     free(state);
     free(uc8_lookup);
+    uc8_lookup = NULL;
 #if defined(SC16Q11_TABLE_BITS)
     free(sc16q11_lookup);
+    sc16q11_lookup = NULL;
 #endif
 }
@@ -42,6 +42,13 @@ iq_convert_fn init_converter(input_format_t format,
         int filter_dc,
         struct converter_state **out_state);
 
+iq_convert_fn init_converter_impl(input_format_t format,
+        double sample_rate,
+        int filter_dc,
+        unsigned index,
+        const char **out_description,
+        struct converter_state **out_state);
+
 void cleanup_converter(struct converter_state *state);
 
 #endif
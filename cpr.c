@@ -52,6 +52,7 @@
 // OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <math.h>
+#include <stdint.h>
 #include <stdio.h>
 #include "cpr.h"
 
@@ -61,92 +62,79 @@
 // Always positive MOD operation, used for CPR decoding.
 //
 
-static int cprModInt(int a, int b) {
+static inline int cprModInt(int a, int b) {
     int res = a % b;
     if (res < 0) res += b;
     return res;
 }
 
-static double cprModDouble(double a, double b) {
+static inline double cprModDouble(double a, double b) {
     double res = fmod(a, b);
     if (res < 0) res += b;
     return res;
 }
 
+// floor() for the small values seen here, without a libm call
+// when the compiler can't inline it
+
+static inline int cprFloor(double x) {
+    int i = (int) x;
+    return i - (x < i);
+}
+
 //
 //=========================================================================
 //
 // The NL function uses the precomputed table from 1090-WP-9-14
 //
-
-static int cprNLFunction(double lat) {
+// NL drops by one at each of these latitudes, from 59 at the equator down
+// to 1 from 87 degrees.
+//
+
+static const double cpr_nl_transitions[58] = {
+    10.47047130, 14.82817437, 18.18626357, 21.02939493,
+    23.54504487, 25.82924707, 27.93898710, 29.91135686,
+    31.77209708, 33.53993436, 35.22899598, 36.85025108,
+    38.41241892, 39.92256684, 41.38651832, 42.80914012,
+    44.19454951, 45.54626723, 46.86733252, 48.16039128,
+    49.42776439, 50.67150166, 51.89342469, 53.09516153,
+    54.27817472, 55.44378444, 56.59318756, 57.72747354,
+    58.84763776, 59.95459277, 61.04917774, 62.13216659,
+    63.20427479, 64.26616523, 65.31845310, 66.36171008,
+    67.39646774, 68.42322022, 69.44242631, 70.45451075,
+    71.45986473, 72.45884545, 73.45177442, 74.43893416,
+    75.42056257, 76.39684391, 77.36789461, 78.33374083,
+    79.29428225, 80.24923213, 81.19801349, 82.13956981,
+    83.07199445, 83.99173563, 84.89166191, 85.75541621,
+    86.53536998, 87.00000000
+};
+
+// Index of the first transition at or above each whole degree of latitude
+// below 87. No degree holds more than two transitions, so two comparisons
+// finish the lookup without any data dependent branches.
+
+static const uint8_t cpr_nl_index[87] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2,
+    2, 2, 2, 3, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8,
+    9, 9, 10, 10, 11, 12, 12, 13, 14, 14, 15, 16, 16, 17, 18, 19,
+    19, 20, 21, 22, 23, 23, 24, 25, 26, 27, 28, 29, 30, 30, 31, 32,
+    33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47, 48,
+    49, 50, 51, 52, 54, 55, 56
+};
+
+int cprNLFunction(double lat) {
     if (lat < 0) lat = -lat; // Table is simmetric about the equator
-    if (lat < 10.47047130) return 59;
-    if (lat < 14.82817437) return 58;
-    if (lat < 18.18626357) return 57;
-    if (lat < 21.02939493) return 56;
-    if (lat < 23.54504487) return 55;
-    if (lat < 25.82924707) return 54;
-    if (lat < 27.93898710) return 53;
-    if (lat < 29.91135686) return 52;
-    if (lat < 31.77209708) return 51;
-    if (lat < 33.53993436) return 50;
-    if (lat < 35.22899598) return 49;
-    if (lat < 36.85025108) return 48;
-    if (lat < 38.41241892) return 47;
-    if (lat < 39.92256684) return 46;
-    if (lat < 41.38651832) return 45;
-    if (lat < 42.80914012) return 44;
-    if (lat < 44.19454951) return 43;
-    if (lat < 45.54626723) return 42;
-    if (lat < 46.86733252) return 41;
-    if (lat < 48.16039128) return 40;
-    if (lat < 49.42776439) return 39;
-    if (lat < 50.67150166) return 38;
-    if (lat < 51.89342469) return 37;
-    if (lat < 53.09516153) return 36;
-    if (lat < 54.27817472) return 35;
-    if (lat < 55.44378444) return 34;
-    if (lat < 56.59318756) return 33;
-    if (lat < 57.72747354) return 32;
-    if (lat < 58.84763776) return 31;
-    if (lat < 59.95459277) return 30;
-    if (lat < 61.04917774) return 29;
-    if (lat < 62.13216659) return 28;
-    if (lat < 63.20427479) return 27;
-    if (lat < 64.26616523) return 26;
-    if (lat < 65.31845310) return 25;
-    if (lat < 66.36171008) return 24;
-    if (lat < 67.39646774) return 23;
-    if (lat < 68.42322022) return 22;
-    if (lat < 69.44242631) return 21;
-    if (lat < 70.45451075) return 20;
-    if (lat < 71.45986473) return 19;
-    if (lat < 72.45884545) return 18;
-    if (lat < 73.45177442) return 17;
-    if (lat < 74.43893416) return 16;
-    if (lat < 75.42056257) return 15;
-    if (lat < 76.39684391) return 14;
-    if (lat < 77.36789461) return 13;
-    if (lat < 78.33374083) return 12;
-    if (lat < 79.29428225) return 11;
-    if (lat < 80.24923213) return 10;
-    if (lat < 81.19801349) return 9;
-    if (lat < 82.13956981) return 8;
-    if (lat < 83.07199445) return 7;
-    if (lat < 83.99173563) return 6;
-    if (lat < 84.89166191) return 5;
-    if (lat < 85.75541621) return 4;
-    if (lat < 86.53536998) return 3;
-    if (lat < 87.00000000) return 2;
-    else return 1;
+    if (!(lat < 87.0)) return 1;
+
+    int i = cpr_nl_index[(int) lat];
+    return 59 - i - (lat >= cpr_nl_transitions[i]) - (lat >= cpr_nl_transitions[i + 1]);
 }
 //
 //=========================================================================
 //
 
-static int cprNFunction(double lat, int fflag) {
-    int nl = cprNLFunction(lat) - (fflag ? 1 : 0);
+static inline int cprNFunction(int nl, int fflag) {
+    nl -= (fflag ? 1 : 0);
     if (nl < 1) nl = 1;
     return nl;
 }
@@ -154,8 +142,8 @@ static int cprNFunction(double lat, int fflag) {
 //=========================================================================
 //
 
-static double cprDlonFunction(double lat, int fflag, int surface) {
-    return (surface ? 90.0 : 360.0) / cprNFunction(lat, fflag);
+static inline double cprDlonFunction(int nl, int fflag, int surface) {
+    return (surface ? 90.0 : 360.0) / cprNFunction(nl, fflag);
 }
 //
 //=========================================================================
@@ -167,7 +155,7 @@ static double cprDlonFunction(double lat, int fflag, int surface) {
 // 1) 131072 is 2^17 since CPR latitude and longitude are encoded in 17 bits.
 //
 
-int decodeCPRairborne(int even_cprlat, int even_cprlon,
+static inline int cprAirborne(int even_cprlat, int even_cprlon,
         int odd_cprlat, int odd_cprlon,
         int fflag,
         double *out_lat, double *out_lon) {
@@ -181,7 +169,7 @@ int decodeCPRairborne(int even_cprlat, int even_cprlon,
     double rlat, rlon;
 
     // Compute the Latitude Index "j"
-    int j = (int) floor(((59 * lat0 - 60 * lat1) / 131072) + 0.5);
+    int j = cprFloor(((59 * lat0 - 60 * lat1) / 131072) + 0.5);
     double rlat0 = AirDlat0 * (cprModInt(j, 60) + lat0 / 131072);
     double rlat1 = AirDlat1 * (cprModInt(j, 59) + lat1 / 131072);
 
@@ -193,26 +181,24 @@ int decodeCPRairborne(int even_cprlat, int even_cprlon,
         return (-2); // bad data
 
     // Check that both are in the same latitude zone, or abort.
-    if (cprNLFunction(rlat0) != cprNLFunction(rlat1))
+    int nl = cprNLFunction(rlat0);
+    if (nl != cprNLFunction(rlat1))
         return (-1); // positions crossed a latitude zone, try again later
 
     // Compute ni and the Longitude Index "m"
+    int m = cprFloor((((lon0 * (nl - 1)) - (lon1 * nl)) / 131072.0) + 0.5);
     if (fflag) { // Use odd packet.
-        int ni = cprNFunction(rlat1, 1);
-        int m = (int) floor((((lon0 * (cprNLFunction(rlat1) - 1)) -
-                (lon1 * cprNLFunction(rlat1))) / 131072.0) + 0.5);
-        rlon = cprDlonFunction(rlat1, 1, 0) * (cprModInt(m, ni) + lon1 / 131072);
+        int ni = cprNFunction(nl, 1);
+        rlon = cprDlonFunction(nl, 1, 0) * (cprModInt(m, ni) + lon1 / 131072);
         rlat = rlat1;
     } else { // Use even packet.
-        int ni = cprNFunction(rlat0, 0);
-        int m = (int) floor((((lon0 * (cprNLFunction(rlat0) - 1)) -
-                (lon1 * cprNLFunction(rlat0))) / 131072) + 0.5);
-        rlon = cprDlonFunction(rlat0, 0, 0) * (cprModInt(m, ni) + lon0 / 131072);
+        int ni = cprNFunction(nl, 0);
+        rlon = cprDlonFunction(nl, 0, 0) * (cprModInt(m, ni) + lon0 / 131072);
         rlat = rlat0;
     }
 
     // Renormalize to -180 .. +180
-    rlon -= floor((rlon + 180) / 360) * 360;
+    rlon -= cprFloor((rlon + 180) / 360) * 360.0;
 
     *out_lat = rlat;
     *out_lon = rlon;
@@ -220,7 +206,7 @@ int decodeCPRairborne(int even_cprlat, int even_cprlon,
     return 0;
 }
 
-int decodeCPRsurface(double reflat, double reflon,
+static inline int cprSurface(double reflat, double reflon,
         int even_cprlat, int even_cprlon,
         int odd_cprlat, int odd_cprlon,
         int fflag,
@@ -234,7 +220,7 @@ int decodeCPRsurface(double reflat, double reflon,
     double rlon, rlat;
 
     // Compute the Latitude Index "j"
-    int j = (int) floor(((59 * lat0 - 60 * lat1) / 131072) + 0.5);
+    int j = cprFloor(((59 * lat0 - 60 * lat1) / 131072) + 0.5);
     double rlat0 = AirDlat0 * (cprModInt(j, 60) + lat0 / 131072);
     double rlat1 = AirDlat1 * (cprModInt(j, 59) + lat1 / 131072);
 
@@ -284,21 +270,19 @@ int decodeCPRsurface(double reflat, double reflon,
         return (-2); // bad data
 
     // Check that both are in the same latitude zone, or abort.
-    if (cprNLFunction(rlat0) != cprNLFunction(rlat1))
+    int nl = cprNLFunction(rlat0);
+    if (nl != cprNLFunction(rlat1))
         return (-1); // positions crossed a latitude zone, try again later
 
     // Compute ni and the Longitude Index "m"
+    int m = cprFloor((((lon0 * (nl - 1)) - (lon1 * nl)) / 131072.0) + 0.5);
     if (fflag) { // Use odd packet.
-        int ni = cprNFunction(rlat1, 1);
-        int m = (int) floor((((lon0 * (cprNLFunction(rlat1) - 1)) -
-                (lon1 * cprNLFunction(rlat1))) / 131072.0) + 0.5);
-        rlon = cprDlonFunction(rlat1, 1, 1) * (cprModInt(m, ni) + lon1 / 131072);
+        int ni = cprNFunction(nl, 1);
+        rlon = cprDlonFunction(nl, 1, 1) * (cprModInt(m, ni) + lon1 / 131072);
         rlat = rlat1;
     } else { // Use even packet.
-        int ni = cprNFunction(rlat0, 0);
-        int m = (int) floor((((lon0 * (cprNLFunction(rlat0) - 1)) -
-                (lon1 * cprNLFunction(rlat0))) / 131072) + 0.5);
-        rlon = cprDlonFunction(rlat0, 0, 1) * (cprModInt(m, ni) + lon0 / 131072);
+        int ni = cprNFunction(nl, 0);
+        rlon = cprDlonFunction(nl, 0, 1) * (cprModInt(m, ni) + lon0 / 131072);
         rlat = rlat0;
     }
 
@@ -308,16 +292,53 @@ int decodeCPRsurface(double reflat, double reflon,
     // quadrants are valid.
 
     // if reflon is more than 45 degrees away, move some multiple of 90 degrees towards it
-    rlon += floor((reflon - rlon + 45) / 90) * 90; // this might move us outside (-180..+180), we fix this below
+    rlon += cprFloor((reflon - rlon + 45) / 90) * 90.0; // this might move us outside (-180..+180), we fix this below
 
     // Renormalize to -180 .. +180
-    rlon -= floor((rlon + 180) / 360) * 360;
+    rlon -= cprFloor((rlon + 180) / 360) * 360.0;
 
     *out_lat = rlat;
     *out_lon = rlon;
     return 0;
 }
 
+int decodeCPRairborne(int even_cprlat, int even_cprlon,
+        int odd_cprlat, int odd_cprlon,
+        int fflag,
+        double *out_lat, double *out_lon) {
+    return cprAirborne(even_cprlat, even_cprlon, odd_cprlat, odd_cprlon, fflag, out_lat, out_lon);
+}
+
+int decodeCPRsurface(double reflat, double reflon,
+        int even_cprlat, int even_cprlon,
+        int odd_cprlat, int odd_cprlon,
+        int fflag,
+        double *out_lat, double *out_lon) {
+    return cprSurface(reflat, reflon, even_cprlat, even_cprlon, odd_cprlat, odd_cprlon, fflag, out_lat, out_lon);
+}
+
+//
+//=========================================================================
+//
+// Batch versions of the above: decode count pairs in one call, so the
+// loop over them is compiled with the decoder inlined and the independent
+// pairs can overlap in the CPU pipeline.
+//
+
+void decodeCPRairborneBatch(struct cpr_pair *pairs, unsigned count) {
+    for (unsigned i = 0; i < count; ++i) {
+        struct cpr_pair *p = &pairs[i];
+        p->result = cprAirborne(p->even_cprlat, p->even_cprlon, p->odd_cprlat, p->odd_cprlon, p->fflag, &p->lat, &p->lon);
+    }
+}
+
+void decodeCPRsurfaceBatch(struct cpr_pair *pairs, unsigned count) {
+    for (unsigned i = 0; i < count; ++i) {
+        struct cpr_pair *p = &pairs[i];
+        p->result = cprSurface(p->reflat, p->reflon, p->even_cprlat, p->even_cprlon, p->odd_cprlat, p->odd_cprlon, p->fflag, &p->lat, &p->lon);
+    }
+}
+
 //
 //=========================================================================
 //
@@ -343,8 +364,8 @@ int decodeCPRrelative(double reflat, double reflon,
     AirDlat = (surface ? 90.0 : 360.0) / (fflag ? 59.0 : 60.0);
 
     // Compute the Latitude Index "j"
-    j = (int) (floor(reflat / AirDlat) +
-            floor(0.5 + cprModDouble(reflat, AirDlat) / AirDlat - fractional_lat));
+    j = cprFloor(reflat / AirDlat) +
+            cprFloor(0.5 + cprModDouble(reflat, AirDlat) / AirDlat - fractional_lat);
     rlat = AirDlat * (j + fractional_lat);
     if (rlat >= 270) rlat -= 360;
 
@@ -359,9 +380,9 @@ int decodeCPRrelative(double reflat, double reflon,
     }
 
     // Compute the Longitude Index "m"
-    AirDlon = cprDlonFunction(rlat, fflag, surface);
-    m = (int) (floor(reflon / AirDlon) +
-            floor(0.5 + cprModDouble(reflon, AirDlon) / AirDlon - fractional_lon));
+    AirDlon = cprDlonFunction(cprNLFunction(rlat), fflag, surface);
+    m = cprFloor(reflon / AirDlon) +
+            cprFloor(0.5 + cprModDouble(reflon, AirDlon) / AirDlon - fractional_lon);
     rlon = AirDlon * (m + fractional_lon);
     if (rlon > 180) rlon -= 360;
 
@@ -24,6 +24,19 @@
 #ifndef CPR_H
 #define CPR_H
 
+// One even/odd message pair for decodeCPRairborneBatch() and
+// decodeCPRsurfaceBatch()
+struct cpr_pair {
+    int even_cprlat, even_cprlon; // input: raw CPR values, even message
+    int odd_cprlat, odd_cprlon; // input: raw CPR values, odd message
+    int fflag; // input: 1 if the odd message is the latest
+    double reflat, reflon; // input: reference location, surface positions only
+    int result; // output: as returned by decodeCPRairborne() / decodeCPRsurface()
+    double lat, lon; // output: decoded position if result is 0
+};
+
+int cprNLFunction(double lat);
+
 int decodeCPRairborne(int even_cprlat, int even_cprlon,
         int odd_cprlat, int odd_cprlon,
         int fflag,
@@ -40,4 +53,7 @@ int decodeCPRrelative(double reflat, double reflon,
         int fflag, int surface,
         double *out_lat, double *out_lon);
 
+void decodeCPRairborneBatch(struct cpr_pair *pairs, unsigned count);
+void decodeCPRsurfaceBatch(struct cpr_pair *pairs, unsigned count);
+
 #endif
@@ -23,6 +23,9 @@
 
 #include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "cpr.h"
 
@@ -306,10 +309,226 @@ static int testCPRRelative() {
     return ok;
 }
 
-int main(int __attribute__ ((unused)) argc, char __attribute__ ((unused)) **argv) {
+// Check the NL lookup against the closed form from 1090-WP-9-14 (A.1.7.2),
+// away from the transition latitudes where rounding decides.
+
+static int testCPRNL() {
+    int ok = 1;
+    unsigned checked = 0;
+
+    for (int i = -90000; i <= 90000; ++i) {
+        double lat = i / 1000.0;
+        double x = 1 - (1 - cos(M_PI / 30)) / pow(cos(M_PI / 180 * lat), 2);
+        int expected = (fabs(lat) >= 87.0) ? 1 : (int) floor(2 * M_PI / acos(x));
+
+        if (fabs(lat) < 87.0 && fabs(2 * M_PI / acos(x) - floor(2 * M_PI / acos(x) + 0.5)) < 1e-6)
+            continue; // at a transition
+
+        if (cprNLFunction(lat) != expected) {
+            ok = 0;
+            fprintf(stderr, "testCPRNL:  FAIL: cprNLFunction(%.3f) = %d (expected %d)\n", lat, cprNLFunction(lat), expected);
+        }
+        checked++;
+    }
+
+    if (ok)
+        fprintf(stderr, "testCPRNL:  PASS (%u latitudes)\n", checked);
+    return ok;
+}
+
+// The batch decoders must agree exactly with the single pair versions
+
+static int testCPRBatch() {
+    int ok = 1;
+    unsigned i, n = 0;
+    struct cpr_pair pairs[2 * (sizeof (cprGlobalAirborneTests) / sizeof (cprGlobalAirborneTests[0]) + sizeof (cprGlobalSurfaceTests) / sizeof (cprGlobalSurfaceTests[0]))];
+    unsigned airborne;
+
+    memset(pairs, 0, sizeof (pairs));
+    for (i = 0; i < sizeof (cprGlobalAirborneTests) / sizeof (cprGlobalAirborneTests[0]); ++i) {
+        for (int fflag = 0; fflag <= 1; ++fflag, ++n) {
+            pairs[n].even_cprlat = cprGlobalAirborneTests[i].even_cprlat;
+            pairs[n].even_cprlon = cprGlobalAirborneTests[i].even_cprlon;
+            pairs[n].odd_cprlat = cprGlobalAirborneTests[i].odd_cprlat;
+            pairs[n].odd_cprlon = cprGlobalAirborneTests[i].odd_cprlon;
+            pairs[n].fflag = fflag;
+        }
+    }
+    airborne = n;
+    for (i = 0; i < sizeof (cprGlobalSurfaceTests) / sizeof (cprGlobalSurfaceTests[0]); ++i) {
+        for (int fflag = 0; fflag <= 1; ++fflag, ++n) {
+            pairs[n].reflat = cprGlobalSurfaceTests[i].reflat;
+            pairs[n].reflon = cprGlobalSurfaceTests[i].reflon;
+            pairs[n].even_cprlat = cprGlobalSurfaceTests[i].even_cprlat;
+            pairs[n].even_cprlon = cprGlobalSurfaceTests[i].even_cprlon;
+            pairs[n].odd_cprlat = cprGlobalSurfaceTests[i].odd_cprlat;
+            pairs[n].odd_cprlon = cprGlobalSurfaceTests[i].odd_cprlon;
+            pairs[n].fflag = fflag;
+        }
+    }
+
+    decodeCPRairborneBatch(pairs, airborne);
+    decodeCPRsurfaceBatch(pairs + airborne, n - airborne);
+
+    for (i = 0; i < n; ++i) {
+        const struct cpr_pair *p = &pairs[i];
+        double rlat = 0, rlon = 0;
+        int res;
+
+        if (i < airborne)
+            res = decodeCPRairborne(p->even_cprlat, p->even_cprlon, p->odd_cprlat, p->odd_cprlon, p->fflag, &rlat, &rlon);
+        else
+            res = decodeCPRsurface(p->reflat, p->reflon, p->even_cprlat, p->even_cprlon, p->odd_cprlat, p->odd_cprlon, p->fflag, &rlat, &rlon);
+
+        if (res != p->result || (res == 0 && (rlat != p->lat || rlon != p->lon))) {
+            ok = 0;
+            fprintf(stderr,
+                    "testCPRBatch[%u]:  FAIL: batch result %d %.6f %.6f, single pair result %d %.6f %.6f\n",
+                    i, p->result, p->lat, p->lon, res, rlat, rlon);
+        }
+    }
+
+    if (ok)
+        fprintf(stderr, "testCPRBatch:  PASS (%u pairs)\n", n);
+    return ok;
+}
+
+//
+// Microbenchmark, run with "cprtests bench [seconds]"
+//
+
+#define BENCH_PAIRS 4096
+
+static double cprModBench(double a, double b) {
+    double res = fmod(a, b);
+    if (res < 0) res += b;
+    return res;
+}
+
+// Encode a position as raw CPR values, 1090-WP-9-14 A.1.7.3
+static void encodeCPR(double lat, double lon, int fflag, int surface, int *cprlat, int *cprlon) {
+    double scale = surface ? 90.0 : 360.0;
+    double dlat = scale / (60 - fflag);
+    int yz = (int) floor(131072 * cprModBench(lat, dlat) / dlat + 0.5);
+    double rlat = dlat * (yz / 131072.0 + floor(lat / dlat));
+    int ni = cprNLFunction(rlat) - fflag;
+    double dlon = scale / (ni < 1 ? 1 : ni);
+    int xz = (int) floor(131072 * cprModBench(lon, dlon) / dlon + 0.5);
+
+    *cprlat = yz & 0x1FFFF;
+    *cprlon = xz & 0x1FFFF;
+}
+
+static struct cpr_pair bench_airborne[BENCH_PAIRS];
+static struct cpr_pair bench_surface[BENCH_PAIRS];
+static volatile double bench_sink; // keeps the results live
+
+static void benchAirborne(void) {
+    for (unsigned i = 0; i < BENCH_PAIRS; ++i) {
+        const struct cpr_pair *p = &bench_airborne[i];
+        double rlat, rlon;
+        decodeCPRairborne(p->even_cprlat, p->even_cprlon, p->odd_cprlat, p->odd_cprlon, p->fflag, &rlat, &rlon);
+        bench_sink = rlat;
+    }
+}
+
+static void benchAirborneBatch(void) {
+    decodeCPRairborneBatch(bench_airborne, BENCH_PAIRS);
+}
+
+static void benchSurface(void) {
+    for (unsigned i = 0; i < BENCH_PAIRS; ++i) {
+        const struct cpr_pair *p = &bench_surface[i];
+        double rlat, rlon;
+        decodeCPRsurface(p->reflat, p->reflon, p->even_cprlat, p->even_cprlon, p->odd_cprlat, p->odd_cprlon, p->fflag, &rlat, &rlon);
+        bench_sink = rlat;
+    }
+}
+
+static void benchSurfaceBatch(void) {
+    decodeCPRsurfaceBatch(bench_surface, BENCH_PAIRS);
+}
+
+static void benchRelative(void) {
+    for (unsigned i = 0; i < BENCH_PAIRS; ++i) {
+        const struct cpr_pair *p = &bench_airborne[i];
+        double rlat, rlon;
+        decodeCPRrelative(p->reflat, p->reflon, p->even_cprlat, p->even_cprlon, 0, 0, &rlat, &rlon);
+        bench_sink = rlat;
+    }
+}
+
+static void benchNL(void) {
+    for (unsigned i = 0; i < BENCH_PAIRS; ++i)
+        bench_sink = cprNLFunction(bench_airborne[i].reflat);
+}
+
+static const struct {
+    const char *name;
+    void (*run)(void);
+} cpr_benchmarks[] = {
+    { "decodeCPRairborne", benchAirborne},
+    { "decodeCPRairborneBatch", benchAirborneBatch},
+    { "decodeCPRsurface", benchSurface},
+    { "decodeCPRsurfaceBatch", benchSurfaceBatch},
+    { "decodeCPRrelative", benchRelative},
+    { "cprNLFunction", benchNL},
+};
+
+static void benchCPR(int seconds) {
+    unsigned bad = 0;
+
+    // positions spread over the whole globe, so the NL lookup sees every zone
+    srand(1);
+    for (unsigned i = 0; i < BENCH_PAIRS; ++i) {
+        struct cpr_pair *air = &bench_airborne[i], *surf = &bench_surface[i];
+        double lat = -85.0 + 170.0 * rand() / RAND_MAX;
+        double lon = -180.0 + 360.0 * rand() / RAND_MAX;
+        double rlat, rlon;
+
+        air->fflag = surf->fflag = rand() & 1;
+        air->reflat = surf->reflat = lat + 0.1;
+        air->reflon = surf->reflon = lon - 0.1;
+        encodeCPR(lat, lon, 0, 0, &air->even_cprlat, &air->even_cprlon);
+        encodeCPR(lat, lon, 1, 0, &air->odd_cprlat, &air->odd_cprlon);
+        encodeCPR(lat, lon, 0, 1, &surf->even_cprlat, &surf->even_cprlon);
+        encodeCPR(lat, lon, 1, 1, &surf->odd_cprlat, &surf->odd_cprlon);
+
+        if (decodeCPRairborne(air->even_cprlat, air->even_cprlon, air->odd_cprlat, air->odd_cprlon, air->fflag, &rlat, &rlon) != 0
+                || fabs(rlat - lat) > 0.001 || fabs(rlon - lon) > 0.001)
+            bad++;
+    }
+
+    fprintf(stderr, "%u positions, %u not decoded back to the encoded position\n", BENCH_PAIRS, bad);
+
+    for (unsigned i = 0; i < sizeof (cpr_benchmarks) / sizeof (cpr_benchmarks[0]); ++i) {
+        struct timespec start, end;
+        unsigned passes = 0;
+        double nanos;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        do {
+            cpr_benchmarks[i].run();
+            passes++;
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            nanos = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+        } while (nanos < seconds * 1e9);
+
+        fprintf(stderr, "  %-24s %8.1f ns per position\n", cpr_benchmarks[i].name, nanos / passes / BENCH_PAIRS);
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1 && !strcmp(argv[1], "bench")) {
+        benchCPR(argc > 2 ? atoi(argv[2]) : 1);
+        return 0;
+    }
+
     int ok = 1;
     ok = testCPRGlobalAirborne() && ok;
     ok = testCPRGlobalSurface() && ok;
     ok = testCPRRelative() && ok;
+    ok = testCPRNL() && ok;
+    ok = testCPRBatch() && ok;
     return ok ? 0 : 1;
 }
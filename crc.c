@@ -24,23 +24,217 @@
 #include "readsb.h"
 #include <assert.h>
 
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define CRC_CLMUL_X86
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRYPTO)
+#include <arm_neon.h>
+#define CRC_CLMUL_PMULL
+#endif
+
 // Errorinfo for "no errors"
 static struct errorinfo NO_ERRORS;
 
 // Generator polynomial for the Mode S CRC:
 #define MODES_GENERATOR_POLY 0xfff409U
 
-// CRC values for all single-byte messages;
+// CRC values for all single-byte messages, followed by the same
+// values advanced by 1..7 zero bytes (slicing-by-8);
 // used to speed up CRC calculation.
-static uint32_t crc_table[256];
+static uint32_t crc_table[8][256];
 
 // Syndrome values for all single-bit errors;
 // used to speed up construction of error-
 // correction tables.
 static uint32_t single_bit_syndrome[112];
 
-static void initLookupTables() {
+// Remainder of the first n bytes of a message times x^24,
+// i.e. the CRC of the message without its parity field
+typedef uint32_t (*crc_fn)(const uint8_t *message, int n);
+
+static uint32_t crc_bytewise(const uint8_t *message, int n) {
+    uint32_t rem = 0;
     int i;
+
+    for (i = 0; i < n; ++i) {
+        rem = (rem << 8) ^ crc_table[0][message[i] ^ ((rem & 0xff0000) >> 16)];
+        rem = rem & 0xffffff;
+    }
+
+    return rem;
+}
+
+static inline uint32_t load_be32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof (v));
+    return be32toh(v);
+}
+
+static inline uint64_t load_be64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof (v));
+    return be64toh(v);
+}
+
+// Eight (or four) bytes at a time: the remainder is xored into the top of
+// the next word, and every byte of the word is then looked up in the table
+// that advances it past the bytes that follow it.
+
+static uint32_t crc_slice8(const uint8_t *message, int n) {
+    uint32_t rem = 0;
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        uint64_t v = ((uint64_t) rem << 40) ^ load_be64(message + i);
+        rem = crc_table[7][v >> 56] ^ crc_table[6][(v >> 48) & 0xff] ^
+                crc_table[5][(v >> 40) & 0xff] ^ crc_table[4][(v >> 32) & 0xff] ^
+                crc_table[3][(v >> 24) & 0xff] ^ crc_table[2][(v >> 16) & 0xff] ^
+                crc_table[1][(v >> 8) & 0xff] ^ crc_table[0][v & 0xff];
+    }
+
+    for (; i + 4 <= n; i += 4) {
+        uint32_t v = (rem << 8) ^ load_be32(message + i);
+        rem = crc_table[3][v >> 24] ^ crc_table[2][(v >> 16) & 0xff] ^
+                crc_table[1][(v >> 8) & 0xff] ^ crc_table[0][v & 0xff];
+    }
+
+    for (; i < n; ++i)
+        rem = ((rem << 8) & 0xffffff) ^ crc_table[0][message[i] ^ (rem >> 16)];
+
+    return rem;
+}
+
+// Several messages at once; the remainders are independent, so with the
+// kernels inlined into one loop their table lookups or multiplies overlap.
+
+typedef void (*crc_batch_fn)(const uint8_t * const *messages, const int *n, uint32_t *out, int count);
+
+static void crc_bytewise_batch(const uint8_t * const *messages, const int *n, uint32_t *out, int count) {
+    for (int k = 0; k < count; ++k)
+        out[k] = crc_bytewise(messages[k], n[k]);
+}
+
+static void crc_slice8_batch(const uint8_t * const *messages, const int *n, uint32_t *out, int count) {
+    for (int k = 0; k < count; ++k)
+        out[k] = crc_slice8(messages[k], n[k]);
+}
+
+// Carry-less multiply version. The data bytes A(x) are at most 88 bits
+// long (11 data bytes of an extended squitter); the top part is folded
+// into 64 bits with x^64 mod G, leaving F(x) == A(x) mod G, and
+// F(x) * x^24 mod G is then a Barrett reduction with mu = x^88 / G:
+//
+//   q = F ^ ((F * (mu - x^64)) >> 64)
+//   crc = (q * (G - x^24)) mod x^24
+//
+// The constants are computed by initLookupTables(). Shorter messages use
+// the table version.
+
+#if defined(CRC_CLMUL_X86) || defined(CRC_CLMUL_PMULL)
+
+static uint64_t crc_fold64; // x^64 mod G
+static uint64_t crc_mu_low; // (x^88 / G) - x^64
+
+// split the first n (8..11) bytes of message into the bits above x^64 and the low 64 bits
+static inline void load_data(const uint8_t *message, int n, uint64_t *hi, uint64_t *lo) {
+    uint64_t h = 0;
+
+    if (n == MODES_LONG_MSG_BYTES - 3) {
+        h = (message[0] << 16) | (message[1] << 8) | message[2];
+    } else {
+        for (int i = 0; i < n - 8; ++i)
+            h = (h << 8) | message[i];
+    }
+
+    *hi = h;
+    *lo = load_be64(message + n - 8);
+}
+
+#endif
+
+#ifdef CRC_CLMUL_X86
+
+__attribute__ ((target("pclmul,sse4.1")))
+static inline __m128i clmul(uint64_t a, uint64_t b) {
+    return _mm_clmulepi64_si128(_mm_cvtsi64_si128(a), _mm_cvtsi64_si128(b), 0x00);
+}
+
+__attribute__ ((target("pclmul,sse4.1")))
+static uint32_t crc_pclmul(const uint8_t *message, int n) {
+    uint64_t hi, lo;
+
+    // a single 4-byte table step is quicker for short messages
+    if (n < 8 || n > MODES_LONG_MSG_BYTES - 3)
+        return crc_slice8(message, n);
+
+    load_data(message, n, &hi, &lo);
+    uint64_t f = lo ^ (uint64_t) _mm_cvtsi128_si64(clmul(hi, crc_fold64));
+    uint64_t q = f ^ (uint64_t) _mm_extract_epi64(clmul(f, crc_mu_low), 1);
+    return (uint32_t) _mm_cvtsi128_si64(clmul(q, MODES_GENERATOR_POLY)) & 0xffffff;
+}
+
+__attribute__ ((target("pclmul,sse4.1")))
+static void crc_pclmul_batch(const uint8_t * const *messages, const int *n, uint32_t *out, int count) {
+    for (int k = 0; k < count; ++k)
+        out[k] = crc_pclmul(messages[k], n[k]);
+}
+
+static bool cpu_has_pclmul(void) {
+    return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+}
+
+#endif /* CRC_CLMUL_X86 */
+
+#ifdef CRC_CLMUL_PMULL
+
+static inline poly128_t clmul(uint64_t a, uint64_t b) {
+    return vmull_p64((poly64_t) a, (poly64_t) b);
+}
+
+static uint32_t crc_pmull(const uint8_t *message, int n) {
+    uint64_t hi, lo;
+
+    // a single 4-byte table step is quicker for short messages
+    if (n < 8 || n > MODES_LONG_MSG_BYTES - 3)
+        return crc_slice8(message, n);
+
+    load_data(message, n, &hi, &lo);
+    uint64_t f = lo ^ vgetq_lane_u64(vreinterpretq_u64_p128(clmul(hi, crc_fold64)), 0);
+    uint64_t q = f ^ vgetq_lane_u64(vreinterpretq_u64_p128(clmul(f, crc_mu_low)), 1);
+    return (uint32_t) vgetq_lane_u64(vreinterpretq_u64_p128(clmul(q, MODES_GENERATOR_POLY)), 0) & 0xffffff;
+}
+
+static void crc_pmull_batch(const uint8_t * const *messages, const int *n, uint32_t *out, int count) {
+    for (int k = 0; k < count; ++k)
+        out[k] = crc_pmull(messages[k], n[k]);
+}
+
+#endif /* CRC_CLMUL_PMULL */
+
+static struct {
+    const char *name;
+    crc_fn fn;
+    crc_batch_fn batch;
+    bool (*supported)(void);
+} crc_implementations[] = {
+    // In order of preference
+#ifdef CRC_CLMUL_X86
+    { "PCLMUL", crc_pclmul, crc_pclmul_batch, cpu_has_pclmul},
+#endif
+#ifdef CRC_CLMUL_PMULL
+    { "PMULL", crc_pmull, crc_pmull_batch, NULL},
+#endif
+    { "slicing-by-8", crc_slice8, crc_slice8_batch, NULL},
+    { "bytewise", crc_bytewise, crc_bytewise_batch, NULL},
+    { NULL, NULL, NULL, NULL}
+};
+
+static crc_fn crc_data = crc_bytewise;
+static crc_batch_fn crc_data_batch = crc_bytewise_batch;
+static const char *crc_name = "bytewise";
+
+static void initLookupTables() {
+    int i, k;
     uint8_t msg[112 / 8];
 
     for (i = 0; i < 256; ++i) {
@@ -53,8 +247,33 @@ static void initLookupTables() {
                 c = (c << 1);
         }
 
-        crc_table[i] = c & 0x00ffffff;
+        crc_table[0][i] = c & 0x00ffffff;
+    }
+
+    // crc_table[k][i] is crc_table[0][i] followed by k zero bytes
+    for (k = 1; k < 8; ++k) {
+        for (i = 0; i < 256; ++i) {
+            uint32_t c = crc_table[k - 1][i];
+            crc_table[k][i] = ((c << 8) & 0xffffff) ^ crc_table[0][c >> 16];
+        }
+    }
+
+#if defined(CRC_CLMUL_X86) || defined(CRC_CLMUL_PMULL)
+    {
+        // x^64 mod G, and the quotient x^88 / G by long division
+        uint32_t rem = 1;
+        uint64_t quot = 0;
+        for (i = 0; i < 88; ++i) {
+            quot = (quot << 1) | ((rem >> 23) & 1);
+            rem = (rem & 0x800000) ? (rem << 1) ^ MODES_GENERATOR_POLY : rem << 1;
+            rem &= 0xffffff;
+            if (i == 63)
+                crc_fold64 = rem;
+        }
+        // quot holds x^88 / G without its leading x^64 term, shifted out above
+        crc_mu_low = quot;
     }
+#endif
 
     memset(msg, 0, sizeof (msg));
     for (i = 0; i < 112; ++i) {
@@ -65,27 +284,192 @@ static void initLookupTables() {
 }
 
 uint32_t modesChecksum(uint8_t *message, int bits) {
-    uint32_t rem = 0;
-    int i;
     int n = bits / 8;
 
     assert(bits % 8 == 0);
     assert(n >= 3);
 
-    for (i = 0; i < n - 3; ++i) {
-        rem = (rem << 8) ^ crc_table[message[i] ^ ((rem & 0xff0000) >> 16)];
-        rem = rem & 0xffffff;
+    return crc_data(message, n - 3) ^ (message[n - 3] << 16) ^ (message[n - 2] << 8) ^ (message[n - 1]);
+}
+
+// Checksums of count messages of bits[k] bits each into out[k],
+// for up to MODES_CRC_BATCH messages
+
+void modesChecksumBatch(uint8_t * const *messages, const int *bits, uint32_t *out, int count) {
+    int n[MODES_CRC_BATCH] = {0};
+
+    assert(count <= MODES_CRC_BATCH);
+    for (int k = 0; k < count; ++k) {
+        assert(bits[k] % 8 == 0);
+        assert(bits[k] >= 24);
+        n[k] = bits[k] / 8 - 3;
     }
 
-    rem = rem ^ (message[n - 3] << 16) ^ (message[n - 2] << 8) ^ (message[n - 1]);
-    return rem;
+    crc_data_batch((const uint8_t * const *) messages, n, out, count);
+
+    for (int k = 0; k < count; ++k) {
+        const uint8_t *parity = messages[k] + n[k];
+        out[k] ^= (parity[0] << 16) ^ (parity[1] << 8) ^ parity[2];
+    }
+}
+
+// Select the fastest CRC implementation supported by this CPU
+
+static void selectChecksum(void) {
+    for (int i = 0; crc_implementations[i].fn; ++i) {
+        if (crc_implementations[i].supported && !crc_implementations[i].supported())
+            continue;
+
+        crc_data = crc_implementations[i].fn;
+        crc_data_batch = crc_implementations[i].batch;
+        crc_name = crc_implementations[i].name;
+        break;
+    }
+}
+
+const char *modesChecksumName(void) {
+    return crc_name;
+}
+
+// Cuckoo hash of the correctable syndromes for one message length: each
+// syndrome lives in one of two slots, so a lookup reads at most two entries.
+// A blocked bloom filter in front of it rejects most syndromes (bad CRCs
+// that are not correctable) with a single word read.
+
+struct syndrome_table {
+    struct errorinfo *slots; // 2 << bits entries, syndrome 0 is an empty slot
+    unsigned shift; // 32 - bits
+    uint32_t seed;
+    uint64_t *bloom;
+    unsigned bloom_shift; // 32 - log2(bloom words)
+};
+
+static struct syndrome_table syndromes_short;
+static struct syndrome_table syndromes_long;
+
+#define SYNDROME_HASH1 0x9e3779b1U
+#define SYNDROME_HASH2 0x85ebca6bU
+#define SYNDROME_BLOOM 0xc2b2ae35U
+
+static inline uint32_t syndrome_slot1(const struct syndrome_table *t, uint32_t syndrome) {
+    return ((syndrome ^ t->seed) * SYNDROME_HASH1) >> t->shift;
 }
 
-static struct errorinfo *bitErrorTable_short;
-static int bitErrorTableSize_short;
+static inline uint32_t syndrome_slot2(const struct syndrome_table *t, uint32_t syndrome) {
+    return (((syndrome ^ t->seed) * SYNDROME_HASH2) >> t->shift) + (1U << (32 - t->shift));
+}
+
+static inline bool syndrome_maybe_present(const struct syndrome_table *t, uint32_t syndrome) {
+    uint32_t h = syndrome * SYNDROME_BLOOM;
+    uint64_t word = t->bloom[h >> t->bloom_shift];
+    return ((word >> (h & 63)) & (word >> ((h >> 6) & 63)) & 1) != 0;
+}
+
+static struct errorinfo *syndromeLookup(struct syndrome_table *t, uint32_t syndrome) {
+    struct errorinfo *ei;
+
+    if (!t->slots || !syndrome_maybe_present(t, syndrome))
+        return NULL;
+
+    ei = &t->slots[syndrome_slot1(t, syndrome)];
+    if (ei->syndrome == syndrome)
+        return ei;
+
+    ei = &t->slots[syndrome_slot2(t, syndrome)];
+    if (ei->syndrome == syndrome)
+        return ei;
+
+    return NULL;
+}
+
+static bool syndromeInsert(struct syndrome_table *t, struct errorinfo ei) {
+    uint32_t pos = syndrome_slot1(t, ei.syndrome);
+
+    if (t->slots[pos].syndrome) {
+        uint32_t alt = syndrome_slot2(t, ei.syndrome);
+        if (!t->slots[alt].syndrome)
+            pos = alt;
+    }
+
+    // evict the occupant to its other slot until one lands in an empty slot
+    for (int kicks = 0; kicks < 256; ++kicks) {
+        struct errorinfo evicted = t->slots[pos];
 
-static struct errorinfo *bitErrorTable_long;
-static int bitErrorTableSize_long;
+        t->slots[pos] = ei;
+        if (!evicted.syndrome)
+            return true;
+
+        ei = evicted;
+        uint32_t first = syndrome_slot1(t, ei.syndrome);
+        pos = (pos == first) ? syndrome_slot2(t, ei.syndrome) : first;
+    }
+
+    return false;
+}
+
+static void freeSyndromeTable(struct syndrome_table *t) {
+    free(t->slots);
+    free(t->bloom);
+    memset(t, 0, sizeof (*t));
+}
+
+// Build the hash for a sorted table from prepareErrorTable(); starts at a
+// load factor of at most 1/2 and retries with another seed or a larger
+// table if the cuckoo insertion cycles.
+
+static bool buildSyndromeTable(struct syndrome_table *t, const struct errorinfo *table, int size) {
+    unsigned bits = 1, bloom_bits = 1;
+    int i;
+
+    freeSyndromeTable(t);
+    if (!size)
+        return true;
+
+    while ((1 << bits) < size)
+        ++bits;
+
+    // 16 filter bits per entry
+    while ((1 << bloom_bits) < size / 4)
+        ++bloom_bits;
+
+    if (!(t->bloom = calloc(1 << bloom_bits, sizeof (uint64_t)))) {
+        fprintf(stderr, "Out of memory allocating syndrome tables\n");
+        return false;
+    }
+    t->bloom_shift = 32 - bloom_bits;
+
+    for (i = 0; i < size; ++i) {
+        uint32_t h = table[i].syndrome * SYNDROME_BLOOM;
+        t->bloom[h >> t->bloom_shift] |= (1ULL << (h & 63)) | (1ULL << ((h >> 6) & 63));
+    }
+
+    for (int attempt = 0; bits < 24; ++attempt) {
+        if (attempt && attempt % 8 == 0)
+            ++bits;
+
+        free(t->slots);
+        if (!(t->slots = calloc(2 << bits, sizeof (struct errorinfo)))) {
+            fprintf(stderr, "Out of memory allocating syndrome tables\n");
+            freeSyndromeTable(t);
+            return false;
+        }
+        t->shift = 32 - bits;
+        t->seed = attempt * SYNDROME_HASH2;
+
+        for (i = 0; i < size; ++i) {
+            // an undetectable error pattern can never be looked up
+            if (table[i].syndrome && !syndromeInsert(t, table[i]))
+                break;
+        }
+
+        if (i == size)
+            return true;
+    }
+
+    fprintf(stderr, "Failed to build syndrome tables\n");
+    freeSyndromeTable(t);
+    return false;
+}
 
 // compare two errorinfo structures
 
@@ -353,33 +737,181 @@ static struct errorinfo *prepareErrorTable(int bits, int max_correct, int max_de
     return table;
 }
 
+// Error tables cached by --crc-cache: a header followed by the short and
+// the long table as built by prepareErrorTable().
+
+#define CRC_CACHE_MAGIC 0x52534543U
+#define CRC_CACHE_VERSION 1
+
+struct crc_cache_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entry_size;
+    int32_t max_correct;
+    int32_t max_detect;
+    int32_t size_short;
+    int32_t size_long;
+};
+
+// Check that every cached entry has the syndrome of its error bits
+
+static bool validErrorTable(const struct errorinfo *table, int size, int bits, int max_correct) {
+    for (int i = 0; i < size; ++i) {
+        uint32_t syndrome = 0;
+
+        if (table[i].errors < 1 || table[i].errors > max_correct)
+            return false;
+
+        for (int j = 0; j < table[i].errors; ++j) {
+            if (table[i].bit[j] < 5 || table[i].bit[j] >= bits)
+                return false;
+            syndrome ^= single_bit_syndrome[table[i].bit[j] + 112 - bits];
+        }
+
+        if (syndrome != table[i].syndrome)
+            return false;
+    }
+
+    return true;
+}
+
+static struct errorinfo *readErrorTable(FILE *f, int size, int bits, int max_correct) {
+    struct errorinfo *table;
+    int maxsize = 0;
+
+    for (int i = 1; i <= max_correct; ++i)
+        maxsize += combinations(bits - 5, i);
+
+    if (size <= 0 || size > maxsize)
+        return NULL;
+
+    if (!(table = malloc(size * sizeof (struct errorinfo))))
+        return NULL;
+
+    if (fread(table, sizeof (struct errorinfo), size, f) != (size_t) size || !validErrorTable(table, size, bits, max_correct)) {
+        free(table);
+        return NULL;
+    }
+
+    return table;
+}
+
+static bool loadErrorTables(const char *path, int max_correct, int max_detect,
+        struct errorinfo **table_short, int *size_short, struct errorinfo **table_long, int *size_long) {
+    struct crc_cache_header header;
+    FILE *f;
+
+    if (!(f = fopen(path, "rb"))) {
+        if (errno != ENOENT)
+            fprintf(stderr, "CRC cache %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    *table_short = *table_long = NULL;
+    if (fread(&header, sizeof (header), 1, f) == 1 &&
+            header.magic == CRC_CACHE_MAGIC && header.version == CRC_CACHE_VERSION &&
+            header.entry_size == sizeof (struct errorinfo) &&
+            header.max_correct == max_correct && header.max_detect == max_detect &&
+            (*table_short = readErrorTable(f, header.size_short, MODES_SHORT_MSG_BITS, max_correct)) &&
+            (*table_long = readErrorTable(f, header.size_long, MODES_LONG_MSG_BITS, max_correct))) {
+        *size_short = header.size_short;
+        *size_long = header.size_long;
+        fclose(f);
+        return true;
+    }
+
+    free(*table_short);
+    *table_short = NULL;
+    fprintf(stderr, "CRC cache %s is stale or damaged, rebuilding it\n", path);
+    fclose(f);
+    return false;
+}
+
+// Write the cache under a temporary name and rename it into place,
+// so a reader never sees a partial file
+
+static void saveErrorTables(const char *path, int max_correct, int max_detect,
+        const struct errorinfo *table_short, int size_short, const struct errorinfo *table_long, int size_long) {
+    struct crc_cache_header header = {
+        .magic = CRC_CACHE_MAGIC,
+        .version = CRC_CACHE_VERSION,
+        .entry_size = sizeof (struct errorinfo),
+        .max_correct = max_correct,
+        .max_detect = max_detect,
+        .size_short = size_short,
+        .size_long = size_long,
+    };
+    char tmppath[PATH_MAX];
+    FILE *f;
+
+    if (snprintf(tmppath, sizeof (tmppath), "%s.tmp", path) >= (int) sizeof (tmppath)) {
+        fprintf(stderr, "CRC cache %s: path too long\n", path);
+        return;
+    }
+
+    if (!(f = fopen(tmppath, "wb"))) {
+        fprintf(stderr, "CRC cache %s: %s\n", tmppath, strerror(errno));
+        return;
+    }
+
+    bool ok = fwrite(&header, sizeof (header), 1, f) == 1 &&
+            fwrite(table_short, sizeof (struct errorinfo), size_short, f) == (size_t) size_short &&
+            fwrite(table_long, sizeof (struct errorinfo), size_long, f) == (size_t) size_long;
+
+    if (fclose(f) != 0 || !ok || rename(tmppath, path) != 0) {
+        fprintf(stderr, "CRC cache %s: %s\n", path, strerror(errno));
+        unlink(tmppath);
+    }
+}
+
 // Precompute syndrome tables for 56- and 112-bit messages.
+// With a cache file, the tables are loaded from it if they were built with
+// the same settings, and written to it otherwise.
+
+void modesChecksumInit(int fixBits, const char *cacheFile) {
+    struct errorinfo *table_short = NULL, *table_long = NULL;
+    int size_short = 0, size_long = 0;
+    int max_correct, max_detect;
 
-void modesChecksumInit(int fixBits) {
     initLookupTables();
+    selectChecksum();
 
     switch (fixBits) {
         case 0:
-            bitErrorTable_short = bitErrorTable_long = NULL;
-            bitErrorTableSize_short = bitErrorTableSize_long = 0;
-            break;
+            freeSyndromeTable(&syndromes_short);
+            freeSyndromeTable(&syndromes_long);
+            return;
 
         case 1:
             // For 1 bit correction, we have 100% coverage up to 4 bit detection, so don't bother
             // with flagging collisions there.
-            bitErrorTable_short = prepareErrorTable(MODES_SHORT_MSG_BITS, 1, 1, &bitErrorTableSize_short);
-            bitErrorTable_long = prepareErrorTable(MODES_LONG_MSG_BITS, 1, 1, &bitErrorTableSize_long);
+            max_correct = max_detect = 1;
             break;
 
         default:
             // Detect out to 4 bit errors; this reduces our 2-bit coverage to about 65%.
-            // This can take a little while - tell the user.
+            max_correct = 2;
+            max_detect = 4;
+            break;
+    }
+
+    if (!cacheFile || !loadErrorTables(cacheFile, max_correct, max_detect, &table_short, &size_short, &table_long, &size_long)) {
+        // This can take a little while - tell the user.
+        if (max_detect > 1)
             fprintf(stderr, "Preparing error correction tables.. ");
-            bitErrorTable_short = prepareErrorTable(MODES_SHORT_MSG_BITS, 2, 4, &bitErrorTableSize_short);
-            bitErrorTable_long = prepareErrorTable(MODES_LONG_MSG_BITS, 2, 4, &bitErrorTableSize_long);
+        table_short = prepareErrorTable(MODES_SHORT_MSG_BITS, max_correct, max_detect, &size_short);
+        table_long = prepareErrorTable(MODES_LONG_MSG_BITS, max_correct, max_detect, &size_long);
+        if (max_detect > 1)
             fprintf(stderr, "done.\n");
-            break;
+
+        if (cacheFile)
+            saveErrorTables(cacheFile, max_correct, max_detect, table_short, size_short, table_long, size_long);
     }
+
+    buildSyndromeTable(&syndromes_short, table_short, size_short);
+    buildSyndromeTable(&syndromes_long, table_long, size_long);
+    free(table_short);
+    free(table_long);
 }
 
 // Given an error syndrome and message length, return
@@ -387,28 +919,11 @@ void modesChecksumInit(int fixBits) {
 // syndrome is uncorrectable
 
 struct errorinfo *modesChecksumDiagnose(uint32_t syndrome, int bitlen) {
-    struct errorinfo *table;
-    int tablesize;
-
-    struct errorinfo ei;
-
     if (syndrome == 0)
         return &NO_ERRORS;
 
     assert(bitlen == 56 || bitlen == 112);
-    if (bitlen == 56) {
-        table = bitErrorTable_short;
-        tablesize = bitErrorTableSize_short;
-    } else {
-        table = bitErrorTable_long;
-        tablesize = bitErrorTableSize_long;
-    }
-
-    if (!table)
-        return NULL;
-
-    ei.syndrome = syndrome;
-    return bsearch(&ei, table, tablesize, sizeof (struct errorinfo), syndrome_compare);
+    return syndromeLookup(bitlen == 56 ? &syndromes_short : &syndromes_long, syndrome);
 }
 
 // Given a message and an error-correction descriptor,
@@ -429,15 +944,109 @@ void modesChecksumFix(uint8_t *msg, struct errorinfo *info) {
  *
  */
 void crcCleanupTables(void) {
-    if (bitErrorTable_short != NULL)
-        free(bitErrorTable_short);
-
-    if (bitErrorTable_long != NULL)
-        free(bitErrorTable_long);
+    freeSyndromeTable(&syndromes_short);
+    freeSyndromeTable(&syndromes_long);
 }
 
 #ifdef CRCDEBUG
 
+// Check every CRC implementation this CPU supports against the bytewise
+// one on random messages, and time them on short and long messages.
+
+#define BENCH_MESSAGES 65536
+#define BENCH_ROUNDS 64
+
+static bool benchmarkChecksums(void) {
+    static uint8_t msgs[BENCH_MESSAGES][MODES_LONG_MSG_BYTES];
+    bool ok = true;
+    int i, k;
+
+    srandom(1);
+    for (i = 0; i < BENCH_MESSAGES; ++i) {
+        for (k = 0; k < MODES_LONG_MSG_BYTES; ++k)
+            msgs[i][k] = random() & 0xff;
+    }
+
+    fprintf(stderr, "benchmarking CRC implementations (selected: %s)..\n", crc_name);
+    for (int impl = 0; crc_implementations[impl].fn; ++impl) {
+        crc_fn fn = crc_implementations[impl].fn;
+        uint32_t sink = 0;
+
+        if (crc_implementations[impl].supported && !crc_implementations[impl].supported()) {
+            fprintf(stderr, "  %-12s  not supported by this CPU\n", crc_implementations[impl].name);
+            continue;
+        }
+
+        for (i = 0; i < BENCH_MESSAGES; ++i) {
+            for (k = 3; k <= MODES_LONG_MSG_BYTES; ++k) {
+                if (fn(msgs[i], k - 3) != crc_bytewise(msgs[i], k - 3)) {
+                    fprintf(stderr, "  %-12s  wrong CRC for a %d byte message\n", crc_implementations[impl].name, k);
+                    ok = false;
+                    break;
+                }
+            }
+        }
+
+        fprintf(stderr, "  %-12s", crc_implementations[impl].name);
+        for (int bytes = MODES_SHORT_MSG_BYTES; bytes <= MODES_LONG_MSG_BYTES; bytes += MODES_LONG_MSG_BYTES - MODES_SHORT_MSG_BYTES) {
+            struct timespec start, end;
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (int round = 0; round < BENCH_ROUNDS; ++round) {
+                for (i = 0; i < BENCH_MESSAGES; ++i)
+                    sink += fn(msgs[i], bytes - 3);
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+
+            double nanos = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+            fprintf(stderr, "  %3d bits: %6.2f ns", bytes * 8, nanos / BENCH_MESSAGES / BENCH_ROUNDS);
+        }
+        fprintf(stderr, "  (%08X)\n", sink);
+    }
+
+    return ok;
+}
+
+// Check the hashed lookup against a binary search of the sorted table for
+// every possible syndrome, and time both.
+
+static bool checkSyndromeLookup(struct syndrome_table *t, struct errorinfo *table, int size, int bits) {
+    struct timespec start, mid, end;
+    uintptr_t sink = 0;
+    int mismatches = 0;
+    uint32_t syndrome;
+
+    if (!buildSyndromeTable(t, table, size))
+        return false;
+
+    fprintf(stderr, "checking %d-bit syndrome lookups..\n", bits);
+    for (syndrome = 1; syndrome < (1 << 24); ++syndrome) {
+        struct errorinfo ei = {.syndrome = syndrome};
+        struct errorinfo *expected = bsearch(&ei, table, size, sizeof (struct errorinfo), syndrome_compare);
+        struct errorinfo *found = syndromeLookup(t, syndrome);
+
+        if (expected ? (!found || memcmp(expected, found, sizeof (ei))) : found != NULL)
+            ++mismatches;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (syndrome = 1; syndrome < (1 << 24); ++syndrome) {
+        struct errorinfo ei = {.syndrome = syndrome};
+        sink += (uintptr_t) bsearch(&ei, table, size, sizeof (struct errorinfo), syndrome_compare);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &mid);
+    for (syndrome = 1; syndrome < (1 << 24); ++syndrome)
+        sink += (uintptr_t) syndromeLookup(t, syndrome);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    fprintf(stderr, "  %d mismatches, bsearch %.2f ns, hashed %.2f ns per lookup (%lx)\n", mismatches,
+            ((mid.tv_sec - start.tv_sec) * 1e9 + (mid.tv_nsec - start.tv_nsec)) / (1 << 24),
+            ((end.tv_sec - mid.tv_sec) * 1e9 + (end.tv_nsec - mid.tv_nsec)) / (1 << 24),
+            (unsigned long) sink);
+
+    return mismatches == 0;
+}
+
 int main(int argc, char **argv) {
     int shortlen, longlen;
     int i;
@@ -449,6 +1058,7 @@ int main(int argc, char **argv) {
     }
 
     initLookupTables();
+    selectChecksum();
     shorttable = prepareErrorTable(MODES_SHORT_MSG_BITS, atoi(argv[1]), atoi(argv[2]), &shortlen);
     longtable = prepareErrorTable(MODES_LONG_MSG_BITS, atoi(argv[1]), atoi(argv[2]), &longlen);
 
@@ -565,9 +1175,13 @@ int main(int argc, char **argv) {
         }
     }
 
+    bool ok = checkSyndromeLookup(&syndromes_short, shorttable, shortlen, MODES_SHORT_MSG_BITS) &&
+            checkSyndromeLookup(&syndromes_long, longtable, longlen, MODES_LONG_MSG_BITS);
+
     free(shorttable);
     free(longtable);
+    crcCleanupTables();
 
-    return 0;
+    return benchmarkChecksums() && ok ? 0 : 1;
 }
 #endif
@@ -29,6 +29,9 @@
 // Global max for fixable bit erros
 #define MODES_MAX_BITERRORS 2
 
+// Max messages per modesChecksumBatch() call, one per 2.4MHz preamble phase
+#define MODES_CRC_BATCH 5
+
 struct errorinfo {
     uint32_t syndrome; // CRC syndrome
     int errors; // number of errors
@@ -36,8 +39,10 @@ struct errorinfo {
     uint16_t padding;
 };
 
-void modesChecksumInit(int fixBits);
+void modesChecksumInit(int fixBits, const char *cacheFile);
 uint32_t modesChecksum(uint8_t *msg, int bitlen);
+void modesChecksumBatch(uint8_t * const *msgs, const int *bitlens, uint32_t *out, int count);
+const char *modesChecksumName(void);
 struct errorinfo *modesChecksumDiagnose(uint32_t syndrome, int bitlen);
 void modesChecksumFix(uint8_t *msg, struct errorinfo *info);
 void crcCleanupTables(void);
@@ -24,6 +24,16 @@
 #include "readsb.h"
 #include <assert.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PREAMBLE_SCAN_X86
+#endif
+
+#if defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#define PREAMBLE_SCAN_NEON
+#endif
+
 #ifdef MODEAC_DEBUG
 #include <gd.h>
 #endif
@@ -176,257 +186,997 @@ static inline __attribute__ ((always_inline)) uint8_t slice_byte(uint16_t **pPtr
     return theByte;
 }
 
-// score a phase using data from the magnitude buffers
-// if the score is better than the existing one passed via bestscore,
-// update bestmsg, bestscore and bestphase
+// bytes to slice for a message starting with the byte first, 1 for an unknown DF
+
+static inline int slice_bytelen(uint8_t first) {
+    switch (first >> 3) {
+        case 0: case 4: case 5: case 11:
+            return MODES_SHORT_MSG_BYTES;
+
+        case 16: case 17: case 18: case 20: case 21: case 24:
+            return MODES_LONG_MSG_BYTES;
+
+        default:
+            return 1; // unknown DF, give up immediately
+    }
+}
+
+// slice the message for a phase from the magnitude buffers into msg;
+// returns the number of valid bits, 8 for an unknown DF
 
-static void score_phase(int try_phase, uint16_t *m, int j, unsigned char **bestmsg, int *bestscore, int *bestphase, unsigned char **msg, unsigned char *msg1, unsigned char *msg2) {
-    Modes.stats_current.demod_preamblePhase[try_phase - 4]++;
+typedef int (*slice_fn)(struct stats *st, int try_phase, uint16_t *m, int j, unsigned char *msg);
+
+static int slice_phase_scalar(struct stats *st, int try_phase, uint16_t *m, int j, unsigned char *msg) {
+    st->demod_preamblePhase[try_phase - 4]++;
     uint16_t *pPtr;
-    int phase, i, score, bytelen;
+    int phase, i, bytelen;
 
     pPtr = &m[j + 19] + (try_phase / 5);
     phase = try_phase % 5;
 
-    (*msg)[0] = slice_byte(&pPtr, &phase);
+    msg[0] = slice_byte(&pPtr, &phase);
+    bytelen = slice_bytelen(msg[0]);
 
-    switch ((*msg)[0] >> 3) {
-        case 0: case 4: case 5: case 11:
-            bytelen = MODES_SHORT_MSG_BYTES;
-            break;
+    for (i = 1; i < bytelen; ++i) {
+        msg[i] = slice_byte(&pPtr, &phase);
+    }
 
-        case 16: case 17: case 18: case 20: case 21: case 24:
-            bytelen = MODES_LONG_MSG_BYTES;
-            break;
+    return bytelen * 8;
+}
 
-        default:
-            bytelen = 1; // unknown DF, give up immediately
-            break;
+#ifdef PREAMBLE_SCAN_X86
+
+//
+// The same slicing four bits at a time. Bit k of a message with phase
+// try_phase starts try_phase + 12k fifths of a sample after m[j + 19], and
+// its correlation is the one of slice_phase0..4 for the phase of that
+// position. The four taps of two bits go into one vector for pmaddwd, which
+// multiplies and adds pairs of signed 16 bit values; the magnitudes are
+// made signed by subtracting 32768, which changes a correlation by 32768
+// times the sum of its coefficients, 1 for slice_phase2 and 0 for the
+// others, so the result is compared against minus that instead of 0.
+// The positions repeat every 5 groups of 4 bits, 48 samples further on,
+// so one pattern of groups per phase does for the whole message.
+//
+
+struct slice_group {
+    __m128i coef[2]; // taps of lanes 0-1 and 2-3
+    __m128i threshold;
+    uint8_t offset[4]; // sample of each lane from m[j + 19]; lane 0 is the last bit
+};
+
+static struct slice_group slice_groups[5][5]; // [try_phase - 4][group % 5]
+
+__attribute__ ((target("sse2")))
+static void slice_groups_init(void) {
+    static const int16_t taps[5][4] = {
+        { 18, -15, -3, 0 }, // slice_phase0
+        { 14, -5, -9, 0 },
+        { 16, 5, -20, 0 },
+        { 7, 11, -18, 0 },
+        { 4, 15, -20, 1 },
+    };
+
+    for (int p = 0; p < 5; p++) {
+        for (int g = 0; g < 5; g++) {
+            struct slice_group *sg = &slice_groups[p][g];
+            int16_t coef[16];
+            int32_t threshold[4];
+
+            for (int lane = 0; lane < 4; lane++) {
+                int pos = p + 4 + 12 * (4 * g + 3 - lane);
+                int phase = pos % 5;
+                sg->offset[lane] = pos / 5;
+                threshold[lane] = phase == 2 ? -32768 : 0;
+                memcpy(&coef[lane * 4], taps[phase], sizeof (taps[phase]));
+            }
+            sg->coef[0] = _mm_loadu_si128((const __m128i *) &coef[0]);
+            sg->coef[1] = _mm_loadu_si128((const __m128i *) &coef[8]);
+            sg->threshold = _mm_loadu_si128((const __m128i *) threshold);
+        }
+    }
+}
+
+// the four bits of a group, first bit highest; reads up to 4 samples at each offset
+__attribute__ ((target("sse2")))
+static inline unsigned slice_group_sse2(const uint16_t *m, const struct slice_group *sg) {
+    const __m128i bias = _mm_set1_epi16((short) 0x8000);
+    __m128i ab = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *) (m + sg->offset[0])),
+            _mm_loadl_epi64((const __m128i *) (m + sg->offset[1])));
+    __m128i cd = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *) (m + sg->offset[2])),
+            _mm_loadl_epi64((const __m128i *) (m + sg->offset[3])));
+
+    ab = _mm_madd_epi16(_mm_xor_si128(ab, bias), sg->coef[0]);
+    cd = _mm_madd_epi16(_mm_xor_si128(cd, bias), sg->coef[1]);
+
+    // lane i is the sum of the pairs 2i and 2i+1 of ab and cd
+    __m128 even = _mm_shuffle_ps(_mm_castsi128_ps(ab), _mm_castsi128_ps(cd), _MM_SHUFFLE(2, 0, 2, 0));
+    __m128 odd = _mm_shuffle_ps(_mm_castsi128_ps(ab), _mm_castsi128_ps(cd), _MM_SHUFFLE(3, 1, 3, 1));
+    __m128i corr = _mm_add_epi32(_mm_castps_si128(even), _mm_castps_si128(odd));
+
+    return _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(corr, sg->threshold)));
+}
+
+__attribute__ ((target("sse2")))
+static int slice_phase_sse2(struct stats *st, int try_phase, uint16_t *m, int j, unsigned char *msg) {
+    st->demod_preamblePhase[try_phase - 4]++;
+    const struct slice_group *groups = slice_groups[try_phase - 4];
+    const uint16_t *base = &m[j + 19];
+    int bytelen;
+
+    msg[0] = slice_group_sse2(base, &groups[0]) << 4 | slice_group_sse2(base, &groups[1]);
+    bytelen = slice_bytelen(msg[0]);
+
+    for (int g = 2, r = 2; g < bytelen * 2; g += 2) {
+        unsigned hi = slice_group_sse2(base, &groups[r]);
+        if (++r == 5) {
+            r = 0;
+            base += 48;
+        }
+        unsigned lo = slice_group_sse2(base, &groups[r]);
+        if (++r == 5) {
+            r = 0;
+            base += 48;
+        }
+        msg[g / 2] = hi << 4 | lo;
     }
 
-    for (i = 1; i < bytelen; ++i) {
-        (*msg)[i] = slice_byte(&pPtr, &phase);
+    return bytelen * 8;
+}
+
+#endif /* PREAMBLE_SCAN_X86 */
+
+static slice_fn slice_phase = slice_phase_scalar;
+
+//
+// Preamble candidate scanning
+//
+// The pre-check pa[1] > pa[7] && pa[12] > pa[14] && pa[12] > pa[15] rejects
+// almost every sample offset, so it is worth evaluating it over several
+// offsets at once. Each scan function returns the first offset in j..mlen-1
+// that passes the pre-check, or mlen if there is none.
+// The vector versions read up to 15 + vector width samples past the offset
+// being tested, which always lies within the trailing overlap of the buffer.
+//
+
+typedef uint32_t (*preamble_scan_fn)(const uint16_t *m, uint32_t j, uint32_t mlen);
+
+static inline __attribute__ ((always_inline)) int preamble_precheck(const uint16_t *pa) {
+    return pa[1] > pa[7] && pa[12] > pa[14] && pa[12] > pa[15];
+}
+
+static uint32_t preamble_scan_scalar(const uint16_t *m, uint32_t j, uint32_t mlen) {
+    while (j < mlen && !preamble_precheck(&m[j]))
+        ++j;
+    return j;
+}
+
+#ifdef PREAMBLE_SCAN_X86
+
+// SSE2/AVX2 only have signed 16 bit compares; flipping the sign bit
+// of both operands turns that into the unsigned compare we need.
+
+__attribute__ ((target("sse2")))
+static uint32_t preamble_scan_sse2(const uint16_t *m, uint32_t j, uint32_t mlen) {
+    const __m128i bias = _mm_set1_epi16((short) 0x8000);
+
+    for (; j + 8 <= mlen; j += 8) {
+        const uint16_t *pa = &m[j];
+        __m128i p1 = _mm_xor_si128(_mm_loadu_si128((const __m128i *) (pa + 1)), bias);
+        __m128i p7 = _mm_xor_si128(_mm_loadu_si128((const __m128i *) (pa + 7)), bias);
+        __m128i p12 = _mm_xor_si128(_mm_loadu_si128((const __m128i *) (pa + 12)), bias);
+        __m128i p14 = _mm_xor_si128(_mm_loadu_si128((const __m128i *) (pa + 14)), bias);
+        __m128i p15 = _mm_xor_si128(_mm_loadu_si128((const __m128i *) (pa + 15)), bias);
+
+        __m128i hit = _mm_and_si128(_mm_cmpgt_epi16(p1, p7),
+                _mm_and_si128(_mm_cmpgt_epi16(p12, p14), _mm_cmpgt_epi16(p12, p15)));
+
+        // two mask bits per 16 bit lane
+        unsigned bits = (unsigned) _mm_movemask_epi8(hit);
+        if (bits)
+            return j + (__builtin_ctz(bits) >> 1);
+    }
+
+    return preamble_scan_scalar(m, j, mlen);
+}
+
+__attribute__ ((target("avx2")))
+static uint32_t preamble_scan_avx2(const uint16_t *m, uint32_t j, uint32_t mlen) {
+    const __m256i bias = _mm256_set1_epi16((short) 0x8000);
+
+    for (; j + 16 <= mlen; j += 16) {
+        const uint16_t *pa = &m[j];
+        __m256i p1 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) (pa + 1)), bias);
+        __m256i p7 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) (pa + 7)), bias);
+        __m256i p12 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) (pa + 12)), bias);
+        __m256i p14 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) (pa + 14)), bias);
+        __m256i p15 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) (pa + 15)), bias);
+
+        __m256i hit = _mm256_and_si256(_mm256_cmpgt_epi16(p1, p7),
+                _mm256_and_si256(_mm256_cmpgt_epi16(p12, p14), _mm256_cmpgt_epi16(p12, p15)));
+
+        // two mask bits per 16 bit lane
+        unsigned bits = (unsigned) _mm256_movemask_epi8(hit);
+        if (bits)
+            return j + (__builtin_ctz(bits) >> 1);
+    }
+
+    return preamble_scan_sse2(m, j, mlen);
+}
+
+static bool cpu_has_sse2(void) {
+    return __builtin_cpu_supports("sse2");
+}
+
+static bool cpu_has_avx2(void) {
+    return __builtin_cpu_supports("avx2");
+}
+
+#endif /* PREAMBLE_SCAN_X86 */
+
+#ifdef PREAMBLE_SCAN_NEON
+
+static uint32_t preamble_scan_neon(const uint16_t *m, uint32_t j, uint32_t mlen) {
+    for (; j + 8 <= mlen; j += 8) {
+        const uint16_t *pa = &m[j];
+        uint16x8_t p1 = vld1q_u16(pa + 1);
+        uint16x8_t p7 = vld1q_u16(pa + 7);
+        uint16x8_t p12 = vld1q_u16(pa + 12);
+        uint16x8_t p14 = vld1q_u16(pa + 14);
+        uint16x8_t p15 = vld1q_u16(pa + 15);
+
+        uint16x8_t hit = vandq_u16(vcgtq_u16(p1, p7),
+                vandq_u16(vcgtq_u16(p12, p14), vcgtq_u16(p12, p15)));
+
+        // narrow to one byte per lane and test all 8 lanes at once
+        uint64_t bits = vget_lane_u64(vreinterpret_u64_u8(vmovn_u16(hit)), 0);
+        if (bits)
+            return j + (__builtin_ctzll(bits) >> 3);
+    }
+
+    return preamble_scan_scalar(m, j, mlen);
+}
+
+#endif /* PREAMBLE_SCAN_NEON */
+
+static struct {
+    const char *name;
+    preamble_scan_fn fn;
+    bool (*supported)(void);
+} preamble_scanners[] = {
+    // In order of preference
+#ifdef PREAMBLE_SCAN_X86
+    { "AVX2", preamble_scan_avx2, cpu_has_avx2},
+    { "SSE2", preamble_scan_sse2, cpu_has_sse2},
+#endif
+#ifdef PREAMBLE_SCAN_NEON
+    { "NEON", preamble_scan_neon, NULL},
+#endif
+    { "scalar", preamble_scan_scalar, NULL},
+    { NULL, NULL, NULL}
+};
+
+static preamble_scan_fn preamble_scan = preamble_scan_scalar;
+static const char *preamble_scan_name = "scalar";
+
+// Select the fastest preamble scanner and slicer supported by this CPU
+
+void demod2400Init(void) {
+    for (int i = 0; preamble_scanners[i].fn; ++i) {
+        if (preamble_scanners[i].supported && !preamble_scanners[i].supported())
+            continue;
+
+        preamble_scan = preamble_scanners[i].fn;
+        preamble_scan_name = preamble_scanners[i].name;
+        break;
+    }
+
+#ifdef PREAMBLE_SCAN_X86
+    if (cpu_has_sse2()) {
+        slice_groups_init();
+        slice_phase = slice_phase_sse2;
+    }
+#endif
+}
+
+const char *demod2400ScannerName(void) {
+    return preamble_scan_name;
+}
+
+//
+// --demod-gate: on a quiet receiver most of each buffer is noise, far too
+// weak to hold a message that decodes. The offsets are searched in chunks of
+// GATE_CHUNK, and a chunk is skipped when no sample the high bits of a
+// preamble starting in it could be on comes up to the gate level: the mean
+// noise magnitude raised by --demod-gate dB. The noise floor is tracked from
+// the noise power of the buffers demodulated so far (see update_noise_power())
+// and the gate is off until the first one is done.
+//
+
+#define GATE_CHUNK 64
+#define GATE_REACH 13 // the last preamble high bit is at most 12 samples in
+
+static _Atomic uint32_t demod_gate_level; // magnitude, 0 while not gating
+static double demod_noise_power; // tracked noise floor, normalized power; main thread
+
+struct gate_state {
+    uint32_t level; // demod_gate_level for this buffer
+    uint32_t chunk; // the chunk open tells about
+    bool open; // the chunk reaches the level
+};
+
+static uint32_t gate_level(void) {
+    return atomic_load_explicit(&demod_gate_level, memory_order_relaxed);
+}
+
+static void gate_init(struct gate_state *gs, uint32_t level) {
+    gs->level = level;
+    gs->chunk = UINT32_MAX;
+    gs->open = true;
+}
+
+// Reads up to GATE_REACH samples past the chunk, within the trailing overlap
+static uint32_t chunk_peak(const uint16_t *m) {
+    uint32_t peak = 0;
+    for (int i = 0; i < GATE_CHUNK + GATE_REACH; i++)
+        peak = m[i] > peak ? m[i] : peak;
+    return peak;
+}
+
+// preamble_scan() over the chunks of j..mlen-1 up to the gate
+static uint32_t preamble_scan_gated(struct gate_state *gs, struct stats *st, const uint16_t *m, uint32_t j, uint32_t mlen) {
+    if (!gs->level)
+        return preamble_scan(m, j, mlen);
+
+    while (j < mlen) {
+        uint32_t chunk = j / GATE_CHUNK;
+        uint32_t chunk_end = min((chunk + 1) * GATE_CHUNK, mlen);
+
+        if (chunk != gs->chunk) {
+            gs->chunk = chunk;
+            gs->open = chunk_peak(&m[chunk * GATE_CHUNK]) >= gs->level;
+            if (!gs->open)
+                st->samples_gated += chunk_end - j;
+        }
+        if (gs->open) {
+            uint32_t found = preamble_scan(m, j, chunk_end);
+            if (found < chunk_end)
+                return found;
+        }
+        j = chunk_end;
     }
 
-    // Score the mode S message and see if it's any good.
-    if (bytelen > 1) {
-        score = scoreModesMessage(*msg, i * 8);
+    return mlen;
+}
+
+// Candidate demodulations of one preamble, one per phase tried
+struct phase_candidates {
+    unsigned char msg[MODES_CRC_BATCH][MODES_LONG_MSG_BYTES];
+    unsigned char *msgp[MODES_CRC_BATCH];
+    int phase[MODES_CRC_BATCH];
+    int validbits[MODES_CRC_BATCH];
+    int score[MODES_CRC_BATCH];
+    int count; // phases sliced
+    int scored; // phases scored
+    int best; // first of the best scoring phases, or -1
+};
+
+static inline void try_phase(struct phase_candidates *c, struct stats *st, int phase, uint16_t *m, uint32_t j) {
+    c->msgp[c->count] = c->msg[c->count];
+    c->phase[c->count] = phase;
+    c->validbits[c->count] = slice_phase(st, phase, m, j, c->msg[c->count]);
+    c->count++;
+}
+
+// Score the phases sliced since the last call together. Returns true once
+// a phase has the best possible score, so later phases needn't be sliced.
+
+static inline bool score_phases(struct phase_candidates *c) {
+    int n = scoreModesMessages(&c->msgp[c->scored], &c->validbits[c->scored], &c->score[c->scored], c->count - c->scored);
+
+    for (int i = c->scored; i < c->scored + n; ++i) {
+        if (c->best < 0 || c->score[i] > c->score[c->best])
+            c->best = i;
+    }
+    c->scored = c->count;
+
+    return c->best >= 0 && c->score[c->best] >= MODES_SCORE_MAX;
+}
+
+//
+// Try the phases that pass the preamble threshold for a message starting at
+// sample offset j, scoring each pair of phases together. On return bestmsg
+// holds the best scoring phase's message and *bestphase its phase.
+// Returns the best score, or -42 if no phase got past the preamble threshold.
+//
+
+static int score_preamble(struct stats *st, uint16_t *m, uint32_t j, unsigned char *bestmsg, int *bestphase) {
+    struct phase_candidates c;
+    uint16_t *pa = &m[j];
+    int32_t pa_mag, base_noise, ref_level;
+    int bestscore;
+
+    // Look for a message starting at around sample 0 with phase offset 3..7
+
+    // Ideal sample values for preambles with different phase
+    // Xn is the first data symbol with phase offset N
+    //
+    // sample#: 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0
+    // phase 3: 2/4\0/5\1 0 0 0 0/5\1/3 3\0 0 0 0 0 0 X4
+    // phase 4: 1/5\0/4\2 0 0 0 0/4\2 2/4\0 0 0 0 0 0 0 X0
+    // phase 5: 0/5\1/3 3\0 0 0 0/3 3\1/5\0 0 0 0 0 0 0 X1
+    // phase 6: 0/4\2 2/4\0 0 0 0 2/4\0/5\1 0 0 0 0 0 0 X2
+    // phase 7: 0/3 3\1/5\0 0 0 0 1/5\0/4\2 0 0 0 0 0 0 X3
+    //
+
+    // 5 noise samples
+    base_noise = pa[5] + pa[8] + pa[16] + pa[17] + pa[18];
+    // pa_mag is the sum of the 4 preamble high bits
+    // minus 2 low bits between each of high bit pairs
+
+    // reduce number of preamble detections if we recently dropped samples
+    if (Modes.stats_15min.sum.samples_dropped) {
+        ref_level = base_noise * max(PREAMBLE_THRESHOLD_PIZERO, Modes.preambleThreshold);
     } else {
-        score = -2;
+        ref_level = base_noise * Modes.preambleThreshold;
+    }
+
+    ref_level >>= 5; // divide by 32
+
+    c.count = c.scored = 0;
+    c.best = -1;
+
+    int32_t diff_2_3 = pa[2] - pa[3];
+    int32_t sum_1_4 = pa[1] + pa[4];
+    int32_t diff_10_11 = pa[10] - pa[11];
+    int32_t common3456 = sum_1_4 - diff_2_3 + pa[9] + pa[12];
+
+    // sample#: 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0
+    // phase 3: 2/4\0/5\1 0 0 0 0/5\1/3 3\0 0 0 0 0 0 X4
+    // phase 4: 1/5\0/4\2 0 0 0 0/4\2 2/4\0 0 0 0 0 0 0 X0
+    pa_mag = common3456 - diff_10_11;
+    if (pa_mag >= ref_level) {
+        // peaks at 1,3,9,11-12: phase 3
+        try_phase(&c, st, 4, m, j);
+        // peaks at 1,3,9,12: phase 4
+        try_phase(&c, st, 5, m, j);
+        if (score_phases(&c))
+            goto scored;
+    }
+    // sample#: 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0
+    // phase 5: 0/5\1/3 3\0 0 0 0/3 3\1/5\0 0 0 0 0 0 0 X1
+    // phase 6: 0/4\2 2/4\0 0 0 0 2/4\0/5\1 0 0 0 0 0 0 X2
+    pa_mag = common3456 + diff_10_11;
+    if (pa_mag >= ref_level) {
+        // peaks at 1,3-4,9-10,12: phase 5
+        try_phase(&c, st, 6, m, j);
+        // peaks at 1,4,10,12: phase 6
+        try_phase(&c, st, 7, m, j);
+        if (score_phases(&c))
+            goto scored;
+    }
+
+    // peaks at 1-2,4,10,12: phase 7
+    // sample#: 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0
+    // phase 7: 0/3 3\1/5\0 0 0 0 1/5\0/4\2 0 0 0 0 0 0 X3
+    pa_mag = sum_1_4 + 2 * diff_2_3 + diff_10_11 + pa[12];
+    if (pa_mag >= ref_level) {
+        try_phase(&c, st, 8, m, j);
+        score_phases(&c);
+    }
+
+scored:
+    if (c.best < 0) {
+        *bestphase = -1;
+        return -42; // no preamble detected
     }
 
-    if (score > *bestscore) {
-        // new high score!
-        *bestmsg = *msg;
-        *bestscore = score;
-        *bestphase = try_phase;
+    bestscore = c.score[c.best];
+    *bestphase = c.phase[c.best];
+    memcpy(bestmsg, c.msg[c.best], MODES_LONG_MSG_BYTES);
 
-        // swap to using the other buffer so we don't clobber our demodulated data
-        // (if we find a better result then we'll swap back, but that's OK because
-        // we no longer need this copy if we found a better one)
-        *msg = (*msg == msg1) ? msg2 : msg1;
+    // we had at least one phase greater than the preamble threshold
+    // and used scoremodesmessage on those bytes
+    st->demod_preambles++;
+
+    // Do we have a candidate?
+    if (bestscore < 0) {
+        if (bestscore == -1)
+            st->demod_rejected_unknown_icao++;
+        else
+            st->demod_rejected_bad++;
     }
+
+    return bestscore;
 }
 
 //
-// Given 'mlen' magnitude samples in 'm', sampled at 2.4MHz,
-// try to demodulate some Mode S messages.
+// Decode a candidate message found at sample offset j and pass it to the next layer.
+// Returns the number of samples to skip over, or 0 if the message was rejected.
 //
 
-void demodulate2400(struct mag_buf *mag) {
+static uint32_t deliver_message(struct mag_buf *mag, uint32_t j, int bestscore, int bestphase, unsigned char *bestmsg, uint64_t *sum_scaled_signal_power) {
     static struct modesMessage zeroMessage;
     struct modesMessage mm;
-    unsigned char msg1[MODES_LONG_MSG_BYTES], msg2[MODES_LONG_MSG_BYTES], *msg;
-    uint32_t j;
-
-    unsigned char *bestmsg;
-    int bestscore, bestphase;
-
     uint16_t *m = mag->data;
-    uint32_t mlen = mag->validLength - mag->overlap;
+    int msglen = modesMessageLenByType(bestmsg[0] >> 3);
 
-    uint64_t sum_scaled_signal_power = 0;
+    // Set initial mm structure details
+    mm = zeroMessage;
 
-    msg = msg1;
+    // For consistency with how the Beast / Radarcape does it,
+    // we report the timestamp at the end of bit 56 (even if
+    // the frame is a 112-bit frame)
+    mm.timestampMsg = mag->sampleTimestamp + j * 5 + (8 + 56) * 12 + bestphase;
 
-    // advance ifile artificial clock even if we don't receive anything
+    // compute message receive time as block-start-time + difference in the 12MHz clock
+    mm.sysTimestampMsg = mag->sysTimestamp + receiveclock_ms_elapsed(mag->sampleTimestamp, mm.timestampMsg);
+
+    // advance ifile artifical clock for every message received
     if (Modes.sdr_type == SDR_IFILE) {
-        Modes.ifile_now = mag->sysTimestamp;
+        Modes.ifile_now = mm.sysTimestampMsg;
     }
 
-    for (j = 0; j < mlen; j++) {
-        uint16_t *pa = &m[j];
-        int32_t pa_mag, base_noise, ref_level;
-        int msglen;
+    mm.score = bestscore;
 
-        // Look for a message starting at around sample 0 with phase offset 3..7
+    // Decode the received message
+    {
+        int result = decodeModesMessage(&mm, bestmsg);
+        if (result < 0) {
+            if (result == -1)
+                Modes.stats_current.demod_rejected_unknown_icao++;
+            else
+                Modes.stats_current.demod_rejected_bad++;
+            return 0;
+        } else {
+            Modes.stats_current.demod_accepted[mm.correctedbits]++;
+        }
+    }
 
-        // Ideal sample values for preambles with different phase
-        // Xn is the first data symbol with phase offset N
-        //
-        // sample#: 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0
-        // phase 3: 2/4\0/5\1 0 0 0 0/5\1/3 3\0 0 0 0 0 0 X4
-        // phase 4: 1/5\0/4\2 0 0 0 0/4\2 2/4\0 0 0 0 0 0 0 X0
-        // phase 5: 0/5\1/3 3\0 0 0 0/3 3\1/5\0 0 0 0 0 0 0 X1
-        // phase 6: 0/4\2 2/4\0 0 0 0 2/4\0/5\1 0 0 0 0 0 0 X2
-        // phase 7: 0/3 3\1/5\0 0 0 0 1/5\0/4\2 0 0 0 0 0 0 X3
-        //
+    Modes.stats_current.demod_bestPhase[bestphase - 4]++;
 
-        // do a pre-check to reduce CPU usage
-        if (!(pa[1] > pa[7] && pa[12] > pa[14] && pa[12] > pa[15])) {
-            continue;
+    // measure signal power
+    {
+        double signal_power;
+        uint64_t scaled_signal_power = 0;
+        int signal_len = msglen * 12 / 5;
+        int k;
+
+        for (k = 0; k < signal_len; ++k) {
+            uint32_t mag = m[j + 19 + k];
+            scaled_signal_power += mag * mag;
         }
 
-        // 5 noise samples
-        base_noise = pa[5] + pa[8] + pa[16] + pa[17] + pa[18];
-        // pa_mag is the sum of the 4 preamble high bits
-        // minus 2 low bits between each of high bit pairs
+        signal_power = scaled_signal_power / 65535.0 / 65535.0;
+        mm.signalLevel = signal_power / signal_len;
+        Modes.stats_current.signal_power_sum += signal_power;
+        Modes.stats_current.signal_power_count += signal_len;
+        *sum_scaled_signal_power += scaled_signal_power;
 
-        // reduce number of preamble detections if we recently dropped samples
-        if (Modes.stats_15min.samples_dropped) {
-            ref_level = base_noise * max(PREAMBLE_THRESHOLD_PIZERO, Modes.preambleThreshold);
-        } else {
-            ref_level = base_noise * Modes.preambleThreshold;
-        }
+        if (mm.signalLevel > Modes.stats_current.peak_signal_power)
+            Modes.stats_current.peak_signal_power = mm.signalLevel;
+        if (mm.signalLevel > 0.50119)
+            Modes.stats_current.strong_signal_count++; // signal power above -3dBFS
+    }
 
-        ref_level >>= 5; // divide by 32
-
-        bestmsg = NULL;
-        bestscore = -42;
-        bestphase = -1;
-
-        int32_t diff_2_3 = pa[2] - pa[3];
-        int32_t sum_1_4 = pa[1] + pa[4];
-        int32_t diff_10_11 = pa[10] - pa[11];
-        int32_t common3456 = sum_1_4 - diff_2_3 + pa[9] + pa[12];
-
-        // sample#: 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0
-        // phase 3: 2/4\0/5\1 0 0 0 0/5\1/3 3\0 0 0 0 0 0 X4
-        // phase 4: 1/5\0/4\2 0 0 0 0/4\2 2/4\0 0 0 0 0 0 0 X0
-        pa_mag = common3456 - diff_10_11;
-        if (pa_mag >= ref_level) {
-            // peaks at 1,3,9,11-12: phase 3
-            score_phase(4, m, j, &bestmsg, &bestscore, &bestphase, &msg, msg1, msg2);
-            // peaks at 1,3,9,12: phase 4
-            score_phase(5, m, j, &bestmsg, &bestscore, &bestphase, &msg, msg1, msg2);
-        }
-        // sample#: 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0
-        // phase 5: 0/5\1/3 3\0 0 0 0/3 3\1/5\0 0 0 0 0 0 0 X1
-        // phase 6: 0/4\2 2/4\0 0 0 0 2/4\0/5\1 0 0 0 0 0 0 X2
-        pa_mag = common3456 + diff_10_11;
-        if (pa_mag >= ref_level) {
-            // peaks at 1,3-4,9-10,12: phase 5
-            score_phase(6, m, j, &bestmsg, &bestscore, &bestphase, &msg, msg1, msg2);
-            // peaks at 1,4,10,12: phase 6
-            score_phase(7, m, j, &bestmsg, &bestscore, &bestphase, &msg, msg1, msg2);
-        }
+    // Pass data to the next layer
+    useModesMessage(&mm);
 
-        // peaks at 1-2,4,10,12: phase 7
-        // sample#: 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0
-        // phase 7: 0/3 3\1/5\0 0 0 0 1/5\0/4\2 0 0 0 0 0 0 X3
-        pa_mag = sum_1_4 + 2 * diff_2_3 + diff_10_11 + pa[12];
-        if (pa_mag >= ref_level) {
-            score_phase(8, m, j, &bestmsg, &bestscore, &bestphase, &msg, msg1, msg2);
-        }
+    // Skip over the message:
+    // (we actually skip to 8 bits before the end of the message,
+    //  because we can often decode two messages that *almost* collide,
+    //  where the preamble of the second message clobbered the last
+    //  few bits of the first message, but the message bits didn't
+    //  overlap)
+    return msglen * 12 / 5;
+}
+
+static void update_noise_power(struct mag_buf *mag, uint32_t mlen, uint64_t sum_scaled_signal_power) {
+    double sum_signal_power = sum_scaled_signal_power / 65535.0 / 65535.0;
+    Modes.stats_current.noise_power_sum += (mag->mean_power * mlen - sum_signal_power);
+    Modes.stats_current.noise_power_count += mlen;
+
+    if (Modes.demod_gate && mlen) {
+        double noise = (mag->mean_power * mlen - sum_signal_power) / mlen;
+        demod_noise_power = demod_noise_power ? demod_noise_power + 0.1 * (noise - demod_noise_power) : noise;
+        // the mean of Rayleigh distributed noise magnitudes of that power
+        double level = sqrt(M_PI / 4 * fmax(demod_noise_power, 0)) * 65535 * pow(10, Modes.demod_gate / 20);
+        atomic_store_explicit(&demod_gate_level, (uint32_t) fmin(fmax(level, 1), 65535), memory_order_relaxed);
+    }
+}
+
+//
+// Sharded demodulation
+//
+// With --demod-threads > 1 each magnitude buffer is split into contiguous
+// slices of starting offsets. A slice may read past its end into the next
+// slice and the trailing overlap, which is always valid data as the whole
+// buffer is in memory, so every message starting inside a slice can be
+// demodulated. Workers only do the preamble search and scoring, which only
+// read shared state; the resulting candidates are decoded and passed on by
+// the main thread in slice order, and therefore in timestamp order.
+//
+
+#define DEMOD_MAX_THREADS 16
+
+// The counters of struct stats the preamble search adds to
+struct demod_counts {
+    uint32_t preambles;
+    uint32_t rejected_bad;
+    uint32_t rejected_unknown_icao;
+    uint32_t preamble_phase[5];
+    uint64_t samples_gated;
+};
+
+// A demodulated, scored but not yet decoded message
+struct demod_candidate {
+    uint32_t offset; // sample offset of the preamble
+    int score; // from scoreModesMessage
+    int phase; // best phase, 4..8
+    unsigned char msg[MODES_LONG_MSG_BYTES];
+    struct demod_counts counts; // of the slice's search up to and including this one
+};
+
+struct demod_slice {
+    pthread_t thread;
+    struct mag_buf *mag;
+    uint32_t from; // first starting offset to examine
+    uint32_t to; // one past the last starting offset to examine
+    uint32_t gate_level; // the --demod-gate level searched with
+    uint32_t filter_generation; // icaoFilterGeneration() when the search started
+    struct stats stats; // preamble statistics for this slice
+    struct demod_candidate *candidates;
+    unsigned count;
+    unsigned alloc;
+};
+
+static struct demod_slice demod_slices[DEMOD_MAX_THREADS];
+static int demod_threads = 1; // number of slices, including the one done by the main thread
+static pthread_mutex_t demod_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t demod_work_cond = PTHREAD_COND_INITIALIZER; // signals a new buffer to the workers
+static pthread_cond_t demod_done_cond = PTHREAD_COND_INITIALIZER; // signals all workers are done
+static unsigned demod_generation; // bumped for every buffer handed to the workers
+static int demod_pending; // workers still busy with the current buffer
+static bool demod_halt;
+
+static void demod_counts_take(struct demod_counts *c, const struct stats *st) {
+    c->preambles = st->demod_preambles;
+    c->rejected_bad = st->demod_rejected_bad;
+    c->rejected_unknown_icao = st->demod_rejected_unknown_icao;
+    for (int i = 0; i < 5; ++i)
+        c->preamble_phase[i] = st->demod_preamblePhase[i];
+    c->samples_gated = st->samples_gated;
+}
+
+// Add what was counted from 'from' to 'to' to st
+static void demod_counts_add(struct stats *st, const struct demod_counts *to, const struct demod_counts *from) {
+    st->demod_preambles += to->preambles - from->preambles;
+    st->demod_rejected_bad += to->rejected_bad - from->rejected_bad;
+    st->demod_rejected_unknown_icao += to->rejected_unknown_icao - from->rejected_unknown_icao;
+    for (int i = 0; i < 5; ++i)
+        st->demod_preamblePhase[i] += to->preamble_phase[i] - from->preamble_phase[i];
+    st->samples_gated += to->samples_gated - from->samples_gated;
+}
+
+static void demodulate_slice(struct demod_slice *slice) {
+    unsigned char bestmsg[MODES_LONG_MSG_BYTES];
+    int bestscore, bestphase;
+    uint16_t *m = slice->mag->data;
+    struct gate_state gs;
+    uint32_t j;
+
+    reset_stats(&slice->stats);
+    slice->count = 0;
+    slice->gate_level = gate_level();
+    slice->filter_generation = icaoFilterGeneration();
+    gate_init(&gs, slice->gate_level);
+
+    for (j = slice->from; j < slice->to; j++) {
+        j = preamble_scan_gated(&gs, &slice->stats, m, j, slice->to);
+        if (j >= slice->to)
+            break;
 
-        // no preamble detected
-        if (bestscore == -42) {
+        bestscore = score_preamble(&slice->stats, m, j, bestmsg, &bestphase);
+        if (bestscore < 0)
             continue;
+
+        if (slice->count == slice->alloc) {
+            unsigned newalloc = slice->alloc ? slice->alloc * 2 : 64;
+            struct demod_candidate *newcand = realloc(slice->candidates, newalloc * sizeof (*newcand));
+            if (!newcand) {
+                fprintf(stderr, "demod: out of memory for message candidates\n");
+                break;
+            }
+            slice->candidates = newcand;
+            slice->alloc = newalloc;
         }
 
-        // we had at least one phase greater than the preamble threshold
-        // and used scoremodesmessage on those bytes
-        Modes.stats_current.demod_preambles++;
+        struct demod_candidate *c = &slice->candidates[slice->count++];
+        c->offset = j;
+        c->score = bestscore;
+        c->phase = bestphase;
+        memcpy(c->msg, bestmsg, MODES_LONG_MSG_BYTES);
+        demod_counts_take(&c->counts, &slice->stats);
 
-        // Do we have a candidate?
-        if (bestscore < 0) {
-            if (bestscore == -1)
-                Modes.stats_current.demod_rejected_unknown_icao++;
-            else
-                Modes.stats_current.demod_rejected_bad++;
-            continue; // nope.
-        }
+        j += modesMessageLenByType(bestmsg[0] >> 3) * 12 / 5;
+    }
+}
 
-        msglen = modesMessageLenByType(bestmsg[0] >> 3);
+static void *demodWorkerEntryPoint(void *arg) {
+    struct demod_slice *slice = arg;
+    unsigned seen = 0;
 
-        // Set initial mm structure details
-        mm = zeroMessage;
+    set_thread_name("readsb-demod");
 
-        // For consistency with how the Beast / Radarcape does it,
-        // we report the timestamp at the end of bit 56 (even if
-        // the frame is a 112-bit frame)
-        mm.timestampMsg = mag->sampleTimestamp + j * 5 + (8 + 56) * 12 + bestphase;
+    pthread_mutex_lock(&demod_mutex);
+    while (true) {
+        while (!demod_halt && demod_generation == seen)
+            pthread_cond_wait(&demod_work_cond, &demod_mutex);
+        if (demod_halt)
+            break;
+        seen = demod_generation;
+        pthread_mutex_unlock(&demod_mutex);
 
-        // compute message receive time as block-start-time + difference in the 12MHz clock
-        mm.sysTimestampMsg = mag->sysTimestamp + receiveclock_ms_elapsed(mag->sampleTimestamp, mm.timestampMsg);
+        demodulate_slice(slice);
+
+        pthread_mutex_lock(&demod_mutex);
+        if (--demod_pending == 0)
+            pthread_cond_signal(&demod_done_cond);
+    }
+    pthread_mutex_unlock(&demod_mutex);
 
-        // advance ifile artifical clock for every message received
-        if (Modes.sdr_type == SDR_IFILE) {
-            Modes.ifile_now = mm.sysTimestampMsg;
+    return NULL;
+}
+
+// Start (threads - 1) demodulator worker threads; the main thread does the remaining slice.
+
+bool demod2400StartWorkers(int threads) {
+    if (threads > DEMOD_MAX_THREADS)
+        threads = DEMOD_MAX_THREADS;
+
+    demod_halt = false;
+    for (demod_threads = 1; demod_threads < threads; ++demod_threads) {
+        struct demod_slice *slice = &demod_slices[demod_threads];
+        int rc = pthread_create(&slice->thread, NULL, demodWorkerEntryPoint, slice);
+        if (rc) {
+            fprintf(stderr, "demod: can't create worker thread: %s\n", strerror(rc));
+            demod2400StopWorkers();
+            return false;
         }
+        thread_place(slice->thread, THREAD_DEMOD);
+    }
 
-        mm.score = bestscore;
-
-        // Decode the received message
-        {
-            int result = decodeModesMessage(&mm, bestmsg);
-            if (result < 0) {
-                if (result == -1)
-                    Modes.stats_current.demod_rejected_unknown_icao++;
-                else
-                    Modes.stats_current.demod_rejected_bad++;
-                continue;
+    return true;
+}
+
+void demod2400StopWorkers(void) {
+    pthread_mutex_lock(&demod_mutex);
+    demod_halt = true;
+    pthread_cond_broadcast(&demod_work_cond);
+    pthread_mutex_unlock(&demod_mutex);
+
+    for (int i = 1; i < demod_threads; ++i)
+        pthread_join(demod_slices[i].thread, NULL);
+
+    for (int i = 0; i < demod_threads; ++i) {
+        free(demod_slices[i].candidates);
+        demod_slices[i].candidates = NULL;
+        demod_slices[i].alloc = 0;
+    }
+
+    demod_threads = 1;
+}
+
+static uint32_t demodulate2400Block(struct mag_buf *mag, uint32_t j, uint32_t end, uint32_t level, uint64_t *sum_scaled_signal_power);
+
+// Decode and pass on the candidates of consecutive slices, with the same
+// messages and statistics as demodulate2400Block() over all of them. The
+// slice searches skipped over every candidate as if it decoded and went on
+// from a fresh start at the beginning of each slice. Where that's not what
+// the sequential search would have done, after a candidate that doesn't
+// decode or a message reaching into the next slice, the search is redone
+// here up to the first offset a slice search examined the same way. Once a
+// message delivered adds an address to the ICAO filter the scores found
+// without it may be wrong, and the rest of the buffer is searched again.
+
+static void deliver_slices(struct mag_buf *mag, struct demod_slice *slices, int count, uint64_t *sum_scaled_signal_power) {
+    uint32_t pos = slices[0].from; // the next offset the sequential search examines
+    bool synced = true; // the search of the current slice got to pos too
+
+    for (int s = 0; s < count; ++s) {
+        struct demod_slice *slice = &slices[s];
+        struct demod_counts last, total;
+
+        memset(&last, 0, sizeof (last));
+        if (pos != slice->from)
+            synced = false;
+
+        for (unsigned k = 0; k < slice->count; ++k) {
+            struct demod_candidate *c = &slice->candidates[k];
+
+            if (icaoFilterGeneration() != slice->filter_generation) {
+                synced = false;
+                break;
+            }
+            if (!synced) {
+                pos = demodulate2400Block(mag, pos, c->offset, slice->gate_level, sum_scaled_signal_power);
+                if (pos != c->offset)
+                    continue; // passed over by a message
+                if (icaoFilterGeneration() != slice->filter_generation)
+                    break;
+
+                // the search is back where the slice's was: score it here,
+                // the slice's counts since the last candidate were redone
+                unsigned char msg[MODES_LONG_MSG_BYTES];
+                int phase;
+                score_preamble(&Modes.stats_current, mag->data, c->offset, msg, &phase);
+                synced = true;
             } else {
-                Modes.stats_current.demod_accepted[mm.correctedbits]++;
+                demod_counts_add(&Modes.stats_current, &c->counts, &last);
             }
+            last = c->counts;
+
+            uint32_t skip = deliver_message(mag, c->offset, c->score, c->phase, c->msg, sum_scaled_signal_power);
+            pos = c->offset + skip + 1;
+            if (!skip)
+                synced = false; // searched on right after it, unlike the slice
         }
 
-        Modes.stats_current.demod_bestPhase[bestphase - 4]++;
-        
-        // measure signal power
-        {
-            double signal_power;
-            uint64_t scaled_signal_power = 0;
-            int signal_len = msglen * 12 / 5;
-            int k;
-
-            for (k = 0; k < signal_len; ++k) {
-                uint32_t mag = m[j + 19 + k];
-                scaled_signal_power += mag * mag;
-            }
+        if (synced && icaoFilterGeneration() == slice->filter_generation) {
+            demod_counts_take(&total, &slice->stats);
+            demod_counts_add(&Modes.stats_current, &total, &last);
+            if (pos < slice->to)
+                pos = slice->to;
+        } else {
+            pos = demodulate2400Block(mag, pos, slice->to, slice->gate_level, sum_scaled_signal_power);
+            synced = (pos == slice->to);
+        }
+    }
+}
 
-            signal_power = scaled_signal_power / 65535.0 / 65535.0;
-            mm.signalLevel = signal_power / signal_len;
-            Modes.stats_current.signal_power_sum += signal_power;
-            Modes.stats_current.signal_power_count += signal_len;
-            sum_scaled_signal_power += scaled_signal_power;
+static void demodulate2400Sharded(struct mag_buf *mag, uint32_t mlen) {
+    uint64_t sum_scaled_signal_power = 0;
+    int i;
 
-            if (mm.signalLevel > Modes.stats_current.peak_signal_power)
-                Modes.stats_current.peak_signal_power = mm.signalLevel;
-            if (mm.signalLevel > 0.50119)
-                Modes.stats_current.strong_signal_count++; // signal power above -3dBFS
-        }
+    for (i = 0; i < demod_threads; ++i) {
+        demod_slices[i].mag = mag;
+        demod_slices[i].from = (uint64_t) mlen * i / demod_threads;
+        demod_slices[i].to = (uint64_t) mlen * (i + 1) / demod_threads;
+    }
 
-        // Skip over the message:
-        // (we actually skip to 8 bits before the end of the message,
-        //  because we can often decode two messages that *almost* collide,
-        //  where the preamble of the second message clobbered the last
-        //  few bits of the first message, but the message bits didn't
-        //  overlap)
-        j += msglen * 12 / 5;
+    pthread_mutex_lock(&demod_mutex);
+    demod_pending = demod_threads - 1;
+    ++demod_generation;
+    pthread_cond_broadcast(&demod_work_cond);
+    pthread_mutex_unlock(&demod_mutex);
 
-        // Pass data to the next layer
-        useModesMessage(&mm);
+    demodulate_slice(&demod_slices[0]);
+
+    pthread_mutex_lock(&demod_mutex);
+    while (demod_pending > 0)
+        pthread_cond_wait(&demod_done_cond, &demod_mutex);
+    pthread_mutex_unlock(&demod_mutex);
+
+    // merge back in slice order
+    deliver_slices(mag, demod_slices, demod_threads, &sum_scaled_signal_power);
+    update_noise_power(mag, mlen, sum_scaled_signal_power);
+}
+
+static void free_prescan(void *prescan) {
+    struct demod_slice *slice = prescan;
+
+    if (slice) {
+        free(slice->candidates);
+        free(slice);
     }
+}
 
-    /* update noise power */
-    {
-        double sum_signal_power = sum_scaled_signal_power / 65535.0 / 65535.0;
-        Modes.stats_current.noise_power_sum += (mag->mean_power * mlen - sum_signal_power);
-        Modes.stats_current.noise_power_count += mlen;
+//
+// Search a whole buffer for messages and score them, without decoding, for
+// producers that demodulate ahead of the main thread (see --ifile-threads).
+// demodulate2400() then only decodes and passes on what was found here.
+// Like the slice workers this only reads shared state, though the ICAO
+// filter seen here may be a few buffers behind the main thread.
+//
+
+void demod2400Prescan(struct mag_buf *mag) {
+    struct demod_slice *slice = mag->prescan;
+
+    if (!slice) {
+        if (!(slice = calloc(1, sizeof (*slice)))) {
+            fprintf(stderr, "demod: out of memory for message candidates\n");
+            return;
+        }
+        mag->prescan = slice;
+        mag->free_prescan = free_prescan;
     }
+
+    slice->mag = mag;
+    slice->from = 0;
+    slice->to = mag->validLength - mag->overlap;
+    demodulate_slice(slice);
+    mag->flags |= MAGBUF_PRESCANNED;
+}
+
+// Block size for the demodulators that work through a buffer piecewise
+#define DEMOD_BLOCK 2048 // samples, 4kB
+
+//
+// Demodulate Mode S messages starting at offsets j..end-1 of the buffer.
+// Returns the next offset to examine, which may lie beyond end if the last
+// message found extends past it.
+//
+
+static uint32_t demodulate2400Block(struct mag_buf *mag, uint32_t j, uint32_t end, uint32_t level, uint64_t *sum_scaled_signal_power) {
+    unsigned char bestmsg[MODES_LONG_MSG_BYTES];
+    int bestscore, bestphase;
+    uint16_t *m = mag->data;
+    struct gate_state gs;
+
+    gate_init(&gs, level);
+    for (; j < end; j++) {
+        // skip ahead to the next offset that passes the pre-check
+        j = preamble_scan_gated(&gs, &Modes.stats_current, m, j, end);
+        if (j >= end)
+            break;
+
+        bestscore = score_preamble(&Modes.stats_current, m, j, bestmsg, &bestphase);
+        if (bestscore < 0)
+            continue; // nope.
+
+        j += deliver_message(mag, j, bestscore, bestphase, bestmsg, sum_scaled_signal_power);
+    }
+
+    return j;
 }
 
+//
+// Given 'mlen' magnitude samples in 'm', sampled at 2.4MHz,
+// try to demodulate some Mode S messages.
+//
+
+void demodulate2400(struct mag_buf *mag) {
+    uint32_t mlen = mag->validLength - mag->overlap;
+    uint64_t sum_scaled_signal_power = 0;
+
+    // advance ifile artificial clock even if we don't receive anything
+    if (Modes.sdr_type == SDR_IFILE) {
+        Modes.ifile_now = mag->sysTimestamp;
+    }
+
+    if (mag->flags & MAGBUF_PRESCANNED) {
+        deliver_slices(mag, mag->prescan, 1, &sum_scaled_signal_power);
+        update_noise_power(mag, mlen, sum_scaled_signal_power);
+        return;
+    }
+
+    if (demod_threads > 1) {
+        fifo_convert(mag, mag->validLength);
+        demodulate2400Sharded(mag, mlen);
+        return;
+    }
+
+    uint32_t level = gate_level();
+
+    if (mag->iq_pending) {
+        // Convert one block at a time just ahead of the demodulator, so the
+        // magnitudes are still in cache when the preamble scan reads them.
+        // Messages starting in a block may extend up to overlap samples past it.
+        uint32_t block, j = 0;
+
+        for (block = 0; block < mlen; block += DEMOD_BLOCK) {
+            uint32_t end = min(block + DEMOD_BLOCK, mlen);
+
+            fifo_convert(mag, end + mag->overlap);
+            j = demodulate2400Block(mag, j, end, level, &sum_scaled_signal_power);
+        }
+    } else {
+        demodulate2400Block(mag, 0, mlen, level, &sum_scaled_signal_power);
+    }
+
+    /* update noise power */
+    update_noise_power(mag, mlen, sum_scaled_signal_power);
+}
 
 #ifdef MODEAC_DEBUG
 
@@ -519,18 +1269,24 @@ static void draw_modeac(uint16_t *m, unsigned modeac, unsigned f1_clock, unsigne
 //
 // one 2.4MHz sample = 25 cycles
 
-void demodulate2400AC(struct mag_buf *mag) {
+static unsigned modeac_noise_level(struct mag_buf *mag) {
+    double noise_stddev = sqrt(mag->mean_power - mag->mean_level * mag->mean_level); // Var(X) = E[(X-E[X])^2] = E[X^2] - (E[X])^2
+    return (unsigned) ((mag->mean_power + noise_stddev) * 65535 + 0.5);
+}
+
+//
+// Look for Mode A/C messages with F1 starting at offsets f1_sample..end-1.
+// Returns the next offset to examine, as for demodulate2400Block().
+//
+
+static uint32_t demodulate2400ACBlock(struct mag_buf *mag, uint32_t f1_sample, uint32_t end, unsigned noise_level) {
     struct modesMessage mm;
     uint16_t *m = mag->data;
     uint32_t mlen = mag->validLength - mag->overlap;
-    unsigned f1_sample;
 
     memset(&mm, 0, sizeof (mm));
 
-    double noise_stddev = sqrt(mag->mean_power - mag->mean_level * mag->mean_level); // Var(X) = E[(X-E[X])^2] = E[X^2] - (E[X])^2
-    unsigned noise_level = (unsigned) ((mag->mean_power + noise_stddev) * 65535 + 0.5);
-
-    for (f1_sample = 1; f1_sample < mlen; ++f1_sample) {
+    for (; f1_sample < end; ++f1_sample) {
         // Mode A/C messages should match this bit sequence:
 
         // bit #     value
@@ -705,4 +1461,61 @@ void demodulate2400AC(struct mag_buf *mag) {
         f1_sample += (20 * 87 / 25);
         Modes.stats_current.demod_modeac++;
     }
+
+    return f1_sample;
+}
+
+void demodulate2400AC(struct mag_buf *mag) {
+    uint32_t mlen = mag->validLength - mag->overlap;
+
+    fifo_convert(mag, mag->validLength);
+
+    demodulate2400ACBlock(mag, 1, mlen, modeac_noise_level(mag));
+}
+
+//
+// Mode S and Mode A/C in a single pass over the buffer
+//
+// Rather than running demodulate2400() and then demodulate2400AC() over the
+// whole buffer, both detectors are run alternately over one block of samples
+// at a time, so the second one finds the block still in cache. Each keeps
+// its own position, as a message found by one detector can run past the end
+// of the current block.
+//
+
+void demodulate2400Fused(struct mag_buf *mag) {
+    uint32_t mlen = mag->validLength - mag->overlap;
+    uint64_t sum_scaled_signal_power = 0;
+    unsigned noise_level;
+    uint32_t block, j, f1_sample;
+
+    if (demod_threads > 1 || (mag->flags & MAGBUF_PRESCANNED)) {
+        // the sharded demodulator already spreads the buffer over several caches,
+        // and a prescanned buffer has no Mode S search left to fuse with
+        demodulate2400(mag);
+        demodulate2400AC(mag);
+        return;
+    }
+
+    // advance ifile artificial clock even if we don't receive anything
+    if (Modes.sdr_type == SDR_IFILE) {
+        Modes.ifile_now = mag->sysTimestamp;
+    }
+
+    // the Mode A/C noise level needs the mean over the whole buffer
+    fifo_convert(mag, mag->validLength);
+    noise_level = modeac_noise_level(mag);
+
+    uint32_t level = gate_level();
+    j = 0;
+    f1_sample = 1;
+    for (block = 0; block < mlen; block += DEMOD_BLOCK) {
+        uint32_t end = min(block + DEMOD_BLOCK, mlen);
+
+        j = demodulate2400Block(mag, j, end, level, &sum_scaled_signal_power);
+        f1_sample = demodulate2400ACBlock(mag, f1_sample, end, noise_level);
+    }
+
+    /* update noise power */
+    update_noise_power(mag, mlen, sum_scaled_signal_power);
 }
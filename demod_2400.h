@@ -25,6 +25,7 @@
 #define DEMOD_2400_H
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #define PREAMBLE_THRESHOLD_MIN 40
 #define PREAMBLE_THRESHOLD_HOT 42
@@ -34,7 +35,13 @@
 
 struct mag_buf;
 
+void demod2400Init(void);
+const char *demod2400ScannerName(void);
+bool demod2400StartWorkers(int threads);
+void demod2400StopWorkers(void);
+void demod2400Prescan(struct mag_buf *mag);
 void demodulate2400(struct mag_buf *mag);
 void demodulate2400AC(struct mag_buf *mag);
+void demodulate2400Fused(struct mag_buf *mag);
 
 #endif
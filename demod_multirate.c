@@ -0,0 +1,259 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// demod_multirate.c: Mode S demodulators for 2.0, 6.0 and 8.0MHz.
+//
+// Copyright (c) 2020 Michael Wolf <michael@mictronics.de>
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "readsb.h"
+
+// Integer ratio sampling rate versions
+//
+// At 2.0, 6.0 and 8.0MHz each 500ns symbol spans a whole number of samples
+// (1, 3 and 4), so unlike at 2.4MHz there is no fractional phase to track:
+// a symbol is the sum of its samples, and a bit is a 1 if its first symbol
+// is stronger than its second one.
+//
+// The demodulator is written once as demodulate_fixed() and instantiated for
+// each rate with a constant symbol width, so the compiler can fully unroll
+// the symbol sums and bit slicing.
+//
+// Preamble, in symbols (sps samples each):
+//
+// symbol#: 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5
+//          1 0 1 0 0 0 0 1 0 1 0 0 0 0 0 0 X0
+//
+
+static inline __attribute__ ((always_inline)) uint32_t symbol(const uint16_t *m, const int sps) {
+    uint32_t sum = 0;
+    for (int i = 0; i < sps; ++i)
+        sum += m[i];
+    return sum;
+}
+
+#define SYM(pa, n) symbol(&(pa)[(n) * sps], sps)
+
+static inline __attribute__ ((always_inline)) int preamble_precheck(const uint16_t *pa, const int sps) {
+    return SYM(pa, 0) > SYM(pa, 1) && SYM(pa, 2) > SYM(pa, 3) && SYM(pa, 7) > SYM(pa, 6) && SYM(pa, 9) > SYM(pa, 10);
+}
+
+// sum of the 4 preamble pulses minus the gaps between the pulse pairs
+static inline __attribute__ ((always_inline)) int32_t preamble_mag(const uint16_t *pa, const int sps) {
+    return SYM(pa, 0) + SYM(pa, 2) + SYM(pa, 7) + SYM(pa, 9) - SYM(pa, 1) - SYM(pa, 8);
+}
+
+// 5 quiet symbols
+static inline __attribute__ ((always_inline)) int32_t preamble_noise(const uint16_t *pa, const int sps) {
+    return SYM(pa, 4) + SYM(pa, 5) + SYM(pa, 11) + SYM(pa, 12) + SYM(pa, 13);
+}
+
+// extract one byte starting at *pPtr and advance it by 8 bits
+
+static inline __attribute__ ((always_inline)) uint8_t slice_byte(const uint16_t **pPtr, const int sps) {
+    uint8_t theByte = 0;
+    for (int i = 0; i < 8; ++i) {
+        theByte = (theByte << 1) | (SYM(*pPtr, 0) > SYM(*pPtr, 1) ? 1 : 0);
+        *pPtr += 2 * sps;
+    }
+    return theByte;
+}
+
+#undef SYM
+
+// slice the message bits starting at m into msg, return the message length
+// in bytes or 0 for an unknown DF
+
+static inline __attribute__ ((always_inline)) int slice_message(const uint16_t *m, unsigned char *msg, const int sps) {
+    int i, bytelen;
+
+    msg[0] = slice_byte(&m, sps);
+
+    switch (msg[0] >> 3) {
+        case 0: case 4: case 5: case 11:
+            bytelen = MODES_SHORT_MSG_BYTES;
+            break;
+
+        case 16: case 17: case 18: case 20: case 21: case 24:
+            bytelen = MODES_LONG_MSG_BYTES;
+            break;
+
+        default:
+            return 0; // unknown DF, give up immediately
+    }
+
+    for (i = 1; i < bytelen; ++i)
+        msg[i] = slice_byte(&m, sps);
+
+    return bytelen;
+}
+
+static inline __attribute__ ((always_inline)) void demodulate_fixed(struct mag_buf *mag, const int sps) {
+    static struct modesMessage zeroMessage;
+    unsigned char msg[MODES_LONG_MSG_BYTES];
+    uint16_t *m = mag->data;
+    uint32_t mlen = mag->validLength - mag->overlap;
+    uint64_t sum_scaled_signal_power = 0;
+    uint32_t j;
+
+    // advance ifile artificial clock even if we don't receive anything
+    if (Modes.sdr_type == SDR_IFILE) {
+        Modes.ifile_now = mag->sysTimestamp;
+    }
+
+    fifo_convert(mag, mag->validLength);
+
+    for (j = 0; j < mlen; j++) {
+        uint16_t *pa = &m[j];
+        int32_t pa_mag, ref_level;
+        int bytelen, score;
+
+        if (!preamble_precheck(pa, sps))
+            continue;
+
+        // reduce number of preamble detections if we recently dropped samples
+        if (Modes.stats_15min.sum.samples_dropped) {
+            ref_level = preamble_noise(pa, sps) * max(PREAMBLE_THRESHOLD_PIZERO, Modes.preambleThreshold);
+        } else {
+            ref_level = preamble_noise(pa, sps) * Modes.preambleThreshold;
+        }
+        ref_level >>= 5; // divide by 32
+
+        pa_mag = preamble_mag(pa, sps);
+        if (pa_mag < ref_level)
+            continue;
+
+        // With several samples per symbol the neighbouring offsets pass as well;
+        // wait for the one best aligned with the preamble pulses.
+        if (sps > 1 && preamble_mag(pa + 1, sps) > pa_mag)
+            continue;
+
+        Modes.stats_current.demod_preambles++;
+
+        bytelen = slice_message(pa + 16 * sps, msg, sps);
+        score = bytelen ? scoreModesMessage(msg, bytelen * 8) : -2;
+        if (score < 0) {
+            if (score == -1)
+                Modes.stats_current.demod_rejected_unknown_icao++;
+            else
+                Modes.stats_current.demod_rejected_bad++;
+            continue; // nope.
+        }
+
+        struct modesMessage mm = zeroMessage;
+        int msglen = modesMessageLenByType(msg[0] >> 3);
+
+        // timestamp at the end of bit 56 as for the 2.4MHz demodulator;
+        // 12MHz clock ticks per sample are 6 / sps
+        mm.timestampMsg = mag->sampleTimestamp + ((uint64_t) j * 6 + sps / 2) / sps + (8 + 56) * 12;
+
+        // compute message receive time as block-start-time + difference in the 12MHz clock
+        mm.sysTimestampMsg = mag->sysTimestamp + receiveclock_ms_elapsed(mag->sampleTimestamp, mm.timestampMsg);
+
+        // advance ifile artifical clock for every message received
+        if (Modes.sdr_type == SDR_IFILE) {
+            Modes.ifile_now = mm.sysTimestampMsg;
+        }
+
+        mm.score = score;
+
+        // Decode the received message
+        {
+            int result = decodeModesMessage(&mm, msg);
+            if (result < 0) {
+                if (result == -1)
+                    Modes.stats_current.demod_rejected_unknown_icao++;
+                else
+                    Modes.stats_current.demod_rejected_bad++;
+                continue;
+            } else {
+                Modes.stats_current.demod_accepted[mm.correctedbits]++;
+            }
+        }
+
+        // measure signal power
+        {
+            double signal_power;
+            uint64_t scaled_signal_power = 0;
+            int signal_len = msglen * 2 * sps;
+            int k;
+
+            for (k = 0; k < signal_len; ++k) {
+                uint32_t mag = pa[16 * sps + k];
+                scaled_signal_power += mag * mag;
+            }
+
+            signal_power = scaled_signal_power / 65535.0 / 65535.0;
+            mm.signalLevel = signal_power / signal_len;
+            Modes.stats_current.signal_power_sum += signal_power;
+            Modes.stats_current.signal_power_count += signal_len;
+            sum_scaled_signal_power += scaled_signal_power;
+
+            if (mm.signalLevel > Modes.stats_current.peak_signal_power)
+                Modes.stats_current.peak_signal_power = mm.signalLevel;
+            if (mm.signalLevel > 0.50119)
+                Modes.stats_current.strong_signal_count++; // signal power above -3dBFS
+        }
+
+        // Pass data to the next layer
+        useModesMessage(&mm);
+
+        // Skip over the message, up to 8 bits before its end
+        // (the preamble is not included), see demodulate2400()
+        j += msglen * 2 * sps;
+    }
+
+    /* update noise power */
+    {
+        double sum_signal_power = sum_scaled_signal_power / 65535.0 / 65535.0;
+        Modes.stats_current.noise_power_sum += (mag->mean_power * mlen - sum_signal_power);
+        Modes.stats_current.noise_power_count += mlen;
+    }
+}
+
+// 1 sample per symbol
+void demodulate2000(struct mag_buf *mag) {
+    demodulate_fixed(mag, 1);
+}
+
+// 3 samples per symbol
+void demodulate6000(struct mag_buf *mag) {
+    demodulate_fixed(mag, 3);
+}
+
+// 4 samples per symbol
+void demodulate8000(struct mag_buf *mag) {
+    demodulate_fixed(mag, 4);
+}
+
+static struct {
+    double sample_rate;
+    demodulate_fn demodulate;
+} demodulators[] = {
+    { 2000000.0, demodulate2000},
+    { 2400000.0, demodulate2400},
+    { 6000000.0, demodulate6000},
+    { 8000000.0, demodulate8000},
+    { 0, NULL}
+};
+
+// Return the demodulator for the given sample rate, or NULL if there is none
+
+demodulate_fn demodSelect(double sample_rate) {
+    for (int i = 0; demodulators[i].demodulate; ++i) {
+        if (fabs(demodulators[i].sample_rate - sample_rate) < 1.0)
+            return demodulators[i].demodulate;
+    }
+    return NULL;
+}
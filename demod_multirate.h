@@ -0,0 +1,32 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// demod_multirate.h: Mode S demodulators for 2.0, 6.0 and 8.0MHz prototypes.
+//
+// Copyright (c) 2020 Michael Wolf <michael@mictronics.de>
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef DEMOD_MULTIRATE_H
+#define DEMOD_MULTIRATE_H
+
+struct mag_buf;
+
+typedef void (*demodulate_fn)(struct mag_buf *mag);
+
+void demodulate2000(struct mag_buf *mag);
+void demodulate6000(struct mag_buf *mag);
+void demodulate8000(struct mag_buf *mag);
+demodulate_fn demodSelect(double sample_rate);
+
+#endif
@@ -28,6 +28,9 @@
 #include <string.h>
 #include <pthread.h>
 #include <assert.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
 
 static pthread_mutex_t fifo_mutex = PTHREAD_MUTEX_INITIALIZER; // mutex protecting the queues
 static pthread_cond_t fifo_notempty_cond = PTHREAD_COND_INITIALIZER; // condition used to signal FIFO-not-empty
@@ -37,18 +40,201 @@ static struct mag_buf *fifo_head; // head of queued buffers awaiting demodulatio
 static struct mag_buf *fifo_tail; // tail of queued buffers awaiting demodulation
 static struct mag_buf *fifo_freelist; // freelist of preallocated buffers
 static bool fifo_halted; // true if queue has been halted
+static unsigned fifo_queued; // number of buffers between fifo_head and fifo_tail
 
 static unsigned overlap_length; // desired overlap size in samples (size of overlap_buffer)
-static uint16_t *overlap_buffer; // buffer used to save overlapping data
+static uint16_t *overlap_buffer; // buffer used to save overlapping data, overlap_length per receiver
+
+static void *hugepage_region; // sample data of all buffers, if allocated with FIFO_HUGEPAGES
+static size_t hugepage_region_size;
+
+//
+// Lock-free mode (FIFO_LOCKFREE)
+//
+// There is exactly one producer (the SDR thread: acquire / enqueue) and one
+// consumer (the demodulator: dequeue / release), so filled buffers travel
+// through one single-producer/single-consumer ring and are returned through
+// another one running the other way. Each ring index is only written by one
+// side and sits on its own cache line.
+//
+// A side that finds its ring empty spins for up to spin_us and then parks on
+// the condition variables above. It announces this in a waiting flag that the
+// other side checks after publishing; with both the flag and the index
+// accessed sequentially consistent at least one of them sees the other, so no
+// wakeup is lost.
+//
+
+#define FIFO_CACHE_LINE 64
+
+struct fifo_ring {
+    _Alignas(FIFO_CACHE_LINE) atomic_uint head; // next slot to read, written by the reader
+    _Alignas(FIFO_CACHE_LINE) atomic_uint tail; // next slot to write, written by the writer
+    _Alignas(FIFO_CACHE_LINE) atomic_bool waiting; // reader is parked, or about to park
+    unsigned mask;
+    struct mag_buf **slots;
+};
+
+static bool fifo_lockfree;
+static unsigned fifo_spin_us;
+static struct fifo_ring fifo_full_ring; // producer -> consumer
+static struct fifo_ring fifo_free_ring; // consumer -> producer
+static atomic_bool fifo_ring_halted;
+static atomic_bool fifo_draining;
+static struct mag_buf **fifo_all_buffers; // every buffer, for fifo_destroy() in lock-free mode
+static unsigned fifo_buffer_count;
+
+static bool ring_init(struct fifo_ring *ring, unsigned count) {
+    unsigned size = 1;
+    while (size < count)
+        size <<= 1;
+
+    if (!(ring->slots = calloc(size, sizeof (ring->slots[0]))))
+        return false;
+    ring->mask = size - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->waiting, false);
+    return true;
+}
+
+static void ring_free(struct fifo_ring *ring) {
+    free(ring->slots);
+    ring->slots = NULL;
+}
+
+static bool ring_empty(struct fifo_ring *ring) {
+    return atomic_load(&ring->head) == atomic_load(&ring->tail);
+}
+
+// Writer side; the ring is sized for all buffers so it can't overflow
+static void ring_push(struct fifo_ring *ring, struct mag_buf *buf, pthread_cond_t *cond) {
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    ring->slots[tail & ring->mask] = buf;
+    atomic_store(&ring->tail, tail + 1);
+
+    if (atomic_load(&ring->waiting)) {
+        pthread_mutex_lock(&fifo_mutex);
+        pthread_cond_signal(cond);
+        pthread_mutex_unlock(&fifo_mutex);
+    }
+}
+
+static struct mag_buf *ring_try_pop(struct fifo_ring *ring) {
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (head == atomic_load_explicit(&ring->tail, memory_order_acquire))
+        return NULL;
+
+    struct mag_buf *buf = ring->slots[head & ring->mask];
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return buf;
+}
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+// Reader side: spin for up to fifo_spin_us, then park for the remaining timeout
+static struct mag_buf *ring_pop(struct fifo_ring *ring, pthread_cond_t *cond, uint32_t timeout_ms) {
+    struct mag_buf *buf;
+    struct timespec deadline;
+
+    if ((buf = ring_try_pop(ring)) || !timeout_ms || atomic_load(&fifo_ring_halted))
+        return buf;
+
+    if (fifo_spin_us) {
+        struct timespec start, now;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        do {
+            for (int i = 0; i < 64; ++i) {
+                if ((buf = ring_try_pop(ring)))
+                    return buf;
+                cpu_relax();
+            }
+            clock_gettime(CLOCK_MONOTONIC, &now);
+        } while (!atomic_load(&fifo_ring_halted) &&
+                (now.tv_sec - start.tv_sec) * 1000000 + (now.tv_nsec - start.tv_nsec) / 1000 < fifo_spin_us);
+    }
+
+    get_deadline(timeout_ms, &deadline);
+
+    pthread_mutex_lock(&fifo_mutex);
+    atomic_store(&ring->waiting, true);
+    atomic_thread_fence(memory_order_seq_cst); // order the flag before re-reading the tail
+    while (!(buf = ring_try_pop(ring)) && !atomic_load(&fifo_ring_halted)) {
+        if (pthread_cond_timedwait(cond, &fifo_mutex, &deadline) == ETIMEDOUT)
+            break;
+    }
+    atomic_store(&ring->waiting, false);
+    pthread_mutex_unlock(&fifo_mutex);
+
+    if (!buf)
+        buf = ring_try_pop(ring);
+    return buf;
+}
+
+// Allocate the sample data of all buffers in one region backed by huge pages,
+// falling back to transparent huge pages if none are reserved.
+
+static uint16_t *alloc_hugepage_region(unsigned buffer_count, size_t buffer_bytes) {
+    const size_t huge = 2 * 1024 * 1024;
+    size_t size = ((size_t) buffer_count * buffer_bytes + huge - 1) & ~(huge - 1);
+    void *region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+    if (region == MAP_FAILED) {
+        region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (region == MAP_FAILED)
+            return NULL;
+        madvise(region, size, MADV_HUGEPAGE);
+    }
+
+    // fault the pages in now, from the thread creating the FIFO, so they
+    // come from its NUMA node rather than from wherever the reader that
+    // happens to write them first runs (see thread_place())
+    memset(region, 0, size);
+
+    hugepage_region = region;
+    hugepage_region_size = size;
+    return region;
+}
+
+// New samples are converted to data[overlap]. Every buffer starts data_pad
+// samples into its allocation so that position is cache line aligned, which
+// suits the vector stores of the converters.
+#define FIFO_DATA_ALIGN 64
+static unsigned data_pad;
 
 // Create the queue structures. Not threadsafe.
 
-bool fifo_create(unsigned buffer_count, unsigned buffer_size, unsigned overlap) {
-    if (!(overlap_buffer = calloc(overlap, sizeof (overlap_buffer[0])))) {
+bool fifo_create(unsigned buffer_count, unsigned buffer_size, unsigned overlap, fifo_flags flags, unsigned spin_us) {
+    uint16_t *region = NULL;
+    size_t buffer_bytes;
+
+    if (!(overlap_buffer = calloc((size_t) overlap * FIFO_MAX_RECEIVERS, sizeof (overlap_buffer[0])))) {
         goto nomem;
     }
 
     overlap_length = overlap;
+    fifo_lockfree = (flags & FIFO_LOCKFREE) != 0;
+    fifo_spin_us = spin_us;
+    atomic_init(&fifo_ring_halted, false);
+    atomic_init(&fifo_draining, false);
+
+    data_pad = (FIFO_DATA_ALIGN - overlap * sizeof (uint16_t) % FIFO_DATA_ALIGN) % FIFO_DATA_ALIGN / sizeof (uint16_t);
+    buffer_bytes = ((data_pad + buffer_size) * sizeof (uint16_t) + FIFO_DATA_ALIGN - 1) & ~(FIFO_DATA_ALIGN - 1);
+
+    if (flags & FIFO_HUGEPAGES) {
+        if (!(region = alloc_hugepage_region(buffer_count, buffer_bytes)))
+            fprintf(stderr, "fifo: can't map huge pages, using normal allocation: %s\n", strerror(errno));
+    }
+
+    if (fifo_lockfree) {
+        if (!ring_init(&fifo_full_ring, buffer_count) || !ring_init(&fifo_free_ring, buffer_count))
+            goto nomem;
+        if (!(fifo_all_buffers = calloc(buffer_count, sizeof (fifo_all_buffers[0]))))
+            goto nomem;
+    }
 
     for (unsigned i = 0; i < buffer_count; ++i) {
         struct mag_buf *newbuf;
@@ -56,14 +242,26 @@ bool fifo_create(unsigned buffer_count, unsigned buffer_size, unsigned overlap)
             goto nomem;
         }
 
-        if (!(newbuf->data = calloc(buffer_size, sizeof (newbuf->data[0])))) {
-            free(newbuf);
-            goto nomem;
+        if (region) {
+            newbuf->data = (uint16_t *) ((char *) region + i * buffer_bytes) + data_pad;
+        } else {
+            void *p;
+            if (posix_memalign(&p, FIFO_DATA_ALIGN, buffer_bytes)) {
+                free(newbuf);
+                goto nomem;
+            }
+            memset(p, 0, buffer_bytes);
+            newbuf->data = (uint16_t *) p + data_pad;
         }
 
         newbuf->totalLength = buffer_size;
-        newbuf->next = fifo_freelist;
-        fifo_freelist = newbuf;
+        if (fifo_lockfree) {
+            fifo_all_buffers[fifo_buffer_count++] = newbuf;
+            ring_push(&fifo_free_ring, newbuf, &fifo_free_cond);
+        } else {
+            newbuf->next = fifo_freelist;
+            fifo_freelist = newbuf;
+        }
     }
 
     return true;
@@ -73,26 +271,147 @@ nomem:
     return false;
 }
 
+static bool alloc_iq(struct mag_buf *buf, unsigned bytes_per_sample) {
+    free(buf->iq_data);
+    if (!(buf->iq_data = malloc((size_t) (buf->totalLength - overlap_length) * bytes_per_sample))) {
+        fprintf(stderr, "Out of memory allocating FIFO sample storage\n");
+        return false;
+    }
+    return true;
+}
+
+bool fifo_alloc_iq(unsigned bytes_per_sample) {
+    if (fifo_lockfree) {
+        for (unsigned i = 0; i < fifo_buffer_count; ++i) {
+            if (!alloc_iq(fifo_all_buffers[i], bytes_per_sample))
+                return false;
+        }
+        return true;
+    }
+
+    for (struct mag_buf *buf = fifo_freelist; buf; buf = buf->next) {
+        if (!alloc_iq(buf, bytes_per_sample))
+            return false;
+    }
+
+    return true;
+}
+
+void fifo_defer_conversion(struct mag_buf *buf, void *iq, unsigned nsamples, unsigned bytes_per_sample,
+        iq_convert_fn converter, struct converter_state *state) {
+    double mean_level, mean_power;
+
+    buf->validLength = buf->overlap + nsamples;
+    buf->iq_source = iq;
+    buf->bytes_per_sample = bytes_per_sample;
+    buf->converter = converter;
+    buf->converter_state = state;
+
+    if (nsamples <= buf->overlap) {
+        // too short to be worth it
+        converter(iq, &buf->data[buf->overlap], nsamples, state, &buf->mean_level, &buf->mean_power);
+        buf->iq_pending = false;
+        return;
+    }
+
+    // sample k of iq_source belongs at data[overlap + k]
+    unsigned tail = buf->validLength - buf->overlap;
+    converter((char *) iq + (size_t) (tail - buf->overlap) * bytes_per_sample,
+            &buf->data[tail], buf->overlap, state, &mean_level, &mean_power);
+
+    buf->iq_sum_level = mean_level * buf->overlap;
+    buf->iq_sum_power = mean_power * buf->overlap;
+    buf->iq_converted = buf->overlap;
+    buf->iq_pending = true;
+}
+
+void fifo_convert(struct mag_buf *buf, unsigned upto) {
+    unsigned tail, n;
+    double mean_level, mean_power;
+
+    if (!buf->iq_pending)
+        return;
+
+    tail = buf->validLength - buf->overlap;
+    if (upto > tail)
+        upto = tail;
+    if (upto <= buf->iq_converted)
+        return;
+
+    n = upto - buf->iq_converted;
+    buf->converter((char *) buf->iq_source + (size_t) (buf->iq_converted - buf->overlap) * buf->bytes_per_sample,
+            &buf->data[buf->iq_converted], n, buf->converter_state, &mean_level, &mean_power);
+    buf->iq_sum_level += mean_level * n;
+    buf->iq_sum_power += mean_power * n;
+    buf->iq_converted = upto;
+
+    if (upto == tail) {
+        unsigned nsamples = buf->validLength - buf->overlap;
+        buf->mean_level = buf->iq_sum_level / nsamples;
+        buf->mean_power = buf->iq_sum_power / nsamples;
+        buf->iq_pending = false;
+    }
+}
+
+static void free_buffer(struct mag_buf *buf) {
+    if (buf->free_prescan)
+        buf->free_prescan(buf->prescan);
+    free(buf->iq_data);
+    if (!hugepage_region)
+        free(buf->data - data_pad);
+    free(buf);
+}
+
 static void free_buffer_list(struct mag_buf *head) {
     while (head) {
         struct mag_buf *next = head->next;
-        free(head->data);
-        free(head);
+        free_buffer(head);
         head = next;
     }
 }
 
 void fifo_destroy() {
-    free_buffer_list(fifo_head);
-    free_buffer_list(fifo_freelist);
+    if (fifo_lockfree) {
+        // buffers may be in either ring, or held by a thread that was stopped
+        for (unsigned i = 0; i < fifo_buffer_count; ++i)
+            free_buffer(fifo_all_buffers[i]);
+        free(fifo_all_buffers);
+        fifo_all_buffers = NULL;
+        fifo_buffer_count = 0;
+        ring_free(&fifo_full_ring);
+        ring_free(&fifo_free_ring);
+    } else {
+        free_buffer_list(fifo_head);
+        free_buffer_list(fifo_freelist);
+    }
     fifo_freelist = NULL;
     fifo_head = fifo_tail = NULL;
+    fifo_queued = 0;
+
+    if (hugepage_region) {
+        munmap(hugepage_region, hugepage_region_size);
+        hugepage_region = NULL;
+    }
 
     free(overlap_buffer);
     overlap_buffer = NULL;
 }
 
 void fifo_drain() {
+    if (fifo_lockfree) {
+        // the consumer signals fifo_empty_cond when it empties the ring while we wait
+        pthread_mutex_lock(&fifo_mutex);
+        atomic_store(&fifo_draining, true);
+        while (!ring_empty(&fifo_full_ring) && !atomic_load(&fifo_ring_halted)) {
+            struct timespec deadline;
+            get_deadline(100, &deadline);
+            pthread_cond_timedwait(&fifo_empty_cond, &fifo_mutex, &deadline);
+        }
+        atomic_store(&fifo_draining, false);
+        pthread_mutex_unlock(&fifo_mutex);
+        return;
+    }
+
     pthread_mutex_lock(&fifo_mutex);
     while (fifo_head && !fifo_halted) {
         pthread_cond_wait(&fifo_empty_cond, &fifo_mutex);
@@ -101,6 +420,18 @@ void fifo_drain() {
 }
 
 void fifo_halt() {
+    if (fifo_lockfree) {
+        // Buffers stay where they are, both rings have a single owner on each
+        // side; fifo_destroy() frees them wherever they are.
+        pthread_mutex_lock(&fifo_mutex);
+        atomic_store(&fifo_ring_halted, true);
+        pthread_cond_broadcast(&fifo_notempty_cond);
+        pthread_cond_broadcast(&fifo_empty_cond);
+        pthread_cond_broadcast(&fifo_free_cond);
+        pthread_mutex_unlock(&fifo_mutex);
+        return;
+    }
+
     pthread_mutex_lock(&fifo_mutex);
 
     // Drain all enqueued buffers to the freelist
@@ -113,6 +444,7 @@ void fifo_halt() {
     }
 
     fifo_tail = NULL;
+    fifo_queued = 0;
     fifo_halted = true;
 
     // wake all waiters
@@ -122,7 +454,28 @@ void fifo_halt() {
     pthread_mutex_unlock(&fifo_mutex);
 }
 
+static void reset_buffer(struct mag_buf *result) {
+    result->overlap = overlap_length;
+    result->validLength = result->overlap;
+    result->sampleTimestamp = 0;
+    result->sysTimestamp = 0;
+    result->flags = 0;
+    result->receiver_id = 0;
+    result->receiveTime = 0;
+    result->iq_pending = false;
+    result->next = NULL;
+}
+
 struct mag_buf *fifo_acquire(uint32_t timeout_ms) {
+    if (fifo_lockfree) {
+        struct mag_buf *result = ring_pop(&fifo_free_ring, &fifo_free_cond, timeout_ms);
+        if (!result || atomic_load(&fifo_ring_halted))
+            return NULL; // a buffer taken while halting is freed by fifo_destroy()
+
+        reset_buffer(result);
+        return result;
+    }
+
     struct timespec deadline;
     if (timeout_ms) {
         get_deadline(timeout_ms, &deadline);
@@ -149,13 +502,7 @@ struct mag_buf *fifo_acquire(uint32_t timeout_ms) {
     if (!fifo_halted) {
         result = fifo_freelist;
         fifo_freelist = result->next;
-
-        result->overlap = overlap_length;
-        result->validLength = result->overlap;
-        result->sampleTimestamp = 0;
-        result->sysTimestamp = 0;
-        result->flags = 0;
-        result->next = NULL;
+        reset_buffer(result);
     }
 
 done:
@@ -163,10 +510,59 @@ done:
     return result;
 }
 
+uint64_t fifo_clock_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000U + ts.tv_nsec / 1000U;
+}
+
+// Queue instrumentation, done by the consumer as it takes a buffer
+
+static void measure_queue(struct mag_buf *buf, unsigned depth) {
+    uint64_t now = fifo_clock_us();
+    buf->queueLatency = (now > buf->enqueueTime) ? now - buf->enqueueTime : 0;
+    buf->queueDepth = depth;
+}
+
+// Producer side of the queue instrumentation
+
+static void stamp_enqueue(struct mag_buf *buf) {
+    buf->enqueueTime = fifo_clock_us();
+    buf->fillLatency = (buf->receiveTime && buf->enqueueTime > buf->receiveTime) ? buf->enqueueTime - buf->receiveTime : 0;
+}
+
+// Overlap handling, done by the producer before the buffer is published
+
+static void fill_overlap(struct mag_buf *buf) {
+    assert(buf->receiver_id < FIFO_MAX_RECEIVERS);
+    uint16_t *saved = overlap_buffer + (size_t) buf->receiver_id * overlap_length;
+
+    // Populate the overlap region
+    if (buf->flags & MAGBUF_DISCONTINUOUS) {
+        // This buffer is discontinuous to the previous, so the overlap region is not valid; zero it out
+        memset(buf->data, 0, overlap_length * sizeof (buf->data[0]));
+    } else {
+        memcpy(buf->data, saved, overlap_length * sizeof (buf->data[0]));
+    }
+
+    // Save the tail of the buffer for next time
+    memcpy(saved, &buf->data[buf->validLength - overlap_length], overlap_length * sizeof (overlap_buffer[0]));
+}
+
 void fifo_enqueue(struct mag_buf *buf) {
     assert(buf->validLength <= buf->totalLength);
     assert(buf->validLength >= overlap_length);
 
+    if (fifo_lockfree) {
+        if (atomic_load(&fifo_ring_halted))
+            return; // shutting down, the buffer is freed by fifo_destroy()
+
+        fill_overlap(buf);
+        stamp_enqueue(buf);
+        ring_push(&fifo_full_ring, buf, &fifo_notempty_cond);
+        return;
+    }
+
     pthread_mutex_lock(&fifo_mutex);
 
     if (fifo_halted) {
@@ -176,24 +572,18 @@ void fifo_enqueue(struct mag_buf *buf) {
         goto done;
     }
 
-    // Populate the overlap region
-    if (buf->flags & MAGBUF_DISCONTINUOUS) {
-        // This buffer is discontinuous to the previous, so the overlap region is not valid; zero it out
-        memset(buf->data, 0, overlap_length * sizeof (buf->data[0]));
-    } else {
-        memcpy(buf->data, overlap_buffer, overlap_length * sizeof (buf->data[0]));
-    }
-
-    // Save the tail of the buffer for next time
-    memcpy(overlap_buffer, &buf->data[buf->validLength - overlap_length], overlap_length * sizeof (overlap_buffer[0]));
+    fill_overlap(buf);
+    stamp_enqueue(buf);
 
     // enqueue and tell the main thread
     buf->next = NULL;
+    fifo_queued++;
     if (!fifo_head) {
         fifo_head = fifo_tail = buf;
         pthread_cond_signal(&fifo_notempty_cond);
     } else {
         fifo_tail->next = buf;
+        fifo_tail = buf;
     }
 
 done:
@@ -201,6 +591,23 @@ done:
 }
 
 struct mag_buf *fifo_dequeue(uint32_t timeout_ms) {
+    if (fifo_lockfree) {
+        if (atomic_load(&fifo_ring_halted))
+            return NULL;
+
+        struct mag_buf *result = ring_pop(&fifo_full_ring, &fifo_notempty_cond, timeout_ms);
+        if (!result)
+            return NULL;
+
+        measure_queue(result, atomic_load(&fifo_full_ring.tail) - atomic_load(&fifo_full_ring.head) + 1);
+        if (atomic_load(&fifo_draining) && ring_empty(&fifo_full_ring)) {
+            pthread_mutex_lock(&fifo_mutex);
+            pthread_cond_broadcast(&fifo_empty_cond);
+            pthread_mutex_unlock(&fifo_mutex);
+        }
+        return result;
+    }
+
     struct timespec deadline;
     if (timeout_ms) {
         get_deadline(timeout_ms, &deadline);
@@ -228,6 +635,7 @@ struct mag_buf *fifo_dequeue(uint32_t timeout_ms) {
         result = fifo_head;
         fifo_head = result->next;
         result->next = NULL;
+        measure_queue(result, fifo_queued--);
         if (!fifo_head) {
             fifo_tail = NULL;
             pthread_cond_broadcast(&fifo_empty_cond);
@@ -240,6 +648,11 @@ done:
 }
 
 void fifo_release(struct mag_buf *buf) {
+    if (fifo_lockfree) {
+        ring_push(&fifo_free_ring, buf, &fifo_free_cond);
+        return;
+    }
+
     pthread_mutex_lock(&fifo_mutex);
     if (!fifo_freelist) {
         pthread_cond_signal(&fifo_free_cond);
@@ -248,4 +661,3 @@ void fifo_release(struct mag_buf *buf) {
     fifo_freelist = buf;
     pthread_mutex_unlock(&fifo_mutex);
 }
-
@@ -25,10 +25,13 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "convert.h"
+
 // Values for mag_buf.flags
 
 typedef enum {
     MAGBUF_DISCONTINUOUS = 1, // this buffer is discontinuous to the previous buffer
+    MAGBUF_PRESCANNED = 2, // the producer already searched this buffer for messages, see prescan
 } mag_buf_flags;
 
 // Structure representing one magnitude buffer
@@ -68,16 +71,76 @@ struct mag_buf {
     double mean_level; // Mean of normalized (0..1) signal level
     double mean_power; // Mean of normalized (0..1) power level
     unsigned dropped; // (approx) number of dropped samples
+    unsigned receiver_id; // receiver that produced this block, set by the producer after fifo_acquire()
+
+    // Queue instrumentation, see struct stats
+    uint64_t receiveTime; // fifo_clock_us() when the producer got the samples, 0 if it doesn't say
+    uint64_t enqueueTime; // fifo_clock_us() at fifo_enqueue()
+    unsigned fillLatency; // microseconds from receiveTime to fifo_enqueue(), 0 if not known
+    unsigned queueLatency; // microseconds spent in the queue, set by fifo_dequeue()
+    unsigned queueDepth; // buffers queued when dequeued, including this one
+
+    // Deferred conversion, see fifo_defer_conversion()
+    void *iq_data; // raw sample storage, allocated by fifo_alloc_iq()
+    void *iq_source; // raw samples to convert: iq_data, or memory of the producer
+    bool iq_pending; // iq_source holds samples not yet converted into data
+    unsigned iq_converted; // data is valid below this offset, and for the trailing overlap
+    iq_convert_fn converter;
+    struct converter_state *converter_state;
+    unsigned bytes_per_sample;
+    double iq_sum_level; // sums over the samples converted so far, for mean_level / mean_power
+    double iq_sum_power;
+
+    // Demodulator results computed by the producer, valid with MAGBUF_PRESCANNED
+    void *prescan; // owned by the demodulator, kept with the buffer for reuse
+    void (*free_prescan)(void *prescan); // called when the buffer is freed
 
     struct mag_buf *next; // linked list forward link
 };
 
+// Number of distinct receiver_id values (producers with their own overlap)
+#define FIFO_MAX_RECEIVERS 4
+
+// Flags for fifo_create()
+
+typedef enum {
+    FIFO_LOCKFREE = 1, // pass buffers through lock-free single producer / single consumer rings
+    FIFO_HUGEPAGES = 2, // allocate the sample buffers from huge pages if possible
+} fifo_flags;
+
 // Create the queue structures. Not threadsafe. Returns true on success.
 //
 //   buffer_count - the number of buffers to preallocate
 //   buffer_size  - the size of each magnitude buffer, in samples, including overlap
 //   overlap      - the number of samples to overlap between adjacent buffers
-bool fifo_create(unsigned buffer_count, unsigned buffer_size, unsigned overlap);
+//   flags        - fifo_flags
+//   spin_us      - with FIFO_LOCKFREE, how long a waiting side spins before it sleeps
+//
+// Several receivers may produce into the same FIFO, each tagging its buffers
+// with receiver_id; the overlap is carried over per receiver.
+// In lock-free mode there must be only one producer thread (fifo_acquire,
+// fifo_enqueue, fifo_drain) and one consumer thread (fifo_dequeue, fifo_release).
+bool fifo_create(unsigned buffer_count, unsigned buffer_size, unsigned overlap, fifo_flags flags, unsigned spin_us);
+
+// Allocate raw sample storage (iq_data) for every buffer, for producers that
+// use fifo_defer_conversion(). Not threadsafe, call before any buffer is acquired.
+// Returns true on success.
+bool fifo_alloc_iq(unsigned bytes_per_sample);
+
+// Producer side of deferred conversion: nsamples raw samples of bytes_per_sample
+// each are at iq, which is either buf->iq_data or memory the producer keeps
+// unchanged until the buffer has been demodulated (e.g. a mapped file).
+// Only the trailing overlap is converted now (it is needed for the
+// next buffer); the rest is left to the consumer, which converts it with
+// fifo_convert() in cache-sized chunks just ahead of the demodulator.
+// The converter must not keep state between calls, i.e. must not filter DC.
+void fifo_defer_conversion(struct mag_buf *buf, void *iq, unsigned nsamples, unsigned bytes_per_sample,
+        iq_convert_fn converter, struct converter_state *state);
+
+// Consumer side of deferred conversion: make buf->data valid below offset upto.
+// Once the whole buffer is converted mean_level and mean_power are valid.
+// Does nothing for buffers that were converted by the producer.
+void fifo_convert(struct mag_buf *buf, unsigned upto);
 
 // Destroy the fifo structures allocated in magbuf_fifo_create. Not threadsafe; ensure all FIFO users
 // are done before calling.
@@ -108,12 +171,17 @@ struct mag_buf *fifo_acquire(uint32_t timeout_ms);
 //   buf->mean_level (if flags & HAS_METRICS)
 //   buf->mean_power (if flags & HAS_METRICS)
 //   buf->dropped    (if flags & DISCONTINUOUS)
+//   buf->receiveTime (optional, to have fillLatency measured)
 void fifo_enqueue(struct mag_buf *buf);
 
+// The monotonic clock used for the queue instrumentation, in microseconds
+uint64_t fifo_clock_us(void);
+
 // Get a buffer from the tail of the FIFO.
 // If the FIFO is halted (or becomes halted), return NULL immediately.
 // If the FIFO is empty, wait for up to "timeout_ms" milliseconds
 //   for more data; return NULL if no data arrives within the timeout.
+// Sets queueLatency and queueDepth of the returned buffer.
 struct mag_buf *fifo_dequeue(uint32_t timeout_ms);
 
 // Release a buffer previously returned by fifo_acquire() or fifo_pop() back to the freelist.
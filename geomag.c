@@ -70,6 +70,7 @@
 // elsewhere). Foreign copyrights may apply.
 
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
@@ -403,3 +404,128 @@ S50:
     }
     return 0;
 }
+
+/**
+ * Declination cache: geomag_calc() declinations at whole degrees of
+ * latitude and longitude and a few altitude bands, each worked out the
+ * first time a position next to it is looked up on a given day.
+ * Latitudes further from the equator than DEC_CACHE_MAX_LAT are not
+ * cached, and cells whose corners differ by more than DEC_CACHE_MAX_SPREAD
+ * are not interpolated: declination changes too quickly near the poles.
+ */
+#define DEC_CACHE_MAX_LAT 80
+#define DEC_CACHE_ROWS (2 * DEC_CACHE_MAX_LAT + 1)
+#define DEC_CACHE_COLUMNS 360
+#define DEC_CACHE_BANDS 5
+#define DEC_CACHE_BAND_KM 4.0
+#define DEC_CACHE_MAX_SPREAD 3.0 // degrees between the corners of a cell
+
+struct dec_node {
+    float dec;
+    uint16_t day; // day of the year + 1 it was worked out for, 0 if never
+};
+
+static struct dec_node *dec_cache;
+static time_t dec_cache_day = -1; // days since 1970 of dec_cache_year
+static double dec_cache_year;
+static uint16_t dec_cache_yday; // day of the year + 1 of dec_cache_year
+
+/**
+ * Decimal year as geomag_calc() works it out, recomputed once a day.
+ */
+static double geomag_decimal_year(uint16_t *day) {
+    time_t rawtime = time(NULL);
+
+    if (rawtime / 86400 != dec_cache_day) {
+        struct tm *info = gmtime(&rawtime);
+        dec_cache_day = rawtime / 86400;
+        dec_cache_year = epoch + ((double) info->tm_yday / 365.0);
+        dec_cache_yday = info->tm_yday + 1;
+    }
+    *day = dec_cache_yday;
+    return dec_cache_year;
+}
+
+static double geomag_node(int band, int row, int column, double decimal_year, uint16_t day) {
+    struct dec_node *node = &dec_cache[(band * DEC_CACHE_ROWS + row) * DEC_CACHE_COLUMNS + column];
+    double dec, dip, ti, gv;
+
+    if (node->day != day) {
+        geomag_calc(band * DEC_CACHE_BAND_KM, row - DEC_CACHE_MAX_LAT, column - 180, decimal_year, &dec, &dip, &ti, &gv);
+        node->dec = dec;
+        node->day = day;
+    }
+    return node->dec;
+}
+
+/**
+ * Magnetic declination for a position, interpolated from the cache.
+ * Falls back to geomag_calc() near the poles.
+ * @param alt Altitude above WGS84 ellipsoid in km
+ * @param lat Latitude in decimal degrees
+ * @param lon Longitude in decimal degrees
+ * @return Declination in degrees
+ */
+double geomag_declination(double alt, double lat, double lon) {
+    uint16_t day;
+    double decimal_year = geomag_decimal_year(&day);
+    double dec, dip, ti, gv;
+
+    if (!dec_cache && fabs(lat) <= DEC_CACHE_MAX_LAT)
+        dec_cache = calloc(DEC_CACHE_BANDS * DEC_CACHE_ROWS * DEC_CACHE_COLUMNS, sizeof (*dec_cache));
+
+    if (!dec_cache || !(fabs(lat) <= DEC_CACHE_MAX_LAT) || !(fabs(lon) <= 180.0)) {
+        geomag_calc(alt, lat, lon, decimal_year, &dec, &dip, &ti, &gv);
+        return dec;
+    }
+
+    int band = (int) lround(alt / DEC_CACHE_BAND_KM);
+    if (band < 0)
+        band = 0;
+    if (band >= DEC_CACHE_BANDS)
+        band = DEC_CACHE_BANDS - 1;
+
+    double y = lat + DEC_CACHE_MAX_LAT;
+    int row = (int) floor(y);
+    if (row >= DEC_CACHE_ROWS - 1)
+        row = DEC_CACHE_ROWS - 2;
+    double fy = y - row;
+
+    double x = lon + 180.0;
+    int column = (int) floor(x);
+    double fx = x - column;
+    if (column >= DEC_CACHE_COLUMNS)
+        column -= DEC_CACHE_COLUMNS;
+    int column1 = (column + 1) % DEC_CACHE_COLUMNS;
+
+    double d00 = geomag_node(band, row, column, decimal_year, day);
+    double d01 = geomag_node(band, row, column1, decimal_year, day);
+    double d10 = geomag_node(band, row + 1, column, decimal_year, day);
+    double d11 = geomag_node(band, row + 1, column1, decimal_year, day);
+
+    // keep the corners on the same side of +-180 degrees as the first one
+    if (d01 - d00 > 180.0) d01 -= 360.0; else if (d01 - d00 < -180.0) d01 += 360.0;
+    if (d10 - d00 > 180.0) d10 -= 360.0; else if (d10 - d00 < -180.0) d10 += 360.0;
+    if (d11 - d00 > 180.0) d11 -= 360.0; else if (d11 - d00 < -180.0) d11 += 360.0;
+
+    // close to the magnetic poles the corners can be far apart, don't interpolate there
+    if (fmax(fmax(d00, d01), fmax(d10, d11)) - fmin(fmin(d00, d01), fmin(d10, d11)) > DEC_CACHE_MAX_SPREAD) {
+        geomag_calc(alt, lat, lon, decimal_year, &dec, &dip, &ti, &gv);
+        return dec;
+    }
+
+    dec = (d00 * (1 - fx) + d01 * fx) * (1 - fy) + (d10 * (1 - fx) + d11 * fx) * fy;
+    if (dec > 180.0)
+        dec -= 360.0;
+    else if (dec <= -180.0)
+        dec += 360.0;
+    return dec;
+}
+
+/**
+ * Free the declination cache.
+ */
+void geomag_cleanup() {
+    free(dec_cache);
+    dec_cache = NULL;
+}
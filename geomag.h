@@ -22,6 +22,8 @@
 
 int geomag_init();
 int geomag_calc(double alt, double lat, double lon, double decimal_year, double *dec, double *dip, double *ti, double *gv);
+double geomag_declination(double alt, double lat, double lon);
+void geomag_cleanup();
 
 #endif /* GEOMAG_H */
 
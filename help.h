@@ -35,6 +35,7 @@ static struct argp_option options[] = {
     {"lon", OptLon, "<lon>", 0, "Reference/receiver surface longitude", 1},
     {"no-interactive", OptNoInteractive, 0, 0, "Disable interactive mode, print to stdout", 1},
     {"interactive-ttl", OptInteractiveTTL, "<sec>", 0, "Remove from list if idle for <sec> (default: 60)", 1},
+    {"interactive-sort", OptInteractiveSort, "<order>", 0, "Order of the aircraft list: none, distance, seen or signal (default: none)", 1},
     {"modeac", OptModeAc, 0, 0, "Enable decoding of SSR Modes 3/A & 3/C", 1},
     {"max-range", OptMaxRange, "<dist>", 0, "Absolute maximum range for position decoding (in nm, default: 300)", 1},
     {"fix", OptFix, 0, 0, "Enable CRC single-bit error correction (default)", 1},
@@ -49,12 +50,24 @@ static struct argp_option options[] = {
 #endif
 #endif
 #if defined(READSB)
+    {"crc-cache", OptCrcCache, "<file>", 0, "Cache the CRC error correction tables in <file> to speed up startup", 1},
+    {"cpu-affinity", OptCpuAffinity, "<role>:<cpus>", 0, "Run the threads of <role> (main, reader, demod, net-io, decode or writer) on the CPUs listed, like 2 or 0-3,8; may be repeated (default: where readsb was started)", 1},
+    {"reader-priority", OptReaderPriority, "<1-99>", 0, "Run the reader threads with SCHED_FIFO real time priority <n>", 1},
+    {"state-file", OptStateFile, "<file>", 0, "Keep aircraft, ICAO filter, range and history in <file> over a restart", 1},
+    {"record", OptRecord, "<file>", 0, "Record every decoded message with its timestamp and signal to <file>, for --device-type replay", 1},
     {"device-type", OptDeviceType, "<type>", 0, "Select SDR type", 1},
     {"gain", OptGain, "<db>", 0, "Set gain (default: max gain. Use -10 for auto-gain)", 1},
     {"freq", OptFreq, "<hz>", 0, "Set frequency (default: 1090 MHz)", 1},
     {"interactive", OptInteractive, 0, 0, "Interactive mode refreshing data on screen. Implies --throttle", 1},
     {"raw", OptRaw, 0, 0, "Show only messages hex values", 1},
     {"preamble-threshold", OptPreambleThreshold, "<"stringize(PREAMBLE_THRESHOLD_MIN)"-"stringize(PREAMBLE_THRESHOLD_MAX)">", 0, "lower threshold --> more CPU usage (default: "stringize(PREAMBLE_THRESHOLD_DEFAULT)", pi zero / pi 1: "stringize(PREAMBLE_THRESHOLD_PIZERO)", hot CPU "stringize(PREAMBLE_THRESHOLD_HOT)")", 1},
+    {"sample-rate", OptSampleRate, "<MHz>", 0, "Set sample rate, one of 2.0, 2.4, 6.0 or 8.0 (default: 2.4)", 1},
+    {"demod-threads", OptDemodThreads, "<n>", 0, "Split demodulation of each sample buffer over <n> threads (default: 1)", 1},
+    {"demod-gate", OptDemodGate, "<dB>", 0, "Skip spans of samples that stay below <dB> over the noise floor, less CPU but fewer weak messages (default: 0, search everything)", 1},
+    {"defer-conversion", OptDeferConversion, 0, 0, "Convert samples in small chunks just ahead of the demodulator (ifile only, no DC filter)", 1},
+    {"fifo-lockfree", OptFifoLockfree, 0, 0, "Pass sample buffers to the demodulator through lock-free rings", 1},
+    {"fifo-spin", OptFifoSpin, "<us>", 0, "With --fifo-lockfree, spin <us> microseconds before sleeping (default: 0)", 1},
+    {"fifo-hugepages", OptFifoHugepages, 0, 0, "Allocate sample buffers from huge pages if available", 1},
     {"no-modeac-auto", OptNoModeAcAuto, 0, 0, "Don't enable Mode A/C if requested by a Beast connection", 1},
     {"forward-mlat", OptForwardMlat, 0, 0, "Allow forwarding of received mlat results to output ports", 1},
     {"mlat", OptMlat, 0, 0, "Display raw messages in Beast ASCII mode", 1},
@@ -84,22 +97,37 @@ static struct argp_option options[] = {
     {"net-sbs-port", OptNetSbsPorts, "<ports>", 0, "TCP BaseStation output listen ports (default: 30003)", 2},
     {"net-sbs-in-port", OptNetSbsInPorts, "<ports>", 0, "TCP BaseStation input listen ports (default: 0)", 2},
     {"net-bi-port", OptNetBiPorts, "<ports>", 0, "TCP Beast input listen ports  (default: 30004,30104)", 2},
+    {"net-bzi-port", OptNetBziPorts, "<ports>", 0, "TCP zlib compressed Beast input listen ports, for beast_zlib_out connectors (default: 0)", 2},
+    {"net-bui-port", OptNetBuiPorts, "<ports>", 0, "UDP Beast input listen ports, for --net-beast-udp-out (default: 0)", 2},
+    {"net-bui-group", OptNetBuiGroup, "<group>", 0, "Multicast group for the UDP Beast input ports to join, e.g. 239.2.3.4 (leave --net-bind-address unset)", 2},
+    {"net-beast-udp-out", OptNetBeastUdpOut, "<ip,port[,ttl]>", 0, "Send the Beast output in UDP datagrams to a host or multicast group, can be specified multiple times (multicast TTL default: 1)", 2},
     {"net-vrs-port", OptNetVRSPorts, "<ports>", 0, "TCP VRS json output listen ports (default: 0)", 2},
+    {"net-http-port", OptNetHttpPorts, "<ports>", 0, "HTTP listen ports serving aircraft.pb, history.pb, stats.pb and receiver.pb from memory, no --write-output needed, and Prometheus metrics on /metrics (default: 0)", 2},
+    {"net-pb-port", OptNetPbPorts, "<ports>", 0, "TCP protocol buffer stream output listen ports: length delimited AircraftsUpdate messages, a full one and then only the changes (default: 0)", 2},
     {"net-beast-reduce-out-port", OptNetBeastReducePorts, "<ports>", 0, "TCP BeastReduce output listen ports (default: 0)", 2},
     {"net-beast-reduce-interval", OptNetBeastReduceInterval, "<seconds>", 0, "BeastReduce position update interval, longer means less data (default: 0.125, valid range: 0.000 - 14.999)", 2},
+    {"net-beast-reduce-budget", OptNetBeastReduceBudget, "<bytes/s>", 0, "Keep the BeastReduce output of each client within <bytes/s>, forwarding new, manoeuvring and downstream stale aircraft first (default: 0, no budget)", 2},
+    {"net-region-out-port", OptNetRegionPorts, "<ports>", 0, "TCP Beast output listen ports for aircraft inside --net-region (default: 0)", 2},
+    {"net-region", OptNetRegion, "<lat1,lon1,lat2,lon2>", 0, "Area for the region output: south-west and north-east corners of a box in decimal degrees, lon1 > lon2 crosses the antimeridian", 2},
     {"net-ro-size", OptNetRoSize, "<size>", 0, "TCP output flush size (maximum amount of internally buffered data before writing to network) (default: 1200)", 2},
     {"net-ro-interval", OptNetRoIntervall, "<rate>", 0, "TCP output flush interval in seconds (maximum interval between two network writes of accumulated data)(default: 0.05)", 2},
-    {"net-connector", OptNetConnector, "<ip,port,protocol>", 0, "Establish connection, can be specified multiple times (e.g. 127.0.0.1,23004,beast_out) Protocols: beast_out, beast_in, raw_out, raw_in, sbs_out, vrs_out", 2},
-    {"net-connector-delay", OptNetConnectorDelay, "<seconds>", 0, "Outbound re-connection delay (default: 30)", 2},
+    {"net-connector", OptNetConnector, "<ip,port,protocol>", 0, "Establish connection, can be specified multiple times (e.g. 127.0.0.1,23004,beast_out) Protocols: beast_out, beast_in, beast_reduce_out, beast_region_out, raw_out, raw_in, sbs_out, vrs_out; add _zlib before _in or _out for a zlib compressed stream, e.g. beast_zlib_out", 2},
+    {"net-connector-delay", OptNetConnectorDelay, "<seconds>", 0, "Longest outbound re-connection delay, backing off from a tenth of it (default: 30)", 2},
     {"net-heartbeat", OptNetHeartbeat, "<rate>", 0, "TCP heartbeat rate in seconds (default: 60 sec; 0 to disable)", 2},
     {"net-buffer", OptNetBuffer, "<n>", 0, "TCP buffer size 64Kb * (2^n) (default: n=2, 256Kb)", 2},
+    {"net-sendq-policy", OptNetSendqPolicy, "<policy>", 0, "What to do with an output client that can't keep up: disconnect, drop-oldest (queued output) or drop-non-position (messages) (default: disconnect)", 2},
+    {"net-ingest-threads", OptNetIngestThreads, "<n>", 0, "Decode Beast input from busy feeds on n threads (default: 1, max: 16)", 2},
+    {"net-dedup-window", OptNetDedupWindow, "<ms>", 0, "Drop copies of a Mode S message received from the network within ms of the first one, e.g. from nearby receivers (default: 0, off; keep it off for MLAT)", 2},
     {"net-verbatim", OptNetVerbatim, 0, 0, "Forward messages unchanged", 2},
+    {"net-relay", OptNetRelay, 0, 0, "Only validate and forward messages; decode and track aircraft only while JSON, SBS, VRS, FATSV, BeastReduce or region output or the display needs it", 2},
 #ifdef ENABLE_RTLSDR
     {0, 0, 0, 0, "RTL-SDR options:", 3},
     {0, 0, 0, OPTION_DOC, "use with --device-type rtlsdr", 3},
-    {"device", OptDevice, "<index|serial>", 0, "Select device by index or serial number", 3},
+    {"device", OptDevice, "<index|serial>", 0, "Select device by index or serial number; repeat to run several devices at once", 3},
     {"enable-agc", OptRtlSdrEnableAgc, 0, 0, "Enable digital AGC (not tuner AGC!)", 3},
     {"ppm", OptRtlSdrPpm, "<correction>", 0, "Set oscillator frequency correction in PPM", 3},
+    {"rtlsdr-buffers", OptRtlSdrBuffers, "<n>", 0, "Number of USB transfers in flight (default: 16)", 3},
+    {"rtlsdr-buffer-size", OptRtlSdrBufferSize, "<kB>", 0, "Size of each USB transfer, a multiple of 16 up to 256 (default: 256); smaller transfers reduce latency but need more FIFO turnover", 3},
 #endif
 #ifdef ENABLE_BLADERF
     {0, 0, 0, 0, "BladeRF options:", 4},
@@ -128,9 +156,16 @@ static struct argp_option options[] = {
 
     {0, 0, 0, 0, "ifile-specific options:", 7},
     {0, 0, 0, OPTION_DOC, "use with --ifile", 7},
-    {"ifile", OptIfileName, "<path>", 0, "Read samples from given file ('-' for stdin)", 7},
+    {"ifile", OptIfileName, "<path>", 0, "Read samples from given file ('-' for stdin); repeat to read several files at once", 7},
     {"iformat", OptIfileFormat, "<type>", 0, "Set sample format (UC8, SC16, SC16Q11)", 7},
     {"throttle", OptIfileThrottle, 0, 0, "Process samples at the original capture speed", 7},
+    {"ifile-mmap", OptIfileMmap, 0, 0, "Map the input file into memory and convert straight from it; fastest replay without --throttle", 7},
+    {"ifile-threads", OptIfileThreads, "<n>", 0, "Demodulate a mappable file in parallel on n threads, merged back in time order (implies --ifile-mmap, not with --throttle or --dcfilter)", 7},
+
+    {0, 0, 0, 0, "Capture replay options:", 9},
+    {0, 0, 0, OPTION_DOC, "use with --device-type replay", 9},
+    {"replay", OptReplayFile, "<path>", 0, "Replay the messages of a --record file ('-' for stdin)", 9},
+    {"throttle", OptIfileThrottle, 0, 0, "Replay at the original speed (default: as fast as they are decoded)", 9},
 #ifdef ENABLE_PLUTOSDR
     {0, 0, 0, 0, "ADALM-Pluto SDR options:", 8},
     {0, 0, 0, OPTION_DOC, "use with --device-type plutosdr", 8},
@@ -23,128 +23,174 @@
 
 #include "readsb.h"
 
-// hash table size, must be a power of two:
-#define ICAO_FILTER_SIZE 4096
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// Number of buckets per table, must be a power of two:
+#define ICAO_FILTER_BITS 9
+#define ICAO_FILTER_BUCKETS (1 << ICAO_FILTER_BITS)
+
+// Slots per bucket, one 64 byte cache line:
+#define ICAO_FILTER_SLOTS 16
 
 // Millis between filter expiry flips:
 #define MODES_ICAO_FILTER_TTL 60000
 
-// Open-addressed hash table with linear probing.
+// Open-addressed hash table of cache line sized buckets.
+// A bucket is filled from its first slot and a lookup compares
+// all slots of a bucket at once; only when a bucket is full do
+// we move on to the next one.
+//
 // We store each address twice to handle Data/Parity
-// which need to match on a partial address (top 16 bits only).
+// which need to match on a partial address (low 16 bits only).
 
 // Maintain two tables and switch between them to age out entries.
 
-static uint32_t icao_filter_a[ICAO_FILTER_SIZE];
-static uint32_t icao_filter_b[ICAO_FILTER_SIZE];
-static uint32_t *icao_filter_active;
+typedef struct {
+    uint32_t slot[ICAO_FILTER_SLOTS];
+} __attribute__ ((aligned(64))) icao_bucket;
+
+static icao_bucket icao_filter_a[ICAO_FILTER_BUCKETS];
+static icao_bucket icao_filter_b[ICAO_FILTER_BUCKETS];
+static icao_bucket *icao_filter_active;
+static uint32_t icao_filter_used; // slots in use in the active table
+static _Atomic uint32_t icao_filter_generation; // bumped whenever a lookup could change its answer
 
 #define ICAO_FILTER_EMPTY 0xFFFFFFFF
 
-static uint32_t icaoHash(uint32_t a) {
-    // Jenkins one-at-a-time hash, unrolled for 3 bytes
-    uint32_t hash = 0;
+static inline uint32_t icaoHash(uint32_t a) {
+    // Multiplicative (Fibonacci) hashing, take the top bits
+    return (a * 0x9E3779B1U) >> (32 - ICAO_FILTER_BITS);
+}
 
-    hash += a & 0xff;
-    hash += hash << 10;
-    hash ^= hash >> 6;
+// Return a bitmask of the slots of b where (slot & mask) == key
 
-    hash += (a >> 8) & 0xff;
-    hash += (hash << 10);
-    hash ^= (hash >> 6);
+static inline uint32_t bucketMatch(const icao_bucket *b, uint32_t key, uint32_t mask) {
+#if defined(__SSE2__)
+    __m128i k = _mm_set1_epi32((int) key);
+    __m128i m = _mm_set1_epi32((int) mask);
+    uint32_t bits = 0;
 
-    hash += (a >> 16) & 0xff;
-    hash += (hash << 10);
-    hash ^= (hash >> 6);
+    for (int i = 0; i < ICAO_FILTER_SLOTS; i += 4) {
+        __m128i v = _mm_and_si128(_mm_load_si128((const __m128i *) &b->slot[i]), m);
+        bits |= (uint32_t) _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, k))) << i;
+    }
+    return bits;
+#elif defined(__aarch64__)
+    static const uint32_t lanes[4] = { 1, 2, 4, 8 };
+    uint32x4_t k = vdupq_n_u32(key);
+    uint32x4_t m = vdupq_n_u32(mask);
+    uint32x4_t l = vld1q_u32(lanes);
+    uint32_t bits = 0;
+
+    for (int i = 0; i < ICAO_FILTER_SLOTS; i += 4) {
+        uint32x4_t v = vandq_u32(vld1q_u32(&b->slot[i]), m);
+        bits |= vaddvq_u32(vandq_u32(vceqq_u32(v, k), l)) << i;
+    }
+    return bits;
+#else
+    uint32_t bits = 0;
 
-    hash += (hash << 3);
-    hash ^= (hash >> 11);
-    hash += (hash << 15);
+    for (int i = 0; i < ICAO_FILTER_SLOTS; ++i) {
+        if ((b->slot[i] & mask) == key)
+            bits |= 1U << i;
+    }
+    return bits;
+#endif
+}
+
+// Look up key under mask in table t, return the matching entry
+// or ICAO_FILTER_EMPTY if there is none
 
-    return hash & (ICAO_FILTER_SIZE - 1);
+static inline uint32_t tableFind(const icao_bucket *t, uint32_t key, uint32_t mask) {
+    uint32_t h = icaoHash(key);
+
+    for (int n = 0; n < ICAO_FILTER_BUCKETS; ++n) {
+        const icao_bucket *b = &t[h];
+        uint32_t empty = bucketMatch(b, ICAO_FILTER_EMPTY, ICAO_FILTER_EMPTY);
+        uint32_t hits = bucketMatch(b, key, mask) & ~empty;
+
+        if (hits)
+            return b->slot[__builtin_ctz(hits)];
+        if (empty)
+            break; // a bucket with free slots never overflowed
+        h = (h + 1) & (ICAO_FILTER_BUCKETS - 1);
+    }
+    return ICAO_FILTER_EMPTY;
+}
+
+// Store addr under key/mask in the active table unless it holds
+// a match already
+
+static void tableInsert(uint32_t key, uint32_t mask, uint32_t addr) {
+    uint32_t h = icaoHash(key);
+
+    for (uint32_t n = 1; n <= ICAO_FILTER_BUCKETS; ++n) {
+        icao_bucket *b = &icao_filter_active[h];
+        uint32_t empty = bucketMatch(b, ICAO_FILTER_EMPTY, ICAO_FILTER_EMPTY);
+
+        if (bucketMatch(b, key, mask) & ~empty)
+            return;
+        if (empty) {
+            b->slot[__builtin_ctz(empty)] = addr;
+            atomic_fetch_add_explicit(&icao_filter_generation, 1, memory_order_relaxed);
+            Modes.stats_current.icao_filter_inserts++;
+            Modes.stats_current.icao_filter_probes += n;
+            if (n > Modes.stats_current.icao_filter_max_probe)
+                Modes.stats_current.icao_filter_max_probe = n;
+            if (++icao_filter_used > Modes.stats_current.icao_filter_used)
+                Modes.stats_current.icao_filter_used = icao_filter_used;
+            return;
+        }
+        h = (h + 1) & (ICAO_FILTER_BUCKETS - 1);
+    }
+
+    fprintf(stderr, "ICAO hash table full, increase ICAO_FILTER_BITS\n");
 }
 
 void icaoFilterInit() {
     memset(icao_filter_a, 0xFF, sizeof (icao_filter_a));
     memset(icao_filter_b, 0xFF, sizeof (icao_filter_b));
     icao_filter_active = icao_filter_a;
+    icao_filter_used = 0;
 }
 
 void icaoFilterAdd(uint32_t addr) {
-    uint32_t h, h0;
-    h0 = h = icaoHash(addr);
-    while (icao_filter_active[h] != ICAO_FILTER_EMPTY && icao_filter_active[h] != addr) {
-        h = (h + 1) & (ICAO_FILTER_SIZE - 1);
-        if (h == h0) {
-            fprintf(stderr, "ICAO hash table full, increase ICAO_FILTER_SIZE\n");
-            return;
-        }
-    }
-    if (icao_filter_active[h] == ICAO_FILTER_EMPTY)
-        icao_filter_active[h] = addr;
+    tableInsert(addr, ICAO_FILTER_EMPTY, addr);
 
     // also add with a zeroed top byte, for handling DF20/21 with Data Parity
-    h0 = h = icaoHash(addr & 0x00ffff);
-    while (icao_filter_active[h] != ICAO_FILTER_EMPTY && (icao_filter_active[h] & 0x00ffff) != (addr & 0x00ffff)) {
-        h = (h + 1) & (ICAO_FILTER_SIZE - 1);
-        if (h == h0) {
-            fprintf(stderr, "ICAO hash table full, increase ICAO_FILTER_SIZE\n");
-            return;
-        }
-    }
-    if (icao_filter_active[h] == ICAO_FILTER_EMPTY)
-        icao_filter_active[h] = addr;
+    tableInsert(addr & 0x00ffff, 0x00ffff, addr);
 }
 
 int icaoFilterTest(uint32_t addr) {
-    uint32_t h, h0;
-
-    h0 = h = icaoHash(addr);
-    while (icao_filter_a[h] != ICAO_FILTER_EMPTY && icao_filter_a[h] != addr) {
-        h = (h + 1) & (ICAO_FILTER_SIZE - 1);
-        if (h == h0)
-            break;
-    }
-    if (icao_filter_a[h] == addr)
-        return 1;
-
-    h = h0;
-    while (icao_filter_b[h] != ICAO_FILTER_EMPTY && icao_filter_b[h] != addr) {
-        h = (h + 1) & (ICAO_FILTER_SIZE - 1);
-        if (h == h0)
-            break;
-    }
-    if (icao_filter_b[h] == addr)
-        return 1;
-
-    return 0;
+    return tableFind(icao_filter_a, addr, ICAO_FILTER_EMPTY) == addr
+            || tableFind(icao_filter_b, addr, ICAO_FILTER_EMPTY) == addr;
 }
 
 uint32_t icaoFilterTestFuzzy(uint32_t partial) {
-    uint32_t h, h0;
+    uint32_t addr;
 
     partial &= 0x00ffff;
-    h0 = h = icaoHash(partial);
-    while (icao_filter_a[h] != ICAO_FILTER_EMPTY && (icao_filter_a[h] & 0x00ffff) != partial) {
-        h = (h + 1) & (ICAO_FILTER_SIZE - 1);
-        if (h == h0)
-            break;
-    }
-    if (icao_filter_a[h] != ICAO_FILTER_EMPTY && (icao_filter_a[h] & 0x00ffff) == partial)
-        return icao_filter_a[h];
-
-    h = h0;
-    while (icao_filter_b[h] != ICAO_FILTER_EMPTY && (icao_filter_b[h] & 0x00ffff) != partial) {
-        h = (h + 1) & (ICAO_FILTER_SIZE - 1);
-        if (h == h0)
-            break;
-    }
-    if (icao_filter_b[h] != ICAO_FILTER_EMPTY && (icao_filter_b[h] & 0x00ffff) == partial)
-        return icao_filter_b[h];
+    if ((addr = tableFind(icao_filter_a, partial, 0x00ffff)) != ICAO_FILTER_EMPTY)
+        return addr;
+    if ((addr = tableFind(icao_filter_b, partial, 0x00ffff)) != ICAO_FILTER_EMPTY)
+        return addr;
 
     return 0;
 }
 
+uint32_t icaoFilterGeneration() {
+    return atomic_load_explicit(&icao_filter_generation, memory_order_relaxed);
+}
+
+// Slots of each table, for occupancy figures
+uint32_t icaoFilterCapacity() {
+    return ICAO_FILTER_BUCKETS * ICAO_FILTER_SLOTS;
+}
+
 // call this periodically:
 
 void icaoFilterExpire() {
@@ -159,6 +205,38 @@ void icaoFilterExpire() {
             memset(icao_filter_a, 0xFF, sizeof (icao_filter_a));
             icao_filter_active = icao_filter_a;
         }
+        icao_filter_used = 0;
+        atomic_fetch_add_explicit(&icao_filter_generation, 1, memory_order_relaxed);
         next_flip = now + MODES_ICAO_FILTER_TTL;
     }
+
+    // the stats period may have started since the last insert
+    if (icao_filter_used > Modes.stats_current.icao_filter_used)
+        Modes.stats_current.icao_filter_used = icao_filter_used;
+}
+
+// Warm restart, see state.c: the addresses in both tables are saved, and
+// added back if they wouldn't have expired yet. Each address is saved once
+// for every slot holding it; adding it again finds it already there.
+
+void icaoFilterSave(FILE *f) {
+    for (int i = 0; i < ICAO_FILTER_BUCKETS; ++i) {
+        for (int j = 0; j < ICAO_FILTER_SLOTS; ++j) {
+            if (icao_filter_a[i].slot[j] != ICAO_FILTER_EMPTY)
+                fwrite(&icao_filter_a[i].slot[j], sizeof (uint32_t), 1, f);
+            if (icao_filter_b[i].slot[j] != ICAO_FILTER_EMPTY)
+                fwrite(&icao_filter_b[i].slot[j], sizeof (uint32_t), 1, f);
+        }
+    }
+}
+
+void icaoFilterRestore(const uint8_t *p, size_t len, uint64_t age) {
+    if (age >= MODES_ICAO_FILTER_TTL)
+        return;
+
+    for (size_t off = 0; off + sizeof (uint32_t) <= len; off += sizeof (uint32_t)) {
+        uint32_t addr;
+        memcpy(&addr, p + off, sizeof (addr));
+        icaoFilterAdd(addr);
+    }
 }
@@ -33,13 +33,26 @@ void icaoFilterAdd(uint32_t addr);
 // Test if the given address matches the filter
 int icaoFilterTest(uint32_t addr);
 
+// Number of slots in each of the two tables
+uint32_t icaoFilterCapacity();
+
 // Test if the top 16 bits match any previously added address.
 // If they do, returns an arbitrary one of the matched
 // addresses. Returns 0 on failure.
 uint32_t icaoFilterTestFuzzy(uint32_t partial);
 
+// Changes whenever an address is added or expired, so a caller can tell
+// whether the answers it got earlier still hold
+uint32_t icaoFilterGeneration();
+
 // Call this periodically to allow the filter to expire
 // old entries.
 void icaoFilterExpire();
 
+// Save the addresses to a state file, and add those saved there back unless
+// the file is age milliseconds old or more, see state.c
+void icaoFilterSave(FILE *f);
+
+void icaoFilterRestore(const uint8_t *p, size_t len, uint64_t age);
+
 #endif
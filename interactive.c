@@ -71,6 +71,301 @@ static int convert_speed(int kts) {
         return kts;
 }
 
+// The screen is drawn by a thread of its own, so a slow terminal doesn't hold
+// up decoding. Every MODES_INTERACTIVE_REFRESH_TIME the main thread formats
+// the rows that fit on the screen into a snapshot, taking the aircraft in
+// the order of the view below, and hands it over; the display thread then
+// rewrites only the rows that differ from what it drew last. curses is only
+// used by the display thread while it runs.
+
+#define INTERACTIVE_COLUMNS 80
+#define INTERACTIVE_ROW_SIZE 128 // of a formatted row, which is cut to the columns
+
+struct interactive_screen {
+    char (*rows)[INTERACTIVE_ROW_SIZE];
+    int count; // rows in use
+    char spinner;
+};
+
+static int screen_rows; // rows below the header, fixed at startup
+static struct interactive_screen screen_next; // filled by the main thread
+static struct interactive_screen screen_ready; // handed over, under display_mutex
+static struct interactive_screen screen_drawn; // owned by the display thread
+static char (*screen_shown)[INTERACTIVE_ROW_SIZE]; // what is on the screen
+
+static pthread_t display_thread;
+static bool display_running;
+static pthread_mutex_t display_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t display_cond = PTHREAD_COND_INITIALIZER;
+static bool display_pending; // screen_ready holds a new snapshot
+static bool display_exit;
+
+// The view: all tracked aircraft in the order of --interactive-sort. Only
+// the entries whose key may have changed since the last refresh are taken
+// out, sorted and merged back in: those on Modes.aircraft_changed for the
+// distance order, those with new messages for the orders that change with
+// every message.
+
+struct view_entry {
+    struct aircraft *a; // NULL once removed
+    double key; // ascending
+    uint64_t seen; // a->meta.seen when the key was taken, 0 to take it again
+};
+
+static struct view_entry *view;
+static struct view_entry *view_moved; // scratch for the entries to sort again
+static struct view_entry *view_merged; // scratch for the merge
+static uint32_t view_len;
+static uint32_t view_size;
+static uint64_t view_cursor; // Modes.track_generation of the last refresh
+
+bool interactiveParseSort(const char *arg) {
+    if (!strcmp(arg, "none"))
+        Modes.interactive_sort = INTERACTIVE_SORT_NONE;
+    else if (!strcmp(arg, "distance"))
+        Modes.interactive_sort = INTERACTIVE_SORT_DISTANCE;
+    else if (!strcmp(arg, "seen"))
+        Modes.interactive_sort = INTERACTIVE_SORT_SEEN;
+    else if (!strcmp(arg, "signal"))
+        Modes.interactive_sort = INTERACTIVE_SORT_SIGNAL;
+    else
+        return false;
+    return true;
+}
+
+static double signalAverage(const struct aircraft *a) {
+    const double *pSig = a->signalLevel;
+    return (pSig[0] + pSig[1] + pSig[2] + pSig[3] +
+            pSig[4] + pSig[5] + pSig[6] + pSig[7]) / 8.0;
+}
+
+static double viewKey(const struct aircraft *a) {
+    switch (Modes.interactive_sort) {
+        case INTERACTIVE_SORT_DISTANCE:
+            if (trackDataValid(&a->position_valid) && a->meta.distance)
+                return a->meta.distance;
+            return HUGE_VAL;
+        case INTERACTIVE_SORT_SEEN:
+            return -(double) a->meta.seen;
+        case INTERACTIVE_SORT_SIGNAL:
+            return -signalAverage(a);
+        default:
+            return 0;
+    }
+}
+
+static int viewCompare(const void *p1, const void *p2) {
+    const struct view_entry *e1 = p1;
+    const struct view_entry *e2 = p2;
+
+    if (e1->key != e2->key)
+        return e1->key < e2->key ? -1 : 1;
+    if (e1->a->meta.addr != e2->a->meta.addr)
+        return e1->a->meta.addr < e2->a->meta.addr ? -1 : 1;
+    return 0;
+}
+
+static void viewGrow(void) {
+    uint32_t size = view_size ? view_size * 2 : 256;
+    struct view_entry *entries[3] = { view, view_moved, view_merged };
+
+    for (int i = 0; i < 3; i++) {
+        if (!(entries[i] = realloc(entries[i], size * sizeof (struct view_entry)))) {
+            fprintf(stderr, "Out of memory growing the interactive view to %u entries\n", size);
+            exit(1);
+        }
+    }
+    view = entries[0];
+    view_moved = entries[1];
+    view_merged = entries[2];
+    view_size = size;
+}
+
+void interactiveRemoveAircraft(struct aircraft *a) {
+    view[a->view_slot - 1].a = NULL;
+    a->view_slot = 0;
+}
+
+static void viewUpdate(void) {
+    struct aircraft *a;
+    bool every_message = (Modes.interactive_sort == INTERACTIVE_SORT_SEEN ||
+            Modes.interactive_sort == INTERACTIVE_SORT_SIGNAL);
+    uint32_t kept = 0, moved = 0;
+
+    // new aircraft join at the end, to be sorted in
+    for (a = Modes.aircraft_changed; a && a->generation > view_cursor; a = a->changed.next) {
+        if (!a->view_slot) {
+            if (view_len == view_size)
+                viewGrow();
+            view[view_len] = (struct view_entry) { a, 0, 0 };
+            a->view_slot = ++view_len;
+        } else if (Modes.interactive_sort == INTERACTIVE_SORT_DISTANCE) {
+            view[a->view_slot - 1].seen = 0;
+        }
+    }
+    view_cursor = Modes.track_generation;
+
+    for (uint32_t i = 0; i < view_len; i++) {
+        struct view_entry e = view[i];
+
+        if (!e.a)
+            continue;
+        if (e.seen && (!every_message || e.seen == e.a->meta.seen)) {
+            view[kept++] = e; // still in order
+            continue;
+        }
+        e.key = viewKey(e.a);
+        e.seen = e.a->meta.seen ? e.a->meta.seen : 1;
+        view_moved[moved++] = e;
+    }
+    if (!moved && kept == view_len)
+        return;
+
+    // merge the sorted moved entries with the kept ones; ties keep the
+    // kept entry first, so without a sort order the view stays in the order
+    // the aircraft were first seen
+    qsort(view_moved, moved, sizeof (struct view_entry), viewCompare);
+
+    uint32_t k = 0, m = 0, n = 0;
+    while (k < kept || m < moved) {
+        if (m == moved || (k < kept && view[k].key <= view_moved[m].key))
+            view_merged[n] = view[k++];
+        else
+            view_merged[n] = view_moved[m++];
+        view_merged[n].a->view_slot = n + 1;
+        n++;
+    }
+
+    struct view_entry *swap = view;
+    view = view_merged;
+    view_merged = swap;
+    view_len = n;
+}
+
+static void formatAircraft(char *row, struct aircraft *a, uint64_t now) {
+    int msgs = a->meta.messages;
+    char strSquawk[5] = " ";
+    char strFl[7] = " ";
+    char strTt[5] = " ";
+    char strGs[5] = " ";
+
+    if (trackDataValid(&a->squawk_valid)) {
+        snprintf(strSquawk, 5, "%04x", a->meta.squawk);
+    }
+
+    if (trackDataValid(&a->gs_valid)) {
+        snprintf(strGs, 5, "%3d", convert_speed(a->meta.gs));
+    }
+
+    if (trackDataValid(&a->track_valid)) {
+        snprintf(strTt, 5, "%3d", a->meta.track);
+    }
+
+    if (msgs > 99999) {
+        msgs = 99999;
+    }
+
+    char strMode[5] = "    ";
+    char strLat[8] = " ";
+    char strLon[9] = " ";
+
+    strMode[0] = 'S';
+    if (a->modeA_hit) {
+        strMode[2] = 'a';
+    }
+    if (a->modeC_hit) {
+        strMode[3] = 'c';
+    }
+
+    if (trackDataValid(&a->position_valid)) {
+        snprintf(strLat, 8, "%7.03f", a->meta.lat);
+        snprintf(strLon, 9, "%8.03f", a->meta.lon);
+    }
+
+    if (trackDataValid(&a->airground_valid) && a->meta.air_ground == AIRCRAFT_META__AIR_GROUND__AG_GROUND) {
+        snprintf(strFl, 7, " grnd");
+    } else if (Modes.use_gnss && trackDataValid(&a->altitude_geom_valid)) {
+        snprintf(strFl, 7, "%5dH", convert_altitude(a->meta.alt_geom));
+    } else if (trackDataValid(&a->altitude_baro_valid)) {
+        snprintf(strFl, 7, "%5d ", convert_altitude(a->meta.alt_baro));
+    }
+
+    snprintf(row, INTERACTIVE_ROW_SIZE, "%s%06X %-4s  %-4s  %-8s %6s %3s  %3s  %7s %8s %5.1f %5d %2.0f",
+            (a->meta.addr & MODES_NON_ICAO_ADDRESS) ? "~" : " ", (a->meta.addr & 0xffffff),
+            strMode, strSquawk, a->callsign, strFl, strGs, strTt,
+            strLat, strLon, 10 * log10(signalAverage(a)), msgs, (now - a->meta.seen) / 1000.0);
+}
+
+static void formatModeAC(char *row, unsigned i) {
+    char strMode[5] = "  A ";
+    char strFl[7] = " ";
+    unsigned modeA = indexToModeA(i);
+    int modeC = modeAToModeC(modeA);
+    if (modeC != INVALID_ALTITUDE) {
+        strMode[3] = 'C';
+        snprintf(strFl, 7, "%5d ", convert_altitude(modeC * 100));
+    }
+
+    snprintf(row, INTERACTIVE_ROW_SIZE,
+            "%7s %-4s  %04x  %-8s %6s %3s  %3s  %7s %8s %5s %5d %2d",
+            "", /* address */
+            strMode, /* mode */
+            modeA, /* squawk */
+            "", /* callsign */
+            strFl, /* altitude */
+            "", /* gs */
+            "", /* heading */
+            "", /* lat */
+            "", /* lon */
+            "", /* signal */
+            modeAC_count[i], /* messages */
+            modeAC_age[i]); /* age */
+}
+
+// Draw the snapshots handed over until told to exit
+
+static void *displayEntryPoint(void *arg) {
+    MODES_NOTUSED(arg);
+
+    pthread_mutex_lock(&display_mutex);
+    while (!display_exit) {
+        if (!display_pending) {
+            pthread_cond_wait(&display_cond, &display_mutex);
+            continue;
+        }
+
+        struct interactive_screen swap = screen_drawn;
+        screen_drawn = screen_ready;
+        screen_ready = swap;
+        display_pending = false;
+        pthread_mutex_unlock(&display_mutex);
+
+        mvaddch(0, INTERACTIVE_COLUMNS - 1, screen_drawn.spinner);
+        for (int row = 0; row < screen_rows; row++) {
+            const char *text = row < screen_drawn.count ? screen_drawn.rows[row] : "";
+            if (!strcmp(text, screen_shown[row]))
+                continue;
+            mvaddnstr(row + 2, 0, text, INTERACTIVE_COLUMNS);
+            clrtoeol();
+            strcpy(screen_shown[row], text);
+        }
+        refresh();
+
+        pthread_mutex_lock(&display_mutex);
+    }
+    pthread_mutex_unlock(&display_mutex);
+
+    return NULL;
+}
+
+static void screenAlloc(struct interactive_screen *screen) {
+    if (!(screen->rows = calloc(screen_rows ? screen_rows : 1, sizeof (*screen->rows)))) {
+        fprintf(stderr, "Out of memory allocating the interactive screen\n");
+        exit(1);
+    }
+    screen->count = 0;
+}
+
 //
 //=========================================================================
 //
@@ -86,138 +381,100 @@ void interactiveInit() {
     refresh();
 
     mvprintw(0, 0, " Hex    Mode  Sqwk  Flight   Alt    Spd  Hdg    Lat      Long   RSSI  Msgs  Ti");
-    mvhline(1, 0, ACS_HLINE, 80);
+    mvhline(1, 0, ACS_HLINE, INTERACTIVE_COLUMNS);
+    refresh();
+
+    screen_rows = getmaxy(stdscr) - 2;
+    if (screen_rows < 0)
+        screen_rows = 0;
+    screenAlloc(&screen_next);
+    screenAlloc(&screen_ready);
+    screenAlloc(&screen_drawn);
+    if (!(screen_shown = calloc(screen_rows ? screen_rows : 1, sizeof (*screen_shown)))) {
+        fprintf(stderr, "Out of memory allocating the interactive screen\n");
+        exit(1);
+    }
+
+    display_exit = false;
+    display_pending = false;
+    int rc = pthread_create(&display_thread, NULL, displayEntryPoint, NULL);
+    if (rc) {
+        fprintf(stderr, "interactive: can't create display thread: %s\n", strerror(rc));
+        endwin();
+        exit(1);
+    }
+    display_running = true;
 }
 
 void interactiveCleanup(void) {
+    if (display_running) {
+        pthread_mutex_lock(&display_mutex);
+        display_exit = true;
+        pthread_cond_signal(&display_cond);
+        pthread_mutex_unlock(&display_mutex);
+        pthread_join(display_thread, NULL);
+        display_running = false;
+    }
+
     if (Modes.interactive) {
         endwin();
     }
+
+    free(screen_next.rows);
+    free(screen_ready.rows);
+    free(screen_drawn.rows);
+    free(screen_shown);
+    screen_next.rows = screen_ready.rows = screen_drawn.rows = NULL;
+    screen_shown = NULL;
+
+    free(view);
+    free(view_moved);
+    free(view_merged);
+    view = view_moved = view_merged = NULL;
+    view_len = view_size = 0;
+    view_cursor = 0;
 }
 
 void interactiveShowData(void) {
     static uint64_t next_update;
     uint64_t now = mstime();
-    char progress;
     char spinner[4] = "|/-\\";
 
     // Refresh screen every (MODES_INTERACTIVE_REFRESH_TIME) miliseconde
-    if (now < next_update)
+    if (now < next_update || !display_running)
         return;
 
     next_update = now + MODES_INTERACTIVE_REFRESH_TIME;
 
-    progress = spinner[(now / 1000) % 4];
-    mvaddch(0, 79, progress);
-
-    int rows = getmaxy(stdscr);
-    int row = 2;
-
-    for (int j = 0; j < AIRCRAFTS_BUCKETS; j++) {
-        struct aircraft *a = Modes.aircrafts[j];
-        while (a && row < rows) {
-
-            if ((now - a->meta.seen) < Modes.interactive_display_ttl) {
-                int msgs = a->meta.messages;
-
-                if (msgs > 1) {
-                    char strSquawk[5] = " ";
-                    char strFl[7] = " ";
-                    char strTt[5] = " ";
-                    char strGs[5] = " ";
-
-                    if (trackDataValid(&a->squawk_valid)) {
-                        snprintf(strSquawk, 5, "%04x", a->meta.squawk);
-                    }
-
-                    if (trackDataValid(&a->gs_valid)) {
-                        snprintf(strGs, 5, "%3d", convert_speed(a->meta.gs));
-                    }
-
-                    if (trackDataValid(&a->track_valid)) {
-                        snprintf(strTt, 5, "%3d", a->meta.track);
-                    }
-
-                    if (msgs > 99999) {
-                        msgs = 99999;
-                    }
-
-                    char strMode[5] = "    ";
-                    char strLat[8] = " ";
-                    char strLon[9] = " ";
-                    double * pSig = a->signalLevel;
-                    double signalAverage = (pSig[0] + pSig[1] + pSig[2] + pSig[3] +
-                            pSig[4] + pSig[5] + pSig[6] + pSig[7]) / 8.0;
-
-                    strMode[0] = 'S';
-                    if (a->modeA_hit) {
-                        strMode[2] = 'a';
-                    }
-                    if (a->modeC_hit) {
-                        strMode[3] = 'c';
-                    }
-
-                    if (trackDataValid(&a->position_valid)) {
-                        snprintf(strLat, 8, "%7.03f", a->meta.lat);
-                        snprintf(strLon, 9, "%8.03f", a->meta.lon);
-                    }
-
-                    if (trackDataValid(&a->airground_valid) && a->meta.air_ground == AIRCRAFT_META__AIR_GROUND__AG_GROUND) {
-                        snprintf(strFl, 7, " grnd");
-                    } else if (Modes.use_gnss && trackDataValid(&a->altitude_geom_valid)) {
-                        snprintf(strFl, 7, "%5dH", convert_altitude(a->meta.alt_geom));
-                    } else if (trackDataValid(&a->altitude_baro_valid)) {
-                        snprintf(strFl, 7, "%5d ", convert_altitude(a->meta.alt_baro));
-                    }
-
-                    mvprintw(row, 0, "%s%06X %-4s  %-4s  %-8s %6s %3s  %3s  %7s %8s %5.1f %5d %2.0f",
-                            (a->meta.addr & MODES_NON_ICAO_ADDRESS) ? "~" : " ", (a->meta.addr & 0xffffff),
-                            strMode, strSquawk, a->callsign, strFl, strGs, strTt,
-                            strLat, strLon, 10 * log10(signalAverage), msgs, (now - a->meta.seen) / 1000.0);
-                    ++row;
-                }
-            }
-            a = a->next;
-        }
+    viewUpdate();
+
+    int row = 0;
+    for (uint32_t j = 0; j < view_len && row < screen_rows; j++) {
+        struct aircraft *a = view[j].a;
+
+        if ((now - a->meta.seen) < Modes.interactive_display_ttl && a->meta.messages > 1)
+            formatAircraft(screen_next.rows[row++], a, now);
     }
 
     if (Modes.mode_ac) {
-        for (unsigned i = 1; i < 4096 && row < rows; ++i) {
+        for (unsigned i = 1; i < 4096 && row < screen_rows; ++i) {
             if (modeAC_match[i] || modeAC_count[i] < 50 || modeAC_age[i] > 5)
                 continue;
 
-            char strMode[5] = "  A ";
-            char strFl[7] = " ";
-            unsigned modeA = indexToModeA(i);
-            int modeC = modeAToModeC(modeA);
-            if (modeC != INVALID_ALTITUDE) {
-                strMode[3] = 'C';
-                snprintf(strFl, 7, "%5d ", convert_altitude(modeC * 100));
-            }
-
-            mvprintw(row, 0,
-                    "%7s %-4s  %04x  %-8s %6s %3s  %3s  %7s %8s %5s %5d %2d\n",
-                    "", /* address */
-                    strMode, /* mode */
-                    modeA, /* squawk */
-                    "", /* callsign */
-                    strFl, /* altitude */
-                    "", /* gs */
-                    "", /* heading */
-                    "", /* lat */
-                    "", /* lon */
-                    "", /* signal */
-                    modeAC_count[i], /* messages */
-                    modeAC_age[i]); /* age */
-            ++row;
+            formatModeAC(screen_next.rows[row++], i);
         }
     }
 
-    move(row, 0);
-    clrtobot();
-    refresh();
-}
+    screen_next.count = row;
+    screen_next.spinner = spinner[(now / 1000) % 4];
 
-//
-//=========================================================================
-//
+    // hand the snapshot over, taking back the one the display thread skipped
+    // if it is still busy
+    pthread_mutex_lock(&display_mutex);
+    struct interactive_screen swap = screen_ready;
+    screen_ready = screen_next;
+    screen_next = swap;
+    display_pending = true;
+    pthread_cond_signal(&display_cond);
+    pthread_mutex_unlock(&display_mutex);
+}
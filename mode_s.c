@@ -308,24 +308,31 @@ static int correct_aa_field(uint32_t *addr, struct errorinfo *ei) {
 
 static unsigned char all_zeros[14] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
 
-int scoreModesMessage(unsigned char *msg, int validbits) {
-    int msgtype, msgbits, crc, iid;
-    uint32_t addr;
-    struct errorinfo *ei;
+// Length of the message in bits, or 0 if it can't be scored
+
+static inline int scorableLength(unsigned char *msg, int validbits) {
+    int msgbits;
 
     if (validbits < 56)
-        return -2;
+        return 0;
 
-    msgtype = getbits(msg, 1, 5); // Downlink Format
-    msgbits = modesMessageLenByType(msgtype);
+    msgbits = modesMessageLenByType(getbits(msg, 1, 5));
 
     if (validbits < msgbits)
-        return -2;
+        return 0;
 
     if (!memcmp(all_zeros, msg, msgbits / 8))
-        return -2;
+        return 0;
 
-    crc = modesChecksum(msg, msgbits);
+    return msgbits;
+}
+
+static int scoreChecksum(unsigned char *msg, int msgbits, int crc) {
+    int msgtype, iid;
+    uint32_t addr;
+    struct errorinfo *ei;
+
+    msgtype = getbits(msg, 1, 5); // Downlink Format
 
     switch (msgtype) {
         case 0: // short air-air surveillance
@@ -384,7 +391,7 @@ int scoreModesMessage(unsigned char *msg, int validbits) {
             correct_aa_field(&addr, ei);
 
             if (icaoFilterTest(addr))
-                return 1800 / (ei->errors + 1);
+                return MODES_SCORE_MAX / (ei->errors + 1);
             else
                 return 1400 / (ei->errors + 1);
 
@@ -408,6 +415,50 @@ int scoreModesMessage(unsigned char *msg, int validbits) {
     }
 }
 
+int scoreModesMessage(unsigned char *msg, int validbits) {
+    int msgbits = scorableLength(msg, validbits);
+
+    if (!msgbits)
+        return -2;
+
+    return scoreChecksum(msg, msgbits, modesChecksum(msg, msgbits));
+}
+
+// Score up to MODES_CRC_BATCH candidate demodulations of the same message,
+// e.g. the phases tried for one preamble, computing their checksums
+// together. Fills scores[] in order and returns the number of candidates
+// scored: scoring stops at the first one with the best possible score
+// (DF17/18 with a good CRC from a known aircraft), as no later candidate
+// could replace it.
+
+int scoreModesMessages(unsigned char **msgs, const int *validbits, int *scores, int count) {
+    uint8_t *batch[MODES_CRC_BATCH];
+    int bits[MODES_CRC_BATCH];
+    uint32_t crc[MODES_CRC_BATCH];
+    int n = 0, b = 0;
+
+    for (int k = 0; k < count; ++k) {
+        if ((bits[n] = scorableLength(msgs[k], validbits[k])))
+            batch[n++] = msgs[k];
+    }
+
+    if (n)
+        modesChecksumBatch(batch, bits, crc, n);
+
+    for (int k = 0; k < count; ++k) {
+        if (b < n && batch[b] == msgs[k]) {
+            scores[k] = scoreChecksum(msgs[k], bits[b], crc[b]);
+            ++b;
+            if (scores[k] >= MODES_SCORE_MAX)
+                return k + 1;
+        } else {
+            scores[k] = -2;
+        }
+    }
+
+    return count;
+}
+
 //
 //=========================================================================
 //
@@ -417,6 +468,134 @@ int scoreModesMessage(unsigned char *msg, int validbits) {
 
 static void decodeExtendedSquitter(struct modesMessage *mm);
 
+//
+// Decode cache
+//
+// Surveillance and all-call replies are the same bytes over and over as long
+// as an aircraft's altitude and squawk don't change. Their decode depends only
+// on the message bytes (and for Address/Parity replies, on the ICAO filter),
+// so the last decoded copy of each recently seen frame is kept in a small
+// direct-mapped cache, keyed on the raw bytes, and reused with the new copy's
+// reception details.
+//
+// Extended squitters are left out: they rarely repeat exactly and their
+// decode updates statistics. Comm-B replies are left out too: their decode
+// depends on, and updates, the aircraft's Comm-B history (see
+// decodeCommBWithHistory()). Only uncorrected frames are cached, so a hit
+// never depends on error correction. Threads decoding ahead for the main
+// thread (see decodeAheadThreadInit()) have a cache of their own.
+//
+
+#define DECODE_CACHE_SIZE 256 // entries, power of two
+
+static struct modesMessage main_decode_cache[DECODE_CACHE_SIZE]; // msgbits == 0: empty
+static _Thread_local struct modesMessage *decode_cache = main_decode_cache;
+
+// Decoding ahead: the ICAO filter is left alone and statistics go to
+// decode_stats, see decodeAheadBegin()
+static _Thread_local bool decode_ahead;
+static _Thread_local struct stats *decode_stats = &Modes.stats_current;
+
+static inline bool decodeCacheable(int msgtype) {
+    switch (msgtype) {
+        case 0: case 4: case 5: case 11: case 16:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static inline struct modesMessage *decodeCacheSlot(const unsigned char *msg, int bytes) {
+    uint32_t h = 2166136261U; // FNV-1a
+
+    for (int i = 0; i < bytes; ++i)
+        h = (h ^ msg[i]) * 16777619U;
+
+    return &decode_cache[(h ^ (h >> 16)) & (DECODE_CACHE_SIZE - 1)];
+}
+
+// Fill mm from a cached decode of the same bytes, keeping the reception
+// details the caller has already set.
+
+static int decodeFromCache(struct modesMessage *mm, const struct modesMessage *cached) {
+    uint64_t timestampMsg = mm->timestampMsg;
+    uint64_t sysTimestampMsg = mm->sysTimestampMsg;
+    double signalLevel = mm->signalLevel;
+    int remote = mm->remote;
+    int score = mm->score;
+    int sbs_in = mm->sbs_in;
+
+    *mm = *cached;
+    mm->timestampMsg = timestampMsg;
+    mm->sysTimestampMsg = sysTimestampMsg;
+    mm->signalLevel = signalLevel;
+    mm->remote = remote;
+    mm->score = score;
+    mm->sbs_in = sbs_in;
+    mm->reduce_forward = 0;
+
+    if (Modes.net_verbatim || Modes.record_file)
+        memcpy(mm->verbatim, mm->msg, MODES_LONG_MSG_BYTES);
+
+    // as in decodeModesMessage(), an all-call with II = 0 and no errors refreshes the address
+    if (mm->msgtype == 11 && mm->IID == 0 && !decode_ahead)
+        icaoFilterAdd(mm->addr);
+
+    if (mm->remote && mm->timestampMsg == MAGIC_MLAT_TIMESTAMP)
+        mm->source = SOURCE_MLAT;
+
+    return 0;
+}
+
+//
+// Decoding ahead
+//
+// Threads other than the main one may decode messages for it to pass on
+// later, in order. Between decodeAheadBegin() and decodeAheadEnd() the
+// calling thread leaves the ICAO filter to the main thread, which calls
+// decodeAheadFinish() for each message as it passes it on, and counts the
+// statistics of its decoding in st. While any thread decodes ahead, the main
+// thread itself must not add to the filter; the messages it rejects as from
+// an unknown address (-1) may have been decoded before the message that
+// adds the address, so it should decode those again itself.
+//
+// Comm-B replies depend on the aircraft's Comm-B history and must not be
+// decoded ahead. Threads other than the main one call decodeAheadThreadInit()
+// first to get a decode cache of their own.
+//
+
+bool decodeAheadThreadInit(void) {
+    if (!(decode_cache = calloc(DECODE_CACHE_SIZE, sizeof (*decode_cache)))) {
+        fprintf(stderr, "Out of memory allocating a decode cache\n");
+        decode_cache = main_decode_cache;
+        return false;
+    }
+    return true;
+}
+
+void decodeAheadThreadCleanup(void) {
+    if (decode_cache != main_decode_cache)
+        free(decode_cache);
+    decode_cache = main_decode_cache;
+}
+
+void decodeAheadBegin(struct stats *st) {
+    decode_ahead = true;
+    decode_stats = st;
+}
+
+void decodeAheadEnd(void) {
+    decode_ahead = false;
+    decode_stats = &Modes.stats_current;
+}
+
+// The ICAO filter update decodeModesMessage() skipped for a message decoded ahead
+
+void decodeAheadFinish(const struct modesMessage *mm) {
+    if (!mm->correctedbits && (mm->msgtype == 17 || (mm->msgtype == 11 && mm->IID == 0)))
+        icaoFilterAdd(mm->addr);
+}
+
 // return 0 if all OK
 //   -1: message might be valid, but we couldn't validate the CRC against a known ICAO
 //   -2: bad message or unrepairable CRC error
@@ -424,8 +603,8 @@ static void decodeExtendedSquitter(struct modesMessage *mm);
 int decodeModesMessage(struct modesMessage *mm, unsigned char *msg) {
     // Work on our local copy.
     memcpy(mm->msg, msg, MODES_LONG_MSG_BYTES);
-    if (Modes.net_verbatim) {
-        // Preserve the original uncorrected copy for later forwarding
+    if (Modes.net_verbatim || Modes.record_file) {
+        // Preserve the original uncorrected copy for later forwarding or --record
         memcpy(mm->verbatim, msg, MODES_LONG_MSG_BYTES);
     }
     msg = mm->msg;
@@ -437,6 +616,16 @@ int decodeModesMessage(struct modesMessage *mm, unsigned char *msg) {
     // Get the message type ASAP as other operations depend on this
     mm->msgtype = getbits(msg, 1, 5); // Downlink Format
     mm->msgbits = modesMessageLenByType(mm->msgtype);
+
+    if (decodeCacheable(mm->msgtype)) {
+        struct modesMessage *cached = decodeCacheSlot(msg, mm->msgbits / 8);
+
+        // Address/Parity replies are only good while the address is in the ICAO filter
+        if (cached->msgbits == mm->msgbits && !memcmp(cached->msg, msg, mm->msgbits / 8) &&
+                (cached->msgtype == 11 || icaoFilterTest(cached->addr)))
+            return decodeFromCache(mm, cached);
+    }
+
     mm->crc = modesChecksum(msg, mm->msgbits);
     mm->correctedbits = 0;
     mm->addr = 0;
@@ -561,6 +750,10 @@ int decodeModesMessage(struct modesMessage *mm, unsigned char *msg) {
         mm->AA = mm->addr = getbits(msg, 9, 32);
     }
 
+    // relaying only needs the address, see modesNetRelayNeedsDecode()
+    if (!modesNetRelayNeedsDecode())
+        goto validated;
+
     // AC (Altitude Code)
     if (mm->msgtype == 0 || mm->msgtype == 4 || mm->msgtype == 16 || mm->msgtype == 20) {
         mm->AC = getbits(msg, 20, 32);
@@ -665,8 +858,10 @@ int decodeModesMessage(struct modesMessage *mm, unsigned char *msg) {
 
     // MB (messsage, Comm-B)
     if (mm->msgtype == 20 || mm->msgtype == 21) {
+        struct aircraft *a = trackFindAircraft(mm->addr);
+
         memcpy(mm->MB, &msg[4], 7);
-        decodeCommB(mm);
+        decodeCommBWithHistory(mm, a ? &a->commb_history : NULL);
     }
 
     // MD (message, Comm-D)
@@ -714,6 +909,10 @@ int decodeModesMessage(struct modesMessage *mm, unsigned char *msg) {
             mm->airground = AIRCRAFT_META__AIR_GROUND__AG_UNCERTAIN;
     }
 
+    if (decodeCacheable(mm->msgtype) && !mm->correctedbits)
+        *decodeCacheSlot(msg, mm->msgbits / 8) = *mm;
+
+validated:
     if (!mm->correctedbits && (mm->msgtype == 17 || (mm->msgtype == 11 && mm->IID == 0))) {
         // No CRC errors seen, and either it was an DF17 extended squitter
         // or a DF11 acquisition squitter with II = 0. We probably have the right address.
@@ -721,8 +920,10 @@ int decodeModesMessage(struct modesMessage *mm, unsigned char *msg) {
         // Don't do this for DF18, as a DF18 transmitter doesn't necessarily have a
         // Mode S transponder.
 
-        // NB this is the only place that adds addresses!
-        icaoFilterAdd(mm->addr);
+        // NB this and decodeFromCache() are the only places that add addresses!
+        // (decodeAheadFinish() does it for messages decoded ahead)
+        if (!decode_ahead)
+            icaoFilterAdd(mm->addr);
     }
 
     // MLAT overrides all other sources
@@ -995,7 +1196,7 @@ static void decodeESAirbornePosition(struct modesMessage *mm, int check_imf) {
             //   400648 (BAE ATP) - Atlantic Airlines
             // altitude == 0, longitude == 0, type == 15 and zeros in latitude LSB.
             // Can alternate with valid reports having type == 14
-            Modes.stats_current.cpr_filtered++;
+            decode_stats->cpr_filtered++;
         } else {
             // Otherwise, assume it's valid.
             mm->cpr_valid = 1;
@@ -1687,7 +1888,7 @@ static int esTypeHasSubtype(unsigned metype) {
     return 1;
 }
 
-static const char *esTypeName(unsigned metype, unsigned mesub) {
+const char *esTypeName(unsigned metype, unsigned mesub) {
     switch (metype) {
         case 0:
             return "No position information (airborne or surface)";
@@ -2148,8 +2349,18 @@ void useModesMessage(struct modesMessage *mm) {
 
     ++Modes.stats_current.messages_total;
 
-    // Track aircraft state
-    a = trackUpdateFromMessage(mm);
+    // Time the message from here, and count how long it took to get here.
+    // Reading a file, the message times aren't real ones.
+    mm->sysTimestampUse = microtime();
+    if (Modes.sdr_type != SDR_IFILE && Modes.sdr_type != SDR_REPLAY && mm->sysTimestampMsg)
+        record_latency(&Modes.stats_current, LATENCY_RECEIVE, (int64_t) (mm->sysTimestampUse - mm->sysTimestampMsg * 1000));
+
+    // --record keeps it as it came in
+    if (Modes.record_file && !mm->sbs_in)
+        captureMessage(mm);
+
+    // Track aircraft state, unless only relaying
+    a = modesNetRelayNeedsDecode() ? trackUpdateFromMessage(mm) : NULL;
 
     // In non-interactive non-quiet mode, display messages on standard output
     if (!Modes.interactive && !Modes.quiet && (!Modes.show_only || mm->addr == Modes.show_only) && !mm->sbs_in) {
@@ -27,14 +27,24 @@
 
 #include <assert.h>
 
+// Best score from scoreModesMessage(): DF17/18, good CRC, known address
+#define MODES_SCORE_MAX 1800
+
 //
 // Functions exported from mode_s.c
 //
 int modesMessageLenByType(int type);
 int scoreModesMessage(unsigned char *msg, int validbits);
+int scoreModesMessages(unsigned char **msgs, const int *validbits, int *scores, int count);
 int decodeModesMessage(struct modesMessage *mm, unsigned char *msg);
+bool decodeAheadThreadInit(void);
+void decodeAheadThreadCleanup(void);
+void decodeAheadBegin(struct stats *st);
+void decodeAheadEnd(void);
+void decodeAheadFinish(const struct modesMessage *mm);
 void displayModesMessage(struct modesMessage *mm);
 void useModesMessage(struct modesMessage *mm);
+const char *esTypeName(unsigned metype, unsigned mesub);
 
 // datafield extraction helpers
 
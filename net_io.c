@@ -64,9 +64,17 @@
 #include <netdb.h>
 #include <poll.h>
 #include <pthread.h>
+#include <sys/uio.h>
+#include <zlib.h>
 
 #include <linux/serial.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 //
 // ============================= Networking =============================
 //
@@ -77,8 +85,9 @@
 //    user space buffering.
 // 2) We don't register any kind of event handler, from time to time a
 //    function gets called and we accept new connections. All the rest is
-//    handled via non-blocking I/O and manually polling clients to see if
-//    they have something new to share with us when reading is needed.
+//    handled via non-blocking I/O, asking the kernel which clients have
+//    something new to share with us (or manually polling all of them where
+//    that is not available).
 
 static int handleBeastCommand(struct client *c, char *p, int remote);
 static int decodeBinMessage(struct client *c, char *p, int remote);
@@ -94,8 +103,324 @@ static void writeFATSVPositionUpdate(float lat, float lon, float alt);
 
 static void autoset_modeac();
 static int hexDigitVal(int c);
-static void *pthreadGetaddrinfo(void *param);
 static void flushClient(struct client *c, uint64_t now);
+static void netDedupInit(void);
+static void clientCompress(struct client *c);
+static void udpListen(struct net_service *service, char *bind_addr, char *bind_ports, char *group);
+static void udpOutputInit(struct net_service *service);
+static int handleHttpRequest(struct client *c, char *request, int remote);
+static void httpInit(void);
+static void pbStreamInit(void);
+static bool pbStreamHasClients(void);
+struct http_snapshot;
+static void httpSnapshotPack(struct http_snapshot *snap, const ProtobufCMessage *msg);
+
+//
+//=========================================================================
+//
+// Readiness notification
+//
+// Listeners and clients are registered with epoll (kqueue on the BSDs) so
+// the network work only touches file descriptors that are actually readable
+// or writable. Clients always wait for input (for write-only services this
+// only catches disconnects early) and for output while their SendQ is not
+// empty. Without a usable poller we fall back to scanning every client.
+//
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#define NET_POLL_EPOLL
+#elif defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__) || defined(__APPLE__)
+#include <sys/event.h>
+#define NET_POLL_KQUEUE
+#endif
+
+#define NET_POLL_READ 1
+#define NET_POLL_WRITE 2
+#define NET_POLL_EVENTS 64
+
+// What a registered fd belongs to, indexed by fd
+
+struct net_poll_entry {
+    struct net_service *listener;
+    struct client *client;
+    bool wakeup; // the I/O thread wakeup pipe
+    int events;
+};
+
+static int net_poll_fd = -1;
+static bool net_poll_failed;
+static struct net_poll_entry *net_poll_entries;
+static int net_poll_size;
+
+static void netPollDisable(const char *what) {
+    fprintf(stderr, "Network %s failed: %s, falling back to polling all clients\n", what, strerror(errno));
+    if (net_poll_fd >= 0)
+        close(net_poll_fd);
+    net_poll_fd = -1;
+    net_poll_failed = true;
+}
+
+static inline bool netPollActive(void) {
+#if defined(NET_POLL_EPOLL) || defined(NET_POLL_KQUEUE)
+    if (net_poll_fd < 0 && !net_poll_failed) {
+#if defined(NET_POLL_EPOLL)
+        net_poll_fd = epoll_create1(EPOLL_CLOEXEC);
+#else
+        net_poll_fd = kqueue();
+#endif
+        if (net_poll_fd < 0)
+            netPollDisable("poller setup");
+    }
+    return net_poll_fd >= 0;
+#else
+    return false;
+#endif
+}
+
+static struct net_poll_entry *netPollEntry(int fd) {
+    if (fd >= net_poll_size) {
+        int size = net_poll_size ? net_poll_size : 64;
+        while (size <= fd)
+            size *= 2;
+
+        struct net_poll_entry *entries = realloc(net_poll_entries, size * sizeof (*entries));
+        if (!entries) {
+            fprintf(stderr, "Out of memory allocating network poll table\n");
+            exit(1);
+        }
+        memset(entries + net_poll_size, 0, (size - net_poll_size) * sizeof (*entries));
+        net_poll_entries = entries;
+        net_poll_size = size;
+    }
+    return &net_poll_entries[fd];
+}
+
+// Change the events fd is registered for, 0 removes it
+
+static void netPollSet(int fd, int events) {
+    if (fd < 0 || !netPollActive())
+        return;
+
+    struct net_poll_entry *e = netPollEntry(fd);
+    if (e->events == events)
+        return;
+
+#if defined(NET_POLL_EPOLL)
+    struct epoll_event ev = { 0 };
+    int op = !events ? EPOLL_CTL_DEL : (e->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD);
+
+    ev.events = ((events & NET_POLL_READ) ? EPOLLIN : 0) | ((events & NET_POLL_WRITE) ? EPOLLOUT : 0);
+    ev.data.fd = fd;
+    if (epoll_ctl(net_poll_fd, op, fd, &ev) < 0 && events) {
+        netPollDisable("epoll registration");
+        return;
+    }
+#elif defined(NET_POLL_KQUEUE)
+    struct kevent changes[2];
+    int n = 0;
+    int diff = e->events ^ events;
+
+    if (diff & NET_POLL_READ)
+        EV_SET(&changes[n++], fd, EVFILT_READ, (events & NET_POLL_READ) ? EV_ADD : EV_DELETE, 0, 0, NULL);
+    if (diff & NET_POLL_WRITE)
+        EV_SET(&changes[n++], fd, EVFILT_WRITE, (events & NET_POLL_WRITE) ? EV_ADD : EV_DELETE, 0, 0, NULL);
+    if (kevent(net_poll_fd, changes, n, NULL, 0, NULL) < 0 && events) {
+        netPollDisable("kqueue registration");
+        return;
+    }
+#endif
+    e->events = events;
+}
+
+static void netPollAddListener(struct net_service *s, int fd) {
+    if (!netPollActive())
+        return;
+    netPollEntry(fd)->listener = s;
+    netPollSet(fd, NET_POLL_READ);
+}
+
+static void netPollAddClient(struct client *c) {
+    if (!netPollActive())
+        return;
+    netPollEntry(c->fd)->client = c;
+    netPollSet(c->fd, NET_POLL_READ);
+}
+
+// Wait for output only while there is something queued
+
+static void netPollUpdateClient(struct client *c) {
+    if (c->service && !c->io_failed && net_poll_fd >= 0)
+        netPollSet(c->fd, NET_POLL_READ | (c->sendq_len ? NET_POLL_WRITE : 0));
+}
+
+static void netPollRemove(int fd) {
+    if (fd < 0 || fd >= net_poll_size)
+        return;
+    netPollSet(fd, 0);
+    net_poll_entries[fd].listener = NULL;
+    net_poll_entries[fd].client = NULL;
+    net_poll_entries[fd].wakeup = false;
+}
+
+// Stop or resume waiting for new connections on all listeners
+
+static void netPollListeners(bool enable) {
+    for (struct net_service *s = Modes.services; s; s = s->next) {
+        for (int i = 0; i < s->listener_count; ++i)
+            netPollSet(s->listener_fds[i], enable ? NET_POLL_READ : 0);
+    }
+}
+
+static void netPollCleanup(void) {
+    if (net_poll_fd >= 0)
+        close(net_poll_fd);
+    net_poll_fd = -1;
+    free(net_poll_entries);
+    net_poll_entries = NULL;
+    net_poll_size = 0;
+}
+
+//
+//=========================================================================
+//
+// Network I/O thread
+//
+// Once modesNetStartThread() has run, socket reads, writes and accepts
+// happen on a thread of their own. Everything touching aircraft or the
+// service client lists stays on the main thread:
+//  - complete input messages, new connections and failed clients are
+//    queued as records, which the main thread drains and handles
+//  - flushWrites() only appends to the client SendQs and hands the
+//    clients to the I/O thread to be written
+//
+// net_io_mutex guards the SendQs, the poller table and both queues.
+// Clients are freed only once no record or flush request refers to them.
+//
+
+enum net_record_type {
+    NET_RECORD_MESSAGE, NET_RECORD_ACCEPT, NET_RECORD_CLOSE
+};
+
+struct net_record {
+    struct client *client; // MESSAGE, CLOSE
+    struct net_service *service; // ACCEPT
+    int fd; // ACCEPT
+    uint16_t len; // of the payload following the record, not counting its NUL
+    uint8_t type;
+    uint8_t remote;
+};
+
+#define NET_RECORD_SIZE(len) (sizeof (struct net_record) + (((len) + 1 + 7) & ~(size_t) 7))
+
+// Stop reading once this much input is waiting for the main thread
+#define NET_INPUT_MAX (4 * 1024 * 1024)
+
+struct net_input {
+    char *data;
+    size_t len;
+    size_t size;
+    uint32_t garbage; // Beast messages worth of garbage skipped
+    uint32_t udp_lost; // UDP datagrams lost, see clientReadDatagrams()
+};
+
+static pthread_t net_io_thread;
+static pthread_mutex_t net_io_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t net_io_input_cond = PTHREAD_COND_INITIALIZER; // input was queued
+static pthread_cond_t net_io_space_cond = PTHREAD_COND_INITIALIZER; // input was drained
+static bool net_io_threaded; // the I/O thread was started, locking is needed
+static atomic_bool net_io_running; // the I/O thread is servicing the sockets
+static bool net_io_stop;
+static _Thread_local bool net_io_self; // true on the I/O thread
+static int net_io_wakeup[2] = {-1, -1};
+static struct net_input net_inputs[2];
+static struct net_input *net_input_fill = &net_inputs[0]; // the I/O thread appends here
+static struct client *net_flush_list; // clients waiting to be written by the I/O thread
+
+static inline void netLock(void) {
+    if (net_io_threaded)
+        pthread_mutex_lock(&net_io_mutex);
+}
+
+static inline void netUnlock(void) {
+    if (net_io_threaded)
+        pthread_mutex_unlock(&net_io_mutex);
+}
+
+static inline bool netThreadRunning(void) {
+    return net_io_threaded && atomic_load(&net_io_running);
+}
+
+// Queue a record for the main thread, called on the I/O thread with the lock held
+
+static struct net_record *netPushRecord(enum net_record_type type, struct client *c, size_t len) {
+    struct net_input *in = net_input_fill;
+    size_t need = NET_RECORD_SIZE(len);
+
+    if (in->len + need > in->size) {
+        size_t size = in->size ? in->size * 2 : 65536;
+        while (size < in->len + need)
+            size *= 2;
+
+        char *data = realloc(in->data, size);
+        if (!data) {
+            fprintf(stderr, "Out of memory queueing network input\n");
+            exit(1);
+        }
+        in->data = data;
+        in->size = size;
+    }
+
+    struct net_record *r = (struct net_record *) (in->data + in->len);
+    memset(r, 0, sizeof (*r));
+    r->type = type;
+    r->client = c;
+    r->len = len;
+    ((char *) (r + 1))[len] = '\0';
+    if (c)
+        c->refs++;
+
+    in->len += need;
+    pthread_cond_signal(&net_io_input_cond);
+    return r;
+}
+
+static void modesCloseClient(struct client *c);
+
+// Reading from or writing to a client failed: close it, or have the main thread do so
+
+static void clientFailed(struct client *c) {
+    if (!net_io_self) {
+        modesCloseClient(c);
+        return;
+    }
+
+    if (!c->io_failed) {
+        c->io_failed = true;
+        netPollRemove(c->fd);
+        netPushRecord(NET_RECORD_CLOSE, c, 0);
+    }
+}
+
+// Pass one complete message to the service handler, or queue it for the
+// main thread. Returns nonzero if the client should be closed.
+
+static int clientMessage(struct client *c, char *msg, int len, int remote) {
+    if (!net_io_self)
+        return c->service->read_handler(c, msg, remote);
+
+    struct net_record *r = netPushRecord(NET_RECORD_MESSAGE, c, len);
+    r->remote = remote;
+    memcpy(r + 1, msg, len);
+    return 0;
+}
+
+static void countGarbage(uint32_t messages) {
+    if (net_io_self)
+        net_input_fill->garbage += messages;
+    else
+        Modes.stats_current.remote_rejected_bad += messages;
+}
 
 //
 //=========================================================================
@@ -140,8 +465,17 @@ struct net_service *serviceInit(const char *descr, struct net_writer *writer, he
             }
         }
 
+        if (Modes.net_sendq_policy == SENDQ_POLICY_DROP_NON_POSITION && !service->writer->pos_data) {
+            if (!(service->writer->pos_data = malloc(MODES_OUT_BUF_SIZE))) {
+                fprintf(stderr, "Out of memory allocating output buffer for service %s\n", descr);
+                exit(1);
+            }
+        }
+
         service->writer->service = service;
         service->writer->dataUsed = 0;
+        service->writer->posUsed = 0;
+        service->writer->position = false;
         service->writer->lastWrite = mstime();
         service->writer->send_heartbeat = hb;
     }
@@ -180,23 +514,31 @@ struct client *createGenericClient(struct net_service *service, int fd) {
     c->next = service->clients;
     c->fd = fd;
     c->buflen = 0;
+    c->beast_need = 0;
     c->modeac_requested = 0;
     c->last_flush = now;
     c->last_send = now;
     c->sendq_len = 0;
     c->sendq_max = 0;
     c->sendq = NULL;
+    c->sendq_head = 0;
+    c->sendq_count = 0;
+    c->sendq_size = 0;
+    c->sendq_offset = 0;
+    c->sendq_peak = 0;
+    c->sendq_dropped = 0;
     c->con = NULL;
 
     if (service->writer) {
-        if (!(c->sendq = malloc(MODES_NET_SNDBUF_SIZE << Modes.net_sndbuf_size))) {
-            fprintf(stderr, "Out of memory allocating client SendQ\n");
-            exit(1);
-        }
         // Have to keep track of this manually
         c->sendq_max = MODES_NET_SNDBUF_SIZE << Modes.net_sndbuf_size;
     }
+    if (service->compressed)
+        clientCompress(c);
     service->clients = c;
+    netLock();
+    netPollAddClient(c);
+    netUnlock();
 
     ++service->connections;
     if (service->writer && service->connections == 1) {
@@ -230,12 +572,103 @@ void serviceReconnectCallback(uint64_t now) {
     }
 }
 
+// xorshift, for the backoff jitter; seeded so that readsb instances
+// started together don't draw the same
+static uint32_t connectorRandom(void) {
+    static uint64_t state;
+    if (!state)
+        state = (microtime() ^ ((uint64_t) getpid() << 32)) | 1;
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state >> 32;
+}
+
+// How long a connector waits to try again: a tenth of --net-connector-delay
+// after losing its connection, doubling with each round that fails up to
+// all of it, and of that a random part of up to half, so that connectors
+// which lost an aggregator together don't all come back at the same time
+static uint64_t connectorBackoff(struct net_connector *con) {
+    uint64_t delay = Modes.net_connector_delay / 10;
+    for (uint32_t i = 0; i < con->failures && delay < Modes.net_connector_delay; i++)
+        delay *= 2;
+    if (delay > Modes.net_connector_delay)
+        delay = Modes.net_connector_delay;
+    return delay - connectorRandom() % (delay / 2 + 1);
+}
+
+// Format address n of the answer like " (192.0.2.1)", empty if it is what
+// was given as the address
+static void connectorAddrString(struct net_connector *con, int n, char *buf, size_t size) {
+    char host[NI_MAXHOST];
+
+    buf[0] = '\0';
+    if (getnameinfo((struct sockaddr *) &con->answer.addr[n], con->answer.addrlen[n],
+            host, sizeof (host), NULL, 0, NI_NUMERICHOST | NI_NUMERICSERV))
+        return;
+    if (strcmp(host, con->address))
+        snprintf(buf, size, " (%s)", host);
+}
+
+static void connectorDropAttempt(struct net_connector *con, int i) {
+    anetCloseSocket(con->attempt_fd[i]);
+    con->attempts--;
+    con->attempt_fd[i] = con->attempt_fd[con->attempts];
+    con->attempt_addr[i] = con->attempt_addr[con->attempts];
+}
+
+// Start connecting to the next address of the answer; false if none is left
+static bool connectorStartAttempt(struct net_connector *con, uint64_t now) {
+    while (con->try_next < con->answer.count) {
+        int n = con->try_next++;
+        struct addrinfo ai = {
+            .ai_family = con->answer.addr[n].ss_family,
+            .ai_socktype = SOCK_STREAM,
+            .ai_addrlen = con->answer.addrlen[n],
+            .ai_addr = (struct sockaddr *) &con->answer.addr[n],
+        };
+        int fd = anetTcpNonBlockConnectAddr(Modes.aneterr, &ai);
+        if (fd == ANET_ERR) {
+            char addr[NI_MAXHOST + 3];
+            connectorAddrString(con, n, addr, sizeof (addr));
+            fprintf(stderr, "%s: Connection to %s%s port %s failed: %s\n",
+                    con->service->descr, con->address, addr, con->port, Modes.aneterr);
+            continue;
+        }
+        if (anetTcpKeepAlive(Modes.aneterr, fd) != ANET_OK) {
+            fprintf(stderr, "%s: Unable to set keepalive: connection to %s port %s ...\n", con->service->descr, con->address, con->port);
+        }
+        con->attempt_fd[con->attempts] = fd;
+        con->attempt_addr[con->attempts] = n;
+        con->attempts++;
+        con->next_attempt = now + NET_CONNECT_STAGGER;
+        return true;
+    }
+    return false;
+}
+
+// The round is over without a connection: back off
+static void connectorFailed(struct net_connector *con) {
+    while (con->attempts)
+        connectorDropAttempt(con, 0);
+    con->connecting = 0;
+    con->failures++;
+    con->next_reconnect = mstime() + connectorBackoff(con);
+    // the host may have moved
+    if (con->answer.count)
+        resolveForget(con->address, con->port);
+}
+
 struct client *checkServiceConnected(struct net_connector *con) {
+    struct pollfd pfd[RESOLVE_MAX_ADDRS];
+    uint64_t now = mstime();
+    int winner = -1;
     int rv;
 
-    struct pollfd pfd = {con->fd, (POLLIN | POLLOUT), 0};
+    for (int i = 0; i < con->attempts; i++)
+        pfd[i] = (struct pollfd) {con->attempt_fd[i], (POLLIN | POLLOUT), 0};
 
-    rv = poll(&pfd, 1, 0);
+    rv = con->attempts ? poll(pfd, con->attempts, 0) : 0;
 
     if (rv == -1) {
         // select() error, just return a NULL here, but log it
@@ -243,46 +676,66 @@ struct client *checkServiceConnected(struct net_connector *con) {
         return NULL;
     }
 
-    if (rv == 0) {
-        // If we've exceeded our connect timeout, bail but try again.
-        if (mstime() >= con->connect_timeout) {
-            fprintf(stderr, "%s: Connection timed out: %s:%s port %s\n",
-                    con->service->descr, con->address, con->port, con->resolved_addr);
-            con->connecting = 0;
-            anetCloseSocket(con->fd);
+    // Look at those that are done, from the last so that dropping one
+    // doesn't move one not looked at yet
+    for (int i = con->attempts - 1; rv > 0 && i >= 0; i--) {
+        if (!pfd[i].revents)
+            continue;
+
+        // At this point, we need to check getsockopt() to see if we succeeded or failed...
+        int optval = -1;
+        socklen_t optlen = sizeof (optval);
+        if (getsockopt(con->attempt_fd[i], SOL_SOCKET, SO_ERROR, &optval, &optlen) == -1) {
+            fprintf(stderr, "getsockopt failed: %d (%s)\n", errno, strerror(errno));
+            connectorDropAttempt(con, i);
+            continue;
         }
-        return NULL;
-    }
 
-    // At this point, we need to check getsockopt() to see if we succeeded or failed...
-    int optval = -1;
-    socklen_t optlen = sizeof (optval);
-    if (getsockopt(con->fd, SOL_SOCKET, SO_ERROR, &optval, &optlen) == -1) {
-        fprintf(stderr, "getsockopt failed: %d (%s)\n", errno, strerror(errno));
-        // Bad stuff going on, but clear this anyway
-        con->connecting = 0;
-        anetCloseSocket(con->fd);
-        return NULL;
+        if (optval != 0) {
+            // only 0 means "connection ok"
+            char addr[NI_MAXHOST + 3];
+            connectorAddrString(con, con->attempt_addr[i], addr, sizeof (addr));
+            fprintf(stderr, "%s: Connection to %s%s port %s failed: %d (%s)\n",
+                    con->service->descr, con->address, addr, con->port, optval, strerror(optval));
+            connectorDropAttempt(con, i);
+            continue;
+        }
+
+        if (winner < 0 || con->attempt_addr[i] < con->attempt_addr[winner])
+            winner = i;
     }
 
-    if (optval != 0) {
-        // only 0 means "connection ok"
-        fprintf(stderr, "%s: Connection to %s%s port %s failed: %d (%s)\n",
-                con->service->descr, con->address, con->resolved_addr, con->port, optval, strerror(optval));
-        con->connecting = 0;
-        anetCloseSocket(con->fd);
+    if (winner < 0) {
+        if (now >= con->connect_timeout) {
+            // If we've exceeded our connect timeout, bail but try again.
+            fprintf(stderr, "%s: Connection timed out: %s port %s\n",
+                    con->service->descr, con->address, con->port);
+            connectorFailed(con);
+        } else if ((!con->attempts || now >= con->next_attempt) && !connectorStartAttempt(con, now) && !con->attempts) {
+            connectorFailed(con);
+        }
         return NULL;
     }
 
+    // The first address to connect wins, the others are given up
+    con->fd = con->attempt_fd[winner];
+    connectorAddrString(con, con->attempt_addr[winner], con->resolved_addr, sizeof (con->resolved_addr));
+    con->attempt_fd[winner] = con->attempt_fd[--con->attempts];
+    con->attempt_addr[winner] = con->attempt_addr[con->attempts];
+    while (con->attempts)
+        connectorDropAttempt(con, 0);
+    con->connecting = 0;
+
     // If we're able to create this "client", save the sockaddr info and print a msg
     struct client *c;
 
     c = createSocketClient(con->service, con->fd);
     if (!c) {
-        con->connecting = 0;
         fprintf(stderr, "createSocketClient failed on fd %d to %s%s port %s\n",
                 con->fd, con->address, con->resolved_addr, con->port);
         anetCloseSocket(con->fd);
+        con->failures++;
+        con->next_reconnect = mstime() + connectorBackoff(con);
         return NULL;
     }
 
@@ -292,9 +745,12 @@ struct client *checkServiceConnected(struct net_connector *con) {
     fprintf(stderr, "%s: Connection established: %s%s port %s\n",
             con->service->descr, con->address, con->resolved_addr, con->port);
 
-    con->connecting = 0;
     con->connected = 1;
+    con->connects++;
+    con->failures = 0;
     c->con = con;
+    if (con->compressed && !c->deflate && !c->inflate)
+        clientCompress(c);
 
     return c;
 }
@@ -303,89 +759,30 @@ struct client *checkServiceConnected(struct net_connector *con) {
 // Return the new client or NULL if the connection failed
 
 struct client *serviceConnect(struct net_connector *con) {
+    uint64_t now = mstime();
 
-    int fd;
-
-    if (con->try_addr && con->try_addr->ai_next) {
-        // iterate the address info
-        con->try_addr = con->try_addr->ai_next;
-    } else {
-        // get the address info
-        if (!con->gai_request_in_progress) {
-            // launch a pthread for async getaddrinfo
-            con->try_addr = NULL;
-            if (con->addr_info) {
-                freeaddrinfo(con->addr_info);
-                con->addr_info = NULL;
-            }
-
-            if (pthread_create(&con->thread, NULL, pthreadGetaddrinfo, con)) {
-                con->next_reconnect = mstime() + 15000;
-                fprintf(stderr, "%s: pthread_create ERROR for %s port %s: %s\n", con->service->descr, con->address, con->port, strerror(errno));
-                return NULL;
-            }
-
-            con->gai_request_in_progress = 1;
-            con->next_reconnect = mstime() + 10;
-            return NULL;
-        } else {
-
-            if (pthread_mutex_trylock(con->mutex)) {
-                // couldn't acquire lock, request not finished
-                con->next_reconnect = mstime() + 50;
-                return NULL;
-            }
-
-            if (pthread_join(con->thread, NULL)) {
-                fprintf(stderr, "%s: pthread_join ERROR for %s port %s: %s\n", con->service->descr, con->address, con->port, strerror(errno));
-                con->next_reconnect = mstime() + 15000;
-                return NULL;
-            }
-            con->gai_request_in_progress = 0;
-
-            if (con->gai_error) {
-                fprintf(stderr, "%s: Name resolution for %s failed: %s\n", con->service->descr, con->address, gai_strerror(con->gai_error));
-                con->next_reconnect = mstime() + Modes.net_connector_delay;
-                return NULL;
-            }
-
-            con->try_addr = con->addr_info;
-            // SUCCESS!
-        }
-    }
-
-    getnameinfo(con->try_addr->ai_addr, con->try_addr->ai_addrlen,
-            con->resolved_addr, sizeof (con->resolved_addr) - 3,
-            NULL, 0,
-            NI_NUMERICHOST | NI_NUMERICSERV);
-
-    if (strcmp(con->resolved_addr, con->address) == 0) {
-        con->resolved_addr[0] = '\0';
-    } else {
-        char tmp[sizeof (con->resolved_addr) + 3]; // shut up gcc
-        snprintf(tmp, sizeof (tmp), " (%s)", con->resolved_addr);
-        memcpy(con->resolved_addr, tmp, sizeof (con->resolved_addr));
-    }
+    if (con->connecting)
+        return checkServiceConnected(con);
 
-    if (!con->try_addr->ai_next) {
-        con->next_reconnect = mstime() + Modes.net_connector_delay;
-    } else {
-        con->next_reconnect = mstime() + 100;
+    if (!resolveLookup(con->address, con->port, &con->answer)) {
+        // the resolver is on it
+        con->next_reconnect = now + 50;
+        return NULL;
     }
 
-    fd = anetTcpNonBlockConnectAddr(Modes.aneterr, con->try_addr);
-    if (fd == ANET_ERR) {
-        fprintf(stderr, "%s: Connection to %s%s port %s failed: %s\n",
-                con->service->descr, con->address, con->resolved_addr, con->port, Modes.aneterr);
+    if (con->answer.gai_error) {
+        fprintf(stderr, "%s: Name resolution for %s failed: %s\n", con->service->descr, con->address, gai_strerror(con->answer.gai_error));
+        con->answer.count = 0;
+        connectorFailed(con);
         return NULL;
     }
 
+    con->try_next = 0;
     con->connecting = 1;
-    con->connect_timeout = mstime() + 10 * 1000; // 10 sec TODO: Move to var
-    con->fd = fd;
-
-    if (anetTcpKeepAlive(Modes.aneterr, fd) != ANET_OK) {
-        fprintf(stderr, "%s: Unable to set keepalive: connection to %s port %s ...\n", con->service->descr, con->address, con->port);
+    con->connect_timeout = now + NET_CONNECT_TIMEOUT;
+    if (!connectorStartAttempt(con, now)) {
+        connectorFailed(con);
+        return NULL;
     }
 
     // Since this is a non-blocking connect, it will always return right away.
@@ -448,6 +845,7 @@ void serviceListen(struct net_service *service, char *bind_addr, char *bind_port
                 fprintf(stderr, "%s port %s: Failed to set non-block: %s\n", service->descr, buf, Modes.aneterr);
             }
             fds[n++] = newfds[i];
+            netPollAddListener(service, newfds[i]);
         }
     }
 
@@ -466,7 +864,10 @@ struct net_service *makeFatsvOutputService(void) {
 void modesInitNet(void) {
     struct net_service *beast_out;
     struct net_service *beast_reduce_out;
+    struct net_service *beast_region_out;
     struct net_service *beast_in;
+    struct net_service *beast_zlib_in;
+    struct net_service *beast_udp_in;
     struct net_service *raw_out;
     struct net_service *raw_in;
     struct net_service *vrs_out;
@@ -478,6 +879,9 @@ void modesInitNet(void) {
     signal(SIGPIPE, SIG_IGN);
     Modes.services = NULL;
 
+    if (Modes.net_dedup_window)
+        netDedupInit();
+
 
     // set up listeners
     raw_out = serviceInit("Raw TCP output", &Modes.raw_out, send_raw_heartbeat, READ_MODE_IGNORE, NULL, NULL);
@@ -489,6 +893,9 @@ void modesInitNet(void) {
     beast_reduce_out = serviceInit("BeastReduce TCP output", &Modes.beast_reduce_out, send_beast_heartbeat, READ_MODE_IGNORE, NULL, NULL);
     serviceListen(beast_reduce_out, Modes.net_bind_address, Modes.net_output_beast_reduce_ports);
 
+    beast_region_out = serviceInit("Region Beast TCP output", &Modes.beast_region_out, send_beast_heartbeat, READ_MODE_IGNORE, NULL, NULL);
+    serviceListen(beast_region_out, Modes.net_bind_address, Modes.net_output_beast_region_ports);
+
     vrs_out = serviceInit("VRS json output", &Modes.vrs_out, NULL, READ_MODE_IGNORE, NULL, NULL);
     serviceListen(vrs_out, Modes.net_bind_address, Modes.net_output_vrs_ports);
 
@@ -505,10 +912,15 @@ void modesInitNet(void) {
     beast_in = makeBeastInputService();
     serviceListen(beast_in, Modes.net_bind_address, Modes.net_input_beast_ports);
 
-    /* Beast input from local Modes-S Beast via USB */
-    if (Modes.sdr_type == SDR_MODESBEAST || Modes.sdr_type == SDR_GNS) {
-        createGenericClient(beast_in, Modes.beast_fd);
-    }
+    beast_zlib_in = serviceInit("Beast zlib TCP input", NULL, NULL, READ_MODE_BEAST, NULL, decodeBinMessage);
+    beast_zlib_in->compressed = true;
+    serviceListen(beast_zlib_in, Modes.net_bind_address, Modes.net_input_beast_zlib_ports);
+
+    beast_udp_in = serviceInit("Beast UDP input", NULL, NULL, READ_MODE_BEAST, NULL, decodeBinMessage);
+    udpListen(beast_udp_in, Modes.net_bind_address, Modes.net_input_beast_udp_ports, Modes.net_input_beast_udp_group);
+    udpOutputInit(beast_out);
+    httpInit();
+    pbStreamInit();
 
     for (int i = 0; i < Modes.net_connectors_count; i++) {
         struct net_connector *con = Modes.net_connectors[i];
@@ -518,6 +930,8 @@ void modesInitNet(void) {
             con->service = beast_in;
         if (strcmp(con->protocol, "beast_reduce_out") == 0)
             con->service = beast_reduce_out;
+        else if (strcmp(con->protocol, "beast_region_out") == 0)
+            con->service = beast_region_out;
         else if (strcmp(con->protocol, "raw_out") == 0)
             con->service = raw_out;
         else if (strcmp(con->protocol, "raw_in") == 0)
@@ -528,13 +942,6 @@ void modesInitNet(void) {
             con->service = sbs_out;
         else if (strcmp(con->protocol, "sbs_in") == 0)
             con->service = sbs_in;
-
-        con->mutex = malloc(sizeof (pthread_mutex_t));
-        if (!con->mutex || pthread_mutex_init(con->mutex, NULL)) {
-            fprintf(stderr, "Unable to initialize connector mutex!\n");
-            exit(1);
-        }
-        pthread_mutex_lock(con->mutex);
     }
     serviceReconnectCallback(now);
 }
@@ -547,51 +954,216 @@ void modesInitNet(void) {
 // awakened by new data arriving. This usually happens a few times every second
 //
 
-static uint64_t modesAcceptClients(uint64_t now) {
+// Create the client for an accepted connection
+
+static void clientAccepted(struct net_service *s, int fd, const char *host, const char *port) {
+    struct client *c = createSocketClient(s, fd);
+
+    if (!c) {
+        fprintf(stderr, "%s: Fatal: createSocketClient shouldn't fail!\n", s->descr);
+        exit(1);
+    }
+
+    // save the sockaddr info and 'hostport'
+    strncpy(c->host, host, sizeof (c->host) - 1);
+    strncpy(c->port, port, sizeof (c->port) - 1);
+
+    if (anetTcpKeepAlive(Modes.aneterr, fd) != ANET_OK) {
+        fprintf(stderr, "%s: Unable to set keepalive on connection from %s port %s (fd %d)\n", c->service->descr, c->host, c->port, fd);
+    }
+}
+
+// Accept all pending connections on the listeners of a service.
+// On the I/O thread the clients are created by the main thread later.
+// Returns false if we ran out of file descriptors.
+
+static bool serviceAccept(struct net_service *s) {
     int fd;
-    struct net_service *s;
-    struct client *c;
 
-    for (s = Modes.services; s; s = s->next) {
-        int i;
-        for (i = 0; i < s->listener_count; ++i) {
-            struct sockaddr_storage storage;
-            struct sockaddr *saddr = (struct sockaddr *) &storage;
-            socklen_t slen = sizeof (storage);
-
-            while ((fd = anetGenericAccept(Modes.aneterr, s->listener_fds[i], saddr, &slen)) >= 0) {
-                c = createSocketClient(s, fd);
-                if (c) {
-                    // We created the client, save the sockaddr info and 'hostport'
-                    getnameinfo(saddr, slen,
-                            c->host, sizeof (c->host),
-                            c->port, sizeof (c->port),
-                            NI_NUMERICHOST | NI_NUMERICSERV);
-
-                    if (anetTcpKeepAlive(Modes.aneterr, fd) != ANET_OK) {
-                        fprintf(stderr, "%s: Unable to set keepalive on connection from %s port %s (fd %d)\n", c->service->descr, c->host, c->port, fd);
-                    }
-                } else {
-                    fprintf(stderr, "%s: Fatal: createSocketClient shouldn't fail!\n", s->descr);
-                    exit(1);
-                }
+    for (int i = 0; i < s->listener_count; ++i) {
+        struct sockaddr_storage storage;
+        struct sockaddr *saddr = (struct sockaddr *) &storage;
+        socklen_t slen = sizeof (storage);
+
+        while ((fd = anetGenericAccept(Modes.aneterr, s->listener_fds[i], saddr, &slen)) >= 0) {
+            char host[NI_MAXHOST] = "";
+            char port[NI_MAXSERV] = "";
+
+            getnameinfo(saddr, slen, host, sizeof (host), port, sizeof (port), NI_NUMERICHOST | NI_NUMERICSERV);
+            if (net_io_self) {
+                size_t hlen = strlen(host) + 1;
+                size_t plen = strlen(port);
+                struct net_record *r = netPushRecord(NET_RECORD_ACCEPT, NULL, hlen + plen);
+                r->service = s;
+                r->fd = fd;
+                memcpy(r + 1, host, hlen);
+                memcpy((char *) (r + 1) + hlen, port, plen);
+            } else {
+                clientAccepted(s, fd, host, port);
             }
+            slen = sizeof (storage);
+        }
 
-            if (errno != EMFILE && errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
-                fprintf(stderr, "%s: Error accepting new connection: %s\n", s->descr, Modes.aneterr);
-            }
+        if (errno == EMFILE)
+            return false;
+        if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+            fprintf(stderr, "%s: Error accepting new connection: %s\n", s->descr, Modes.aneterr);
         }
     }
-    // temporarily stop trying to accept new clients if we are limited by file descriptors
-    if (errno == EMFILE) {
-        fprintf(stderr, "Accepting new connections suspended for 3 seconds: %s\n", Modes.aneterr);
-        return (now + 3000);
+    return true;
+}
+
+static uint64_t modesAcceptClients(uint64_t now) {
+    struct net_service *s;
+
+    for (s = Modes.services; s; s = s->next) {
+        if (!serviceAccept(s)) {
+            // temporarily stop trying to accept new clients if we are limited by file descriptors
+            fprintf(stderr, "Accepting new connections suspended for 3 seconds: %s\n", Modes.aneterr);
+            return (now + 3000);
+        }
     }
 
     // only check for new clients not sooner than 150 ms from now
     return (now + 150);
 }
 
+//
+// SendQ segments
+//
+// flushWrites() copies a writer buffer once into a segment and appends it to
+// the SendQ of every client that takes it, counting each of them. A SendQ is
+// a ring of segment pointers, oldest first, plus the number of bytes of the
+// oldest one already written; a segment is freed once the last client has
+// written or dropped it. The ring only ever grows by doubling, so neither
+// queueing, writing nor dropping output moves any queued data.
+//
+
+static void segmentRelease(struct net_segment *seg) {
+    if (--seg->refs == 0)
+        free(seg);
+}
+
+static inline struct net_segment *clientSegment(struct client *c, unsigned i) {
+    return c->sendq[(c->sendq_head + i) & (c->sendq_size - 1)];
+}
+
+// Append a segment to a client's SendQ
+
+static void clientQueue(struct client *c, struct net_segment *seg) {
+    if (c->sendq_count == c->sendq_size) {
+        unsigned size = c->sendq_size ? c->sendq_size * 2 : 16;
+        struct net_segment **ring;
+
+        if (!(ring = malloc(size * sizeof (*ring)))) {
+            fprintf(stderr, "Out of memory allocating a SendQ\n");
+            exit(1);
+        }
+        for (unsigned i = 0; i < c->sendq_count; ++i)
+            ring[i] = clientSegment(c, i);
+        free(c->sendq);
+        c->sendq = ring;
+        c->sendq_head = 0;
+        c->sendq_size = size;
+    }
+
+    c->sendq[(c->sendq_head + c->sendq_count) & (c->sendq_size - 1)] = seg;
+    c->sendq_count++;
+    c->sendq_len += seg->len;
+    if (c->sendq_len > c->sendq_peak)
+        c->sendq_peak = c->sendq_len;
+    seg->refs++;
+}
+
+// Remove the oldest segment from a client's SendQ, keeping sendq_offset
+
+static void clientPop(struct client *c) {
+    struct net_segment *seg = c->sendq[c->sendq_head];
+
+    c->sendq_head = (c->sendq_head + 1) & (c->sendq_size - 1);
+    c->sendq_count--;
+    segmentRelease(seg);
+}
+
+// Statistics of the network I/O thread, the latency of the output it writes,
+// counted with the network lock held and added to the main thread's stats
+// every second
+static struct stats_slot net_io_stats;
+
+// Drop n written bytes from the front of a client's SendQ
+
+static void clientConsume(struct client *c, int n) {
+    uint64_t now_us = 0;
+
+    c->sendq_len -= n;
+    while (c->sendq_count) {
+        struct net_segment *seg = c->sendq[c->sendq_head];
+        int left = seg->len - c->sendq_offset;
+
+        if (n < left) {
+            c->sendq_offset += n;
+            return;
+        }
+
+        if (seg->queued) {
+            if (!now_us)
+                now_us = microtime();
+            record_latency(&net_io_stats.st, LATENCY_SEND, (int64_t) (now_us - seg->queued));
+            if (seg->received)
+                record_latency(&net_io_stats.st, LATENCY_TOTAL, (int64_t) (now_us - seg->received));
+        }
+
+        n -= left;
+        c->sendq_offset = 0;
+        clientPop(c);
+    }
+}
+
+// SENDQ_POLICY_DROP_OLDEST: drop the oldest segments nothing has been
+// written of until len more bytes fit. Segments end on message boundaries,
+// so the client only loses whole messages.
+
+static bool clientDropOldest(struct client *c, int len) {
+    while (c->sendq_len + len >= c->sendq_max) {
+        unsigned mask = c->sendq_size - 1;
+        struct net_segment *seg;
+
+        if (c->sendq_offset) {
+            // The oldest segment is partly written; drop the next one by
+            // moving the partly written one into its slot
+            if (c->sendq_count < 2)
+                return false;
+            seg = c->sendq[(c->sendq_head + 1) & mask];
+            c->sendq[(c->sendq_head + 1) & mask] = c->sendq[c->sendq_head];
+            c->sendq[c->sendq_head] = seg;
+        } else {
+            if (!c->sendq_count)
+                return false;
+            seg = c->sendq[c->sendq_head];
+        }
+
+        c->sendq_len -= seg->len;
+        c->sendq_dropped += seg->len;
+        Modes.stats_current.net_sendq_dropped += seg->len;
+        clientPop(c);
+    }
+    return true;
+}
+
+static void clientReleaseSendQ(struct client *c) {
+    while (c->sendq_count)
+        clientPop(c);
+    free(c->sendq);
+    c->sendq = NULL;
+    c->sendq_head = 0;
+    c->sendq_size = 0;
+    c->sendq_len = 0;
+    c->sendq_offset = 0;
+}
+
+// Segments handed to a single writev()
+#define SENDQ_IOV 16
+
 //
 //=========================================================================
 //
@@ -609,6 +1181,7 @@ static void modesCloseClient(struct client *c) {
         Modes.exit = 3;
     }
 
+    netPollRemove(c->fd);
     anetCloseSocket(c->fd);
     c->service->connections--;
     if (c->con) {
@@ -617,18 +1190,15 @@ static void modesCloseClient(struct client *c) {
         // only wait a short time to reconnect
         c->con->connecting = 0;
         c->con->connected = 0;
-        c->con->next_reconnect = mstime() + Modes.net_connector_delay / 10;
+        c->con->next_reconnect = mstime() + connectorBackoff(c->con);
     }
 
+    clientReleaseSendQ(c);
+
     // mark it as inactive and ready to be freed
     c->fd = -1;
     c->service = NULL;
     c->modeac_requested = 0;
-    c->sendq_len = 0;
-    if (c->sendq) {
-        free(c->sendq);
-        c->sendq = NULL;
-    }
 
     autoset_modeac();
 }
@@ -638,15 +1208,24 @@ static void modesCloseClient(struct client *c) {
 //
 
 static void flushClient(struct client *c, uint64_t now) {
-    int towrite = c->sendq_len;
-    char *psendq = c->sendq;
     int loops = 0;
     int max_loops = 2;
     int total_nwritten = 0;
     int done = 0;
 
     do {
-        int nwritten = write(c->fd, psendq, towrite);
+        struct iovec iov[SENDQ_IOV];
+        int offset = c->sendq_offset;
+        int n;
+
+        for (n = 0; n < (int) c->sendq_count && n < SENDQ_IOV; ++n) {
+            struct net_segment *seg = clientSegment(c, n);
+            iov[n].iov_base = seg->data + offset;
+            iov[n].iov_len = seg->len - offset;
+            offset = 0;
+        }
+
+        int nwritten = writev(c->fd, iov, n);
         int err = errno;
         loops++;
         // If we get -1, it's only fatal if it's not EAGAIN/EWOULDBLOCK
@@ -655,18 +1234,16 @@ static void flushClient(struct client *c, uint64_t now) {
                 fprintf(stderr, "%s: Send Error: %s: %s port %s (fd %d, SendQ %d, RecvQ %d)\n",
                         c->service->descr, strerror(err), c->host, c->port,
                         c->fd, c->sendq_len, c->buflen);
-                modesCloseClient(c);
+                clientFailed(c);
+                return;
             }
             done = 1; // Blocking, just bail, try later.
         } else {
-            if (nwritten > 0) {
-                // We've written something, add it to the total
-                total_nwritten += nwritten;
-                // Advance buffer
-                psendq += nwritten;
-                towrite -= nwritten;
-            }
-            if (total_nwritten == c->sendq_len) {
+            // We've written something, add it to the total and advance the SendQ
+            total_nwritten += nwritten;
+            c->bytes_sent += nwritten;
+            clientConsume(c, nwritten);
+            if (c->sendq_len == 0) {
                 done = 1;
             }
         }
@@ -674,20 +1251,443 @@ static void flushClient(struct client *c, uint64_t now) {
 
     if (total_nwritten > 0) {
         c->last_send = now; // If we wrote anything, update this.
-        if (total_nwritten == c->sendq_len) {
-            c->sendq_len = 0;
-        } else {
-            c->sendq_len -= total_nwritten;
-            memmove((void*) c->sendq, c->sendq + total_nwritten, towrite);
-        }
         c->last_flush = now;
     }
 
+    // A response that ends the connection has been sent: have the client
+    // close it, we close our end when it does
+    if (c->close_when_sent && !c->sendq_len && !c->half_closed) {
+        shutdown(c->fd, SHUT_WR);
+        c->half_closed = true;
+    }
+
     // If writing has failed for 5 seconds, disconnect.
     if (c->last_flush + 5000 < now) {
         fprintf(stderr, "%s: Unable to send data, disconnecting: %s port %s (fd %d, SendQ %d)\n", c->service->descr, c->host, c->port, c->fd, c->sendq_len);
-        modesCloseClient(c);
+        clientFailed(c);
+        return;
+    }
+
+    netPollUpdateClient(c);
+}
+
+// Copy a writer buffer into a new segment, holding a reference to it
+
+static struct net_segment *segmentCreate(const void *data, int len) {
+    struct net_segment *seg;
+
+    if (!(seg = malloc(sizeof (*seg) + len))) {
+        fprintf(stderr, "Out of memory allocating a SendQ segment\n");
+        exit(1);
+    }
+    memcpy(seg->data, data, len);
+    seg->len = len;
+    seg->refs = 1;
+    seg->queued = seg->received = 0;
+    return seg;
+}
+
+//
+// UDP Beast output and input
+//
+// --net-beast-udp-out sends the Beast output to UDP destinations, unicast
+// or multicast. completeWrite() notes where each datagram of the writer
+// buffer ends, so that a datagram holds whole frames and fits a 1500 byte
+// MTU, and flushWrites() hands all of them to udpSend(), one sendmmsg()
+// per destination. Every datagram starts with a 32-bit big endian sequence
+// number for the receiver to count lost datagrams with. The destinations
+// are permanent connections of the Beast output service, a datagram that
+// can't be sent right away is dropped.
+//
+// The --net-bui-port sockets are clients of the Beast UDP input service,
+// read by clientReadDatagrams(): the frames of a batch of datagrams are
+// appended to the client buffer and handled like Beast TCP input.
+//
+
+#define NET_UDP_PAYLOAD 1472 // a 1500 byte MTU less the IPv4 and UDP headers
+#define NET_UDP_HEADER 4 // the sequence number
+#define NET_UDP_SLOT 2048 // client buffer space for each datagram received
+#define NET_UDP_BATCH 32 // datagrams received per recvmmsg()
+// datagrams in a writer buffer: each is at least half full
+#define NET_UDP_DATAGRAMS (MODES_OUT_BUF_SIZE / (NET_UDP_PAYLOAD / 2) + 2)
+
+static int *net_udp_fds; // connected sockets, one per destination
+static int net_udp_count;
+static uint32_t net_udp_seq;
+
+// Connect the --net-beast-udp-out destinations and attach them to the
+// writer of the given service. _exits_ on failure!
+
+static void udpOutputInit(struct net_service *service) {
+    if (!Modes.net_udp_outputs_count)
+        return;
+
+    net_udp_fds = malloc(sizeof (int) * Modes.net_udp_outputs_count);
+    service->writer->udp_ends = malloc(sizeof (int) * NET_UDP_DATAGRAMS);
+    if (!net_udp_fds || !service->writer->udp_ends) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < Modes.net_udp_outputs_count; ++i) {
+        char buf[256];
+        char *host, *port, *ttl;
+        int fd;
+
+        strncpy(buf, Modes.net_udp_outputs[i], sizeof (buf) - 1);
+        buf[sizeof (buf) - 1] = 0;
+        host = strtok(buf, ",");
+        port = strtok(NULL, ",");
+        ttl = strtok(NULL, ",");
+        if (!host || !port) {
+            fprintf(stderr, "--net-beast-udp-out %s: expected ip,port[,ttl]\n", Modes.net_udp_outputs[i]);
+            exit(1);
+        }
+
+        fd = anetUdpConnect(Modes.aneterr, host, port, ttl ? atoi(ttl) : 1);
+        if (fd == ANET_ERR) {
+            fprintf(stderr, "%s: UDP destination %s port %s: %s\n", service->descr, host, port, Modes.aneterr);
+            exit(1);
+        }
+        if (anetNonBlock(Modes.aneterr, fd) == ANET_ERR) {
+            fprintf(stderr, "%s: UDP destination %s port %s: Failed to set non-block: %s\n",
+                    service->descr, host, port, Modes.aneterr);
+        }
+        anetSetSendBuffer(Modes.aneterr, fd, (MODES_NET_SNDBUF_SIZE << Modes.net_sndbuf_size));
+        net_udp_fds[net_udp_count++] = fd;
+        ++service->connections;
+    }
+}
+
+static void udpOutputCleanup(void) {
+    for (int i = 0; i < net_udp_count; ++i)
+        anetCloseSocket(net_udp_fds[i]);
+    free(net_udp_fds);
+    net_udp_fds = NULL;
+    net_udp_count = 0;
+}
+
+// A message of the writer buffer ends at 'end': start a new datagram
+// before it if it doesn't fit the current one
+
+static inline void udpMessageEnd(struct net_writer *writer, int end) {
+    if (end - writer->udp_start > NET_UDP_PAYLOAD - NET_UDP_HEADER &&
+            writer->dataUsed > writer->udp_start && writer->udp_count < NET_UDP_DATAGRAMS) {
+        writer->udp_ends[writer->udp_count++] = writer->dataUsed;
+        writer->udp_start = writer->dataUsed;
+    }
+}
+
+// Send the writer buffer to the UDP destinations
+
+static void udpSend(struct net_writer *writer) {
+    struct mmsghdr msgs[NET_UDP_DATAGRAMS + 1];
+    struct iovec iov[NET_UDP_DATAGRAMS + 1][2];
+    unsigned char seq[NET_UDP_DATAGRAMS + 1][NET_UDP_HEADER];
+    int count = 0, start = 0;
+
+    memset(msgs, 0, sizeof (msgs));
+    for (int i = 0; i <= writer->udp_count; ++i) {
+        int end = (i < writer->udp_count) ? writer->udp_ends[i] : writer->dataUsed;
+        uint32_t n = net_udp_seq++;
+
+        seq[count][0] = n >> 24;
+        seq[count][1] = n >> 16;
+        seq[count][2] = n >> 8;
+        seq[count][3] = n;
+        iov[count][0].iov_base = seq[count];
+        iov[count][0].iov_len = NET_UDP_HEADER;
+        iov[count][1].iov_base = (char *) writer->data + start;
+        iov[count][1].iov_len = end - start;
+        msgs[count].msg_hdr.msg_iov = iov[count];
+        msgs[count].msg_hdr.msg_iovlen = 2;
+        count++;
+        start = end;
+    }
+
+    for (int i = 0; i < net_udp_count; ++i) {
+        int sent = 0;
+        bool refused = false;
+
+        while (sent < count) {
+            int n = sendmmsg(net_udp_fds[i], msgs + sent, count - sent, 0);
+            if (n > 0) {
+                sent += n;
+            } else if (n < 0 && errno == ECONNREFUSED && !refused) {
+                refused = true; // an earlier datagram found no listener, try again once
+            } else {
+                break;
+            }
+        }
+        Modes.stats_current.net_udp_dropped += count - sent;
+    }
+
+    writer->udp_count = 0;
+    writer->udp_start = 0;
+}
+
+// Set up the Beast UDP input service on the given ports.
+// _exits_ on failure!
+
+static void udpListen(struct net_service *service, char *bind_addr, char *bind_ports, char *group) {
+    char *p, *end;
+    char buf[NI_MAXSERV];
+
+    if (!bind_ports || !strcmp(bind_ports, "") || !strcmp(bind_ports, "0"))
+        return;
+
+    p = bind_ports;
+    while (p && *p) {
+        int newfds[16];
+        int nfds, i;
+
+        end = strpbrk(p, ", ");
+        if (!end) {
+            strncpy(buf, p, sizeof (buf));
+            buf[sizeof (buf) - 1] = 0;
+            p = NULL;
+        } else {
+            size_t len = end - p;
+            if (len >= sizeof (buf))
+                len = sizeof (buf) - 1;
+            memcpy(buf, p, len);
+            buf[len] = 0;
+            p = end + 1;
+        }
+
+        nfds = anetUdpServer(Modes.aneterr, buf, bind_addr, group, newfds, sizeof (newfds) / sizeof (newfds[0]));
+        if (nfds == ANET_ERR) {
+            fprintf(stderr, "Error opening the UDP port %s (%s): %s\n",
+                    buf, service->descr, Modes.aneterr);
+            exit(1);
+        }
+
+        for (i = 0; i < nfds; ++i) {
+            struct client *c = createGenericClient(service, newfds[i]);
+            c->datagram = true;
+            snprintf(c->host, sizeof (c->host), "%s", group ? group : (bind_addr ? bind_addr : "*"));
+            memcpy(c->port, buf, sizeof (c->port));
+        }
+    }
+}
+
+static void countUdpLost(uint32_t datagrams) {
+    if (net_io_self)
+        net_input_fill->udp_lost += datagrams;
+    else
+        Modes.stats_current.remote_udp_lost += datagrams;
+}
+
+// read() for a UDP client: receives a batch of datagrams and leaves the
+// frames they carry in buf. Returns -1 with errno EAGAIN when there are
+// none, never 0.
+
+static int clientReadDatagrams(struct client *c, char *buf, int len) {
+    struct mmsghdr msgs[NET_UDP_BATCH];
+    struct iovec iov[NET_UDP_BATCH];
+    struct sockaddr_storage from[NET_UDP_BATCH];
+    int batch = len / NET_UDP_SLOT;
+    char *out = buf;
+    uint32_t lost = 0;
+    int got;
+
+    if (batch > NET_UDP_BATCH)
+        batch = NET_UDP_BATCH;
+    if (batch < 1) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    memset(msgs, 0, sizeof (msgs));
+    for (int i = 0; i < batch; ++i) {
+        iov[i].iov_base = buf + i * NET_UDP_SLOT;
+        iov[i].iov_len = NET_UDP_SLOT;
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &from[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof (from[i]);
+    }
+
+    if ((got = recvmmsg(c->fd, msgs, batch, MSG_DONTWAIT, NULL)) < 0)
+        return -1;
+
+    for (int i = 0; i < got; ++i) {
+        unsigned char *p = (unsigned char *) buf + i * NET_UDP_SLOT;
+        unsigned dlen = msgs[i].msg_len;
+        socklen_t flen = msgs[i].msg_hdr.msg_namelen;
+        uint32_t seq;
+
+        if (dlen < NET_UDP_HEADER || (msgs[i].msg_hdr.msg_flags & MSG_TRUNC))
+            continue; // not from --net-beast-udp-out
+
+        // The sequence is counted per sender: start over when another
+        // one shows up
+        seq = ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+        if (c->udp_seq_valid && flen == c->udp_from_len && !memcmp(&from[i], &c->udp_from, flen)) {
+            uint32_t gap = seq - c->udp_seq;
+            if (gap < 0x10000) // not reordered or a restarted sender
+                lost += gap;
+        } else {
+            memcpy(&c->udp_from, &from[i], flen);
+            c->udp_from_len = flen;
+        }
+        c->udp_seq = seq + 1;
+        c->udp_seq_valid = true;
+
+        memmove(out, p + NET_UDP_HEADER, dlen - NET_UDP_HEADER);
+        out += dlen - NET_UDP_HEADER;
+    }
+
+    if (lost)
+        countUdpLost(lost);
+
+    if (out == buf) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return out - buf;
+}
+
+//
+// Compressed streams
+//
+// Connectors with a _zlib_ protocol (beast_zlib_out, beast_zlib_in, ...)
+// and the --net-bzi-port listeners exchange a raw deflate stream instead
+// of the plain one. Output is compressed once per writer flush, into one
+// segment shared by all compressed clients of the service. Each flush ends
+// with Z_SYNC_FLUSH, so a segment holds whole messages, but it refers back
+// to the data of the segments before it. A client that joins, or has to
+// drop queued output, waits for the next segment for which the writer
+// started a new deflate stream, which it does at the first flush after.
+//
+
+struct net_inflate {
+    z_stream z;
+    unsigned char in[16 * 1024]; // compressed data read, inflated from z.next_in
+};
+
+// Set up compression for a new client of a compressed service or connector
+
+static void clientCompress(struct client *c) {
+    if (c->service->writer) {
+        c->deflate = true;
+        c->deflate_sync = false;
+        c->service->writer->zrestart = true;
+        return;
+    }
+
+    if (!(c->inflate = calloc(1, sizeof (*c->inflate))) || inflateInit2(&c->inflate->z, -MAX_WBITS) != Z_OK) {
+        fprintf(stderr, "Out of memory setting up decompression for a %s network client\n", c->service->descr);
+        exit(1);
+    }
+}
+
+static void clientFree(struct client *c) {
+    if (c->inflate) {
+        inflateEnd(&c->inflate->z);
+        free(c->inflate);
+    }
+    free(c);
+}
+
+// Are there compressed bytes read but not inflated yet?
+
+static inline bool clientInflatePending(struct client *c) {
+    return c->inflate && c->inflate->z.avail_in;
+}
+
+// read() for client input, inflating it if need be. Like read(), returns 0
+// only at the end of the stream.
+
+static int clientRead(struct client *c, char *buf, int len) {
+    struct net_inflate *zin = c->inflate;
+    z_stream *z;
+    int ret;
+
+    if (c->datagram)
+        return clientReadDatagrams(c, buf, len);
+    if (!zin)
+        return read(c->fd, buf, len);
+
+    z = &zin->z;
+    z->next_out = (unsigned char *) buf;
+    z->avail_out = len;
+    while (z->avail_out) {
+        if (!z->avail_in) {
+            int nread = read(c->fd, zin->in, sizeof (zin->in));
+            if (nread <= 0) {
+                if (z->avail_out == (unsigned) len)
+                    return nread;
+                break; // this read() is repeated next time
+            }
+            z->next_in = zin->in;
+            z->avail_in = nread;
+        }
+
+        ret = inflate(z, Z_SYNC_FLUSH);
+        if (ret == Z_STREAM_END) {
+            // the sender finished a stream, another may follow
+            inflateReset(z);
+        } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            fprintf(stderr, "%s: Bad compressed data: %s port %s (fd %d): %s\n",
+                    c->service->descr, c->host, c->port, c->fd, z->msg ? z->msg : "inflate failed");
+            errno = EBADMSG;
+            return -1;
+        }
+    }
+
+    return len - z->avail_out;
+}
+
+// A client with compressed output can't skip part of it: drop all of its
+// SendQ that isn't partly written and wait for a new stream
+
+static void clientDropCompressed(struct client *c) {
+    clientDropOldest(c, c->sendq_max);
+    c->deflate_sync = false;
+    c->service->writer->zrestart = true;
+}
+
+// Compress a writer buffer into a new segment, holding a reference to it.
+// That starts a new stream if a client waits for one.
+
+static struct net_segment *segmentDeflate(struct net_writer *writer, const void *data, int len) {
+    struct net_segment *seg;
+    z_stream *z = writer->zstream;
+    int bound;
+
+    if (!z) {
+        if (!(z = calloc(1, sizeof (*z))) ||
+                deflateInit2(z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            fprintf(stderr, "Out of memory setting up compression for service %s\n", writer->service->descr);
+            exit(1);
+        }
+        writer->zstream = z;
+    } else if (writer->zrestart) {
+        deflateReset(z);
     }
+    writer->zrestart = false;
+
+    // room for the data, and the empty stored block ending a flush
+    bound = deflateBound(z, len) + 16;
+    if (!(seg = malloc(sizeof (*seg) + bound))) {
+        fprintf(stderr, "Out of memory allocating a SendQ segment\n");
+        exit(1);
+    }
+
+    z->next_in = (unsigned char *) data;
+    z->avail_in = len;
+    z->next_out = (unsigned char *) seg->data;
+    z->avail_out = bound;
+    if (deflate(z, Z_SYNC_FLUSH) != Z_OK || z->avail_in || !z->avail_out) {
+        fprintf(stderr, "%s: compressing output failed\n", writer->service->descr);
+        exit(1);
+    }
+
+    seg->len = bound - z->avail_out;
+    seg->refs = 1;
+    seg->queued = seg->received = 0;
+    return seg;
 }
 
 //
@@ -696,37 +1696,167 @@ static void flushClient(struct client *c, uint64_t now) {
 // Send the write buffer for the specified writer to all connected clients
 //
 
+// Have a client's SendQ written: right away, or by the I/O thread when it
+// is running. Called with the network lock held, returns true if the I/O
+// thread needs waking up for it (see netWakeIo()).
+
+static bool clientScheduleFlush(struct client *c, uint64_t now, bool threaded) {
+    if (!threaded) {
+        // Try flushing...
+        flushClient(c, now);
+        return false;
+    }
+    if (c->flush_queued)
+        return false;
+
+    // ... or leave that to the I/O thread
+    c->flush_queued = true;
+    c->refs++;
+    c->flush_next = net_flush_list;
+    net_flush_list = c;
+    return true;
+}
+
+static void netWakeIo(void) {
+    if (write(net_io_wakeup[1], "", 1) < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        fprintf(stderr, "Network I/O thread wakeup failed: %s\n", strerror(errno));
+    }
+}
+
+// Time a segment of writer output from going on the SendQs at now_us
+static inline void segmentTime(struct net_segment *seg, const struct net_writer *writer, uint64_t now_us) {
+    if (writer->queued) {
+        seg->queued = now_us;
+        seg->received = writer->received;
+    }
+}
+
 static void flushWrites(struct net_writer *writer) {
     struct client *c;
     uint64_t now = mstime();
+    bool threaded = netThreadRunning();
+    bool wake = false;
+
+    struct net_service *s = writer->service;
+    struct net_segment *seg = NULL; // the buffer, ours until all clients are done
+    struct net_segment *pos = NULL; // its position messages
+    struct net_segment *zseg = NULL; // the buffer compressed
+    bool zfresh = false; // zseg starts a new stream
+    uint64_t now_us = 0;
 
-    for (c = writer->service->clients; c; c = c->next) {
+    if (writer->queued) {
+        now_us = microtime();
+        record_latency(&Modes.stats_current, LATENCY_BUFFER, (int64_t) (now_us - writer->queued));
+    }
+
+    if (writer->udp_ends && writer->dataUsed)
+        udpSend(writer);
+
+    netLock();
+    for (c = s->clients; c; c = c->next) {
         if (!c->service)
             continue;
         if (c->service->writer == writer->service->writer) {
-            uintptr_t psendq_end = (uintptr_t) c->sendq + c->sendq_len; // Pointer to end of sendq
+            struct net_segment *out;
 
-            // Add the buffer to the client's SendQ
-            if ((c->sendq_len + writer->dataUsed) >= c->sendq_max) {
-                // Too much data in client SendQ.  Drop client - SendQ exceeded.
-                fprintf(stderr, "%s: Dropped due to full SendQ: %s port %s (fd %d, SendQ %d, RecvQ %d)\n",
-                        c->service->descr, c->host, c->port,
-                        c->fd, c->sendq_len, c->buflen);
-                modesCloseClient(c);
-                continue; // Go to the next client
+            if (c->deflate) {
+                if (!zseg) {
+                    zfresh = writer->zrestart;
+                    zseg = segmentDeflate(writer, writer->data, writer->dataUsed);
+                    segmentTime(zseg, writer, now_us);
+                }
+                if (!c->deflate_sync && !zfresh)
+                    continue; // waiting for a new stream
+                c->deflate_sync = true;
+                out = zseg;
+            } else {
+                if (!seg) {
+                    seg = segmentCreate(writer->data, writer->dataUsed);
+                    segmentTime(seg, writer, now_us);
+                }
+                out = seg;
             }
-            // Append the data to the end of the queue, increment len
-            memcpy((void*) psendq_end, writer->data, writer->dataUsed);
-            c->sendq_len += writer->dataUsed;
-            // Try flushing...
-            flushClient(c, now);
+
+            // Too much data in client SendQ, apply the SendQ policy
+            if ((c->sendq_len + out->len) >= c->sendq_max) {
+                bool keep = false;
+
+                if (c->deflate && Modes.net_sendq_policy != SENDQ_POLICY_DISCONNECT) {
+                    // Either drop policy: the rest of the stream depends
+                    // on what would be dropped
+                    clientDropCompressed(c);
+                    c->sendq_dropped += out->len;
+                    Modes.stats_current.net_sendq_dropped += out->len;
+                    continue;
+                }
+
+                switch (Modes.net_sendq_policy) {
+                    case SENDQ_POLICY_DROP_OLDEST:
+                        keep = clientDropOldest(c, out->len);
+                        break;
+                    case SENDQ_POLICY_DROP_NON_POSITION:
+                        // Queue only the positions, making room for them
+                        // from the oldest output if need be
+                        if (!pos) {
+                            pos = segmentCreate(writer->pos_data, writer->posUsed);
+                            segmentTime(pos, writer, now_us);
+                        }
+                        out = pos;
+                        c->sendq_dropped += writer->dataUsed - writer->posUsed;
+                        Modes.stats_current.net_sendq_dropped += writer->dataUsed - writer->posUsed;
+                        keep = clientDropOldest(c, out->len);
+                        break;
+                    case SENDQ_POLICY_DISCONNECT:
+                        break;
+                }
+
+                if (!keep) {
+                    // Drop client - SendQ exceeded.
+                    fprintf(stderr, "%s: Dropped due to full SendQ: %s port %s (fd %d, SendQ %d, RecvQ %d)\n",
+                            c->service->descr, c->host, c->port,
+                            c->fd, c->sendq_len, c->buflen);
+                    Modes.stats_current.net_sendq_disconnects++;
+                    modesCloseClient(c);
+                    continue; // Go to the next client
+                }
+            }
+
+            if (!out->len)
+                continue;
+
+            // Append the segment to the end of the queue
+            if (!c->sendq_count) {
+                // An empty SendQ has been flushed up to now
+                c->sendq_offset = 0;
+                c->last_flush = now;
+            }
+            clientQueue(c, out);
+            if (clientScheduleFlush(c, now, threaded))
+                wake = true;
         }
     }
+    if (seg)
+        segmentRelease(seg);
+    if (pos)
+        segmentRelease(pos);
+    if (zseg)
+        segmentRelease(zseg);
+    netUnlock();
+
+    if (wake)
+        netWakeIo();
     writer->dataUsed = 0;
+    writer->posUsed = 0;
+    writer->queued = writer->received = 0;
     writer->lastWrite = mstime();
     return;
 }
 
+// The message modesQueueOutput() is writing output for, for the latency
+// statistics: microtime() it was queued and it was received, 0 if not known
+static uint64_t output_queued;
+static uint64_t output_received;
+
 // Prepare to write up to 'len' bytes to the given net_writer.
 // Returns a pointer to write to, or NULL to skip this write.
 
@@ -753,6 +1883,19 @@ static void *prepareWrite(struct net_writer *writer, int len) {
 // to the buffer returned from prepareWrite.
 
 static void completeWrite(struct net_writer *writer, void *endptr) {
+    if (output_queued && !writer->queued) {
+        writer->queued = output_queued;
+        writer->received = output_received;
+    }
+    if (writer->position && writer->pos_data) {
+        int len = endptr - (writer->data + writer->dataUsed);
+        memcpy(writer->pos_data + writer->posUsed, writer->data + writer->dataUsed, len);
+        writer->posUsed += len;
+    }
+    writer->position = false;
+    writer->bytes += (char *) endptr - ((char *) writer->data + writer->dataUsed);
+    if (writer->udp_ends)
+        udpMessageEnd(writer, (char *) endptr - (char *) writer->data);
     writer->dataUsed = endptr - writer->data;
 
     if (writer->dataUsed >= Modes.net_output_flush_size) {
@@ -766,17 +1909,14 @@ static void completeWrite(struct net_writer *writer, void *endptr) {
 // Write raw output in Beast Binary format with Timestamp to TCP clients
 //
 
-static void modesSendBeastOutput(struct modesMessage *mm, struct net_writer *writer) {
+static void encodeBeast(struct modesMessage *mm) {
     int msgLen = mm->msgbits / 8;
-    char *p = prepareWrite(writer, 2 + 2 * (7 + msgLen));
+    char *p = mm->encoded.beast;
     char ch;
     int j;
     int sig;
     unsigned char *msg = (Modes.net_verbatim ? mm->verbatim : mm->msg);
 
-    if (!p)
-        return;
-
     *p++ = 0x1a;
     if (msgLen == MODES_SHORT_MSG_BYTES) {
         *p++ = '2';
@@ -831,7 +1971,22 @@ static void modesSendBeastOutput(struct modesMessage *mm, struct net_writer *wri
         }
     }
 
-    completeWrite(writer, p);
+    mm->encoded.beast_len = p - mm->encoded.beast;
+}
+
+static void modesSendBeastOutput(struct modesMessage *mm, struct net_writer *writer) {
+    char *p = prepareWrite(writer, MODES_BEAST_ENCODED_MAX);
+
+    if (!p)
+        return; // no clients, or no room: nothing to encode for
+    if (!mm->encoded.beast_len)
+        encodeBeast(mm);
+    if (!mm->encoded.beast_len)
+        return;
+
+    memcpy(p, mm->encoded.beast, mm->encoded.beast_len);
+    writer->position = mm->cpr_valid;
+    completeWrite(writer, p + mm->encoded.beast_len);
 }
 
 static void send_beast_heartbeat(struct net_service *service) {
@@ -867,15 +2022,12 @@ static void printHexDigit(char *p, unsigned char c) {
 // Write raw output to TCP clients
 //
 
-static void modesSendRawOutput(struct modesMessage *mm) {
+static void encodeRaw(struct modesMessage *mm) {
     int msgLen = mm->msgbits / 8;
-    char *p = prepareWrite(&Modes.raw_out, msgLen * 2 + 15);
+    char *p = mm->encoded.raw;
     int j;
     unsigned char *msg = (Modes.net_verbatim ? mm->verbatim : mm->msg);
 
-    if (!p)
-        return;
-
     if (Modes.mlat && mm->timestampMsg) {
         /* timestamp, big-endian */
         sprintf(p, "@%012" PRIX64,
@@ -892,7 +2044,20 @@ static void modesSendRawOutput(struct modesMessage *mm) {
     *p++ = ';';
     *p++ = '\n';
 
-    completeWrite(&Modes.raw_out, p);
+    mm->encoded.raw_len = p - mm->encoded.raw;
+}
+
+static void modesSendRawOutput(struct modesMessage *mm, struct net_writer *writer) {
+    char *p = prepareWrite(writer, MODES_RAW_ENCODED_MAX);
+
+    if (!p)
+        return;
+    if (!mm->encoded.raw_len)
+        encodeRaw(mm);
+
+    memcpy(p, mm->encoded.raw, mm->encoded.raw_len);
+    writer->position = mm->cpr_valid;
+    completeWrite(writer, p + mm->encoded.raw_len);
 }
 
 static void send_raw_heartbeat(struct net_service *service) {
@@ -921,9 +2086,6 @@ static int decodeSbsLine(struct client *c, char *line, int remote) {
     struct modesMessage mm;
     static struct modesMessage zeroMessage;
 
-    char *p = line;
-    char *t[23]; // leave 0 indexed entry empty, place 22 tokens into array
-
     MODES_NOTUSED(remote);
     MODES_NOTUSED(c);
     mm = zeroMessage;
@@ -934,97 +2096,12 @@ static int decodeSbsLine(struct client *c, char *line, int remote) {
     mm.signalLevel = 0;
     mm.sbs_in = 1;
 
-    // sample message from mlat-client basestation output
-    //MSG,3,1,1,4AC8B3,1,2019/12/10,19:10:46.320,2019/12/10,19:10:47.789,,36017,,,51.1001,10.1915,,,,,,
-    //
-    for (int i = 1; i < 23; i++) {
-        t[i] = strsep(&p, ",");
-        if (!p && i < 22)
-            return 0;
-    }
-
-    // check field 1
-    if (!t[1] || strcmp(t[1], "MSG") != 0)
-        return 0;
-
-    if (!t[2] || strlen(t[2]) != 1)
-        return 0; // decoder limited to type 3 messages for now
-
-    if (!t[5] || strlen(t[5]) != 6)
-        return 0; // icao must be 6 characters
-
-    char *icao = t[5];
-    unsigned char *chars = (unsigned char *) &(mm.addr);
-    for (int j = 0; j < 6; j += 2) {
-        int high = hexDigitVal(icao[j]);
-        int low = hexDigitVal(icao[j + 1]);
-
-        if (high == -1 || low == -1) return 0;
-        chars[2 - j / 2] = (high << 4) | low;
-    }
-    if (mm.addr == 0)
+    if (!sbsParse(line, &mm))
         return 0;
 
-    //field 11, callsign
-    if (t[11] && strlen(t[11]) > 0) {
-        strncpy(mm.callsign, t[11], 9);
-        mm.callsign_valid = 1;
-        //fprintf(stderr, "call: %s, ", mm.callsign);
-    }
-    // field 12, altitude
-    if (t[12] && strlen(t[12]) > 0) {
-        mm.altitude_baro = atoi(t[12]);
-        if (mm.altitude_baro < -5000 || mm.altitude_baro > 100000)
-            return 0;
-        mm.altitude_baro_valid = 1;
-        mm.altitude_baro_unit = UNIT_FEET;
-        //fprintf(stderr, "alt: %d, ", mm.altitude_baro);
-    }
-    // field 13, groundspeed
-    if (t[13] && strlen(t[13]) > 0) {
-        mm.gs.v0 = strtod(t[13], NULL);
-        if (mm.gs.v0 > 0)
-            mm.gs_valid = 1;
-        //fprintf(stderr, "gs: %.1f, ", mm.gs.selected);
-    }
-    //field 14, heading
-    if (t[14] && strlen(t[14]) > 0) {
-        mm.heading_valid = 1;
-        mm.heading = strtod(t[14], NULL);
-        mm.heading_type = HEADING_GROUND_TRACK;
-        //fprintf(stderr, "track: %.1f, ", mm.heading);
-    }
-    // field 15 and 16, position
-    if (t[15] && strlen(t[15]) && t[16] && strlen(t[16])) {
-        mm.decoded_lat = strtod(t[15], NULL);
-        mm.decoded_lon = strtod(t[16], NULL);
-        //fprintf(stderr, "pos: (%.2f, %.2f), ", mm.decoded_lat, mm.decoded_lon);
-    }
-    // field 17 vertical rate, assume baro
-    if (t[17] && strlen(t[17]) > 0) {
-        mm.baro_rate = atoi(t[17]);
-        mm.baro_rate_valid = 1;
-        //fprintf(stderr, "vRate: %d, ", mm.baro_rate);
-    }
-    // field 18 vertical rate, assume baro
-    if (t[18] && strlen(t[18]) > 0) {
-        long int tmp = strtol(t[18], NULL, 10);
-        if (tmp > 0) {
-            mm.squawk = (tmp / 1000) * 16 * 16 * 16 + (tmp / 100 % 10) * 16 * 16 + (tmp / 10 % 10) * 16 + (tmp % 10);
-            mm.squawk_valid = 1;
-            //fprintf(stderr, "squawk: %04x %s, ", mm.squawk, t[18]);
-        }
-    }
-    // field 22 ground status
-    if (t[22] && strlen(t[22]) > 0 && atoi(t[22]) > 0) {
-        mm.airground = AIRCRAFT_META__AIR_GROUND__AG_GROUND;
-        //fprintf(stderr, "onground, ");
-    }
-
     // record reception time as the time we read it.
     mm.sysTimestampMsg = mstime();
 
-    //fprintf(stderr, "%d, %0.5f, %0.5f\n", mm.altitude_baro, mm.decoded_lat, mm.decoded_lon);
     useModesMessage(&mm);
 
     return 0;
@@ -1037,232 +2114,96 @@ static int decodeSbsLine(struct client *c, char *line, int remote) {
 
 static void modesSendSBSOutput(struct modesMessage *mm, struct aircraft *a) {
     char *p;
-    struct timespec now;
-    struct tm stTime_receive, stTime_now;
-    int msgType;
 
     // For now, suppress non-ICAO addresses
     if (mm->addr & MODES_NON_ICAO_ADDRESS)
         return;
 
-    p = prepareWrite(&Modes.sbs_out, 200);
+    p = prepareWrite(&Modes.sbs_out, SBS_MAX_LINE);
     if (!p)
         return;
 
-    //
-    // SBS BS style output checked against the following reference
-    // http://www.homepages.mcb.net/bones/SBS/Article/Barebones42_Socket_Data.htm - seems comprehensive
-    //
-
-    // Decide on the basic SBS Message Type
-    switch (mm->msgtype) {
-        case 4:
-        case 20:
-            msgType = 5;
-            break;
-            break;
+    if (!(p = sbsEncode(p, mm, a, NULL)))
+        return;
 
-        case 5:
-        case 21:
-            msgType = 6;
-            break;
+    Modes.sbs_out.position = mm->cpr_valid;
+    completeWrite(&Modes.sbs_out, p);
+}
 
-        case 0:
-        case 16:
-            msgType = 7;
-            break;
+static void send_sbs_heartbeat(struct net_service *service) {
+    static char *heartbeat_message = "\r\n"; // is there a better one?
+    char *data;
+    int len = strlen(heartbeat_message);
 
-        case 11:
-            msgType = 8;
-            break;
+    if (!service->writer)
+        return;
 
-        case 17:
-        case 18:
-            if (mm->metype >= 1 && mm->metype <= 4) {
-                msgType = 1;
-            } else if (mm->metype >= 5 && mm->metype <= 8) {
-                msgType = 2;
-            } else if (mm->metype >= 9 && mm->metype <= 18) {
-                msgType = 3;
-            } else if (mm->metype == 19) {
-                msgType = 4;
-            } else {
-                return;
-            }
-            break;
+    data = prepareWrite(service->writer, len);
+    if (!data)
+        return;
 
-        default:
-            return;
-    }
+    memcpy(data, heartbeat_message, len);
+    completeWrite(service->writer, data + len);
+}
 
-    // Fields 1 to 6 : SBS message type and ICAO address of the aircraft and some other stuff
-    p += sprintf(p, "MSG,%d,1,1,%06X,1,", msgType, mm->addr);
+//
+//=========================================================================
+//
 
-    // Find current system time
-    clock_gettime(CLOCK_REALTIME, &now);
-    localtime_r(&now.tv_sec, &stTime_now);
+// --net-beast-reduce-budget: trackReduceSchedule() keeps the BeastReduce
+// output near the budget over the seconds, this holds it to it in between,
+// with a bucket of a second of budget filled as time passes and drained by
+// what is written. Messages of new and downstream stale aircraft may take
+// half a second of budget ahead.
 
-    // Find message reception time
-    time_t received = (time_t) (mm->sysTimestampMsg / 1000);
-    localtime_r(&received, &stTime_receive);
+static bool beastReduceAdmit(struct aircraft *a) {
+    static int64_t tokens;
+    static uint64_t last, charged;
+    int64_t budget = Modes.net_output_beast_reduce_budget;
+    uint64_t now = mstime();
 
-    // Fields 7 & 8 are the message reception time and date
-    p += sprintf(p, "%04d/%02d/%02d,", (stTime_receive.tm_year + 1900), (stTime_receive.tm_mon + 1), stTime_receive.tm_mday);
-    p += sprintf(p, "%02d:%02d:%02d.%03u,", stTime_receive.tm_hour, stTime_receive.tm_min, stTime_receive.tm_sec, (unsigned) (mm->sysTimestampMsg % 1000));
+    if (!budget)
+        return true;
 
-    // Fields 9 & 10 are the current time and date
-    p += sprintf(p, "%04d/%02d/%02d,", (stTime_now.tm_year + 1900), (stTime_now.tm_mon + 1), stTime_now.tm_mday);
-    p += sprintf(p, "%02d:%02d:%02d.%03u", stTime_now.tm_hour, stTime_now.tm_min, stTime_now.tm_sec, (unsigned) (now.tv_nsec / 1000000U));
+    if (!last)
+        last = now; // start empty, or the first second gets two
+    int64_t refill = budget * (int64_t) (now - last) / 1000;
+    if (refill > 0) {
+        tokens = tokens + refill < budget ? tokens + refill : budget;
+        last = now;
+    }
+    tokens -= Modes.beast_reduce_out.bytes - charged;
+    charged = Modes.beast_reduce_out.bytes;
 
-    // Field 11 is the callsign (if we have it)
-    if (mm->callsign_valid) {
-        p += sprintf(p, ",%s", mm->callsign);
-    } else {
-        p += sprintf(p, ",");
+    int64_t least = (!a || a->reduce_priority <= REDUCE_PRIORITY_STALE) ? -budget / 2 : 0;
+    if (tokens < least) {
+        Modes.stats_current.net_reduce_dropped++;
+        return false;
     }
+    return true;
+}
 
-    // Field 12 is the altitude (if we have it)
-    if (Modes.use_gnss) {
-        if (mm->altitude_geom_valid) {
-            p += sprintf(p, ",%dH", mm->altitude_geom);
-        } else if (mm->altitude_baro_valid && trackDataValid(&a->geom_delta_valid)) {
-            p += sprintf(p, ",%dH", mm->altitude_baro + a->geom_delta);
-        } else if (mm->altitude_baro_valid) {
-            p += sprintf(p, ",%d", mm->altitude_baro);
-        } else {
-            p += sprintf(p, ",");
-        }
-    } else {
-        if (mm->altitude_baro_valid) {
-            p += sprintf(p, ",%d", mm->altitude_baro);
-        } else if (mm->altitude_geom_valid && trackDataValid(&a->geom_delta_valid)) {
-            p += sprintf(p, ",%d", mm->altitude_geom - a->geom_delta);
-        } else {
-            p += sprintf(p, ",");
-        }
-    }
-
-    // Field 13 is the ground Speed (if we have it)
-    if (mm->gs_valid) {
-        p += sprintf(p, ",%.0f", mm->gs.selected);
-    } else {
-        p += sprintf(p, ",");
-    }
-
-    // Field 14 is the ground Heading (if we have it)
-    if (mm->heading_valid && mm->heading_type == HEADING_GROUND_TRACK) {
-        p += sprintf(p, ",%.0f", mm->heading);
-    } else {
-        p += sprintf(p, ",");
-    }
-
-    // Fields 15 and 16 are the Lat/Lon (if we have it)
-    if (mm->cpr_decoded) {
-        p += sprintf(p, ",%1.5f,%1.5f", mm->decoded_lat, mm->decoded_lon);
-    } else {
-        p += sprintf(p, ",,");
-    }
-
-    // Field 17 is the VerticalRate (if we have it)
-    if (Modes.use_gnss) {
-        if (mm->geom_rate_valid) {
-            p += sprintf(p, ",%dH", mm->geom_rate);
-        } else if (mm->baro_rate_valid) {
-            p += sprintf(p, ",%d", mm->baro_rate);
-        } else {
-            p += sprintf(p, ",");
-        }
-    } else {
-        if (mm->baro_rate_valid) {
-            p += sprintf(p, ",%d", mm->baro_rate);
-        } else if (mm->geom_rate_valid) {
-            p += sprintf(p, ",%d", mm->geom_rate);
-        } else {
-            p += sprintf(p, ",");
-        }
-    }
-
-    // Field 18 is  the Squawk (if we have it)
-    if (mm->squawk_valid) {
-        p += sprintf(p, ",%04x", mm->squawk);
-    } else {
-        p += sprintf(p, ",");
-    }
-
-    // Field 19 is the Squawk Changing Alert flag (if we have it)
-    if (mm->alert_valid) {
-        if (mm->alert) {
-            p += sprintf(p, ",-1");
-        } else {
-            p += sprintf(p, ",0");
-        }
-    } else {
-        p += sprintf(p, ",");
-    }
-
-    // Field 20 is the Squawk Emergency flag (if we have it)
-    if (mm->squawk_valid) {
-        if ((mm->squawk == 0x7500) || (mm->squawk == 0x7600) || (mm->squawk == 0x7700)) {
-            p += sprintf(p, ",-1");
-        } else {
-            p += sprintf(p, ",0");
-        }
-    } else {
-        p += sprintf(p, ",");
-    }
-
-    // Field 21 is the Squawk Ident flag (if we have it)
-    if (mm->spi_valid) {
-        if (mm->spi) {
-            p += sprintf(p, ",-1");
-        } else {
-            p += sprintf(p, ",0");
-        }
-    } else {
-        p += sprintf(p, ",");
-    }
-
-    // Field 22 is the OnTheGround flag (if we have it)
-    switch (mm->airground) {
-        case AIRCRAFT_META__AIR_GROUND__AG_GROUND:
-            p += sprintf(p, ",-1");
-            break;
-        case AIRCRAFT_META__AIR_GROUND__AG_AIRBORNE:
-            p += sprintf(p, ",0");
-            break;
-        default:
-            p += sprintf(p, ",");
-            break;
-    }
-
-    p += sprintf(p, "\r\n");
+// Does the aircraft have a position inside the --net-region box?
 
-    completeWrite(&Modes.sbs_out, p);
-}
-
-static void send_sbs_heartbeat(struct net_service *service) {
-    static char *heartbeat_message = "\r\n"; // is there a better one?
-    char *data;
-    int len = strlen(heartbeat_message);
-
-    if (!service->writer)
-        return;
-
-    data = prepareWrite(service->writer, len);
-    if (!data)
-        return;
-
-    memcpy(data, heartbeat_message, len);
-    completeWrite(service->writer, data + len);
+static bool aircraftInNetRegion(struct aircraft *a) {
+    return a && Modes.net_region_set && trackDataValid(&a->position_valid) &&
+            trackBoxContains(Modes.net_region[0], Modes.net_region[1], Modes.net_region[2], Modes.net_region[3],
+            a->meta.lat, a->meta.lon);
 }
 
-//
-//=========================================================================
-//
-
 void modesQueueOutput(struct modesMessage *mm, struct aircraft *a) {
     int is_mlat = (mm->source == SOURCE_MLAT);
 
+    // Time the output written for the message
+    output_queued = microtime();
+    output_received = (Modes.sdr_type != SDR_IFILE && Modes.sdr_type != SDR_REPLAY) ? mm->sysTimestampMsg * 1000 : 0;
+    if (mm->sysTimestampUse)
+        record_latency(&Modes.stats_current, LATENCY_DECODE, (int64_t) (output_queued - mm->sysTimestampUse));
+
+    // each format is encoded once, when the first writer wants it
+    mm->encoded.beast_len = 0;
+    mm->encoded.raw_len = 0;
+
     if (a && !is_mlat && mm->correctedbits < 2) {
         // Don't ever forward 2-bit-corrected messages via SBS output.
         // Don't ever forward mlat messages via SBS output.
@@ -1272,21 +2213,56 @@ void modesQueueOutput(struct modesMessage *mm, struct aircraft *a) {
     if (!is_mlat && (Modes.net_verbatim || mm->correctedbits < 2)) {
         // Forward 2-bit-corrected messages via raw output only if --net-verbatim is set
         // Don't ever forward mlat messages via raw output.
-        modesSendRawOutput(mm);
+        modesSendRawOutput(mm, &Modes.raw_out);
     }
 
     if ((!is_mlat || Modes.forward_mlat) && (Modes.net_verbatim || mm->correctedbits < 2)) {
         // Forward 2-bit-corrected messages via beast output only if --net-verbatim is set
         // Forward mlat messages via beast output only if --forward-mlat is set
         modesSendBeastOutput(mm, &Modes.beast_out);
-        if (mm->reduce_forward) {
+        if (mm->reduce_forward && beastReduceAdmit(a)) {
             modesSendBeastOutput(mm, &Modes.beast_reduce_out);
+            if (a && mm->cpr_valid)
+                a->reduce_position_forwarded = mstime();
+        }
+        if (aircraftInNetRegion(a)) {
+            modesSendBeastOutput(mm, &Modes.beast_region_out);
         }
     }
 
     if (a && !is_mlat) {
         writeFATSVEvent(mm, a);
     }
+
+    output_queued = 0;
+}
+
+static inline bool serviceHasClients(struct net_service *service) {
+    return service && service->connections;
+}
+
+static inline bool writerHasClients(struct net_writer *writer) {
+    return serviceHasClients(writer->service);
+}
+
+// With --net-relay, messages are only CRC-checked, their address extracted
+// and then forwarded, until something needs decoded fields or aircraft
+// state: output files, the display, or a client of an output built from
+// tracked aircraft. Raw and Beast output just copy the message. Every JSON,
+// protocol buffer or SBS consumer of the aircraft has to be listed here,
+// or it gets none with --net-relay. The HTTP snapshots and the history
+// are polled, so they need the aircraft kept up between requests, not just
+// while a client is connected.
+
+bool modesNetRelayNeedsDecode(void) {
+    if (!Modes.net_relay)
+        return true;
+
+    return Modes.output_dir || Modes.interactive || !Modes.quiet ||
+            writerHasClients(&Modes.sbs_out) || writerHasClients(&Modes.vrs_out) ||
+            writerHasClients(&Modes.fatsv_out) || writerHasClients(&Modes.beast_reduce_out) ||
+            writerHasClients(&Modes.beast_region_out) ||
+            modesNetHttpEnabled() || pbStreamHasClients();
 }
 
 // Decode a little-endian IEEE754 float (binary32)
@@ -1427,13 +2403,7 @@ static void decodeHulcMessage(char *p) {
 
     if (id == 0x01 && len == 0x18) {
         // HULC Status message
-        for (int j = 0; j < len; j++) {
-            hsm.buf[j] = *p++;
-            // unescape
-            if (*p == 0x1A) {
-                p++;
-            }
-        }
+        memcpy(hsm.buf, p, len);
         // Antenna serial
         Modes.receiver.antenna_serial = __bswap_32(hsm.status.serial);
         // Antenna status flags
@@ -1483,15 +2453,309 @@ static void decodeHulcMessage(char *p) {
 // case where we want broken messages here to close the client connection.
 //
 
+//
+//=========================================================================
+//
+// Beast framing
+//
+// A frame is a 0x1a, a type byte and a fixed length body (its length in the
+// body for GNS HULC frames) in which every 0x1a is sent twice.
+// beastNextFrame() finds the frames in a buffer and unescapes them in place,
+// so decodeBeastFrame() and the network I/O thread only ever see the plain
+// frame. Escapes are rare, so each frame body is first tested for 0x1a as a
+// whole, 32 bytes at a time when SIMD is available; only frames that have
+// one are walked byte by byte.
+//
+
+// Length of the unescaped frame starting at the type byte p, 0 if p does
+// not start a valid frame, or -1 if more data is needed to tell
+
+static int beastFrameLength(const char *p, const char *eod) {
+    if (p >= eod)
+        return -1;
+
+    switch (*p) {
+        case '1':
+            return MODEAC_MSG_BYTES + 8;
+        case '2':
+            return MODES_SHORT_MSG_BYTES + 8;
+        case '3':
+        case '4':
+        case '5':
+            return MODES_LONG_MSG_BYTES + 8;
+        case 'H':
+        {
+            // GNS HULC protocol message
+            if (p + 2 >= eod)
+                return -1;
+            int len = *(const unsigned char *) (p + 2);
+            if (len > 24)
+                return 0; // Length doesn't match, skip message
+            return len + 3;
+        }
+        default:
+            return 0;
+    }
+}
+
+// Return the first 0x1a in the n bytes (at most 32) at p, or NULL
+
+static inline char *beastFindEscape(char *p, int n, const char *eod) {
+#if defined(__SSE2__)
+    if (eod - p >= 32) {
+        __m128i esc = _mm_set1_epi8(0x1a);
+        uint32_t bits = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) p), esc)) |
+                (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (p + 16)), esc)) << 16;
+
+        if (n < 32)
+            bits &= (1U << n) - 1;
+        return bits ? p + __builtin_ctz(bits) : NULL;
+    }
+#elif defined(__aarch64__)
+    if (eod - p >= 32) {
+        static const uint8_t lanes[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+        uint8x16_t esc = vdupq_n_u8(0x1a);
+        uint8x16_t l = vld1q_u8(lanes);
+        uint8x16_t lo = vandq_u8(vceqq_u8(vld1q_u8((const uint8_t *) p), esc), l);
+        uint8x16_t hi = vandq_u8(vceqq_u8(vld1q_u8((const uint8_t *) (p + 16)), esc), l);
+        uint32_t bits = vaddv_u8(vget_low_u8(lo)) | vaddv_u8(vget_high_u8(lo)) << 8 |
+                vaddv_u8(vget_low_u8(hi)) << 16 | (uint32_t) vaddv_u8(vget_high_u8(hi)) << 24;
+
+        if (n < 32)
+            bits &= (1U << n) - 1;
+        return bits ? p + __builtin_ctz(bits) : NULL;
+    }
+#endif
+    return memchr(p, 0x1a, n);
+}
+
+// Return the next complete frame between scan->next and scan->eod, starting
+// at its type byte and unescaped in place, with its length in *len, and
+// advance scan->next past it. Bytes before it that are not part of a frame
+// are skipped and added to scan->garbage. Returns NULL once no complete
+// frame is left: scan->next then points at the 0x1a of an incomplete frame,
+// scan->need is the (least) number of bytes that frame takes, or at eod.
+
+char *beastNextFrame(struct beast_scan *scan, int *len) {
+    char *som = scan->next; // first byte of next frame
+    char *eod = scan->eod;
+
+    scan->need = 0;
+    while (som < eod) {
+        if (*som != 0x1a) {
+            char *p = memchr(som, 0x1a, eod - som);
+            if (!p) {
+                scan->garbage += eod - som;
+                som = eod;
+                break;
+            }
+            scan->garbage += p - som;
+            som = p; // consume garbage up to the 0x1a
+        }
+
+        char *frame = som + 1; // skip 0x1a
+        int flen = beastFrameLength(frame, eod);
+        if (flen < 0) {
+            // Incomplete frame, retry later
+            scan->need = (frame - som) + 3;
+            break;
+        }
+        if (flen == 0) {
+            // Not a valid Beast frame, skip 0x1a and try again
+            ++som;
+            continue;
+        }
+
+        char *eom = frame + flen; // one byte past end of frame, without escapes
+        if (eom > eod) {
+            scan->need = eom - som;
+            break;
+        }
+
+        char *p = beastFindEscape(frame, flen, eod);
+        if (p) {
+            // Find where the escaped frame ends ...
+            for (char *q = p; q < eod && q < eom; q++) {
+                if (0x1a == *q) {
+                    q++;
+                    eom++;
+                }
+            }
+            if (eom > eod) {
+                scan->need = eom - som;
+                break;
+            }
+
+            // ... and drop the second of every pair of 0x1a
+            for (char *out = p; p < eom; ) {
+                char ch = *p++;
+                *out++ = ch;
+                if (0x1a == ch)
+                    p++;
+            }
+        }
+
+        scan->next = eom;
+        *len = flen;
+        return frame;
+    }
+
+    scan->next = som;
+    return NULL;
+}
+
+//
+// Duplicate suppression
+//
+// Receivers close to each other that feed the same instance deliver the
+// same Mode S frame within milliseconds of each other. With
+// --net-dedup-window, a frame from the network with the same bytes as one
+// received less than a window ago is dropped before it is decoded.
+//
+// The frames seen are kept in two hash sets, one per window: the current
+// one and the previous one, which is cleared and becomes the current one
+// when the current window ends. So a frame is suppressed for at least one
+// and at most two windows after the first copy, and a frame repeated
+// within every window is still passed on once every one or two windows.
+//
+
+#define NET_DEDUP_SLOTS 16384 // per window, power of two
+#define NET_DEDUP_LIMIT (NET_DEDUP_SLOTS / 2) // frames kept per window
+
+struct net_dedup_entry {
+    uint8_t len; // 0: empty
+    unsigned char msg[MODES_LONG_MSG_BYTES];
+};
+
+static struct net_dedup_entry *net_dedup_sets[2]; // current, previous
+static unsigned net_dedup_used; // entries of the current set
+static uint64_t net_dedup_start; // when the current window started
+
+static void netDedupInit(void) {
+    for (int i = 0; i < 2; ++i) {
+        if (!(net_dedup_sets[i] = calloc(NET_DEDUP_SLOTS, sizeof (struct net_dedup_entry)))) {
+            fprintf(stderr, "Out of memory allocating the duplicate filter\n");
+            exit(1);
+        }
+    }
+}
+
+static inline unsigned netDedupHash(const unsigned char *msg, int len) {
+    uint32_t h = 2166136261u; // FNV-1a
+
+    for (int i = 0; i < len; ++i)
+        h = (h ^ msg[i]) * 16777619u;
+    return h & (NET_DEDUP_SLOTS - 1);
+}
+
+// Look for msg in a set; returns its slot, or the empty slot it would go in
+
+static inline struct net_dedup_entry *netDedupFind(struct net_dedup_entry *set, unsigned h, const unsigned char *msg, int len) {
+    struct net_dedup_entry *e;
+
+    while ((e = &set[h])->len && (e->len != len || memcmp(e->msg, msg, len)))
+        h = (h + 1) & (NET_DEDUP_SLOTS - 1);
+    return e;
+}
+
+// Is msg a copy of a frame received within the window before now? If not,
+// remember it.
+
+static bool netDuplicate(const unsigned char *msg, int len, uint64_t now) {
+    struct net_dedup_entry *e;
+    unsigned h;
+
+    if (now - net_dedup_start >= (uint64_t) Modes.net_dedup_window) {
+        struct net_dedup_entry *set = net_dedup_sets[1];
+
+        // the previous window ends, unless it was over long ago
+        if (now - net_dedup_start >= 2 * (uint64_t) Modes.net_dedup_window)
+            memset(net_dedup_sets[0], 0, NET_DEDUP_SLOTS * sizeof (*set));
+        memset(set, 0, NET_DEDUP_SLOTS * sizeof (*set));
+        net_dedup_sets[1] = net_dedup_sets[0];
+        net_dedup_sets[0] = set;
+        net_dedup_used = 0;
+        net_dedup_start = now;
+    }
+
+    h = netDedupHash(msg, len);
+    if (netDedupFind(net_dedup_sets[1], h, msg, len)->len)
+        return true;
+
+    e = netDedupFind(net_dedup_sets[0], h, msg, len);
+    if (e->len)
+        return true;
+
+    // a full set passes on what doesn't fit
+    if (net_dedup_used < NET_DEDUP_LIMIT) {
+        e->len = len;
+        memcpy(e->msg, msg, len);
+        net_dedup_used++;
+    }
+    return false;
+}
+
 static int decodeBinMessage(struct client *c, char *p, int remote) {
+    MODES_NOTUSED(c);
+    decodeBeastFrame(p, remote, mstime());
+    return 0;
+}
+
+//
+// Set up mm for the Mode S or Mode A/C message of a Beast frame, p pointing
+// past its type byte. Returns the message data.
+//
+
+static char *beastFrameMessage(char *p, int remote, uint64_t received, struct modesMessage *mm) {
+    static struct modesMessage zeroMessage;
+
+    *mm = zeroMessage;
+
+    /* Beast messages are marked depending on their source. From internet they are marked
+     * remote so that we don't try to pass them off as being received by this instance
+     * when forwarding them.
+     */
+    mm->remote = remote;
+
+    // Grab the timestamp (big endian format)
+    mm->timestampMsg = 0;
+    for (int j = 0; j < 6; j++)
+        mm->timestampMsg = mm->timestampMsg << 8 | (*p++ & 255);
+
+    // record reception time as the time we read it.
+    mm->sysTimestampMsg = received;
+
+    // Grab the signal level
+    mm->signalLevel = ((unsigned char) *p++ / 255.0);
+    mm->signalLevel = mm->signalLevel * mm->signalLevel;
+
+    return p;
+}
+
+// In case of Mode-S Beast use the signal level per message for statistics
+
+static inline void beastSignalStats(const struct modesMessage *mm) {
+    if (Modes.sdr_type == SDR_MODESBEAST || (Modes.sdr_type == SDR_REPLAY && !mm->remote)) {
+        Modes.stats_current.signal_power_sum += mm->signalLevel;
+        Modes.stats_current.signal_power_count += 1;
+
+        if (mm->signalLevel > Modes.stats_current.peak_signal_power)
+            Modes.stats_current.peak_signal_power = mm->signalLevel;
+        if (mm->signalLevel > 0.50119)
+            Modes.stats_current.strong_signal_count++; // signal power above -3dBFS
+    }
+}
+
+//
+// Decode one Beast frame as returned by beastNextFrame(), that was read at
+// system time 'received'.
+//
+
+void decodeBeastFrame(char *p, int remote, uint64_t received) {
     int msgLen = 0;
-    int j;
     char ch;
     unsigned char msg[MODES_LONG_MSG_BYTES + 7];
-    static struct modesMessage zeroMessage;
     struct modesMessage mm;
-    MODES_NOTUSED(c);
-    memset(&mm, 0, sizeof (mm));
 
     ch = *p++; /// Get the message type
 
@@ -1502,7 +2766,7 @@ static int decodeBinMessage(struct client *c, char *p, int remote) {
             } else {
                 Modes.stats_current.demod_modeac++;
             }
-            return 0;
+            return;
         }
         msgLen = MODEAC_MSG_BYTES;
     } else if (ch == '2') {
@@ -1513,74 +2777,28 @@ static int decodeBinMessage(struct client *c, char *p, int remote) {
         // Special case for Radarcape position messages.
         float lat, lon, alt;
 
-        for (j = 0; j < 21; j++) { // and the data
-            msg[j] = ch = *p++;
-            if (0x1A == ch) {
-                p++;
-            }
-        }
+        memcpy(msg, p, 21);
 
         lat = ieee754_binary32_le_to_float(msg + 4);
         lon = ieee754_binary32_le_to_float(msg + 8);
         alt = ieee754_binary32_le_to_float(msg + 12);
 
         handle_radarcape_position(lat, lon, alt);
-        return 0;
+        return;
     } else if (ch == 'H') {
         decodeHulcMessage(p);
-        return 0;
+        return;
     } else {
         // Ignore this.
-        return 0;
+        return;
     }
 
     if (msgLen) {
-        mm = zeroMessage;
-
-        /* Beast messages are marked depending on their source. From internet they are marked
-         * remote so that we don't try to pass them off as being received by this instance
-         * when forwarding them.
-         */
-        mm.remote = remote;
-
-        // Grab the timestamp (big endian format)
-        mm.timestampMsg = 0;
-        for (j = 0; j < 6; j++) {
-            ch = *p++;
-            mm.timestampMsg = mm.timestampMsg << 8 | (ch & 255);
-            if (0x1A == ch) {
-                p++;
-            }
-        }
-
-        // record reception time as the time we read it.
-        mm.sysTimestampMsg = mstime();
-
-        ch = *p++; // Grab the signal level
-        mm.signalLevel = ((unsigned char) ch / 255.0);
-        mm.signalLevel = mm.signalLevel * mm.signalLevel;
-
-        /* In case of Mode-S Beast use the signal level per message for statistics */
-        if (Modes.sdr_type == SDR_MODESBEAST) {
-            Modes.stats_current.signal_power_sum += mm.signalLevel;
-            Modes.stats_current.signal_power_count += 1;
-
-            if (mm.signalLevel > Modes.stats_current.peak_signal_power)
-                Modes.stats_current.peak_signal_power = mm.signalLevel;
-            if (mm.signalLevel > 0.50119)
-                Modes.stats_current.strong_signal_count++; // signal power above -3dBFS
-        }
+        p = beastFrameMessage(p, remote, received, &mm);
 
-        if (0x1A == ch) {
-            p++;
-        }
+        beastSignalStats(&mm);
 
-        for (j = 0; j < msgLen; j++) { // and the data
-            msg[j] = ch = *p++;
-            if (0x1A == ch) {
-                p++;
-            }
-        }
+        memcpy(msg, p, msgLen); // and the data
 
         if (msgLen == MODEAC_MSG_BYTES) { // ModeA or ModeC
             if (remote) {
@@ -1596,6 +2814,10 @@ static int decodeBinMessage(struct client *c, char *p, int remote) {
             } else {
                 Modes.stats_current.demod_preambles++;
             }
+            if (remote && Modes.net_dedup_window && netDuplicate(msg, msgLen, received)) {
+                Modes.stats_current.remote_duplicates++;
+                return;
+            }
             result = decodeModesMessage(&mm, msg);
             if (result < 0) {
                 if (result == -1) {
@@ -1611,7 +2833,7 @@ static int decodeBinMessage(struct client *c, char *p, int remote) {
                         Modes.stats_current.demod_rejected_bad++;
                     }
                 }
-                return 0;
+                return;
             } else {
                 if (remote) {
                     Modes.stats_current.remote_accepted[mm.correctedbits]++;
@@ -1623,7 +2845,6 @@ static int decodeBinMessage(struct client *c, char *p, int remote) {
 
         useModesMessage(&mm);
     }
-    return (0);
 }
 //
 //=========================================================================
@@ -1747,6 +2968,10 @@ static int decodeHexMessage(struct client *c, char *hex, int remote) {
         int result;
 
         Modes.stats_current.remote_received_modes++;
+        if (Modes.net_dedup_window && netDuplicate(msg, l / 2, mm.sysTimestampMsg)) {
+            Modes.stats_current.remote_duplicates++;
+            return 0;
+        }
         result = decodeModesMessage(&mm, msg);
         if (result < 0) {
             if (result == -1)
@@ -1971,212 +3196,1069 @@ static void compute_wind(struct aircraft *a) {
     }
 }
 
-/**
- * Generate aircraft metadata collection as protocol buffer file.
- */
-void generateAircraftProtoBuf(void) {
-    char pathbuf[PATH_MAX];
-    char tmppath[PATH_MAX];
+// Protocol buffer files are written several times a second. The packed
+// message goes straight to the file through a fixed buffer rather than being
+// packed into a malloc'ed copy first. aircraft.pb is packed on a writer thread
+// from a copy of the aircraft state, see startAircraftWriter().
+
+#define PB_WRITE_CHUNK 65536
+
+static void pbSnapshotCleanup(void);
+
+static void pbCleanup(void) {
+    pbSnapshotCleanup();
+}
+
+// A ProtobufCBuffer that collects the packed message and writes it to fd
+// whenever PB_WRITE_CHUNK bytes have come together
+struct pb_file_buffer {
+    ProtobufCBuffer base;
     int fd;
-    mode_t mask;
+    bool failed;
+    size_t len;
+    uint8_t data[PB_WRITE_CHUNK];
+};
+
+static struct pb_file_buffer pb_file_buffer;
+static struct pb_file_buffer pb_writer_buffer; // used by the aircraft.pb writer thread
+
+static void pbWriteAll(struct pb_file_buffer *b, const uint8_t *data, size_t len) {
+    while (len && !b->failed) {
+        ssize_t n = write(b->fd, data, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            b->failed = true;
+            break;
+        }
+        data += n;
+        len -= n;
+    }
+}
 
-    if (!Modes.output_dir) {
+static void pbFileAppend(ProtobufCBuffer *buffer, size_t len, const uint8_t *data) {
+    struct pb_file_buffer *b = (struct pb_file_buffer *) buffer;
+
+    if (b->len + len > PB_WRITE_CHUNK) {
+        pbWriteAll(b, b->data, b->len);
+        b->len = 0;
+    }
+    if (len > PB_WRITE_CHUNK) {
+        pbWriteAll(b, data, len);
         return;
     }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+}
+
+// The umask can only be read by setting it, which is process wide. Do that
+// once, before startAircraftWriter() starts its thread, not for every file.
+static mode_t pbFileMode(void) {
+    static bool done;
+    static mode_t mode;
+
+    if (!done) {
+        mode_t mask = umask(0);
+        umask(mask);
+        mode = 0644 & ~mask;
+        done = true;
+    }
+    return mode;
+}
+
+// Write the packed message, or else len bytes of data, through b to a
+// temporary file in the output directory and rename it to file when complete
+static void writeOutputFile(struct pb_file_buffer *b, const char *file, const ProtobufCMessage *msg, const uint8_t *data, size_t len) {
+    char pathbuf[PATH_MAX];
+    char tmppath[PATH_MAX];
 
-    snprintf(tmppath, PATH_MAX, "%s/aircraft.pb.XXXXXX", Modes.output_dir);
+    snprintf(tmppath, PATH_MAX, "%s/%s.XXXXXX", Modes.output_dir, file);
     tmppath[PATH_MAX - 1] = 0;
-    fd = mkstemp(tmppath);
-    if (fd < 0) {
-        fprintf(stderr, "Creating aircraft.pb failed.\n");
+    b->fd = mkstemp(tmppath);
+    if (b->fd < 0) {
+        fprintf(stderr, "Creating %s failed.\n", file);
         return;
     }
 
-    uint64_t now = mstime();
-    struct aircraft *a;
-    size_t j;
-    // The entire collection of tracked aircrafts.
-    AircraftsUpdate msg = AIRCRAFTS_UPDATE__INIT;
+    fchmod(b->fd, pbFileMode());
 
-    msg.n_aircraft = 0;
-    msg.now = (uint64_t) (now / 1000);
-    msg.messages = Modes.stats_current.messages_total + Modes.stats_alltime.messages_total;
+    b->base.append = pbFileAppend;
+    b->failed = false;
+    b->len = 0;
+    if (msg)
+        protobuf_c_message_pack_to_buffer(msg, &b->base);
+    else
+        pbFileAppend(&b->base, len, data);
+    pbWriteAll(b, b->data, b->len);
 
-    Modes.stats_current.with_positions = 0;
-    Modes.stats_current.mlat_positions = 0;
-    Modes.stats_current.tisb_positions = 0;
+    if (close(b->fd) == 0 && !b->failed) {
+        snprintf(pathbuf, PATH_MAX, "%s/%s", Modes.output_dir, file);
+        pathbuf[PATH_MAX - 1] = 0;
+        rename(tmppath, pathbuf);
+    } else {
+        unlink(tmppath);
+    }
+}
 
-    for (j = 0; j < AIRCRAFTS_BUCKETS; j++) {
-        for (a = Modes.aircrafts[j]; a; a = a->next) {
-            if ((a->meta.messages < 2) || (now > (a->meta.seen + 90E3))) {
-                // Basic filter for bad decodes and
-                // don't include stale aircraft.
-                continue;
-            }
+static void writeProtoBufFile(struct pb_file_buffer *b, const char *file, const ProtobufCMessage *msg) {
+    writeOutputFile(b, file, msg, NULL, 0);
+}
 
-            if (msg.aircraft == NULL) {
-                msg.aircraft = malloc(sizeof (AircraftMeta*));
-            } else {
-                msg.aircraft = realloc(msg.aircraft, sizeof (AircraftMeta*) * (msg.n_aircraft + 1));
-            }
+// Pack the message into the HTTP snapshot if given, else write it to file
 
-            msg.aircraft[msg.n_aircraft] = &a->meta;
+static void writeProtoBuf(const char *file, struct http_snapshot *snap, const ProtobufCMessage *msg) {
+    if (snap)
+        httpSnapshotPack(snap, msg);
+    else
+        writeProtoBufFile(&pb_file_buffer, file, msg);
+}
 
-            if (trackDataValid(&a->callsign_valid)) {
-                msg.aircraft[msg.n_aircraft]->flight = a->callsign;
-            }
+// aircraft.pb from a snapshot: the main thread copies what the message needs
+// out of every aircraft, and the writer thread builds and packs the message
+// from that copy while tracking carries on. There are two snapshots, so one
+// can be filled while the other is being written.
+
+struct pb_aircraft_state {
+    AircraftMeta meta;
+    AircraftMeta__NavModes nav_modes;
+    AircraftMeta__ValidSource valid_source;
+    double signal; // sum of signalLevel[], the RSSI is worked out when packing
+    char callsign[sizeof (((struct aircraft *) 0)->callsign)];
+};
+
+struct pb_aircraft_snapshot {
+    struct pb_aircraft_state *states;
+    AircraftMeta **list; // msg.aircraft, pointing into states
+    size_t count;
+    size_t size;
+    uint64_t now;
+    uint64_t messages;
+};
+
+static struct pb_aircraft_snapshot pb_snapshots[2];
+static struct pb_aircraft_snapshot pb_snapshot_sync; // captured and packed on the main thread
+static pthread_t pb_writer_thread;
+static pthread_mutex_t pb_writer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pb_writer_cond = PTHREAD_COND_INITIALIZER;
+static bool pb_writer_running;
+static bool pb_writer_stop;
+static struct pb_aircraft_snapshot *pb_writer_pending; // captured, waiting for the writer
+static struct pb_aircraft_snapshot *pb_writer_busy; // being written by the writer
+
+static void pbSnapshotFree(struct pb_aircraft_snapshot *snap) {
+    free(snap->states);
+    free(snap->list);
+    memset(snap, 0, sizeof (*snap));
+}
 
-            if (trackDataValid(&a->nav_modes_valid)) {
-                msg.aircraft[msg.n_aircraft]->nav_modes = &a->nav_modes;
-            }
-            if (trackDataValid(&a->position_valid)) {
-                msg.aircraft[msg.n_aircraft]->seen_pos = (now - a->position_valid.updated) / 1000.0;
-                // Update position statistics.
-                Modes.stats_current.with_positions += 1;
-                if (a->position_valid.source == SOURCE_MLAT) {
-                    Modes.stats_current.mlat_positions += 1;
-                } else if (a->position_valid.source == SOURCE_TISB) {
-                    Modes.stats_current.tisb_positions += 1;
-                }
-            }
-            if (a->adsb_version >= 0) {
-                msg.aircraft[msg.n_aircraft]->version = a->adsb_version;
-            }
+static void pbSnapshotCleanup(void) {
+    pbSnapshotFree(&pb_snapshot_sync);
+    for (int i = 0; i < 2; ++i)
+        pbSnapshotFree(&pb_snapshots[i]);
+}
+
+// Whether an aircraft goes into aircraft.pb; a basic filter for bad decodes
+// that leaves out stale aircraft
+static inline bool pbAircraftListed(struct aircraft *a, uint64_t now) {
+    return a->meta.messages >= 2 && now <= a->meta.seen + 90E3;
+}
+
+// Copy the state of an aircraft for its AircraftMeta, doing the bookkeeping
+// that used to happen while building the message
+static void pbAircraftState(struct aircraft *a, uint64_t now, struct pb_aircraft_state *st) {
+    if (trackDataValid(&a->callsign_valid)) {
+        a->meta.flight = a->callsign;
+    }
+    if (trackDataValid(&a->nav_modes_valid)) {
+        a->meta.nav_modes = &a->nav_modes;
+    }
+    if (trackDataValid(&a->position_valid)) {
+        a->meta.seen_pos = (now - a->position_valid.updated) / 1000.0;
+    }
+    if (a->adsb_version >= 0) {
+        a->meta.version = a->adsb_version;
+    }
+
+    // The wind only changes with the data it is worked out from
+    if (a->wind_generation != a->generation || a->wind_heading_type != a->heading_type) {
+        compute_wind(a);
+        a->wind_generation = a->generation;
+        a->wind_heading_type = a->heading_type;
+    }
+
+    // Create valid source information
+    generateValidSourceMessage(a);
+    a->meta.valid_source = &a->valid_source;
 
-            compute_wind(a);
+    st->meta = a->meta;
+    st->nav_modes = a->nav_modes;
+    st->valid_source = a->valid_source;
+    memcpy(st->callsign, a->callsign, sizeof (st->callsign));
+    st->signal = a->signalLevel[0] + a->signalLevel[1] + a->signalLevel[2] + a->signalLevel[3] +
+            a->signalLevel[4] + a->signalLevel[5] + a->signalLevel[6] + a->signalLevel[7];
+}
+
+// Point the message of a copied state at the copies, and fill in the RSSI
+static void pbAircraftStateLink(struct pb_aircraft_state *st) {
+    if (st->meta.flight)
+        st->meta.flight = st->callsign;
+    if (st->meta.nav_modes)
+        st->meta.nav_modes = &st->nav_modes;
+    st->meta.valid_source = &st->valid_source;
+    st->meta.rssi = 10 * log10((st->signal + 1e-5) / 8);
+}
 
-            // Create valid source information
-            generateValidSourceMessage(a);
-            msg.aircraft[msg.n_aircraft]->valid_source = &a->valid_source;
+// Copy the state of every aircraft that goes into aircraft.pb
+static void pbCaptureAircraft(struct pb_aircraft_snapshot *snap) {
+    uint64_t now = mstime();
 
-            msg.aircraft[msg.n_aircraft]->rssi = 10 * log10((a->signalLevel[0] + a->signalLevel[1] + a->signalLevel[2] + a->signalLevel[3] +
-                    a->signalLevel[4] + a->signalLevel[5] + a->signalLevel[6] + a->signalLevel[7] + 1e-5) / 8);
-            msg.n_aircraft += 1;
+    if (snap->size < Modes.aircraft_count) {
+        size_t size = Modes.aircraft_count + Modes.aircraft_count / 2 + 16;
+        free(snap->states);
+        free(snap->list);
+        snap->states = malloc(size * sizeof (*snap->states));
+        snap->list = malloc(size * sizeof (*snap->list));
+        if (!snap->states || !snap->list) {
+            fprintf(stderr, "Out of memory allocating the aircraft snapshot\n");
+            exit(1);
         }
+        snap->size = size;
     }
-    // Pack and serialize entire aicraft collection.
-    ssize_t len = aircrafts_update__get_packed_size(&msg);
-    void *buf = malloc(len);
-    aircrafts_update__pack(&msg, buf);
-    // Write aircraft collection to file.
-    mask = umask(0);
-    umask(mask);
-    fchmod(fd, 0644 & ~mask);
 
-    if (write(fd, buf, len) != len) {
-        close(fd);
-    } else {
-        if (close(fd) == 0) {
-            snprintf(pathbuf, PATH_MAX, "%s/aircraft.pb", Modes.output_dir);
-            pathbuf[PATH_MAX - 1] = 0;
-            rename(tmppath, pathbuf);
-        } else {
-            unlink(tmppath);
+    snap->count = 0;
+    snap->now = now;
+    snap->messages = Modes.stats_current.messages_total + Modes.stats_alltime.messages_total;
+
+    Modes.stats_current.with_positions = 0;
+    Modes.stats_current.mlat_positions = 0;
+    Modes.stats_current.tisb_positions = 0;
+
+    for (size_t j = 0; j < Modes.aircraft_count; j++) {
+        struct aircraft_entry *e = &Modes.aircraft_table[j];
+        if ((e->messages < 2) || (now > (e->seen + 90E3))) {
+            // Basic filter for bad decodes and
+            // don't include stale aircraft.
+            continue;
+        }
+        struct aircraft *a = e->a;
+
+        if (trackDataValid(&a->position_valid)) {
+            // Update position statistics.
+            Modes.stats_current.with_positions += 1;
+            if (a->position_valid.source == SOURCE_MLAT) {
+                Modes.stats_current.mlat_positions += 1;
+            } else if (a->position_valid.source == SOURCE_TISB) {
+                Modes.stats_current.tisb_positions += 1;
+            }
+        }
+
+        pbAircraftState(a, now, &snap->states[snap->count++]);
+    }
+}
+
+// Build the message from a snapshot, pointing the copies at each other
+static void pbSnapshotMessage(struct pb_aircraft_snapshot *snap, AircraftsUpdate *msg) {
+    msg->aircraft = snap->list;
+    msg->n_aircraft = snap->count;
+    msg->now = (uint64_t) (snap->now / 1000);
+    msg->messages = snap->messages;
+
+    for (size_t j = 0; j < snap->count; j++) {
+        pbAircraftStateLink(&snap->states[j]);
+        snap->list[j] = &snap->states[j].meta;
+    }
+}
+
+static void *pbWriterEntryPoint(void *arg) {
+    MODES_NOTUSED(arg);
+
+    pthread_mutex_lock(&pb_writer_mutex);
+    while (!pb_writer_stop) {
+        if (!pb_writer_pending) {
+            pthread_cond_wait(&pb_writer_cond, &pb_writer_mutex);
+            continue;
         }
+        pb_writer_busy = pb_writer_pending;
+        pb_writer_pending = NULL;
+        pthread_mutex_unlock(&pb_writer_mutex);
+
+        AircraftsUpdate msg = AIRCRAFTS_UPDATE__INIT;
+        pbSnapshotMessage(pb_writer_busy, &msg);
+        writeProtoBufFile(&pb_writer_buffer, "aircraft.pb", &msg.base);
+
+        pthread_mutex_lock(&pb_writer_mutex);
+        pb_writer_busy = NULL;
     }
-    // Free up all allocated memory.
-    free(buf);
-    free(msg.aircraft);
+    pthread_mutex_unlock(&pb_writer_mutex);
+    return NULL;
 }
 
 /**
- * Generate aircraft metadata collection as protocol buffer file.
- * @param file File name for protocol buffer output.
+ * Start the thread that writes aircraft.pb, if there is an output directory.
+ * Without it the file is written on the main thread.
  */
-void generateHistoryProtoBuf(const char *file) {
-    char pathbuf[PATH_MAX];
-    char tmppath[PATH_MAX];
-    int fd;
-    mode_t mask;
+bool startAircraftWriter(void) {
+    if (!Modes.output_dir || pb_writer_running)
+        return true;
+
+    pbFileMode();
+    pb_writer_stop = false;
+    int rc = pthread_create(&pb_writer_thread, NULL, pbWriterEntryPoint, NULL);
+    if (rc) {
+        fprintf(stderr, "aircraft.pb writer: pthread_create failed: %s\n", strerror(rc));
+        return false;
+    }
+    thread_place(pb_writer_thread, THREAD_WRITER);
+    pb_writer_running = true;
+    return true;
+}
 
-    if (!Modes.output_dir) {
+/**
+ * Stop the aircraft.pb writer, writing out a snapshot it has not got to yet.
+ */
+void stopAircraftWriter(void) {
+    if (!pb_writer_running)
         return;
+
+    pthread_mutex_lock(&pb_writer_mutex);
+    pb_writer_stop = true;
+    pthread_cond_signal(&pb_writer_cond);
+    pthread_mutex_unlock(&pb_writer_mutex);
+    pthread_join(pb_writer_thread, NULL);
+    pb_writer_running = false;
+
+    if (pb_writer_pending) {
+        AircraftsUpdate msg = AIRCRAFTS_UPDATE__INIT;
+        pbSnapshotMessage(pb_writer_pending, &msg);
+        writeProtoBufFile(&pb_file_buffer, "aircraft.pb", &msg.base);
+        pb_writer_pending = NULL;
     }
+}
 
-    snprintf(tmppath, PATH_MAX, "%s/%s.XXXXXX", Modes.output_dir, file);
-    tmppath[PATH_MAX - 1] = 0;
-    fd = mkstemp(tmppath);
-    if (fd < 0) {
-        fprintf(stderr, "Creating history file failed.\n");
+/**
+ * Generate aircraft metadata collection as protocol buffer file,
+ * or into an HTTP snapshot.
+ */
+static void aircraftProtoBuf(struct http_snapshot *snap) {
+    if (!snap && !Modes.output_dir) {
+        return;
+    }
+
+    if (!snap && pb_writer_running) {
+        // Fill whichever snapshot the writer isn't using; a pending one it
+        // hasn't started on yet is simply replaced by this newer one.
+        pthread_mutex_lock(&pb_writer_mutex);
+        struct pb_aircraft_snapshot *fill = (pb_writer_busy == &pb_snapshots[0]) ? &pb_snapshots[1] : &pb_snapshots[0];
+        pb_writer_pending = NULL;
+        pthread_mutex_unlock(&pb_writer_mutex);
+
+        pbCaptureAircraft(fill);
+
+        pthread_mutex_lock(&pb_writer_mutex);
+        pb_writer_pending = fill;
+        pthread_cond_signal(&pb_writer_cond);
+        pthread_mutex_unlock(&pb_writer_mutex);
         return;
     }
 
-    uint64_t now = mstime();
-    struct aircraft *a;
-    size_t j;
     // The entire collection of tracked aircrafts.
     AircraftsUpdate msg = AIRCRAFTS_UPDATE__INIT;
 
-    msg.n_history = 0;
-    msg.now = (uint64_t) (now / 1000);
+    pbCaptureAircraft(&pb_snapshot_sync);
+    pbSnapshotMessage(&pb_snapshot_sync, &msg);
+    writeProtoBuf("aircraft.pb", snap, &msg.base);
+}
 
-    for (j = 0; j < AIRCRAFTS_BUCKETS; j++) {
-        for (a = Modes.aircrafts[j]; a; a = a->next) {
-            if ((a->meta.messages < 2) || (now > (a->meta.seen + 90E3))) {
-                // Basic filter for bad decodes and
-                // don't include stale aircraft.
-                continue;
+void generateAircraftProtoBuf(void) {
+    aircraftProtoBuf(NULL);
+}
+
+// Protocol buffers encoded by hand, for output protobuf-c can't produce
+// as cheaply: history.pb and the stream output. Fields go out in the wire
+// format of the types readsb.proto gives them.
+
+struct pb_bytes {
+    uint8_t *data;
+    size_t len;
+    size_t size;
+};
+
+static void pbReserve(struct pb_bytes *b, size_t len) {
+    if (b->len + len <= b->size)
+        return;
+
+    size_t size = b->size ? b->size * 2 : 65536;
+    while (size < b->len + len)
+        size *= 2;
+
+    uint8_t *data = realloc(b->data, size);
+    if (!data) {
+        fprintf(stderr, "Out of memory encoding a protocol buffer\n");
+        exit(1);
+    }
+    b->data = data;
+    b->size = size;
+}
+
+static inline uint64_t pbZigzag(int64_t v) {
+    return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+}
+
+static inline size_t pbVarintLen(uint64_t v) {
+    size_t len = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        len++;
+    }
+    return len;
+}
+
+static void pbVarint(struct pb_bytes *b, uint64_t v) {
+    pbReserve(b, 10);
+    while (v >= 0x80) {
+        b->data[b->len++] = (uint8_t) (v | 0x80);
+        v >>= 7;
+    }
+    b->data[b->len++] = (uint8_t) v;
+}
+
+// Append field number field, length delimited, with the content of from
+static void pbBytes(struct pb_bytes *b, unsigned field, const struct pb_bytes *from) {
+    pbVarint(b, field << 3 | 2);
+    pbVarint(b, from->len);
+    pbReserve(b, from->len);
+    memcpy(b->data + b->len, from->data, from->len);
+    b->len += from->len;
+}
+
+// Append a fixed32 or fixed64 value, len 4 or 8, least significant byte first
+static void pbFixed(struct pb_bytes *b, uint64_t v, int len) {
+    pbReserve(b, len);
+    for (int i = 0; i < len; ++i)
+        b->data[b->len++] = (uint8_t) (v >> (8 * i));
+}
+
+// Start a length delimited field whose length isn't known yet: its content
+// goes after room for the longest length, and pbEndField() moves it down
+static size_t pbBeginField(struct pb_bytes *b, unsigned field) {
+    size_t start = b->len;
+
+    pbVarint(b, field << 3 | 2);
+    pbReserve(b, 5);
+    b->len += 5;
+    return start;
+}
+
+// Finish the field begun at start, taking it out again if it is empty and
+// not keep_empty. Returns the length of its content.
+static size_t pbEndField(struct pb_bytes *b, size_t start, unsigned field, bool keep_empty) {
+    size_t from = start + pbVarintLen(field << 3 | 2) + 5;
+    size_t len = b->len - from;
+
+    if (!len && !keep_empty) {
+        b->len = start;
+        return 0;
+    }
+    b->len = from - 5;
+    pbVarint(b, len);
+    memmove(b->data + b->len, b->data + from, len);
+    b->len += len;
+    return len;
+}
+
+// Position history. Every HISTORY_INTERVAL the position of each aircraft goes
+// into a ring of the last HISTORY_SIZE samples, quantized as HistoryTrack
+// describes. history.pb is encoded from the ring by hand: grouping the
+// positions by aircraft and taking the differences between them leaves
+// little more than a run of small varints, with no message objects needed.
+
+#define HISTORY_ALT_GROUND (-400) // in 25 feet, see HistoryTrack
+
+struct history_point {
+    uint32_t addr;
+    int32_t lat; // 1e-5 degrees
+    int32_t lon; // 1e-5 degrees
+    int32_t alt; // 25 feet
+};
+
+struct history_sample {
+    uint64_t seq; // 1 for the first sample taken, 0 while unused
+    uint64_t time;
+    struct history_point *points;
+    uint32_t count;
+    uint32_t size;
+};
+
+struct history_ref {
+    const struct history_point *p;
+    uint32_t sample; // counted from the first sample encoded
+};
+
+static struct history_sample history_ring[HISTORY_SIZE];
+static uint64_t history_seq; // the newest sample
+static struct history_ref *history_refs;
+static size_t history_refs_size;
+static struct pb_bytes history_out;
+static struct pb_bytes history_field; // a packed field until its length is known
+
+static int historyRefCompare(const void *x, const void *y) {
+    const struct history_ref *a = x, *b = y;
+
+    if (a->p->addr != b->p->addr)
+        return a->p->addr < b->p->addr ? -1 : 1;
+    return (a->sample > b->sample) - (a->sample < b->sample);
+}
+
+// Encode the HistoryUpdate message with the samples taken after since into out
+static void historyEncode(struct pb_bytes *out, uint64_t since) {
+    uint64_t first = history_seq >= HISTORY_SIZE ? history_seq - HISTORY_SIZE + 1 : 1;
+    size_t n = 0, k = 0;
+    int64_t last_time = 0;
+
+    // A cursor from before a restart, or that has dropped out of the ring,
+    // gets everything there is
+    if (since >= first && since <= history_seq)
+        first = since + 1;
+    // samples restored after a restart may not fill the ring up to the first
+    while (first <= history_seq && history_ring[first % HISTORY_SIZE].seq != first)
+        first++;
+
+    out->len = 0;
+    pbVarint(out, 1 << 3 | 0);
+    pbVarint(out, mstime() / 1000);
+    if (history_seq) {
+        pbVarint(out, 2 << 3 | 0);
+        pbVarint(out, history_seq);
+    }
+
+    history_field.len = 0;
+    for (uint64_t seq = first; seq <= history_seq; ++seq) {
+        struct history_sample *sample = &history_ring[seq % HISTORY_SIZE];
+        int64_t time = sample->time / 1000;
+
+        pbVarint(&history_field, pbZigzag(time - last_time));
+        last_time = time;
+        n += sample->count;
+    }
+    if (history_field.len)
+        pbBytes(out, 3, &history_field);
+
+    if (n > history_refs_size) {
+        free(history_refs);
+        history_refs_size = n + n / 2;
+        if (!(history_refs = malloc(history_refs_size * sizeof (*history_refs)))) {
+            fprintf(stderr, "Out of memory encoding the aircraft history\n");
+            exit(1);
+        }
+    }
+    for (uint64_t seq = first; seq <= history_seq; ++seq) {
+        struct history_sample *sample = &history_ring[seq % HISTORY_SIZE];
+        for (uint32_t i = 0; i < sample->count; ++i) {
+            history_refs[k].p = &sample->points[i];
+            history_refs[k].sample = seq - first;
+            k++;
+        }
+    }
+    qsort(history_refs, n, sizeof (*history_refs), historyRefCompare);
+
+    for (size_t i = 0; i < n;) {
+        uint32_t addr = history_refs[i].p->addr;
+        struct history_point last = { 0, 0, 0, 0 };
+        uint32_t last_sample = 0;
+
+        history_field.len = 0;
+        for (; i < n && history_refs[i].p->addr == addr; ++i) {
+            const struct history_point *p = history_refs[i].p;
+
+            pbVarint(&history_field, pbZigzag((int64_t) history_refs[i].sample - last_sample));
+            pbVarint(&history_field, pbZigzag((int64_t) p->lat - last.lat));
+            pbVarint(&history_field, pbZigzag((int64_t) p->lon - last.lon));
+            pbVarint(&history_field, pbZigzag((int64_t) p->alt - last.alt));
+            last = *p;
+            last_sample = history_refs[i].sample;
+        }
+
+        pbVarint(out, 4 << 3 | 2);
+        pbVarint(out, 1 + pbVarintLen(addr) + 1 + pbVarintLen(history_field.len) + history_field.len);
+        pbVarint(out, 1 << 3 | 0);
+        pbVarint(out, addr);
+        pbBytes(out, 2, &history_field);
+    }
+}
+
+/**
+ * Add the positions of the aircraft to the history, and write history.pb.
+ * It is also served by HTTP, encoded when asked for.
+ */
+void generateHistoryProtoBuf(void) {
+    if (!modesNetHttpEnabled() && !Modes.output_dir) {
+        return;
+    }
+
+    uint64_t now = mstime();
+    struct history_sample *sample = &history_ring[(history_seq + 1) % HISTORY_SIZE];
+
+    if (sample->size < Modes.aircraft_count) {
+        uint32_t size = Modes.aircraft_count + Modes.aircraft_count / 2 + 16;
+        struct history_point *points = realloc(sample->points, size * sizeof (*points));
+        if (!points) {
+            fprintf(stderr, "Out of memory recording the aircraft history\n");
+            exit(1);
+        }
+        sample->points = points;
+        sample->size = size;
+    }
+    sample->count = 0;
+
+    for (size_t j = 0; j < Modes.aircraft_count; j++) {
+        struct aircraft_entry *e = &Modes.aircraft_table[j];
+        if ((e->messages < 2) || (now > (e->seen + 90E3))) {
+            // Basic filter for bad decodes and
+            // don't include stale aircraft.
+            continue;
+        }
+        struct aircraft *a = e->a;
+
+        // Record only aircrafts with position in history.
+        if (!trackDataValid(&a->position_valid)) {
+            continue;
+        }
+
+        struct history_point *p = &sample->points[sample->count++];
+        p->addr = a->meta.addr;
+        p->lat = (int32_t) lrint(a->meta.lat * 1e5);
+        p->lon = (int32_t) lrint(a->meta.lon * 1e5);
+
+        if (trackDataValid(&a->airground_valid) && a->airground_valid.source >= SOURCE_MODE_S_CHECKED && a->meta.air_ground == AIRCRAFT_META__AIR_GROUND__AG_GROUND)
+            p->alt = HISTORY_ALT_GROUND;
+        else if (trackDataValid(&a->altitude_baro_valid) && a->altitude_baro_reliable >= 3)
+            p->alt = (int32_t) lrint(a->meta.alt_baro / 25.0);
+        else if (trackDataValid(&a->altitude_geom_valid))
+            p->alt = (int32_t) lrint(a->meta.alt_geom / 25.0);
+        else
+            p->alt = 0;
+    }
+
+    sample->seq = ++history_seq;
+    sample->time = now;
+
+    if (Modes.output_dir) {
+        historyEncode(&history_out, 0);
+        writeOutputFile(&pb_file_buffer, "history.pb", NULL, history_out.data, history_out.len);
+    }
+}
+
+// Warm restart, see state.c: the samples in the ring, oldest first, each as
+// its seq, time and count followed by its points
+
+struct history_saved {
+    uint64_t seq;
+    uint64_t time;
+    uint32_t count;
+    uint32_t padding;
+};
+
+void modesNetHistorySave(FILE *f) {
+    uint64_t first = history_seq >= HISTORY_SIZE ? history_seq - HISTORY_SIZE + 1 : 1;
+
+    for (uint64_t seq = first; seq <= history_seq; ++seq) {
+        struct history_sample *sample = &history_ring[seq % HISTORY_SIZE];
+        struct history_saved saved = { sample->seq, sample->time, sample->count, 0 };
+
+        fwrite(&saved, sizeof (saved), 1, f);
+        fwrite(sample->points, sizeof (struct history_point), sample->count, f);
+    }
+}
+
+// Put the samples saved by modesNetHistorySave() taken since then back in
+// the ring, before any new ones are taken
+void modesNetHistoryRestore(const uint8_t *p, size_t len, uint64_t since) {
+    size_t off = 0;
+
+    while (off + sizeof (struct history_saved) <= len) {
+        struct history_saved saved;
+
+        memcpy(&saved, p + off, sizeof (saved));
+        off += sizeof (saved);
+        if (saved.count > (len - off) / sizeof (struct history_point))
+            break;
+        if (saved.time >= since && saved.seq > history_seq) {
+            struct history_sample *sample = &history_ring[saved.seq % HISTORY_SIZE];
+            struct history_point *points = realloc(sample->points, (saved.count + 16) * sizeof (*points));
+
+            if (!points) {
+                fprintf(stderr, "Out of memory restoring the aircraft history\n");
+                exit(1);
             }
+            memcpy(points, p + off, saved.count * sizeof (*points));
+            sample->points = points;
+            sample->size = saved.count + 16;
+            sample->count = saved.count;
+            sample->seq = history_seq = saved.seq;
+            sample->time = saved.time;
+        }
+        off += saved.count * sizeof (struct history_point);
+    }
+}
+
+static void historyCleanup(void) {
+    for (int i = 0; i < HISTORY_SIZE; ++i)
+        free(history_ring[i].points);
+    memset(history_ring, 0, sizeof (history_ring));
+    free(history_refs);
+    free(history_out.data);
+    free(history_field.data);
+    history_refs = NULL;
+    history_refs_size = 0;
+    memset(&history_out, 0, sizeof (history_out));
+    memset(&history_field, 0, sizeof (history_field));
+    history_seq = 0;
+}
+
+// Protocol buffer stream output (--net-pb-port). Clients get AircraftsUpdate
+// messages, each preceded by its length as a varint: the delimited format
+// protobuf libraries read with parseDelimitedFrom() and the like. The first
+// has every aircraft aircraft.pb would have. The ones after it have only the
+// aircraft that changed, each with its addr and the fields that differ from
+// what was sent before, even when they changed to zero, and in gone the
+// addresses of the aircraft that left the collection. Merged in field by
+// field they keep a copy of the collection up to date.
+//
+// A client that can't keep up has the updates it hasn't started on dropped
+// and gets a full one again: the updates only make sense in sequence.
+
+#define PB_STREAM_INTERVAL 250 // milliseconds between updates
+
+static struct net_service *pb_stream_service;
+static uint64_t pb_stream_cursor; // Modes.track_generation of the last update
+static struct pb_bytes pb_stream_update;
+static struct pb_bytes pb_stream_full;
+static struct pb_bytes pb_stream_gone; // the packed gone field
 
-            // Record only aircrafts with position in history.
-            if (!trackDataValid(&a->position_valid)) {
+// Append the fields of message cur, of type desc, that differ from those of
+// old, or with old NULL those that aren't zero like protobuf-c would pack
+// them. A submessage is compared field by field in turn, and left out when
+// nothing in it changed.
+
+static void pbEncodeChanges(struct pb_bytes *out, const ProtobufCMessageDescriptor *desc, const void *cur, const void *old) {
+    static const uint8_t zero[8];
+
+    for (unsigned i = 0; i < desc->n_fields; i++) {
+        const ProtobufCFieldDescriptor *f = &desc->fields[i];
+        const uint8_t *c = (const uint8_t *) cur + f->offset;
+        const uint8_t *o = old ? (const uint8_t *) old + f->offset : zero;
+        size_t size;
+
+        if (f->label == PROTOBUF_C_LABEL_REPEATED)
+            continue; // not in AircraftMeta
+
+        switch (f->type) {
+            case PROTOBUF_C_TYPE_STRING: {
+                const char *s = *(char * const *) c;
+                const char *os = old ? *(char * const *) o : NULL;
+                size_t len;
+
+                if (!strcmp(s ? s : "", os ? os : ""))
+                    continue;
+                len = s ? strlen(s) : 0;
+                pbVarint(out, f->id << 3 | 2);
+                pbVarint(out, len);
+                pbReserve(out, len);
+                memcpy(out->data + out->len, s, len);
+                out->len += len;
                 continue;
             }
-
-            if (msg.history == NULL) {
-                msg.history = malloc(sizeof (AircraftHistory*));
-            } else {
-                msg.history = realloc(msg.history, sizeof (AircraftHistory*) * (msg.n_history + 1));
+            case PROTOBUF_C_TYPE_MESSAGE: {
+                const void *m = *(void * const *) c;
+                const void *om = old ? *(void * const *) o : NULL;
+                size_t start;
+
+                if (!m)
+                    continue; // the AircraftMeta submessages stay once there
+                start = pbBeginField(out, f->id);
+                pbEncodeChanges(out, f->descriptor, m, om);
+                pbEndField(out, start, f->id, !om);
+                continue;
             }
+            case PROTOBUF_C_TYPE_BYTES:
+                continue; // not in AircraftMeta
+            case PROTOBUF_C_TYPE_BOOL:
+                size = sizeof (protobuf_c_boolean);
+                break;
+            case PROTOBUF_C_TYPE_INT64:
+            case PROTOBUF_C_TYPE_SINT64:
+            case PROTOBUF_C_TYPE_UINT64:
+            case PROTOBUF_C_TYPE_SFIXED64:
+            case PROTOBUF_C_TYPE_FIXED64:
+            case PROTOBUF_C_TYPE_DOUBLE:
+                size = 8;
+                break;
+            default:
+                size = 4;
+                break;
+        }
+        if (!memcmp(c, o, size))
+            continue;
 
-            msg.history[msg.n_history] = malloc(sizeof (AircraftHistory));
-            aircraft_history__init(msg.history[msg.n_history]);
-            msg.history[msg.n_history]->addr = a->meta.addr;
-            msg.history[msg.n_history]->lat = a->meta.lat;
-            msg.history[msg.n_history]->lon = a->meta.lon;
-
-            if (trackDataValid(&a->airground_valid) && a->airground_valid.source >= SOURCE_MODE_S_CHECKED && a->meta.air_ground == AIRCRAFT_META__AIR_GROUND__AG_GROUND)
-                msg.history[msg.n_history]->alt_baro = INVALID_ALTITUDE;
-            else {
-                if (trackDataValid(&a->altitude_baro_valid) && a->altitude_baro_reliable >= 3) {
-                    msg.history[msg.n_history]->alt_baro = a->meta.alt_baro;
-                } else if (trackDataValid(&a->altitude_geom_valid)) {
-                    msg.history[msg.n_history]->alt_baro = a->meta.alt_geom;
-                }
+        uint32_t v32 = 0;
+        uint64_t v64 = 0;
+        if (size == 8)
+            memcpy(&v64, c, 8);
+        else if (size == 4)
+            memcpy(&v32, c, 4);
+
+        switch (f->type) {
+            case PROTOBUF_C_TYPE_BOOL: {
+                protobuf_c_boolean b;
+                memcpy(&b, c, sizeof (b));
+                pbVarint(out, f->id << 3 | 0);
+                pbVarint(out, b ? 1 : 0);
+                break;
             }
+            case PROTOBUF_C_TYPE_INT32:
+            case PROTOBUF_C_TYPE_ENUM:
+                pbVarint(out, f->id << 3 | 0);
+                pbVarint(out, (uint64_t) (int64_t) (int32_t) v32);
+                break;
+            case PROTOBUF_C_TYPE_SINT32:
+                pbVarint(out, f->id << 3 | 0);
+                pbVarint(out, pbZigzag((int32_t) v32));
+                break;
+            case PROTOBUF_C_TYPE_UINT32:
+                pbVarint(out, f->id << 3 | 0);
+                pbVarint(out, v32);
+                break;
+            case PROTOBUF_C_TYPE_INT64:
+            case PROTOBUF_C_TYPE_UINT64:
+                pbVarint(out, f->id << 3 | 0);
+                pbVarint(out, v64);
+                break;
+            case PROTOBUF_C_TYPE_SINT64:
+                pbVarint(out, f->id << 3 | 0);
+                pbVarint(out, pbZigzag((int64_t) v64));
+                break;
+            case PROTOBUF_C_TYPE_SFIXED64:
+            case PROTOBUF_C_TYPE_FIXED64:
+            case PROTOBUF_C_TYPE_DOUBLE:
+                pbVarint(out, f->id << 3 | 1);
+                pbFixed(out, v64, 8);
+                break;
+            default: // 32 bit fixed and float
+                pbVarint(out, f->id << 3 | 5);
+                pbFixed(out, v32, 4);
+                break;
+        }
+    }
+}
+
+// Point the state last sent for an aircraft at its own copies
+static void pbStreamSentLink(struct aircraft *a) {
+    if (a->pb_sent.flight)
+        a->pb_sent.flight = a->pb_sent_callsign;
+    if (a->pb_sent.nav_modes)
+        a->pb_sent.nav_modes = &a->pb_sent_nav_modes;
+    if (a->pb_sent.valid_source)
+        a->pb_sent.valid_source = &a->pb_sent_valid_source;
+}
+
+// Start an update: now and messages, with room for its length in front
+static void pbStreamBegin(struct pb_bytes *out, uint64_t now) {
+    out->len = 0;
+    pbReserve(out, 5);
+    out->len = 5;
+    pbVarint(out, 1 << 3 | 0);
+    pbVarint(out, now / 1000);
+    pbVarint(out, 2 << 3 | 0);
+    pbVarint(out, Modes.stats_current.messages_total + Modes.stats_alltime.messages_total);
+}
+
+// Finish an update into a segment, holding a reference to it
+static struct net_segment *pbStreamSegment(struct pb_bytes *out) {
+    size_t end = out->len;
+    size_t len = end - 5;
+    size_t prefix = pbVarintLen(len);
+
+    out->len = 5 - prefix;
+    pbVarint(out, len);
+    out->len = end;
+    return segmentCreate(out->data + 5 - prefix, len + prefix);
+}
+
+// Queue an update for a client, with the network lock held. Returns true if
+// the I/O thread needs waking up for it.
 
-            msg.n_history += 1;
+static bool pbStreamQueue(struct client *c, struct net_segment *seg, uint64_t now, bool threaded) {
+    if (c->sendq_count && c->sendq_len + seg->len >= (MODES_NET_SNDBUF_SIZE << Modes.net_sndbuf_size)) {
+        if (Modes.net_sendq_policy == SENDQ_POLICY_DISCONNECT) {
+            fprintf(stderr, "%s: Dropped due to full SendQ: %s port %s (fd %d, SendQ %d, RecvQ %d)\n",
+                    c->service->descr, c->host, c->port,
+                    c->fd, c->sendq_len, c->buflen);
+            Modes.stats_current.net_sendq_disconnects++;
+            modesCloseClient(c);
+            return false;
         }
+        // Drop all that isn't partly written, the next update it gets is
+        // a full one
+        clientDropOldest(c, c->sendq_max);
+        c->pb_synced = false;
+        return false;
     }
-    // Pack and serialize entire aicraft collection.
-    ssize_t len = aircrafts_update__get_packed_size(&msg);
-    void *buf = malloc(len);
-    aircrafts_update__pack(&msg, buf);
-    // Write aircraft collection to file.
-    mask = umask(0);
-    umask(mask);
-    fchmod(fd, 0644 & ~mask);
 
-    if (write(fd, buf, len) != len) {
-        close(fd);
-    } else {
-        if (close(fd) == 0) {
-            snprintf(pathbuf, PATH_MAX, "%s/%s", Modes.output_dir, file);
-            pathbuf[PATH_MAX - 1] = 0;
-            rename(tmppath, pathbuf);
-        } else {
-            unlink(tmppath);
+    if (!c->sendq_count) {
+        // An empty SendQ has been flushed up to now
+        c->sendq_offset = 0;
+        c->last_flush = now;
+    }
+    clientQueue(c, seg);
+    return clientScheduleFlush(c, now, threaded);
+}
+
+static void writePbStream(void) {
+    static uint64_t next_update;
+    uint64_t now = mstime();
+    bool threaded = netThreadRunning();
+    bool wake = false;
+    bool full = false;
+    struct net_segment *seg = NULL;
+    struct aircraft *a;
+    struct client *c;
+
+    if (!pb_stream_service || !pb_stream_service->connections || now < next_update)
+        return;
+    next_update = now + PB_STREAM_INTERVAL;
+
+    // The changes since the last update, which bring the state sent for
+    // every aircraft up to date
+    pbStreamBegin(&pb_stream_update, now);
+    size_t empty = pb_stream_update.len;
+
+    for (a = Modes.aircraft_changed; a && a->generation > pb_stream_cursor; a = a->changed.next) {
+        struct pb_aircraft_state st;
+
+        if (!pbAircraftListed(a, now))
+            continue;
+        pbAircraftState(a, now, &st);
+        pbAircraftStateLink(&st);
+
+        size_t start = pbBeginField(&pb_stream_update, 15);
+        if (a->pb_streamed) {
+            pbStreamSentLink(a);
+            pbVarint(&pb_stream_update, 1 << 3 | 0); // addr, to say which aircraft
+            pbVarint(&pb_stream_update, st.meta.addr);
+        }
+        size_t fields = pb_stream_update.len;
+        pbEncodeChanges(&pb_stream_update, &aircraft_meta__descriptor, &st.meta, a->pb_streamed ? &a->pb_sent : NULL);
+        if (a->pb_streamed && pb_stream_update.len == fields)
+            pb_stream_update.len = start; // nothing it has changed
+        else
+            pbEndField(&pb_stream_update, start, 15, true);
+
+        a->pb_sent = st.meta;
+        a->pb_sent_nav_modes = st.nav_modes;
+        a->pb_sent_valid_source = st.valid_source;
+        memcpy(a->pb_sent_callsign, st.callsign, sizeof (a->pb_sent_callsign));
+        a->pb_streamed = true;
+    }
+    pb_stream_cursor = Modes.track_generation;
+
+    pb_stream_gone.len = 0;
+    for (size_t j = 0; j < Modes.aircraft_count; j++) {
+        a = Modes.aircraft_table[j].a;
+        if (a->pb_streamed && !pbAircraftListed(a, now)) {
+            pbVarint(&pb_stream_gone, a->meta.addr);
+            a->pb_streamed = false;
         }
     }
-    // Free up all allocated memory.
-    free(buf);
-    for (j = 0; j < msg.n_history; j++) {
-        free(msg.history[j]);
+    if (pb_stream_gone.len)
+        pbBytes(&pb_stream_update, 16, &pb_stream_gone);
+
+    netLock();
+    for (c = pb_stream_service->clients; c; c = c->next) {
+        if (!c->service)
+            continue;
+        if (!c->pb_synced) {
+            full = true;
+            continue;
+        }
+        if (pb_stream_update.len == empty)
+            continue;
+        if (!seg)
+            seg = pbStreamSegment(&pb_stream_update);
+        if (pbStreamQueue(c, seg, now, threaded))
+            wake = true;
+    }
+    if (seg)
+        segmentRelease(seg);
+    netUnlock();
+
+    if (full) {
+        // Every aircraft as sent, for the clients yet to get them
+        pbStreamBegin(&pb_stream_full, now);
+        for (size_t j = 0; j < Modes.aircraft_count; j++) {
+            a = Modes.aircraft_table[j].a;
+            if (!a->pb_streamed)
+                continue;
+            pbStreamSentLink(a);
+            size_t start = pbBeginField(&pb_stream_full, 15);
+            pbEncodeChanges(&pb_stream_full, &aircraft_meta__descriptor, &a->pb_sent, NULL);
+            pbEndField(&pb_stream_full, start, 15, true);
+        }
+        seg = pbStreamSegment(&pb_stream_full);
+
+        netLock();
+        for (c = pb_stream_service->clients; c; c = c->next) {
+            if (!c->service || c->pb_synced)
+                continue;
+            c->pb_synced = true;
+            if (pbStreamQueue(c, seg, now, threaded))
+                wake = true;
+        }
+        segmentRelease(seg);
+        netUnlock();
     }
-    free(msg.history);
+
+    if (wake)
+        netWakeIo();
+}
+
+static bool pbStreamHasClients(void) {
+    return serviceHasClients(pb_stream_service);
+}
+
+static void pbStreamInit(void) {
+    pb_stream_service = serviceInit("Protocol buffer stream output", NULL, NULL, READ_MODE_IGNORE, NULL, NULL);
+    serviceListen(pb_stream_service, Modes.net_bind_address, Modes.net_output_pb_ports);
+}
+
+static void pbStreamCleanup(void) {
+    free(pb_stream_update.data);
+    free(pb_stream_full.data);
+    free(pb_stream_gone.data);
+    memset(&pb_stream_update, 0, sizeof (pb_stream_update));
+    memset(&pb_stream_full, 0, sizeof (pb_stream_full));
+    memset(&pb_stream_gone, 0, sizeof (pb_stream_gone));
+    pb_stream_cursor = 0;
+    pb_stream_service = NULL;
 }
 
-static void createStatisticEntry(StatisticEntry *e, struct stats *st) {
+static Latency *createLatency(Latency *l, struct stats *st, latency_stage_t stage) {
+    uint32_t count = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+        count += st->latency[stage][i];
+    if (!count)
+        return NULL;
+
+    latency__init(l);
+    l->n_buckets = LATENCY_BUCKETS;
+    l->buckets = st->latency[stage];
+    l->p50 = latency_percentile(st, stage, 0.50);
+    l->p99 = latency_percentile(st, stage, 0.99);
+    l->max = st->latency_max[stage];
+    return l;
+}
+
+// latency holds the submessages, it has to live until the entry is packed
+static void createStatisticEntry(StatisticEntry *e, struct stats *st, Latency latency[LATENCY_STAGES]) {
     int i;
     e->start = st->start / 1000.0;
     e->stop = st->end / 1000.0;
@@ -2209,6 +4291,15 @@ static void createStatisticEntry(StatisticEntry *e, struct stats *st) {
         for (i = 0; i <= Modes.nfix_crc; ++i) {
             e->local_accepted += st->demod_accepted[i];
         }
+
+        // points into *st, which outlives the packed message
+        e->n_local_fifo_latency = FIFO_LATENCY_BUCKETS;
+        e->local_fifo_latency = st->fifo_latency;
+        e->n_local_fifo_depth = FIFO_DEPTH_BUCKETS;
+        e->local_fifo_depth = st->fifo_depth;
+        e->n_local_fill_latency = FIFO_LATENCY_BUCKETS;
+        e->local_fill_latency = st->fill_latency;
+        e->local_fifo_overruns = st->fifo_overruns;
     }
 
     if (Modes.net) {
@@ -2216,6 +4307,7 @@ static void createStatisticEntry(StatisticEntry *e, struct stats *st) {
         e->remote_modes = st->remote_received_modes;
         e->remote_bad = st->remote_rejected_bad;
         e->remote_unknown_icao = st->remote_rejected_unknown_icao;
+        e->remote_duplicates = st->remote_duplicates;
 
         for (i = 0; i <= Modes.nfix_crc; ++i) {
             e->remote_accepted += st->remote_accepted[i];
@@ -2248,27 +4340,22 @@ static void createStatisticEntry(StatisticEntry *e, struct stats *st) {
     e->messages = st->messages_total;
     e->max_distance_in_metres = st->longest_distance;
     e->max_distance_in_nautical_miles = st->longest_distance / 1852.0;
+
+    e->latency_receive = createLatency(&latency[LATENCY_RECEIVE], st, LATENCY_RECEIVE);
+    e->latency_decode = createLatency(&latency[LATENCY_DECODE], st, LATENCY_DECODE);
+    e->latency_buffer = createLatency(&latency[LATENCY_BUFFER], st, LATENCY_BUFFER);
+    e->latency_send = createLatency(&latency[LATENCY_SEND], st, LATENCY_SEND);
+    e->latency_total = createLatency(&latency[LATENCY_TOTAL], st, LATENCY_TOTAL);
 }
 
 /**
  * Generate statistics in protocol buffer format.
- * @param file File name.
+ * @param snap HTTP snapshot to generate, NULL for the file.
  */
-void generateStatsProtoBuf() {
-    char pathbuf[PATH_MAX];
-    char tmppath[PATH_MAX];
-    int fd, b;
-    mode_t mask;
-
-    if (!Modes.output_dir) {
-        return;
-    }
+static void statsProtoBuf(struct http_snapshot *snap) {
+    int b;
 
-    snprintf(tmppath, PATH_MAX, "%s/stats.pb.XXXXXX", Modes.output_dir);
-    tmppath[PATH_MAX - 1] = 0;
-    fd = mkstemp(tmppath);
-    if (fd < 0) {
-        fprintf(stderr, "Creating stats.pb failed.\n");
+    if (!snap && !Modes.output_dir) {
         return;
     }
 
@@ -2279,13 +4366,14 @@ void generateStatsProtoBuf() {
     StatisticEntry last_15min = STATISTIC_ENTRY__INIT;
     StatisticEntry total = STATISTIC_ENTRY__INIT;
     struct stats add;
+    Latency latency[5][LATENCY_STAGES];
 
-    createStatisticEntry(&latest, &Modes.stats_periodic);
-    createStatisticEntry(&last_1min, &Modes.stats_1min[Modes.stats_latest_1min]);
-    createStatisticEntry(&last_5min, &Modes.stats_5min);
-    createStatisticEntry(&last_15min, &Modes.stats_15min);
+    createStatisticEntry(&latest, &Modes.stats_periodic, latency[0]);
+    createStatisticEntry(&last_1min, &Modes.stats_1min.sum, latency[1]);
+    createStatisticEntry(&last_5min, &Modes.stats_5min.sum, latency[2]);
+    createStatisticEntry(&last_15min, &Modes.stats_15min.sum, latency[3]);
     add_stats(&Modes.stats_alltime, &Modes.stats_current, &add);
-    createStatisticEntry(&total, &add);
+    createStatisticEntry(&total, &add, latency[4]);
 
     stats.latest = &latest;
     stats.last_1min = &last_1min;
@@ -2305,28 +4393,9 @@ void generateStatsProtoBuf() {
         stats.n_polar_range = POLAR_RANGE_BUCKETS;
     }
 
-    // Pack and serialize entire aicraft collection.
-    ssize_t len = statistics__get_packed_size(&stats);
-    void *buf = malloc(len);
-    statistics__pack(&stats, buf);
-    // Write aircraft collection to file.
-    mask = umask(0);
-    umask(mask);
-    fchmod(fd, 0644 & ~mask);
+    writeProtoBuf("stats.pb", snap, &stats.base);
 
-    if (write(fd, buf, len) != len) {
-        close(fd);
-    } else {
-        if (close(fd) == 0) {
-            snprintf(pathbuf, PATH_MAX, "%s/stats.pb", Modes.output_dir);
-            pathbuf[PATH_MAX - 1] = 0;
-            rename(tmppath, pathbuf);
-        } else {
-            unlink(tmppath);
-        }
-    }
     // Free up all allocated memory.
-    free(buf);
     if (Modes.stats_polar_range) {
         for (b = 0; b < POLAR_RANGE_BUCKETS; b++) {
             free(stats.polar_range[b]);
@@ -2335,28 +4404,20 @@ void generateStatsProtoBuf() {
     }
 }
 
+void generateStatsProtoBuf() {
+    statsProtoBuf(NULL);
+}
+
 /**
  * Generate receiver description in protocol buffer format.
- * @param file File name.
+ * @param snap HTTP snapshot to generate, NULL for the file.
  */
-void generateReceiverProtoBuf() {
-    char pathbuf[PATH_MAX];
-    char tmppath[PATH_MAX];
-    int fd;
-    mode_t mask;
+static void receiverProtoBuf(struct http_snapshot *snap) {
     // Backup precise position
     double preclat = Modes.receiver.latitude;
     double preclon = Modes.receiver.longitude;
 
-    if (!Modes.output_dir) {
-        return;
-    }
-
-    snprintf(tmppath, PATH_MAX, "%s/receiver.pb.XXXXXX", Modes.output_dir);
-    tmppath[PATH_MAX - 1] = 0;
-    fd = mkstemp(tmppath);
-    if (fd < 0) {
-        fprintf(stderr, "Creating receiver.pb failed.\n");
+    if (!snap && !Modes.output_dir) {
         return;
     }
 
@@ -2373,28 +4434,7 @@ void generateReceiverProtoBuf() {
         }
     }
 
-    // Pack and serialize entire aicraft collection.
-    ssize_t len = receiver__get_packed_size(&Modes.receiver);
-    void *buf = malloc(len);
-    receiver__pack(&Modes.receiver, buf);
-    // Write aircraft collection to file.
-    mask = umask(0);
-    umask(mask);
-    fchmod(fd, 0644 & ~mask);
-
-    if (write(fd, buf, len) != len) {
-        close(fd);
-    } else {
-        if (close(fd) == 0) {
-            snprintf(pathbuf, PATH_MAX, "%s/receiver.pb", Modes.output_dir);
-            pathbuf[PATH_MAX - 1] = 0;
-            rename(tmppath, pathbuf);
-        } else {
-            unlink(tmppath);
-        }
-    }
-    // Free up all allocated memory.
-    free(buf);
+    writeProtoBuf("receiver.pb", snap, &Modes.receiver.base);
 
     // Restore precise position.
     if (Modes.rx_location_accuracy == 1) {
@@ -2403,6 +4443,616 @@ void generateReceiverProtoBuf() {
     }
 }
 
+void generateReceiverProtoBuf() {
+    receiverProtoBuf(NULL);
+}
+
+//
+// Metrics
+//
+// /metrics on the --net-http-port lists the statistics in the Prometheus text
+// format, or in OpenMetrics for scrapers that ask for it. The counters count
+// from the start, the other threads' statistics included, and are only
+// added up when scraped.
+//
+
+struct metrics {
+    struct pb_bytes out; // the text, reused between scrapes
+    bool openmetrics; // OpenMetrics rather than the Prometheus text format
+};
+
+static struct metrics metrics;
+
+__attribute__ ((format(printf, 2, 3))) static void metricsPrintf(struct metrics *m, const char *format, ...) {
+    va_list ap;
+    int len;
+
+    va_start(ap, format);
+    len = vsnprintf(NULL, 0, format, ap);
+    va_end(ap);
+
+    pbReserve(&m->out, len + 1);
+    va_start(ap, format);
+    vsnprintf((char *) m->out.data + m->out.len, len + 1, format, ap);
+    va_end(ap);
+    m->out.len += len;
+}
+
+// The HELP and TYPE lines of a metric. The Prometheus text format names a
+// counter by its samples, with _total, OpenMetrics without it.
+
+static void metricsFamily(struct metrics *m, const char *name, const char *type, const char *help) {
+    const char *suffix = (!m->openmetrics && !strcmp(type, "counter")) ? "_total" : "";
+
+    metricsPrintf(m, "# HELP %s%s %s\n# TYPE %s%s %s\n", name, suffix, help, name, suffix, type);
+}
+
+static void metricsCounter(struct metrics *m, const char *name, const char *help, uint64_t value) {
+    metricsFamily(m, name, "counter", help);
+    metricsPrintf(m, "%s_total %" PRIu64 "\n", name, value);
+}
+
+static void metricsGauge(struct metrics *m, const char *name, const char *help, double value) {
+    metricsFamily(m, name, "gauge", help);
+    metricsPrintf(m, "%s %.17g\n", name, value);
+}
+
+// A label value, with backslashes, quotes and newlines escaped
+
+static const char *metricsLabel(const char *value) {
+    static char buf[2 * NI_MAXHOST + 1];
+    char *p = buf;
+
+    for (; *value && p < buf + sizeof (buf) - 2; value++) {
+        if (*value == '\\' || *value == '"') {
+            *p++ = '\\';
+            *p++ = *value;
+        } else if (*value == '\n') {
+            *p++ = '\\';
+            *p++ = 'n';
+        } else {
+            *p++ = *value;
+        }
+    }
+    *p = '\0';
+    return buf;
+}
+
+static double timespecSeconds(const struct timespec *ts) {
+    return ts->tv_sec + ts->tv_nsec / 1e9;
+}
+
+static void metricsStats(struct metrics *m, const struct stats *st) {
+    static const char *stages[LATENCY_STAGES] = {"receive", "decode", "buffer", "send", "total"};
+    int i;
+
+    if (!Modes.net_only) {
+        metricsCounter(m, "readsb_samples_processed", "Samples demodulated", st->samples_processed);
+        metricsCounter(m, "readsb_samples_dropped", "Samples dropped before they were demodulated", st->samples_dropped);
+        metricsCounter(m, "readsb_samples_gated", "Samples not searched for preambles, below the --demod-gate", st->samples_gated);
+        metricsCounter(m, "readsb_fifo_overruns", "Times samples were dropped as the sample FIFO was full", st->fifo_overruns);
+        metricsCounter(m, "readsb_demod_preambles", "Mode S preambles seen by the demodulator", st->demod_preambles);
+        metricsCounter(m, "readsb_demod_rejected_bad", "Demodulated Mode S messages with a bad CRC", st->demod_rejected_bad);
+        metricsCounter(m, "readsb_demod_rejected_unknown_icao", "Demodulated Mode S messages from an unknown address", st->demod_rejected_unknown_icao);
+        metricsFamily(m, "readsb_demod_accepted", "counter", "Demodulated Mode S messages accepted, by bit errors corrected");
+        for (i = 0; i <= Modes.nfix_crc; ++i)
+            metricsPrintf(m, "readsb_demod_accepted_total{corrected_bits=\"%d\"} %u\n", i, st->demod_accepted[i]);
+        metricsCounter(m, "readsb_demod_modeac", "Demodulated Mode A/C replies", st->demod_modeac);
+        metricsCounter(m, "readsb_strong_signals", "Messages received above -3 dBFS", st->strong_signal_count);
+    }
+
+    if (Modes.net) {
+        metricsCounter(m, "readsb_remote_received_modes", "Mode S messages received from the network", st->remote_received_modes);
+        metricsCounter(m, "readsb_remote_received_modeac", "Mode A/C replies received from the network", st->remote_received_modeac);
+        metricsCounter(m, "readsb_remote_rejected_bad", "Mode S messages from the network with a bad CRC", st->remote_rejected_bad);
+        metricsCounter(m, "readsb_remote_rejected_unknown_icao", "Mode S messages from the network from an unknown address", st->remote_rejected_unknown_icao);
+        metricsFamily(m, "readsb_remote_accepted", "counter", "Mode S messages from the network accepted, by bit errors corrected");
+        for (i = 0; i <= Modes.nfix_crc; ++i)
+            metricsPrintf(m, "readsb_remote_accepted_total{corrected_bits=\"%d\"} %u\n", i, st->remote_accepted[i]);
+        metricsCounter(m, "readsb_remote_duplicates", "Copies of network messages dropped by --net-dedup-window", st->remote_duplicates);
+        metricsCounter(m, "readsb_remote_udp_lost", "Beast UDP datagrams missing from the sequence", st->remote_udp_lost);
+        metricsCounter(m, "readsb_net_sendq_disconnects", "Clients dropped with a full SendQ", st->net_sendq_disconnects);
+        metricsCounter(m, "readsb_net_sendq_dropped_bytes", "Output bytes the SendQ policy dropped", st->net_sendq_dropped);
+        metricsCounter(m, "readsb_net_beast_reduce_dropped", "BeastReduce messages held back by --net-beast-reduce-budget", st->net_reduce_dropped);
+        metricsCounter(m, "readsb_net_udp_dropped", "Beast UDP output datagrams that could not be sent", st->net_udp_dropped);
+    }
+
+    metricsCounter(m, "readsb_messages", "Messages used", st->messages_total);
+    metricsCounter(m, "readsb_altitude_suppressed", "Altitude messages ignored for a recent DF17/18 altitude", st->suppressed_altitude_messages);
+    metricsCounter(m, "readsb_tracks_new", "New aircraft tracks", st->unique_aircraft);
+    metricsCounter(m, "readsb_tracks_single_message", "Aircraft tracks of a single message", st->single_message_aircraft);
+
+    metricsFamily(m, "readsb_cpr", "counter", "CPR positions decoded, by encoding");
+    metricsPrintf(m, "readsb_cpr_total{encoding=\"airborne\"} %u\n", st->cpr_airborne);
+    metricsPrintf(m, "readsb_cpr_total{encoding=\"surface\"} %u\n", st->cpr_surface);
+    metricsFamily(m, "readsb_cpr_global", "counter", "Global CPR decodes, by result");
+    metricsPrintf(m, "readsb_cpr_global_total{result=\"ok\"} %u\n", st->cpr_global_ok);
+    metricsPrintf(m, "readsb_cpr_global_total{result=\"bad\"} %u\n", st->cpr_global_bad);
+    metricsPrintf(m, "readsb_cpr_global_total{result=\"skipped\"} %u\n", st->cpr_global_skipped);
+    metricsPrintf(m, "readsb_cpr_global_total{result=\"range\"} %u\n", st->cpr_global_range_checks);
+    metricsPrintf(m, "readsb_cpr_global_total{result=\"speed\"} %u\n", st->cpr_global_speed_checks);
+    metricsFamily(m, "readsb_cpr_local", "counter", "Local CPR decodes, by result");
+    metricsPrintf(m, "readsb_cpr_local_total{result=\"aircraft_relative\"} %u\n", st->cpr_local_aircraft_relative);
+    metricsPrintf(m, "readsb_cpr_local_total{result=\"receiver_relative\"} %u\n", st->cpr_local_receiver_relative);
+    metricsPrintf(m, "readsb_cpr_local_total{result=\"skipped\"} %u\n", st->cpr_local_skipped);
+    metricsPrintf(m, "readsb_cpr_local_total{result=\"range\"} %u\n", st->cpr_local_range_checks);
+    metricsPrintf(m, "readsb_cpr_local_total{result=\"speed\"} %u\n", st->cpr_local_speed_checks);
+    metricsCounter(m, "readsb_cpr_filtered", "CPR positions filtered out", st->cpr_filtered);
+
+    metricsCounter(m, "readsb_icao_filter_inserts", "Addresses stored in the ICAO filter", st->icao_filter_inserts);
+    metricsCounter(m, "readsb_icao_filter_probes", "ICAO filter buckets probed to store them", st->icao_filter_probes);
+
+    metricsFamily(m, "readsb_cpu_seconds", "counter", "CPU time used, by thread");
+    metricsPrintf(m, "readsb_cpu_seconds_total{thread=\"demod\"} %.3f\n", timespecSeconds(&st->demod_cpu));
+    metricsPrintf(m, "readsb_cpu_seconds_total{thread=\"reader\"} %.3f\n", timespecSeconds(&st->reader_cpu));
+    metricsPrintf(m, "readsb_cpu_seconds_total{thread=\"background\"} %.3f\n", timespecSeconds(&st->background_cpu));
+
+    metricsFamily(m, "readsb_latency_seconds", "histogram", "Time messages spend in each stage, for output per buffer");
+    for (int s = 0; s < LATENCY_STAGES; ++s) {
+        uint64_t count = 0;
+        for (i = 0; i < LATENCY_BUCKETS - 1; ++i) {
+            count += st->latency[s][i];
+            metricsPrintf(m, "readsb_latency_seconds_bucket{stage=\"%s\",le=\"%g\"} %" PRIu64 "\n",
+                    stages[s], (LATENCY_BASE_US << i) / 1e6, count);
+        }
+        count += st->latency[s][i];
+        metricsPrintf(m, "readsb_latency_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %" PRIu64 "\n", stages[s], count);
+        metricsPrintf(m, "readsb_latency_seconds_sum{stage=\"%s\"} %g\n", stages[s], st->latency_sum[s] / 1e6);
+        metricsPrintf(m, "readsb_latency_seconds_count{stage=\"%s\"} %" PRIu64 "\n", stages[s], count);
+    }
+}
+
+// The signal levels and ranges of the last minute, and what is tracked now
+
+static void metricsGauges(struct metrics *m) {
+    const struct stats *st = &Modes.stats_1min.sum;
+
+    if (!Modes.net_only) {
+        if (st->signal_power_sum > 0 && st->signal_power_count > 0)
+            metricsGauge(m, "readsb_signal_dbfs", "Mean signal power of the last minute", 10 * log10(st->signal_power_sum / st->signal_power_count));
+        if (st->noise_power_sum > 0 && st->noise_power_count > 0)
+            metricsGauge(m, "readsb_noise_dbfs", "Mean noise power of the last minute", 10 * log10(st->noise_power_sum / st->noise_power_count));
+        if (st->peak_signal_power > 0)
+            metricsGauge(m, "readsb_peak_signal_dbfs", "Peak signal power of the last minute", 10 * log10(st->peak_signal_power));
+    }
+    metricsGauge(m, "readsb_max_distance_metres", "Longest range decoded in the last minute", st->longest_distance);
+
+    if (Modes.stats_polar_range) {
+        metricsFamily(m, "readsb_polar_range_metres", "gauge", "Longest range decoded, by bearing");
+        for (int b = 0; b < POLAR_RANGE_BUCKETS; b++)
+            metricsPrintf(m, "readsb_polar_range_metres{bearing=\"%d\"} %u\n", b * POLAR_RANGE_RESOLUTION, Modes.stats_range.polar_range[b]);
+    }
+
+    st = &Modes.stats_current;
+    metricsGauge(m, "readsb_tracks_with_position", "Aircraft with positions", st->with_positions);
+    metricsGauge(m, "readsb_tracks_mlat_position", "Aircraft with mlat positions", st->mlat_positions);
+    metricsGauge(m, "readsb_tracks_tisb_position", "Aircraft with TIS-B positions", st->tisb_positions);
+    metricsGauge(m, "readsb_aircraft_pool_size", "Aircraft records allocated", st->aircraft_pool_size);
+}
+
+// The clients of each service and the connectors
+
+static void metricsNetwork(struct metrics *m) {
+    struct net_service *s;
+    struct client *c;
+
+    metricsFamily(m, "readsb_client_received_bytes", "counter", "Bytes read from a client, inflated");
+    for (s = Modes.services; s; s = s->next) {
+        for (c = s->clients; c; c = c->next) {
+            if (!c->service)
+                continue;
+            metricsPrintf(m, "readsb_client_received_bytes_total{service=\"%s\",", metricsLabel(s->descr));
+            metricsPrintf(m, "host=\"%s\",port=\"%s\"} %" PRIu64 "\n", metricsLabel(c->host), c->port, c->bytes_received);
+        }
+    }
+
+    // The I/O thread writes the SendQs
+    netLock();
+    metricsFamily(m, "readsb_client_sent_bytes", "counter", "Bytes written to a client");
+    for (s = Modes.services; s; s = s->next) {
+        for (c = s->clients; c; c = c->next) {
+            if (!c->service)
+                continue;
+            metricsPrintf(m, "readsb_client_sent_bytes_total{service=\"%s\",", metricsLabel(s->descr));
+            metricsPrintf(m, "host=\"%s\",port=\"%s\"} %" PRIu64 "\n", metricsLabel(c->host), c->port, c->bytes_sent);
+        }
+    }
+    metricsFamily(m, "readsb_client_sendq_bytes", "gauge", "Bytes queued for a client");
+    for (s = Modes.services; s; s = s->next) {
+        for (c = s->clients; c; c = c->next) {
+            if (!c->service || !s->writer)
+                continue;
+            metricsPrintf(m, "readsb_client_sendq_bytes{service=\"%s\",", metricsLabel(s->descr));
+            metricsPrintf(m, "host=\"%s\",port=\"%s\"} %d\n", metricsLabel(c->host), c->port, c->sendq_len);
+        }
+    }
+    metricsFamily(m, "readsb_client_sendq_dropped_bytes", "counter", "Bytes the SendQ policy dropped for a client");
+    for (s = Modes.services; s; s = s->next) {
+        for (c = s->clients; c; c = c->next) {
+            if (!c->service || !s->writer)
+                continue;
+            metricsPrintf(m, "readsb_client_sendq_dropped_bytes_total{service=\"%s\",", metricsLabel(s->descr));
+            metricsPrintf(m, "host=\"%s\",port=\"%s\"} %" PRIu64 "\n", metricsLabel(c->host), c->port, c->sendq_dropped);
+        }
+    }
+    netUnlock();
+
+    if (!Modes.net_connectors_count)
+        return;
+
+    metricsFamily(m, "readsb_connector_up", "gauge", "Whether a --net-connector is connected");
+    for (int i = 0; i < Modes.net_connectors_count; i++) {
+        struct net_connector *con = Modes.net_connectors[i];
+        metricsPrintf(m, "readsb_connector_up{address=\"%s\",", metricsLabel(con->address));
+        metricsPrintf(m, "port=\"%s\",protocol=\"%s\"} %d\n", metricsLabel(con->port), con->protocol, con->connected ? 1 : 0);
+    }
+    metricsFamily(m, "readsb_connector_connects", "counter", "Connections a --net-connector established");
+    for (int i = 0; i < Modes.net_connectors_count; i++) {
+        struct net_connector *con = Modes.net_connectors[i];
+        metricsPrintf(m, "readsb_connector_connects_total{address=\"%s\",", metricsLabel(con->address));
+        metricsPrintf(m, "port=\"%s\",protocol=\"%s\"} %u\n", metricsLabel(con->port), con->protocol, con->connects);
+    }
+    metricsFamily(m, "readsb_connector_failures", "gauge", "Connection rounds a --net-connector failed in a row");
+    for (int i = 0; i < Modes.net_connectors_count; i++) {
+        struct net_connector *con = Modes.net_connectors[i];
+        metricsPrintf(m, "readsb_connector_failures{address=\"%s\",", metricsLabel(con->address));
+        metricsPrintf(m, "port=\"%s\",protocol=\"%s\"} %u\n", metricsLabel(con->port), con->protocol, con->failures);
+    }
+}
+
+// Write the metrics to metrics.out
+
+static void metricsWrite(bool openmetrics) {
+    struct stats total;
+
+    metrics.out.len = 0;
+    metrics.openmetrics = openmetrics;
+
+    add_stats(&Modes.stats_alltime, &Modes.stats_current, &total);
+    netLock();
+    add_stats(&total, &net_io_stats.st, &total);
+    netUnlock();
+
+    metricsStats(&metrics, &total);
+    metricsGauges(&metrics);
+    metricsNetwork(&metrics);
+    if (openmetrics)
+        metricsPrintf(&metrics, "# EOF\n");
+}
+
+//
+// HTTP protocol buffer snapshots
+//
+// --net-http-port serves aircraft.pb, history.pb, stats.pb and receiver.pb
+// from memory, under any directory. aircraft.pb, stats.pb and receiver.pb
+// are only generated when asked for, at most once per output_interval, and
+// history.pb when asked for after a sample was added; history.pb?since=<n>
+// is encoded for each request, like metrics (see metricsWrite()). A snapshot is a segment the SendQs of all clients share, its ETag changes
+// only when its content does, and it is compressed for gzip clients once.
+//
+
+struct http_snapshot {
+    struct net_segment *body; // the packed message, NULL until there is one
+    struct net_segment *gzip; // body gzip'ed, NULL if not (yet)
+    bool gzip_done; // gzip has been tried
+    uint64_t etag;
+    uint64_t expires; // when to generate it again when asked for
+};
+
+static struct net_service *http_service;
+static struct http_snapshot http_aircraft;
+static struct http_snapshot http_stats;
+static struct http_snapshot http_receiver;
+static struct http_snapshot http_history;
+static uint64_t http_history_seq; // newest sample in http_history
+static uint64_t http_etag_base; // start time, so ETags differ between runs
+static uint64_t http_etag_next;
+
+bool modesNetHttpEnabled(void) {
+    return http_service && http_service->listener_count > 0;
+}
+
+static void httpSnapshotRelease(struct http_snapshot *snap) {
+    if (snap->body)
+        segmentRelease(snap->body);
+    if (snap->gzip)
+        segmentRelease(snap->gzip);
+    snap->body = snap->gzip = NULL;
+    snap->gzip_done = false;
+}
+
+// Make seg the snapshot, keeping the ETag if the content is unchanged
+
+static void httpSnapshotSet(struct http_snapshot *snap, struct net_segment *seg) {
+    netLock();
+    if (snap->body && snap->body->len == seg->len && !memcmp(snap->body->data, seg->data, seg->len)) {
+        free(seg);
+    } else {
+        httpSnapshotRelease(snap);
+        snap->body = seg;
+        snap->etag = ++http_etag_next;
+    }
+    netUnlock();
+}
+
+static void httpSnapshotPack(struct http_snapshot *snap, const ProtobufCMessage *msg) {
+    size_t len = protobuf_c_message_get_packed_size(msg);
+    struct net_segment *seg;
+
+    if (len > INT_MAX || !(seg = malloc(sizeof (*seg) + len))) {
+        fprintf(stderr, "Out of memory allocating an HTTP snapshot\n");
+        exit(1);
+    }
+    seg->len = protobuf_c_message_pack(msg, (uint8_t *) seg->data);
+    seg->refs = 1;
+    seg->queued = seg->received = 0;
+    httpSnapshotSet(snap, seg);
+}
+
+// The history since the given sample, 0 for all of it
+static void httpSnapshotHistory(struct http_snapshot *snap, uint64_t since) {
+    historyEncode(&history_out, since);
+    if (history_out.len > INT_MAX) {
+        fprintf(stderr, "Out of memory allocating an HTTP snapshot\n");
+        exit(1);
+    }
+    httpSnapshotSet(snap, segmentCreate(history_out.data, history_out.len));
+}
+
+// Compress the snapshot for gzip clients, if that makes it smaller
+
+static void httpSnapshotGzip(struct http_snapshot *snap) {
+    z_stream z;
+    struct net_segment *seg;
+
+    snap->gzip_done = true;
+    memset(&z, 0, sizeof (z));
+    if (deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return;
+
+    uLong bound = deflateBound(&z, snap->body->len);
+    if (!(seg = malloc(sizeof (*seg) + bound))) {
+        fprintf(stderr, "Out of memory compressing an HTTP snapshot\n");
+        exit(1);
+    }
+
+    z.next_in = (Bytef *) snap->body->data;
+    z.avail_in = snap->body->len;
+    z.next_out = (Bytef *) seg->data;
+    z.avail_out = bound;
+    if (deflate(&z, Z_FINISH) == Z_STREAM_END && z.total_out < (uLong) snap->body->len) {
+        seg->len = z.total_out;
+        seg->refs = 1;
+        seg->queued = seg->received = 0;
+        netLock();
+        snap->gzip = seg;
+        netUnlock();
+    } else {
+        free(seg);
+    }
+    deflateEnd(&z);
+}
+
+// A request header, NULL if not there. Header names are case insensitive.
+
+static const char *httpHeader(char *headers, const char *name) {
+    size_t len = strlen(name);
+
+    for (char *line = headers; line && *line; line = strchr(line, '\n') ? strchr(line, '\n') + 1 : NULL) {
+        if (!strncasecmp(line, name, len) && line[len] == ':') {
+            const char *value = line + len + 1;
+            while (*value == ' ' || *value == '\t')
+                value++;
+            return value;
+        }
+    }
+    return NULL;
+}
+
+// Does the header value, up to the end of its line, contain token?
+
+static bool httpHeaderHas(const char *value, const char *token) {
+    size_t len = strlen(token);
+
+    for (; value && *value && *value != '\r' && *value != '\n'; value++) {
+        if (!strncasecmp(value, token, len))
+            return true;
+    }
+    return false;
+}
+
+// Queue a response for the client: the head, then body unless NULL.
+// Returns nonzero, to close the client, if it isn't reading its responses.
+
+static int httpRespond(struct client *c, const char *head, int head_len, struct net_segment *body, bool close) {
+    uint64_t now = mstime();
+    bool threaded = netThreadRunning();
+    struct net_segment *seg;
+
+    netLock();
+    if (c->sendq_len > (MODES_NET_SNDBUF_SIZE << Modes.net_sndbuf_size)) {
+        netUnlock();
+        return 1;
+    }
+
+    seg = segmentCreate(head, head_len);
+    if (c->service && !c->io_failed) {
+        if (!c->sendq_count) {
+            // An empty SendQ has been flushed up to now
+            c->sendq_offset = 0;
+            c->last_flush = now;
+        }
+        clientQueue(c, seg);
+        if (body && body->len)
+            clientQueue(c, body);
+        c->close_when_sent = close;
+        if (clientScheduleFlush(c, now, threaded))
+            netWakeIo();
+    }
+    segmentRelease(seg);
+    netUnlock();
+    return 0;
+}
+
+static int httpError(struct client *c, const char *status) {
+    char head[256];
+    int len = snprintf(head, sizeof (head),
+            "HTTP/1.1 %s\r\n"
+            "Content-Type: text/plain\r\n"
+            "Content-Length: %zu\r\n"
+            "Connection: close\r\n"
+            "\r\n"
+            "%s\n", status, strlen(status) + 1, status);
+
+    return httpRespond(c, head, len, NULL, true);
+}
+
+// The handler of the HTTP service, request is the request line and headers
+
+static int handleHttpRequest(struct client *c, char *request, int remote) {
+    char method[8], target[128], version[16];
+    struct http_snapshot *snap = NULL;
+    struct http_snapshot once_snap; // generated for this request only
+    const char *type = "application/x-protobuf";
+    uint64_t now = mstime();
+    uint64_t since = 0;
+    int ret;
+    MODES_NOTUSED(remote);
+
+    // Requests after a response that closes the connection are ignored
+    if (c->close_when_sent)
+        return 0;
+
+    // Browsers may send an empty line after a POST body, skip blank lines
+    while (*request == '\r' || *request == '\n')
+        request++;
+
+    if (sscanf(request, "%7s %127s %15s", method, target, version) != 3 || strncmp(version, "HTTP/1.", 7)) {
+        return httpError(c, "400 Bad Request");
+    }
+
+    bool head = !strcmp(method, "HEAD");
+    if (!head && strcmp(method, "GET")) {
+        return httpError(c, "405 Method Not Allowed");
+    }
+
+    char *headers = strchr(request, '\n');
+    headers = headers ? headers + 1 : request + strlen(request);
+
+    const char *connection = httpHeader(headers, "Connection");
+    bool close = !strcmp(version, "HTTP/1.0") ? !httpHeaderHas(connection, "keep-alive") : httpHeaderHas(connection, "close");
+
+    // Only the file name counts, and of the query the since cursor
+    char *query = strchr(target, '?');
+    if (query) {
+        char *save;
+        *query++ = '\0';
+        for (char *arg = strtok_r(query, "&", &save); arg; arg = strtok_r(NULL, "&", &save)) {
+            if (!strncmp(arg, "since=", 6))
+                since = strtoull(arg + 6, NULL, 10);
+        }
+    }
+    char *file = strrchr(target, '/');
+    file = file ? file + 1 : target;
+
+    if (!strcmp(file, "aircraft.pb") || !strcmp(file, "stats.pb") || !strcmp(file, "receiver.pb")) {
+        snap = (file[0] == 'a') ? &http_aircraft : (file[0] == 's') ? &http_stats : &http_receiver;
+        if (!snap->body || now >= snap->expires) {
+            if (snap == &http_aircraft)
+                aircraftProtoBuf(snap);
+            else if (snap == &http_stats)
+                statsProtoBuf(snap);
+            else
+                receiverProtoBuf(snap);
+            snap->expires = now + Modes.output_interval;
+        }
+    } else if (!strcmp(file, "history.pb") && since) {
+        // Its ETag need only tell the states of the ring apart
+        memset(&once_snap, 0, sizeof (once_snap));
+        httpSnapshotHistory(&once_snap, since);
+        once_snap.etag = history_seq;
+        snap = &once_snap;
+    } else if (!strcmp(file, "history.pb")) {
+        snap = &http_history;
+        if (!snap->body || http_history_seq != history_seq) {
+            httpSnapshotHistory(snap, 0);
+            http_history_seq = history_seq;
+        }
+    } else if (!strcmp(file, "metrics")) {
+        bool openmetrics = httpHeaderHas(httpHeader(headers, "Accept"), "application/openmetrics-text");
+        metricsWrite(openmetrics);
+        type = openmetrics ? "application/openmetrics-text; version=1.0.0; charset=utf-8" : "text/plain; version=0.0.4; charset=utf-8";
+        // Always new, the time is its ETag
+        memset(&once_snap, 0, sizeof (once_snap));
+        httpSnapshotSet(&once_snap, segmentCreate(metrics.out.data, metrics.out.len));
+        once_snap.etag = now;
+        snap = &once_snap;
+    }
+
+    if (!snap || !snap->body) {
+        return httpError(c, "404 Not Found");
+    }
+
+    char etag[48];
+    snprintf(etag, sizeof (etag), "\"%" PRIx64 "-%" PRIx64 "\"", http_etag_base, snap->etag);
+
+    const char *match = httpHeader(headers, "If-None-Match");
+    if (match && (httpHeaderHas(match, etag) || httpHeaderHas(match, "*"))) {
+        char response[256];
+        int len = snprintf(response, sizeof (response),
+                "HTTP/1.1 304 Not Modified\r\n"
+                "ETag: %s\r\n"
+                "Cache-Control: no-cache\r\n"
+                "%s"
+                "\r\n", etag, close ? "Connection: close\r\n" : "");
+        ret = httpRespond(c, response, len, NULL, close);
+        goto done;
+    }
+
+    bool gzip = httpHeaderHas(httpHeader(headers, "Accept-Encoding"), "gzip");
+    if (gzip && !snap->gzip_done)
+        httpSnapshotGzip(snap);
+    struct net_segment *body = (gzip && snap->gzip) ? snap->gzip : snap->body;
+
+    char response[512];
+    int len = snprintf(response, sizeof (response),
+            "HTTP/1.1 200 OK\r\n"
+            "Content-Type: %s\r\n"
+            "Content-Length: %d\r\n"
+            "%s"
+            "ETag: %s\r\n"
+            "Cache-Control: no-cache\r\n"
+            "Vary: Accept-Encoding\r\n"
+            "%s"
+            "\r\n", type, body->len, body == snap->gzip ? "Content-Encoding: gzip\r\n" : "", etag, close ? "Connection: close\r\n" : "");
+    ret = httpRespond(c, response, len, head ? NULL : body, close);
+
+done:
+    if (snap == &once_snap) {
+        netLock();
+        httpSnapshotRelease(snap);
+        netUnlock();
+    }
+    return ret;
+}
+
+static void httpInit(void) {
+    http_service = serviceInit("HTTP protobuf output", NULL, NULL, READ_MODE_ASCII, "\r\n\r\n", handleHttpRequest);
+    serviceListen(http_service, Modes.net_bind_address, Modes.net_http_ports);
+    http_etag_base = mstime();
+}
+
+static void httpCleanup(void) {
+    httpSnapshotRelease(&http_aircraft);
+    httpSnapshotRelease(&http_stats);
+    httpSnapshotRelease(&http_receiver);
+    httpSnapshotRelease(&http_history);
+    http_history_seq = 0;
+    http_service = NULL;
+    free(metrics.out.data);
+    memset(&metrics, 0, sizeof (metrics));
+}
+
 static void periodicReadFromClient(struct client *c) {
     int nread, err;
     char buf[512];
@@ -2417,7 +5067,7 @@ static void periodicReadFromClient(struct client *c) {
         fprintf(stderr, "%s: Socket Error: %s: %s port %s (fd %d)\n",
                 c->service->descr, nread < 0 ? strerror(err) : "EOF", c->host, c->port,
                 c->fd);
-        modesCloseClient(c);
+        clientFailed(c);
         return;
     }
 }
@@ -2444,21 +5094,24 @@ static void modesReadFromClient(struct client *c) {
     int bContinue = 1;
     int loop = 0;
 
-    while (bContinue && loop++ < 10) {
+    // compressed input may be left to inflate after the last loop
+    while (bContinue && (loop++ < 10 || clientInflatePending(c))) {
         left = MODES_CLIENT_BUF_SIZE - c->buflen - 1; // leave 1 extra byte for NUL termination in the ASCII case
 
         // If our buffer is full discard it, this is some badly formatted shit
         if (left <= 0) {
             c->buflen = 0;
+            c->beast_need = 0;
             left = MODES_CLIENT_BUF_SIZE;
             // If there is garbage, read more to discard it ASAP
         }
 
-        nread = read(c->fd, c->buf + c->buflen, left);
+        nread = clientRead(c, c->buf + c->buflen, left);
         int err = errno;
 
         // If we didn't get all the data we asked for, then return once we've processed what we did get.
-        if (nread != left) {
+        // Datagrams are read until there are none.
+        if (nread != left && !c->datagram) {
             bContinue = 0;
         }
 
@@ -2467,7 +5120,7 @@ static void modesReadFromClient(struct client *c) {
                 fprintf(stderr, "%s: Remote server disconnected: %s port %s (fd %d, SendQ %d, RecvQ %d)\n",
                         c->service->descr, c->con->address, c->con->port, c->fd, c->sendq_len, c->buflen);
             }
-            modesCloseClient(c);
+            clientFailed(c);
             return;
         }
 
@@ -2480,11 +5133,12 @@ static void modesReadFromClient(struct client *c) {
             fprintf(stderr, "%s: Receive Error: %s: %s port %s (fd %d, SendQ %d, RecvQ %d)\n",
                     c->service->descr, strerror(err), c->host, c->port,
                     c->fd, c->sendq_len, c->buflen);
-            modesCloseClient(c);
+            clientFailed(c);
             return;
         }
 
         c->buflen += nread;
+        c->bytes_received += nread;
 
         char *som = c->buf; // first byte of next message
         char *eod = som + c->buflen; // one byte past end of data
@@ -2502,71 +5156,33 @@ static void modesReadFromClient(struct client *c) {
                 break;
 
             case READ_MODE_BEAST:
-                // This is the Beast Binary scanning case.
-                // If there is a complete message still in the buffer, there must be the separator 'sep'
-                // in the buffer, note that we full-scan the buffer at every read for simplicity.
-
-                while (som < eod && ((p = memchr(som, (char) 0x1a, eod - som)) != NULL)) { // The first byte of buffer 'should' be 0x1a
-
-                    Modes.stats_current.remote_rejected_bad += ((p - som) / (8 + MODES_SHORT_MSG_BYTES));
-                    som = p; // consume garbage up to the 0x1a
-                    ++p; // skip 0x1a
-
-                    if (p >= eod) {
-                        // Incomplete message in buffer, retry later
-                        break;
-                    }
-
-                    char *eom; // one byte past end of message
-                    if (*p == '1') {
-                        eom = p + MODEAC_MSG_BYTES + 8; // point past remainder of message
-                    } else if (*p == '2') {
-                        eom = p + MODES_SHORT_MSG_BYTES + 8;
-                    } else if (*p == '3') {
-                        eom = p + MODES_LONG_MSG_BYTES + 8;
-                    } else if (*p == '4') {
-                        eom = p + MODES_LONG_MSG_BYTES + 8;
-                    } else if (*p == '5') {
-                        eom = p + MODES_LONG_MSG_BYTES + 8;
-                    } else if (*p == 'H') {
-                        // GNS HULC protocol message
-                        if (p + 2 >= eod) { // Incomplete message in buffer, retry later
-                            break;
-                        }
-                        int len = *(unsigned char *) (p + 2);
-                        if (len > 24) {
-                            ++som; // Length doesn't match, skip message
-                            continue;
-                        }
-                        eom = p + len + 3;
-                    } else {
-                        // Not a valid beast message, skip 0x1a and try again
-                        ++som;
-                        continue;
-                    }
-
-                    // we need to be careful of double escape characters in the message body
-                    for (p = som + 1; p < eod && p < eom; p++) {
-                        if (0x1A == *p) {
-                            p++;
-                            eom++;
-                        }
-                    }
+            {
+                // This is the Beast Binary scanning case. Anything up to an
+                // incomplete frame at the end is consumed, so only that frame
+                // is scanned again after the next read, and not before it
+                // can be complete.
+                struct beast_scan scan = {som, eod, 0, 0};
+                char *frame;
+                int len;
+
+                if (c->buflen < c->beast_need)
+                    break;
 
-                    if (eom > eod) { // Incomplete message in buffer, retry later
-                        break;
-                    }
+                while ((frame = beastNextFrame(&scan, &len))) {
+                    countGarbage(scan.garbage / (8 + MODES_SHORT_MSG_BYTES));
+                    scan.garbage = 0;
 
-                    // Have a 0x1a followed by 1/2/3/4/5 - pass message to handler.
-                    if (c->service->read_handler(c, som + 1, remote)) {
+                    // Have a 0x1a followed by 1/2/3/4/5/H - pass message to handler.
+                    if (clientMessage(c, frame, len, remote)) {
                         modesCloseClient(c);
                         return;
                     }
-
-                    // advance to next message
-                    som = eom;
                 }
+                countGarbage(scan.garbage / (8 + MODES_SHORT_MSG_BYTES));
+                som = scan.next;
+                c->beast_need = scan.need;
                 break;
+            }
 
             case READ_MODE_BEAST_COMMAND:
                 while (som < eod && ((p = memchr(som, (char) 0x1a, eod - som)) != NULL)) { // The first byte of buffer 'should' be 0x1a
@@ -2601,7 +5217,7 @@ static void modesReadFromClient(struct client *c) {
                     }
 
                     // Have a 0x1a followed by 1 - pass message to handler.
-                    if (c->service->read_handler(c, som + 1, remote)) {
+                    if (clientMessage(c, som + 1, eom - som - 1, remote)) {
                         modesCloseClient(c);
                         return;
                     }
@@ -2623,7 +5239,7 @@ static void modesReadFromClient(struct client *c) {
 
                 while (som < eod && (p = strstr(som, c->service->read_sep)) != NULL) { // end of first message if found
                     *p = '\0'; // The handler expects null terminated strings
-                    if (c->service->read_handler(c, som, remote)) { // Pass message to handler.
+                    if (clientMessage(c, som, p - som, remote)) { // Pass message to handler.
                         modesCloseClient(c); // Handler returns 1 on error to signal we .
                         return; // should close the client connection
                     }
@@ -2849,238 +5465,279 @@ static const char *airground_enum_string(AircraftMeta__AirGround ag) {
     }
 }
 
-static void writeFATSV() {
-    struct aircraft *a;
-    static uint64_t next_update;
-
-    if (!Modes.fatsv_out.service || !Modes.fatsv_out.service->connections) {
-        return; // not enabled or no active connections
+// What decides whether and when an aircraft is emitted, worked out from its
+// current state (with _messageNow set to when it was last seen)
+struct fatsv_state {
+    int altValid;
+    int airgroundValid;
+    int gsValid;
+    int squawkValid;
+    int callsignValid;
+    int positionValid;
+    nav_modes_t nm;
+    uint64_t min_age; // how long after the last emission the next one is due
+};
+
+static void fatsvState(struct aircraft *a, struct fatsv_state *s) {
+    // some special cases:
+    s->altValid = trackDataValid(&a->altitude_baro_valid);
+    s->airgroundValid = trackDataValid(&a->airground_valid) && a->airground_valid.source >= SOURCE_MODE_S_CHECKED; // for non-ADS-B transponders, only trust DF11 CA field
+    s->gsValid = trackDataValid(&a->gs_valid);
+    s->squawkValid = trackDataValid(&a->squawk_valid);
+    s->callsignValid = trackDataValid(&a->callsign_valid) && strcmp(a->callsign, "        ") != 0;
+    s->positionValid = trackDataValid(&a->position_valid);
+
+    // If we are definitely on the ground, suppress any unreliable altitude info.
+    // When on the ground, ADS-B transponders don't emit an ADS-B message that includes
+    // altitude, so a corrupted Mode S altitude response from some other in-the-air AC
+    // might be taken as the "best available altitude" and produce e.g. "airGround G+ alt 31000".
+    if (s->airgroundValid && a->meta.air_ground == AIRCRAFT_META__AIR_GROUND__AG_GROUND && a->altitude_baro_valid.source < SOURCE_MODE_S_CHECKED)
+        s->altValid = 0;
+
+    // Convert new nav modes message to old enum format.
+    s->nm = 0;
+    if (a->nav_modes.autopilot) s->nm += NAV_MODE_AUTOPILOT;
+    if (a->nav_modes.vnav) s->nm += NAV_MODE_VNAV;
+    if (a->nav_modes.althold) s->nm += NAV_MODE_ALT_HOLD;
+    if (a->nav_modes.approach) s->nm += NAV_MODE_APPROACH;
+    if (a->nav_modes.lnav) s->nm += NAV_MODE_LNAV;
+    if (a->nav_modes.tcas) s->nm += NAV_MODE_TCAS;
+
+    // if it hasn't changed altitude, heading, or speed much,
+    // don't update so often
+    int changed =
+            (s->altValid && abs(a->meta.alt_baro - a->fatsv_emitted_altitude_baro) >= 50) ||
+            (trackDataValid(&a->altitude_geom_valid) && abs(a->meta.alt_geom - a->fatsv_emitted_altitude_geom) >= 50) ||
+            (trackDataValid(&a->baro_rate_valid) && abs(a->meta.baro_rate - a->fatsv_emitted_baro_rate) > 500) ||
+            (trackDataValid(&a->geom_rate_valid) && abs(a->meta.geom_rate - a->fatsv_emitted_geom_rate) > 500) ||
+            (trackDataValid(&a->track_valid) && heading_difference(a->meta.track, a->fatsv_emitted_track) >= 2) ||
+            (trackDataValid(&a->track_rate_valid) && fabs(a->meta.track_rate - a->fatsv_emitted_track_rate) >= 0.5) ||
+            (trackDataValid(&a->roll_valid) && fabs(a->meta.roll - a->fatsv_emitted_roll) >= 5.0) ||
+            (trackDataValid(&a->mag_heading_valid) && heading_difference(a->meta.mag_heading, a->fatsv_emitted_mag_heading) >= 2) ||
+            (trackDataValid(&a->true_heading_valid) && heading_difference(a->meta.true_heading, a->fatsv_emitted_true_heading) >= 2) ||
+            (s->gsValid && fabs(a->meta.gs - a->fatsv_emitted_gs) >= 25) ||
+            (trackDataValid(&a->ias_valid) && unsigned_difference(a->meta.ias, a->fatsv_emitted_ias) >= 25) ||
+            (trackDataValid(&a->tas_valid) && unsigned_difference(a->meta.tas, a->fatsv_emitted_tas) >= 25) ||
+            (trackDataValid(&a->mach_valid) && fabs(a->meta.mach - a->fatsv_emitted_mach) >= 0.02);
+
+    int immediate =
+            (trackDataValid(&a->nav_altitude_mcp_valid) && unsigned_difference(a->meta.nav_altitude_mcp, a->fatsv_emitted_nav_altitude_mcp) > 50) ||
+            (trackDataValid(&a->nav_altitude_fms_valid) && unsigned_difference(a->meta.nav_altitude_fms, a->fatsv_emitted_nav_altitude_fms) > 50) ||
+            (trackDataValid(&a->nav_altitude_src_valid) && a->nav_altitude_src != a->fatsv_emitted_nav_altitude_src) ||
+            (trackDataValid(&a->nav_heading_valid) && heading_difference(a->meta.nav_heading, a->fatsv_emitted_nav_heading) > 2) ||
+            (trackDataValid(&a->nav_modes_valid) && s->nm != a->fatsv_emitted_nav_modes) ||
+            (trackDataValid(&a->nav_qnh_valid) && fabs(a->meta.nav_qnh - a->fatsv_emitted_nav_qnh) > 0.8) || // 0.8 is the ES message resolution
+            (s->callsignValid && strcmp(a->callsign, a->fatsv_emitted_callsign) != 0) ||
+            (s->airgroundValid && a->meta.air_ground == AIRCRAFT_META__AIR_GROUND__AG_AIRBORNE && a->fatsv_emitted_airground == AIRCRAFT_META__AIR_GROUND__AG_GROUND) ||
+            (s->airgroundValid && a->meta.air_ground == AIRCRAFT_META__AIR_GROUND__AG_GROUND && a->fatsv_emitted_airground == AIRCRAFT_META__AIR_GROUND__AG_AIRBORNE) ||
+            (s->squawkValid && a->meta.squawk != a->fatsv_emitted_squawk) ||
+            (trackDataValid(&a->emergency_valid) && a->meta.emergency != a->fatsv_emitted_emergency);
+
+    if (immediate) {
+        // a change we want to emit right away
+        s->min_age = 0;
+    } else if (!s->positionValid) {
+        // don't send mode S very often
+        s->min_age = 30000;
+    } else if ((s->airgroundValid && a->meta.air_ground == AIRCRAFT_META__AIR_GROUND__AG_GROUND) ||
+            (s->altValid && a->meta.alt_baro < 500 && (!s->gsValid || a->meta.gs < 200)) ||
+            (s->gsValid && a->meta.gs < 100 && (!s->altValid || a->meta.alt_baro < 1000))) {
+        // we are probably on the ground, increase the update rate
+        s->min_age = 1000;
+    } else if (!s->altValid || a->meta.alt_baro < 10000) {
+        // Below 10000 feet, emit up to every 5s when changing, 10s otherwise
+        s->min_age = (changed ? 5000 : 10000);
+    } else {
+        // Above 10000 feet, emit up to every 10s when changing, 30s otherwise
+        s->min_age = (changed ? 10000 : 30000);
     }
+}
 
-    uint64_t now = mstime();
-    if (now < next_update) {
-        return;
-    }
+// Emit a line for the aircraft, false if there was no room for it
 
-    // scan once a second at most
-    next_update = now + 1000;
+static bool writeFATSVAircraft(struct aircraft *a, struct fatsv_state *s, uint64_t now) {
+    char *p = prepareWrite(&Modes.fatsv_out, TSV_MAX_PACKET_SIZE);
+    if (!p)
+        return false;
+    char *end = p + TSV_MAX_PACKET_SIZE;
 
-    for (int j = 0; j < AIRCRAFTS_BUCKETS; j++) {
-        for (a = Modes.aircrafts[j]; a; a = a->next) {
-            if (a->meta.messages < 2) // basic filter for bad decodes
-                continue;
+    p = appendFATSV(p, end, "_v", "%s", TSV_VERSION);
+    p = appendFATSV(p, end, "clock", "%" PRIu64, messageNow() / 1000);
+    p = appendFATSV(p, end, (a->meta.addr & MODES_NON_ICAO_ADDRESS) ? "otherid" : "hexid", "%06X", a->meta.addr & 0xFFFFFF);
+
+    // for fields we only emit on change,
+    // occasionally re-emit them all
+    int forceEmit = (now - a->fatsv_last_force_emit) > 600000;
+
+    // these don't change often / at all, only emit when they change
+    if (forceEmit || a->meta.addr_type != a->fatsv_emitted_addrtype) {
+        p = appendFATSV(p, end, "addrtype", "%s", addrtype_enum_string(a->meta.addr_type));
+    }
+    if (forceEmit || a->adsb_version != a->fatsv_emitted_adsb_version) {
+        p = appendFATSV(p, end, "adsb_version", "%d", a->adsb_version);
+    }
+    if (forceEmit || a->meta.category != a->fatsv_emitted_category) {
+        p = appendFATSV(p, end, "category", "%02X", a->meta.category);
+    }
+    if (trackDataValid(&a->nac_p_valid) && (forceEmit || a->meta.nac_p != a->fatsv_emitted_nac_p)) {
+        p = appendFATSVMeta(p, end, "nac_p", a, &a->nac_p_valid, "%u", a->meta.nac_p);
+    }
+    if (trackDataValid(&a->nac_v_valid) && (forceEmit || a->meta.nac_v != a->fatsv_emitted_nac_v)) {
+        p = appendFATSVMeta(p, end, "nac_v", a, &a->nac_v_valid, "%u", a->meta.nac_v);
+    }
+    if (trackDataValid(&a->sil_valid) && (forceEmit || a->meta.sil != a->fatsv_emitted_sil)) {
+        p = appendFATSVMeta(p, end, "sil", a, &a->sil_valid, "%u", a->meta.sil);
+    }
+    if (trackDataValid(&a->sil_valid) && (forceEmit || a->meta.sil_type != a->fatsv_emitted_sil_type)) {
+        p = appendFATSVMeta(p, end, "sil_type", a, &a->sil_valid, "%s", sil_type_enum_string(a->meta.sil_type));
+    }
+    if (trackDataValid(&a->nic_baro_valid) && (forceEmit || a->meta.nic_baro != a->fatsv_emitted_nic_baro)) {
+        p = appendFATSVMeta(p, end, "nic_baro", a, &a->nic_baro_valid, "%u", a->meta.nic_baro);
+    }
+
+    // only emit alt, speed, latlon, track etc if they have been received since the last time
+    // and are not stale
+
+    char *dataStart = p;
+
+    // special cases
+    if (s->airgroundValid)
+        p = appendFATSVMeta(p, end, "airGround", a, &a->airground_valid, "%s", airground_enum_string(a->meta.air_ground));
+    if (s->squawkValid)
+        p = appendFATSVMeta(p, end, "squawk", a, &a->squawk_valid, "%04x", a->meta.squawk);
+    if (s->callsignValid)
+        p = appendFATSVMeta(p, end, "ident", a, &a->callsign_valid, "{%s}", a->callsign);
+    if (s->altValid)
+        p = appendFATSVMeta(p, end, "alt", a, &a->altitude_baro_valid, "%d", a->meta.alt_baro);
+    if (s->positionValid) {
+        p = appendFATSVMeta(p, end, "position", a, &a->position_valid, "{%.5f %.5f %u %u}", a->meta.lat, a->meta.lon, a->meta.nic, a->meta.rc);
+    }
+
+    p = appendFATSVMeta(p, end, "alt_gnss", a, &a->altitude_geom_valid, "%d", a->meta.alt_geom);
+    p = appendFATSVMeta(p, end, "vrate", a, &a->baro_rate_valid, "%d", a->meta.baro_rate);
+    p = appendFATSVMeta(p, end, "vrate_geom", a, &a->geom_rate_valid, "%d", a->meta.geom_rate);
+    p = appendFATSVMeta(p, end, "speed", a, &a->gs_valid, "%d", a->meta.gs);
+    p = appendFATSVMeta(p, end, "speed_ias", a, &a->ias_valid, "%u", a->meta.ias);
+    p = appendFATSVMeta(p, end, "speed_tas", a, &a->tas_valid, "%u", a->meta.tas);
+    p = appendFATSVMeta(p, end, "mach", a, &a->mach_valid, "%.3f", a->meta.mach);
+    p = appendFATSVMeta(p, end, "track", a, &a->track_valid, "%d", a->meta.track);
+    p = appendFATSVMeta(p, end, "track_rate", a, &a->track_rate_valid, "%.2f", a->meta.track_rate);
+    p = appendFATSVMeta(p, end, "roll", a, &a->roll_valid, "%.1f", a->meta.roll);
+    p = appendFATSVMeta(p, end, "heading_magnetic", a, &a->mag_heading_valid, "%d", a->meta.mag_heading);
+    p = appendFATSVMeta(p, end, "heading_true", a, &a->true_heading_valid, "%d", a->meta.true_heading);
+    p = appendFATSVMeta(p, end, "nav_alt_mcp", a, &a->nav_altitude_mcp_valid, "%u", a->meta.nav_altitude_mcp);
+    p = appendFATSVMeta(p, end, "nav_alt_fms", a, &a->nav_altitude_fms_valid, "%u", a->meta.nav_altitude_fms);
+    p = appendFATSVMeta(p, end, "nav_alt_src", a, &a->nav_altitude_src_valid, "%s", nav_altitude_source_enum_string(a->nav_altitude_src));
+    p = appendFATSVMeta(p, end, "nav_heading", a, &a->nav_heading_valid, "%d", a->meta.nav_heading);
+    p = appendFATSVMeta(p, end, "nav_modes", a, &a->nav_modes_valid, "{%s}", nav_modes_flags_string(a->nav_modes));
+    p = appendFATSVMeta(p, end, "nav_qnh", a, &a->nav_qnh_valid, "%.1f", a->meta.nav_qnh);
+    p = appendFATSVMeta(p, end, "emergency", a, &a->emergency_valid, "%s", emergency_enum_string(a->meta.emergency));
+
+    // if we didn't get anything interesting, bail out.
+    // We don't need to do anything special to unwind prepareWrite().
+    // It won't have anything new until it changes again.
+    if (p == dataStart) {
+        a->fatsv_generation = a->generation;
+        return true;
+    }
 
-            // don't emit if it hasn't updated since last time
-            if (a->meta.seen < a->fatsv_last_emitted) {
-                continue;
-            }
+    --p; // remove last tab
+    p = safe_snprintf(p, end, "\n");
 
-            // Pretend we are "processing a message" so the validity checks work as expected
-            _messageNow = a->meta.seen;
-
-            // some special cases:
-            int altValid = trackDataValid(&a->altitude_baro_valid);
-            int airgroundValid = trackDataValid(&a->airground_valid) && a->airground_valid.source >= SOURCE_MODE_S_CHECKED; // for non-ADS-B transponders, only trust DF11 CA field
-            int gsValid = trackDataValid(&a->gs_valid);
-            int squawkValid = trackDataValid(&a->squawk_valid);
-            int callsignValid = trackDataValid(&a->callsign_valid) && strcmp(a->callsign, "        ") != 0;
-            int positionValid = trackDataValid(&a->position_valid);
-
-            // If we are definitely on the ground, suppress any unreliable altitude info.
-            // When on the ground, ADS-B transponders don't emit an ADS-B message that includes
-            // altitude, so a corrupted Mode S altitude response from some other in-the-air AC
-            // might be taken as the "best available altitude" and produce e.g. "airGround G+ alt 31000".
-            if (airgroundValid && a->meta.air_ground == AIRCRAFT_META__AIR_GROUND__AG_GROUND && a->altitude_baro_valid.source < SOURCE_MODE_S_CHECKED)
-                altValid = 0;
-
-            // Convert new nav modes message to old enum format.
-            nav_modes_t nm = 0;
-            if (a->nav_modes.autopilot) nm += NAV_MODE_AUTOPILOT;
-            if (a->nav_modes.vnav) nm += NAV_MODE_VNAV;
-            if (a->nav_modes.althold) nm += NAV_MODE_ALT_HOLD;
-            if (a->nav_modes.approach) nm += NAV_MODE_APPROACH;
-            if (a->nav_modes.lnav) nm += NAV_MODE_LNAV;
-            if (a->nav_modes.tcas) nm += NAV_MODE_TCAS;
-
-            // if it hasn't changed altitude, heading, or speed much,
-            // don't update so often
-            int changed =
-                    (altValid && abs(a->meta.alt_baro - a->fatsv_emitted_altitude_baro) >= 50) ||
-                    (trackDataValid(&a->altitude_geom_valid) && abs(a->meta.alt_geom - a->fatsv_emitted_altitude_geom) >= 50) ||
-                    (trackDataValid(&a->baro_rate_valid) && abs(a->meta.baro_rate - a->fatsv_emitted_baro_rate) > 500) ||
-                    (trackDataValid(&a->geom_rate_valid) && abs(a->meta.geom_rate - a->fatsv_emitted_geom_rate) > 500) ||
-                    (trackDataValid(&a->track_valid) && heading_difference(a->meta.track, a->fatsv_emitted_track) >= 2) ||
-                    (trackDataValid(&a->track_rate_valid) && fabs(a->meta.track_rate - a->fatsv_emitted_track_rate) >= 0.5) ||
-                    (trackDataValid(&a->roll_valid) && fabs(a->meta.roll - a->fatsv_emitted_roll) >= 5.0) ||
-                    (trackDataValid(&a->mag_heading_valid) && heading_difference(a->meta.mag_heading, a->fatsv_emitted_mag_heading) >= 2) ||
-                    (trackDataValid(&a->true_heading_valid) && heading_difference(a->meta.true_heading, a->fatsv_emitted_true_heading) >= 2) ||
-                    (gsValid && fabs(a->meta.gs - a->fatsv_emitted_gs) >= 25) ||
-                    (trackDataValid(&a->ias_valid) && unsigned_difference(a->meta.ias, a->fatsv_emitted_ias) >= 25) ||
-                    (trackDataValid(&a->tas_valid) && unsigned_difference(a->meta.tas, a->fatsv_emitted_tas) >= 25) ||
-                    (trackDataValid(&a->mach_valid) && fabs(a->meta.mach - a->fatsv_emitted_mach) >= 0.02);
-
-            int immediate =
-                    (trackDataValid(&a->nav_altitude_mcp_valid) && unsigned_difference(a->meta.nav_altitude_mcp, a->fatsv_emitted_nav_altitude_mcp) > 50) ||
-                    (trackDataValid(&a->nav_altitude_fms_valid) && unsigned_difference(a->meta.nav_altitude_fms, a->fatsv_emitted_nav_altitude_fms) > 50) ||
-                    (trackDataValid(&a->nav_altitude_src_valid) && a->nav_altitude_src != a->fatsv_emitted_nav_altitude_src) ||
-                    (trackDataValid(&a->nav_heading_valid) && heading_difference(a->meta.nav_heading, a->fatsv_emitted_nav_heading) > 2) ||
-                    (trackDataValid(&a->nav_modes_valid) && nm != a->fatsv_emitted_nav_modes) ||
-                    (trackDataValid(&a->nav_qnh_valid) && fabs(a->meta.nav_qnh - a->fatsv_emitted_nav_qnh) > 0.8) || // 0.8 is the ES message resolution
-                    (callsignValid && strcmp(a->callsign, a->fatsv_emitted_callsign) != 0) ||
-                    (airgroundValid && a->meta.air_ground == AIRCRAFT_META__AIR_GROUND__AG_AIRBORNE && a->fatsv_emitted_airground == AIRCRAFT_META__AIR_GROUND__AG_GROUND) ||
-                    (airgroundValid && a->meta.air_ground == AIRCRAFT_META__AIR_GROUND__AG_GROUND && a->fatsv_emitted_airground == AIRCRAFT_META__AIR_GROUND__AG_AIRBORNE) ||
-                    (squawkValid && a->meta.squawk != a->fatsv_emitted_squawk) ||
-                    (trackDataValid(&a->emergency_valid) && a->meta.emergency != a->fatsv_emitted_emergency);
-
-            uint64_t minAge;
-            if (immediate) {
-                // a change we want to emit right away
-                minAge = 0;
-            } else if (!positionValid) {
-                // don't send mode S very often
-                minAge = 30000;
-            } else if ((airgroundValid && a->meta.air_ground == AIRCRAFT_META__AIR_GROUND__AG_GROUND) ||
-                    (altValid && a->meta.alt_baro < 500 && (!gsValid || a->meta.gs < 200)) ||
-                    (gsValid && a->meta.gs < 100 && (!altValid || a->meta.alt_baro < 1000))) {
-                // we are probably on the ground, increase the update rate
-                minAge = 1000;
-            } else if (!altValid || a->meta.alt_baro < 10000) {
-                // Below 10000 feet, emit up to every 5s when changing, 10s otherwise
-                minAge = (changed ? 5000 : 10000);
-            } else {
-                // Above 10000 feet, emit up to every 10s when changing, 30s otherwise
-                minAge = (changed ? 10000 : 30000);
-            }
+    if (p < end)
+        completeWrite(&Modes.fatsv_out, p);
+    else
+        fprintf(stderr, "fatsv: output too large (max %d, overran by %d)\n", TSV_MAX_PACKET_SIZE, (int) (p - end));
 
-            if ((now - a->fatsv_last_emitted) < minAge)
-                continue;
+    a->fatsv_emitted_altitude_baro = a->meta.alt_baro;
+    a->fatsv_emitted_altitude_geom = a->meta.alt_geom;
+    a->fatsv_emitted_baro_rate = a->meta.baro_rate;
+    a->fatsv_emitted_geom_rate = a->meta.geom_rate;
+    a->fatsv_emitted_gs = a->meta.gs;
+    a->fatsv_emitted_ias = a->meta.ias;
+    a->fatsv_emitted_tas = a->meta.tas;
+    a->fatsv_emitted_mach = a->meta.mach;
+    a->fatsv_emitted_track = a->meta.track;
+    a->fatsv_emitted_track_rate = a->meta.track_rate;
+    a->fatsv_emitted_roll = a->meta.roll;
+    a->fatsv_emitted_mag_heading = a->meta.mag_heading;
+    a->fatsv_emitted_true_heading = a->meta.true_heading;
+    a->fatsv_emitted_airground = a->meta.air_ground;
+    a->fatsv_emitted_nav_altitude_mcp = a->meta.nav_altitude_mcp;
+    a->fatsv_emitted_nav_altitude_fms = a->meta.nav_altitude_fms;
+    a->fatsv_emitted_nav_altitude_src = a->nav_altitude_src;
+    a->fatsv_emitted_nav_heading = a->meta.nav_heading;
+    a->fatsv_emitted_nav_modes = s->nm;
+    a->fatsv_emitted_nav_qnh = a->meta.nav_qnh;
+    memcpy(a->fatsv_emitted_callsign, a->callsign, sizeof (a->fatsv_emitted_callsign));
+    a->fatsv_emitted_addrtype = a->meta.addr_type;
+    a->fatsv_emitted_adsb_version = a->adsb_version;
+    a->fatsv_emitted_category = a->meta.category;
+    a->fatsv_emitted_squawk = a->meta.squawk;
+    a->fatsv_emitted_nac_p = a->meta.nac_p;
+    a->fatsv_emitted_nac_v = a->meta.nac_v;
+    a->fatsv_emitted_sil = a->meta.sil;
+    a->fatsv_emitted_sil_type = a->meta.sil_type;
+    a->fatsv_emitted_nic_baro = a->meta.nic_baro;
+    a->fatsv_emitted_emergency = a->meta.emergency;
+    a->fatsv_last_emitted = now;
+    a->fatsv_generation = a->generation;
+    if (forceEmit) {
+        a->fatsv_last_force_emit = now;
+    }
+    return true;
+}
 
-            char *p = prepareWrite(&Modes.fatsv_out, TSV_MAX_PACKET_SIZE);
-            if (!p)
-                return;
-            char *end = p + TSV_MAX_PACKET_SIZE;
+static void writeFATSV() {
+    struct aircraft *a;
+    static uint64_t next_update;
+    static uint64_t cursor; // every aircraft changed after this is looked at
+
+    if (!Modes.fatsv_out.service || !Modes.fatsv_out.service->connections) {
+        return; // not enabled or no active connections
+    }
+
+    uint64_t now = mstime();
+    if (now < next_update) {
+        return;
+    }
 
-            p = appendFATSV(p, end, "_v", "%s", TSV_VERSION);
-            p = appendFATSV(p, end, "clock", "%" PRIu64, messageNow() / 1000);
-            p = appendFATSV(p, end, (a->meta.addr & MODES_NON_ICAO_ADDRESS) ? "otherid" : "hexid", "%06X", a->meta.addr & 0xFFFFFF);
+    // scan once a second at most
+    next_update = now + 1000;
 
-            // for fields we only emit on change,
-            // occasionally re-emit them all
-            int forceEmit = (now - a->fatsv_last_force_emit) > 600000;
+    // Only aircraft that changed since the last scan can have anything new
+    // to emit. Work out when each of them is next due and queue it for then;
+    // a later change moves it again.
+    struct fatsv_state s;
 
-            // these don't change often / at all, only emit when they change
-            if (forceEmit || a->meta.addr_type != a->fatsv_emitted_addrtype) {
-                p = appendFATSV(p, end, "addrtype", "%s", addrtype_enum_string(a->meta.addr_type));
-            }
-            if (forceEmit || a->adsb_version != a->fatsv_emitted_adsb_version) {
-                p = appendFATSV(p, end, "adsb_version", "%d", a->adsb_version);
-            }
-            if (forceEmit || a->meta.category != a->fatsv_emitted_category) {
-                p = appendFATSV(p, end, "category", "%02X", a->meta.category);
-            }
-            if (trackDataValid(&a->nac_p_valid) && (forceEmit || a->meta.nac_p != a->fatsv_emitted_nac_p)) {
-                p = appendFATSVMeta(p, end, "nac_p", a, &a->nac_p_valid, "%u", a->meta.nac_p);
-            }
-            if (trackDataValid(&a->nac_v_valid) && (forceEmit || a->meta.nac_v != a->fatsv_emitted_nac_v)) {
-                p = appendFATSVMeta(p, end, "nac_v", a, &a->nac_v_valid, "%u", a->meta.nac_v);
-            }
-            if (trackDataValid(&a->sil_valid) && (forceEmit || a->meta.sil != a->fatsv_emitted_sil)) {
-                p = appendFATSVMeta(p, end, "sil", a, &a->sil_valid, "%u", a->meta.sil);
-            }
-            if (trackDataValid(&a->sil_valid) && (forceEmit || a->meta.sil_type != a->fatsv_emitted_sil_type)) {
-                p = appendFATSVMeta(p, end, "sil_type", a, &a->sil_valid, "%s", sil_type_enum_string(a->meta.sil_type));
-            }
-            if (trackDataValid(&a->nic_baro_valid) && (forceEmit || a->meta.nic_baro != a->fatsv_emitted_nic_baro)) {
-                p = appendFATSVMeta(p, end, "nic_baro", a, &a->nic_baro_valid, "%u", a->meta.nic_baro);
-            }
+    for (a = Modes.aircraft_changed; a && a->generation > cursor; a = a->changed.next) {
+        if (a->meta.messages < 2) // basic filter for bad decodes
+            continue;
 
-            // only emit alt, speed, latlon, track etc if they have been received since the last time
-            // and are not stale
-
-            char *dataStart = p;
-
-            // special cases
-            if (airgroundValid)
-                p = appendFATSVMeta(p, end, "airGround", a, &a->airground_valid, "%s", airground_enum_string(a->meta.air_ground));
-            if (squawkValid)
-                p = appendFATSVMeta(p, end, "squawk", a, &a->squawk_valid, "%04x", a->meta.squawk);
-            if (callsignValid)
-                p = appendFATSVMeta(p, end, "ident", a, &a->callsign_valid, "{%s}", a->callsign);
-            if (altValid)
-                p = appendFATSVMeta(p, end, "alt", a, &a->altitude_baro_valid, "%d", a->meta.alt_baro);
-            if (positionValid) {
-                p = appendFATSVMeta(p, end, "position", a, &a->position_valid, "{%.5f %.5f %u %u}", a->meta.lat, a->meta.lon, a->meta.nic, a->meta.rc);
-            }
+        // don't emit if it hasn't updated since last time
+        if (a->generation <= a->fatsv_generation) {
+            continue;
+        }
 
-            p = appendFATSVMeta(p, end, "alt_gnss", a, &a->altitude_geom_valid, "%d", a->meta.alt_geom);
-            p = appendFATSVMeta(p, end, "vrate", a, &a->baro_rate_valid, "%d", a->meta.baro_rate);
-            p = appendFATSVMeta(p, end, "vrate_geom", a, &a->geom_rate_valid, "%d", a->meta.geom_rate);
-            p = appendFATSVMeta(p, end, "speed", a, &a->gs_valid, "%d", a->meta.gs);
-            p = appendFATSVMeta(p, end, "speed_ias", a, &a->ias_valid, "%u", a->meta.ias);
-            p = appendFATSVMeta(p, end, "speed_tas", a, &a->tas_valid, "%u", a->meta.tas);
-            p = appendFATSVMeta(p, end, "mach", a, &a->mach_valid, "%.3f", a->meta.mach);
-            p = appendFATSVMeta(p, end, "track", a, &a->track_valid, "%d", a->meta.track);
-            p = appendFATSVMeta(p, end, "track_rate", a, &a->track_rate_valid, "%.2f", a->meta.track_rate);
-            p = appendFATSVMeta(p, end, "roll", a, &a->roll_valid, "%.1f", a->meta.roll);
-            p = appendFATSVMeta(p, end, "heading_magnetic", a, &a->mag_heading_valid, "%d", a->meta.mag_heading);
-            p = appendFATSVMeta(p, end, "heading_true", a, &a->true_heading_valid, "%d", a->meta.true_heading);
-            p = appendFATSVMeta(p, end, "nav_alt_mcp", a, &a->nav_altitude_mcp_valid, "%u", a->meta.nav_altitude_mcp);
-            p = appendFATSVMeta(p, end, "nav_alt_fms", a, &a->nav_altitude_fms_valid, "%u", a->meta.nav_altitude_fms);
-            p = appendFATSVMeta(p, end, "nav_alt_src", a, &a->nav_altitude_src_valid, "%s", nav_altitude_source_enum_string(a->nav_altitude_src));
-            p = appendFATSVMeta(p, end, "nav_heading", a, &a->nav_heading_valid, "%d", a->meta.nav_heading);
-            p = appendFATSVMeta(p, end, "nav_modes", a, &a->nav_modes_valid, "{%s}", nav_modes_flags_string(a->nav_modes));
-            p = appendFATSVMeta(p, end, "nav_qnh", a, &a->nav_qnh_valid, "%.1f", a->meta.nav_qnh);
-            p = appendFATSVMeta(p, end, "emergency", a, &a->emergency_valid, "%s", emergency_enum_string(a->meta.emergency));
-
-            // if we didn't get anything interesting, bail out.
-            // We don't need to do anything special to unwind prepareWrite().
-            if (p == dataStart) {
-                continue;
-            }
+        // Pretend we are "processing a message" so the validity checks work as expected
+        _messageNow = a->meta.seen;
+        fatsvState(a, &s);
 
-            --p; // remove last tab
-            p = safe_snprintf(p, end, "\n");
+        if (a->fatsv_last_emitted > now)
+            trackScheduleFatsv(a, 0);
+        else
+            trackScheduleFatsv(a, a->fatsv_last_emitted + s.min_age);
+    }
+    cursor = Modes.track_generation;
 
-            if (p < end)
-                completeWrite(&Modes.fatsv_out, p);
-            else
-                fprintf(stderr, "fatsv: output too large (max %d, overran by %d)\n", TSV_MAX_PACKET_SIZE, (int) (p - end));
-
-            a->fatsv_emitted_altitude_baro = a->meta.alt_baro;
-            a->fatsv_emitted_altitude_geom = a->meta.alt_geom;
-            a->fatsv_emitted_baro_rate = a->meta.baro_rate;
-            a->fatsv_emitted_geom_rate = a->meta.geom_rate;
-            a->fatsv_emitted_gs = a->meta.gs;
-            a->fatsv_emitted_ias = a->meta.ias;
-            a->fatsv_emitted_tas = a->meta.tas;
-            a->fatsv_emitted_mach = a->meta.mach;
-            a->fatsv_emitted_track = a->meta.track;
-            a->fatsv_emitted_track_rate = a->meta.track_rate;
-            a->fatsv_emitted_roll = a->meta.roll;
-            a->fatsv_emitted_mag_heading = a->meta.mag_heading;
-            a->fatsv_emitted_true_heading = a->meta.true_heading;
-            a->fatsv_emitted_airground = a->meta.air_ground;
-            a->fatsv_emitted_nav_altitude_mcp = a->meta.nav_altitude_mcp;
-            a->fatsv_emitted_nav_altitude_fms = a->meta.nav_altitude_fms;
-            a->fatsv_emitted_nav_altitude_src = a->nav_altitude_src;
-            a->fatsv_emitted_nav_heading = a->meta.nav_heading;
-            a->fatsv_emitted_nav_modes = nm;
-            a->fatsv_emitted_nav_qnh = a->meta.nav_qnh;
-            memcpy(a->fatsv_emitted_callsign, a->callsign, sizeof (a->fatsv_emitted_callsign));
-            a->fatsv_emitted_addrtype = a->meta.addr_type;
-            a->fatsv_emitted_adsb_version = a->adsb_version;
-            a->fatsv_emitted_category = a->meta.category;
-            a->fatsv_emitted_squawk = a->meta.squawk;
-            a->fatsv_emitted_nac_p = a->meta.nac_p;
-            a->fatsv_emitted_nac_v = a->meta.nac_v;
-            a->fatsv_emitted_sil = a->meta.sil;
-            a->fatsv_emitted_sil_type = a->meta.sil_type;
-            a->fatsv_emitted_nic_baro = a->meta.nic_baro;
-            a->fatsv_emitted_emergency = a->meta.emergency;
-            a->fatsv_last_emitted = now;
-            if (forceEmit) {
-                a->fatsv_last_force_emit = now;
-            }
+    // Then emit those due by now. Their state is as it was when queued.
+    while ((a = trackNextFatsvDue(now))) {
+        _messageNow = a->meta.seen;
+        fatsvState(a, &s);
+
+        if (!writeFATSVAircraft(a, &s, now)) {
+            trackScheduleFatsv(a, 0);
+            break;
         }
     }
 }
@@ -3090,11 +5747,18 @@ void modesNetSecondWork(void) {
     struct net_service *s;
     uint64_t now = mstime();
 
+    netLock();
+    add_stats(&Modes.stats_current, &net_io_stats.st, &Modes.stats_current);
+    reset_stats(&net_io_stats.st);
     for (s = Modes.services; s; s = s->next) {
-        if (s->read_handler)
-            continue;
         for (c = s->clients; c; c = c->next) {
-            if (!c->service)
+            if (!c->service || c->io_failed)
+                continue;
+            // Clients are only flushed when they become writable, catch
+            // the ones that never do
+            if (c->sendq_len && net_poll_fd >= 0)
+                flushClient(c, now);
+            if (!c->service || s->read_handler || net_poll_fd >= 0)
                 continue;
             if (c->last_read + 30000 < now) {
                 // This is called if there is no read handler - we just read and discard to try to trigger socket errors
@@ -3104,6 +5768,7 @@ void modesNetSecondWork(void) {
             }
         }
     }
+    netUnlock();
 
     // If we have generated no messages for a while, send
     // a heartbeat
@@ -3118,306 +5783,969 @@ void modesNetSecondWork(void) {
         }
     }
 
-    // Unlink and free closed clients
+    // Unlink and free closed clients nothing refers to any more
+    netLock();
     for (s = Modes.services; s; s = s->next) {
         for (prev = &s->clients, c = *prev; c; c = *prev) {
-            if (c->fd == -1) {
+            if (c->fd == -1 && !c->refs) {
                 // Recently closed, prune from list
                 *prev = c->next;
-                free(c);
+                clientFree(c);
             } else {
                 prev = &c->next;
             }
         }
     }
+    netUnlock();
 }
 
 //
-// Perform periodic network work
+// Handle a client the poller reported ready
 //
 
-void modesNetPeriodicWork(void) {
-    struct client *c;
-    struct net_service *s;
-    uint64_t now = mstime();
-    static uint64_t next_tcp_json;
+static void netPollClient(struct client *c, bool readable, bool writable, uint64_t now) {
+    if (c->io_failed)
+        return;
+
+    if (readable && c->service) {
+        if (c->service->read_handler)
+            modesReadFromClient(c);
+        else
+            periodicReadFromClient(c); // read and discard, notices disconnects
+    }
+
+    if (writable && c->service && !c->io_failed && c->sendq_len)
+        flushClient(c, now);
+}
+
+// Write the clients flushWrites() handed over, on the I/O thread
+
+static void netFlushQueued(uint64_t now) {
+    char buf[64];
+
+    while (read(net_io_wakeup[0], buf, sizeof (buf)) > 0)
+        ;
+
+    struct client *c = net_flush_list;
+    net_flush_list = NULL;
+    while (c) {
+        struct client *next = c->flush_next;
+        c->flush_queued = false;
+        c->refs--;
+        if (c->service && !c->io_failed && c->sendq_len)
+            flushClient(c, now);
+        c = next;
+    }
+}
+
+// Wait up to timeout_ms for network events and service them.
+// Returns false if the poller is not in use.
+
+static bool netPollDispatch(int timeout_ms) {
     static uint64_t next_accept;
+    uint64_t now;
+    int n = 0;
+
+    if (!netPollActive())
+        return false;
 
-    // Accept new connections
-    if (now > next_accept) {
-        next_accept = modesAcceptClients(now);
+    now = mstime();
+    if (next_accept && now >= next_accept) {
+        netLock();
+        netPollListeners(true);
+        netUnlock();
+        next_accept = 0;
     }
 
-    // Read from clients, and if any need flushing, do so.
-    for (s = Modes.services; s; s = s->next) {
-        for (c = s->clients; c; c = c->next) {
-            if (!c->service)
-                continue;
+#if defined(NET_POLL_EPOLL)
+    struct epoll_event events[NET_POLL_EVENTS];
 
-            if (s->read_handler) {
-                modesReadFromClient(c);
-            }
+    n = epoll_wait(net_poll_fd, events, NET_POLL_EVENTS, timeout_ms);
+#elif defined(NET_POLL_KQUEUE)
+    struct kevent events[NET_POLL_EVENTS];
+    struct timespec ts = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
 
-            // If there is a sendq, try to flush it
-            if (s->writer) {
-                if (c->sendq_len == 0) {
-                    c->last_flush = now;
-                    continue;
-                }
-                flushClient(c, now);
+    n = kevent(net_poll_fd, NULL, 0, events, NET_POLL_EVENTS, &ts);
+#endif
+    if (n < 0) {
+        if (errno != EINTR)
+            netPollDisable("poller wait");
+        return true;
+    }
+
+    netLock();
+    now = mstime();
+    for (int i = 0; i < n; ++i) {
+#if defined(NET_POLL_EPOLL)
+        int fd = events[i].data.fd;
+        // errors and hangups are reported by the next read or write
+        bool readable = events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR);
+        bool writable = events[i].events & (EPOLLOUT | EPOLLERR);
+#elif defined(NET_POLL_KQUEUE)
+        int fd = (int) events[i].ident;
+        bool readable = events[i].filter == EVFILT_READ;
+        bool writable = events[i].filter == EVFILT_WRITE;
+#endif
+        if (fd < 0 || fd >= net_poll_size)
+            continue;
+
+        struct net_poll_entry *e = &net_poll_entries[fd];
+        if (e->wakeup) {
+            netFlushQueued(now);
+        } else if (e->listener) {
+            if (!serviceAccept(e->listener)) {
+                fprintf(stderr, "Accepting new connections suspended for 3 seconds: %s\n", Modes.aneterr);
+                netPollListeners(false);
+                next_accept = now + 3000;
             }
+        } else if (e->client) {
+            netPollClient(e->client, readable, writable, now);
         }
     }
+    netUnlock();
 
-    // Generate FATSV output
-    writeFATSV();
+    return true;
+}
 
-    // supply JSON to vrs_out writer
-    if (Modes.vrs_out.service && Modes.vrs_out.service->connections && now >= next_tcp_json) {
-        static int part;
-        int n_parts = 1 << 3; // must be power of 2
-        writeJsonToNet(&Modes.vrs_out, generateVRS(part, n_parts));
-        if (++part >= n_parts)
-            part = 0;
-        next_tcp_json = now + 1000 / n_parts;
+// Handle the records the I/O thread queued, on the main thread
+
+//
+// Decoding Beast input ahead
+//
+// With --net-ingest-threads > 1, the Mode S frames read from remote Beast
+// inputs are decoded in parallel before the main thread handles their
+// records. Each window of up to NET_DECODE_WINDOW frames is split into
+// contiguous slices, one per thread including the main thread, which run
+// decodeModesMessage() over them as decodeAheadBegin() describes. The main
+// thread then goes through the records in order and tracks and forwards
+// the decoded messages, so the results are the same as decoding them one
+// by one. Comm-B replies, other frames, and messages rejected for an
+// unknown address are decoded by the main thread when it gets to them.
+//
+
+#define NET_DECODE_MAX_THREADS 16
+#define NET_DECODE_WINDOW 4096 // frames decoded ahead at a time
+#define NET_DECODE_MIN 64 // frames per thread worth waking the workers for
+#define NET_DECODE_DEFER 1 // result of frames left to the main thread
+#define NET_DECODE_DUPLICATE 2 // result of frames dropped by netDuplicate()
+#define NET_DECODE_AHEAD 3 // not decoded yet
+
+struct net_decoded {
+    struct net_record *record;
+    int result; // from decodeModesMessage(), or one of the NET_DECODE_ values above
+    struct modesMessage mm;
+};
+
+struct net_decode_slice {
+    pthread_t thread;
+    struct net_decoded *from;
+    unsigned count;
+    bool ready; // has a decode cache, see decodeAheadThreadInit(); if not, the main thread decodes the slice
+    struct stats_slot stats; // of decoding this slice
+};
+
+static struct net_decoded *net_decoded; // the window, NET_DECODE_WINDOW entries
+static uint64_t net_decode_received; // reception time of the window
+static struct net_decode_slice net_decode_slices[NET_DECODE_MAX_THREADS];
+static int net_decode_threads = 1; // number of slices, including the one done by the main thread
+static pthread_mutex_t net_decode_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t net_decode_work_cond = PTHREAD_COND_INITIALIZER; // signals a new window to the workers
+static pthread_cond_t net_decode_done_cond = PTHREAD_COND_INITIALIZER; // signals all workers are done
+static unsigned net_decode_generation; // bumped for every window handed to the workers
+static int net_decode_pending; // workers still busy with the current window
+static bool net_decode_halt;
+
+static inline bool netDecodeAhead(const struct net_record *r) {
+    return r->type == NET_RECORD_MESSAGE && r->remote &&
+            r->client->service && r->client->service->read_handler == decodeBinMessage;
+}
+
+// The length of the Mode S message of a frame to decode ahead, or 0 if it is
+// left to the main thread
+
+static inline int decodeAheadLength(const char *p) {
+    // p[8] is the first byte of the message, after type, timestamp and signal level
+    if (*p == '2')
+        return MODES_SHORT_MSG_BYTES;
+    if (*p == '3' && (p[8] >> 3 & 0x1f) != 20 && (p[8] >> 3 & 0x1f) != 21)
+        return MODES_LONG_MSG_BYTES;
+    return 0;
+}
+
+static void decodeSlice(struct net_decode_slice *slice) {
+    reset_stats(&slice->stats.st);
+    decodeAheadBegin(&slice->stats.st);
+
+    for (unsigned i = 0; i < slice->count; ++i) {
+        struct net_decoded *d = &slice->from[i];
+        char *p = (char *) (d->record + 1);
+        unsigned char msg[MODES_LONG_MSG_BYTES];
+
+        if (d->result != NET_DECODE_AHEAD)
+            continue;
+
+        memcpy(msg, beastFrameMessage(p + 1, 1, net_decode_received, &d->mm), decodeAheadLength(p));
+        d->result = decodeModesMessage(&d->mm, msg);
     }
 
-    // If we have data that has been waiting to be written for a while,
-    // write it now.
-    for (s = Modes.services; s; s = s->next) {
-        if (s->writer &&
-                s->writer->dataUsed &&
-                ((s->writer->lastWrite + Modes.net_output_flush_interval) <= now)) {
-            flushWrites(s->writer);
+    decodeAheadEnd();
+}
+
+static void *netDecodeEntryPoint(void *arg) {
+    struct net_decode_slice *slice = arg;
+    unsigned seen = 0;
+
+    set_thread_name("readsb-decode");
+    slice->ready = decodeAheadThreadInit();
+
+    pthread_mutex_lock(&net_decode_mutex);
+    while (true) {
+        while (!net_decode_halt && net_decode_generation == seen)
+            pthread_cond_wait(&net_decode_work_cond, &net_decode_mutex);
+        if (net_decode_halt)
+            break;
+        seen = net_decode_generation;
+        pthread_mutex_unlock(&net_decode_mutex);
+
+        if (slice->ready)
+            decodeSlice(slice);
+
+        pthread_mutex_lock(&net_decode_mutex);
+        if (--net_decode_pending == 0)
+            pthread_cond_signal(&net_decode_done_cond);
+    }
+    pthread_mutex_unlock(&net_decode_mutex);
+
+    decodeAheadThreadCleanup();
+    return NULL;
+}
+
+static void stopDecodeThreads(void) {
+    pthread_mutex_lock(&net_decode_mutex);
+    net_decode_halt = true;
+    pthread_cond_broadcast(&net_decode_work_cond);
+    pthread_mutex_unlock(&net_decode_mutex);
+
+    for (int i = 1; i < net_decode_threads; ++i)
+        pthread_join(net_decode_slices[i].thread, NULL);
+
+    net_decode_threads = 1;
+    free(net_decoded);
+    net_decoded = NULL;
+}
+
+// Start (threads - 1) decoding threads; the main thread does the remaining slice.
+
+static bool startDecodeThreads(int threads) {
+    if (threads > NET_DECODE_MAX_THREADS)
+        threads = NET_DECODE_MAX_THREADS;
+
+    if (!(net_decoded = malloc(NET_DECODE_WINDOW * sizeof (*net_decoded)))) {
+        fprintf(stderr, "Out of memory allocating the network decode window\n");
+        return false;
+    }
+
+    net_decode_halt = false;
+    net_decode_slices[0].ready = true;
+    for (net_decode_threads = 1; net_decode_threads < threads; ++net_decode_threads) {
+        struct net_decode_slice *slice = &net_decode_slices[net_decode_threads];
+        int rc = pthread_create(&slice->thread, NULL, netDecodeEntryPoint, slice);
+        if (rc) {
+            fprintf(stderr, "Network decoding: can't create thread: %s\n", strerror(rc));
+            stopDecodeThreads();
+            return false;
         }
+        thread_place(slice->thread, THREAD_DECODE);
     }
 
-    serviceReconnectCallback(now);
+    return true;
+}
+
+// Decode the first count frames of the window, in parallel
+
+static void decodeWindow(unsigned count) {
+    unsigned per = (count + net_decode_threads - 1) / net_decode_threads;
+
+    net_decode_received = mstime();
+    for (unsigned i = 0; i < count; ++i) {
+        struct net_decoded *d = &net_decoded[i];
+        char *p = (char *) (d->record + 1);
+        int msgLen = decodeAheadLength(p);
+
+        if (!msgLen)
+            d->result = NET_DECODE_DEFER;
+        else if (Modes.net_dedup_window && netDuplicate((unsigned char *) p + 8, msgLen, net_decode_received)) {
+            beastFrameMessage(p + 1, 1, net_decode_received, &d->mm); // for its signal level
+            d->result = NET_DECODE_DUPLICATE;
+        } else
+            d->result = NET_DECODE_AHEAD;
+    }
+
+    for (int i = 0; i < net_decode_threads; ++i) {
+        struct net_decode_slice *slice = &net_decode_slices[i];
+        unsigned from = min(i * per, count);
+
+        slice->from = net_decoded + from;
+        slice->count = min(per, count - from);
+    }
+
+    pthread_mutex_lock(&net_decode_mutex);
+    net_decode_pending = net_decode_threads - 1;
+    net_decode_generation++;
+    pthread_cond_broadcast(&net_decode_work_cond);
+    pthread_mutex_unlock(&net_decode_mutex);
+
+    decodeSlice(&net_decode_slices[0]);
+
+    pthread_mutex_lock(&net_decode_mutex);
+    while (net_decode_pending)
+        pthread_cond_wait(&net_decode_done_cond, &net_decode_mutex);
+    pthread_mutex_unlock(&net_decode_mutex);
+
+    for (int i = 1; i < net_decode_threads; ++i) {
+        if (!net_decode_slices[i].ready)
+            decodeSlice(&net_decode_slices[i]);
+    }
+
+    for (int i = 0; i < net_decode_threads; ++i)
+        add_stats(&Modes.stats_current, &net_decode_slices[i].stats.st, &Modes.stats_current);
 }
 
-void writeJsonToNet(struct net_writer *writer, struct char_buffer cb) {
-    int len = cb.len;
-    int written = 0;
-    char *content = cb.buffer;
-    char *pos;
-    int bytes = MODES_OUT_BUF_SIZE / 2;
+// Pass on a message decoded ahead, as decodeBeastFrame() would have
+
+static void deliverDecoded(struct net_decoded *d) {
+    struct client *c = d->record->client;
+    char *p = (char *) (d->record + 1);
+    unsigned char msg[MODES_LONG_MSG_BYTES];
 
-    char *p = prepareWrite(writer, bytes);
-    if (!p) {
-        free(content);
+    if (!c->service)
+        return;
+
+    if (d->result == NET_DECODE_DEFER) {
+        // decodeBinMessage() never asks for the client to be closed
+        c->service->read_handler(c, p, 1);
         return;
     }
 
-    pos = content;
+    beastSignalStats(&d->mm);
+    Modes.stats_current.remote_received_modes++;
+    if (d->result == NET_DECODE_DUPLICATE) {
+        Modes.stats_current.remote_duplicates++;
+        return;
+    }
 
-    while (p && written < len) {
-        if (bytes > len - written) {
-            bytes = len - written;
-        }
-        memcpy(p, pos, bytes);
-        p += bytes;
-        pos += bytes;
-        written += bytes;
-        completeWrite(writer, p);
+    if (d->result == -1) {
+        // a message passed on before this one may have added its address
+        memcpy(msg, beastFrameMessage(p + 1, 1, net_decode_received, &d->mm), decodeAheadLength(p));
+        d->result = decodeModesMessage(&d->mm, msg);
+    } else if (d->result == 0) {
+        decodeAheadFinish(&d->mm);
+    }
 
-        p = prepareWrite(writer, bytes);
+    if (d->result < 0) {
+        if (d->result == -1)
+            Modes.stats_current.remote_rejected_unknown_icao++;
+        else
+            Modes.stats_current.remote_rejected_bad++;
+        return;
     }
 
-    flushWrites(writer);
-    free(content);
+    Modes.stats_current.remote_accepted[d->mm.correctedbits]++;
+    useModesMessage(&d->mm);
 }
 
-struct char_buffer generateVRS(int part, int n_parts) {
-    struct char_buffer cb;
-    uint64_t now = mstime();
-    struct aircraft *a;
-    int buflen = 256 * 1024; // The initial buffer is resized as needed
-    char *buf = (char *) malloc(buflen), *p = buf, *end = buf + buflen;
-    char *line_start;
-    int first = 1;
-    int part_len = AIRCRAFTS_BUCKETS / n_parts;
-    int part_start = part * part_len;
+static void netDrainInput(void) {
+    struct net_input *in;
+    size_t off, end;
 
-    _messageNow = now;
+    if (!net_io_threaded)
+        return;
+
+    pthread_mutex_lock(&net_io_mutex);
+    in = net_input_fill;
+    net_input_fill = (in == &net_inputs[0]) ? &net_inputs[1] : &net_inputs[0];
+    Modes.stats_current.remote_rejected_bad += in->garbage;
+    in->garbage = 0;
+    Modes.stats_current.remote_udp_lost += in->udp_lost;
+    in->udp_lost = 0;
+    pthread_cond_signal(&net_io_space_cond);
+    pthread_mutex_unlock(&net_io_mutex);
+
+    for (off = 0; off < in->len; off = end) {
+        unsigned count = 0, next = 0;
+
+        // Decode the next window of Beast frames ahead, if it is worth it
+        end = in->len;
+        if (net_decode_threads > 1) {
+            for (end = off; end < in->len && count < NET_DECODE_WINDOW; end += NET_RECORD_SIZE(((struct net_record *) (in->data + end))->len)) {
+                struct net_record *r = (struct net_record *) (in->data + end);
+                if (netDecodeAhead(r))
+                    net_decoded[count++].record = r;
+            }
+            if (count >= NET_DECODE_MIN * (unsigned) net_decode_threads)
+                decodeWindow(count);
+            else
+                count = 0;
+        }
 
-    p = safe_snprintf(p, end,
-            "{\"acList\":[");
+        for (; off < end; off += NET_RECORD_SIZE(((struct net_record *) (in->data + off))->len)) {
+            struct net_record *r = (struct net_record *) (in->data + off);
+            struct client *c = r->client;
+            char *data = (char *) (r + 1);
 
-    for (int j = part_start; j < part_start + part_len; j++) {
-        for (a = Modes.aircrafts[j]; a; a = a->next) {
-            if (a->meta.messages < 2) { // basic filter for bad decodes
+            if (next < count && net_decoded[next].record == r) {
+                deliverDecoded(&net_decoded[next++]);
                 continue;
             }
-            if ((now - a->meta.seen) > 5E3) // don't include stale aircraft in output
-                continue;
 
-            // For now, suppress non-ICAO addresses
-            if (a->meta.addr & MODES_NON_ICAO_ADDRESS)
-                continue;
+            switch (r->type) {
+                case NET_RECORD_MESSAGE:
+                    if (c->service && c->service->read_handler(c, data, r->remote)) {
+                        netLock();
+                        modesCloseClient(c);
+                        netUnlock();
+                    }
+                    break;
 
-            if (first)
-                first = 0;
-            else
-                *p++ = ',';
+                case NET_RECORD_CLOSE:
+                    netLock();
+                    if (c->service)
+                        modesCloseClient(c);
+                    netUnlock();
+                    break;
+
+                case NET_RECORD_ACCEPT:
+                    clientAccepted(r->service, r->fd, data, data + strlen(data) + 1);
+                    break;
+            }
+        }
+    }
+
+    // the records no longer refer to their clients
+    pthread_mutex_lock(&net_io_mutex);
+    for (off = 0; off < in->len; off += NET_RECORD_SIZE(((struct net_record *) (in->data + off))->len)) {
+        struct net_record *r = (struct net_record *) (in->data + off);
+        if (r->client)
+            r->client->refs--;
+    }
+    pthread_mutex_unlock(&net_io_mutex);
+    in->len = 0;
+}
+
+static void *netIoThreadEntryPoint(void *arg) {
+    (void) arg;
+    net_io_self = true;
 
-retry:
-            line_start = p;
-            p = safe_snprintf(p, end, "{\"Sig\":%.0f",
-                    255 * ((a->signalLevel[0] + a->signalLevel[1] + a->signalLevel[2] + a->signalLevel[3] +
-                    a->signalLevel[4] + a->signalLevel[5] + a->signalLevel[6] + a->signalLevel[7] + 1e-5) / 8));
+    while (!Modes.exit) {
+        pthread_mutex_lock(&net_io_mutex);
+        // stop reading while the main thread is behind
+        while (net_input_fill->len >= NET_INPUT_MAX && !net_io_stop && !Modes.exit)
+            pthread_cond_wait(&net_io_space_cond, &net_io_mutex);
+        bool stop = net_io_stop;
+        pthread_mutex_unlock(&net_io_mutex);
 
-            p = safe_snprintf(p, end, ",\"Icao\":\"%s%06X\"", (a->meta.addr & MODES_NON_ICAO_ADDRESS) ? "~" : "", a->meta.addr & 0xFFFFFF);
+        if (stop || !netPollDispatch(100))
+            break;
+    }
 
-            if (trackDataValid(&a->altitude_baro_valid) && a->altitude_baro_reliable >= 3)
-                p = safe_snprintf(p, end, ",\"Alt\":%d", a->meta.alt_baro);
-            if (trackDataValid(&a->altitude_geom_valid))
-                p = safe_snprintf(p, end, ",\"GAlt\":%d", a->meta.alt_geom);
+    atomic_store(&net_io_running, false);
+    return NULL;
+}
 
+// Move socket I/O to its own thread, and start the threads decoding its
+// input ahead if asked to. Without a poller it stays on the main thread,
+// which is not an error.
 
-            if (trackDataValid(&a->nav_qnh_valid))
-                p = safe_snprintf(p, end, ",\"InHg\":%.2f", a->meta.nav_qnh * 0.02952998307);
+bool modesNetStartThread(void) {
+    if (!netPollActive()) {
+        if (Modes.net_ingest_threads > 1)
+            fprintf(stderr, "--net-ingest-threads needs the network I/O thread, decoding on the main thread only\n");
+        return true;
+    }
 
-            //p = safe_snprintf(p, end, ",\"AltT\":%d", 0);
+    if (pipe(net_io_wakeup) < 0) {
+        fprintf(stderr, "Network I/O thread: pipe failed: %s\n", strerror(errno));
+        return false;
+    }
+    anetNonBlock(Modes.aneterr, net_io_wakeup[0]);
+    anetNonBlock(Modes.aneterr, net_io_wakeup[1]);
 
-            if (trackDataValid(&a->nav_altitude_mcp_valid)) {
-                p = safe_snprintf(p, end, ",\"TAlt\":%d", a->meta.nav_altitude_mcp);
-            } else if (trackDataValid(&a->nav_altitude_fms_valid)) {
-                p = safe_snprintf(p, end, ",\"TAlt\":%d", a->meta.nav_altitude_fms);
-            }
+    netPollEntry(net_io_wakeup[0])->wakeup = true;
+    netPollSet(net_io_wakeup[0], NET_POLL_READ);
 
-            if (trackDataValid(&a->callsign_valid)) {
-                p = safe_snprintf(p, end, ",\"Call\":\"%s\"", jsonEscapeString(a->callsign));
-                //p = safe_snprintf(p, end, ",\"CallSus\":false");
-            }
+    net_io_threaded = true;
+    atomic_store(&net_io_running, true);
+    int rc = pthread_create(&net_io_thread, NULL, netIoThreadEntryPoint, NULL);
+    if (rc) {
+        fprintf(stderr, "Network I/O thread: pthread_create failed: %s\n", strerror(rc));
+        atomic_store(&net_io_running, false);
+        net_io_threaded = false;
+        return false;
+    }
+    thread_place(net_io_thread, THREAD_NET_IO);
 
-            if (trackDataValid(&a->position_valid)) {
-                p = safe_snprintf(p, end, ",\"Lat\":%f,\"Long\":%f", a->meta.lat, a->meta.lon);
-                p = safe_snprintf(p, end, ",\"PosTime\":%"PRIu64, a->position_valid.updated);
-            }
+    if (Modes.net_ingest_threads > 1 && !startDecodeThreads(Modes.net_ingest_threads))
+        return false;
 
-            if (a->position_valid.source == SOURCE_MLAT)
-                p = safe_snprintf(p, end, ",\"Mlat\":true");
-            else
-                p = safe_snprintf(p, end, ",\"Mlat\":false");
-            if (a->position_valid.source == SOURCE_TISB)
-                p = safe_snprintf(p, end, ",\"Tisb\":true");
-            else
-                p = safe_snprintf(p, end, ",\"Tisb\":false");
-
-
-            if (trackDataValid(&a->gs_valid)) {
-                p = safe_snprintf(p, end, ",\"Spd\":%d", a->meta.gs);
-                p = safe_snprintf(p, end, ",\"SpdTyp\":0");
-            } else if (trackDataValid(&a->ias_valid)) {
-                p = safe_snprintf(p, end, ",\"Spd\":%u", a->meta.ias);
-                p = safe_snprintf(p, end, ",\"SpdTyp\":2");
-            } else if (trackDataValid(&a->tas_valid)) {
-                p = safe_snprintf(p, end, ",\"Spd\":%u", a->meta.tas);
-                p = safe_snprintf(p, end, ",\"SpdTyp\":3");
-            }
+    return true;
+}
 
-            if (trackDataValid(&a->track_valid)) {
-                p = safe_snprintf(p, end, ",\"Trak\":%d", a->meta.track);
-                p = safe_snprintf(p, end, ",\"TrkH\":false");
-            } else if (trackDataValid(&a->mag_heading_valid)) {
-                p = safe_snprintf(p, end, ",\"Trak\":%d", a->meta.mag_heading);
-                p = safe_snprintf(p, end, ",\"TrkH\":true");
-            } else if (trackDataValid(&a->true_heading_valid)) {
-                p = safe_snprintf(p, end, ",\"Trak\":%d", a->meta.true_heading);
-                p = safe_snprintf(p, end, ",\"TrkH\":true");
-            }
+static void modesNetStopThread(void) {
+    if (!net_io_threaded)
+        return;
 
-            if (trackDataValid(&a->nav_heading_valid))
-                p = safe_snprintf(p, end, ",\"TTrk\":%d", a->meta.nav_heading);
+    pthread_mutex_lock(&net_io_mutex);
+    net_io_stop = true;
+    pthread_cond_broadcast(&net_io_space_cond);
+    pthread_mutex_unlock(&net_io_mutex);
+    if (write(net_io_wakeup[1], "", 1) < 0) {
+        // the thread wakes up on its own within 100ms
+    }
+    pthread_join(net_io_thread, NULL);
+
+    netDrainInput();
+    if (net_decoded)
+        stopDecodeThreads();
+    net_io_threaded = false;
+    close(net_io_wakeup[0]);
+    close(net_io_wakeup[1]);
+    net_io_wakeup[0] = net_io_wakeup[1] = -1;
+    for (int i = 0; i < 2; ++i) {
+        free(net_inputs[i].data);
+        memset(&net_inputs[i], 0, sizeof (net_inputs[i]));
+    }
+}
 
-            if (trackDataValid(&a->squawk_valid))
-                p = safe_snprintf(p, end, ",\"Sqk\":\"%04x\"", a->meta.squawk);
+// If we have data that has been waiting to be written for a while,
+// write it now. Returns ms until the next writer is due, or -1 if none are.
 
-            if (trackDataValid(&a->geom_rate_valid)) {
-                p = safe_snprintf(p, end, ",\"Vsi\":%d", a->meta.geom_rate);
-                p = safe_snprintf(p, end, ",\"VsiT\":1");
-            } else if (trackDataValid(&a->baro_rate_valid)) {
-                p = safe_snprintf(p, end, ",\"Vsi\":%d", a->meta.baro_rate);
-                p = safe_snprintf(p, end, ",\"VsiT\":0");
-            }
+static int flushWaitingWrites(uint64_t now) {
+    int due = -1;
+
+    for (struct net_service *s = Modes.services; s; s = s->next) {
+        if (!s->writer || !s->writer->dataUsed)
+            continue;
+        if ((s->writer->lastWrite + Modes.net_output_flush_interval) <= now) {
+            flushWrites(s->writer);
+        } else {
+            int left = s->writer->lastWrite + Modes.net_output_flush_interval - now;
+            if (due < 0 || left < due)
+                due = left;
+        }
+    }
+    return due;
+}
 
+//
+// VRS json output
+//
+// Every 1000 / VRS_PARTS ms one part of the aircraft, a fixed share of the
+// addresses, goes to the VRS clients as {"acList":[...]}. The records are
+// written straight into the writer buffer, and a copy of each is kept in
+// an arena of its part. In the next round of the part, the record of an
+// aircraft that hasn't changed is copied from there instead of being
+// formatted again: no change to its generation or message count, and none
+// of the data shown expired since. The arenas are kept and reused.
+//
 
-            if (trackDataValid(&a->airground_valid) && a->airground_valid.source >= SOURCE_MODE_S_CHECKED && a->meta.air_ground == AIRCRAFT_META__AIR_GROUND__AG_GROUND)
-                p = safe_snprintf(p, end, ",\"Gnd\":true");
-            else
-                p = safe_snprintf(p, end, ",\"Gnd\":false");
+#define VRS_PARTS 8 // must be power of 2
+#define VRS_RECORD_MAX 1024 // room for the record of one aircraft
 
-            if (a->adsb_version >= 0)
-                p = safe_snprintf(p, end, ",\"Trt\":%d", a->adsb_version + 3);
-            else
-                p = safe_snprintf(p, end, ",\"Trt\":%d", 1);
+struct vrs_arena {
+    char *data;
+    uint32_t len;
+    uint32_t size;
+};
+
+// Per part, the records of the last round and of the one being written
+static struct vrs_arena vrs_arenas[VRS_PARTS][2];
+static uint32_t vrs_rounds[VRS_PARTS];
+
+static void vrsArenaAppend(struct vrs_arena *arena, const char *record, uint32_t len) {
+    if (arena->len + len > arena->size) {
+        uint32_t size = arena->size ? arena->size : 64 * 1024;
+        char *data;
+
+        while (size < arena->len + len)
+            size *= 2;
+        if (!(data = realloc(arena->data, size))) {
+            fprintf(stderr, "Out of memory growing the VRS output arena\n");
+            exit(1);
+        }
+        arena->data = data;
+        arena->size = size;
+    }
+    memcpy(arena->data + arena->len, record, len);
+    arena->len += len;
+}
+
+static void vrsCleanup(void) {
+    for (int i = 0; i < VRS_PARTS; ++i) {
+        for (int j = 0; j < 2; ++j) {
+            free(vrs_arenas[i][j].data);
+            vrs_arenas[i][j].data = NULL;
+            vrs_arenas[i][j].len = vrs_arenas[i][j].size = 0;
+        }
+    }
+}
+
+// trackDataValid(), noting when data that is valid expires: the record
+// changes then even without a new message
+
+static inline int vrsDataValid(uint64_t *expires, const data_validity *v) {
+    if (!trackDataValid(v))
+        return 0;
+    if (v->expires < *expires)
+        *expires = v->expires;
+    return 1;
+}
+
+// Format the record of an aircraft at p, with room up to end
 
+static char *vrsRecord(char *p, char *end, struct aircraft *a, uint64_t *expires) {
+    p = safe_snprintf(p, end, "{\"Sig\":%.0f",
+            255 * ((a->signalLevel[0] + a->signalLevel[1] + a->signalLevel[2] + a->signalLevel[3] +
+            a->signalLevel[4] + a->signalLevel[5] + a->signalLevel[6] + a->signalLevel[7] + 1e-5) / 8));
 
-            p = safe_snprintf(p, end, ",\"Cmsgs\":%" PRIu64, a->meta.messages);
+    p = safe_snprintf(p, end, ",\"Icao\":\"%s%06X\"", (a->meta.addr & MODES_NON_ICAO_ADDRESS) ? "~" : "", a->meta.addr & 0xFFFFFF);
 
-            p = safe_snprintf(p, end, "}");
+    if (vrsDataValid(expires, &a->altitude_baro_valid) && a->altitude_baro_reliable >= 3)
+        p = safe_snprintf(p, end, ",\"Alt\":%d", a->meta.alt_baro);
+    if (vrsDataValid(expires, &a->altitude_geom_valid))
+        p = safe_snprintf(p, end, ",\"GAlt\":%d", a->meta.alt_geom);
 
-            if ((p + 10) >= end) { // +10 to leave some space for the final line
-                // overran the buffer
-                int used = line_start - buf;
-                buflen *= 2;
-                buf = (char *) realloc(buf, buflen);
-                p = buf + used;
-                end = buf + buflen;
-                goto retry;
+
+    if (vrsDataValid(expires, &a->nav_qnh_valid))
+        p = safe_snprintf(p, end, ",\"InHg\":%.2f", a->meta.nav_qnh * 0.02952998307);
+
+    //p = safe_snprintf(p, end, ",\"AltT\":%d", 0);
+
+    if (vrsDataValid(expires, &a->nav_altitude_mcp_valid)) {
+        p = safe_snprintf(p, end, ",\"TAlt\":%d", a->meta.nav_altitude_mcp);
+    } else if (vrsDataValid(expires, &a->nav_altitude_fms_valid)) {
+        p = safe_snprintf(p, end, ",\"TAlt\":%d", a->meta.nav_altitude_fms);
+    }
+
+    if (vrsDataValid(expires, &a->callsign_valid)) {
+        p = safe_snprintf(p, end, ",\"Call\":\"%s\"", jsonEscapeString(a->callsign));
+        //p = safe_snprintf(p, end, ",\"CallSus\":false");
+    }
+
+    if (vrsDataValid(expires, &a->position_valid)) {
+        p = safe_snprintf(p, end, ",\"Lat\":%f,\"Long\":%f", a->meta.lat, a->meta.lon);
+        p = safe_snprintf(p, end, ",\"PosTime\":%"PRIu64, a->position_valid.updated);
+    }
+
+    if (a->position_valid.source == SOURCE_MLAT)
+        p = safe_snprintf(p, end, ",\"Mlat\":true");
+    else
+        p = safe_snprintf(p, end, ",\"Mlat\":false");
+    if (a->position_valid.source == SOURCE_TISB)
+        p = safe_snprintf(p, end, ",\"Tisb\":true");
+    else
+        p = safe_snprintf(p, end, ",\"Tisb\":false");
+
+
+    if (vrsDataValid(expires, &a->gs_valid)) {
+        p = safe_snprintf(p, end, ",\"Spd\":%d", a->meta.gs);
+        p = safe_snprintf(p, end, ",\"SpdTyp\":0");
+    } else if (vrsDataValid(expires, &a->ias_valid)) {
+        p = safe_snprintf(p, end, ",\"Spd\":%u", a->meta.ias);
+        p = safe_snprintf(p, end, ",\"SpdTyp\":2");
+    } else if (vrsDataValid(expires, &a->tas_valid)) {
+        p = safe_snprintf(p, end, ",\"Spd\":%u", a->meta.tas);
+        p = safe_snprintf(p, end, ",\"SpdTyp\":3");
+    }
+
+    if (vrsDataValid(expires, &a->track_valid)) {
+        p = safe_snprintf(p, end, ",\"Trak\":%d", a->meta.track);
+        p = safe_snprintf(p, end, ",\"TrkH\":false");
+    } else if (vrsDataValid(expires, &a->mag_heading_valid)) {
+        p = safe_snprintf(p, end, ",\"Trak\":%d", a->meta.mag_heading);
+        p = safe_snprintf(p, end, ",\"TrkH\":true");
+    } else if (vrsDataValid(expires, &a->true_heading_valid)) {
+        p = safe_snprintf(p, end, ",\"Trak\":%d", a->meta.true_heading);
+        p = safe_snprintf(p, end, ",\"TrkH\":true");
+    }
+
+    if (vrsDataValid(expires, &a->nav_heading_valid))
+        p = safe_snprintf(p, end, ",\"TTrk\":%d", a->meta.nav_heading);
+
+    if (vrsDataValid(expires, &a->squawk_valid))
+        p = safe_snprintf(p, end, ",\"Sqk\":\"%04x\"", a->meta.squawk);
+
+    if (vrsDataValid(expires, &a->geom_rate_valid)) {
+        p = safe_snprintf(p, end, ",\"Vsi\":%d", a->meta.geom_rate);
+        p = safe_snprintf(p, end, ",\"VsiT\":1");
+    } else if (vrsDataValid(expires, &a->baro_rate_valid)) {
+        p = safe_snprintf(p, end, ",\"Vsi\":%d", a->meta.baro_rate);
+        p = safe_snprintf(p, end, ",\"VsiT\":0");
+    }
+
+
+    if (vrsDataValid(expires, &a->airground_valid) && a->airground_valid.source >= SOURCE_MODE_S_CHECKED && a->meta.air_ground == AIRCRAFT_META__AIR_GROUND__AG_GROUND)
+        p = safe_snprintf(p, end, ",\"Gnd\":true");
+    else
+        p = safe_snprintf(p, end, ",\"Gnd\":false");
+
+    if (a->adsb_version >= 0)
+        p = safe_snprintf(p, end, ",\"Trt\":%d", a->adsb_version + 3);
+    else
+        p = safe_snprintf(p, end, ",\"Trt\":%d", 1);
+
+
+    p = safe_snprintf(p, end, ",\"Cmsgs\":%" PRIu64, a->meta.messages);
+
+    p = safe_snprintf(p, end, "}");
+
+    return p;
+}
+
+// Write one part of the aircraft to the VRS clients
+
+static void writeVRS(struct net_writer *writer, int part) {
+    uint64_t now = mstime();
+    uint32_t round = vrs_rounds[part] + 1;
+    struct vrs_arena *last = &vrs_arenas[part][vrs_rounds[part] & 1];
+    struct vrs_arena *arena = &vrs_arenas[part][round & 1];
+    bool first = true;
+    char *p;
+
+    _messageNow = now;
+
+    if (!(p = prepareWrite(writer, 16)))
+        return;
+    vrs_rounds[part] = round;
+    arena->len = 0;
+
+    p = safe_snprintf(p, p + 16, "{\"acList\":[");
+    completeWrite(writer, p);
+
+    for (uint32_t j = 0; j < Modes.aircraft_count; j++) {
+        struct aircraft_entry *e = &Modes.aircraft_table[j];
+        struct aircraft *a;
+        uint32_t len;
+
+        // each part holds a fixed share of the addresses
+        if ((e->addr & (VRS_PARTS - 1)) != (uint32_t) part)
+            continue;
+        if (e->messages < 2) { // basic filter for bad decodes
+            continue;
+        }
+        if ((now - e->seen) > 5E3) // don't include stale aircraft in output
+            continue;
+        a = e->a;
+
+        // For now, suppress non-ICAO addresses
+        if (a->meta.addr & MODES_NON_ICAO_ADDRESS)
+            continue;
+
+        if (!(p = prepareWrite(writer, VRS_RECORD_MAX + 1)))
+            return;
+
+        if (first)
+            first = false;
+        else
+            *p++ = ',';
+
+        if (a->vrs_len && a->vrs_round == round - 1 && a->vrs_generation == a->generation &&
+                a->vrs_messages == a->meta.messages && now < a->vrs_expires) {
+            len = a->vrs_len;
+            memcpy(p, last->data + a->vrs_offset, len);
+        } else {
+            uint64_t expires = UINT64_MAX;
+
+            len = vrsRecord(p, p + VRS_RECORD_MAX, a, &expires) - p;
+            a->vrs_generation = a->generation;
+            a->vrs_messages = a->meta.messages;
+            a->vrs_expires = expires;
+        }
+
+        a->vrs_round = round;
+        a->vrs_offset = arena->len;
+        a->vrs_len = len;
+        vrsArenaAppend(arena, p, len);
+        completeWrite(writer, p + len);
+    }
+
+    if (!(p = prepareWrite(writer, 16)))
+        return;
+    p = safe_snprintf(p, p + 16, "]}\n");
+    completeWrite(writer, p);
+    flushWrites(writer);
+}
+
+//
+// Perform periodic network work
+//
+
+void modesNetPeriodicWork(void) {
+    struct client *c;
+    struct net_service *s;
+    uint64_t now = mstime();
+    static uint64_t next_tcp_json;
+    static uint64_t next_accept;
+
+    // Handle what the I/O thread received, or service whatever the poller
+    // has for us, otherwise accept new connections and read from and
+    // flush all clients
+    netDrainInput();
+    if (!netThreadRunning() && !netPollDispatch(0)) {
+        if (now > next_accept) {
+            next_accept = modesAcceptClients(now);
+        }
+
+        for (s = Modes.services; s; s = s->next) {
+            for (c = s->clients; c; c = c->next) {
+                if (!c->service)
+                    continue;
+
+                if (s->read_handler) {
+                    modesReadFromClient(c);
+                }
+
+                // If there is a sendq, try to flush it
+                if (s->writer) {
+                    if (c->sendq_len == 0) {
+                        c->last_flush = now;
+                        continue;
+                    }
+                    flushClient(c, now);
+                }
             }
         }
     }
 
-    p = safe_snprintf(p, end, "]}\n");
+    // Generate FATSV output
+    writeFATSV();
+
+    // and the protocol buffer stream
+    writePbStream();
+
+    // supply JSON to vrs_out writer
+    if (Modes.vrs_out.service && Modes.vrs_out.service->connections && now >= next_tcp_json) {
+        static int part;
+        writeVRS(&Modes.vrs_out, part);
+        if (++part >= VRS_PARTS)
+            part = 0;
+        next_tcp_json = now + 1000 / VRS_PARTS;
+    }
+
+    flushWaitingWrites(now);
 
-    cb.len = p - buf;
-    cb.buffer = buf;
-    return cb;
+    serviceReconnectCallback(now);
 }
 
 //
-// =============================== Network IO ===========================
+// Print the SendQ of every output client, as part of the periodic stats
 //
 
-static void *pthreadGetaddrinfo(void *param) {
-    struct net_connector *con = (struct net_connector *) param;
+void modesNetShowClients(void) {
+    bool header = false;
 
-    struct addrinfo gai_hints;
+    netLock();
+    for (struct net_service *s = Modes.services; s; s = s->next) {
+        if (!s->writer)
+            continue;
+        for (struct client *c = s->clients; c; c = c->next) {
+            if (!c->service)
+                continue;
+            if (!header) {
+                printf("Network output clients:\n");
+                header = true;
+            }
+            printf("  %s %s port %s: SendQ %d bytes (peak %d of %d), %" PRIu64 " bytes dropped\n",
+                    s->descr, c->host, c->port, c->sendq_len, c->sendq_peak, c->sendq_max, c->sendq_dropped);
+            c->sendq_peak = c->sendq_len;
+        }
+    }
+    netUnlock();
 
-    gai_hints.ai_family = AF_UNSPEC;
-    gai_hints.ai_socktype = SOCK_STREAM;
-    gai_hints.ai_protocol = 0;
-    gai_hints.ai_flags = 0;
-    gai_hints.ai_addrlen = 0;
-    gai_hints.ai_addr = NULL;
-    gai_hints.ai_canonname = NULL;
-    gai_hints.ai_next = NULL;
+    if (Modes.net_connectors_count)
+        printf("Network connectors:\n");
+    for (int i = 0; i < Modes.net_connectors_count; i++) {
+        struct net_connector *con = Modes.net_connectors[i];
+        printf("  %s %s port %s: ", con->protocol, con->address, con->port);
+        if (con->connected)
+            printf("connected to %s%s", con->address, con->resolved_addr);
+        else if (con->connecting)
+            printf("connecting, %d of %d addresses tried", con->try_next, con->answer.count);
+        else
+            printf("retrying in %.1f s", (con->next_reconnect > mstime() ? con->next_reconnect - mstime() : 0) / 1000.0);
+        printf(", %u connections, %u rounds failed in a row\n", con->connects, con->failures);
+    }
+}
 
-    con->gai_error = getaddrinfo(con->address, con->port, &gai_hints, &con->addr_info);
+//
+// Sleep for up to timeout_ms, servicing network input and output as soon
+// as it arrives rather than on the next call to modesNetPeriodicWork()
+//
 
-    pthread_mutex_unlock(con->mutex);
-    return NULL;
+void modesNetWait(int64_t timeout_ms) {
+    uint64_t deadline = mstime() + timeout_ms;
+    uint64_t now;
+
+    if (!netPollActive()) {
+        struct timespec slp = {timeout_ms / 1000, (timeout_ms % 1000) * 1000 * 1000};
+        nanosleep(&slp, NULL);
+        return;
+    }
+
+    while (!Modes.exit && (now = mstime()) < deadline) {
+        int wait = deadline - now;
+        int due = flushWaitingWrites(now);
+
+        if (due >= 0 && due < wait)
+            wait = due;
+
+        if (netThreadRunning()) {
+            struct timespec ts;
+
+            get_deadline(wait, &ts);
+            pthread_mutex_lock(&net_io_mutex);
+            if (!net_input_fill->len)
+                pthread_cond_timedwait(&net_io_input_cond, &net_io_mutex, &ts);
+            pthread_mutex_unlock(&net_io_mutex);
+            netDrainInput();
+        } else if (!netPollDispatch(wait)) {
+            break;
+        }
+    }
 }
 
+//
+// =============================== Network IO ===========================
+//
+
 inline void cleanupNetwork(void) {
+    modesNetStopThread();
+
+    for (int i = 0; i < 2; ++i) {
+        free(net_dedup_sets[i]);
+        net_dedup_sets[i] = NULL;
+    }
+
     for (struct net_service *s = Modes.services; s; s = s->next) {
         struct client *c = s->clients, *nc;
         while (c) {
             nc = c->next;
 
             anetCloseSocket(c->fd);
-            c->sendq_len = 0;
-            if (c->sendq) {
-                free(c->sendq);
-                c->sendq = NULL;
-            }
-            free(c);
+            if (c->service)
+                clientReleaseSendQ(c);
+            clientFree(c);
 
             c = nc;
         }
     }
 
+    udpOutputCleanup();
+    vrsCleanup();
+    pbCleanup();
+    historyCleanup();
+    httpCleanup();
+    pbStreamCleanup();
+
     struct net_service *s = Modes.services, *ns;
     while (s) {
         ns = s->next;
@@ -3426,23 +6754,31 @@ inline void cleanupNetwork(void) {
             free(s->writer->data);
             s->writer->data = NULL;
         }
+        if (s->writer && s->writer->pos_data) {
+            free(s->writer->pos_data);
+            s->writer->pos_data = NULL;
+        }
+        if (s->writer && s->writer->zstream) {
+            deflateEnd(s->writer->zstream);
+            free(s->writer->zstream);
+            s->writer->zstream = NULL;
+        }
+        if (s->writer && s->writer->udp_ends) {
+            free(s->writer->udp_ends);
+            s->writer->udp_ends = NULL;
+        }
         if (s) free(s);
         s = ns;
     }
 
     for (int i = 0; i < Modes.net_connectors_count; i++) {
         struct net_connector *con = Modes.net_connectors[i];
+        while (con->attempts)
+            connectorDropAttempt(con, 0);
         free(con->address);
-        if (con->addr_info) {
-            freeaddrinfo(con->addr_info);
-            con->addr_info = NULL;
-        }
-        if (con->mutex) {
-            pthread_mutex_unlock(con->mutex);
-            pthread_mutex_destroy(con->mutex);
-            free(con->mutex);
-        }
         free(con);
     }
     free(Modes.net_connectors);
+    resolveCleanup();
+    netPollCleanup();
 }
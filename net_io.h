@@ -64,6 +64,7 @@ struct net_service {
     int read_sep_len;
     const char *descr;
     struct client *clients; // linked list of clients connected to this service
+    bool compressed; // its clients send zlib compressed data, see clientCompress()
 };
 
 // Client connection
@@ -75,16 +76,22 @@ struct net_connector {
     struct net_service *service;
     int connected;
     int connecting;
-    int fd;
+    int fd; // of the connection, once connected
     uint64_t next_reconnect;
     uint64_t connect_timeout;
     char resolved_addr[NI_MAXHOST + 3];
-    struct addrinfo *addr_info;
-    struct addrinfo *try_addr; // pointer walking addr_info list
-    int gai_error;
-    int gai_request_in_progress;
-    pthread_t thread;
-    pthread_mutex_t *mutex;
+    // One round of connecting goes through the addresses of answer, starting
+    // the next one NET_CONNECT_STAGGER after the last or when all those in
+    // flight failed, and takes the first that connects
+    struct resolve_answer answer;
+    int try_next; // next address of answer to start
+    int attempts; // connects in flight
+    int attempt_fd[RESOLVE_MAX_ADDRS];
+    int attempt_addr[RESOLVE_MAX_ADDRS]; // their address in answer
+    uint64_t next_attempt; // when to start another address alongside
+    uint32_t failures; // rounds failed in a row, for the backoff
+    bool compressed; // a _zlib_ protocol, the stream is zlib compressed
+    uint32_t connects; // connections established
 };
 
 // Structure used to describe a networking client
@@ -94,17 +101,63 @@ struct client {
     struct client* next; // Pointer to next client
     int fd; // File descriptor
     int buflen; // Amount of data on buffer
+    int beast_need; // Buffered bytes a pending Beast frame needs before it is worth scanning again
     int modeac_requested; // 1 if this Beast output connection has asked for A/C
     uint64_t last_flush;
     uint64_t last_send;
     uint64_t last_read; // This is used on write-only clients to help check for dead connections
     char buf[MODES_CLIENT_BUF_SIZE + 4]; // Read buffer+padding
-    void *sendq; // Write buffer - allocated later
+    struct net_segment **sendq; // Ring of queued output segments, oldest first
+    unsigned sendq_head; // Index of the oldest segment
+    unsigned sendq_count; // Segments queued
+    unsigned sendq_size; // Ring slots, a power of two
+    int sendq_offset; // Bytes of the oldest segment already written
     int sendq_len; // Amount of data in SendQ
     int sendq_max; // Max size of SendQ
+    int sendq_peak; // Most data in SendQ since the last client report
+    uint64_t sendq_dropped; // Bytes the SendQ policy dropped for this client
+    uint64_t bytes_received; // Read from it, after inflating compressed input
+    uint64_t bytes_sent; // Written to it, by the network I/O thread
     char host[NI_MAXHOST]; // For logging
     char port[NI_MAXSERV];
     struct net_connector *con;
+    int refs; // Records and flush requests of the network I/O thread naming this client
+    bool io_failed; // The I/O thread saw it fail, the main thread is yet to close it
+    bool flush_queued; // Waiting to be written by the I/O thread
+    struct client *flush_next;
+    bool deflate; // Gets the compressed output of its writer
+    bool deflate_sync; // Has had every compressed segment since the start of a stream
+    struct net_inflate *inflate; // Inflates its compressed input, or NULL
+    bool datagram; // A UDP socket, read by clientReadDatagrams()
+    bool udp_seq_valid; // udp_seq was set by a datagram
+    uint32_t udp_seq; // sequence number of the next datagram expected
+    struct sockaddr_storage udp_from; // the sender udp_seq is for
+    socklen_t udp_from_len;
+    bool close_when_sent; // HTTP: the connection ends after the queued response
+    bool half_closed; // close_when_sent and our end is shut down
+    bool pb_synced; // Protocol buffer stream: has had a full update, the others build on it
+};
+
+// What to do when a client's SendQ can't take more output
+
+typedef enum {
+    SENDQ_POLICY_DISCONNECT, // drop the client
+    SENDQ_POLICY_DROP_OLDEST, // drop the oldest queued output
+    SENDQ_POLICY_DROP_NON_POSITION // only queue messages carrying a position
+} sendq_policy_t;
+
+// A flushed writer buffer, shared by the SendQs of all clients of the
+// service until each has written it
+
+struct net_segment {
+    int refs; // clients still to write it
+    int len;
+    // For the latency statistics, in microseconds: when a writer buffer went
+    // on the SendQs, 0 for other output, and when its oldest message was
+    // received, 0 if not known
+    uint64_t queued;
+    uint64_t received;
+    char data[];
 };
 
 // Common writer state for all output sockets of one type
@@ -118,6 +171,17 @@ struct net_writer {
     struct net_service *service; // owning service
     heartbeat_fn send_heartbeat; // function that queues a heartbeat if needed
     uint64_t lastWrite; // time of last write to clients
+    uint64_t bytes; // written in total
+    void *pos_data; // the position messages of data, for SENDQ_POLICY_DROP_NON_POSITION
+    int posUsed;
+    bool position; // the message being written carries a position
+    struct z_stream_s *zstream; // compresses data for clients that want it, once set up
+    bool zrestart; // a client waits for zstream to start a new stream
+    int *udp_ends; // where the UDP datagrams of data end, for a writer with UDP destinations
+    int udp_count; // datagrams ended in udp_ends
+    int udp_start; // start of the datagram being filled
+    uint64_t queued; // microtime() its oldest message was queued for output, 0 if not timed
+    uint64_t received; // when that message was received, in microseconds, 0 if not known
 };
 
 // GNS HULC status message
@@ -155,18 +219,36 @@ struct char_buffer {
     size_t len;
 };
 
+// Position of beastNextFrame() in a buffer of Beast data
+
+struct beast_scan {
+    char *next; // first byte not consumed yet
+    char *eod; // one byte past end of data
+    int need; // bytes from next an incomplete frame needs, 0 if none is pending
+    unsigned garbage; // bytes skipped that were not part of a frame
+};
+
 void sendBeastSettings(int fd, const char *settings);
+char *beastNextFrame(struct beast_scan *scan, int *len);
+void decodeBeastFrame(char *frame, int remote, uint64_t received);
 
 void modesInitNet(void);
 void modesQueueOutput(struct modesMessage *mm, struct aircraft *a);
+bool modesNetRelayNeedsDecode(void);
 void modesNetSecondWork(void);
 void modesNetPeriodicWork(void);
+void modesNetWait(int64_t timeout_ms);
+void modesNetShowClients(void);
+bool modesNetHttpEnabled(void); // serving protocol buffer snapshots over HTTP
+bool modesNetStartThread(void);
 void cleanupNetwork(void);
 
-struct char_buffer generateVRS(int part, int n_parts);
-void writeJsonToNet(struct net_writer *writer, struct char_buffer cb);
 void generateAircraftProtoBuf(void);
-void generateHistoryProtoBuf(const char *file);
+bool startAircraftWriter(void);
+void stopAircraftWriter(void);
+void generateHistoryProtoBuf(void);
+void modesNetHistorySave(FILE *f);
+void modesNetHistoryRestore(const uint8_t *p, size_t len, uint64_t since);
 void generateReceiverProtoBuf(void);
 void generateStatsProtoBuf(void);
 
@@ -0,0 +1,244 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// beast_benchmark.c: benchmark for Beast input framing
+//
+// Copyright (c) 2020 Michael Wolf <michael@mictronics.de>
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Loads a Beast binary capture and replays it at full speed through the
+// same buffering as a Beast input client in modesReadFromClient(): the feed
+// is copied into the client buffer in reads of a fixed size (-r, bytes),
+// every complete frame is split off with beastNextFrame(), and what is left
+// is moved to the start of the buffer for the next read.
+//
+// With -l the frames are found the way the network code did before
+// beastNextFrame(): memchr() for each 0x1a, a byte by byte walk over the
+// frame for escapes and a byte by byte unescaping copy. Both report a sum
+// over the frames they found, which must match.
+//
+// Usage: beast_benchmark [-r readsize] [-s seconds] [-l] <file>
+
+#include "../readsb.h"
+
+#include <getopt.h>
+
+struct _Modes Modes;
+
+static char *feed;
+static size_t feed_len;
+
+void receiverPositionChanged(float lat, float lon, float alt) {
+    /* nothing */
+    (void) lat;
+    (void) lon;
+    (void) alt;
+}
+
+static bool load(const char *filename) {
+    struct stat st;
+    int fd;
+
+    if ((fd = open(filename, O_RDONLY)) < 0) {
+        fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+        return false;
+    }
+
+    if (fstat(fd, &st) < 0 || !(feed = malloc(st.st_size + 1))) {
+        fprintf(stderr, "%s: can't allocate %lld bytes\n", filename, (long long) st.st_size);
+        close(fd);
+        return false;
+    }
+
+    while (feed_len < (size_t) st.st_size) {
+        ssize_t nread = read(fd, feed + feed_len, st.st_size - feed_len);
+        if (nread <= 0)
+            break;
+        feed_len += nread;
+    }
+    close(fd);
+
+    if (!feed_len || feed[0] != 0x1a) {
+        fprintf(stderr, "%s: not a Beast capture\n", filename);
+        return false;
+    }
+
+    fprintf(stderr, "Loaded %zu bytes of Beast data from %s\n", feed_len, filename);
+    return true;
+}
+
+// The frame sum: length and bytes at fixed offsets of every frame, enough
+// to tell whether both scanners found and unescaped the same frames
+
+static inline uint64_t frameSum(const char *frame, int len) {
+    return len + (uint8_t) frame[0] + ((uint8_t) frame[len - 1] << 8) + ((uint8_t) frame[len / 2] << 16);
+}
+
+// The previous scanner: returns the number of bytes consumed
+
+static size_t legacyScan(char *buf, size_t len, uint64_t *frames, uint64_t *sum) {
+    char *som = buf;
+    char *eod = buf + len;
+    char *p;
+
+    while (som < eod && (p = memchr(som, (char) 0x1a, eod - som)) != NULL) {
+        char unescaped[MODES_LONG_MSG_BYTES + 16];
+        char *eom;
+        int flen;
+
+        som = p;
+        p = som + 1;
+        if (p >= eod)
+            break;
+
+        if (*p == '1') {
+            flen = MODEAC_MSG_BYTES + 8;
+        } else if (*p == '2') {
+            flen = MODES_SHORT_MSG_BYTES + 8;
+        } else if (*p == '3' || *p == '4' || *p == '5') {
+            flen = MODES_LONG_MSG_BYTES + 8;
+        } else {
+            ++som; // HULC frames are not expected in a capture
+            continue;
+        }
+        eom = p + flen;
+
+        for (p = som + 1; p < eod && p < eom; p++) {
+            if (0x1A == *p) {
+                p++;
+                eom++;
+            }
+        }
+        if (eom > eod)
+            break;
+
+        for (int j = 0; j < flen; j++) {
+            char ch = *++som;
+            unescaped[j] = ch;
+            if (0x1A == ch)
+                som++;
+        }
+
+        *frames += 1;
+        *sum += frameSum(unescaped, flen);
+        som = eom;
+    }
+
+    return som - buf;
+}
+
+static size_t scan(char *buf, size_t len, uint64_t *frames, uint64_t *sum) {
+    struct beast_scan scan = {buf, buf + len, 0, 0};
+    char *frame;
+    int flen;
+
+    while ((frame = beastNextFrame(&scan, &flen))) {
+        *frames += 1;
+        *sum += frameSum(frame, flen);
+    }
+
+    return scan.next - buf;
+}
+
+int main(int argc, char **argv) {
+    size_t readsize = 1500;
+    bool legacy = false;
+    int seconds = 5;
+    int opt;
+
+    memset(&Modes, 0, sizeof (Modes));
+
+    while ((opt = getopt(argc, argv, "r:s:l")) != -1) {
+        switch (opt) {
+            case 'r':
+                readsize = atoi(optarg);
+                break;
+            case 's':
+                seconds = atoi(optarg);
+                break;
+            case 'l':
+                legacy = true;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-r readsize] [-s seconds] [-l] <file>\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind >= argc || readsize < 1 || readsize > MODES_CLIENT_BUF_SIZE / 2) {
+        fprintf(stderr, "Usage: %s [-r readsize] [-s seconds] [-l] <file>\n", argv[0]);
+        return 1;
+    }
+
+    if (!load(argv[optind]))
+        return 1;
+
+    char *buf = malloc(MODES_CLIENT_BUF_SIZE);
+    if (!buf) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    fprintf(stderr, "Benchmarking: %s scanner, %zu byte reads ", legacy ? "legacy" : "beastNextFrame()", readsize);
+
+    struct timespec total = {0, 0};
+    uint64_t frames = 0, sum = 0;
+    unsigned passes = 0;
+
+    while (total.tv_sec < seconds) {
+        struct timespec start, end;
+        time_t sec = total.tv_sec;
+        size_t buflen = 0;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        for (size_t pos = 0; pos < feed_len; pos += readsize) {
+            size_t nread = (feed_len - pos < readsize) ? feed_len - pos : readsize;
+            size_t used;
+
+            memcpy(buf + buflen, feed + pos, nread);
+            buflen += nread;
+
+            if (legacy)
+                used = legacyScan(buf, buflen, &frames, &sum);
+            else
+                used = scan(buf, buflen, &frames, &sum);
+
+            buflen -= used;
+            if (buflen && used)
+                memmove(buf, buf + used, buflen);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        total.tv_sec += end.tv_sec - start.tv_sec;
+        total.tv_nsec += end.tv_nsec - start.tv_nsec;
+        normalize_timespec(&total);
+        if (total.tv_sec != sec)
+            fprintf(stderr, ".");
+        passes++;
+    }
+
+    double nanos = total.tv_sec * 1e9 + total.tv_nsec;
+
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  %u passes, %.2f MB in %.6f seconds\n", passes, (double) feed_len * passes / 1e6, nanos / 1e9);
+    fprintf(stderr, "  %.1f MB/second\n", feed_len * passes / nanos * 1e3);
+    fprintf(stderr, "  %llu frames per pass, %.2fM frames/second, %.1f ns per frame\n",
+            (unsigned long long) (frames / passes), frames / nanos * 1e3, frames ? nanos / frames : 0.0);
+    fprintf(stderr, "  frame sum %016llx\n", (unsigned long long) (sum / passes));
+
+    free(buf);
+    free(feed);
+    return 0;
+}
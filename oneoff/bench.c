@@ -0,0 +1,1166 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// bench.c: the performance regression suite run by "make bench"
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Loads a corpus of Mode S frames in the hex format of the raw input port
+// (oneoff/corpus/traffic.hex, see make-traffic.py there), or a capture
+// recorded with readsb --record, and times each stage of readsb on it, from
+// IQ samples to network output:
+//
+//   convert.*      IQ to magnitude, the preferred converter of each format,
+//                  as convert_benchmark does it
+//   demod.2400     demodulate2400() over the corpus modulated into IQ
+//                  samples at 2.4MHz, as demod_benchmark does it
+//   crc.checksum   modesChecksum() of every frame
+//   crc.fix        modesChecksumDiagnose() and modesChecksumFix() of the
+//                  DF17 frames with one bit flipped
+//   decode         decodeModesMessage() of every frame
+//   cpr.*          decodeCPRairborne(), decodeCPRsurface() and
+//                  decodeCPRrelative() of the positions of the corpus
+//   track          trackUpdateFromMessage() of every decoded message
+//   beast.ingest   the corpus as a Beast stream read in 1500 byte chunks,
+//                  split by beastNextFrame() and handled by decodeBeastFrame()
+//   beast.fanout   the same with Beast output to 4 clients and SBS output
+//                  to one, over socket pairs drained every 64 frames
+//
+// Each stage runs one untimed pass, then timed passes in 5 rounds of at
+// least a fifth of -s seconds; the median round is reported. The results
+// and the host they were taken on are written to the JSON file -o. Every
+// result has a check value computed from the first pass, which is the same
+// for two builds doing the same work, whatever their speed.
+//
+// Given earlier results with -b, a stage whose rate dropped by more than
+// its threshold is reported and fails the run: -t percent sets the default
+// threshold (10%), -t name=percent the one of a stage or, without a dot in
+// the name, of a group of stages.
+//
+// Usage: bench [-s seconds] [-o results.json] [-b baseline.json] [-t [name=]percent]... <corpus>
+//
+// Exits with 2 when a stage regressed, 1 on errors.
+
+#include "../readsb.h"
+
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/utsname.h>
+
+struct _Modes Modes;
+
+#define BENCH_ROUNDS 5 // timed rounds of each stage, the median is reported
+#define BENCH_SPACING 720 // IQ samples from one frame to the next, 300us at 2.4MHz
+#define BENCH_CLIENTS 4 // Beast output clients of beast.fanout
+#define BENCH_DRAIN 64 // frames between reading the output clients
+#define BENCH_READ 1500 // bytes of Beast input read at a time
+#define BENCH_RESULTS 32
+#define BENCH_THRESHOLDS 32
+
+struct frame {
+    uint64_t timestampMsg; // 12MHz clock, 0 if the record had none
+    uint64_t sysTimestampMsg; // relative to the first frame
+    double signalLevel;
+    unsigned char signal; // as received, 0-255
+    int bits;
+    unsigned char msg[MODES_LONG_MSG_BYTES];
+};
+
+// A decoded message of the corpus, for the stages that start from one
+struct decoded {
+    struct modesMessage mm;
+    unsigned frame;
+};
+
+// A position message of the corpus, for decodeCPRrelative()
+struct cpr_position {
+    unsigned lat, lon;
+    int odd;
+    bool surface;
+};
+
+struct result {
+    const char *name;
+    const char *unit; // of the work done
+    const char *impl; // the implementation timed, where there is a choice
+    double work; // units per pass
+    double rate; // units per second, median of the rounds
+    uint64_t check;
+    unsigned passes;
+};
+
+struct threshold {
+    const char *name;
+    double percent;
+};
+
+typedef uint64_t(*pass_fn)(void);
+
+static struct frame *frames;
+static unsigned frame_count;
+static unsigned frame_alloc;
+static uint64_t span; // the traffic of the corpus, in milliseconds
+static uint64_t shift; // passes are shifted forward in time past the previous one
+
+static struct decoded *decoded;
+static unsigned decoded_count;
+
+static uint8_t *iq_uc8;
+static uint16_t *iq_sc16;
+static uint16_t *iq_sc16q11;
+static unsigned iq_samples;
+static uint16_t *mag_out; // convert.* output, one block
+
+static struct mag_buf *buffers;
+static unsigned buffer_count;
+
+static unsigned char (*corrupted)[MODES_LONG_MSG_BYTES]; // crc.fix input
+static unsigned corrupted_count;
+
+static struct cpr_pair *airborne_pairs;
+static unsigned airborne_count;
+static struct cpr_pair *surface_pairs;
+static unsigned surface_count;
+static struct cpr_position *positions;
+static unsigned position_count;
+
+static char *beast;
+static size_t beast_len;
+static char *beast_buf; // as a client buffer
+
+static int fanout_peers[BENCH_CLIENTS + 1];
+static int fanout_count;
+
+static struct result results[BENCH_RESULTS];
+static int result_count;
+static struct threshold thresholds[BENCH_THRESHOLDS];
+static int threshold_count;
+static double default_threshold = 10.0;
+static double seconds = 1.0;
+
+void receiverPositionChanged(float lat, float lon, float alt) {
+    /* nothing */
+    (void) lat;
+    (void) lon;
+    (void) alt;
+}
+
+//
+// Corpus
+//
+
+static int hexDigitVal(int c) {
+    c = tolower(c);
+    if (c >= '0' && c <= '9') return c - '0';
+    else if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    else return -1;
+}
+
+// Parse one hex record the same way decodeHexMessage() does.
+// Returns false if the line is not a Mode S frame.
+
+static bool parseHexLine(char *hex, struct frame *f) {
+    int l = strlen(hex);
+
+    while (l && isspace(hex[l - 1]))
+        hex[--l] = '\0';
+    while (isspace(*hex)) {
+        hex++;
+        l--;
+    }
+
+    if (l < 2 || hex[l - 1] != ';')
+        return false;
+
+    f->signal = 0;
+    switch (hex[0]) {
+        case '<':
+            if (l < 16)
+                return false;
+            for (int j = 1; j <= 12; ++j)
+                f->timestampMsg = (f->timestampMsg << 4) | (hexDigitVal(hex[j]) & 15);
+            f->signal = ((hexDigitVal(hex[13]) & 15) << 4) | (hexDigitVal(hex[14]) & 15);
+            hex += 15;
+            l -= 16;
+            break;
+
+        case '@':
+        case '%':
+            if (l < 14)
+                return false;
+            for (int j = 1; j <= 12; ++j)
+                f->timestampMsg = (f->timestampMsg << 4) | (hexDigitVal(hex[j]) & 15);
+            hex += 13;
+            l -= 14;
+            break;
+
+        case '*':
+        case ':':
+            hex++;
+            l -= 2;
+            break;
+
+        default:
+            return false;
+    }
+
+    if (l != MODES_SHORT_MSG_BYTES * 2 && l != MODES_LONG_MSG_BYTES * 2)
+        return false;
+
+    for (int j = 0; j < l; j += 2) {
+        int high = hexDigitVal(hex[j]);
+        int low = hexDigitVal(hex[j + 1]);
+
+        if (high == -1 || low == -1)
+            return false;
+        f->msg[j / 2] = (high << 4) | low;
+    }
+
+    if (!f->signal)
+        f->signal = 128;
+    f->signalLevel = (f->signal / 255.0) * (f->signal / 255.0);
+    f->bits = l * 4;
+    return true;
+}
+
+// Room for one more frame, NULL when out of memory
+static struct frame *newFrame(void) {
+    if (frame_count == frame_alloc) {
+        unsigned alloc = frame_alloc ? frame_alloc * 2 : 4096;
+        struct frame *newframes = realloc(frames, alloc * sizeof (*frames));
+        if (!newframes) {
+            fprintf(stderr, "Out of memory\n");
+            return NULL;
+        }
+        frames = newframes;
+        frame_alloc = alloc;
+    }
+
+    memset(&frames[frame_count], 0, sizeof (frames[frame_count]));
+    return &frames[frame_count];
+}
+
+// The Mode S frames of a --record capture; Mode A/C replies are left out
+static void captureFrame(const struct capture_frame *cf, void *arg) {
+    bool *failed = arg;
+    struct frame *f;
+
+    if (*failed || cf->len == MODEAC_MSG_BYTES)
+        return;
+    if (!(f = newFrame())) {
+        *failed = true;
+        return;
+    }
+
+    f->timestampMsg = cf->timestamp;
+    f->signal = cf->signal ? cf->signal : 128;
+    f->signalLevel = (f->signal / 255.0) * (f->signal / 255.0);
+    f->bits = cf->len * 8;
+    memcpy(f->msg, cf->msg, cf->len);
+    frame_count++;
+}
+
+static bool loadCapture(const unsigned char *p, size_t len, const char *filename) {
+    size_t off = CAPTURE_HEADER_BYTES;
+    bool failed = false;
+    int blen;
+
+    while (len - off >= CAPTURE_BLOCK_HEADER_BYTES && !failed) {
+        if ((blen = captureBlockLength(p + off)) < 0 || len - off - CAPTURE_BLOCK_HEADER_BYTES < (size_t) blen) {
+            fprintf(stderr, "%s: damaged or cut short after %u frames, using those\n", filename, frame_count);
+            break;
+        }
+        if (!captureReadBlock(p + off, CAPTURE_BLOCK_HEADER_BYTES + blen, captureFrame, &failed))
+            fprintf(stderr, "%s: damaged block after %u frames, skipped the rest of it\n", filename, frame_count);
+        off += CAPTURE_BLOCK_HEADER_BYTES + blen;
+    }
+    return !failed;
+}
+
+static bool loadHex(char *data, char *eod) {
+    char *line = data, *next;
+
+    for (; line < eod; line = next) {
+        if ((next = memchr(line, '\n', eod - line)))
+            *next++ = '\0';
+        else
+            next = eod;
+        if (!*line)
+            continue;
+
+        struct frame *f = newFrame();
+        if (!f)
+            return false;
+        if (parseHexLine(line, f))
+            frame_count++;
+    }
+    return true;
+}
+
+static bool load(const char *filename) {
+    struct stat st;
+    char *data;
+    uint64_t start;
+    int fd;
+
+    if ((fd = open(filename, O_RDONLY)) < 0) {
+        fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+        return false;
+    }
+
+    if (fstat(fd, &st) < 0 || !(data = malloc(st.st_size + 1))) {
+        fprintf(stderr, "%s: can't allocate %lld bytes\n", filename, (long long) st.st_size);
+        close(fd);
+        return false;
+    }
+
+    ssize_t len = 0;
+    while (len < st.st_size) {
+        ssize_t nread = read(fd, data + len, st.st_size - len);
+        if (nread <= 0)
+            break;
+        len += nread;
+    }
+    close(fd);
+    data[len] = '\0';
+
+    bool ok;
+    if (len >= CAPTURE_HEADER_BYTES && captureCheckHeader((unsigned char *) data, &start))
+        ok = loadCapture((unsigned char *) data, len, filename);
+    else
+        ok = loadHex(data, data + len);
+    free(data);
+    if (!ok)
+        return false;
+
+    if (!frame_count) {
+        fprintf(stderr, "%s: no Mode S frames\n", filename);
+        return false;
+    }
+
+    // Reception times from the 12MHz clock, kept monotonic; records
+    // without a timestamp are spaced 1ms apart
+    uint64_t first = frames[0].timestampMsg;
+    uint64_t last = 0;
+    for (unsigned i = 0; i < frame_count; ++i) {
+        uint64_t sys = last + 1;
+        if (frames[i].timestampMsg >= first && frames[i].timestampMsg)
+            sys = receiveclock_ms_elapsed(first, frames[i].timestampMsg);
+        if (sys < last)
+            sys = last;
+        frames[i].sysTimestampMsg = last = sys;
+    }
+    span = frames[frame_count - 1].sysTimestampMsg + 1000;
+
+    fprintf(stderr, "Loaded %u Mode S frames from %s, %.1f seconds of traffic\n",
+            frame_count, filename, span / 1000.0);
+    return true;
+}
+
+//
+// Inputs of the stages, all derived from the corpus
+//
+
+static uint32_t prng_state = 56;
+
+static inline uint32_t prng(void) {
+    // xorshift32, the same sequence on every host
+    prng_state ^= prng_state << 13;
+    prng_state ^= prng_state >> 17;
+    prng_state ^= prng_state << 5;
+    return prng_state;
+}
+
+static inline double uniform(void) {
+    return (prng() >> 8) / 16777216.0;
+}
+
+// Add a pulse of amplitude amp from us to us + width to the per sample
+// amplitudes at 2.4MHz, in proportion to the part of each sample it covers
+static void addPulse(float *amp, double us, double width, float level) {
+    double from = us * 2.4, to = (us + width) * 2.4;
+
+    for (unsigned n = (unsigned) from; n < to && n < iq_samples; ++n) {
+        double lo = n > from ? n : from;
+        double hi = n + 1 < to ? n + 1 : to;
+        amp[n] += level * (hi - lo);
+    }
+}
+
+// Modulate each frame of the corpus onto a 2.4MHz UC8 IQ stream, one every
+// 300us at a random phase within the first microsecond, with its signal
+// level and noise; the SC16 and SC16Q11 streams are derived from it
+static bool modulate(void) {
+    float *amp;
+
+    iq_samples = frame_count * BENCH_SPACING + BENCH_SPACING;
+    amp = calloc(iq_samples, sizeof (float));
+    float *phase = calloc(iq_samples, sizeof (float));
+    iq_uc8 = malloc(iq_samples * 2);
+    iq_sc16 = malloc(iq_samples * 4);
+    iq_sc16q11 = malloc(iq_samples * 4);
+    mag_out = malloc(MODES_MAG_BUF_SAMPLES * sizeof (uint16_t));
+    if (!amp || !phase || !iq_uc8 || !iq_sc16 || !iq_sc16q11 || !mag_out) {
+        fprintf(stderr, "Out of memory\n");
+        return false;
+    }
+
+    for (unsigned i = 0; i < frame_count; ++i) {
+        const struct frame *f = &frames[i];
+        double start = (i + 0.25) * BENCH_SPACING / 2.4 + uniform();
+        float level = f->signal / 255.0 * 110;
+        float p = uniform() * 2 * M_PI;
+
+        addPulse(amp, start, 0.5, level);
+        addPulse(amp, start + 1.0, 0.5, level);
+        addPulse(amp, start + 3.5, 0.5, level);
+        addPulse(amp, start + 4.5, 0.5, level);
+        for (int bit = 0; bit < f->bits; ++bit) {
+            int one = (f->msg[bit / 8] >> (7 - bit % 8)) & 1;
+            addPulse(amp, start + 8 + bit + (one ? 0 : 0.5), 0.5, level);
+        }
+        for (unsigned n = start * 2.4; n < (start + 8 + f->bits) * 2.4 + 2 && n < iq_samples; ++n)
+            phase[n] = p;
+    }
+
+    for (unsigned n = 0; n < iq_samples; ++n) {
+        float noise_i = (uniform() + uniform() + uniform() - 1.5) * 6;
+        float noise_q = (uniform() + uniform() + uniform() - 1.5) * 6;
+        float i_val = amp[n] * cosf(phase[n]) + noise_i;
+        float q_val = amp[n] * sinf(phase[n]) + noise_q;
+        int i_u8 = (int) lrintf(127.5f + i_val);
+        int q_u8 = (int) lrintf(127.5f + q_val);
+
+        iq_uc8[n * 2] = i_u8 < 0 ? 0 : (i_u8 > 255 ? 255 : i_u8);
+        iq_uc8[n * 2 + 1] = q_u8 < 0 ? 0 : (q_u8 > 255 ? 255 : q_u8);
+        iq_sc16[n * 2] = htole16((int16_t) ((iq_uc8[n * 2] - 127.5f) * 256));
+        iq_sc16[n * 2 + 1] = htole16((int16_t) ((iq_uc8[n * 2 + 1] - 127.5f) * 256));
+        iq_sc16q11[n * 2] = htole16((int16_t) ((iq_uc8[n * 2] - 127.5f) * 16));
+        iq_sc16q11[n * 2 + 1] = htole16((int16_t) ((iq_uc8[n * 2 + 1] - 127.5f) * 16));
+    }
+
+    free(amp);
+    free(phase);
+    return true;
+}
+
+// Convert the UC8 stream into magnitude buffers, carrying the trailing
+// overlap of each buffer into the next one like fifo_enqueue() does
+static bool fillBuffers(void) {
+    unsigned overlap = Modes.trailing_samples;
+    struct converter_state *state;
+    iq_convert_fn converter = init_converter(INPUT_UC8, Modes.sample_rate, 0, &state);
+
+    if (!converter) {
+        fprintf(stderr, "Can't initialize converter\n");
+        return false;
+    }
+
+    buffer_count = (iq_samples + MODES_MAG_BUF_SAMPLES - 1) / MODES_MAG_BUF_SAMPLES;
+    if (!(buffers = calloc(buffer_count, sizeof (*buffers)))) {
+        fprintf(stderr, "Out of memory\n");
+        return false;
+    }
+
+    for (unsigned i = 0; i < buffer_count; ++i) {
+        struct mag_buf *buf = &buffers[i];
+        unsigned pos = i * MODES_MAG_BUF_SAMPLES;
+        unsigned samples = iq_samples - pos < MODES_MAG_BUF_SAMPLES ? iq_samples - pos : MODES_MAG_BUF_SAMPLES;
+
+        buf->totalLength = MODES_MAG_BUF_SAMPLES + overlap;
+        if (!(buf->data = calloc(buf->totalLength, sizeof (buf->data[0])))) {
+            fprintf(stderr, "Out of memory\n");
+            return false;
+        }
+        buf->overlap = overlap;
+        buf->validLength = overlap + samples;
+        buf->sampleTimestamp = pos * 12e6 / Modes.sample_rate;
+        buf->sysTimestamp = buf->sampleTimestamp / 12000U + Modes.startup_time;
+        converter(iq_uc8 + pos * 2, &buf->data[overlap], samples, state, &buf->mean_level, &buf->mean_power);
+        if (i > 0) {
+            struct mag_buf *prev = &buffers[i - 1];
+            memcpy(buf->data, &prev->data[prev->validLength - overlap], overlap * sizeof (buf->data[0]));
+        }
+    }
+
+    cleanup_converter(state);
+    return true;
+}
+
+// The DF17 frames, each with one bit flipped
+static bool corrupt(void) {
+    if (!(corrupted = malloc(frame_count * sizeof (*corrupted)))) {
+        fprintf(stderr, "Out of memory\n");
+        return false;
+    }
+
+    for (unsigned i = 0; i < frame_count; ++i) {
+        if (frames[i].msg[0] >> 3 != 17)
+            continue;
+        memcpy(corrupted[corrupted_count], frames[i].msg, MODES_LONG_MSG_BYTES);
+        unsigned bit = 5 + prng() % (MODES_LONG_MSG_BITS - 5);
+        corrupted[corrupted_count][bit / 8] ^= 1 << (7 - bit % 8);
+        corrupted_count++;
+    }
+    return true;
+}
+
+static inline int decodeFrame(const struct frame *f, struct modesMessage *mm) {
+    static struct modesMessage zeroMessage;
+    unsigned char msg[MODES_LONG_MSG_BYTES];
+
+    *mm = zeroMessage;
+    mm->remote = 1;
+    mm->timestampMsg = f->timestampMsg ? f->timestampMsg + shift * 12000 : 0;
+    mm->sysTimestampMsg = Modes.startup_time + f->sysTimestampMsg + shift;
+    mm->signalLevel = f->signalLevel;
+
+    // decodeModesMessage() may repair the message in place
+    memcpy(msg, f->msg, sizeof (msg));
+    return decodeModesMessage(mm, msg);
+}
+
+// The messages of the corpus decoded once, and the CPR pairs in them: an
+// even and an odd position of an aircraft less than 10 seconds apart
+static bool prepareMessages(void) {
+    struct last_cpr {
+        uint32_t addr;
+        bool valid[2];
+        unsigned lat[2], lon[2];
+        uint64_t when[2];
+    } *last;
+    unsigned last_count = 0;
+
+    decoded = malloc(frame_count * sizeof (*decoded));
+    airborne_pairs = malloc(frame_count * sizeof (*airborne_pairs));
+    surface_pairs = malloc(frame_count * sizeof (*surface_pairs));
+    positions = malloc(frame_count * sizeof (*positions));
+    last = calloc(frame_count, sizeof (*last));
+    if (!decoded || !airborne_pairs || !surface_pairs || !positions || !last) {
+        fprintf(stderr, "Out of memory\n");
+        return false;
+    }
+
+    for (unsigned i = 0; i < frame_count; ++i) {
+        struct modesMessage *mm = &decoded[decoded_count].mm;
+
+        if (decodeFrame(&frames[i], mm) < 0)
+            continue;
+        decoded[decoded_count++].frame = i;
+
+        if (!mm->cpr_valid || mm->cpr_type == CPR_COARSE)
+            continue;
+
+        bool surface = (mm->cpr_type == CPR_SURFACE);
+        positions[position_count++] = (struct cpr_position) {mm->cpr_lat, mm->cpr_lon, mm->cpr_odd, surface};
+
+        struct last_cpr *l = NULL;
+        for (unsigned j = 0; j < last_count && !l; ++j) {
+            if (last[j].addr == mm->addr)
+                l = &last[j];
+        }
+        if (!l) {
+            l = &last[last_count++];
+            l->addr = mm->addr;
+        }
+
+        int odd = mm->cpr_odd;
+        l->valid[odd] = true;
+        l->lat[odd] = mm->cpr_lat;
+        l->lon[odd] = mm->cpr_lon;
+        l->when[odd] = frames[i].sysTimestampMsg;
+        if (!l->valid[!odd] || l->when[odd] - l->when[!odd] > 10000)
+            continue;
+
+        struct cpr_pair *p = surface ? &surface_pairs[surface_count++] : &airborne_pairs[airborne_count++];
+        memset(p, 0, sizeof (*p));
+        p->even_cprlat = l->lat[0];
+        p->even_cprlon = l->lon[0];
+        p->odd_cprlat = l->lat[1];
+        p->odd_cprlon = l->lon[1];
+        p->fflag = odd;
+        p->reflat = Modes.receiver.latitude;
+        p->reflon = Modes.receiver.longitude;
+    }
+
+    free(last);
+    return true;
+}
+
+// The corpus as a Beast capture
+static bool beastEncode(void) {
+    char *p;
+
+    // worst case, every byte after the 0x1a escaped
+    beast = malloc(frame_count * (2 + 2 * (7 + MODES_LONG_MSG_BYTES)));
+    beast_buf = malloc(MODES_CLIENT_BUF_SIZE);
+    if (!beast || !beast_buf) {
+        fprintf(stderr, "Out of memory\n");
+        return false;
+    }
+
+    p = beast;
+    for (unsigned i = 0; i < frame_count; ++i) {
+        const struct frame *f = &frames[i];
+        unsigned char record[7 + MODES_LONG_MSG_BYTES];
+
+        for (int j = 0; j < 6; ++j)
+            record[j] = f->timestampMsg >> (40 - 8 * j);
+        record[6] = f->signal;
+        memcpy(record + 7, f->msg, f->bits / 8);
+
+        *p++ = 0x1a;
+        *p++ = f->bits == MODES_LONG_MSG_BITS ? '3' : '2';
+        for (int j = 0; j < 7 + f->bits / 8; ++j) {
+            *p++ = record[j];
+            if (record[j] == 0x1a)
+                *p++ = 0x1a;
+        }
+    }
+    beast_len = p - beast;
+    return true;
+}
+
+//
+// Stages: each function is one pass and returns its check value
+//
+
+static iq_convert_fn convert_fn;
+static struct converter_state *convert_state;
+static void *convert_input;
+static unsigned convert_sample_bytes;
+
+static uint64_t passConvert(void) {
+    uint64_t sum = 0;
+
+    for (unsigned pos = 0; pos < iq_samples; pos += MODES_MAG_BUF_SAMPLES) {
+        unsigned samples = iq_samples - pos < MODES_MAG_BUF_SAMPLES ? iq_samples - pos : MODES_MAG_BUF_SAMPLES;
+        convert_fn((char *) convert_input + pos * convert_sample_bytes, mag_out, samples, convert_state, NULL, NULL);
+        sum += mag_out[samples / 2];
+    }
+    return sum;
+}
+
+static uint64_t passDemod(void) {
+    uint32_t before = Modes.stats_current.demod_accepted[0] + Modes.stats_current.demod_accepted[1];
+
+    for (unsigned i = 0; i < buffer_count; ++i)
+        Modes.demodulate(&buffers[i]);
+    return Modes.stats_current.demod_accepted[0] + Modes.stats_current.demod_accepted[1] - before;
+}
+
+static uint64_t passChecksum(void) {
+    uint64_t sum = 0;
+
+    for (unsigned i = 0; i < frame_count; ++i)
+        sum += modesChecksum(frames[i].msg, frames[i].bits);
+    return sum;
+}
+
+static uint64_t passFix(void) {
+    uint64_t fixed = 0;
+
+    for (unsigned i = 0; i < corrupted_count; ++i) {
+        unsigned char msg[MODES_LONG_MSG_BYTES];
+        struct errorinfo *ei;
+
+        memcpy(msg, corrupted[i], sizeof (msg));
+        if ((ei = modesChecksumDiagnose(modesChecksum(msg, MODES_LONG_MSG_BITS), MODES_LONG_MSG_BITS))) {
+            modesChecksumFix(msg, ei);
+            fixed++;
+        }
+    }
+    return fixed;
+}
+
+static uint64_t passDecode(void) {
+    struct modesMessage mm;
+    uint64_t accepted = 0;
+
+    for (unsigned i = 0; i < frame_count; ++i) {
+        if (decodeFrame(&frames[i], &mm) >= 0)
+            accepted++;
+    }
+    return accepted;
+}
+
+static uint64_t passAirborne(void) {
+    uint64_t ok = 0;
+
+    for (unsigned i = 0; i < airborne_count; ++i) {
+        struct cpr_pair *p = &airborne_pairs[i];
+        if (decodeCPRairborne(p->even_cprlat, p->even_cprlon, p->odd_cprlat, p->odd_cprlon, p->fflag, &p->lat, &p->lon) == 0)
+            ok++;
+    }
+    return ok;
+}
+
+static uint64_t passSurface(void) {
+    uint64_t ok = 0;
+
+    for (unsigned i = 0; i < surface_count; ++i) {
+        struct cpr_pair *p = &surface_pairs[i];
+        if (decodeCPRsurface(p->reflat, p->reflon, p->even_cprlat, p->even_cprlon,
+                p->odd_cprlat, p->odd_cprlon, p->fflag, &p->lat, &p->lon) == 0)
+            ok++;
+    }
+    return ok;
+}
+
+static uint64_t passRelative(void) {
+    uint64_t ok = 0;
+
+    for (unsigned i = 0; i < position_count; ++i) {
+        const struct cpr_position *p = &positions[i];
+        double lat, lon;
+        if (decodeCPRrelative(Modes.receiver.latitude, Modes.receiver.longitude,
+                p->lat, p->lon, p->odd, p->surface, &lat, &lon) == 0)
+            ok++;
+    }
+    return ok;
+}
+
+static uint64_t passTrack(void) {
+    uint32_t before = Modes.stats_current.cpr_global_ok + Modes.stats_current.cpr_local_ok;
+
+    for (unsigned i = 0; i < decoded_count; ++i) {
+        struct modesMessage mm = decoded[i].mm;
+        const struct frame *f = &frames[decoded[i].frame];
+
+        mm.sysTimestampMsg = Modes.startup_time + f->sysTimestampMsg + shift;
+        if (mm.timestampMsg)
+            mm.timestampMsg = f->timestampMsg + shift * 12000;
+        trackUpdateFromMessage(&mm);
+    }
+    shift += span;
+    return Modes.stats_current.cpr_global_ok + Modes.stats_current.cpr_local_ok - before;
+}
+
+// Read what the output clients have been sent, returns the bytes read
+static uint64_t drainClients(void) {
+    char buf[65536];
+    uint64_t bytes = 0;
+
+    for (int i = 0; i < fanout_count; ++i) {
+        ssize_t n;
+        while ((n = read(fanout_peers[i], buf, sizeof (buf))) > 0)
+            bytes += n;
+    }
+    return bytes;
+}
+
+// Feed the Beast stream in BENCH_READ byte reads as a client buffer would
+// see it; frame n of the stream is frame n of the corpus
+static uint64_t passBeast(void) {
+    uint32_t before = Modes.stats_current.remote_accepted[0] + Modes.stats_current.remote_accepted[1];
+    uint64_t sent = 0;
+    size_t buflen = 0;
+    unsigned n = 0;
+
+    for (size_t pos = 0; pos < beast_len; pos += BENCH_READ) {
+        size_t nread = beast_len - pos < BENCH_READ ? beast_len - pos : BENCH_READ;
+        struct beast_scan scan;
+        char *frame;
+        int flen;
+
+        memcpy(beast_buf + buflen, beast + pos, nread);
+        buflen += nread;
+        scan = (struct beast_scan) {beast_buf, beast_buf + buflen, 0, 0};
+
+        while ((frame = beastNextFrame(&scan, &flen))) {
+            decodeBeastFrame(frame, 1, Modes.startup_time + frames[n].sysTimestampMsg + shift);
+            if (++n % BENCH_DRAIN == 0 && fanout_count)
+                sent += drainClients();
+        }
+
+        buflen = beast_buf + buflen - scan.next;
+        if (buflen)
+            memmove(beast_buf, scan.next, buflen);
+    }
+    shift += span;
+    if (fanout_count)
+        return sent + drainClients();
+    return Modes.stats_current.remote_accepted[0] + Modes.stats_current.remote_accepted[1] - before;
+}
+
+static bool startFanout(void) {
+    struct net_service *beast_out = serviceInit("Beast TCP output", &Modes.beast_out, NULL, READ_MODE_IGNORE, NULL, NULL);
+    struct net_service *sbs_out = serviceInit("Basestation TCP output", &Modes.sbs_out, NULL, READ_MODE_IGNORE, NULL, NULL);
+
+    for (int i = 0; i <= BENCH_CLIENTS; ++i) {
+        int fds[2];
+
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+            fprintf(stderr, "socketpair: %s\n", strerror(errno));
+            return false;
+        }
+        anetNonBlock(Modes.aneterr, fds[1]);
+        createSocketClient(i < BENCH_CLIENTS ? beast_out : sbs_out, fds[0]);
+        fanout_peers[fanout_count++] = fds[1];
+    }
+    Modes.net = 1;
+    return true;
+}
+
+//
+// Timing and results
+//
+
+static inline uint64_t elapsed_ns(const struct timespec *start, const struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1000000000ULL + end->tv_nsec - start->tv_nsec;
+}
+
+static int compareRates(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+static void run(const char *name, const char *unit, const char *impl, double work, pass_fn pass) {
+    struct result *res;
+    double rates[BENCH_ROUNDS];
+    uint64_t round_ns = seconds * 1e9 / BENCH_ROUNDS;
+
+    if (result_count == BENCH_RESULTS || work <= 0)
+        return;
+
+    res = &results[result_count++];
+    res->name = name;
+    res->unit = unit;
+    res->impl = impl;
+    res->work = work;
+    res->check = pass(); // untimed, so caches and state are warm
+
+    for (int r = 0; r < BENCH_ROUNDS; ++r) {
+        struct timespec start, end;
+        unsigned passes = 0;
+        uint64_t ns;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        do {
+            pass();
+            passes++;
+            clock_gettime(CLOCK_MONOTONIC, &end);
+        } while ((ns = elapsed_ns(&start, &end)) < round_ns);
+
+        rates[r] = work * passes / ns * 1e9;
+        res->passes += passes;
+    }
+
+    qsort(rates, BENCH_ROUNDS, sizeof (rates[0]), compareRates);
+    res->rate = rates[BENCH_ROUNDS / 2];
+
+    fprintf(stderr, "  %-16s %12.3fM %s/s, %.1f ns each%s%s\n", name, res->rate / 1e6, unit,
+            1e9 / res->rate, impl ? ", " : "", impl ? impl : "");
+}
+
+static void runConvert(const char *name, input_format_t format, void *input, unsigned sample_bytes, bool dc) {
+    const char *description;
+
+    convert_fn = init_converter_impl(format, Modes.sample_rate, dc, 0, &description, &convert_state);
+    if (!convert_fn) {
+        fprintf(stderr, "  %-16s no converter\n", name);
+        return;
+    }
+    convert_input = input;
+    convert_sample_bytes = sample_bytes;
+    run(name, "samples", description, iq_samples, passConvert);
+    cleanup_converter(convert_state);
+}
+
+static void writeString(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; s && *s; ++s) {
+        if (*s == '"' || *s == '\\')
+            fprintf(f, "\\%c", *s);
+        else if ((unsigned char) *s < 0x20)
+            fprintf(f, "\\u%04x", (unsigned char) *s);
+        else
+            fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+// One result per line, which is all readBaseline() relies on
+static bool writeResults(const char *filename, const char *corpus) {
+    struct utsname un;
+    FILE *f;
+
+    if (!(f = fopen(filename, "w"))) {
+        fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+        return false;
+    }
+    if (uname(&un) < 0)
+        memset(&un, 0, sizeof (un));
+
+    fprintf(f, "{\n  \"suite\": \"readsb bench\",\n  \"format\": 1,\n  \"version\": ");
+    writeString(f, MODES_READSB_VERSION);
+    fprintf(f, ",\n  \"time\": %llu,\n  \"host\": {\"system\": ", (unsigned long long) time(NULL));
+    writeString(f, un.sysname);
+    fprintf(f, ", \"release\": ");
+    writeString(f, un.release);
+    fprintf(f, ", \"machine\": ");
+    writeString(f, un.machine);
+    fprintf(f, ", \"cpus\": %ld, \"compiler\": ", sysconf(_SC_NPROCESSORS_ONLN));
+    writeString(f, __VERSION__);
+    fprintf(f, "},\n  \"corpus\": ");
+    writeString(f, corpus);
+    fprintf(f, ",\n  \"frames\": %u,\n  \"seconds\": %g,\n  \"results\": [\n", frame_count, seconds);
+
+    for (int i = 0; i < result_count; ++i) {
+        const struct result *r = &results[i];
+        fprintf(f, "    {\"name\": ");
+        writeString(f, r->name);
+        fprintf(f, ", \"unit\": ");
+        writeString(f, r->unit);
+        if (r->impl) {
+            fprintf(f, ", \"impl\": ");
+            writeString(f, r->impl);
+        }
+        fprintf(f, ", \"rate\": %.1f, \"ns\": %.3f, \"work\": %.0f, \"passes\": %u, \"check\": %llu}%s\n",
+                r->rate, 1e9 / r->rate, r->work, r->passes, (unsigned long long) r->check,
+                i + 1 < result_count ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+
+    if (fclose(f) != 0) {
+        fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+        return false;
+    }
+    fprintf(stderr, "Results written to %s\n", filename);
+    return true;
+}
+
+static bool parseThreshold(char *arg) {
+    char *eq = strchr(arg, '=');
+    char *end;
+    double percent = strtod(eq ? eq + 1 : arg, &end);
+
+    if (*end || percent < 0)
+        return false;
+    if (!eq) {
+        default_threshold = percent;
+        return true;
+    }
+    if (threshold_count == BENCH_THRESHOLDS)
+        return false;
+    *eq = '\0';
+    thresholds[threshold_count].name = arg;
+    thresholds[threshold_count].percent = percent;
+    threshold_count++;
+    return true;
+}
+
+// The threshold of a stage: the last one given for its name or its group
+static double thresholdFor(const char *name) {
+    double percent = default_threshold;
+    size_t group = strcspn(name, ".");
+
+    for (int i = 0; i < threshold_count; ++i) {
+        const char *t = thresholds[i].name;
+        if (!strcmp(t, name) || (strlen(t) == group && !strncmp(t, name, group)))
+            percent = thresholds[i].percent;
+    }
+    return percent;
+}
+
+// Find the value of "key": on a result line of a results file
+static bool lineValue(const char *line, const char *key, char *out, size_t size) {
+    char pattern[32];
+    const char *p;
+    size_t n = 0;
+
+    snprintf(pattern, sizeof (pattern), "\"%s\": ", key);
+    if (!(p = strstr(line, pattern)))
+        return false;
+    p += strlen(pattern);
+    if (*p == '"')
+        p++;
+    while (*p && *p != '"' && *p != ',' && *p != '}' && n + 1 < size)
+        out[n++] = *p++;
+    out[n] = '\0';
+    return true;
+}
+
+// Compare against the results of an earlier run, returns the number of
+// stages that regressed or -1 if the file can't be read
+static int compareBaseline(const char *filename) {
+    char line[1024];
+    int regressions = 0;
+    FILE *f;
+
+    if (!(f = fopen(filename, "r"))) {
+        fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+        return -1;
+    }
+
+    fprintf(stderr, "Compared to %s:\n", filename);
+    fprintf(stderr, "  %-16s %14s %14s %8s %9s\n", "stage", "baseline/s", "now/s", "change", "threshold");
+
+    bool seen[BENCH_RESULTS] = { false };
+    while (fgets(line, sizeof (line), f)) {
+        char name[64], value[64];
+
+        if (!lineValue(line, "name", name, sizeof (name)) || !lineValue(line, "rate", value, sizeof (value)))
+            continue;
+
+        double base = atof(value);
+        uint64_t base_check = lineValue(line, "check", value, sizeof (value)) ? strtoull(value, NULL, 10) : 0;
+        const struct result *r = NULL;
+        for (int i = 0; i < result_count && !r; ++i) {
+            if (!strcmp(results[i].name, name)) {
+                r = &results[i];
+                seen[i] = true;
+            }
+        }
+        if (!r) {
+            fprintf(stderr, "  %-16s %14.0f %14s\n", name, base, "not run");
+            continue;
+        }
+
+        double change = base > 0 ? (r->rate / base - 1) * 100 : 0;
+        double percent = thresholdFor(name);
+        bool regressed = change < -percent;
+        fprintf(stderr, "  %-16s %14.0f %14.0f %+7.1f%% %8.1f%%%s%s\n", name, base, r->rate, change, percent,
+                regressed ? "  REGRESSION" : "", base_check != r->check ? "  (check differs, not the same work)" : "");
+        if (regressed)
+            regressions++;
+    }
+    fclose(f);
+
+    for (int i = 0; i < result_count; ++i) {
+        if (!seen[i])
+            fprintf(stderr, "  %-16s %14s %14.0f\n", results[i].name, "new", results[i].rate);
+    }
+
+    if (regressions)
+        fprintf(stderr, "%d stage(s) regressed\n", regressions);
+    return regressions;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "Usage: %s [-s seconds] [-o results.json] [-b baseline.json] [-t [name=]percent]... <corpus>\n", argv0);
+}
+
+int main(int argc, char **argv) {
+    const char *output = "bench.json";
+    const char *baseline = NULL;
+    int opt;
+
+    memset(&Modes, 0, sizeof (Modes));
+    Modes.sdr_type = SDR_IFILE;
+    Modes.sample_rate = 2400000.0;
+    Modes.preambleThreshold = PREAMBLE_THRESHOLD_DEFAULT;
+    Modes.nfix_crc = 1;
+    Modes.check_crc = 1;
+    Modes.quiet = 1;
+    Modes.maxRange = 1852 * 300;
+    Modes.net_output_flush_size = 1200;
+    Modes.startup_time = Modes.ifile_now = mstime();
+    receiver__init(&Modes.receiver);
+
+    while ((opt = getopt(argc, argv, "s:o:b:t:")) != -1) {
+        switch (opt) {
+            case 's':
+                seconds = atof(optarg);
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'b':
+                baseline = optarg;
+                break;
+            case 't':
+                if (!parseThreshold(optarg)) {
+                    fprintf(stderr, "-t %s: expected percent or name=percent\n", optarg);
+                    return 1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind >= argc || seconds <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // The corpus is centred on 51.5N 0.5W; the receiver is placed there
+    // for the surface and receiver-relative positions
+    Modes.receiver.latitude = 51.5;
+    Modes.receiver.longitude = -0.5;
+    Modes.bUserFlags |= MODES_USER_LATLON_VALID;
+
+    Modes.demodulate = demodSelect(Modes.sample_rate);
+    Modes.trailing_samples = (MODES_PREAMBLE_US + MODES_LONG_MSG_BITS + 16) * 1e-6 * Modes.sample_rate;
+
+    modesChecksumInit(Modes.nfix_crc, NULL);
+    icaoFilterInit();
+    modeACInit();
+    demod2400Init();
+
+    if (!load(argv[optind]) || !modulate() || !fillBuffers() || !corrupt() || !prepareMessages() || !beastEncode())
+        return 1;
+
+    fprintf(stderr, "Running each stage for %.1f seconds:\n", seconds);
+
+    runConvert("convert.uc8", INPUT_UC8, iq_uc8, 2, false);
+    runConvert("convert.uc8-dc", INPUT_UC8, iq_uc8, 2, true);
+    runConvert("convert.sc16", INPUT_SC16, iq_sc16, 4, false);
+    runConvert("convert.sc16q11", INPUT_SC16Q11, iq_sc16q11, 4, false);
+
+    run("demod.2400", "samples", demod2400ScannerName(), iq_samples, passDemod);
+    shift = span;
+
+    run("crc.checksum", "frames", modesChecksumName(), frame_count, passChecksum);
+    run("crc.fix", "frames", NULL, corrupted_count, passFix);
+    run("decode", "frames", NULL, frame_count, passDecode);
+    run("cpr.airborne", "pairs", NULL, airborne_count, passAirborne);
+    run("cpr.surface", "pairs", NULL, surface_count, passSurface);
+    run("cpr.relative", "positions", NULL, position_count, passRelative);
+    run("track", "messages", NULL, decoded_count, passTrack);
+    run("beast.ingest", "frames", NULL, frame_count, passBeast);
+
+    if (!startFanout())
+        return 1;
+    run("beast.fanout", "frames", NULL, frame_count, passBeast);
+
+    if (!writeResults(output, argv[optind]))
+        return 1;
+
+    int regressions = baseline ? compareBaseline(baseline) : 0;
+
+    for (int i = 0; i < fanout_count; ++i)
+        close(fanout_peers[i]);
+    for (unsigned i = 0; i < buffer_count; ++i)
+        free(buffers[i].data);
+    free(buffers);
+    free(frames);
+    free(decoded);
+    free(iq_uc8);
+    free(iq_sc16);
+    free(iq_sc16q11);
+    free(mag_out);
+    free(corrupted);
+    free(airborne_pairs);
+    free(surface_pairs);
+    free(positions);
+    free(beast);
+    free(beast_buf);
+    crcCleanupTables();
+
+    if (regressions < 0)
+        return 1;
+    return regressions ? 2 : 0;
+}
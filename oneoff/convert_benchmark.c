@@ -24,6 +24,8 @@
 
 #include "../readsb.h"
 
+struct _Modes Modes;
+
 static void **testdata_uc8;
 static void **testdata_sc16;
 static void **testdata_sc16q11;
@@ -60,7 +62,7 @@ static uint16_t *outdata;
 // SC16Q11_TABLE_BITS=8:          5.77M samples/second
 // SC16Q11_TABLE_BITS=7:         10.23M samples/second
 
-void prepare()
+static void prepare()
 {
     srand(1);
 
@@ -93,16 +95,18 @@ void prepare()
     }
 }
 
-void test(const char *what, input_format_t format, void **data, double sample_rate, bool filter_dc) {
-    fprintf(stderr, "Benchmarking: %s ", what);
-
+static void test(const char *what, input_format_t format, void **data, double sample_rate, bool filter_dc, unsigned impl) {
     struct converter_state *state;
-    iq_convert_fn converter = init_converter(format, sample_rate, filter_dc, &state);
+    const char *description;
+    iq_convert_fn converter = init_converter_impl(format, sample_rate, filter_dc, impl, &description, &state);
     if (!converter) {
-        fprintf(stderr, "Can't initialize converter\n");
+        if (impl == 0)
+            fprintf(stderr, "Can't initialize converter\n");
         return;
     }
 
+    fprintf(stderr, "Benchmarking: %s [%s] ", what, description);
+
     struct timespec total = { 0, 0 };
     int iterations = 0;
 
@@ -132,21 +136,64 @@ void test(const char *what, input_format_t format, void **data, double sample_ra
             samples / 1e6, nanos / 1e9);
     fprintf(stderr, "  %.2fM samples/second\n",
             samples / nanos * 1e3);
+
+    // Compare against the preferred implementation
+    if (impl > 0) {
+        struct converter_state *ref_state;
+        iq_convert_fn reference = init_converter(format, sample_rate, filter_dc, &ref_state);
+        iq_convert_fn candidate = init_converter_impl(format, sample_rate, filter_dc, impl, NULL, &state);
+        uint16_t *refdata = calloc(MODES_MAG_BUF_SAMPLES, sizeof(uint16_t));
+        int maxdiff = 0;
+
+        reference(data[0], refdata, MODES_MAG_BUF_SAMPLES, ref_state, NULL, NULL);
+        candidate(data[0], outdata, MODES_MAG_BUF_SAMPLES, state, NULL, NULL);
+        for (unsigned i = 0; i < MODES_MAG_BUF_SAMPLES; ++i) {
+            int diff = abs((int) outdata[i] - (int) refdata[i]);
+            if (diff > maxdiff)
+                maxdiff = diff;
+        }
+
+        fprintf(stderr, "  max difference to preferred implementation: %d\n", maxdiff);
+        free(refdata);
+        cleanup_converter(state);
+        cleanup_converter(ref_state);
+    }
+}
+
+// Benchmark the implementation init_converter() picks for each format, or
+// with --all every implementation available on this host.
+
+static void test_all(const char *what, input_format_t format, void **data, double sample_rate, bool filter_dc, bool all) {
+    for (unsigned impl = 0; impl == 0 || all; ++impl) {
+        struct converter_state *state;
+        if (impl > 0 && !init_converter_impl(format, sample_rate, filter_dc, impl, NULL, &state))
+            break;
+        if (impl > 0)
+            cleanup_converter(state);
+
+        test(what, format, data, sample_rate, filter_dc, impl);
+    }
 }
 
 int main(int argc, char **argv)
 {
-    MODES_NOTUSED(argc);
-    MODES_NOTUSED(argv);
+    bool all = false;
+
+    if (argc > 1 && !strcmp(argv[1], "--all")) {
+        all = true;
+    } else if (argc > 1) {
+        fprintf(stderr, "Usage: %s [--all]\n", argv[0]);
+        return 1;
+    }
 
     prepare();
 
-    test("SC16Q11, DC", INPUT_SC16Q11, testdata_sc16q11, 2400000, true);
-    test("SC16Q11, no DC", INPUT_SC16Q11, testdata_sc16q11, 2400000, false);
+    test_all("SC16Q11, DC", INPUT_SC16Q11, testdata_sc16q11, 2400000, true, all);
+    test_all("SC16Q11, no DC", INPUT_SC16Q11, testdata_sc16q11, 2400000, false, all);
 
-    test("UC8, DC", INPUT_UC8, testdata_uc8, 2400000, true);
-    test("UC8, no DC", INPUT_UC8, testdata_uc8, 2400000, false);
+    test_all("UC8, DC", INPUT_UC8, testdata_uc8, 2400000, true, all);
+    test_all("UC8, no DC", INPUT_UC8, testdata_uc8, 2400000, false, all);
 
-    test("SC16, DC", INPUT_SC16, testdata_sc16, 2400000, true);
-    test("SC16, no DC", INPUT_SC16, testdata_sc16, 2400000, false);
+    test_all("SC16, DC", INPUT_SC16, testdata_sc16, 2400000, true, all);
+    test_all("SC16, no DC", INPUT_SC16, testdata_sc16, 2400000, false, all);
 }
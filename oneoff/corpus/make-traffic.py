@@ -0,0 +1,205 @@
+#!/usr/bin/env python3
+
+# Writes traffic.hex, the corpus of oneoff/bench: 30 seconds of synthetic
+# Mode S traffic from 16 aircraft in the air and 2 on the ground around
+# 51.5N 0.5W, as '<' records (12MHz timestamp, signal, frame) in the hex
+# format of the raw input port.
+#
+# The traffic is made up so that the corpus is small, free to ship, the
+# same on every host and exercises every decoder the suite times:
+# DF17 positions (airborne and surface), velocities and identification,
+# DF11 all-call replies, DF0/4/5 surveillance and DF20/21 Comm-B replies.
+# About 2% of the DF17 frames have one bit flipped for the error
+# correction and 1% of the records are noise.
+#
+# The output only depends on the seed, so rerunning it must not change the
+# checked-in file. Run me like this:
+#  ./make-traffic.py > traffic.hex
+
+import math, random, sys
+
+SEED = 56
+SECONDS = 30
+CENTRE = (51.5, -0.5)
+CHARSET = '#ABCDEFGHIJKLMNOPQRSTUVWXYZ##### ###############0123456789######'
+
+rng = random.Random(SEED)
+
+
+def crc(bits, value):
+    # Mode S CRC-24 of the first bits of value, MSB first
+    poly = 0xfff409
+    c = 0
+    for i in range(bits - 1, -1, -1):
+        c ^= ((value >> i) & 1) << 23
+        c = ((c << 1) ^ poly) & 0xffffff if c & 0x800000 else (c << 1) & 0xffffff
+    return c
+
+
+def frame(bits, value):
+    # append the parity of a DF11/17 frame
+    return (value << 24) | crc(bits - 24, value), bits
+
+
+def frame_ap(bits, value, addr):
+    # append address/parity
+    return (value << 24) | (crc(bits - 24, value) ^ addr), bits
+
+
+def nl(lat):
+    if lat == 0:
+        return 59
+    if abs(lat) == 87:
+        return 2
+    if abs(lat) > 87:
+        return 1
+    a = 1 - math.cos(math.pi / 30)
+    b = math.cos(math.pi / 180 * abs(lat)) ** 2
+    return int(math.floor(2 * math.pi / math.acos(1 - a / b)))
+
+
+def cpr(lat, lon, odd, surface):
+    span = 90.0 if surface else 360.0
+    dlat = span / (60 - odd)
+    yz = int(math.floor(131072 * (lat % dlat) / dlat + 0.5))
+    rlat = dlat * (yz / 131072 + math.floor(lat / dlat))
+    dlon = span / max(nl(rlat) - odd, 1)
+    xz = int(math.floor(131072 * (lon % dlon) / dlon + 0.5))
+    return yz & 0x1ffff, xz & 0x1ffff
+
+
+def alt12(alt):
+    n = (alt + 1000) // 25
+    return ((n & 0x7f0) << 1) | 0x10 | (n & 0xf)
+
+
+def ac13(alt):
+    n = (alt + 1000) // 25
+    return ((n & 0x7e0) << 2) | ((n & 0x10) << 1) | 0x10 | (n & 0xf)
+
+
+def id13(squawk):
+    a, b, c, d = (int(ch) for ch in '%04d' % squawk)
+    bit = lambda v, n: (v >> n) & 1
+    order = [(c, 0), (a, 0), (c, 1), (a, 1), (c, 2), (a, 2), None,
+             (b, 0), (d, 0), (b, 1), (d, 1), (b, 2), (d, 2)]
+    v = 0
+    for o in order:
+        v = (v << 1) | (bit(*o) if o else 0)
+    return v
+
+
+def chars(callsign):
+    v = 0
+    for ch in callsign.ljust(8)[:8]:
+        v = (v << 6) | CHARSET.index(ch)
+    return v
+
+
+class Aircraft:
+    def __init__(self, n, surface):
+        self.addr = rng.randrange(0x400000, 0x440000)
+        self.callsign = '%s%d' % (rng.choice(['BAW', 'EZY', 'RYR', 'DLH', 'KLM', 'AFR']), rng.randrange(10, 9999))
+        self.squawk = int(''.join(rng.choice('01234567') for i in range(4)))
+        self.surface = surface
+        spread = 0.02 if surface else 2.0
+        self.lat = CENTRE[0] + rng.uniform(-spread, spread)
+        self.lon = CENTRE[1] + rng.uniform(-spread, spread) * 1.6
+        speed = rng.uniform(5, 20) if surface else rng.uniform(180, 480) # knots
+        self.track = rng.uniform(0, 360)
+        self.vn = speed * math.cos(math.radians(self.track))
+        self.ve = speed * math.sin(math.radians(self.track))
+        self.alt = 0 if surface else rng.randrange(40, 400) * 100
+        self.rate = 0 if surface else rng.choice([0, 0, -1280, 1600]) # fpm
+        self.signal = rng.randrange(40, 250)
+        self.odd = 0
+
+    def move(self, dt):
+        self.lat += self.vn * 1852 / 3600 * dt / 111120
+        self.lon += self.ve * 1852 / 3600 * dt / (111120 * math.cos(math.radians(self.lat)))
+        self.alt = max(0, self.alt + self.rate * dt / 60) if not self.surface else 0
+
+    def es(self, me):
+        return frame(112, (17 << 83) | (5 << 80) | (self.addr << 56) | me)
+
+    def position(self):
+        self.odd ^= 1
+        lat, lon = cpr(self.lat, self.lon, self.odd, self.surface)
+        if self.surface:
+            speed = math.hypot(self.vn, self.ve)
+            mov = min(124, 9 + int(speed)) # a valid movement code, not the exact speed
+            trk = int(self.track * 128 / 360) & 0x7f
+            me = (6 << 51) | (mov << 44) | (1 << 43) | (trk << 36)
+        else:
+            me = (11 << 51) | (alt12(int(self.alt // 25 * 25)) << 36)
+        return self.es(me | (self.odd << 34) | (lat << 17) | lon)
+
+    def velocity(self):
+        vew = int(abs(self.ve)) + 1
+        vns = int(abs(self.vn)) + 1
+        vr = abs(self.rate) // 64 + 1
+        me = (19 << 51) | (1 << 48) | ((self.ve < 0) << 42) | (min(vew, 1023) << 32)
+        me |= ((self.vn < 0) << 31) | (min(vns, 1023) << 21) | (1 << 20) | ((self.rate < 0) << 19) | (vr << 10)
+        return self.es(me)
+
+    def ident(self):
+        return self.es((4 << 51) | (3 << 48) | chars(self.callsign))
+
+    def all_call(self):
+        return frame(56, (11 << 27) | (5 << 24) | self.addr)
+
+    def surveillance(self, df):
+        if df == 0:
+            return frame_ap(56, (0 << 27) | ac13(int(self.alt)), self.addr)
+        field = ac13(int(self.alt)) if df == 4 else id13(self.squawk)
+        return frame_ap(56, (df << 27) | field, self.addr)
+
+    def comm_b(self, df):
+        field = ac13(int(self.alt)) if df == 20 else id13(self.squawk)
+        mb = (0x20 << 48) | chars(self.callsign)
+        return frame_ap(112, (df << 83) | (field << 56) | mb, self.addr)
+
+
+def main():
+    aircraft = [Aircraft(n, False) for n in range(16)] + [Aircraft(n, True) for n in range(2)]
+    records = []
+
+    for a in aircraft:
+        # messages per second of each kind
+        if a.surface:
+            rates = [(a.position, 1.0), (a.ident, 0.2), (a.all_call, 0.5)]
+        else:
+            rates = [(a.position, 2.0), (a.velocity, 1.0), (a.ident, 0.2), (a.all_call, 1.0),
+                     (lambda: a.surveillance(0), 0.5), (lambda: a.surveillance(4), 0.5),
+                     (lambda: a.surveillance(5), 0.5), (lambda: a.comm_b(20), 0.3),
+                     (lambda: a.comm_b(21), 0.3)]
+
+        events = []
+        for fn, rate in rates:
+            t = rng.uniform(0, 1 / rate)
+            while t < SECONDS:
+                events.append((t, fn))
+                t += rng.uniform(0.5, 1.5) / rate
+        events.sort(key=lambda e: e[0])
+
+        last = 0
+        for t, fn in events:
+            a.move(t - last)
+            last = t
+            value, bits = fn()
+            if value >> 107 == 17 and rng.random() < 0.02:
+                value ^= 1 << rng.randrange(0, 107)
+            signal = max(1, min(255, a.signal + rng.randrange(-8, 9)))
+            records.append((t, signal, value, bits))
+
+    for i in range(len(records) // 100):
+        bits = rng.choice([56, 112])
+        records.append((rng.uniform(0, SECONDS), rng.randrange(1, 40), rng.getrandbits(bits), bits))
+
+    records.sort(key=lambda r: r[0])
+    for t, signal, value, bits in records:
+        print('<%012x%02x%0*x;' % (int(t * 12e6), signal, bits // 4, value))
+
+
+if __name__ == '__main__':
+    main()
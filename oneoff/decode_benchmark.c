@@ -0,0 +1,476 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// decode_benchmark.c: benchmark for Mode S message decoding and tracking
+//
+// Copyright (c) 2020 Michael Wolf <michael@mictronics.de>
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Loads a corpus of Mode S frames, either a Beast binary capture or hex
+// lines as accepted on the raw input port (*, :, @, % and < records), and
+// replays it through decodeModesMessage() and trackUpdateFromMessage()
+// repeatedly at full speed with networking disabled.
+//
+// The first phase times whole passes over the corpus for the overall
+// message rate. The second phase times every message on its own and
+// reports the cost per DF and per extended squitter type code, with the
+// overhead of reading the clock measured up front and subtracted.
+//
+// Usage: decode_benchmark [-f fixbits] [-s seconds] <file>
+
+#include "../readsb.h"
+
+#include <getopt.h>
+
+struct _Modes Modes;
+
+struct frame {
+    uint64_t timestampMsg; // 12MHz clock, 0 if the record had none
+    uint64_t sysTimestampMsg; // relative to the first frame
+    double signalLevel;
+    unsigned char msg[MODES_LONG_MSG_BYTES];
+};
+
+struct class_stats {
+    uint64_t count;
+    uint64_t rejected;
+    uint64_t nanos;
+    unsigned mesub; // ES only: subtype seen first, to name the type code
+};
+
+static struct frame *frames;
+static unsigned frame_count;
+static unsigned frame_alloc;
+static unsigned frames_skipped;
+
+static struct class_stats df_stats[32];
+static struct class_stats es_stats[32];
+
+void receiverPositionChanged(float lat, float lon, float alt) {
+    /* nothing */
+    (void) lat;
+    (void) lon;
+    (void) alt;
+}
+
+static int hexDigitVal(int c) {
+    c = tolower(c);
+    if (c >= '0' && c <= '9') return c - '0';
+    else if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    else return -1;
+}
+
+static struct frame *newFrame(void) {
+    if (frame_count == frame_alloc) {
+        unsigned alloc = frame_alloc ? frame_alloc * 2 : 4096;
+        struct frame *newframes = realloc(frames, alloc * sizeof (*frames));
+        if (!newframes) {
+            fprintf(stderr, "Out of memory\n");
+            return NULL;
+        }
+        frames = newframes;
+        frame_alloc = alloc;
+    }
+
+    struct frame *f = &frames[frame_count];
+    memset(f, 0, sizeof (*f));
+    return f;
+}
+
+// Parse one hex record the same way decodeHexMessage() does.
+// Returns false if the line is not a Mode S frame.
+
+static bool parseHexLine(char *hex, struct frame *f) {
+    int l = strlen(hex);
+
+    while (l && isspace(hex[l - 1]))
+        hex[--l] = '\0';
+    while (isspace(*hex)) {
+        hex++;
+        l--;
+    }
+
+    if (l < 2 || hex[l - 1] != ';')
+        return false;
+
+    switch (hex[0]) {
+        case '<':
+            if (l < 16)
+                return false;
+            for (int j = 1; j <= 12; ++j)
+                f->timestampMsg = (f->timestampMsg << 4) | (hexDigitVal(hex[j]) & 15);
+            f->signalLevel = ((hexDigitVal(hex[13]) << 4) | hexDigitVal(hex[14])) / 255.0;
+            f->signalLevel = f->signalLevel * f->signalLevel;
+            hex += 15;
+            l -= 16;
+            break;
+
+        case '@':
+        case '%':
+            if (l < 14)
+                return false;
+            for (int j = 1; j <= 12; ++j)
+                f->timestampMsg = (f->timestampMsg << 4) | (hexDigitVal(hex[j]) & 15);
+            hex += 13;
+            l -= 14;
+            break;
+
+        case '*':
+        case ':':
+            hex++;
+            l -= 2;
+            break;
+
+        default:
+            return false;
+    }
+
+    // Mode A/C records are skipped along with anything malformed
+    if (l != MODES_SHORT_MSG_BYTES * 2 && l != MODES_LONG_MSG_BYTES * 2)
+        return false;
+
+    for (int j = 0; j < l; j += 2) {
+        int high = hexDigitVal(hex[j]);
+        int low = hexDigitVal(hex[j + 1]);
+
+        if (high == -1 || low == -1)
+            return false;
+        f->msg[j / 2] = (high << 4) | low;
+    }
+
+    return true;
+}
+
+// Parse one unescaped Beast frame as decodeBeastFrame() does.
+// Returns false if it is not a Mode S frame.
+
+static bool parseBeastFrame(const char *p, struct frame *f) {
+    int msgLen;
+    char ch;
+
+    ch = *p++;
+    if (ch == '2') {
+        msgLen = MODES_SHORT_MSG_BYTES;
+    } else if (ch == '3') {
+        msgLen = MODES_LONG_MSG_BYTES;
+    } else {
+        return false; // Mode A/C, Radarcape position and HULC frames
+    }
+
+    for (int j = 0; j < 6; j++) {
+        ch = *p++;
+        f->timestampMsg = f->timestampMsg << 8 | (ch & 255);
+    }
+
+    ch = *p++;
+    f->signalLevel = ((unsigned char) ch / 255.0);
+    f->signalLevel = f->signalLevel * f->signalLevel;
+
+    memcpy(f->msg, p, msgLen);
+
+    return true;
+}
+
+static bool load(const char *filename) {
+    struct stat st;
+    char *data, *eod;
+    int fd;
+
+    if ((fd = open(filename, O_RDONLY)) < 0) {
+        fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+        return false;
+    }
+
+    if (fstat(fd, &st) < 0 || !(data = malloc(st.st_size + 1))) {
+        fprintf(stderr, "%s: can't allocate %lld bytes\n", filename, (long long) st.st_size);
+        close(fd);
+        return false;
+    }
+
+    ssize_t len = 0;
+    while (len < st.st_size) {
+        ssize_t nread = read(fd, data + len, st.st_size - len);
+        if (nread <= 0)
+            break;
+        len += nread;
+    }
+    close(fd);
+    data[len] = '\0';
+    eod = data + len;
+
+    bool beast = (len > 0 && data[0] == 0x1a);
+    struct frame *f;
+
+    if (beast) {
+        struct beast_scan scan = {data, eod, 0, 0};
+        char *frame;
+        int flen;
+
+        // a truncated final frame is left alone
+        while ((frame = beastNextFrame(&scan, &flen))) {
+            if (!(f = newFrame()))
+                break;
+            if (parseBeastFrame(frame, f))
+                frame_count++;
+            else
+                frames_skipped++;
+        }
+    } else {
+        char *line = data, *next;
+        for (; line < eod; line = next) {
+            if ((next = memchr(line, '\n', eod - line)))
+                *next++ = '\0';
+            else
+                next = eod;
+            if (!*line)
+                continue;
+            if (!(f = newFrame()))
+                break;
+            if (parseHexLine(line, f))
+                frame_count++;
+            else
+                frames_skipped++;
+        }
+    }
+
+    free(data);
+
+    if (!frame_count) {
+        fprintf(stderr, "%s: no Mode S frames\n", filename);
+        return false;
+    }
+
+    // Derive reception times from the 12MHz clock, kept monotonic so that
+    // merged captures don't run the tracker backwards; records without a
+    // timestamp are spaced 1ms apart.
+    uint64_t first = frames[0].timestampMsg;
+    uint64_t last = 0;
+    for (unsigned i = 0; i < frame_count; ++i) {
+        uint64_t sys = last + 1;
+        if (frames[i].timestampMsg >= first && frames[i].timestampMsg)
+            sys = receiveclock_ms_elapsed(first, frames[i].timestampMsg);
+        if (sys < last)
+            sys = last;
+        frames[i].sysTimestampMsg = last = sys;
+    }
+
+    fprintf(stderr, "Loaded %u Mode S frames from %s %s (%u other records skipped), %.1f seconds of traffic\n",
+            frame_count, beast ? "Beast capture" : "hex file", filename, frames_skipped,
+            frames[frame_count - 1].sysTimestampMsg / 1000.0);
+    return true;
+}
+
+// Each pass is shifted forward in time past the previous one, so the
+// tracker sees a continuous stream rather than the same second replayed.
+
+static inline int replay(const struct frame *f, uint64_t shift, struct modesMessage *mm) {
+    static struct modesMessage zeroMessage;
+    unsigned char msg[MODES_LONG_MSG_BYTES];
+    int result;
+
+    *mm = zeroMessage;
+    mm->remote = 1;
+    mm->timestampMsg = f->timestampMsg ? f->timestampMsg + shift * 12000 : 0;
+    mm->sysTimestampMsg = Modes.startup_time + f->sysTimestampMsg + shift;
+    mm->signalLevel = f->signalLevel;
+
+    // decodeModesMessage() may repair the message in place
+    memcpy(msg, f->msg, sizeof (msg));
+    if ((result = decodeModesMessage(mm, msg)) >= 0)
+        trackUpdateFromMessage(mm);
+    return result;
+}
+
+static inline uint64_t elapsed_ns(const struct timespec *start, const struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1000000000ULL + end->tv_nsec - start->tv_nsec;
+}
+
+static void report_class(const char *label, const char *name, const struct class_stats *cs, uint64_t total) {
+    double ns = cs->count ? (double) cs->nanos / cs->count : 0.0;
+    fprintf(stderr, "  %-6s %10llu %5.1f%% %8llu %9.1f %8.2fM  %s\n", label,
+            (unsigned long long) cs->count, 100.0 * cs->count / total,
+            (unsigned long long) cs->rejected, ns, ns > 0 ? 1e3 / ns : 0.0, name);
+}
+
+static void report(uint64_t total) {
+    char label[8];
+
+    fprintf(stderr, "  class     messages  share rejected   ns/msg    msgs/s\n");
+    for (int df = 0; df < 32; ++df) {
+        if (!df_stats[df].count)
+            continue;
+        snprintf(label, sizeof (label), "DF%d", df);
+        report_class(label, "", &df_stats[df], total);
+    }
+
+    fprintf(stderr, "  extended squitter (DF17/18) by type code:\n");
+    for (int type = 0; type < 32; ++type) {
+        if (!es_stats[type].count)
+            continue;
+        snprintf(label, sizeof (label), "TC%d", type);
+        report_class(label, esTypeName(type, es_stats[type].mesub), &es_stats[type], total);
+    }
+}
+
+int main(int argc, char **argv) {
+    int seconds = 5;
+    int opt;
+
+    memset(&Modes, 0, sizeof (Modes));
+    Modes.nfix_crc = 1;
+    Modes.check_crc = 1;
+    Modes.quiet = 1;
+    Modes.maxRange = 1852 * 300;
+    Modes.startup_time = mstime();
+    receiver__init(&Modes.receiver);
+
+    while ((opt = getopt(argc, argv, "f:s:")) != -1) {
+        switch (opt) {
+            case 'f':
+                Modes.nfix_crc = atoi(optarg);
+                if (Modes.nfix_crc > MODES_MAX_BITERRORS)
+                    Modes.nfix_crc = MODES_MAX_BITERRORS;
+                break;
+            case 's':
+                seconds = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-f fixbits] [-s seconds] <file>\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind >= argc) {
+        fprintf(stderr, "Usage: %s [-f fixbits] [-s seconds] <file>\n", argv[0]);
+        return 1;
+    }
+
+    modesChecksumInit(Modes.nfix_crc, NULL);
+    icaoFilterInit();
+    modeACInit();
+
+    if (!load(argv[optind]))
+        return 1;
+
+    uint64_t span = frames[frame_count - 1].sysTimestampMsg + 1000;
+    uint64_t shift = 0;
+    struct modesMessage mm;
+
+    // One untimed pass so the ICAO filter and aircraft table are populated
+    // as they would be in steady state.
+    for (unsigned i = 0; i < frame_count; ++i)
+        replay(&frames[i], shift, &mm);
+    shift += span;
+
+    fprintf(stderr, "Benchmarking: %s CRC, %d-bit error correction ", modesChecksumName(), Modes.nfix_crc);
+
+    struct timespec total = {0, 0};
+    uint64_t messages = 0, accepted = 0;
+    unsigned passes = 0;
+
+    while (total.tv_sec < seconds) {
+        struct timespec start, end;
+        time_t sec = total.tv_sec;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        for (unsigned i = 0; i < frame_count; ++i) {
+            if (replay(&frames[i], shift, &mm) >= 0)
+                accepted++;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        total.tv_sec += end.tv_sec - start.tv_sec;
+        total.tv_nsec += end.tv_nsec - start.tv_nsec;
+        normalize_timespec(&total);
+        if (total.tv_sec != sec)
+            fprintf(stderr, ".");
+        messages += frame_count;
+        shift += span;
+        passes++;
+    }
+
+    double nanos = total.tv_sec * 1e9 + total.tv_nsec;
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  %u passes, %llu messages in %.6f seconds\n", passes, (unsigned long long) messages, nanos / 1e9);
+    fprintf(stderr, "  %.1f accepted per pass\n", (double) accepted / passes);
+    fprintf(stderr, "  %.3fM messages/second\n", messages / nanos * 1e3);
+    fprintf(stderr, "  %.1f ns per message\n", nanos / messages);
+
+    // The cost of a clock read, taken as the smallest of many, is removed
+    // from every per-message sample below.
+    uint64_t overhead = ~(uint64_t) 0;
+    for (int i = 0; i < 100000; ++i) {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        uint64_t ns = elapsed_ns(&start, &end);
+        if (ns < overhead)
+            overhead = ns;
+    }
+
+    fprintf(stderr, "Per-message timing (%llu ns clock overhead subtracted) ", (unsigned long long) overhead);
+
+    struct timespec breakdown = {0, 0};
+    messages = 0;
+
+    while (breakdown.tv_sec < seconds) {
+        struct timespec pass_start, pass_end;
+        time_t sec = breakdown.tv_sec;
+
+        clock_gettime(CLOCK_MONOTONIC, &pass_start);
+
+        for (unsigned i = 0; i < frame_count; ++i) {
+            struct timespec start, end;
+            unsigned df = frames[i].msg[0] >> 3;
+            int result;
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            result = replay(&frames[i], shift, &mm);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+
+            uint64_t ns = elapsed_ns(&start, &end);
+            ns = ns > overhead ? ns - overhead : 0;
+
+            df_stats[df].count++;
+            df_stats[df].nanos += ns;
+            if (result < 0) {
+                df_stats[df].rejected++;
+            } else if (mm.msgtype == 17 || mm.msgtype == 18) {
+                struct class_stats *es = &es_stats[mm.metype & 31];
+                if (!es->count)
+                    es->mesub = mm.mesub;
+                es->count++;
+                es->nanos += ns;
+            }
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &pass_end);
+        breakdown.tv_sec += pass_end.tv_sec - pass_start.tv_sec;
+        breakdown.tv_nsec += pass_end.tv_nsec - pass_start.tv_nsec;
+        normalize_timespec(&breakdown);
+        if (breakdown.tv_sec != sec)
+            fprintf(stderr, ".");
+        messages += frame_count;
+        shift += span;
+    }
+
+    fprintf(stderr, "\n");
+    report(messages);
+
+    free(frames);
+    crcCleanupTables();
+
+    return 0;
+}
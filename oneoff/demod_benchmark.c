@@ -0,0 +1,285 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// demod_benchmark.c: benchmark for the Mode S demodulator
+//
+// Copyright (c) 2020 Michael Wolf <michael@mictronics.de>
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Loads a recorded IQ file (as accepted by --ifile) into preallocated
+// magnitude buffers using the same converters as sdr_ifile.c, then runs
+// the demodulator for the sample rate (-r, in MHz) over those buffers
+// repeatedly at full speed.
+//
+// Usage: demod_benchmark [-f uc8|sc16|sc16q11] [-r MHz] [-a] [-d] [-t threads] [-s seconds] <file>
+
+#include "../readsb.h"
+
+#include <getopt.h>
+
+struct _Modes Modes;
+
+static struct mag_buf *buffers;
+static unsigned buffer_count;
+
+void receiverPositionChanged(float lat, float lon, float alt) {
+    /* nothing */
+    (void) lat;
+    (void) lon;
+    (void) alt;
+}
+
+// Read the whole file and convert it into magnitude buffers, carrying the
+// trailing overlap of each buffer into the start of the next one exactly
+// like fifo_enqueue() does.
+
+static bool load(const char *filename, input_format_t format) {
+    unsigned bytes_per_sample = (format == INPUT_UC8) ? 2 : 4;
+    unsigned overlap = Modes.trailing_samples;
+    struct converter_state *state;
+    iq_convert_fn converter;
+    uint64_t sampleCounter = 0;
+    char *readbuf;
+    int fd;
+
+    if ((fd = open(filename, O_RDONLY)) < 0) {
+        fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+        return false;
+    }
+
+    converter = init_converter(format, Modes.sample_rate, Modes.dc_filter, &state);
+    if (!converter) {
+        fprintf(stderr, "Can't initialize converter\n");
+        close(fd);
+        return false;
+    }
+
+    readbuf = malloc(MODES_MAG_BUF_SAMPLES * bytes_per_sample);
+    if (!readbuf) {
+        fprintf(stderr, "Out of memory\n");
+        close(fd);
+        return false;
+    }
+
+    while (true) {
+        ssize_t nread = read(fd, readbuf, MODES_MAG_BUF_SAMPLES * bytes_per_sample);
+        if (nread <= 0)
+            break;
+
+        unsigned samples = nread / bytes_per_sample;
+        struct mag_buf *newbufs = realloc(buffers, (buffer_count + 1) * sizeof (*buffers));
+        if (!newbufs) {
+            fprintf(stderr, "Out of memory\n");
+            break;
+        }
+        buffers = newbufs;
+
+        struct mag_buf *buf = &buffers[buffer_count];
+        memset(buf, 0, sizeof (*buf));
+        buf->totalLength = MODES_MAG_BUF_SAMPLES + overlap;
+        if (!(buf->data = calloc(buf->totalLength, sizeof (buf->data[0])))) {
+            fprintf(stderr, "Out of memory\n");
+            break;
+        }
+
+        buf->overlap = overlap;
+        buf->validLength = overlap + samples;
+        buf->sampleTimestamp = sampleCounter * 12e6 / Modes.sample_rate;
+        buf->sysTimestamp = buf->sampleTimestamp / 12000U + Modes.startup_time;
+        converter(readbuf, &buf->data[overlap], samples, state, &buf->mean_level, &buf->mean_power);
+
+        if (buffer_count > 0) {
+            struct mag_buf *prev = &buffers[buffer_count - 1];
+            memcpy(buf->data, &prev->data[prev->validLength - overlap], overlap * sizeof (buf->data[0]));
+        }
+
+        // the trailing overlap must be readable even for a short final block
+        memset(&buf->data[buf->validLength], 0, (buf->totalLength - buf->validLength) * sizeof (buf->data[0]));
+
+        sampleCounter += samples;
+        buffer_count++;
+    }
+
+    free(readbuf);
+    cleanup_converter(state);
+    close(fd);
+
+    if (!buffer_count) {
+        fprintf(stderr, "%s: no samples\n", filename);
+        return false;
+    }
+
+    fprintf(stderr, "Loaded %.2fM samples into %u buffers\n", sampleCounter / 1e6, buffer_count);
+    return true;
+}
+
+static void report(const struct stats *st, unsigned passes, const struct timespec *total) {
+    double samples = (double) st->samples_processed;
+    double nanos = total->tv_sec * 1e9 + total->tv_nsec;
+    uint32_t accepted = 0;
+
+    for (int i = 0; i <= MODES_MAX_BITERRORS; ++i)
+        accepted += st->demod_accepted[i];
+
+    fprintf(stderr, "  %u passes, %.2fM samples in %.6f seconds\n", passes, samples / 1e6, nanos / 1e9);
+    fprintf(stderr, "  %.2fM samples/second\n", samples / nanos * 1e3);
+    fprintf(stderr, "  %.1f preambles examined per pass\n", (double) st->demod_preambles / passes);
+    fprintf(stderr, "    %.1f with bad message format or invalid CRC\n", (double) st->demod_rejected_bad / passes);
+    fprintf(stderr, "    %.1f with unrecognized ICAO address\n", (double) st->demod_rejected_unknown_icao / passes);
+    fprintf(stderr, "    %.1f accepted with correct CRC\n", (double) st->demod_accepted[0] / passes);
+    for (int i = 1; i <= Modes.nfix_crc; ++i)
+        fprintf(stderr, "    %.1f accepted with %d-bit error repaired\n", (double) st->demod_accepted[i] / passes, i);
+    fprintf(stderr, "  %.1f ns per accepted message\n", accepted ? nanos / accepted : 0.0);
+
+    // only the 2.4MHz demodulator works with phases
+    if (Modes.mode_ac)
+        fprintf(stderr, "  %.1f Mode A/C messages per pass\n", (double) st->demod_modeac / passes);
+
+    if (Modes.demodulate != demodulate2400 && Modes.demodulate != demodulate2400Fused)
+        return;
+
+    fprintf(stderr, "  phase      scored  best-scoring\n");
+    for (int i = 0; i < 5; ++i) {
+        fprintf(stderr, "  %5d  %10.1f  %12.1f\n", i + 4,
+                (double) st->demod_preamblePhase[i] / passes,
+                (double) st->demod_bestPhase[i] / passes);
+    }
+}
+
+int main(int argc, char **argv) {
+    input_format_t format = INPUT_UC8;
+    int threads = 1;
+    int seconds = 5;
+    int opt;
+
+    memset(&Modes, 0, sizeof (Modes));
+    Modes.sdr_type = SDR_IFILE;
+    Modes.sample_rate = 2400000.0;
+    Modes.preambleThreshold = PREAMBLE_THRESHOLD_DEFAULT;
+    Modes.nfix_crc = 1;
+    Modes.check_crc = 1;
+    Modes.quiet = 1;
+    Modes.maxRange = 1852 * 300;
+    Modes.startup_time = Modes.ifile_now = mstime();
+    receiver__init(&Modes.receiver);
+
+    while ((opt = getopt(argc, argv, "f:r:adt:s:")) != -1) {
+        switch (opt) {
+            case 'f':
+                if (!strcasecmp(optarg, "uc8")) {
+                    format = INPUT_UC8;
+                } else if (!strcasecmp(optarg, "sc16")) {
+                    format = INPUT_SC16;
+                } else if (!strcasecmp(optarg, "sc16q11")) {
+                    format = INPUT_SC16Q11;
+                } else {
+                    fprintf(stderr, "Input format '%s' not understood (supported values: UC8, SC16, SC16Q11)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'r':
+                Modes.sample_rate = atof(optarg) * 1e6;
+                break;
+            case 'a':
+                Modes.mode_ac = 1;
+                break;
+            case 'd':
+                Modes.dc_filter = 1;
+                break;
+            case 't':
+                threads = atoi(optarg);
+                break;
+            case 's':
+                seconds = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-f uc8|sc16|sc16q11] [-r MHz] [-a] [-d] [-t threads] [-s seconds] <file>\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind >= argc) {
+        fprintf(stderr, "Usage: %s [-f uc8|sc16|sc16q11] [-r MHz] [-a] [-d] [-t threads] [-s seconds] <file>\n", argv[0]);
+        return 1;
+    }
+
+    if (!(Modes.demodulate = demodSelect(Modes.sample_rate))) {
+        fprintf(stderr, "Unsupported sample rate %.1f MHz\n", Modes.sample_rate / 1e6);
+        return 1;
+    }
+    if (Modes.mode_ac) {
+        if (Modes.demodulate != demodulate2400) {
+            fprintf(stderr, "Mode A/C decoding needs a sample rate of 2.4 MHz\n");
+            return 1;
+        }
+        Modes.demodulate = demodulate2400Fused;
+    }
+    Modes.trailing_samples = (MODES_PREAMBLE_US + MODES_LONG_MSG_BITS + 16) * 1e-6 * Modes.sample_rate;
+
+    modesChecksumInit(Modes.nfix_crc, NULL);
+    icaoFilterInit();
+    modeACInit();
+    demod2400Init();
+
+    if (!load(argv[optind], format))
+        return 1;
+
+    if (Modes.demodulate == demodulate2400 || Modes.demodulate == demodulate2400Fused) {
+        if (threads > 1 && !demod2400StartWorkers(threads))
+            return 1;
+        fprintf(stderr, "Benchmarking: demodulate2400%s, %s preamble scan, %d thread(s) ",
+                Modes.mode_ac ? " with Mode A/C" : "", demod2400ScannerName(), threads);
+    } else {
+        fprintf(stderr, "Benchmarking: %.1f MHz demodulator ", Modes.sample_rate / 1e6);
+    }
+
+    // One untimed pass so the ICAO filter is populated as it would be in steady state.
+    for (unsigned i = 0; i < buffer_count; ++i)
+        Modes.demodulate(&buffers[i]);
+
+    struct timespec total = {0, 0};
+    unsigned passes = 0;
+    reset_stats(&Modes.stats_current);
+
+    // Wall clock rather than thread CPU time, so slices handed to the
+    // demodulator worker threads are accounted for.
+    while (total.tv_sec < seconds) {
+        struct timespec start, end;
+
+        fprintf(stderr, ".");
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        for (unsigned i = 0; i < buffer_count; ++i) {
+            Modes.demodulate(&buffers[i]);
+            Modes.stats_current.samples_processed += buffers[i].validLength - buffers[i].overlap;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        total.tv_sec += end.tv_sec - start.tv_sec;
+        total.tv_nsec += end.tv_nsec - start.tv_nsec;
+        normalize_timespec(&total);
+        passes++;
+    }
+
+    fprintf(stderr, "\n");
+    report(&Modes.stats_current, passes, &total);
+
+    demod2400StopWorkers();
+    for (unsigned i = 0; i < buffer_count; ++i)
+        free(buffers[i].data);
+    free(buffers);
+    crcCleanupTables();
+
+    return 0;
+}
@@ -0,0 +1,546 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// sbs_benchmark.c: benchmark for BaseStation (SBS) encoding and parsing
+//
+// Copyright (c) 2020 Michael Wolf <michael@mictronics.de>
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Loads a Beast binary capture, decodes and tracks its messages once, and
+// then times writing a BaseStation line for each of them and parsing those
+// lines again, both with sbsEncode() / sbsParse() and with the sprintf()
+// and strsep() code the SBS output and input used before them. The lines
+// and the parsed messages of the two are compared first; any difference is
+// reported and fails the run.
+//
+// Usage: sbs_benchmark [-s seconds] [-g] <file>
+//   -g  GNSS altitudes and rates, as --gnss
+
+#include "../readsb.h"
+
+#include <getopt.h>
+
+struct _Modes Modes;
+
+struct message {
+    struct modesMessage mm;
+    struct aircraft *a;
+};
+
+static struct message *messages;
+static unsigned message_count;
+
+void receiverPositionChanged(float lat, float lon, float alt) {
+    /* nothing */
+    (void) lat;
+    (void) lon;
+    (void) alt;
+}
+
+// The previous encoder, as modesSendSBSOutput() had it
+
+static char *legacyEncode(char *p, struct modesMessage *mm, struct aircraft *a, const struct timespec *now) {
+    struct tm stTime_receive, stTime_now;
+    int msgType;
+
+    switch (mm->msgtype) {
+        case 4:
+        case 20:
+            msgType = 5;
+            break;
+
+        case 5:
+        case 21:
+            msgType = 6;
+            break;
+
+        case 0:
+        case 16:
+            msgType = 7;
+            break;
+
+        case 11:
+            msgType = 8;
+            break;
+
+        case 17:
+        case 18:
+            if (mm->metype >= 1 && mm->metype <= 4) {
+                msgType = 1;
+            } else if (mm->metype >= 5 && mm->metype <= 8) {
+                msgType = 2;
+            } else if (mm->metype >= 9 && mm->metype <= 18) {
+                msgType = 3;
+            } else if (mm->metype == 19) {
+                msgType = 4;
+            } else {
+                return NULL;
+            }
+            break;
+
+        default:
+            return NULL;
+    }
+
+    p += sprintf(p, "MSG,%d,1,1,%06X,1,", msgType, mm->addr);
+
+    localtime_r(&now->tv_sec, &stTime_now);
+
+    time_t received = (time_t) (mm->sysTimestampMsg / 1000);
+    localtime_r(&received, &stTime_receive);
+
+    p += sprintf(p, "%04d/%02d/%02d,", (stTime_receive.tm_year + 1900), (stTime_receive.tm_mon + 1), stTime_receive.tm_mday);
+    p += sprintf(p, "%02d:%02d:%02d.%03u,", stTime_receive.tm_hour, stTime_receive.tm_min, stTime_receive.tm_sec, (unsigned) (mm->sysTimestampMsg % 1000));
+
+    p += sprintf(p, "%04d/%02d/%02d,", (stTime_now.tm_year + 1900), (stTime_now.tm_mon + 1), stTime_now.tm_mday);
+    p += sprintf(p, "%02d:%02d:%02d.%03u", stTime_now.tm_hour, stTime_now.tm_min, stTime_now.tm_sec, (unsigned) (now->tv_nsec / 1000000U));
+
+    if (mm->callsign_valid) {
+        p += sprintf(p, ",%s", mm->callsign);
+    } else {
+        p += sprintf(p, ",");
+    }
+
+    if (Modes.use_gnss) {
+        if (mm->altitude_geom_valid) {
+            p += sprintf(p, ",%dH", mm->altitude_geom);
+        } else if (mm->altitude_baro_valid && trackDataValid(&a->geom_delta_valid)) {
+            p += sprintf(p, ",%dH", mm->altitude_baro + a->geom_delta);
+        } else if (mm->altitude_baro_valid) {
+            p += sprintf(p, ",%d", mm->altitude_baro);
+        } else {
+            p += sprintf(p, ",");
+        }
+    } else {
+        if (mm->altitude_baro_valid) {
+            p += sprintf(p, ",%d", mm->altitude_baro);
+        } else if (mm->altitude_geom_valid && trackDataValid(&a->geom_delta_valid)) {
+            p += sprintf(p, ",%d", mm->altitude_geom - a->geom_delta);
+        } else {
+            p += sprintf(p, ",");
+        }
+    }
+
+    if (mm->gs_valid) {
+        p += sprintf(p, ",%.0f", mm->gs.selected);
+    } else {
+        p += sprintf(p, ",");
+    }
+
+    if (mm->heading_valid && mm->heading_type == HEADING_GROUND_TRACK) {
+        p += sprintf(p, ",%.0f", mm->heading);
+    } else {
+        p += sprintf(p, ",");
+    }
+
+    if (mm->cpr_decoded) {
+        p += sprintf(p, ",%1.5f,%1.5f", mm->decoded_lat, mm->decoded_lon);
+    } else {
+        p += sprintf(p, ",,");
+    }
+
+    if (Modes.use_gnss) {
+        if (mm->geom_rate_valid) {
+            p += sprintf(p, ",%dH", mm->geom_rate);
+        } else if (mm->baro_rate_valid) {
+            p += sprintf(p, ",%d", mm->baro_rate);
+        } else {
+            p += sprintf(p, ",");
+        }
+    } else {
+        if (mm->baro_rate_valid) {
+            p += sprintf(p, ",%d", mm->baro_rate);
+        } else if (mm->geom_rate_valid) {
+            p += sprintf(p, ",%d", mm->geom_rate);
+        } else {
+            p += sprintf(p, ",");
+        }
+    }
+
+    if (mm->squawk_valid) {
+        p += sprintf(p, ",%04x", mm->squawk);
+    } else {
+        p += sprintf(p, ",");
+    }
+
+    if (mm->alert_valid) {
+        if (mm->alert) {
+            p += sprintf(p, ",-1");
+        } else {
+            p += sprintf(p, ",0");
+        }
+    } else {
+        p += sprintf(p, ",");
+    }
+
+    if (mm->squawk_valid) {
+        if ((mm->squawk == 0x7500) || (mm->squawk == 0x7600) || (mm->squawk == 0x7700)) {
+            p += sprintf(p, ",-1");
+        } else {
+            p += sprintf(p, ",0");
+        }
+    } else {
+        p += sprintf(p, ",");
+    }
+
+    if (mm->spi_valid) {
+        if (mm->spi) {
+            p += sprintf(p, ",-1");
+        } else {
+            p += sprintf(p, ",0");
+        }
+    } else {
+        p += sprintf(p, ",");
+    }
+
+    switch (mm->airground) {
+        case AIRCRAFT_META__AIR_GROUND__AG_GROUND:
+            p += sprintf(p, ",-1");
+            break;
+        case AIRCRAFT_META__AIR_GROUND__AG_AIRBORNE:
+            p += sprintf(p, ",0");
+            break;
+        default:
+            p += sprintf(p, ",");
+            break;
+    }
+
+    p += sprintf(p, "\r\n");
+    return p;
+}
+
+static int hexDigitVal(int c) {
+    c = tolower(c);
+    if (c >= '0' && c <= '9') return c - '0';
+    else if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    else return -1;
+}
+
+// The previous parser, as decodeSbsLine() had it; modifies the line
+
+static bool legacyParse(char *line, struct modesMessage *mm) {
+    char *p = line;
+    char *t[23];
+
+    for (int i = 1; i < 23; i++) {
+        t[i] = strsep(&p, ",");
+        if (!p && i < 22)
+            return false;
+    }
+
+    if (!t[1] || strcmp(t[1], "MSG") != 0)
+        return false;
+
+    if (!t[2] || strlen(t[2]) != 1)
+        return false;
+
+    if (!t[5] || strlen(t[5]) != 6)
+        return false;
+
+    char *icao = t[5];
+    unsigned char *chars = (unsigned char *) &(mm->addr);
+    for (int j = 0; j < 6; j += 2) {
+        int high = hexDigitVal(icao[j]);
+        int low = hexDigitVal(icao[j + 1]);
+
+        if (high == -1 || low == -1) return false;
+        chars[2 - j / 2] = (high << 4) | low;
+    }
+    if (mm->addr == 0)
+        return false;
+
+    if (t[11] && strlen(t[11]) > 0) {
+        strncpy(mm->callsign, t[11], 9);
+        mm->callsign_valid = 1;
+    }
+    if (t[12] && strlen(t[12]) > 0) {
+        mm->altitude_baro = atoi(t[12]);
+        if (mm->altitude_baro < -5000 || mm->altitude_baro > 100000)
+            return false;
+        mm->altitude_baro_valid = 1;
+        mm->altitude_baro_unit = UNIT_FEET;
+    }
+    if (t[13] && strlen(t[13]) > 0) {
+        mm->gs.v0 = strtod(t[13], NULL);
+        if (mm->gs.v0 > 0)
+            mm->gs_valid = 1;
+    }
+    if (t[14] && strlen(t[14]) > 0) {
+        mm->heading_valid = 1;
+        mm->heading = strtod(t[14], NULL);
+        mm->heading_type = HEADING_GROUND_TRACK;
+    }
+    if (t[15] && strlen(t[15]) && t[16] && strlen(t[16])) {
+        mm->decoded_lat = strtod(t[15], NULL);
+        mm->decoded_lon = strtod(t[16], NULL);
+    }
+    if (t[17] && strlen(t[17]) > 0) {
+        mm->baro_rate = atoi(t[17]);
+        mm->baro_rate_valid = 1;
+    }
+    if (t[18] && strlen(t[18]) > 0) {
+        long int tmp = strtol(t[18], NULL, 10);
+        if (tmp > 0) {
+            mm->squawk = (tmp / 1000) * 16 * 16 * 16 + (tmp / 100 % 10) * 16 * 16 + (tmp / 10 % 10) * 16 + (tmp % 10);
+            mm->squawk_valid = 1;
+        }
+    }
+    if (t[22] && strlen(t[22]) > 0 && atoi(t[22]) > 0) {
+        mm->airground = AIRCRAFT_META__AIR_GROUND__AG_GROUND;
+    }
+
+    return true;
+}
+
+static bool load(const char *filename) {
+    static struct modesMessage zeroMessage;
+    struct stat st;
+    char *data;
+    int fd;
+
+    if ((fd = open(filename, O_RDONLY)) < 0) {
+        fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+        return false;
+    }
+
+    if (fstat(fd, &st) < 0 || !(data = malloc(st.st_size + 1))) {
+        fprintf(stderr, "%s: can't allocate %lld bytes\n", filename, (long long) st.st_size);
+        close(fd);
+        return false;
+    }
+
+    ssize_t len = 0;
+    while (len < st.st_size) {
+        ssize_t nread = read(fd, data + len, st.st_size - len);
+        if (nread <= 0)
+            break;
+        len += nread;
+    }
+    close(fd);
+
+    if (!len || data[0] != 0x1a) {
+        fprintf(stderr, "%s: not a Beast capture\n", filename);
+        free(data);
+        return false;
+    }
+
+    // Every frame could be a message
+    if (!(messages = malloc(sizeof (*messages) * (len / (2 + 7 + MODES_SHORT_MSG_BYTES) + 1)))) {
+        fprintf(stderr, "Out of memory\n");
+        free(data);
+        return false;
+    }
+
+    struct beast_scan scan = {data, data + len, 0, 0};
+    unsigned frames = 0;
+    char *frame;
+    int flen;
+
+    while ((frame = beastNextFrame(&scan, &flen))) {
+        struct message *m = &messages[message_count];
+        unsigned char msg[MODES_LONG_MSG_BYTES];
+        uint64_t timestamp = 0;
+
+        frames++;
+        if (frame[0] != '2' && frame[0] != '3')
+            continue;
+
+        for (int j = 1; j <= 6; j++)
+            timestamp = timestamp << 8 | (frame[j] & 255);
+
+        m->mm = zeroMessage;
+        m->mm.remote = 1;
+        m->mm.timestampMsg = timestamp;
+        m->mm.sysTimestampMsg = Modes.startup_time + frames * 10;
+        m->mm.signalLevel = (unsigned char) frame[7] / 255.0;
+        memcpy(msg, frame + 8, frame[0] == '2' ? MODES_SHORT_MSG_BYTES : MODES_LONG_MSG_BYTES);
+
+        if (decodeModesMessage(&m->mm, msg) < 0)
+            continue;
+        m->a = trackUpdateFromMessage(&m->mm);
+        if (!m->a || (m->mm.addr & MODES_NON_ICAO_ADDRESS))
+            continue;
+        message_count++;
+    }
+    free(data);
+
+    fprintf(stderr, "Loaded %u Beast frames from %s, %u messages with an ICAO address\n", frames, filename, message_count);
+    return message_count > 0;
+}
+
+typedef char *(*encode_fn)(char *p, struct modesMessage *mm, struct aircraft *a, const struct timespec *now);
+
+// Encode every message into lines, NUL separated; returns the line count
+
+static unsigned encodeAll(encode_fn encode, char *out, const struct timespec *now) {
+    unsigned lines = 0;
+
+    for (unsigned i = 0; i < message_count; ++i) {
+        char *end = encode(out, &messages[i].mm, messages[i].a, now);
+        if (end) {
+            *end = '\0';
+            out = end + 1;
+            lines++;
+        }
+    }
+    return lines;
+}
+
+static void reportRate(const char *what, double nanos, uint64_t count, uint64_t bytes) {
+    fprintf(stderr, "  %-22s %8.1f ns per line, %6.2fM lines/second, %7.1f MB/second\n",
+            what, nanos / count, count / nanos * 1e3, bytes / nanos * 1e3);
+}
+
+int main(int argc, char **argv) {
+    int seconds = 3;
+    int opt;
+
+    memset(&Modes, 0, sizeof (Modes));
+    Modes.nfix_crc = 1;
+    Modes.check_crc = 1;
+    Modes.quiet = 1;
+    Modes.maxRange = 1852 * 300;
+    Modes.startup_time = mstime();
+    receiver__init(&Modes.receiver);
+
+    while ((opt = getopt(argc, argv, "s:g")) != -1) {
+        switch (opt) {
+            case 's':
+                seconds = atoi(optarg);
+                break;
+            case 'g':
+                Modes.use_gnss = 1;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-s seconds] [-g] <file>\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind >= argc) {
+        fprintf(stderr, "Usage: %s [-s seconds] [-g] <file>\n", argv[0]);
+        return 1;
+    }
+
+    modesChecksumInit(Modes.nfix_crc, NULL);
+    icaoFilterInit();
+    modeACInit();
+
+    if (!load(argv[optind]))
+        return 1;
+
+    size_t size = (size_t) message_count * (SBS_MAX_LINE + 1);
+    char *legacy = malloc(size);
+    char *fast = malloc(size);
+    if (!legacy || !fast) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    // Both must write the same lines, and read the same messages from them
+    unsigned lines = encodeAll(legacyEncode, legacy, &now);
+    unsigned fast_lines = encodeAll(sbsEncode, fast, &now);
+    unsigned bad = 0;
+    size_t bytes = 0;
+
+    if (lines != fast_lines) {
+        fprintf(stderr, "Line count differs: %u vs %u\n", lines, fast_lines);
+        return 1;
+    }
+    char *l = legacy, *f = fast;
+    for (unsigned i = 0; i < lines; ++i, l += strlen(l) + 1, f += strlen(f) + 1) {
+        static struct modesMessage zeroMessage;
+        struct modesMessage lm = zeroMessage, fm = zeroMessage;
+        char copy[SBS_MAX_LINE + 1];
+
+        if (strcmp(l, f)) {
+            if (!bad++)
+                fprintf(stderr, "Lines differ:\n  %s  %s", l, f);
+            continue;
+        }
+        bytes += strlen(l);
+
+        strcpy(copy, l);
+        bool lok = legacyParse(copy, &lm);
+        bool fok = sbsParse(l, &fm);
+        if (lok != fok || memcmp(&lm, &fm, sizeof (lm))) {
+            if (!bad++)
+                fprintf(stderr, "Parsed messages differ for:\n  %s", l);
+        }
+    }
+    if (bad) {
+        fprintf(stderr, "%u of %u lines differ\n", bad, lines);
+        return 1;
+    }
+    fprintf(stderr, "%u lines, %zu bytes, identical\n", lines, bytes);
+
+    encode_fn encoders[2] = {legacyEncode, sbsEncode};
+    const char *names[2] = {"sprintf() encoder", "sbsEncode()"};
+
+    for (int e = 0; e < 2; ++e) {
+        uint64_t count = 0;
+        struct timespec start, end;
+        double nanos;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        do {
+            // a new second every pass, as when running
+            now.tv_sec++;
+            count += encodeAll(encoders[e], fast, &now);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+        } while (end.tv_sec - start.tv_sec < seconds);
+
+        nanos = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+        reportRate(names[e], nanos, count, bytes * (count / lines));
+    }
+
+    // Parse the lines in legacy, each copied first as strsep() needs a
+    // copy that it can modify
+    for (int e = 0; e < 2; ++e) {
+        uint64_t count = 0, accepted = 0;
+        struct timespec start, end;
+        double nanos;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        do {
+            char *l = legacy;
+            for (unsigned i = 0; i < lines; ++i) {
+                static struct modesMessage zeroMessage;
+                struct modesMessage mm = zeroMessage;
+                char copy[SBS_MAX_LINE + 1];
+                size_t len = strlen(l) + 1;
+
+                memcpy(copy, l, len);
+                if (e ? sbsParse(copy, &mm) : legacyParse(copy, &mm))
+                    accepted++;
+                count++;
+                l += len;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+        } while (end.tv_sec - start.tv_sec < seconds);
+
+        nanos = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+        reportRate(e ? "sbsParse()" : "strsep() parser", nanos, count, bytes * (count / lines));
+        fprintf(stderr, "  %22s %.1f%% of the lines accepted\n", "", 100.0 * accepted / count);
+    }
+
+    free(legacy);
+    free(fast);
+    free(messages);
+    crcCleanupTables();
+    return 0;
+}
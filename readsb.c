@@ -54,6 +54,8 @@
 #define READSB
 #include "readsb.h"
 #include "help.h"
+#include "sdr_ifile.h"
+#include "sdr_beast.h"
 
 #include <stdarg.h>
 
@@ -146,6 +148,10 @@ static void modesInitConfig(void) {
     }
 
     Modes.preambleThreshold = PREAMBLE_THRESHOLD_DEFAULT;
+    Modes.sample_rate = (double) 2400000.0;
+    Modes.demod_threads = 1;
+    Modes.ifile_threads = 1;
+    Modes.net_ingest_threads = 1;
     if (nprocs < 2) {
         Modes.preambleThreshold = PREAMBLE_THRESHOLD_PIZERO;
     }
@@ -160,10 +166,15 @@ static void modesInitConfig(void) {
     Modes.net_output_sbs_ports = strdup("0");
     Modes.net_input_sbs_ports = strdup("0");
     Modes.net_input_beast_ports = strdup("0");
+    Modes.net_input_beast_zlib_ports = strdup("0");
+    Modes.net_input_beast_udp_ports = strdup("0");
     Modes.net_output_beast_ports = strdup("0");
     Modes.net_output_beast_reduce_ports = strdup("0");
     Modes.net_output_beast_reduce_interval = 125;
+    Modes.net_output_beast_region_ports = strdup("0");
     Modes.net_output_vrs_ports = strdup("0");
+    Modes.net_http_ports = strdup("0");
+    Modes.net_output_pb_ports = strdup("0");
     Modes.net_connector_delay = 30 * 1000;
     Modes.interactive_display_ttl = MODES_INTERACTIVE_DISPLAY_TTL;
     Modes.output_interval = 1000;
@@ -191,13 +202,47 @@ static void modesInit(void) {
         fprintf(stderr, "<3> Error creating stats semaphore: %s (readsbrrd won't work)\n", strerror(errno));
         Modes.stats_semptr = NULL;
     }
+    stats_sketches_reset();
+    stats_shm_init();
 
-    Modes.sample_rate = (double) 2400000.0;
+    Modes.demodulate = demodSelect(Modes.sample_rate);
+    if (!Modes.demodulate) {
+        fprintf(stderr, "Unsupported sample rate %.1f MHz (supported: 2.0, 2.4, 6.0, 8.0)\n", Modes.sample_rate / 1e6);
+        exit(1);
+    }
+
+    // Mode A/C and sharded demodulation are only implemented for 2.4MHz
+    if (Modes.demodulate != demodulate2400) {
+        if (Modes.mode_ac)
+            fprintf(stderr, "Mode A/C decoding needs a sample rate of 2.4 MHz, disabled\n");
+        if (Modes.demod_threads > 1)
+            fprintf(stderr, "--demod-threads needs a sample rate of 2.4 MHz, ignored\n");
+        if (Modes.demod_gate)
+            fprintf(stderr, "--demod-gate needs a sample rate of 2.4 MHz, ignored\n");
+        Modes.mode_ac = 0;
+        Modes.mode_ac_auto = 0;
+        Modes.demod_threads = 1;
+    }
 
     // Allocate the various buffers used by Modes
     Modes.trailing_samples = (MODES_PREAMBLE_US + MODES_LONG_MSG_BITS + 16) * 1e-6 * Modes.sample_rate;
 
-    if (!fifo_create(MODES_MAG_BUFFERS, MODES_MAG_BUF_SAMPLES + Modes.trailing_samples, Modes.trailing_samples)) {
+    if (Modes.sdr_type != SDR_IFILE)
+        Modes.ifile_threads = 1;
+
+    // The lock-free rings take a single producer
+    if (Modes.fifo_lockfree && (sdrReceiverCount() > 1 || Modes.ifile_threads > 1)) {
+        fprintf(stderr, "--fifo-lockfree supports a single producer thread only, ignored\n");
+        Modes.fifo_lockfree = 0;
+    }
+
+    // every --ifile-threads thread holds a buffer while it waits for its turn
+    unsigned buffers = MODES_MAG_BUFFERS;
+    if (Modes.ifile_threads > 1)
+        buffers += Modes.ifile_threads * sdrReceiverCount();
+
+    fifo_flags flags = (Modes.fifo_lockfree ? FIFO_LOCKFREE : 0) | (Modes.fifo_hugepages ? FIFO_HUGEPAGES : 0);
+    if (!fifo_create(buffers, MODES_MAG_BUF_SAMPLES + Modes.trailing_samples, Modes.trailing_samples, flags, Modes.fifo_spin_us)) {
         fprintf(stderr, "Out of memory allocating FIFO\n");
         exit(1);
     }
@@ -238,29 +283,15 @@ static void modesInit(void) {
     }
 
     // Prepare error correction tables
-    modesChecksumInit(Modes.nfix_crc);
+    modesChecksumInit(Modes.nfix_crc, Modes.crc_cache);
     icaoFilterInit();
     modeACInit();
+    demod2400Init();
 
     if (Modes.show_only)
         icaoFilterAdd(Modes.show_only);
 }
 
-// Set affinity of calling thread to specific core on a multi-core CPU
-
-static int thread_to_core(int core_id) {
-    int num_cores = sysconf(_SC_NPROCESSORS_ONLN);
-    if (core_id < 0 || core_id >= num_cores)
-        return EINVAL;
-
-    cpu_set_t cpuset;
-    CPU_ZERO(&cpuset);
-    CPU_SET(core_id, &cpuset);
-
-    pthread_t current_thread = pthread_self();
-    return pthread_setaffinity_np(current_thread, sizeof (cpu_set_t), &cpuset);
-}
-
 //
 //=========================================================================
 //
@@ -268,19 +299,22 @@ static int thread_to_core(int core_id) {
 // without caring about data acquisition
 //
 
+static atomic_uint readers_running;
+
 static void *readerThreadEntryPoint(void *arg) {
-    MODES_NOTUSED(arg);
+    unsigned id = (unsigned) (uintptr_t) arg;
 
-    // Try sticking this thread to core 3
-    thread_to_core(3);
+    sdrRun(id);
 
-    sdrRun();
+    // The last reader to finish ends the process; a receiver that stops early
+    // (e.g. the shorter of several input files) leaves the others running.
+    if (atomic_fetch_sub(&readers_running, 1) == 1) {
+        if (!Modes.exit) {
+            Modes.exit = 2; // unexpected exit
+        }
 
-    if (!Modes.exit) {
-        Modes.exit = 2; // unexpected exit
+        fifo_halt(); // wakes the main thread, if it's still waiting
     }
-
-    fifo_halt(); // wakes the main thread, if it's still waiting
     pthread_exit(NULL);
 }
 //
@@ -323,6 +357,7 @@ static void display_total_stats(void) {
 static void backgroundTasks(void) {
     static uint64_t next_stats_display;
     static uint64_t next_stats_update;
+    static unsigned stats_buckets;
     static uint64_t next_full, next_history;
     static uint64_t last_second;
 
@@ -352,42 +387,36 @@ static void backgroundTasks(void) {
     Modes.stats_current.end = mstime();
 
     if (now >= next_stats_update) {
-        int i;
-
         if (next_stats_update == 0) {
-            next_stats_update = now + 60000;
+            next_stats_update = now + STATS_BUCKET_MS;
         } else {
-            Modes.stats_latest_1min = (Modes.stats_latest_1min + 1) % 15;
-            Modes.stats_1min[Modes.stats_latest_1min] = Modes.stats_current;
+            stats_window_push(&Modes.stats_1min, &Modes.stats_current);
+            stats_window_push(&Modes.stats_5min, &Modes.stats_current);
+            stats_window_push(&Modes.stats_15min, &Modes.stats_current);
 
             add_stats(&Modes.stats_current, &Modes.stats_alltime, &Modes.stats_alltime);
             add_stats(&Modes.stats_current, &Modes.stats_periodic, &Modes.stats_periodic);
 
-            reset_stats(&Modes.stats_5min);
-            for (i = 0; i < 5; ++i)
-                add_stats(&Modes.stats_1min[(Modes.stats_latest_1min - i + 15) % 15], &Modes.stats_5min, &Modes.stats_5min);
-
-            reset_stats(&Modes.stats_15min);
-            for (i = 0; i < 15; ++i)
-                add_stats(&Modes.stats_1min[i], &Modes.stats_15min, &Modes.stats_15min);
-
             reset_stats(&Modes.stats_current);
             Modes.stats_current.start = Modes.stats_current.end = now;
 
-            if (Modes.output_dir) {
-                generateStatsProtoBuf();
+            // the files are written once a minute
+            if (++stats_buckets % (60000 / STATS_BUCKET_MS) == 0) {
+                if (Modes.output_dir)
+                    generateStatsProtoBuf();
+                stats_shm_publish(now);
                 if (Modes.stats_semptr && sem_post(Modes.stats_semptr) < 0) {
                     fprintf(stderr, "error posting stats semaphore: %s\n", strerror(errno));
                 }
-            }
 
-            // Create new receiver file frequently when antenna has a valid GPS fix.
-            // Thus, we can show status in webapp.
-            if ((Modes.receiver.antenna_flags & 0xE000) == 0xE000) {
-                generateReceiverProtoBuf();
+                // Create new receiver file frequently when antenna has a valid GPS fix.
+                // Thus, we can show status in webapp.
+                if ((Modes.receiver.antenna_flags & 0xE000) == 0xE000) {
+                    generateReceiverProtoBuf();
+                }
             }
 
-            next_stats_update += 60000;
+            next_stats_update += STATS_BUCKET_MS;
         }
     }
 
@@ -397,6 +426,8 @@ static void backgroundTasks(void) {
         } else {
             add_stats(&Modes.stats_periodic, &Modes.stats_current, &Modes.stats_periodic);
             display_stats(&Modes.stats_periodic);
+            if (Modes.net)
+                modesNetShowClients();
             reset_stats(&Modes.stats_periodic);
 
             next_stats_display += Modes.stats;
@@ -407,15 +438,15 @@ static void backgroundTasks(void) {
         }
     }
 
+    capturePeriodicWork(now);
+
     if (Modes.output_dir && now >= next_full) {
         generateAircraftProtoBuf();
         next_full = now + Modes.output_interval;
     }
 
-    if (Modes.output_dir && now >= next_history) {
-        char filebuf[PATH_MAX];
-        snprintf(filebuf, PATH_MAX, "history_%d.pb", Modes.aircraft_history_next);
-        generateHistoryProtoBuf(filebuf);
+    if ((Modes.output_dir || modesNetHttpEnabled()) && now >= next_history) {
+        generateHistoryProtoBuf();
 
         if (!Modes.aircraft_history_full) {
             generateReceiverProtoBuf();
@@ -432,35 +463,50 @@ static void backgroundTasks(void) {
 // Clean up memory prior to exit.
 
 static void cleanup_and_exit(int code) {
+    // the aircraft.pb writer still needs the output directory
+    stopAircraftWriter();
+    captureStop();
+    stateSave();
     if (Modes.stats_semptr)
         sem_close(Modes.stats_semptr);
+    stats_shm_cleanup();
     // Free any used memory
     interactiveCleanup();
-    free(Modes.dev_name);
+    stats_window_free(&Modes.stats_1min);
+    stats_window_free(&Modes.stats_5min);
+    stats_window_free(&Modes.stats_15min);
+    for (unsigned i = 0; i < Modes.dev_count; ++i)
+        free(Modes.dev_names[i]);
     free(Modes.filename);
     /* Free only when pointing to string in heap (strdup allocated when given as run parameter)
      * otherwise points to const string
      */
     free(Modes.output_dir);
+    free(Modes.crc_cache);
+    free(Modes.state_file);
+    free(Modes.record_file);
     free(Modes.net_bind_address);
     free(Modes.net_input_beast_ports);
+    free(Modes.net_input_beast_zlib_ports);
+    free(Modes.net_input_beast_udp_ports);
+    free(Modes.net_input_beast_udp_group);
+    for (int i = 0; i < Modes.net_udp_outputs_count; ++i)
+        free(Modes.net_udp_outputs[i]);
+    free(Modes.net_udp_outputs);
     free(Modes.net_output_beast_ports);
     free(Modes.net_output_beast_reduce_ports);
+    free(Modes.net_output_beast_region_ports);
     free(Modes.net_output_vrs_ports);
+    free(Modes.net_http_ports);
+    free(Modes.net_output_pb_ports);
     free(Modes.net_input_raw_ports);
     free(Modes.net_output_raw_ports);
     free(Modes.net_output_sbs_ports);
     free(Modes.net_input_sbs_ports);
     free(Modes.beast_serial);
-    /* Go through tracked aircraft chain and free up any used memory */
-    for (int j = 0; j < AIRCRAFTS_BUCKETS; j++) {
-        struct aircraft *a = Modes.aircrafts[j], *na;
-        while (a) {
-            na = a->next;
-            if (a) free(a);
-            a = na;
-        }
-    }
+    /* Free up the tracked aircraft */
+    trackCleanup();
+    geomag_cleanup();
 
     fifo_destroy();
 
@@ -474,7 +520,11 @@ static void cleanup_and_exit(int code) {
 static error_t parse_opt(int key, char *arg, struct argp_state *state) {
     switch (key) {
         case OptDevice:
-            Modes.dev_name = strdup(arg);
+            if (Modes.dev_count >= MODES_MAX_RECEIVERS) {
+                fprintf(stderr, "Too many devices, at most %d are supported\n", MODES_MAX_RECEIVERS);
+                return 1;
+            }
+            Modes.dev_names[Modes.dev_count++] = strdup(arg);
             break;
         case OptGain:
             Modes.gain = (int) (atof(arg)*10); // Gain is in tens of DBs
@@ -503,6 +553,30 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
         case OptPreambleThreshold:
             Modes.preambleThreshold = (uint32_t) (max(min(strtoll(arg, NULL, 10), PREAMBLE_THRESHOLD_MAX), PREAMBLE_THRESHOLD_MIN));
             break;
+        case OptFifoLockfree:
+            Modes.fifo_lockfree = 1;
+            break;
+        case OptFifoSpin:
+            Modes.fifo_spin_us = (unsigned) max(0, min(atoi(arg), 100000));
+            break;
+        case OptFifoHugepages:
+            Modes.fifo_hugepages = 1;
+            break;
+        case OptDeferConversion:
+            Modes.defer_conversion = 1;
+            break;
+        case OptSampleRate:
+            Modes.sample_rate = atof(arg) * 1e6;
+            break;
+        case OptDemodThreads:
+            Modes.demod_threads = max(1, min(atoi(arg), 16));
+            break;
+        case OptDemodGate:
+            Modes.demod_gate = fmax(0, fmin(atof(arg), 30));
+            break;
+        case OptIfileThreads:
+            Modes.ifile_threads = max(1, min(atoi(arg), IFILE_MAX_THREADS));
+            break;
         case OptNet:
             Modes.net = 1;
             break;
@@ -541,12 +615,42 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
         case OptAggressive:
             Modes.nfix_crc = MODES_MAX_BITERRORS;
             break;
+        case OptCrcCache:
+            Modes.crc_cache = strdup(arg);
+            break;
+        case OptStateFile:
+            Modes.state_file = strdup(arg);
+            break;
+        case OptRecord:
+            Modes.record_file = strdup(arg);
+            break;
+        case OptCpuAffinity:
+            if (!thread_parse_affinity(arg)) {
+                fprintf(stderr, "--cpu-affinity: Invalid placement: %s\n", arg);
+                fprintf(stderr, "Use <role>:<cpus> with role main, reader, demod, net-io, decode or writer, like reader:3 or demod:4-7\n");
+                return 1;
+            }
+            break;
+        case OptReaderPriority:
+            Modes.reader_priority = atoi(arg);
+            if (Modes.reader_priority < sched_get_priority_min(SCHED_FIFO) || Modes.reader_priority > sched_get_priority_max(SCHED_FIFO)) {
+                fprintf(stderr, "--reader-priority: %s is out of range\n", arg);
+                return 1;
+            }
+            break;
         case OptInteractive:
             Modes.interactive = 1;
             break;
         case OptInteractiveTTL:
             Modes.interactive_display_ttl = (uint64_t) (1000 * atof(arg));
             break;
+        case OptInteractiveSort:
+            if (!interactiveParseSort(arg)) {
+                fprintf(stderr, "--interactive-sort: Unknown order: %s\n", arg);
+                fprintf(stderr, "Valid orders: none, distance, seen, signal\n");
+                return 1;
+            }
+            break;
         case OptLat:
             Modes.receiver.latitude = atof(arg);
             break;
@@ -609,6 +713,24 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
             free(Modes.net_input_beast_ports);
             Modes.net_input_beast_ports = strdup(arg);
             break;
+        case OptNetBziPorts:
+            free(Modes.net_input_beast_zlib_ports);
+            Modes.net_input_beast_zlib_ports = strdup(arg);
+            break;
+        case OptNetBuiPorts:
+            free(Modes.net_input_beast_udp_ports);
+            Modes.net_input_beast_udp_ports = strdup(arg);
+            break;
+        case OptNetBuiGroup:
+            free(Modes.net_input_beast_udp_group);
+            Modes.net_input_beast_udp_group = strdup(arg);
+            break;
+        case OptNetBeastUdpOut:
+            Modes.net_udp_outputs = realloc(Modes.net_udp_outputs, sizeof (char *) * (Modes.net_udp_outputs_count + 1));
+            if (!Modes.net_udp_outputs)
+                return 1;
+            Modes.net_udp_outputs[Modes.net_udp_outputs_count++] = strdup(arg);
+            break;
         case OptNetBeastReducePorts:
             free(Modes.net_output_beast_reduce_ports);
             Modes.net_output_beast_reduce_ports = strdup(arg);
@@ -619,6 +741,26 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
             if (Modes.net_output_beast_reduce_interval > 15000)
                 Modes.net_output_beast_reduce_interval = 15000;
             break;
+        case OptNetBeastReduceBudget:
+            Modes.net_output_beast_reduce_budget = atoi(arg) > 0 ? atoi(arg) : 0;
+            break;
+        case OptNetRegionPorts:
+            free(Modes.net_output_beast_region_ports);
+            Modes.net_output_beast_region_ports = strdup(arg);
+            break;
+        case OptNetRegion:
+        {
+            double *r = Modes.net_region;
+            if (sscanf(arg, "%lf,%lf,%lf,%lf", &r[0], &r[1], &r[2], &r[3]) != 4 ||
+                    r[0] < -90.0 || r[0] > 90.0 || r[2] < -90.0 || r[2] > 90.0 || r[0] > r[2] ||
+                    r[1] < -180.0 || r[1] > 180.0 || r[3] < -180.0 || r[3] > 180.0) {
+                fprintf(stderr, "--net-region: Wrong format: %s\n", arg);
+                fprintf(stderr, "Correct syntax: --net-region=lat1,lon1,lat2,lon2 with lat1 <= lat2\n");
+                return 1;
+            }
+            Modes.net_region_set = 1;
+            break;
+        }
         case OptNetBindAddr:
             free(Modes.net_bind_address);
             Modes.net_bind_address = strdup(arg);
@@ -635,12 +777,43 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
             free(Modes.net_output_vrs_ports);
             Modes.net_output_vrs_ports = strdup(arg);
             break;
+        case OptNetHttpPorts:
+            free(Modes.net_http_ports);
+            Modes.net_http_ports = strdup(arg);
+            break;
+        case OptNetPbPorts:
+            free(Modes.net_output_pb_ports);
+            Modes.net_output_pb_ports = strdup(arg);
+            break;
         case OptNetBuffer:
             Modes.net_sndbuf_size = atoi(arg);
             break;
+        case OptNetDedupWindow:
+            Modes.net_dedup_window = max(0, min(atoi(arg), 10000));
+            break;
+        case OptNetIngestThreads:
+            Modes.net_ingest_threads = max(1, min(atoi(arg), 16));
+            break;
+        case OptNetSendqPolicy:
+            if (!strcmp(arg, "disconnect")) {
+                Modes.net_sendq_policy = SENDQ_POLICY_DISCONNECT;
+            } else if (!strcmp(arg, "drop-oldest")) {
+                Modes.net_sendq_policy = SENDQ_POLICY_DROP_OLDEST;
+            } else if (!strcmp(arg, "drop-non-position")) {
+                Modes.net_sendq_policy = SENDQ_POLICY_DROP_NON_POSITION;
+            } else {
+                fprintf(stderr, "--net-sendq-policy: Unknown policy: %s\n", arg);
+                fprintf(stderr, "Valid policies: disconnect, drop-oldest, drop-non-position\n");
+                return 1;
+            }
+            break;
         case OptNetVerbatim:
             Modes.net_verbatim = 1;
             break;
+        case OptNetRelay:
+            Modes.net = 1;
+            Modes.net_relay = 1;
+            break;
         case OptNetConnector:
             if (!Modes.net_connectors || Modes.net_connectors_count + 1 > Modes.net_connectors_size) {
                 Modes.net_connectors_size = Modes.net_connectors_count * 2 + 8;
@@ -661,8 +834,15 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
                 fprintf(stderr, "Correct syntax: --net-connector=ip,port,protocol\n");
                 return 1;
             }
+            // beast_zlib_out and the like: a compressed stream of the protocol without _zlib
+            char *zlib = strstr(con->protocol, "_zlib_");
+            if (zlib) {
+                memmove(zlib, zlib + 5, strlen(zlib + 5) + 1);
+                con->compressed = true;
+            }
             if (strcmp(con->protocol, "beast_out") != 0
                     && strcmp(con->protocol, "beast_reduce_out") != 0
+                    && strcmp(con->protocol, "beast_region_out") != 0
                     && strcmp(con->protocol, "beast_in") != 0
                     && strcmp(con->protocol, "raw_out") != 0
                     && strcmp(con->protocol, "raw_in") != 0
@@ -670,7 +850,8 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
                     && strcmp(con->protocol, "sbs_in") != 0
                     && strcmp(con->protocol, "sbs_out") != 0) {
                 fprintf(stderr, "--net-connector: Unknown protocol: %s\n", con->protocol);
-                fprintf(stderr, "Supported protocols: beast_out, beast_in, beast_reduce_out, raw_out, raw_in, sbs_out, sbs_in, vrs_out\n");
+                fprintf(stderr, "Supported protocols: beast_out, beast_in, beast_reduce_out, beast_region_out, raw_out, raw_in, sbs_out, sbs_in, vrs_out\n");
+                fprintf(stderr, "For a zlib compressed stream add _zlib before _in or _out, e.g. beast_zlib_out\n");
                 return 1;
             }
             if (strcmp(con->address, "") == 0 || strcmp(con->address, "") == 0) {
@@ -689,6 +870,8 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
 #ifdef ENABLE_RTLSDR
         case OptRtlSdrEnableAgc:
         case OptRtlSdrPpm:
+        case OptRtlSdrBuffers:
+        case OptRtlSdrBufferSize:
 #endif
         case OptBeastSerial:
         case OptBeastBaudrate:
@@ -701,6 +884,8 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
         case OptIfileName:
         case OptIfileFormat:
         case OptIfileThrottle:
+        case OptIfileMmap:
+        case OptReplayFile:
 #ifdef ENABLE_BLADERF
         case OptBladeFpgaDir:
         case OptBladeDecim:
@@ -731,8 +916,6 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
 //
 
 int main(int argc, char **argv) {
-    int j;
-
     // Set sane defaults
     modesInitConfig();
 
@@ -743,11 +926,6 @@ int main(int argc, char **argv) {
     signal(SIGINT, sigintHandler);
     signal(SIGTERM, sigtermHandler);
 
-    /* On a multi-core CPU we run the main thread and reader thread on different cores.
-     * Try sticking the main thread to core 1
-     */
-    thread_to_core(1);
-
     // Parse the command line options
     if (argp_parse(&argp, argc, argv, 0, 0, 0)) {
         fprintf(stderr, "Command line used:\n");
@@ -760,6 +938,10 @@ int main(int argc, char **argv) {
 
     // Initialization
     log_with_timestamp("%s %s starting up.", MODES_READSB_VARIANT, MODES_READSB_VERSION);
+
+    // before modesInit(): the sample buffers are first touched, and so come
+    // from the NUMA node of, the thread that creates them
+    thread_place(pthread_self(), THREAD_MAIN);
     modesInit();
     geomag_init();
 
@@ -769,17 +951,23 @@ int main(int argc, char **argv) {
 
     if (Modes.net) {
         modesInitNet();
+        if (!modesNetStartThread())
+            cleanup_and_exit(1);
     }
 
     // init stats:
     Modes.stats_current.start = Modes.stats_current.end =
             Modes.stats_alltime.start = Modes.stats_alltime.end =
-            Modes.stats_periodic.start = Modes.stats_periodic.end =
-            Modes.stats_5min.start = Modes.stats_5min.end =
-            Modes.stats_15min.start = Modes.stats_15min.end = mstime();
+            Modes.stats_periodic.start = Modes.stats_periodic.end = mstime();
 
-    for (j = 0; j < 15; ++j)
-        Modes.stats_1min[j].start = Modes.stats_1min[j].end = Modes.stats_current.start;
+    stats_window_init(&Modes.stats_1min, 60000 / STATS_BUCKET_MS, Modes.stats_current.start);
+    stats_window_init(&Modes.stats_5min, 5 * 60000 / STATS_BUCKET_MS, Modes.stats_current.start);
+    stats_window_init(&Modes.stats_15min, 15 * 60000 / STATS_BUCKET_MS, Modes.stats_current.start);
+
+    stateLoad();
+
+    if (!startAircraftWriter() || !captureStart())
+        cleanup_and_exit(1);
 
     // write initial protocol buffer files so they're not missing
     generateReceiverProtoBuf();
@@ -792,8 +980,22 @@ int main(int argc, char **argv) {
      * clients without reading data from the RTL device.
      * This rules also in case a local Mode-S Beast is connected via USB.
      */
-    if (Modes.sdr_type == SDR_NONE || Modes.sdr_type == SDR_MODESBEAST || Modes.sdr_type == SDR_GNS) {
-        struct timespec slp = {0, 20 * 1000 * 1000};
+    if (Modes.sdr_type == SDR_NONE || Modes.sdr_type == SDR_MODESBEAST || Modes.sdr_type == SDR_GNS || Modes.sdr_type == SDR_REPLAY) {
+        bool serial = (Modes.sdr_type != SDR_NONE);
+
+        // a local Beast, or a capture replay, is read by its own thread,
+        // which hands over frames to be decoded in between the background work
+        if (serial) {
+            atomic_store(&readers_running, 1);
+            int rc = pthread_create(&Modes.reader_threads[0], NULL, readerThreadEntryPoint, (void *) (uintptr_t) 0);
+            if (rc) {
+                fprintf(stderr, "Unable to create reader thread: %s\n", strerror(rc));
+                cleanup_and_exit(1);
+            }
+            thread_place(Modes.reader_threads[0], THREAD_READER);
+        }
+        thread_report_placement();
+
         while (!Modes.exit) {
             int64_t sleep_millis = 100;
             struct timespec start_time;
@@ -808,14 +1010,42 @@ int main(int argc, char **argv) {
 
             //fprintf(stderr, "%ld\n", sleep_millis);
 
-            slp.tv_nsec = sleep_millis * 1000 * 1000;
-            nanosleep(&slp, NULL);
+            if (serial) {
+                beastProcessFrames(sleep_millis);
+            } else {
+                // network input is handled as it arrives while we wait
+                start_cpu_timing(&start_time);
+                modesNetWait(sleep_millis);
+                end_cpu_timing(&start_time, &Modes.stats_current.background_cpu);
+            }
+        }
+
+        if (serial) {
+            pthread_join(Modes.reader_threads[0], NULL);
         }
     } else {
         int watchdogCounter = 10; // about 1 second
 
-        // Create the thread that will read the data from the device.
-        pthread_create(&Modes.reader_thread, NULL, readerThreadEntryPoint, NULL);
+        if (Modes.demod_threads > 1 && !demod2400StartWorkers(Modes.demod_threads)) {
+            cleanup_and_exit(1);
+        }
+
+        // Create the threads that will read the data from the devices.
+        unsigned readers = sdrReceiverCount();
+        atomic_store(&readers_running, readers);
+        for (unsigned id = 0; id < readers; ++id) {
+            int rc = pthread_create(&Modes.reader_threads[id], NULL, readerThreadEntryPoint, (void *) (uintptr_t) id);
+            if (rc) {
+                fprintf(stderr, "Unable to create reader thread %u: %s\n", id, strerror(rc));
+                // stop the readers already running, and only wait for those
+                Modes.exit = 2;
+                atomic_fetch_sub(&readers_running, readers - id);
+                readers = id;
+                break;
+            }
+            thread_place(Modes.reader_threads[id], THREAD_READER);
+        }
+        thread_report_placement();
 
         while (!Modes.exit) {
             // get the next sample buffer off the FIFO; wait only up to 100ms
@@ -827,13 +1057,16 @@ int main(int argc, char **argv) {
                 // Process one buffer
                 start_cpu_timing(&start_time);
 
-                demodulate2400(buf);
                 if (Modes.mode_ac) {
-                    demodulate2400AC(buf);
+                    // Mode A/C is only enabled at 2.4MHz
+                    demodulate2400Fused(buf);
+                } else {
+                    Modes.demodulate(buf);
                 }
 
                 Modes.stats_current.samples_processed += buf->validLength;
                 Modes.stats_current.samples_dropped += buf->dropped;
+                record_fifo_stats(&Modes.stats_current, buf);
                 end_cpu_timing(&start_time, &Modes.stats_current.demod_cpu);
 
                 // Return the buffer to the FIFO freelist for reuse
@@ -856,7 +1089,10 @@ int main(int argc, char **argv) {
 
         log_with_timestamp("Waiting for receive thread termination");
         fifo_halt(); // Reader thread should do this anyway, but just in case..
-        pthread_join(Modes.reader_thread, NULL); // Wait on reader thread exit
+        for (unsigned id = 0; id < readers; ++id) {
+            pthread_join(Modes.reader_threads[id], NULL); // Wait on reader thread exit
+        }
+        demod2400StopWorkers();
     }
 
     // If --stats were given, print statistics
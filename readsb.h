@@ -98,6 +98,7 @@
 #define MODES_RTL_BUF_SIZE      (16*16384)                 // 256k
 #define MODES_MAG_BUF_SAMPLES   (MODES_RTL_BUF_SIZE / 2)   // Each sample is 2 bytes
 #define MODES_MAG_BUFFERS       12                         // Number of magnitude buffers (should be smaller than RTL_BUFFERS for flowcontrol to work)
+#define MODES_MAX_RECEIVERS     FIFO_MAX_RECEIVERS         // Maximum number of SDR receivers run by one process
 #define MODES_AUTO_GAIN         -100                       // Use automatic gain
 #define MODES_MAX_GAIN          999999                     // Use max available gain
 #define MODEAC_MSG_BYTES        2
@@ -113,6 +114,8 @@
 #define MODES_SHORT_MSG_SAMPLES (MODES_SHORT_MSG_BITS    * 2)
 #define MODES_LONG_MSG_SIZE     (MODES_LONG_MSG_SAMPLES  * sizeof(uint16_t))
 #define MODES_SHORT_MSG_SIZE    (MODES_SHORT_MSG_SAMPLES * sizeof(uint16_t))
+#define MODES_BEAST_ENCODED_MAX (2 + 2 * (7 + MODES_LONG_MSG_BYTES)) // escaped Beast frame, worst case
+#define MODES_RAW_ENCODED_MAX   (15 + 2 * MODES_LONG_MSG_BYTES)      // "@" timestamp, hex, ";\n" and a NUL
 
 #define MODES_OS_PREAMBLE_SAMPLES  (20)
 #define MODES_OS_PREAMBLE_SIZE     (MODES_OS_PREAMBLE_SAMPLES  * sizeof(uint16_t))
@@ -194,6 +197,15 @@ typedef enum {
     NAV_ALT_FMS
 } nav_altitude_source_t;
 
+// Order of the aircraft in interactive mode, see --interactive-sort
+
+typedef enum {
+    INTERACTIVE_SORT_NONE, // as first seen
+    INTERACTIVE_SORT_DISTANCE, // nearest first, aircraft without a position last
+    INTERACTIVE_SORT_SEEN, // most recently seen first
+    INTERACTIVE_SORT_SIGNAL // strongest first
+} interactive_sort_t;
+
 #define MODES_NON_ICAO_ADDRESS       (1<<24) // Set on addresses to indicate they are not ICAO addresses
 
 #define MODES_INTERACTIVE_REFRESH_TIME 250      // Milliseconds
@@ -206,22 +218,25 @@ typedef enum {
 #define MODES_NET_SNDBUF_MAX  (7)
 
 #define NET_MAX_CONNECTORS 256
+#define NET_CONNECT_STAGGER 250 // ms before a connector tries the next address alongside
+#define NET_CONNECT_TIMEOUT (10 * 1000)
 
 #define HISTORY_SIZE 120
 #define HISTORY_INTERVAL 30000
 
 #define MODES_NOTUSED(V) ((void) V)
 
-#define AIRCRAFTS_BUCKETS 2048
-
 // Include subheaders after all the #defines are in place
 
 #include "util.h"
 #include "anet.h"
+#include "resolve.h"
 #include "net_io.h"
 #include "crc.h"
 #include "demod_2400.h"
+#include "demod_multirate.h"
 #include "stats.h"
+#include "stats_shm.h"
 #include "cpr.h"
 #include "icao_filter.h"
 #include "convert.h"
@@ -233,13 +248,13 @@ typedef enum {
 //======================== structure declarations =========================
 
 typedef enum {
-    SDR_NONE = 0, SDR_IFILE, SDR_RTLSDR, SDR_BLADERF, SDR_MICROBLADERF, SDR_MODESBEAST, SDR_PLUTOSDR, SDR_GNS
+    SDR_NONE = 0, SDR_IFILE, SDR_RTLSDR, SDR_BLADERF, SDR_MICROBLADERF, SDR_MODESBEAST, SDR_PLUTOSDR, SDR_GNS, SDR_REPLAY
 } sdr_type_t;
 
 // Program global state
 
 struct _Modes { // Internal state
-    pthread_t reader_thread;
+    pthread_t reader_threads[MODES_MAX_RECEIVERS]; // one per receiver, see sdrReceiverCount()
     unsigned trailing_samples; // extra trailing samples in magnitude buffers
     atomic_int exit; // Exit from the main loop when true
     int8_t dc_filter; // should we apply a DC filter?
@@ -247,7 +262,8 @@ struct _Modes { // Internal state
     int fd; // --ifile option file descriptor
     input_format_t input_format; // --iformat option
     iq_convert_fn converter_function;
-    char * dev_name;
+    char *dev_names[MODES_MAX_RECEIVERS]; // --device, one per receiver
+    unsigned dev_count;
     int gain;
     int enable_agc;
     sdr_type_t sdr_type; // where are we getting data from?
@@ -257,10 +273,17 @@ struct _Modes { // Internal state
     int beast_fd; // Local Modes-S Beast handler
     int beast_baudrate; // Mode-S beast and similar baud rate
     struct net_service *services; // Active services
-    struct aircraft *aircrafts[AIRCRAFTS_BUCKETS];
+    struct aircraft_entry *aircraft_table; // Tracked aircraft, see track.h
+    uint32_t aircraft_count; // Entries in use in aircraft_table
+    uint32_t aircraft_table_size; // Entries allocated in aircraft_table
+    struct aircraft_slot *aircraft_index; // Open-addressing address -> aircraft_table position
+    uint32_t aircraft_index_mask; // Number of index slots - 1
+    uint64_t track_generation; // Generation of the latest aircraft changes, see track.h
+    struct aircraft *aircraft_changed; // All aircraft, most recently changed first
     struct net_writer raw_out; // Raw output
     struct net_writer beast_out; // Beast-format output
     struct net_writer beast_reduce_out; // Reduced data Beast-format output
+    struct net_writer beast_region_out; // Beast-format output of aircraft inside net_region
     struct net_writer sbs_out; // SBS-format output
     struct net_writer vrs_out; // SBS-format output
     struct net_writer fatsv_out; // FATSV-format output
@@ -269,6 +292,11 @@ struct _Modes { // Internal state
     // Configuration
     Receiver receiver; // Receiver configuration
     int8_t nfix_crc; // Number of crc bit error(s) to correct
+    char *crc_cache; // File caching the error correction tables, or NULL
+    char *state_file; // File keeping the tracking state over a restart, or NULL, see state.c
+    char *record_file; // --record capture file, or NULL, see capture.c
+    cpu_set_t thread_cpus[THREAD_ROLE_COUNT]; // --cpu-affinity by thread role, empty if not given
+    int reader_priority; // SCHED_FIFO priority of the reader threads, 0 to leave them alone
     int8_t check_crc; // Only display messages with good CRC
     int8_t raw; // Raw output format
     int8_t mode_ac; // Enable decoding of SSR Modes A & C
@@ -276,6 +304,13 @@ struct _Modes { // Internal state
     int8_t net; // Enable networking
     int8_t net_only; // Enable just networking
     uint32_t preambleThreshold;
+    int demod_threads; // Number of threads sharing the demodulation of each buffer
+    float demod_gate; // --demod-gate, dB above the noise floor a span needs to be searched, 0 for all
+    int ifile_threads; // Threads demodulating chunks of an --ifile ahead of the main thread, see sdr_ifile.c
+    int defer_conversion; // Leave sample conversion to the demodulator thread, see fifo_defer_conversion()
+    int fifo_lockfree; // Use lock-free rings between SDR and demodulator thread
+    int fifo_hugepages; // Allocate sample buffers from huge pages
+    unsigned fifo_spin_us; // Spin this long before sleeping on an empty lock-free fifo
     int net_output_flush_size; // Minimum Size of output data
     uint32_t net_connector_delay;
     int filter_persistence; // Maximum number of consecutive implausible positions from global CPR to invalidate a known position.
@@ -283,20 +318,33 @@ struct _Modes { // Internal state
     uint32_t net_output_flush_interval; // Maximum interval (in milliseconds) between outputwrites
     double maxRange; // Absolute maximum decoding range, in *metres*
     double sample_rate; // actual sample rate in use (in hz)
+    demodulate_fn demodulate; // demodulator matching sample_rate
     uint32_t interactive_display_ttl; // Interactive mode: TTL display
+    interactive_sort_t interactive_sort; // Interactive mode: order of the aircraft
     uint64_t stats; // Interval (millis) between stats dumps,
     uint64_t startup_time; // Readsb startup epoch
-    uint64_t ifile_now; // ifile timestamp
+    _Atomic uint64_t ifile_now; // ifile timestamp, read by the network I/O thread too
     uint32_t output_interval; // Interval between rewriting the aircraft file, in milliseconds; also the advertised map refresh interval
     char *net_output_raw_ports; // List of raw output TCP ports
     char *net_input_raw_ports; // List of raw input TCP ports
     char *net_output_sbs_ports; // List of SBS output TCP ports
     char *net_input_sbs_ports; // List of SBS input TCP ports
     char *net_input_beast_ports; // List of Beast input TCP ports
+    char *net_input_beast_zlib_ports; // List of zlib compressed Beast input TCP ports
+    char *net_input_beast_udp_ports; // List of Beast input UDP ports
+    char *net_input_beast_udp_group; // Multicast group joined by the Beast input UDP ports, or NULL
+    char **net_udp_outputs; // --net-beast-udp-out destinations, "host,port[,ttl]"
+    int net_udp_outputs_count;
     char *net_output_beast_ports; // List of Beast output TCP ports
     char *net_output_beast_reduce_ports; // List of Beast output TCP ports
     uint32_t net_output_beast_reduce_interval; // Position update interval for data reduction
+    uint32_t net_output_beast_reduce_budget; // BeastReduce output bytes/s, 0 for the fixed interval; see trackReduceSchedule()
+    char *net_output_beast_region_ports; // List of region Beast output TCP ports
+    double net_region[4]; // --net-region box: lat_min, lon_min, lat_max, lon_max
+    int8_t net_region_set; // net_region was given
     char *net_output_vrs_ports; // List of VRS output TCP ports
+    char *net_http_ports; // List of HTTP protocol buffer snapshot TCP ports
+    char *net_output_pb_ports; // List of protocol buffer stream output TCP ports
     int8_t basestation_is_mlat; // Basestation input is from MLAT
     struct net_connector **net_connectors; // client connectors
     int net_connectors_count;
@@ -306,7 +354,11 @@ struct _Modes { // Internal state
     char *output_dir; // Path to output base directory, or NULL not to write any output.
     char *beast_serial; // Modes-S Beast device path
     int net_sndbuf_size; // TCP output buffer size (64Kb * 2^n)
+    sendq_policy_t net_sendq_policy; // what to do with clients whose SendQ is full
+    int net_ingest_threads; // Number of threads decoding Beast input ahead
+    int net_dedup_window; // Drop copies of a Mode S message received from the network within this many ms; 0 disables
     int8_t net_verbatim; // if true, send the original message, not the CRC-corrected one
+    int8_t net_relay; // only validate and forward messages unless an output needs them decoded, see modesNetRelayNeedsDecode()
     int8_t forward_mlat; // allow forwarding of mlat messages to output ports
     int8_t quiet; // Suppress stdout
     int8_t interactive; // Interactive mode
@@ -318,19 +370,18 @@ struct _Modes { // Internal state
     int8_t rx_location_accuracy; // Accuracy of location metadata: 0=none, 1=approx, 2=exact
     int aircraft_history_next;
     int aircraft_history_full;
-    int stats_latest_1min;
     int bUserFlags; // Flags relating to the user details
     int8_t biastee;
     struct stats stats_current;
     struct stats stats_alltime;
     struct stats stats_periodic;
-    struct stats stats_1min[15];
-    struct stats stats_5min;
-    struct stats stats_15min;
+    struct stats_window stats_1min; // of STATS_BUCKET_MS buckets
+    struct stats_window stats_5min;
+    struct stats_window stats_15min;
     struct range_stats stats_range;
-    struct timespec reader_cpu_accumulator; // accumulated CPU time used by the reader thread
-    struct timespec reader_cpu_start; // start time for the last reader thread CPU measurement
-    pthread_mutex_t reader_cpu_mutex; // mutex protecting reader_cpu_accumulator
+    struct stats_shm *stats_shm; // for readsbrrd, NULL if it couldn't be created
+    struct stats_sketch stats_rssi; // of the messages since the last stats_shm update
+    struct stats_sketch stats_distance; // of the positions since then
 };
 
 extern struct _Modes Modes;
@@ -340,6 +391,7 @@ extern struct _Modes Modes;
 struct modesMessage {
     uint64_t timestampMsg; // Timestamp of the message (12MHz clock)
     uint64_t sysTimestampMsg; // Timestamp of the message (system time)
+    uint64_t sysTimestampUse; // microtime() of useModesMessage(), for the latency statistics
     // Generic fields
     unsigned char msg[MODES_LONG_MSG_BYTES]; // Binary message.
     unsigned char verbatim[MODES_LONG_MSG_BYTES]; // Binary message, as originally received before correction
@@ -544,6 +596,16 @@ struct modesMessage {
 
         nav_modes_t modes;
     } nav;
+
+    // The message as written to the Beast and raw outputs, encoded by
+    // modesQueueOutput() for the first writer of each format and copied to
+    // the others. A length of 0 is not encoded yet.
+    struct {
+        uint8_t beast_len;
+        uint8_t raw_len;
+        char beast[MODES_BEAST_ENCODED_MAX];
+        char raw[MODES_RAW_ENCODED_MAX];
+    } encoded;
 };
 
 /* All the program options */
@@ -555,8 +617,16 @@ enum {
     OptInteractive,
     OptNoInteractive,
     OptInteractiveTTL,
+    OptInteractiveSort,
     OptRaw,
     OptPreambleThreshold,
+    OptDemodThreads,
+    OptDemodGate,
+    OptSampleRate,
+    OptDeferConversion,
+    OptFifoLockfree,
+    OptFifoSpin,
+    OptFifoHugepages,
     OptModeAc,
     OptNoModeAcAuto,
     OptForwardMlat,
@@ -567,6 +637,11 @@ enum {
     OptNoFix,
     OptNoCrcCheck,
     OptAggressive,
+    OptCrcCache,
+    OptStateFile,
+    OptRecord,
+    OptCpuAffinity,
+    OptReaderPriority,
     OptMlat,
     OptStats,
     OptStatsRange,
@@ -590,10 +665,19 @@ enum {
     OptNetSbsPorts,
     OptNetSbsInPorts,
     OptNetBiPorts,
+    OptNetBziPorts,
+    OptNetBuiPorts,
+    OptNetBuiGroup,
+    OptNetBeastUdpOut,
     OptNetBoPorts,
     OptNetBeastReducePorts,
     OptNetBeastReduceInterval,
+    OptNetBeastReduceBudget,
+    OptNetRegionPorts,
+    OptNetRegion,
     OptNetVRSPorts,
+    OptNetHttpPorts,
+    OptNetPbPorts,
     OptNetRoSize,
     OptNetRoRate,
     OptNetRoIntervall,
@@ -601,9 +685,15 @@ enum {
     OptNetConnectorDelay,
     OptNetHeartbeat,
     OptNetBuffer,
+    OptNetSendqPolicy,
+    OptNetIngestThreads,
+    OptNetDedupWindow,
     OptNetVerbatim,
+    OptNetRelay,
     OptRtlSdrEnableAgc,
     OptRtlSdrPpm,
+    OptRtlSdrBuffers,
+    OptRtlSdrBufferSize,
     OptBeastSerial,
     OptBeastBaudrate,
     OptBeastDF1117,
@@ -615,6 +705,9 @@ enum {
     OptIfileName,
     OptIfileFormat,
     OptIfileThrottle,
+    OptIfileMmap,
+    OptIfileThreads,
+    OptReplayFile,
     OptBladeFpgaDir,
     OptBladeDecim,
     OptBladeBw,
@@ -623,9 +716,12 @@ enum {
 };
 
 // This one needs modesMessage:
+#include "comm_b.h"
 #include "track.h"
 #include "mode_s.h"
-#include "comm_b.h"
+#include "sbs.h"
+#include "state.h"
+#include "capture.h"
 
 // ======================== function declarations =========================
 
@@ -645,7 +741,9 @@ extern "C" {
     // Functions exported from interactive.c
     //
     void interactiveInit(void);
+    bool interactiveParseSort(const char *arg);
     void interactiveShowData(void);
+    void interactiveRemoveAircraft(struct aircraft *a);
     void interactiveCleanup(void);
 
     // Provided by readsb.c & viewadsb.c
@@ -154,6 +154,96 @@ void   aircrafts_update__free_unpacked
   assert(message->base.descriptor == &aircrafts_update__descriptor);
   protobuf_c_message_free_unpacked ((ProtobufCMessage*)message, allocator);
 }
+void   history_track__init
+                     (HistoryTrack         *message)
+{
+  static const HistoryTrack init_value = HISTORY_TRACK__INIT;
+  *message = init_value;
+}
+size_t history_track__get_packed_size
+                     (const HistoryTrack *message)
+{
+  assert(message->base.descriptor == &history_track__descriptor);
+  return protobuf_c_message_get_packed_size ((const ProtobufCMessage*)(message));
+}
+size_t history_track__pack
+                     (const HistoryTrack *message,
+                      uint8_t       *out)
+{
+  assert(message->base.descriptor == &history_track__descriptor);
+  return protobuf_c_message_pack ((const ProtobufCMessage*)message, out);
+}
+size_t history_track__pack_to_buffer
+                     (const HistoryTrack *message,
+                      ProtobufCBuffer *buffer)
+{
+  assert(message->base.descriptor == &history_track__descriptor);
+  return protobuf_c_message_pack_to_buffer ((const ProtobufCMessage*)message, buffer);
+}
+HistoryTrack *
+       history_track__unpack
+                     (ProtobufCAllocator  *allocator,
+                      size_t               len,
+                      const uint8_t       *data)
+{
+  return (HistoryTrack *)
+     protobuf_c_message_unpack (&history_track__descriptor,
+                                allocator, len, data);
+}
+void   history_track__free_unpacked
+                     (HistoryTrack *message,
+                      ProtobufCAllocator *allocator)
+{
+  if(!message)
+    return;
+  assert(message->base.descriptor == &history_track__descriptor);
+  protobuf_c_message_free_unpacked ((ProtobufCMessage*)message, allocator);
+}
+void   history_update__init
+                     (HistoryUpdate         *message)
+{
+  static const HistoryUpdate init_value = HISTORY_UPDATE__INIT;
+  *message = init_value;
+}
+size_t history_update__get_packed_size
+                     (const HistoryUpdate *message)
+{
+  assert(message->base.descriptor == &history_update__descriptor);
+  return protobuf_c_message_get_packed_size ((const ProtobufCMessage*)(message));
+}
+size_t history_update__pack
+                     (const HistoryUpdate *message,
+                      uint8_t       *out)
+{
+  assert(message->base.descriptor == &history_update__descriptor);
+  return protobuf_c_message_pack ((const ProtobufCMessage*)message, out);
+}
+size_t history_update__pack_to_buffer
+                     (const HistoryUpdate *message,
+                      ProtobufCBuffer *buffer)
+{
+  assert(message->base.descriptor == &history_update__descriptor);
+  return protobuf_c_message_pack_to_buffer ((const ProtobufCMessage*)message, buffer);
+}
+HistoryUpdate *
+       history_update__unpack
+                     (ProtobufCAllocator  *allocator,
+                      size_t               len,
+                      const uint8_t       *data)
+{
+  return (HistoryUpdate *)
+     protobuf_c_message_unpack (&history_update__descriptor,
+                                allocator, len, data);
+}
+void   history_update__free_unpacked
+                     (HistoryUpdate *message,
+                      ProtobufCAllocator *allocator)
+{
+  if(!message)
+    return;
+  assert(message->base.descriptor == &history_update__descriptor);
+  protobuf_c_message_free_unpacked ((ProtobufCMessage*)message, allocator);
+}
 void   receiver__init
                      (Receiver         *message)
 {
@@ -199,6 +289,51 @@ void   receiver__free_unpacked
   assert(message->base.descriptor == &receiver__descriptor);
   protobuf_c_message_free_unpacked ((ProtobufCMessage*)message, allocator);
 }
+void   latency__init
+                     (Latency         *message)
+{
+  static const Latency init_value = LATENCY__INIT;
+  *message = init_value;
+}
+size_t latency__get_packed_size
+                     (const Latency *message)
+{
+  assert(message->base.descriptor == &latency__descriptor);
+  return protobuf_c_message_get_packed_size ((const ProtobufCMessage*)(message));
+}
+size_t latency__pack
+                     (const Latency *message,
+                      uint8_t       *out)
+{
+  assert(message->base.descriptor == &latency__descriptor);
+  return protobuf_c_message_pack ((const ProtobufCMessage*)message, out);
+}
+size_t latency__pack_to_buffer
+                     (const Latency *message,
+                      ProtobufCBuffer *buffer)
+{
+  assert(message->base.descriptor == &latency__descriptor);
+  return protobuf_c_message_pack_to_buffer ((const ProtobufCMessage*)message, buffer);
+}
+Latency *
+       latency__unpack
+                     (ProtobufCAllocator  *allocator,
+                      size_t               len,
+                      const uint8_t       *data)
+{
+  return (Latency *)
+     protobuf_c_message_unpack (&latency__descriptor,
+                                allocator, len, data);
+}
+void   latency__free_unpacked
+                     (Latency *message,
+                      ProtobufCAllocator *allocator)
+{
+  if(!message)
+    return;
+  assert(message->base.descriptor == &latency__descriptor);
+  protobuf_c_message_free_unpacked ((ProtobufCMessage*)message, allocator);
+}
 void   statistic_entry__init
                      (StatisticEntry         *message)
 {
@@ -1732,7 +1867,7 @@ const ProtobufCMessageDescriptor aircraft_history__descriptor =
   (ProtobufCMessageInit) aircraft_history__init,
   NULL,NULL,NULL    /* reserved[123] */
 };
-static const ProtobufCFieldDescriptor aircrafts_update__field_descriptors[4] =
+static const ProtobufCFieldDescriptor aircrafts_update__field_descriptors[5] =
 {
   {
     "now",
@@ -1782,9 +1917,22 @@ static const ProtobufCFieldDescriptor aircrafts_update__field_descriptors[4] =
     0,             /* flags */
     0,NULL,NULL    /* reserved1,reserved2, etc */
   },
+  {
+    "gone",
+    16,
+    PROTOBUF_C_LABEL_REPEATED,
+    PROTOBUF_C_TYPE_UINT32,
+    offsetof(AircraftsUpdate, n_gone),
+    offsetof(AircraftsUpdate, gone),
+    NULL,
+    NULL,
+    0 | PROTOBUF_C_FIELD_FLAG_PACKED,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
 };
 static const unsigned aircrafts_update__field_indices_by_name[] = {
   3,   /* field[3] = aircraft */
+  4,   /* field[4] = gone */
   2,   /* field[2] = history */
   1,   /* field[1] = messages */
   0,   /* field[0] = now */
@@ -1793,7 +1941,7 @@ static const ProtobufCIntRange aircrafts_update__number_ranges[2 + 1] =
 {
   { 1, 0 },
   { 14, 2 },
-  { 0, 4 }
+  { 0, 5 }
 };
 const ProtobufCMessageDescriptor aircrafts_update__descriptor =
 {
@@ -1803,13 +1951,141 @@ const ProtobufCMessageDescriptor aircrafts_update__descriptor =
   "AircraftsUpdate",
   "",
   sizeof(AircraftsUpdate),
-  4,
+  5,
   aircrafts_update__field_descriptors,
   aircrafts_update__field_indices_by_name,
   2,  aircrafts_update__number_ranges,
   (ProtobufCMessageInit) aircrafts_update__init,
   NULL,NULL,NULL    /* reserved[123] */
 };
+static const ProtobufCFieldDescriptor history_track__field_descriptors[2] =
+{
+  {
+    "addr",
+    1,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_UINT32,
+    0,   /* quantifier_offset */
+    offsetof(HistoryTrack, addr),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "points",
+    2,
+    PROTOBUF_C_LABEL_REPEATED,
+    PROTOBUF_C_TYPE_SINT32,
+    offsetof(HistoryTrack, n_points),
+    offsetof(HistoryTrack, points),
+    NULL,
+    NULL,
+    0 | PROTOBUF_C_FIELD_FLAG_PACKED,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+};
+static const unsigned history_track__field_indices_by_name[] = {
+  0,   /* field[0] = addr */
+  1,   /* field[1] = points */
+};
+static const ProtobufCIntRange history_track__number_ranges[1 + 1] =
+{
+  { 1, 0 },
+  { 0, 2 }
+};
+const ProtobufCMessageDescriptor history_track__descriptor =
+{
+  PROTOBUF_C__MESSAGE_DESCRIPTOR_MAGIC,
+  "HistoryTrack",
+  "HistoryTrack",
+  "HistoryTrack",
+  "",
+  sizeof(HistoryTrack),
+  2,
+  history_track__field_descriptors,
+  history_track__field_indices_by_name,
+  1,  history_track__number_ranges,
+  (ProtobufCMessageInit) history_track__init,
+  NULL,NULL,NULL    /* reserved[123] */
+};
+static const ProtobufCFieldDescriptor history_update__field_descriptors[4] =
+{
+  {
+    "now",
+    1,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_UINT64,
+    0,   /* quantifier_offset */
+    offsetof(HistoryUpdate, now),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "cursor",
+    2,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_UINT64,
+    0,   /* quantifier_offset */
+    offsetof(HistoryUpdate, cursor),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "times",
+    3,
+    PROTOBUF_C_LABEL_REPEATED,
+    PROTOBUF_C_TYPE_SINT64,
+    offsetof(HistoryUpdate, n_times),
+    offsetof(HistoryUpdate, times),
+    NULL,
+    NULL,
+    0 | PROTOBUF_C_FIELD_FLAG_PACKED,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "tracks",
+    4,
+    PROTOBUF_C_LABEL_REPEATED,
+    PROTOBUF_C_TYPE_MESSAGE,
+    offsetof(HistoryUpdate, n_tracks),
+    offsetof(HistoryUpdate, tracks),
+    &history_track__descriptor,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+};
+static const unsigned history_update__field_indices_by_name[] = {
+  1,   /* field[1] = cursor */
+  0,   /* field[0] = now */
+  2,   /* field[2] = times */
+  3,   /* field[3] = tracks */
+};
+static const ProtobufCIntRange history_update__number_ranges[1 + 1] =
+{
+  { 1, 0 },
+  { 0, 4 }
+};
+const ProtobufCMessageDescriptor history_update__descriptor =
+{
+  PROTOBUF_C__MESSAGE_DESCRIPTOR_MAGIC,
+  "HistoryUpdate",
+  "HistoryUpdate",
+  "HistoryUpdate",
+  "",
+  sizeof(HistoryUpdate),
+  4,
+  history_update__field_descriptors,
+  history_update__field_indices_by_name,
+  1,  history_update__number_ranges,
+  (ProtobufCMessageInit) history_update__init,
+  NULL,NULL,NULL    /* reserved[123] */
+};
 static const ProtobufCFieldDescriptor receiver__field_descriptors[11] =
 {
   {
@@ -1979,7 +2255,84 @@ const ProtobufCMessageDescriptor receiver__descriptor =
   (ProtobufCMessageInit) receiver__init,
   NULL,NULL,NULL    /* reserved[123] */
 };
-static const ProtobufCFieldDescriptor statistic_entry__field_descriptors[44] =
+static const ProtobufCFieldDescriptor latency__field_descriptors[4] =
+{
+  {
+    "buckets",
+    1,
+    PROTOBUF_C_LABEL_REPEATED,
+    PROTOBUF_C_TYPE_UINT32,
+    offsetof(Latency, n_buckets),
+    offsetof(Latency, buckets),
+    NULL,
+    NULL,
+    0 | PROTOBUF_C_FIELD_FLAG_PACKED,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "p50",
+    2,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_UINT32,
+    0,   /* quantifier_offset */
+    offsetof(Latency, p50),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "p99",
+    3,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_UINT32,
+    0,   /* quantifier_offset */
+    offsetof(Latency, p99),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "max",
+    4,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_UINT32,
+    0,   /* quantifier_offset */
+    offsetof(Latency, max),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+};
+static const unsigned latency__field_indices_by_name[] = {
+  0,   /* field[0] = buckets */
+  3,   /* field[3] = max */
+  1,   /* field[1] = p50 */
+  2,   /* field[2] = p99 */
+};
+static const ProtobufCIntRange latency__number_ranges[1 + 1] =
+{
+  { 1, 0 },
+  { 0, 4 }
+};
+const ProtobufCMessageDescriptor latency__descriptor =
+{
+  PROTOBUF_C__MESSAGE_DESCRIPTOR_MAGIC,
+  "Latency",
+  "Latency",
+  "Latency",
+  "",
+  sizeof(Latency),
+  4,
+  latency__field_descriptors,
+  latency__field_indices_by_name,
+  1,  latency__number_ranges,
+  (ProtobufCMessageInit) latency__init,
+  NULL,NULL,NULL    /* reserved[123] */
+};
+static const ProtobufCFieldDescriptor statistic_entry__field_descriptors[54] =
 {
   {
     "start",
@@ -2377,6 +2730,18 @@ static const ProtobufCFieldDescriptor statistic_entry__field_descriptors[44] =
     0,             /* flags */
     0,NULL,NULL    /* reserved1,reserved2, etc */
   },
+  {
+    "remote_duplicates",
+    75,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_UINT64,
+    0,   /* quantifier_offset */
+    offsetof(StatisticEntry, remote_duplicates),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
   {
     "local_samples_processed",
     90,
@@ -2509,6 +2874,114 @@ static const ProtobufCFieldDescriptor statistic_entry__field_descriptors[44] =
     0,             /* flags */
     0,NULL,NULL    /* reserved1,reserved2, etc */
   },
+  {
+    "local_fifo_latency",
+    101,
+    PROTOBUF_C_LABEL_REPEATED,
+    PROTOBUF_C_TYPE_UINT32,
+    offsetof(StatisticEntry, n_local_fifo_latency),
+    offsetof(StatisticEntry, local_fifo_latency),
+    NULL,
+    NULL,
+    0 | PROTOBUF_C_FIELD_FLAG_PACKED,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "local_fifo_depth",
+    102,
+    PROTOBUF_C_LABEL_REPEATED,
+    PROTOBUF_C_TYPE_UINT32,
+    offsetof(StatisticEntry, n_local_fifo_depth),
+    offsetof(StatisticEntry, local_fifo_depth),
+    NULL,
+    NULL,
+    0 | PROTOBUF_C_FIELD_FLAG_PACKED,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "local_fill_latency",
+    103,
+    PROTOBUF_C_LABEL_REPEATED,
+    PROTOBUF_C_TYPE_UINT32,
+    offsetof(StatisticEntry, n_local_fill_latency),
+    offsetof(StatisticEntry, local_fill_latency),
+    NULL,
+    NULL,
+    0 | PROTOBUF_C_FIELD_FLAG_PACKED,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "local_fifo_overruns",
+    104,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_UINT32,
+    0,   /* quantifier_offset */
+    offsetof(StatisticEntry, local_fifo_overruns),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "latency_receive",
+    105,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_MESSAGE,
+    0,   /* quantifier_offset */
+    offsetof(StatisticEntry, latency_receive),
+    &latency__descriptor,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "latency_decode",
+    106,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_MESSAGE,
+    0,   /* quantifier_offset */
+    offsetof(StatisticEntry, latency_decode),
+    &latency__descriptor,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "latency_buffer",
+    107,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_MESSAGE,
+    0,   /* quantifier_offset */
+    offsetof(StatisticEntry, latency_buffer),
+    &latency__descriptor,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "latency_send",
+    108,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_MESSAGE,
+    0,   /* quantifier_offset */
+    offsetof(StatisticEntry, latency_send),
+    &latency__descriptor,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "latency_total",
+    109,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_MESSAGE,
+    0,   /* quantifier_offset */
+    offsetof(StatisticEntry, latency_total),
+    &latency__descriptor,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
 };
 static const unsigned statistic_entry__field_indices_by_name[] = {
   5,   /* field[5] = altitude_suppressed */
@@ -2529,22 +3002,32 @@ static const unsigned statistic_entry__field_indices_by_name[] = {
   13,   /* field[13] = cpu_background */
   11,   /* field[11] = cpu_demod */
   12,   /* field[12] = cpu_reader */
-  43,   /* field[43] = local_accepted */
-  37,   /* field[37] = local_bad */
-  35,   /* field[35] = local_modeac */
-  36,   /* field[36] = local_modes */
-  41,   /* field[41] = local_noise */
-  42,   /* field[42] = local_peak_signal */
-  34,   /* field[34] = local_samples_dropped */
-  33,   /* field[33] = local_samples_processed */
-  40,   /* field[40] = local_signal */
-  39,   /* field[39] = local_strong_signals */
-  38,   /* field[38] = local_unknown_icao */
+  51,   /* field[51] = latency_buffer */
+  50,   /* field[50] = latency_decode */
+  49,   /* field[49] = latency_receive */
+  52,   /* field[52] = latency_send */
+  53,   /* field[53] = latency_total */
+  44,   /* field[44] = local_accepted */
+  38,   /* field[38] = local_bad */
+  46,   /* field[46] = local_fifo_depth */
+  45,   /* field[45] = local_fifo_latency */
+  48,   /* field[48] = local_fifo_overruns */
+  47,   /* field[47] = local_fill_latency */
+  36,   /* field[36] = local_modeac */
+  37,   /* field[37] = local_modes */
+  42,   /* field[42] = local_noise */
+  43,   /* field[43] = local_peak_signal */
+  35,   /* field[35] = local_samples_dropped */
+  34,   /* field[34] = local_samples_processed */
+  41,   /* field[41] = local_signal */
+  40,   /* field[40] = local_strong_signals */
+  39,   /* field[39] = local_unknown_icao */
   3,   /* field[3] = max_distance_in_metres */
   4,   /* field[4] = max_distance_in_nautical_miles */
   2,   /* field[2] = messages */
   32,   /* field[32] = remote_accepted */
   30,   /* field[30] = remote_bad */
+  33,   /* field[33] = remote_duplicates */
   28,   /* field[28] = remote_modeac */
   29,   /* field[29] = remote_modes */
   31,   /* field[31] = remote_unknown_icao */
@@ -2562,8 +3045,8 @@ static const ProtobufCIntRange statistic_entry__number_ranges[5 + 1] =
   { 20, 11 },
   { 40, 14 },
   { 70, 28 },
-  { 90, 33 },
-  { 0, 44 }
+  { 90, 34 },
+  { 0, 54 }
 };
 const ProtobufCMessageDescriptor statistic_entry__descriptor =
 {
@@ -2573,7 +3056,7 @@ const ProtobufCMessageDescriptor statistic_entry__descriptor =
   "StatisticEntry",
   "",
   sizeof(StatisticEntry),
-  44,
+  54,
   statistic_entry__field_descriptors,
   statistic_entry__field_indices_by_name,
   5,  statistic_entry__number_ranges,
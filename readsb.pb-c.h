@@ -20,7 +20,10 @@ typedef struct _AircraftMeta__NavModes AircraftMeta__NavModes;
 typedef struct _AircraftMeta__ValidSource AircraftMeta__ValidSource;
 typedef struct _AircraftHistory AircraftHistory;
 typedef struct _AircraftsUpdate AircraftsUpdate;
+typedef struct _HistoryTrack HistoryTrack;
+typedef struct _HistoryUpdate HistoryUpdate;
 typedef struct _Receiver Receiver;
+typedef struct _Latency Latency;
 typedef struct _StatisticEntry StatisticEntry;
 typedef struct _Statistics Statistics;
 typedef struct _Statistics__PolarRangeEntry Statistics__PolarRangeEntry;
@@ -399,7 +402,7 @@ struct  _AircraftsUpdate
    */
   uint64_t messages;
   /*
-   * Aircraft position history collection.
+   * Aircraft position history collection, no longer written: see HistoryUpdate.
    */
   size_t n_history;
   AircraftHistory **history;
@@ -408,9 +411,70 @@ struct  _AircraftsUpdate
    */
   size_t n_aircraft;
   AircraftMeta **aircraft;
+  /*
+   * Stream output only: addresses of the aircraft that left the collection.
+   */
+  size_t n_gone;
+  uint32_t *gone;
 };
 #define AIRCRAFTS_UPDATE__INIT \
  { PROTOBUF_C_MESSAGE_INIT (&aircrafts_update__descriptor) \
+    , 0, 0, 0,NULL, 0,NULL, 0,NULL }
+
+
+/*
+ **
+ * Position history of one aircraft, see HistoryUpdate.
+ */
+struct  _HistoryTrack
+{
+  ProtobufCMessage base;
+  /*
+   * The 24-bit ICAO identifier of the aircraft.
+   */
+  uint32_t addr;
+  /*
+   * Four numbers per position: the sample it was taken in, latitude and
+   * longitude in 1e-5 degrees, altitude in 25 feet (-400 when on the ground).
+   * Each is the difference to the previous position of the track, the first
+   * one to sample 0, 0, 0 and 0. Samples count from the first in times.
+   */
+  size_t n_points;
+  int32_t *points;
+};
+#define HISTORY_TRACK__INIT \
+ { PROTOBUF_C_MESSAGE_INIT (&history_track__descriptor) \
+    , 0, 0,NULL }
+
+
+/*
+ **
+ * Aircraft position history, sampled every 30 seconds, in history.pb.
+ */
+struct  _HistoryUpdate
+{
+  ProtobufCMessage base;
+  /*
+   * The time this was generated, in seconds since Unix epoch.
+   */
+  uint64_t now;
+  /*
+   * Number of the last sample; ask for history.pb?since=<cursor> to get only newer ones.
+   */
+  uint64_t cursor;
+  /*
+   * Time of each sample, in seconds since Unix epoch, each as the difference to the one before.
+   */
+  size_t n_times;
+  int64_t *times;
+  /*
+   * One track per aircraft.
+   */
+  size_t n_tracks;
+  HistoryTrack **tracks;
+};
+#define HISTORY_UPDATE__INIT \
+ { PROTOBUF_C_MESSAGE_INIT (&history_update__descriptor) \
     , 0, 0, 0,NULL, 0,NULL }
 
 
@@ -471,6 +535,36 @@ struct  _Receiver
     , (char *)protobuf_c_empty_string, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 }
 
 
+/*
+ **
+ * Message latency through one stage of processing, in microseconds.
+ */
+struct  _Latency
+{
+  ProtobufCMessage base;
+  /*
+   * messages per latency bucket; bucket 0 is below 16us, each further bucket doubles the limit, the last one is open-ended.
+   */
+  size_t n_buckets;
+  uint32_t *buckets;
+  /*
+   * median, the upper limit of the bucket it falls in.
+   */
+  uint32_t p50;
+  /*
+   * 99th percentile, the upper limit of the bucket it falls in.
+   */
+  uint32_t p99;
+  /*
+   * longest latency seen.
+   */
+  uint32_t max;
+};
+#define LATENCY__INIT \
+ { PROTOBUF_C_MESSAGE_INIT (&latency__descriptor) \
+    , 0,NULL, 0, 0, 0 }
+
+
 /*
  **
  * Single statistcs entry.
@@ -601,6 +695,10 @@ struct  _StatisticEntry
    * number of valid Mode S messages accepted with N-bit errors corrected.
    */
   uint64_t remote_accepted;
+  /*
+   * number of Mode S messages dropped as copies of one received shortly before, see --net-dedup-window.
+   */
+  uint64_t remote_duplicates;
   /*
    * statistics about messages received from a local SDR dongle. Not present in --net-only mode.
    */
@@ -648,10 +746,49 @@ struct  _StatisticEntry
    * the number of valid Mode S messages accepted with N-bit errors corrected.
    */
   uint64_t local_accepted;
+  /*
+   * sample buffers per FIFO queue latency bucket; bucket 0 is below 64us, each further bucket doubles the limit, the last one is open-ended.
+   */
+  size_t n_local_fifo_latency;
+  uint32_t *local_fifo_latency;
+  /*
+   * sample buffers per number of buffers queued when dequeued, including the dequeued one.
+   */
+  size_t n_local_fifo_depth;
+  uint32_t *local_fifo_depth;
+  /*
+   * sample buffers per latency bucket from the SDR receiving the samples to queueing them, same buckets as local_fifo_latency. Empty if the SDR doesn't report it.
+   */
+  size_t n_local_fill_latency;
+  uint32_t *local_fill_latency;
+  /*
+   * number of times samples were dropped as the FIFO had no free buffer.
+   */
+  uint32_t local_fifo_overruns;
+  /*
+   * message latency from the message being received, by the SDR or from the network, to it being decoded.
+   */
+  Latency *latency_receive;
+  /*
+   * message latency from decoding the message to queueing it for output, mostly aircraft tracking.
+   */
+  Latency *latency_decode;
+  /*
+   * message latency from queueing a message for output to its output buffer being handed to the clients, per buffer for its oldest message.
+   */
+  Latency *latency_buffer;
+  /*
+   * message latency from an output buffer being handed to a client to the last of it being written to the socket, per buffer and client.
+   */
+  Latency *latency_send;
+  /*
+   * message latency from receiving the message to its output being written to the socket, per buffer and client for its oldest message.
+   */
+  Latency *latency_total;
 };
 #define STATISTIC_ENTRY__INIT \
  { PROTOBUF_C_MESSAGE_INIT (&statistic_entry__descriptor) \
-    , 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 }
+    , 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,NULL, 0,NULL, 0,NULL, 0, NULL, NULL, NULL, NULL, NULL }
 
 
 struct  _Statistics__PolarRangeEntry
@@ -766,6 +903,44 @@ AircraftsUpdate *
 void   aircrafts_update__free_unpacked
                      (AircraftsUpdate *message,
                       ProtobufCAllocator *allocator);
+/* HistoryTrack methods */
+void   history_track__init
+                     (HistoryTrack         *message);
+size_t history_track__get_packed_size
+                     (const HistoryTrack   *message);
+size_t history_track__pack
+                     (const HistoryTrack   *message,
+                      uint8_t             *out);
+size_t history_track__pack_to_buffer
+                     (const HistoryTrack   *message,
+                      ProtobufCBuffer     *buffer);
+HistoryTrack *
+       history_track__unpack
+                     (ProtobufCAllocator  *allocator,
+                      size_t               len,
+                      const uint8_t       *data);
+void   history_track__free_unpacked
+                     (HistoryTrack *message,
+                      ProtobufCAllocator *allocator);
+/* HistoryUpdate methods */
+void   history_update__init
+                     (HistoryUpdate         *message);
+size_t history_update__get_packed_size
+                     (const HistoryUpdate   *message);
+size_t history_update__pack
+                     (const HistoryUpdate   *message,
+                      uint8_t             *out);
+size_t history_update__pack_to_buffer
+                     (const HistoryUpdate   *message,
+                      ProtobufCBuffer     *buffer);
+HistoryUpdate *
+       history_update__unpack
+                     (ProtobufCAllocator  *allocator,
+                      size_t               len,
+                      const uint8_t       *data);
+void   history_update__free_unpacked
+                     (HistoryUpdate *message,
+                      ProtobufCAllocator *allocator);
 /* Receiver methods */
 void   receiver__init
                      (Receiver         *message);
@@ -785,6 +960,25 @@ Receiver *
 void   receiver__free_unpacked
                      (Receiver *message,
                       ProtobufCAllocator *allocator);
+/* Latency methods */
+void   latency__init
+                     (Latency         *message);
+size_t latency__get_packed_size
+                     (const Latency   *message);
+size_t latency__pack
+                     (const Latency   *message,
+                      uint8_t             *out);
+size_t latency__pack_to_buffer
+                     (const Latency   *message,
+                      ProtobufCBuffer     *buffer);
+Latency *
+       latency__unpack
+                     (ProtobufCAllocator  *allocator,
+                      size_t               len,
+                      const uint8_t       *data);
+void   latency__free_unpacked
+                     (Latency *message,
+                      ProtobufCAllocator *allocator);
 /* StatisticEntry methods */
 void   statistic_entry__init
                      (StatisticEntry         *message);
@@ -843,9 +1037,18 @@ typedef void (*AircraftHistory_Closure)
 typedef void (*AircraftsUpdate_Closure)
                  (const AircraftsUpdate *message,
                   void *closure_data);
+typedef void (*HistoryTrack_Closure)
+                 (const HistoryTrack *message,
+                  void *closure_data);
+typedef void (*HistoryUpdate_Closure)
+                 (const HistoryUpdate *message,
+                  void *closure_data);
 typedef void (*Receiver_Closure)
                  (const Receiver *message,
                   void *closure_data);
+typedef void (*Latency_Closure)
+                 (const Latency *message,
+                  void *closure_data);
 typedef void (*StatisticEntry_Closure)
                  (const StatisticEntry *message,
                   void *closure_data);
@@ -870,7 +1073,10 @@ extern const ProtobufCEnumDescriptor    aircraft_meta__emergency__descriptor;
 extern const ProtobufCEnumDescriptor    aircraft_meta__sil_type__descriptor;
 extern const ProtobufCMessageDescriptor aircraft_history__descriptor;
 extern const ProtobufCMessageDescriptor aircrafts_update__descriptor;
+extern const ProtobufCMessageDescriptor history_track__descriptor;
+extern const ProtobufCMessageDescriptor history_update__descriptor;
 extern const ProtobufCMessageDescriptor receiver__descriptor;
+extern const ProtobufCMessageDescriptor latency__descriptor;
 extern const ProtobufCMessageDescriptor statistic_entry__descriptor;
 extern const ProtobufCMessageDescriptor statistics__descriptor;
 extern const ProtobufCMessageDescriptor statistics__polar_range_entry__descriptor;
@@ -18,10 +18,9 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "readsbrrd.h"
-#include "readsb.pb-c.h"
+#include "stats_shm.h"
 
 static int readsbrrd_exit = 0;
-static uint8_t *read_buf;
 static error_t parse_opt(int key, char *arg, struct argp_state *state);
 const char *argp_program_version = "readsbrrd v1.0.0";
 const char doc[] = "readsbrrd - Readsb Round Robin Database statistics collector.";
@@ -295,247 +294,88 @@ static void update_from_system() {
 }
 
 /**
- * Read and process readsb stats.pb file.
- * @param file_name Absolute path and file name.
+ * Map the statistics block readsb shares, if it runs.
+ * @return The block, or NULL.
  */
-static void update_from_stats(const char *file_name) {
+static const struct stats_shm *map_stats(void) {
     struct stat st;
-    off_t file_size = 0;
-    Statistics *stats_msg;
+    void *shm;
 
-    if (stat(file_name, &st) == 0) {
-        file_size = st.st_size;
-    } else {
-        fprintf(stderr, "cannot determine size of %s: %s\n", file_name, strerror(errno));
-        return;
-    }
-
-    int fd = open(file_name, O_RDONLY);
+    int fd = shm_open(STATS_SHM_NAME, O_RDONLY, 0);
     if (fd == -1) {
-        fprintf(stderr, "cannot open file %s: %s\n", file_name, strerror(errno));
-        return;
+        return NULL;
     }
 
-    read_buf = (uint8_t *) malloc(file_size);
-    if (read_buf == NULL) {
-        fprintf(stderr, "unable to allocated read buffer for %s\n", file_name);
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof (struct stats_shm)) {
         close(fd);
-        return;
+        return NULL;
     }
 
-    file_size = read(fd, read_buf, file_size);
+    shm = mmap(NULL, sizeof (struct stats_shm), PROT_READ, MAP_SHARED, fd, 0);
     close(fd);
-
-    if (file_size == 0) {
-        return;
+    if (shm == MAP_FAILED) {
+        fprintf(stderr, "cannot map readsb statistics: %s\n", strerror(errno));
+        return NULL;
     }
-
-    stats_msg = statistics__unpack(NULL, file_size, read_buf);
-    free(read_buf);
-    if (stats_msg == NULL) {
-        fprintf(stderr, "unpacking statistics message failed\n");
-        return;
-    }
-
-    // Overwrite update time from stats entry if exists, otherwise use unix epoch.
-    rrd.time_update = stats_msg->last_1min->stop;
-    rrd_update_file(DBFS_SIGNAL, (float) (stats_msg->last_1min->local_signal));
-    rrd_update_file(DBFS_NOISE, (float) (stats_msg->last_1min->local_noise));
-    rrd_update_file(MSG_STRONG_SIGNALS, stats_msg->total->local_strong_signals);
-    rrd_update_file(MSG_POSITIONS, (float) (stats_msg->total->cpr_local_ok + stats_msg->total->cpr_global_ok));
-    rrd_update_file(TRACKS_ALL, (float) (stats_msg->total->tracks_new));
-    rrd_update_file(TRACKS_SINGLE_MSG, (float) (stats_msg->total->tracks_single_message));
-    rrd_update_file(CPU_DEMOD, (float) (stats_msg->total->cpu_demod));
-    rrd_update_file(CPU_READER, (float) (stats_msg->total->cpu_reader));
-    rrd_update_file(CPU_BACKGROUND, (float) (stats_msg->total->cpu_background));
-    rrd_update_file(MSG_LOCAL_ACCEPTED, (float) (stats_msg->total->local_accepted));
-    rrd_update_file(MSG_REMOTE_ACCEPTED, (float) (stats_msg->total->remote_accepted));
-
-    statistics__free_unpacked(stats_msg, NULL);
+    return shm;
 }
 
 /**
- * Compare two float numbers for qsort.
- * @param a First float number.
- * @param b Second float number.
- * @return Comparision result.
+ * Update rrd files with the statistics readsb shares.
+ * @param shm Mapped statistics block.
  */
-static int compare_float(const void* a, const void* b) {
-    float val_a = *((float*) a);
-    float val_b = *((float*) b);
+static void update_from_readsb(const struct stats_shm *shm) {
+    struct stats_shm s;
 
-    if (val_a == val_b) return 0;
-    else if (val_a < val_b) return -1;
-    else return 1;
-}
-
-/**
- * Caluclate given percentile from array of floats.
- * @param p Percentile to calculate, range 0-1.
- * @param values Array of float numbers.
- * @param l Length of array.
- * @return The percentile.
- */
-static float percentile(float p, float* values, size_t l) {
-    float res = 0.0f;
-    float x = p * (l - 1);
-    float d = x - (int) x;
-    unsigned y = (unsigned) x;
-    if (y + 1 < l) {
-        res = values[y] + d * (values[y + 1] - values[y]);
-    } else {
-        res = values[y];
-    }
-    return res;
-}
-
-/**
- * Read and process readsb aircraft.pb file.
- * @param file_name Absolute path and file name.
- */
-static void update_from_aircrafts(const char* file_name) {
-    struct stat st;
-    off_t file_size = 0;
-    float min = 0;
-    float quart1 = 0;
-    float median = 0;
-    float quart3 = 0;
-    float max = 0;
-    float ac_total = 0;
-    float ac_with_pos = 0;
-    float ac_mlat = 0;
-    float ac_tisb = 0;
-    float ac_gps = 0;
-    uint64_t seen = 0;
-    size_t n_aircraft = 0;
-    float *signals;
-    float *distances;
-    AircraftsUpdate *aircrafts_msg;
-
-    if (stat(file_name, &st) == 0) {
-        file_size = st.st_size;
-    } else {
-        fprintf(stderr, "cannot determine size of %s: %s\n", file_name, strerror(errno));
+    if (!stats_shm_read(shm, &s)) {
+        fprintf(stderr, "readsb statistics keep changing, skipping update\n");
         return;
     }
 
-    int fd = open(file_name, O_RDONLY);
-    if (fd == -1) {
-        fprintf(stderr, "cannot open file %s: %s\n", file_name, strerror(errno));
-        return;
-    }
-
-    read_buf = (uint8_t *) malloc(file_size);
-    if (read_buf == NULL) {
-        fprintf(stderr, "unable to allocated read buffer for %s\n", file_name);
-        close(fd);
+    if (s.magic != STATS_SHM_MAGIC || s.version != STATS_SHM_VERSION || s.size != sizeof (s)) {
+        fprintf(stderr, "readsb statistics version %u, expected %u\n", s.version, STATS_SHM_VERSION);
         return;
     }
 
-    file_size = read(fd, read_buf, file_size);
-    close(fd);
-    if (file_size == 0) {
+    if (s.time == 0) {
+        // readsb has not published yet
         return;
     }
 
-    aircrafts_msg = aircrafts_update__unpack(NULL, file_size, read_buf);
-    free(read_buf);
-    if (aircrafts_msg == NULL) {
-        fprintf(stderr, "unpacking statistics message failed\n");
-        return;
+    rrd.time_update = s.time;
+    rrd_update_file(DBFS_SIGNAL, (float) s.signal);
+    rrd_update_file(DBFS_NOISE, (float) s.noise);
+    rrd_update_file(MSG_STRONG_SIGNALS, (float) s.strong_signals);
+    rrd_update_file(MSG_POSITIONS, (float) s.positions);
+    rrd_update_file(TRACKS_ALL, (float) s.tracks_new);
+    rrd_update_file(TRACKS_SINGLE_MSG, (float) s.tracks_single_message);
+    rrd_update_file(CPU_DEMOD, (float) s.cpu_demod);
+    rrd_update_file(CPU_READER, (float) s.cpu_reader);
+    rrd_update_file(CPU_BACKGROUND, (float) s.cpu_background);
+    rrd_update_file(MSG_LOCAL_ACCEPTED, (float) s.local_accepted);
+    rrd_update_file(MSG_REMOTE_ACCEPTED, (float) s.remote_accepted);
+
+    if (s.rssi.count > 0) {
+        rrd_update_file(DBFS_MIN_SIGNAL, s.rssi.min);
+        rrd_update_file(DBFS_QUART1, stats_sketch_quantile(&s.rssi, 0.25f));
+        rrd_update_file(DBFS_MEDIAN, stats_sketch_quantile(&s.rssi, 0.50f));
+        rrd_update_file(DBFS_QUART3, stats_sketch_quantile(&s.rssi, 0.75f));
+        rrd_update_file(DBFS_MAX_SIGNAL, s.rssi.max);
     }
 
-    // Overwrite update time from aircraft.pb if exists, otherwise use unix epoch.
-    rrd.time_update = aircrafts_msg->now;
-    n_aircraft = aircrafts_msg->n_aircraft;
-
-    if (n_aircraft > 0) {
-        signals = calloc(n_aircraft, sizeof (float));
-        distances = calloc(n_aircraft, sizeof (uint32_t));
-        if (signals == NULL) {
-            fprintf(stderr, "failed to allocated memory for signal stats\n");
-            free(distances);
-            aircrafts_update__free_unpacked(aircrafts_msg, NULL);
-            return;
-        }
-
-        if (distances == NULL) {
-            fprintf(stderr, "failed to allocated memory for distance stats\n");
-            free(signals);
-            aircrafts_update__free_unpacked(aircrafts_msg, NULL);
-            return;
-        }
-
-        for (size_t a = 0; a < n_aircraft; a++) {
-            // Get signal RSSI.
-            seen = (rrd.time_update - (aircrafts_msg->aircraft[a]->seen / 1000));
-            if ((aircrafts_msg->aircraft[a]->messages > 3) && (seen < 30) && (aircrafts_msg->aircraft[a]->rssi > -50.0)) {
-                signals[a] = aircrafts_msg->aircraft[a]->rssi;
-            }
-            // Get distances.
-            distances[a] = (float) aircrafts_msg->aircraft[a]->distance;
-
-            // Count total number of aircrafts and with valid position.
-            if (seen < 30) {
-                ac_total += 1;
-            }
-
-            if ((aircrafts_msg->aircraft[a]->seen_pos < 30)) {
-                ac_with_pos += 1;
-            }
-
-            // Count aircraft source type.
-            if (aircrafts_msg->aircraft[a]->valid_source != NULL) {
-                if (aircrafts_msg->aircraft[a]->valid_source->lat == SOURCE_MLAT) {
-                    ac_mlat += 1;
-                } else if (aircrafts_msg->aircraft[a]->valid_source->lat == SOURCE_TISB) {
-                    ac_tisb += 1;
-                } else {
-                    ac_gps += 1;
-                }
-            }
-        }
-
-        aircrafts_update__free_unpacked(aircrafts_msg, NULL);
-        // Sort signals and distances ascending.
-        qsort(signals, n_aircraft, sizeof (float), compare_float);
-        qsort(distances, n_aircraft, sizeof (float), compare_float);
-
-        // Calculate signal statistics
-        min = signals[0];
-        quart1 = percentile(0.25f, signals, n_aircraft);
-        median = percentile(0.50f, signals, n_aircraft);
-        quart3 = percentile(0.75f, signals, n_aircraft);
-        max = signals[n_aircraft - 1];
-
-        rrd_update_file(DBFS_MIN_SIGNAL, min);
-        rrd_update_file(DBFS_QUART1, quart1);
-        rrd_update_file(DBFS_MEDIAN, median);
-        rrd_update_file(DBFS_QUART3, quart3);
-        rrd_update_file(DBFS_MAX_SIGNAL, max);
-
-        // Calculate distance statistics
-        min = distances[0];
-        quart1 = percentile(0.25f, distances, n_aircraft);
-        median = percentile(0.50f, distances, n_aircraft);
-        quart3 = percentile(0.75f, distances, n_aircraft);
-        max = distances[n_aircraft - 1];
-
-        rrd_update_file(RANGE_MIN, min);
-        rrd_update_file(RANGE_QUART1, quart1);
-        rrd_update_file(RANGE_MEDIAN, median);
-        rrd_update_file(RANGE_QUART3, quart3);
-        rrd_update_file(RANGE_MAX, max);
-
-        free(signals);
-        free(distances);
+    if (s.distance.count > 0) {
+        rrd_update_file(RANGE_MIN, s.distance.min);
+        rrd_update_file(RANGE_QUART1, stats_sketch_quantile(&s.distance, 0.25f));
+        rrd_update_file(RANGE_MEDIAN, stats_sketch_quantile(&s.distance, 0.50f));
+        rrd_update_file(RANGE_QUART3, stats_sketch_quantile(&s.distance, 0.75f));
+        rrd_update_file(RANGE_MAX, s.distance.max);
     }
 
-    rrd_update_file(AIRCRAFT_TOTAL, ac_total);
-    rrd_update_file(AIRCRAFT_POSITIONS, ac_with_pos);
-    rrd_update_file(AIRCRAFT_MLAT, ac_mlat);
-    rrd_update_file(AIRCRAFT_TISB, ac_tisb);
-    rrd_update_file(AIRCRAFT_GPS, ac_gps);
+    rrd_update_file(AIRCRAFT_TOTAL, s.aircraft_total);
+    rrd_update_file(AIRCRAFT_POSITIONS, s.aircraft_positions);
+    rrd_update_file(AIRCRAFT_MLAT, s.aircraft_mlat);
+    rrd_update_file(AIRCRAFT_TISB, s.aircraft_tisb);
+    rrd_update_file(AIRCRAFT_GPS, s.aircraft_gps);
 }
 
 /**
@@ -547,10 +387,7 @@ static void update_from_aircrafts(const char* file_name) {
 int main(int argc, char** argv) {
     struct timespec ts;
     int semcnt, r;
-    char stats_file_path[PATH_MAX];
-    char aircrafts_file_path[PATH_MAX];
-    snprintf(stats_file_path, PATH_MAX, "%s/stats.pb", DEFAULT_READSB_RUN_PATH);
-    snprintf(aircrafts_file_path, PATH_MAX, "%s/aircraft.pb", DEFAULT_READSB_RUN_PATH);
+    const struct stats_shm *shm = NULL;
 
     // signal handlers:
     signal(SIGINT, signal_handler);
@@ -586,8 +423,11 @@ int main(int argc, char** argv) {
             // Get update time as unix epoch
             rrd.time_update = (uint64_t)time(NULL);
             update_from_system();
-            update_from_stats(stats_file_path);
-            update_from_aircrafts(aircrafts_file_path);
+            // readsb may start after us
+            if (!shm)
+                shm = map_stats();
+            if (shm)
+                update_from_readsb(shm);
         }
         // Wait for new statistic from readsb process, or read anyway on timeout.
         r = sem_timedwait(stats_semptr, &ts);
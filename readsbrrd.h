@@ -33,12 +33,12 @@
 #include <errno.h>
 #include <time.h>
 #include <semaphore.h>
+#include <sys/mman.h>
 
 #define NOTUSED(V) ((void) V)
 
 #define DS_STEP 60
 #define DEFAULT_RRD_PATH "/var/lib/collectd/rrd/localhost/readsb"
-#define DEFAULT_READSB_RUN_PATH "/run/readsb"
 
 typedef enum {
     DBFS_SIGNAL = 0,
@@ -79,18 +79,6 @@ enum {
     OPT_RRD_DIR
 };
 
-/* Where did a bit of data arrive from? In order of increasing priority */
-typedef enum {
-    SOURCE_INVALID = 0, /* data is not valid */
-    SOURCE_MODE_AC = 1, /* A/C message */
-    SOURCE_MLAT = 2, /* derived from mlat */
-    SOURCE_MODE_S = 3, /* data from a Mode S message, no full CRC */
-    SOURCE_MODE_S_CHECKED = 4, /* data from a Mode S message with full CRC */
-    SOURCE_TISB = 5, /* data from a TIS-B extended squitter message */
-    SOURCE_ADSR = 6, /* data from a ADS-R extended squitter message */
-    SOURCE_ADSB = 7, /* data from a ADS-B extended squitter message */
-} datasource_t;
-
 #define MAX_RRD_ARGV 20
 
 typedef struct {
@@ -0,0 +1,234 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// resolve.c: name resolution for the outgoing connections
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "readsb.h"
+
+#include <netdb.h>
+
+// There is an entry for each host and port ever looked up, never removed:
+// there are only as many as there are connectors. The threads are started
+// as needed, while all of those running are busy with a lookup, up to
+// RESOLVE_THREADS. getaddrinfo() doesn't tell the TTL of the DNS records,
+// so the answers are kept for RESOLVE_TTL, or until none of their
+// addresses connects.
+
+struct resolve_entry {
+    char *host;
+    char *port;
+    bool pending; // to be looked up, or being looked up
+    bool busy; // a thread is looking it up
+    uint64_t expires; // when the answer runs out, 0 for no answer
+    struct resolve_answer answer;
+};
+
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t work; // an entry turned pending, or exit
+    pthread_cond_t idle; // a thread finished a lookup
+    pthread_t threads[RESOLVE_THREADS];
+    int thread_count;
+    int busy; // threads looking something up
+    bool exit;
+    struct resolve_entry **entries;
+    int count;
+    int size;
+} resolver = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .work = PTHREAD_COND_INITIALIZER,
+    .idle = PTHREAD_COND_INITIALIZER,
+};
+
+// The answers run on real time, also when --ifile has mstime() run on its own
+static uint64_t resolveNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Take the stream addresses of res, alternating the families
+static void resolveFill(struct resolve_answer *answer, const struct addrinfo *res) {
+    const struct addrinfo *next[2] = { res, res };
+    int family[2];
+
+    answer->count = 0;
+    if (!res)
+        return;
+    family[0] = res->ai_family;
+    family[1] = family[0] == AF_INET6 ? AF_INET : AF_INET6;
+
+    for (int turn = 0, dry = 0; answer->count < RESOLVE_MAX_ADDRS && dry < 2; turn ^= 1) {
+        const struct addrinfo *p = next[turn];
+        while (p && (p->ai_family != family[turn] || p->ai_socktype != SOCK_STREAM || p->ai_addrlen > sizeof (struct sockaddr_storage)))
+            p = p->ai_next;
+        if (!p) {
+            next[turn] = NULL;
+            dry = (next[0] == NULL) + (next[1] == NULL);
+            continue;
+        }
+        memcpy(&answer->addr[answer->count], p->ai_addr, p->ai_addrlen);
+        answer->addrlen[answer->count] = p->ai_addrlen;
+        answer->count++;
+        next[turn] = p->ai_next;
+    }
+}
+
+static struct resolve_entry *resolveNextPending(void) {
+    for (int i = 0; i < resolver.count; i++) {
+        if (resolver.entries[i]->pending && !resolver.entries[i]->busy)
+            return resolver.entries[i];
+    }
+    return NULL;
+}
+
+static void *resolveThread(void *arg) {
+    MODES_NOTUSED(arg);
+    set_thread_name("resolver");
+
+    pthread_mutex_lock(&resolver.mutex);
+    while (!resolver.exit) {
+        struct resolve_entry *e = resolveNextPending();
+        if (!e) {
+            pthread_cond_wait(&resolver.work, &resolver.mutex);
+            continue;
+        }
+        e->busy = true;
+        resolver.busy++;
+        pthread_mutex_unlock(&resolver.mutex);
+
+        struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+        struct addrinfo *res = NULL;
+        struct resolve_answer answer;
+
+        answer.gai_error = getaddrinfo(e->host, e->port, &hints, &res);
+        resolveFill(&answer, answer.gai_error ? NULL : res);
+        if (!answer.gai_error && !answer.count)
+            answer.gai_error = EAI_NONAME; // nothing to connect to
+        if (res)
+            freeaddrinfo(res);
+
+        pthread_mutex_lock(&resolver.mutex);
+        e->answer = answer;
+        e->expires = resolveNow() + (answer.gai_error ? RESOLVE_NEGATIVE_TTL : RESOLVE_TTL);
+        e->pending = false;
+        e->busy = false;
+        resolver.busy--;
+        pthread_cond_broadcast(&resolver.idle);
+    }
+    pthread_mutex_unlock(&resolver.mutex);
+    return NULL;
+}
+
+static struct resolve_entry *resolveFind(const char *host, const char *port) {
+    for (int i = 0; i < resolver.count; i++) {
+        struct resolve_entry *e = resolver.entries[i];
+        if (!strcmp(e->host, host) && !strcmp(e->port, port))
+            return e;
+    }
+    return NULL;
+}
+
+static struct resolve_entry *resolveAdd(const char *host, const char *port) {
+    if (resolver.count == resolver.size) {
+        resolver.size = resolver.size * 2 + 8;
+        resolver.entries = realloc(resolver.entries, resolver.size * sizeof (*resolver.entries));
+    }
+    struct resolve_entry *e = calloc(1, sizeof (*e));
+    if (!resolver.entries || !e || !(e->host = strdup(host)) || !(e->port = strdup(port))) {
+        fprintf(stderr, "resolver: out of memory\n");
+        exit(1);
+    }
+    resolver.entries[resolver.count++] = e;
+    return e;
+}
+
+bool resolveLookup(const char *host, const char *port, struct resolve_answer *answer) {
+    bool found = false;
+
+    pthread_mutex_lock(&resolver.mutex);
+    struct resolve_entry *e = resolveFind(host, port);
+    if (!e)
+        e = resolveAdd(host, port);
+
+    if (e->expires > resolveNow()) {
+        *answer = e->answer;
+        found = true;
+    } else if (!e->pending) {
+        e->pending = true;
+        if (resolver.busy == resolver.thread_count && resolver.thread_count < RESOLVE_THREADS) {
+            pthread_t *thread = &resolver.threads[resolver.thread_count];
+            int rc = pthread_create(thread, NULL, resolveThread, NULL);
+            if (rc) {
+                fprintf(stderr, "resolver: pthread_create failed: %s\n", strerror(rc));
+            } else {
+                thread_place(*thread, THREAD_NET_IO);
+                resolver.thread_count++;
+            }
+        }
+        if (resolver.thread_count) {
+            pthread_cond_signal(&resolver.work);
+        } else {
+            // no thread to do it, fail like a lookup would
+            e->pending = false;
+            e->answer.gai_error = EAI_AGAIN;
+            e->answer.count = 0;
+            e->expires = resolveNow() + RESOLVE_NEGATIVE_TTL;
+        }
+    }
+    pthread_mutex_unlock(&resolver.mutex);
+    return found;
+}
+
+void resolveForget(const char *host, const char *port) {
+    pthread_mutex_lock(&resolver.mutex);
+    struct resolve_entry *e = resolveFind(host, port);
+    if (e && !e->pending)
+        e->expires = 0;
+    pthread_mutex_unlock(&resolver.mutex);
+}
+
+void resolveCleanup(void) {
+    struct timespec deadline;
+
+    pthread_mutex_lock(&resolver.mutex);
+    resolver.exit = true;
+    pthread_cond_broadcast(&resolver.work);
+
+    // A lookup can take long to fail; don't hold up the exit for it, just
+    // leave the thread and what it uses be.
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += 1;
+    while (resolver.busy && pthread_cond_timedwait(&resolver.idle, &resolver.mutex, &deadline) != ETIMEDOUT)
+        ;
+    bool busy = resolver.busy;
+    pthread_mutex_unlock(&resolver.mutex);
+    if (busy)
+        return;
+
+    for (int i = 0; i < resolver.thread_count; i++)
+        pthread_join(resolver.threads[i], NULL);
+    resolver.thread_count = 0;
+
+    for (int i = 0; i < resolver.count; i++) {
+        free(resolver.entries[i]->host);
+        free(resolver.entries[i]->port);
+        free(resolver.entries[i]);
+    }
+    free(resolver.entries);
+    resolver.entries = NULL;
+    resolver.count = resolver.size = 0;
+    resolver.exit = false;
+}
@@ -0,0 +1,49 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// resolve.h: name resolution for the outgoing connections (header)
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef RESOLVE_H
+#define RESOLVE_H
+
+#include <sys/socket.h>
+
+// A few threads shared by all --net-connector connections do the
+// getaddrinfo() calls, and each answer is kept for a while, so that many
+// connectors to a host, or all of them reconnecting at once, don't each
+// start a thread and a lookup of their own.
+
+#define RESOLVE_THREADS 4
+#define RESOLVE_MAX_ADDRS 8
+#define RESOLVE_TTL (5 * 60 * 1000) // how long an answer is used, ms
+#define RESOLVE_NEGATIVE_TTL (10 * 1000) // and a failure to resolve
+
+struct resolve_answer {
+    int gai_error; // of getaddrinfo(), 0 when it resolved
+    int count;
+    // the addresses in the order to try them: the family of the first one
+    // getaddrinfo() gave first, then alternating with the other one
+    struct sockaddr_storage addr[RESOLVE_MAX_ADDRS];
+    socklen_t addrlen[RESOLVE_MAX_ADDRS];
+};
+
+// Copy the current answer for host and port to *answer. If there is none,
+// return false and have a resolver thread look it up: ask again later.
+bool resolveLookup(const char *host, const char *port, struct resolve_answer *answer);
+// None of the addresses answered would connect: look it up again next time
+void resolveForget(const char *host, const char *port);
+void resolveCleanup(void);
+
+#endif
@@ -0,0 +1,557 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// sbs.c: BaseStation (SBS) output encoding and input parsing
+//
+// Copyright (c) 2020 Michael Wolf <michael@mictronics.de>
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// A BaseStation line is 22 comma separated fields:
+//
+//   MSG,3,1,1,4AC8B3,1,2019/12/10,19:10:46.320,2019/12/10,19:10:47.789,,36017,,,51.1001,10.1915,,,,,,
+//
+// sbsEncode() writes the same lines sprintf() and strftime() style code
+// would, and sbsParse() reads the same values strsep(), atoi() and strtod()
+// would; oneoff/sbs_benchmark.c checks both against that code. They get
+// there by hand instead:
+//
+//  - the local date and time of a second is formatted once, for all the
+//    messages received or sent within it
+//  - integers are written with a table of digit pairs, and numbers with a
+//    fixed number of decimals are rounded to an integer and written as one,
+//    falling back to snprintf() where that could round differently
+//  - a line is parsed in one pass over its fields, and plain decimal
+//    numbers are converted without strtod()
+
+#include "readsb.h"
+
+static const char digit_pairs[] =
+        "00010203040506070809"
+        "10111213141516171819"
+        "20212223242526272829"
+        "30313233343536373839"
+        "40414243444546474849"
+        "50515253545556575859"
+        "60616263646566676869"
+        "70717273747576777879"
+        "80818283848586878889"
+        "90919293949596979899";
+
+static inline char *putPair(char *p, unsigned v) {
+    memcpy(p, digit_pairs + 2 * v, 2);
+    return p + 2;
+}
+
+static char *putUnsigned(char *p, uint32_t v) {
+    char buf[10];
+    char *q = buf + sizeof (buf);
+
+    while (v >= 100) {
+        q -= 2;
+        memcpy(q, digit_pairs + 2 * (v % 100), 2);
+        v /= 100;
+    }
+    if (v >= 10) {
+        q -= 2;
+        memcpy(q, digit_pairs + 2 * v, 2);
+    } else {
+        *--q = '0' + v;
+    }
+
+    memcpy(p, q, buf + sizeof (buf) - q);
+    return p + (buf + sizeof (buf) - q);
+}
+
+// printf("%d")
+
+static inline char *putInt(char *p, int v) {
+    if (v < 0) {
+        *p++ = '-';
+        return putUnsigned(p, 0U - (uint32_t) v);
+    }
+    return putUnsigned(p, v);
+}
+
+// printf("%.0f")
+
+static char *putRounded(char *p, double v) {
+    double r = nearbyint(v); // rounds half to even, as printf() does
+
+    if (!(fabs(r) < 1e9))
+        return p + sprintf(p, "%.0f", v);
+    if (signbit(r)) {
+        *p++ = '-';
+        r = -r;
+    }
+    return putUnsigned(p, (uint32_t) r);
+}
+
+// printf("%1.5f"). v * 1e5 is only a close approximation of the decimal
+// v stands for, so values where it's close to a rounding tie get snprintf().
+
+static char *putFixed5(char *p, double v) {
+    double s = v * 1e5;
+    double r = nearbyint(s);
+    uint32_t n;
+
+    if (!(fabs(v) < 1e4) || fabs(fabs(s - r) - 0.5) < 1e-6)
+        return p + sprintf(p, "%1.5f", v);
+    if (signbit(v)) {
+        *p++ = '-';
+        r = -r;
+    }
+    n = (uint32_t) r;
+    p = putUnsigned(p, n / 100000);
+    *p++ = '.';
+    n %= 100000;
+    *p++ = '0' + n / 10000;
+    p = putPair(p, n / 100 % 100);
+    return putPair(p, n % 100);
+}
+
+// The date and time fields, "YYYY/MM/DD,HH:MM:SS", of the two seconds seen
+// last: the reception time and the current time are mostly the same one or
+// two seconds. Like the SBS output, used by the main thread only.
+
+struct sbs_time {
+    time_t second;
+    char text[20];
+};
+
+static struct sbs_time sbs_times[2];
+static unsigned sbs_time_next;
+
+static const char *sbsTime(time_t second) {
+    struct sbs_time *t;
+    struct tm tm;
+    unsigned year;
+    char *p;
+
+    for (int i = 0; i < 2; ++i) {
+        if (sbs_times[i].second == second && sbs_times[i].text[0])
+            return sbs_times[i].text;
+    }
+
+    t = &sbs_times[sbs_time_next];
+    sbs_time_next ^= 1;
+
+    localtime_r(&second, &tm);
+    year = (unsigned) (tm.tm_year + 1900) % 10000; // years of four digits
+    p = t->text;
+    p = putPair(p, year / 100);
+    p = putPair(p, year % 100);
+    *p++ = '/';
+    p = putPair(p, tm.tm_mon + 1);
+    *p++ = '/';
+    p = putPair(p, tm.tm_mday);
+    *p++ = ',';
+    p = putPair(p, tm.tm_hour);
+    *p++ = ':';
+    p = putPair(p, tm.tm_min);
+    *p++ = ':';
+    p = putPair(p, tm.tm_sec);
+    *p = '\0';
+    t->second = second;
+    return t->text;
+}
+
+// A date and time field pair with milliseconds
+
+static inline char *putTime(char *p, time_t second, unsigned millis) {
+    memcpy(p, sbsTime(second), 19);
+    p += 19;
+    *p++ = '.';
+    *p++ = '0' + millis / 100;
+    return putPair(p, millis % 100);
+}
+
+// A flag field: -1, 0 or empty
+
+static inline char *putFlag(char *p, bool valid, bool set) {
+    *p++ = ',';
+    if (valid) {
+        if (set)
+            *p++ = '-';
+        *p++ = set ? '1' : '0';
+    }
+    return p;
+}
+
+// Write the BaseStation line for a message with an ICAO address to p, with
+// the current time now, or the time of the realtime clock if now is NULL.
+// Returns the end of the line written, or NULL if the message has no
+// BaseStation equivalent.
+//
+// SBS BS style output checked against the following reference
+// http://www.homepages.mcb.net/bones/SBS/Article/Barebones42_Socket_Data.htm - seems comprehensive
+
+char *sbsEncode(char *p, struct modesMessage *mm, struct aircraft *a, const struct timespec *now) {
+    static const char hex[] = "0123456789ABCDEF";
+    static const char lhex[] = "0123456789abcdef";
+    struct timespec clock_now;
+    int msgType;
+
+    // Decide on the basic SBS Message Type
+    switch (mm->msgtype) {
+        case 4:
+        case 20:
+            msgType = 5;
+            break;
+
+        case 5:
+        case 21:
+            msgType = 6;
+            break;
+
+        case 0:
+        case 16:
+            msgType = 7;
+            break;
+
+        case 11:
+            msgType = 8;
+            break;
+
+        case 17:
+        case 18:
+            if (mm->metype >= 1 && mm->metype <= 4) {
+                msgType = 1;
+            } else if (mm->metype >= 5 && mm->metype <= 8) {
+                msgType = 2;
+            } else if (mm->metype >= 9 && mm->metype <= 18) {
+                msgType = 3;
+            } else if (mm->metype == 19) {
+                msgType = 4;
+            } else {
+                return NULL;
+            }
+            break;
+
+        default:
+            return NULL;
+    }
+
+    if (!now) {
+        clock_gettime(CLOCK_REALTIME, &clock_now);
+        now = &clock_now;
+    }
+
+    // Fields 1 to 6 : SBS message type and ICAO address of the aircraft and some other stuff
+    memcpy(p, "MSG,", 4);
+    p += 4;
+    *p++ = '0' + msgType;
+    memcpy(p, ",1,1,", 5);
+    p += 5;
+    if (mm->addr > 0xFFFFFF) {
+        p += sprintf(p, "%06X", mm->addr);
+    } else {
+        for (int shift = 20; shift >= 0; shift -= 4)
+            *p++ = hex[(mm->addr >> shift) & 15];
+    }
+    memcpy(p, ",1,", 3);
+    p += 3;
+
+    // Fields 7 & 8 are the message reception time and date
+    p = putTime(p, (time_t) (mm->sysTimestampMsg / 1000), (unsigned) (mm->sysTimestampMsg % 1000));
+    *p++ = ',';
+
+    // Fields 9 & 10 are the current time and date
+    p = putTime(p, now->tv_sec, (unsigned) (now->tv_nsec / 1000000U));
+
+    // Field 11 is the callsign (if we have it)
+    *p++ = ',';
+    if (mm->callsign_valid) {
+        size_t len = strlen(mm->callsign);
+        memcpy(p, mm->callsign, len);
+        p += len;
+    }
+
+    // Field 12 is the altitude (if we have it)
+    *p++ = ',';
+    if (Modes.use_gnss) {
+        if (mm->altitude_geom_valid) {
+            p = putInt(p, mm->altitude_geom);
+            *p++ = 'H';
+        } else if (mm->altitude_baro_valid && trackDataValid(&a->geom_delta_valid)) {
+            p = putInt(p, mm->altitude_baro + a->geom_delta);
+            *p++ = 'H';
+        } else if (mm->altitude_baro_valid) {
+            p = putInt(p, mm->altitude_baro);
+        }
+    } else {
+        if (mm->altitude_baro_valid) {
+            p = putInt(p, mm->altitude_baro);
+        } else if (mm->altitude_geom_valid && trackDataValid(&a->geom_delta_valid)) {
+            p = putInt(p, mm->altitude_geom - a->geom_delta);
+        }
+    }
+
+    // Field 13 is the ground Speed (if we have it)
+    *p++ = ',';
+    if (mm->gs_valid)
+        p = putRounded(p, mm->gs.selected);
+
+    // Field 14 is the ground Heading (if we have it)
+    *p++ = ',';
+    if (mm->heading_valid && mm->heading_type == HEADING_GROUND_TRACK)
+        p = putRounded(p, mm->heading);
+
+    // Fields 15 and 16 are the Lat/Lon (if we have it)
+    *p++ = ',';
+    if (mm->cpr_decoded) {
+        p = putFixed5(p, mm->decoded_lat);
+        *p++ = ',';
+        p = putFixed5(p, mm->decoded_lon);
+    } else {
+        *p++ = ',';
+    }
+
+    // Field 17 is the VerticalRate (if we have it)
+    *p++ = ',';
+    if (Modes.use_gnss) {
+        if (mm->geom_rate_valid) {
+            p = putInt(p, mm->geom_rate);
+            *p++ = 'H';
+        } else if (mm->baro_rate_valid) {
+            p = putInt(p, mm->baro_rate);
+        }
+    } else {
+        if (mm->baro_rate_valid) {
+            p = putInt(p, mm->baro_rate);
+        } else if (mm->geom_rate_valid) {
+            p = putInt(p, mm->geom_rate);
+        }
+    }
+
+    // Field 18 is  the Squawk (if we have it)
+    *p++ = ',';
+    if (mm->squawk_valid) {
+        if (mm->squawk > 0xFFFF) {
+            p += sprintf(p, "%04x", mm->squawk);
+        } else {
+            for (int shift = 12; shift >= 0; shift -= 4)
+                *p++ = lhex[(mm->squawk >> shift) & 15];
+        }
+    }
+
+    // Field 19 is the Squawk Changing Alert flag (if we have it)
+    p = putFlag(p, mm->alert_valid, mm->alert);
+
+    // Field 20 is the Squawk Emergency flag (if we have it)
+    p = putFlag(p, mm->squawk_valid, (mm->squawk == 0x7500) || (mm->squawk == 0x7600) || (mm->squawk == 0x7700));
+
+    // Field 21 is the Squawk Ident flag (if we have it)
+    p = putFlag(p, mm->spi_valid, mm->spi);
+
+    // Field 22 is the OnTheGround flag (if we have it)
+    p = putFlag(p, mm->airground == AIRCRAFT_META__AIR_GROUND__AG_GROUND || mm->airground == AIRCRAFT_META__AIR_GROUND__AG_AIRBORNE,
+            mm->airground == AIRCRAFT_META__AIR_GROUND__AG_GROUND);
+
+    *p++ = '\r';
+    *p++ = '\n';
+    return p;
+}
+
+//
+//=========================================================================
+//
+// Parsing
+//
+
+// strtol(s, NULL, 10) of the field [s, e)
+
+static long fieldLong(const char *s, const char *e) {
+    unsigned long v = 0;
+    bool neg = false;
+    bool overflow = false;
+
+    while (s < e && isspace((unsigned char) *s))
+        s++;
+    if (s < e && (*s == '-' || *s == '+'))
+        neg = (*s++ == '-');
+    for (; s < e && *s >= '0' && *s <= '9'; s++) {
+        unsigned digit = *s - '0';
+        if (v > (ULONG_MAX - digit) / 10)
+            overflow = true;
+        else
+            v = v * 10 + digit;
+    }
+
+    if (neg) {
+        if (overflow || v > (unsigned long) LONG_MAX + 1)
+            return LONG_MIN;
+        return (long) (0UL - v);
+    }
+    if (overflow || v > (unsigned long) LONG_MAX)
+        return LONG_MAX;
+    return (long) v;
+}
+
+// strtod(s, NULL) of the field [s, e). Up to 15 digits make an exact
+// integer and 10^n is exact as well, so dividing them rounds the decimal
+// value correctly, just like strtod(); anything else goes to strtod(),
+// which stops at the comma after the field.
+
+static double fieldDouble(const char *s, const char *e) {
+    static const double pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15};
+    const char *start = s;
+    uint64_t mantissa = 0;
+    int digits = 0, decimals = 0;
+    bool neg = false;
+
+    while (s < e && isspace((unsigned char) *s))
+        s++;
+    if (s < e && (*s == '-' || *s == '+'))
+        neg = (*s++ == '-');
+    for (; s < e && *s >= '0' && *s <= '9'; s++, digits++)
+        mantissa = mantissa * 10 + (*s - '0');
+    if (s < e && *s == '.') {
+        for (s++; s < e && *s >= '0' && *s <= '9'; s++, digits++, decimals++)
+            mantissa = mantissa * 10 + (*s - '0');
+    }
+
+    if (!digits || digits > 15 || (s < e && (*s == 'e' || *s == 'E' || *s == 'x' || *s == 'X')))
+        return strtod(start, NULL); // an exponent, hex, inf, nan or no number at all
+
+    double v = (double) mantissa / pow10[decimals];
+    return neg ? -v : v;
+}
+
+static inline int hexValue(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+// Read a BaseStation line into mm, which the caller has set up. Returns
+// false for lines that aren't usable: not 22 fields, not a MSG line, or
+// without a valid ICAO address or altitude.
+
+bool sbsParse(const char *line, struct modesMessage *mm) {
+    const char *s = line;
+    const char *lat = NULL, *lat_end = NULL;
+
+    for (int field = 1; field <= 22; field++) {
+        const char *e = s;
+
+        while (*e && *e != ',')
+            e++;
+        if (!*e && field < 22)
+            return false; // a short line
+
+        switch (field) {
+            case 1:
+                if (e - s != 3 || memcmp(s, "MSG", 3))
+                    return false;
+                break;
+
+            case 2:
+                if (e - s != 1)
+                    return false; // decoder limited to type 3 messages for now
+                break;
+
+            case 5: {
+                unsigned char *chars = (unsigned char *) &(mm->addr);
+
+                if (e - s != 6)
+                    return false; // icao must be 6 characters
+                for (int j = 0; j < 6; j += 2) {
+                    int high = hexValue(s[j]);
+                    int low = hexValue(s[j + 1]);
+
+                    if (high == -1 || low == -1)
+                        return false;
+                    chars[2 - j / 2] = (high << 4) | low;
+                }
+                if (mm->addr == 0)
+                    return false;
+                break;
+            }
+
+            case 11: // callsign
+                if (e > s) {
+                    memcpy(mm->callsign, s, (e - s) < 9 ? (size_t) (e - s) : 9);
+                    mm->callsign_valid = 1;
+                }
+                break;
+
+            case 12: // altitude
+                if (e > s) {
+                    mm->altitude_baro = (int) fieldLong(s, e);
+                    if (mm->altitude_baro < -5000 || mm->altitude_baro > 100000)
+                        return false;
+                    mm->altitude_baro_valid = 1;
+                    mm->altitude_baro_unit = UNIT_FEET;
+                }
+                break;
+
+            case 13: // groundspeed
+                if (e > s) {
+                    mm->gs.v0 = fieldDouble(s, e);
+                    if (mm->gs.v0 > 0)
+                        mm->gs_valid = 1;
+                }
+                break;
+
+            case 14: // heading
+                if (e > s) {
+                    mm->heading_valid = 1;
+                    mm->heading = fieldDouble(s, e);
+                    mm->heading_type = HEADING_GROUND_TRACK;
+                }
+                break;
+
+            case 15:
+                lat = s;
+                lat_end = e;
+                break;
+
+            case 16: // position, with field 15
+                if (lat_end > lat && e > s) {
+                    mm->decoded_lat = fieldDouble(lat, lat_end);
+                    mm->decoded_lon = fieldDouble(s, e);
+                }
+                break;
+
+            case 17: // vertical rate, assume baro
+                if (e > s) {
+                    mm->baro_rate = (int) fieldLong(s, e);
+                    mm->baro_rate_valid = 1;
+                }
+                break;
+
+            case 18: // squawk
+                if (e > s) {
+                    long tmp = fieldLong(s, e);
+                    if (tmp > 0) {
+                        mm->squawk = (tmp / 1000) * 16 * 16 * 16 + (tmp / 100 % 10) * 16 * 16 + (tmp / 10 % 10) * 16 + (tmp % 10);
+                        mm->squawk_valid = 1;
+                    }
+                }
+                break;
+
+            case 22: // ground status
+                if (e > s && (int) fieldLong(s, e) > 0)
+                    mm->airground = AIRCRAFT_META__AIR_GROUND__AG_GROUND;
+                break;
+        }
+
+        s = e + 1;
+    }
+
+    return true;
+}
@@ -37,6 +37,7 @@
 #endif
 
 #include "sdr_beast.h"
+#include "sdr_replay.h"
 
 typedef struct {
     void (*initConfig)();
@@ -44,6 +45,7 @@ typedef struct {
     bool(*open)();
     void (*run)();
     void (*close)();
+    unsigned (*receivers)();
     const char *name;
     sdr_type_t sdr_type;
     uint32_t padding;
@@ -70,6 +72,10 @@ static void noRun() {
 static void noClose() {
 }
 
+static unsigned oneReceiver() {
+    return 1;
+}
+
 static bool unsupportedOpen() {
     fprintf(stderr, "Support for this SDR type was not enabled in this build.\n");
     return false;
@@ -77,24 +83,25 @@ static bool unsupportedOpen() {
 
 static sdr_handler sdr_handlers[] = {
 #ifdef ENABLE_RTLSDR
-    { rtlsdrInitConfig, rtlsdrHandleOption, rtlsdrOpen, rtlsdrRun, rtlsdrClose, "rtlsdr", SDR_RTLSDR, 0},
+    { rtlsdrInitConfig, rtlsdrHandleOption, rtlsdrOpen, rtlsdrRun, rtlsdrClose, rtlsdrReceivers, "rtlsdr", SDR_RTLSDR, 0},
 #endif
 
 #ifdef ENABLE_BLADERF
-    { bladeRFInitConfig, bladeRFHandleOption, bladeRFOpen, bladeRFRun, bladeRFClose, "bladerf", SDR_BLADERF, 0},
-    { ubladeRFInitConfig, ubladeRFHandleOption, ubladeRFOpen, ubladeRFRun, ubladeRFClose, "ubladerf", SDR_MICROBLADERF, 0},
+    { bladeRFInitConfig, bladeRFHandleOption, bladeRFOpen, bladeRFRun, bladeRFClose, oneReceiver, "bladerf", SDR_BLADERF, 0},
+    { ubladeRFInitConfig, ubladeRFHandleOption, ubladeRFOpen, ubladeRFRun, ubladeRFClose, oneReceiver, "ubladerf", SDR_MICROBLADERF, 0},
 #endif
 
 #ifdef ENABLE_PLUTOSDR
-    { plutosdrInitConfig, plutosdrHandleOption, plutosdrOpen, plutosdrRun, plutosdrClose, "plutosdr", SDR_PLUTOSDR, 0},
+    { plutosdrInitConfig, plutosdrHandleOption, plutosdrOpen, plutosdrRun, plutosdrClose, oneReceiver, "plutosdr", SDR_PLUTOSDR, 0},
 #endif
 
-    { beastInitConfig, beastHandleOption, beastOpen, noRun, noClose, "modesbeast", SDR_MODESBEAST, 0},
-    { beastInitConfig, beastHandleOption, beastOpen, noRun, noClose, "gnshulc", SDR_GNS, 0},
-    { ifileInitConfig, ifileHandleOption, ifileOpen, ifileRun, ifileClose, "ifile", SDR_IFILE, 0},
-    { noInitConfig, noHandleOption, noOpen, noRun, noClose, "none", SDR_NONE, 0},
+    { beastInitConfig, beastHandleOption, beastOpen, beastRun, beastClose, oneReceiver, "modesbeast", SDR_MODESBEAST, 0},
+    { beastInitConfig, beastHandleOption, beastOpen, beastRun, beastClose, oneReceiver, "gnshulc", SDR_GNS, 0},
+    { ifileInitConfig, ifileHandleOption, ifileOpen, ifileRun, ifileClose, ifileReceivers, "ifile", SDR_IFILE, 0},
+    { replayInitConfig, replayHandleOption, replayOpen, replayRun, replayClose, oneReceiver, "replay", SDR_REPLAY, 0},
+    { noInitConfig, noHandleOption, noOpen, noRun, noClose, oneReceiver, "none", SDR_NONE, 0},
 
-    { NULL, NULL, NULL, NULL, NULL, NULL, SDR_NONE, 0} /* must come last */
+    { NULL, NULL, NULL, NULL, NULL, NULL, NULL, SDR_NONE, 0} /* must come last */
 };
 
 void sdrInitConfig() {
@@ -133,7 +140,7 @@ bool sdrHandleOption(int argc, char *argv) {
 }
 
 static sdr_handler *current_handler() {
-    static sdr_handler unsupported_handler = {noInitConfig, noHandleOption, unsupportedOpen, noRun, noClose, "unsupported", SDR_NONE, 0};
+    static sdr_handler unsupported_handler = {noInitConfig, noHandleOption, unsupportedOpen, noRun, noClose, oneReceiver, "unsupported", SDR_NONE, 0};
 
     for (int i = 0; sdr_handlers[i].name; ++i) {
         if (Modes.sdr_type == sdr_handlers[i].sdr_type) {
@@ -144,42 +151,93 @@ static sdr_handler *current_handler() {
     return &unsupported_handler;
 }
 
+// Per receiver reader thread CPU accounting
+
+static struct {
+    struct timespec cpu_accumulator; // accumulated CPU time used by the reader thread
+    struct timespec cpu_start; // start time for the last reader thread CPU measurement
+} receivers[MODES_MAX_RECEIVERS];
+
+static pthread_mutex_t reader_cpu_mutex = PTHREAD_MUTEX_INITIALIZER; // protects receivers[]
+static unsigned receiver_count;
+static _Thread_local unsigned current_receiver; // receiver served by this thread
+
+unsigned sdrReceiverCount() {
+    unsigned count = current_handler()->receivers();
+    return count < MODES_MAX_RECEIVERS ? count : MODES_MAX_RECEIVERS;
+}
+
+unsigned sdrReceiverId() {
+    return current_receiver;
+}
+
 bool sdrOpen() {
-    pthread_mutex_init(&Modes.reader_cpu_mutex, NULL);
-    return current_handler()->open();
+    sdr_handler *handler = current_handler();
+
+    receiver_count = sdrReceiverCount();
+    if (Modes.dev_count > receiver_count) {
+        fprintf(stderr, "SDR type '%s' supports only %u device(s), %u given\n", handler->name, receiver_count, Modes.dev_count);
+        return false;
+    }
+
+    for (unsigned id = 0; id < receiver_count; ++id) {
+        current_receiver = id;
+        if (!handler->open()) {
+            // close the receivers opened so far
+            receiver_count = id;
+            sdrClose();
+            return false;
+        }
+    }
+
+    current_receiver = 0;
+    return true;
 }
 
-void sdrRun() {
-    set_thread_name("readsb-sdr");
+void sdrRun(unsigned id) {
+    char name[16];
 
-    pthread_mutex_lock(&Modes.reader_cpu_mutex);
-    Modes.reader_cpu_accumulator.tv_sec = 0;
-    Modes.reader_cpu_accumulator.tv_nsec = 0;
-    start_cpu_timing(&Modes.reader_cpu_start);
-    pthread_mutex_unlock(&Modes.reader_cpu_mutex);
+    current_receiver = id;
+    if (receiver_count > 1) {
+        snprintf(name, sizeof (name), "readsb-sdr%u", id);
+        set_thread_name(name);
+    } else {
+        set_thread_name("readsb-sdr");
+    }
+
+    pthread_mutex_lock(&reader_cpu_mutex);
+    receivers[id].cpu_accumulator.tv_sec = 0;
+    receivers[id].cpu_accumulator.tv_nsec = 0;
+    start_cpu_timing(&receivers[id].cpu_start);
+    pthread_mutex_unlock(&reader_cpu_mutex);
 
     current_handler()->run();
 
-    pthread_mutex_lock(&Modes.reader_cpu_mutex);
-    end_cpu_timing(&Modes.reader_cpu_start, &Modes.reader_cpu_accumulator);
-    pthread_mutex_unlock(&Modes.reader_cpu_mutex);
+    pthread_mutex_lock(&reader_cpu_mutex);
+    end_cpu_timing(&receivers[id].cpu_start, &receivers[id].cpu_accumulator);
+    pthread_mutex_unlock(&reader_cpu_mutex);
 }
 
 void sdrClose() {
-    pthread_mutex_destroy(&Modes.reader_cpu_mutex);
-    current_handler()->close();
+    for (unsigned id = receiver_count; id-- > 0;) {
+        current_receiver = id;
+        current_handler()->close();
+    }
+    current_receiver = 0;
 }
 
 void sdrMonitor() {
-    pthread_mutex_lock(&Modes.reader_cpu_mutex);
-    update_cpu_timing(&Modes.reader_cpu_start, &Modes.reader_cpu_accumulator);
-    pthread_mutex_unlock(&Modes.reader_cpu_mutex);
+    pthread_mutex_lock(&reader_cpu_mutex);
+    update_cpu_timing(&receivers[current_receiver].cpu_start, &receivers[current_receiver].cpu_accumulator);
+    pthread_mutex_unlock(&reader_cpu_mutex);
 }
 
 void sdrUpdateCPUTime(struct timespec *addTo) {
-    pthread_mutex_lock(&Modes.reader_cpu_mutex);
-    add_timespecs(&Modes.reader_cpu_accumulator, addTo, addTo);
-    Modes.reader_cpu_accumulator.tv_sec = 0;
-    Modes.reader_cpu_accumulator.tv_nsec = 0;
-    pthread_mutex_unlock(&Modes.reader_cpu_mutex);
-}
\ No newline at end of file
+    pthread_mutex_lock(&reader_cpu_mutex);
+    for (unsigned id = 0; id < receiver_count; ++id) {
+        add_timespecs(&receivers[id].cpu_accumulator, addTo, addTo);
+        receivers[id].cpu_accumulator.tv_sec = 0;
+        receivers[id].cpu_accumulator.tv_nsec = 0;
+    }
+    pthread_mutex_unlock(&reader_cpu_mutex);
+}
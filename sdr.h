@@ -29,9 +29,13 @@
 
 void sdrInitConfig();
 bool sdrHandleOption(int argc, char *argv);
+// Number of receivers configured, each needs a reader thread calling sdrRun()
+unsigned sdrReceiverCount();
 bool sdrOpen();
-void sdrRun();
+void sdrRun(unsigned id);
 void sdrClose();
+// Receiver the SDR handler is working for; valid in its open, run and close calls
+unsigned sdrReceiverId();
 // Call periodically from the SDR read thread to update reader thread CPU stats:
 void sdrMonitor();
 // Retrieve CPU stats and add new CPU time to *addTo
@@ -18,9 +18,42 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <termios.h>
+#include <poll.h>
 #include "readsb.h"
 #include "sdr_beast.h"
 
+// The serial port is read by its own thread, which splits the data into
+// frames and queues them for the main thread to decode. Messages are thus
+// picked up as soon as they arrive, instead of on the next pass of the
+// main loop's background work.
+
+#define BEAST_READ_BUF 65536
+#define BEAST_FRAME_MAX 32 // longest unescaped frame, without the leading 0x1a
+#define BEAST_QUEUE_FRAMES 4096
+
+struct beast_frame {
+    uint64_t received; // system time the frame was read
+    unsigned len;
+    bool remote; // passed on from a capture replay
+    char data[BEAST_FRAME_MAX];
+};
+
+static struct {
+    struct beast_frame frames[BEAST_QUEUE_FRAMES];
+    unsigned head; // next slot the reader fills
+    unsigned tail; // next slot the main thread decodes
+    unsigned garbage; // bytes skipped between frames, not yet counted by the main thread
+    pthread_mutex_t mutex;
+    pthread_cond_t notempty;
+    pthread_cond_t notfull;
+} beast_queue = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .notempty = PTHREAD_COND_INITIALIZER,
+    .notfull = PTHREAD_COND_INITIALIZER,
+};
+
+static char beast_readbuf[BEAST_READ_BUF];
+
 static struct {
     bool filter_df045;
     bool filter_df1117;
@@ -105,8 +138,11 @@ bool beastOpen(void) {
     tios.c_oflag = 0;
     tios.c_lflag = 0;
     tios.c_cflag = CS8 | CRTSCTS;
+    // Have read() return once at least the shortest frame (Mode A/C) has
+    // arrived, with everything that has accumulated by then; a partial
+    // frame is returned after 100ms without further data.
     tios.c_cc[VMIN] = 11;
-    tios.c_cc[VTIME] = 0;
+    tios.c_cc[VTIME] = 1;
 
     if (Modes.sdr_type == SDR_GNS) {
         baud = B921600;
@@ -192,12 +228,179 @@ bool beastOpen(void) {
     return true;
 }
 
+// Queue one frame, waiting for room if the main thread is behind; the
+// hardware flow control then holds off the receiver. Also used by the
+// capture replay, see sdr_replay.c.
+
+void beastQueueFrame(const char *frame, unsigned len, uint64_t received, bool remote) {
+    pthread_mutex_lock(&beast_queue.mutex);
+    while (beast_queue.head - beast_queue.tail == BEAST_QUEUE_FRAMES && !Modes.exit) {
+        struct timespec deadline;
+        get_deadline(100, &deadline); // recheck Modes.exit
+        pthread_cond_timedwait(&beast_queue.notfull, &beast_queue.mutex, &deadline);
+    }
+    pthread_mutex_unlock(&beast_queue.mutex);
+
+    if (Modes.exit)
+        return;
+
+    // only this thread writes head, and the main thread leaves this slot alone until it does
+    struct beast_frame *f = &beast_queue.frames[beast_queue.head % BEAST_QUEUE_FRAMES];
+    f->received = received;
+    f->len = len;
+    f->remote = remote;
+    memcpy(f->data, frame, len);
+
+    pthread_mutex_lock(&beast_queue.mutex);
+    beast_queue.head++;
+    pthread_mutex_unlock(&beast_queue.mutex);
+}
+
+// Wake up the main thread for the frames queued so far, counting the bytes
+// that were skipped between them
+
+void beastQueueNotify(unsigned garbage) {
+    pthread_mutex_lock(&beast_queue.mutex);
+    beast_queue.garbage += garbage;
+    pthread_cond_signal(&beast_queue.notempty);
+    pthread_mutex_unlock(&beast_queue.mutex);
+}
+
+// Wait until the main thread has decoded everything queued, or is exiting
+
+void beastQueueDrain(void) {
+    pthread_mutex_lock(&beast_queue.mutex);
+    pthread_cond_signal(&beast_queue.notempty);
+    while (beast_queue.head != beast_queue.tail && !Modes.exit) {
+        struct timespec deadline;
+        get_deadline(100, &deadline);
+        pthread_cond_timedwait(&beast_queue.notfull, &beast_queue.mutex, &deadline);
+    }
+    pthread_mutex_unlock(&beast_queue.mutex);
+}
+
+// Split the data read so far into frames, unescaped in place. Returns the
+// number of bytes consumed; *garbage counts those that were not part of a
+// frame.
+
+static size_t parse_frames(char *buf, size_t len, uint64_t received, unsigned *garbage) {
+    struct beast_scan scan = {buf, buf + len, 0, 0};
+    char *frame;
+    int flen;
+
+    while ((frame = beastNextFrame(&scan, &flen))) {
+        if (flen > BEAST_FRAME_MAX)
+            continue;
+        beastQueueFrame(frame, flen, received, false);
+    }
+
+    *garbage += scan.garbage;
+    return scan.next - buf;
+}
+
 void beastRun() {
+    size_t len = 0;
+
+    while (!Modes.exit) {
+        struct pollfd pfd = {Modes.beast_fd, POLLIN, 0};
+
+        sdrMonitor();
+
+        // wake up regularly to notice Modes.exit
+        int ready = poll(&pfd, 1, 100);
+        if (ready < 0 && errno != EINTR) {
+            fprintf(stderr, "Beast: poll(%s): %s\n", Modes.beast_serial, strerror(errno));
+            break;
+        }
+        if (ready <= 0)
+            continue;
+        if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+            fprintf(stderr, "Beast: %s closed: USB handle failed?\n", Modes.beast_serial);
+            break;
+        }
+
+        if (len == BEAST_READ_BUF)
+            len = 0; // a full buffer without a single frame, drop it
+
+        ssize_t nread = read(Modes.beast_fd, beast_readbuf + len, BEAST_READ_BUF - len);
+        if (nread < 0 && (errno == EINTR || errno == EAGAIN))
+            continue;
+        if (nread <= 0) {
+            fprintf(stderr, "Beast: error reading %s: %s\n", Modes.beast_serial, nread ? strerror(errno) : "end of file");
+            break;
+        }
+
+        unsigned garbage = 0;
+        len += nread;
+        size_t used = parse_frames(beast_readbuf, len, mstime(), &garbage);
+        memmove(beast_readbuf, beast_readbuf + used, len - used);
+        len -= used;
+
+        beastQueueNotify(garbage);
+    }
+
+    if (!Modes.exit) {
+        Modes.exit = 3; // lost the device
+    }
+
+    // the main thread may be waiting for frames, and it no longer drains the queue
+    pthread_mutex_lock(&beast_queue.mutex);
+    pthread_cond_broadcast(&beast_queue.notempty);
+    pthread_cond_broadcast(&beast_queue.notfull);
+    pthread_mutex_unlock(&beast_queue.mutex);
+}
+
+//
+// Main thread: wait up to timeout_ms for frames from the reader thread and
+// decode them as they come in, until the timeout has passed.
+//
+
+void beastProcessFrames(int64_t timeout_ms) {
+    struct timespec deadline;
+
+    get_deadline(timeout_ms, &deadline);
+
+    pthread_mutex_lock(&beast_queue.mutex);
+    while (!Modes.exit) {
+        if (beast_queue.head == beast_queue.tail) {
+            if (pthread_cond_timedwait(&beast_queue.notempty, &beast_queue.mutex, &deadline) == ETIMEDOUT)
+                break;
+            continue;
+        }
+
+        unsigned head = beast_queue.head;
+        unsigned garbage = beast_queue.garbage;
+        beast_queue.garbage = 0;
+        pthread_mutex_unlock(&beast_queue.mutex);
+
+        struct timespec start_time;
+        start_cpu_timing(&start_time);
 
+        Modes.stats_current.remote_rejected_bad += garbage / (8 + MODES_SHORT_MSG_BYTES);
+        for (unsigned i = beast_queue.tail; i != head; ++i) {
+            struct beast_frame *f = &beast_queue.frames[i % BEAST_QUEUE_FRAMES];
+            if (Modes.sdr_type == SDR_REPLAY)
+                Modes.ifile_now = f->received;
+            decodeBeastFrame(f->data, f->remote, f->received);
+        }
+
+        end_cpu_timing(&start_time, &Modes.stats_current.demod_cpu);
+
+        pthread_mutex_lock(&beast_queue.mutex);
+        beast_queue.tail = head;
+        pthread_cond_signal(&beast_queue.notfull);
+
+        // a replay runs on the clock of its frames, which may be far ahead
+        // of the wall clock: go back for the background work after each batch
+        if (Modes.sdr_type == SDR_REPLAY)
+            break;
+    }
+    pthread_mutex_unlock(&beast_queue.mutex);
 }
 
 void beastClose() {
-    /* Beast device will be closed in the main cleanup_and_exit function when
-     * clients are freed.
-     */
+    if (Modes.beast_fd >= 0) {
+        close(Modes.beast_fd);
+        Modes.beast_fd = -1;
+    }
 }
@@ -25,6 +25,12 @@ bool beastHandleOption(int argc, char *argv);
 bool beastOpen();
 void beastRun();
 void beastClose();
+void beastProcessFrames(int64_t timeout_ms);
+
+// Reader thread side of the frame queue, shared with the capture replay
+void beastQueueFrame(const char *frame, unsigned len, uint64_t received, bool remote);
+void beastQueueNotify(unsigned garbage);
+void beastQueueDrain(void);
 
 #endif /* SDR_BEAST_H */
 
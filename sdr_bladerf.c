@@ -156,7 +156,7 @@ bool bladeRFOpen() {
     int status;
 
     bladerf_set_usb_reset_on_open(true);
-    if ((status = bladerf_open(&BladeRF.device, Modes.dev_name)) < 0) {
+    if ((status = bladerf_open(&BladeRF.device, Modes.dev_names[0])) < 0) {
         fprintf(stderr, "Failed to open bladeRF: %s\n", bladerf_strerror(status));
         goto error;
     }
@@ -55,34 +55,78 @@
 #include "readsb.h"
 #include "sdr_ifile.h"
 
+#include <sys/mman.h>
+
+// With --ifile-mmap, how many blocks to ask the kernel to read ahead
+#define IFILE_READAHEAD_BLOCKS 8
+
 static struct {
     input_format_t input_format;
-    int fd;
     unsigned bytes_per_sample;
     bool throttle;
+    bool mmap; // --ifile-mmap
+    unsigned count; // number of --ifile arguments, one receiver each
+    atomic_uint running; // receivers still reading
+} ifile;
+
+// One per --ifile argument
+
+static struct ifile_input {
+    int fd;
     unsigned bufsize;
     char *readbuf;
     iq_convert_fn converter;
     struct converter_state *converter_state;
     const char *filename;
-} ifile;
+    char *map; // the whole file, with --ifile-mmap
+    size_t map_size;
+    size_t map_offset; // next byte to deliver
+    size_t map_released; // pages below this have been given back
+
+    // With --ifile-threads, see demod_chunks()
+    unsigned threads;
+    pthread_t workers[IFILE_MAX_THREADS];
+    pthread_mutex_t chunk_mutex;
+    pthread_cond_t chunk_cond;
+    uint64_t next_chunk; // next chunk to hand to a thread
+    uint64_t next_enqueue; // next chunk to pass to the FIFO
+} inputs[MODES_MAX_RECEIVERS];
 
 void ifileInitConfig(void) {
-    ifile.filename = NULL;
     ifile.input_format = INPUT_UC8;
     ifile.throttle = false;
-    ifile.fd = -1;
+    ifile.mmap = false;
     ifile.bytes_per_sample = 0;
-    ifile.bufsize = 0;
-    ifile.readbuf = NULL;
-    ifile.converter = NULL;
-    ifile.converter_state = NULL;
+    ifile.count = 0;
+    atomic_init(&ifile.running, 0);
+
+    for (int i = 0; i < MODES_MAX_RECEIVERS; ++i) {
+        inputs[i].filename = NULL;
+        inputs[i].fd = -1;
+        inputs[i].bufsize = 0;
+        inputs[i].readbuf = NULL;
+        inputs[i].converter = NULL;
+        inputs[i].converter_state = NULL;
+        inputs[i].map = NULL;
+        inputs[i].map_size = 0;
+        inputs[i].map_offset = 0;
+        inputs[i].map_released = 0;
+        inputs[i].threads = 1;
+        inputs[i].next_chunk = 0;
+        inputs[i].next_enqueue = 0;
+        pthread_mutex_init(&inputs[i].chunk_mutex, NULL);
+        pthread_cond_init(&inputs[i].chunk_cond, NULL);
+    }
 }
 
 bool ifileHandleOption(int argc, char *argv) {
     switch (argc) {
         case OptIfileName:
-            ifile.filename = strdup(argv);
+            if (ifile.count >= MODES_MAX_RECEIVERS) {
+                fprintf(stderr, "ifile: too many input files, at most %d are supported\n", MODES_MAX_RECEIVERS);
+                return false;
+            }
+            inputs[ifile.count++].filename = strdup(argv);
             Modes.sdr_type = SDR_IFILE;
             break;
         case OptIfileFormat:
@@ -101,28 +145,88 @@ bool ifileHandleOption(int argc, char *argv) {
         case OptIfileThrottle:
             ifile.throttle = true;
             break;
+        case OptIfileMmap:
+            ifile.mmap = true;
+            break;
+    }
+    return true;
+}
+
+unsigned ifileReceivers(void) {
+    return ifile.count ? ifile.count : 1;
+}
+
+// Map the whole input file, so samples are converted straight from the page
+// cache without a copy into a read buffer. Returns false if the file can't
+// be mapped; the caller falls back to read().
+
+static bool map_input(struct ifile_input *in) {
+    struct stat st;
+
+    if (fstat(in->fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        fprintf(stderr, "ifile: %s is not a regular file, --ifile-mmap ignored\n", in->filename);
+        return false;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, in->fd, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "ifile: can't map %s, --ifile-mmap ignored: %s\n", in->filename, strerror(errno));
+        return false;
     }
+
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    in->map = map;
+    in->map_size = st.st_size;
+    in->map_offset = 0;
+    in->map_released = 0;
     return true;
 }
 
+// Keep the kernel reading ahead of map_offset, and hand back the pages
+// behind it that no buffer can still refer to, so resident memory stays
+// bounded however large the file is. The page cache itself is kept, a
+// second replay of the same file is served from memory.
+
+static void advise_input(struct ifile_input *in) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t start = in->map_offset & ~(page - 1);
+    size_t ahead = (size_t) in->bufsize * IFILE_READAHEAD_BLOCKS;
+
+    if (start < in->map_size)
+        madvise(in->map + start, min(ahead, in->map_size - start), MADV_WILLNEED);
+
+    // with deferred conversion every FIFO buffer may still point into the map
+    size_t keep = (size_t) in->bufsize * (MODES_MAG_BUFFERS + 1);
+    if (in->map_offset > keep) {
+        size_t end = (in->map_offset - keep) & ~(page - 1);
+        if (end > in->map_released) {
+            madvise(in->map + in->map_released, end - in->map_released, MADV_DONTNEED);
+            in->map_released = end;
+        }
+    }
+}
+
 //
 //=========================================================================
 //
 // This is used when --ifile is specified in order to read data from file
-// instead of using an RTLSDR device
+// instead of using an RTLSDR device. Each --ifile is read by its own
+// receiver thread.
 //
 
 bool ifileOpen(void) {
-    if (!ifile.filename) {
+    struct ifile_input *in = &inputs[sdrReceiverId()];
+
+    if (!in->filename) {
         fprintf(stderr, "SDR type 'ifile' requires an --ifile argument\n");
         return false;
     }
 
-    if (!strcmp(ifile.filename, "-")) {
-        ifile.fd = STDIN_FILENO;
-    } else if ((ifile.fd = open(ifile.filename, O_RDONLY)) < 0) {
+    if (!strcmp(in->filename, "-")) {
+        in->fd = STDIN_FILENO;
+    } else if ((in->fd = open(in->filename, O_RDONLY)) < 0) {
         fprintf(stderr, "ifile: could not open %s: %s\n",
-                ifile.filename, strerror(errno));
+                in->filename, strerror(errno));
         return false;
     }
 
@@ -140,31 +244,174 @@ bool ifileOpen(void) {
             return false;
     }
 
-    ifile.bufsize = ifile.bytes_per_sample * MODES_MAG_BUF_SAMPLES; /* ~1M samples, about half a second's worth */
+    in->bufsize = ifile.bytes_per_sample * MODES_MAG_BUF_SAMPLES; /* ~1M samples, about half a second's worth */
+
+    if ((ifile.mmap || Modes.ifile_threads > 1) && in->fd != STDIN_FILENO) {
+        map_input(in);
+    }
 
-    if (!(ifile.readbuf = malloc(ifile.bufsize))) {
+    if (!in->map && !(in->readbuf = malloc(in->bufsize))) {
         fprintf(stderr, "ifile: failed to allocate read buffer\n");
         ifileClose();
         return false;
     }
 
-    ifile.converter = init_converter(ifile.input_format,
+    in->converter = init_converter(ifile.input_format,
             Modes.sample_rate,
             Modes.dc_filter,
-            &ifile.converter_state);
-    if (!ifile.converter) {
+            &in->converter_state);
+    if (!in->converter) {
         fprintf(stderr, "ifile: can't initialize sample converter\n");
         ifileClose();
         return false;
     }
 
+    if (Modes.defer_conversion) {
+        if (Modes.dc_filter) {
+            fprintf(stderr, "ifile: --defer-conversion can't be used with --dcfilter, ignored\n");
+            Modes.defer_conversion = 0;
+        } else if (!in->map && !fifo_alloc_iq(ifile.bytes_per_sample)) {
+            ifileClose();
+            return false;
+        }
+    }
+
+    in->threads = 1;
+    if (Modes.ifile_threads > 1) {
+        if (!in->map) {
+            fprintf(stderr, "ifile: --ifile-threads needs a mappable file, ignored for %s\n", in->filename);
+        } else if (ifile.throttle || Modes.interactive) {
+            fprintf(stderr, "ifile: --ifile-threads can't be used with --throttle, ignored\n");
+        } else if (Modes.dc_filter) {
+            fprintf(stderr, "ifile: --ifile-threads can't be used with --dcfilter, ignored\n");
+        } else {
+            in->threads = Modes.ifile_threads;
+            // the chunk threads convert the samples themselves
+            Modes.defer_conversion = 0;
+        }
+    }
+
+    atomic_fetch_add(&ifile.running, 1);
     return true;
 }
 
+//
+// With --ifile-threads the mapped file is cut into chunks of one FIFO buffer
+// each. Every thread takes the next chunk, converts it together with its
+// leading overlap straight from the map, so it depends on no other chunk,
+// and at 2.4MHz also searches it for messages (demod2400Prescan()). The
+// chunks are then passed to the FIFO strictly in file order, so the main
+// thread decodes and tracks them in timestamp order as if they had been read
+// sequentially.
+//
+// A thread takes a chunk number only once it holds a buffer, so the oldest
+// chunk not yet queued always has a buffer and the threads can't deadlock.
+//
+
+static void demod_chunks(struct ifile_input *in, unsigned id, bool reader) {
+    unsigned bps = ifile.bytes_per_sample;
+
+    while (!Modes.exit) {
+        struct mag_buf *outbuf = fifo_acquire(100 /* milliseconds */);
+        if (!outbuf)
+            continue;
+
+        pthread_mutex_lock(&in->chunk_mutex);
+        uint64_t chunk = in->next_chunk++;
+        pthread_mutex_unlock(&in->chunk_mutex);
+
+        size_t start = chunk * in->bufsize;
+        if (start >= in->map_size) {
+            fifo_release(outbuf);
+            break;
+        }
+
+        unsigned samples = min((size_t) in->bufsize, in->map_size - start) / bps;
+        uint64_t sampleCounter = start / bps;
+        unsigned overlap = min((uint64_t) outbuf->overlap, sampleCounter);
+        double level, power;
+
+        outbuf->receiver_id = id;
+        outbuf->sampleTimestamp = sampleCounter * 12e6 / Modes.sample_rate;
+        outbuf->sysTimestamp = outbuf->sampleTimestamp / 12000U + Modes.startup_time;
+        outbuf->flags = 0;
+
+        // The same samples fifo_enqueue() copies in from the previous chunk;
+        // silence before the start of the file
+        memset(outbuf->data, 0, (outbuf->overlap - overlap) * sizeof (outbuf->data[0]));
+        if (overlap)
+            in->converter(in->map + start - (size_t) overlap * bps, &outbuf->data[outbuf->overlap - overlap], overlap, in->converter_state, &level, &power);
+        in->converter(in->map + start, &outbuf->data[outbuf->overlap], samples, in->converter_state, &outbuf->mean_level, &outbuf->mean_power);
+        outbuf->validLength = outbuf->overlap + samples;
+
+        if (Modes.demodulate == demodulate2400 || Modes.demodulate == demodulate2400Fused)
+            demod2400Prescan(outbuf);
+
+        pthread_mutex_lock(&in->chunk_mutex);
+        while (in->next_enqueue != chunk && !Modes.exit) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += 100 * 1000000;
+            normalize_timespec(&deadline);
+            pthread_cond_timedwait(&in->chunk_cond, &in->chunk_mutex, &deadline);
+        }
+        if (Modes.exit) {
+            pthread_mutex_unlock(&in->chunk_mutex);
+            fifo_release(outbuf);
+            break;
+        }
+
+        if (reader)
+            sdrMonitor();
+        fifo_enqueue(outbuf);
+        in->next_enqueue++;
+        in->map_offset = start + (size_t) samples * bps;
+        advise_input(in);
+        pthread_cond_broadcast(&in->chunk_cond);
+        pthread_mutex_unlock(&in->chunk_mutex);
+    }
+}
+
+static void *chunkWorkerEntryPoint(void *arg) {
+    struct ifile_input *in = arg;
+
+    set_thread_name("readsb-chunk");
+    demod_chunks(in, in - inputs, false);
+    return NULL;
+}
+
+// Run the --ifile-threads threads for one input, this thread being one of them
+
+static void run_chunked(struct ifile_input *in, unsigned id) {
+    unsigned started;
+
+    in->next_chunk = in->next_enqueue = 0;
+    for (started = 1; started < in->threads; ++started) {
+        int rc = pthread_create(&in->workers[started], NULL, chunkWorkerEntryPoint, in);
+        if (rc) {
+            fprintf(stderr, "ifile: can't create chunk thread: %s\n", strerror(rc));
+            break;
+        }
+    }
+
+    demod_chunks(in, id, true);
+
+    for (unsigned i = 1; i < started; ++i)
+        pthread_join(in->workers[i], NULL);
+}
+
 void ifileRun() {
-    if (ifile.fd < 0)
+    unsigned id = sdrReceiverId();
+    struct ifile_input *in = &inputs[id];
+
+    if (in->fd < 0)
         return;
 
+    if (in->threads > 1) {
+        run_chunked(in, id);
+        goto done;
+    }
+
     struct timespec next_buffer_delivery;
     clock_gettime(CLOCK_MONOTONIC, &next_buffer_delivery);
 
@@ -182,7 +429,8 @@ void ifileRun() {
         }
 
         sdrMonitor();
-        
+        outbuf->receiver_id = id;
+
         // Compute the sample timestamp for the start of the block
         outbuf->sampleTimestamp = sampleCounter * 12e6 / Modes.sample_rate;
         
@@ -190,13 +438,24 @@ void ifileRun() {
         outbuf->sysTimestamp = outbuf->sampleTimestamp / 12000U + Modes.startup_time;
 
         unsigned bytes_wanted = (outbuf->totalLength - outbuf->overlap) * ifile.bytes_per_sample;
-        if (bytes_wanted > ifile.bufsize) {
-            bytes_wanted = ifile.bufsize;
+        if (bytes_wanted > in->bufsize) {
+            bytes_wanted = in->bufsize;
         }
 
+        // with deferred conversion read straight into the buffer's sample storage
+        char *readbuf = Modes.defer_conversion ? outbuf->iq_data : in->readbuf;
         unsigned bytes_read = 0;
-        while (bytes_read < bytes_wanted) {
-            ssize_t nread = read(ifile.fd, ifile.readbuf + bytes_read, bytes_wanted - bytes_read);
+        if (in->map) {
+            // no read at all, the samples are converted in place
+            size_t left = in->map_size - in->map_offset;
+            bytes_read = (left < bytes_wanted) ? left : bytes_wanted;
+            readbuf = in->map + in->map_offset;
+            in->map_offset += bytes_read;
+            eof = (in->map_offset == in->map_size);
+            advise_input(in);
+        }
+        while (!in->map && bytes_read < bytes_wanted) {
+            ssize_t nread = read(in->fd, readbuf + bytes_read, bytes_wanted - bytes_read);
             if (nread <= 0) {
                 if (nread < 0) {
                     fprintf(stderr, "ifile: error reading input file: %s\n", strerror(errno));
@@ -211,7 +470,11 @@ void ifileRun() {
         unsigned samples_read = bytes_read / ifile.bytes_per_sample;
 
         // Convert the new data
-        ifile.converter(ifile.readbuf, &outbuf->data[outbuf->overlap], samples_read, ifile.converter_state, &outbuf->mean_level, &outbuf->mean_power);
+        if (Modes.defer_conversion) {
+            fifo_defer_conversion(outbuf, readbuf, samples_read, ifile.bytes_per_sample, in->converter, in->converter_state);
+        } else {
+            in->converter(readbuf, &outbuf->data[outbuf->overlap], samples_read, in->converter_state, &outbuf->mean_level, &outbuf->mean_power);
+        }
         outbuf->validLength = outbuf->overlap + samples_read;
         outbuf->flags = 0;
 
@@ -230,26 +493,36 @@ void ifileRun() {
         sampleCounter += samples_read;
     }
 
-    // Wait for the FIFO to drain so we don't throw away trailing data
-    fifo_drain();
-    
-    Modes.exit = 1;
+done:
+    // The last file to end drains the FIFO, so we don't throw away
+    // trailing data, and ends the process.
+    if (atomic_fetch_sub(&ifile.running, 1) == 1) {
+        fifo_drain();
+        Modes.exit = 1;
+    }
 }
 
 void ifileClose() {
-    if (ifile.converter) {
-        cleanup_converter(ifile.converter_state);
-        ifile.converter = NULL;
-        ifile.converter_state = NULL;
+    struct ifile_input *in = &inputs[sdrReceiverId()];
+
+    if (in->converter) {
+        cleanup_converter(in->converter_state);
+        in->converter = NULL;
+        in->converter_state = NULL;
+    }
+
+    if (in->readbuf) {
+        free(in->readbuf);
+        in->readbuf = NULL;
     }
 
-    if (ifile.readbuf) {
-        free(ifile.readbuf);
-        ifile.readbuf = NULL;
+    if (in->map) {
+        munmap(in->map, in->map_size);
+        in->map = NULL;
     }
 
-    if (ifile.fd >= 0 && ifile.fd != STDIN_FILENO) {
-        close(ifile.fd);
-        ifile.fd = -1;
+    if (in->fd >= 0 && in->fd != STDIN_FILENO) {
+        close(in->fd);
+        in->fd = -1;
     }
 }
@@ -27,10 +27,13 @@
 
 // Pseudo-SDR that reads from a sample file
 
+#define IFILE_MAX_THREADS 64 // --ifile-threads
+
 void ifileInitConfig();
 bool ifileHandleOption(int argc, char *argv);
 bool ifileOpen();
 void ifileRun();
 void ifileClose();
+unsigned ifileReceivers();
 
 #endif
@@ -0,0 +1,193 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// sdr_replay.c: replay of a --record capture
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "readsb.h"
+#include "sdr_beast.h"
+#include "sdr_replay.h"
+
+#include <inttypes.h>
+
+// The reader thread turns the records back into Beast frames and queues
+// them like a local Beast would, so the main thread decodes them with
+// decodeBeastFrame() in between the background work. Like --ifile the
+// replay has its own clock: mstime() is the system time of the frame last
+// decoded, moved to start at startup, and with --throttle the frames are
+// queued at the pace they were recorded at, otherwise as fast as they are
+// decoded.
+
+static struct {
+    char *filename;
+    bool throttle;
+    int fd;
+    unsigned char *buf; // one block
+    bool started;
+    uint64_t first_sys; // system time of the first frame
+    uint64_t last_received;
+    struct timespec wall_start; // when the first frame was queued, with --throttle
+    uint64_t frames;
+} replay;
+
+void replayInitConfig(void) {
+    replay.filename = NULL;
+    replay.throttle = false;
+    replay.fd = -1;
+    replay.buf = NULL;
+}
+
+bool replayHandleOption(int argc, char *argv) {
+    switch (argc) {
+        case OptReplayFile:
+            free(replay.filename);
+            replay.filename = strdup(argv);
+            break;
+        case OptIfileThrottle:
+            replay.throttle = true;
+            break;
+    }
+    return true;
+}
+
+static bool read_all(int fd, unsigned char *p, size_t len) {
+    while (len) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            fprintf(stderr, "replay: error reading %s: %s\n", replay.filename, strerror(errno));
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool replayOpen(void) {
+    unsigned char header[CAPTURE_HEADER_BYTES];
+    uint64_t start;
+
+    if (!replay.filename) {
+        fprintf(stderr, "SDR type 'replay' requires a --replay argument\n");
+        return false;
+    }
+
+    if (!strcmp(replay.filename, "-")) {
+        replay.fd = STDIN_FILENO;
+    } else if ((replay.fd = open(replay.filename, O_RDONLY)) < 0) {
+        fprintf(stderr, "replay: could not open %s: %s\n", replay.filename, strerror(errno));
+        return false;
+    }
+
+    if (!read_all(replay.fd, header, sizeof (header)) || !captureCheckHeader(header, &start)) {
+        fprintf(stderr, "replay: %s is not a capture file of this version\n", replay.filename);
+        return false;
+    }
+
+    if (!(replay.buf = malloc(CAPTURE_BLOCK_BYTES))) {
+        fprintf(stderr, "replay: out of memory allocating the read buffer\n");
+        return false;
+    }
+
+    time_t t = start / 1000;
+    char when[32];
+    strftime(when, sizeof (when), "%Y-%m-%d %H:%M:%S", localtime(&t));
+    fprintf(stderr, "Replaying %s, recorded at %s%s\n", replay.filename, when,
+            (replay.throttle || Modes.interactive) ? " at the original speed" : "");
+    return true;
+}
+
+static void replayFrame(const struct capture_frame *frame, void *arg) {
+    char beast[1 + 6 + 1 + MODES_LONG_MSG_BYTES], *p = beast;
+    MODES_NOTUSED(arg);
+
+    if (Modes.exit)
+        return;
+
+    if (!replay.started) {
+        replay.started = true;
+        replay.first_sys = frame->sys_timestamp;
+        clock_gettime(CLOCK_MONOTONIC, &replay.wall_start);
+    }
+
+    // the clock moves on with the frames, and never back
+    uint64_t offset = frame->sys_timestamp > replay.first_sys ? frame->sys_timestamp - replay.first_sys : 0;
+    uint64_t received = Modes.startup_time + offset;
+    if (received < replay.last_received)
+        received = replay.last_received;
+    replay.last_received = received;
+
+    if (replay.throttle || Modes.interactive) {
+        struct timespec due = replay.wall_start;
+        due.tv_sec += (received - Modes.startup_time) / 1000;
+        due.tv_nsec += (received - Modes.startup_time) % 1000 * 1000000;
+        normalize_timespec(&due);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR)
+            ;
+    }
+
+    *p++ = frame->len == MODEAC_MSG_BYTES ? '1' : (frame->len == MODES_SHORT_MSG_BYTES ? '2' : '3');
+    for (int shift = 40; shift >= 0; shift -= 8)
+        *p++ = frame->timestamp >> shift;
+    *p++ = frame->signal;
+    memcpy(p, frame->msg, frame->len);
+    p += frame->len;
+
+    beastQueueFrame(beast, p - beast, received, frame->remote);
+    replay.frames++;
+
+    // hand throttled frames over as they come, the others by the block
+    if (replay.throttle || Modes.interactive)
+        beastQueueNotify(0);
+}
+
+void replayRun(void) {
+    while (!Modes.exit) {
+        unsigned char *block = replay.buf;
+        int len;
+
+        sdrMonitor();
+
+        if (!read_all(replay.fd, block, CAPTURE_BLOCK_HEADER_BYTES))
+            break; // done
+        if ((len = captureBlockLength(block)) < 0) {
+            fprintf(stderr, "replay: %s: bad block after %" PRIu64 " frames, stopping\n", replay.filename, replay.frames);
+            break;
+        }
+        if (!read_all(replay.fd, block + CAPTURE_BLOCK_HEADER_BYTES, len)) {
+            fprintf(stderr, "replay: %s: the last block is cut short\n", replay.filename);
+            break;
+        }
+        if (!captureReadBlock(block, CAPTURE_BLOCK_HEADER_BYTES + len, replayFrame, NULL))
+            fprintf(stderr, "replay: %s: damaged block after %" PRIu64 " frames, skipped the rest of it\n", replay.filename, replay.frames);
+        beastQueueNotify(0);
+    }
+
+    // The queue is decoded before the end, so trailing frames aren't lost.
+    beastQueueDrain();
+    if (!Modes.exit) {
+        fprintf(stderr, "replay: %s: %" PRIu64 " frames replayed\n", replay.filename, replay.frames);
+        Modes.exit = 1;
+    }
+}
+
+void replayClose(void) {
+    if (replay.fd >= 0 && replay.fd != STDIN_FILENO)
+        close(replay.fd);
+    replay.fd = -1;
+    free(replay.buf);
+    replay.buf = NULL;
+}
@@ -0,0 +1,29 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// sdr_replay.h: replay of a --record capture (header)
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SDR_REPLAY_H
+#define SDR_REPLAY_H
+
+// Pseudo-SDR that reads back the frames of a capture file
+
+void replayInitConfig();
+bool replayHandleOption(int argc, char *argv);
+bool replayOpen();
+void replayRun();
+void replayClose();
+
+#endif
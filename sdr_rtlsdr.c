@@ -63,25 +63,47 @@
 #endif
 
 static struct {
+    int ppm_error;
+    bool digital_agc;
+    unsigned buffers; // USB transfers in flight
+    unsigned buffer_size; // bytes per USB transfer, one FIFO buffer each
+} RTLSDR;
+
+// One per --device
+
+static struct rtlsdr_receiver {
+    unsigned id;
     iq_convert_fn converter;
     struct converter_state *converter_state;
     rtlsdr_dev_t *dev;
-    int ppm_error;
-    bool digital_agc;
     uint8_t *bounce_buffer;
-} RTLSDR;
+    unsigned dropped;
+    uint64_t sampleCounter;
+} receivers[MODES_MAX_RECEIVERS];
 
 //
 // =============================== RTLSDR handling ==========================
 //
 
 void rtlsdrInitConfig() {
-    RTLSDR.dev = NULL;
     RTLSDR.digital_agc = false;
     RTLSDR.ppm_error = 0;
-    RTLSDR.converter = NULL;
-    RTLSDR.converter_state = NULL;
-    RTLSDR.bounce_buffer = NULL;
+    RTLSDR.buffers = MODES_RTL_BUFFERS;
+    RTLSDR.buffer_size = MODES_RTL_BUF_SIZE;
+
+    for (unsigned i = 0; i < MODES_MAX_RECEIVERS; ++i) {
+        receivers[i].id = i;
+        receivers[i].dev = NULL;
+        receivers[i].converter = NULL;
+        receivers[i].converter_state = NULL;
+        receivers[i].bounce_buffer = NULL;
+        receivers[i].dropped = 0;
+        receivers[i].sampleCounter = 0;
+    }
+}
+
+unsigned rtlsdrReceivers() {
+    return Modes.dev_count ? Modes.dev_count : 1;
 }
 
 static void show_rtlsdr_devices() {
@@ -150,20 +172,39 @@ bool rtlsdrHandleOption(int argc, char *argv) {
         case OptRtlSdrPpm:
             RTLSDR.ppm_error = atoi(argv);
             break;
+        case OptRtlSdrBuffers:
+            RTLSDR.buffers = atoi(argv);
+            if (RTLSDR.buffers < 2 || RTLSDR.buffers > 64) {
+                fprintf(stderr, "rtlsdr: --rtlsdr-buffers must be between 2 and 64\n");
+                return false;
+            }
+            break;
+        case OptRtlSdrBufferSize:
+            // librtlsdr wants a multiple of the 16kB URB size, and each
+            // transfer must fit into one FIFO buffer
+            RTLSDR.buffer_size = atoi(argv) * 1024;
+            if (RTLSDR.buffer_size < 16384 || RTLSDR.buffer_size > MODES_RTL_BUF_SIZE || RTLSDR.buffer_size % 16384) {
+                fprintf(stderr, "rtlsdr: --rtlsdr-buffer-size must be a multiple of 16 between 16 and %d\n", MODES_RTL_BUF_SIZE / 1024);
+                return false;
+            }
+            break;
     }
     return true;
 }
 
 bool rtlsdrOpen(void) {
+    struct rtlsdr_receiver *rx = &receivers[sdrReceiverId()];
+    char *dev_name = Modes.dev_names[rx->id];
+
     if (!rtlsdr_get_device_count()) {
         fprintf(stderr, "rtlsdr: no supported devices found.\n");
         return false;
     }
 
     int dev_index = 0;
-    if (Modes.dev_name) {
-        if ((dev_index = find_device_index(Modes.dev_name)) < 0) {
-            fprintf(stderr, "rtlsdr: no device matching '%s' found.\n", Modes.dev_name);
+    if (dev_name) {
+        if ((dev_index = find_device_index(dev_name)) < 0) {
+            fprintf(stderr, "rtlsdr: no device matching '%s' found.\n", dev_name);
             show_rtlsdr_devices();
             return false;
         }
@@ -181,7 +222,7 @@ bool rtlsdrOpen(void) {
             dev_index, rtlsdr_get_device_name(dev_index),
             manufacturer, product, serial);
 
-    if (rtlsdr_open(&RTLSDR.dev, dev_index) < 0) {
+    if (rtlsdr_open(&rx->dev, dev_index) < 0) {
         fprintf(stderr, "rtlsdr: error opening the RTLSDR device: %s\n",
                 strerror(errno));
         return false;
@@ -190,19 +231,19 @@ bool rtlsdrOpen(void) {
     // Set gain, frequency, sample rate, and reset the device
     if (Modes.gain == MODES_AUTO_GAIN) {
         fprintf(stderr, "rtlsdr: enabling tuner AGC\n");
-        rtlsdr_set_tuner_gain_mode(RTLSDR.dev, 0);
+        rtlsdr_set_tuner_gain_mode(rx->dev, 0);
     } else {
         int *gains;
         int numgains;
 
-        numgains = rtlsdr_get_tuner_gains(RTLSDR.dev, NULL);
+        numgains = rtlsdr_get_tuner_gains(rx->dev, NULL);
         if (numgains <= 0) {
             fprintf(stderr, "rtlsdr: error getting tuner gains\n");
             return false;
         }
 
         gains = malloc(numgains * sizeof (int));
-        if (rtlsdr_get_tuner_gains(RTLSDR.dev, gains) != numgains) {
+        if (rtlsdr_get_tuner_gains(rx->dev, gains) != numgains) {
             fprintf(stderr, "rtlsdr: error getting tuner gains\n");
             free(gains);
             return false;
@@ -216,39 +257,41 @@ bool rtlsdrOpen(void) {
                 closest = i;
         }
 
-        rtlsdr_set_tuner_gain(RTLSDR.dev, gains[closest]);
+        rtlsdr_set_tuner_gain(rx->dev, gains[closest]);
         free(gains);
         fprintf(stderr, "rtlsdr: tuner gain set to %.1f dB\n",
-                rtlsdr_get_tuner_gain(RTLSDR.dev) / 10.0);
+                rtlsdr_get_tuner_gain(rx->dev) / 10.0);
     }
 
     if (RTLSDR.digital_agc) {
         fprintf(stderr, "rtlsdr: enabling digital AGC\n");
-        rtlsdr_set_agc_mode(RTLSDR.dev, 1);
+        rtlsdr_set_agc_mode(rx->dev, 1);
     }
 
-    rtlsdr_set_freq_correction(RTLSDR.dev, RTLSDR.ppm_error);
-    rtlsdr_set_center_freq(RTLSDR.dev, Modes.freq);
-    rtlsdr_set_sample_rate(RTLSDR.dev, (unsigned) Modes.sample_rate);
+    rtlsdr_set_freq_correction(rx->dev, RTLSDR.ppm_error);
+    rtlsdr_set_center_freq(rx->dev, Modes.freq);
+    rtlsdr_set_sample_rate(rx->dev, (unsigned) Modes.sample_rate);
 #ifdef ENABLE_RTLSDR_BIASTEE
     // Enable or disable bias tee on GPIO pin 0. (Works only for rtl-sdr.com v3 dongles)
-    rtlsdr_set_bias_tee(RTLSDR.dev, Modes.biastee);
+    rtlsdr_set_bias_tee(rx->dev, Modes.biastee);
 #endif
 
-    rtlsdr_reset_buffer(RTLSDR.dev);
+    rtlsdr_reset_buffer(rx->dev);
 
-    RTLSDR.converter = init_converter(INPUT_UC8,
+    rx->converter = init_converter(INPUT_UC8,
             Modes.sample_rate,
             Modes.dc_filter,
-            &RTLSDR.converter_state);
-    if (!RTLSDR.converter) {
+            &rx->converter_state);
+    if (!rx->converter) {
         fprintf(stderr, "rtlsdr: can't initialize sample converter\n");
         rtlsdrClose();
         return false;
     }
 
 #ifdef USE_BOUNCE_BUFFER
-    if (!(RTLSDR.bounce_buffer = malloc(MODES_RTL_BUF_SIZE))) {
+    // aligned like the FIFO buffers, for the vectorized converters
+    if (posix_memalign((void **) &rx->bounce_buffer, 64, RTLSDR.buffer_size)) {
+        rx->bounce_buffer = NULL;
         fprintf(stderr, "rtlsdr: can't allocate bounce buffer\n");
         rtlsdrClose();
         return false;
@@ -259,15 +302,13 @@ bool rtlsdrOpen(void) {
 }
 
 static void rtlsdrCallback(unsigned char *buf, uint32_t len, void *ctx) {
-    static unsigned dropped = 0;
-    static uint64_t sampleCounter = 0;
-
-    MODES_NOTUSED(ctx);
+    struct rtlsdr_receiver *rx = ctx;
+    uint64_t receive_time = fifo_clock_us();
 
     sdrMonitor();
     
     if (Modes.exit) {
-        rtlsdr_cancel_async(RTLSDR.dev); // ask our caller to exit
+        rtlsdr_cancel_async(rx->dev); // ask our caller to exit
         return;
     }
 
@@ -279,26 +320,28 @@ static void rtlsdrCallback(unsigned char *buf, uint32_t len, void *ctx) {
     struct mag_buf *outbuf = fifo_acquire(0 /* don't wait */);
     if (!outbuf) {
         // FIFO is full. Drop this block.
-        dropped += samples_read;
-        sampleCounter += samples_read;
+        rx->dropped += samples_read;
+        rx->sampleCounter += samples_read;
         return;
     }
 
     outbuf->flags = 0;
     outbuf->dropped = 0;
+    outbuf->receiver_id = rx->id;
+    outbuf->receiveTime = receive_time;
 
-    if (dropped) {
+    if (rx->dropped) {
         // We previously dropped some samples due to no buffers being available
         outbuf->flags |= MAGBUF_DISCONTINUOUS;
-        outbuf->dropped = dropped;
+        outbuf->dropped = rx->dropped;
 
         // reset dropped counter
-        dropped = 0;
+        rx->dropped = 0;
     }
 
     // Compute the sample timestamp and system timestamp for the start of the block
-    outbuf->sampleTimestamp = sampleCounter * 12e6 / Modes.sample_rate;
-    sampleCounter += samples_read;
+    outbuf->sampleTimestamp = rx->sampleCounter * 12e6 / Modes.sample_rate;
+    rx->sampleCounter += samples_read;
 
     // Get the approx system time for the start of this block
     uint64_t block_duration = 1e3 * samples_read / Modes.sample_rate;
@@ -309,16 +352,16 @@ static void rtlsdrCallback(unsigned char *buf, uint32_t len, void *ctx) {
     if (to_convert + outbuf->overlap > outbuf->totalLength) {
         // how did that happen?
         to_convert = outbuf->totalLength - outbuf->overlap;
-        dropped = samples_read - to_convert;
+        rx->dropped = samples_read - to_convert;
     }
 
 #ifdef USE_BOUNCE_BUFFER
     // Work around zero-copy slowness on Pis with 5.x kernels
-    memcpy(RTLSDR.bounce_buffer, buf, to_convert * 2);
-    buf = RTLSDR.bounce_buffer;
+    memcpy(rx->bounce_buffer, buf, to_convert * 2);
+    buf = rx->bounce_buffer;
 #endif
 
-    RTLSDR.converter(buf, &outbuf->data[outbuf->overlap], to_convert, RTLSDR.converter_state, &outbuf->mean_level, &outbuf->mean_power);
+    rx->converter(buf, &outbuf->data[outbuf->overlap], to_convert, rx->converter_state, &outbuf->mean_level, &outbuf->mean_power);
     outbuf->validLength = outbuf->overlap + to_convert;
 
     // Push to the demodulation thread
@@ -326,30 +369,35 @@ static void rtlsdrCallback(unsigned char *buf, uint32_t len, void *ctx) {
 }
 
 void rtlsdrRun() {
-    if (!RTLSDR.dev) {
+    struct rtlsdr_receiver *rx = &receivers[sdrReceiverId()];
+
+    if (!rx->dev) {
         return;
     }
 
-    rtlsdr_read_async(RTLSDR.dev, rtlsdrCallback, NULL, MODES_RTL_BUFFERS, MODES_RTL_BUF_SIZE);
+    rtlsdr_read_async(rx->dev, rtlsdrCallback, rx, RTLSDR.buffers, RTLSDR.buffer_size);
     if (!Modes.exit) {
         fprintf(stderr, "rtlsdr_read_async returned unexpectedly, probably lost the USB device, bailing out");
+        Modes.exit = 2; // don't carry on with the other receivers
     }
 }
 
 void rtlsdrClose() {
-    if (RTLSDR.dev) {
-        rtlsdr_close(RTLSDR.dev);
-        RTLSDR.dev = NULL;
+    struct rtlsdr_receiver *rx = &receivers[sdrReceiverId()];
+
+    if (rx->dev) {
+        rtlsdr_close(rx->dev);
+        rx->dev = NULL;
     }
 
-    if (RTLSDR.converter) {
-        cleanup_converter(RTLSDR.converter_state);
-        RTLSDR.converter = NULL;
-        RTLSDR.converter_state = NULL;
+    if (rx->converter) {
+        cleanup_converter(rx->converter_state);
+        rx->converter = NULL;
+        rx->converter_state = NULL;
     }
 
-    if (RTLSDR.bounce_buffer) {
-        free(RTLSDR.bounce_buffer);
-        RTLSDR.bounce_buffer = NULL;
+    if (rx->bounce_buffer) {
+        free(rx->bounce_buffer);
+        rx->bounce_buffer = NULL;
     }
 }
@@ -29,6 +29,7 @@ void rtlsdrInitConfig();
 bool rtlsdrOpen();
 void rtlsdrRun();
 void rtlsdrClose();
+unsigned rtlsdrReceivers();
 bool rtlsdrHandleOption(int argc, char *argv);
 
 #endif
@@ -166,8 +166,8 @@ bool ubladeRFOpen() {
     int status;
 
     bladerf_set_usb_reset_on_open(true);
-    fprintf(stderr, "Opening BladeRF: %s\n", Modes.dev_name);
-    if ((status = bladerf_open(&uBladeRF.device, Modes.dev_name)) < 0) {
+    fprintf(stderr, "Opening BladeRF: %s\n", Modes.dev_names[0]);
+    if ((status = bladerf_open(&uBladeRF.device, Modes.dev_names[0])) < 0) {
         fprintf(stderr, "Failed to open bladeRF: %s\n", bladerf_strerror(status));
         goto error;
     }
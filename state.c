@@ -0,0 +1,210 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// state.c: tracking state kept over a restart
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "readsb.h"
+#include <sys/mman.h>
+
+// With --state-file readsb writes what it has learned to a file when it
+// shuts down and reads it back when it starts up, so it doesn't have to
+// learn it all again after a restart or an upgrade: the tracked aircraft
+// with their CPR frames, callsigns and the rest, the ICAO filter, the polar
+// range statistics and the position history. Whatever would have timed out
+// while readsb was down is left out.
+//
+// The file is a struct state_header followed by sections, each a struct
+// state_section and its payload, written and read by the module the data
+// belongs to; sections of unknown id are skipped. It is in the byte order
+// of the machine, and the aircraft are only restored by a readsb with the
+// same struct aircraft. The file is mapped to read it, and written under a
+// temporary name that replaces it once complete.
+
+#define STATE_MAGIC 0x57425352 // "RSBW"
+#define STATE_VERSION 1
+
+enum state_section_id {
+    STATE_AIRCRAFT = 1,
+    STATE_ICAO_FILTER = 2,
+    STATE_RANGE = 3,
+    STATE_HISTORY = 4
+};
+
+struct state_header {
+    uint32_t magic; // STATE_MAGIC
+    uint32_t version; // STATE_VERSION
+    uint64_t time; // mstime() when it was written
+};
+
+struct state_section {
+    uint32_t id;
+    uint32_t padding;
+    uint64_t len; // of the payload that follows
+};
+
+static bool state_loaded; // so a readsb that failed to start up leaves the file alone
+
+static long stateBeginSection(FILE *f, uint32_t id) {
+    struct state_section section = { id, 0, 0 };
+    long start = ftell(f);
+
+    fwrite(&section, sizeof (section), 1, f);
+    return start;
+}
+
+// Fill in the length of the section begun at start
+static void stateEndSection(FILE *f, long start) {
+    long end = ftell(f);
+    uint64_t len = end - start - sizeof (struct state_section);
+
+    fseek(f, start + offsetof(struct state_section, len), SEEK_SET);
+    fwrite(&len, sizeof (len), 1, f);
+    fseek(f, end, SEEK_SET);
+}
+
+void stateSave(void) {
+    char tmppath[PATH_MAX];
+    struct state_header header = { STATE_MAGIC, STATE_VERSION, mstime() };
+    long start;
+    FILE *f;
+    int fd;
+
+    if (!Modes.state_file || !state_loaded)
+        return;
+
+    snprintf(tmppath, PATH_MAX, "%s.XXXXXX", Modes.state_file);
+    if ((fd = mkstemp(tmppath)) < 0 || !(f = fdopen(fd, "w"))) {
+        fprintf(stderr, "Creating %s failed: %s\n", tmppath, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+            unlink(tmppath);
+        }
+        return;
+    }
+
+    fwrite(&header, sizeof (header), 1, f);
+
+    start = stateBeginSection(f, STATE_AIRCRAFT);
+    trackSave(f);
+    stateEndSection(f, start);
+
+    start = stateBeginSection(f, STATE_ICAO_FILTER);
+    icaoFilterSave(f);
+    stateEndSection(f, start);
+
+    start = stateBeginSection(f, STATE_RANGE);
+    fwrite(&Modes.stats_range, sizeof (Modes.stats_range), 1, f);
+    stateEndSection(f, start);
+
+    start = stateBeginSection(f, STATE_HISTORY);
+    modesNetHistorySave(f);
+    stateEndSection(f, start);
+
+    bool ok = !ferror(f);
+    if (fclose(f))
+        ok = false;
+    if (!ok || rename(tmppath, Modes.state_file) < 0) {
+        fprintf(stderr, "Writing %s failed: %s\n", Modes.state_file, strerror(errno));
+        unlink(tmppath);
+    }
+}
+
+// Take the larger of each saved range and the one seen so far
+static void stateRestoreRange(const uint8_t *p, size_t len) {
+    struct range_stats saved;
+
+    if (len != sizeof (saved))
+        return;
+    memcpy(&saved, p, sizeof (saved));
+    for (int i = 0; i < POLAR_RANGE_BUCKETS; i++) {
+        if (saved.polar_range[i] > Modes.stats_range.polar_range[i])
+            Modes.stats_range.polar_range[i] = saved.polar_range[i];
+    }
+}
+
+void stateLoad(void) {
+    struct state_header header;
+    struct stat st;
+    uint8_t *map;
+    size_t off;
+    uint64_t now = mstime(), age;
+    uint32_t aircraft = 0;
+    int fd;
+
+    if (!Modes.state_file)
+        return;
+    state_loaded = true;
+
+    if (Modes.sdr_type == SDR_IFILE || Modes.sdr_type == SDR_REPLAY) {
+        // its clock is that of the file, the saved times mean nothing to it
+        fprintf(stderr, "--state-file is not used with --ifile or a replay\n");
+        state_loaded = false;
+        return;
+    }
+
+    if ((fd = open(Modes.state_file, O_RDONLY)) < 0) {
+        if (errno != ENOENT)
+            fprintf(stderr, "Opening %s failed: %s\n", Modes.state_file, strerror(errno));
+        return;
+    }
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof (header)) {
+        close(fd);
+        return;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Mapping %s failed: %s\n", Modes.state_file, strerror(errno));
+        return;
+    }
+
+    memcpy(&header, map, sizeof (header));
+    if (header.magic != STATE_MAGIC || header.version != STATE_VERSION || header.time > now) {
+        fprintf(stderr, "%s is not a readsb state file of this version, ignored\n", Modes.state_file);
+        munmap(map, st.st_size);
+        return;
+    }
+    age = now - header.time;
+
+    for (off = sizeof (header); off + sizeof (struct state_section) <= (size_t) st.st_size;) {
+        struct state_section section;
+        const uint8_t *p = map + off + sizeof (section);
+
+        memcpy(&section, map + off, sizeof (section));
+        if (section.len > st.st_size - off - sizeof (section))
+            break;
+
+        switch (section.id) {
+            case STATE_AIRCRAFT:
+                aircraft = trackRestore(p, section.len, now);
+                break;
+            case STATE_ICAO_FILTER:
+                icaoFilterRestore(p, section.len, age);
+                break;
+            case STATE_RANGE:
+                stateRestoreRange(p, section.len);
+                break;
+            case STATE_HISTORY:
+                modesNetHistoryRestore(p, section.len, now - HISTORY_SIZE * HISTORY_INTERVAL);
+                break;
+            default:
+                break;
+        }
+        off += sizeof (section) + section.len;
+    }
+
+    munmap(map, st.st_size);
+    fprintf(stderr, "Restored %u aircraft from %s, saved %.0f seconds ago\n", aircraft, Modes.state_file, age / 1000.0);
+}
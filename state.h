@@ -0,0 +1,25 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// state.h: tracking state kept over a restart (header)
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef STATE_H
+#define STATE_H
+
+// Read Modes.state_file, if given, at startup and write it on shutdown
+void stateLoad(void);
+void stateSave(void);
+
+#endif
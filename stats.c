@@ -53,6 +53,8 @@
 
 #include "readsb.h"
 
+#include <sys/mman.h>
+
 void add_timespecs(const struct timespec *x, const struct timespec *y, struct timespec *z) {
     z->tv_sec = x->tv_sec + y->tv_sec;
     z->tv_nsec = x->tv_nsec + y->tv_nsec;
@@ -81,6 +83,34 @@ void display_stats(struct stats *st) {
         printf("Local receiver:\n");
         printf("  %llu samples processed\n", (unsigned long long) st->samples_processed);
         printf("  %llu samples dropped\n", (unsigned long long) st->samples_dropped);
+        if (Modes.demod_gate)
+            printf("  %llu samples below the --demod-gate\n", (unsigned long long) st->samples_gated);
+
+        printf("  FIFO queue latency:\n");
+        for (j = 0; j < FIFO_LATENCY_BUCKETS; ++j) {
+            if (!st->fifo_latency[j])
+                continue;
+            if (j < FIFO_LATENCY_BUCKETS - 1)
+                printf("    %u buffers waited less than %u us\n", st->fifo_latency[j], FIFO_LATENCY_BASE_US << j);
+            else
+                printf("    %u buffers waited %u us or longer\n", st->fifo_latency[j], FIFO_LATENCY_BASE_US << (j - 1));
+        }
+        printf("  FIFO depth at dequeue:\n");
+        for (j = 0; j < FIFO_DEPTH_BUCKETS; ++j) {
+            if (st->fifo_depth[j])
+                printf("    %u buffers with %d queued\n", st->fifo_depth[j], j);
+        }
+        printf("  %u FIFO overruns\n", st->fifo_overruns);
+        printf("  SDR to FIFO latency:\n");
+        for (j = 0; j < FIFO_LATENCY_BUCKETS; ++j) {
+            if (!st->fill_latency[j])
+                continue;
+            if (j < FIFO_LATENCY_BUCKETS - 1)
+                printf("    %u buffers filled in less than %u us\n", st->fill_latency[j], FIFO_LATENCY_BASE_US << j);
+            else
+                printf("    %u buffers filled in %u us or more\n", st->fill_latency[j], FIFO_LATENCY_BASE_US << (j - 1));
+        }
+
 
         printf("  %u Mode A/C messages received\n", st->demod_modeac);
         printf("  %u Mode-S message preambles received\n", st->demod_preambles);
@@ -126,9 +156,20 @@ void display_stats(struct stats *st) {
         printf("  %u Mode S messages received\n", st->remote_received_modes);
         printf("    %u with bad message format or invalid CRC\n", st->remote_rejected_bad);
         printf("    %u with unrecognized ICAO address\n", st->remote_rejected_unknown_icao);
+        if (Modes.net_dedup_window)
+            printf("    %u dropped as duplicates\n", st->remote_duplicates);
+        if (Modes.net_input_beast_udp_ports && strcmp(Modes.net_input_beast_udp_ports, "0"))
+            printf("  %u UDP datagrams lost\n", st->remote_udp_lost);
         printf("    %u accepted with correct CRC\n", st->remote_accepted[0]);
         for (j = 1; j <= Modes.nfix_crc; ++j)
             printf("    %u accepted with %d-bit error repaired\n", st->remote_accepted[j], j);
+        printf("Network output:\n");
+        printf("  %u clients disconnected with a full SendQ\n", st->net_sendq_disconnects);
+        printf("  %llu bytes dropped from full SendQs\n", (unsigned long long) st->net_sendq_dropped);
+        if (Modes.net_output_beast_reduce_budget)
+            printf("  %u BeastReduce messages held back by the budget\n", st->net_reduce_dropped);
+        if (Modes.net_udp_outputs_count)
+            printf("  %u UDP datagrams not sent\n", st->net_udp_dropped);
     }
 
     printf("%u total usable messages\n",
@@ -169,6 +210,36 @@ void display_stats(struct stats *st) {
     printf("%u aircraft with positions seen\n", st->with_positions);
     printf("%u aircraft had an MLAT postion source\n", st->mlat_positions);
     printf("%u aircraft had an TISB position source\n", st->tisb_positions);
+    printf("%u aircraft records in the pool, at most %u in use\n", st->aircraft_pool_size, st->aircraft_pool_peak);
+    printf("%u of %u ICAO filter slots in use, %u entries added with %.2f buckets probed on average, at most %u\n",
+            st->icao_filter_used, icaoFilterCapacity(), st->icao_filter_inserts,
+            st->icao_filter_inserts ? (double) st->icao_filter_probes / st->icao_filter_inserts : 0.0,
+            st->icao_filter_max_probe);
+
+    {
+        static const char *stages[LATENCY_STAGES] = {
+            [LATENCY_RECEIVE] = "received to decoded",
+            [LATENCY_DECODE] = "decoded to queued for output",
+            [LATENCY_BUFFER] = "queued to handed to the clients",
+            [LATENCY_SEND] = "handed to a client to sent",
+            [LATENCY_TOTAL] = "received to sent",
+        };
+        bool header = false;
+
+        for (int s = 0; s < LATENCY_STAGES; ++s) {
+            uint64_t count = 0;
+            for (j = 0; j < LATENCY_BUCKETS; ++j)
+                count += st->latency[s][j];
+            if (!count)
+                continue;
+            if (!header) {
+                printf("Message latency (median / 99th percentile / longest):\n");
+                header = true;
+            }
+            printf("  %llu %s: %u / %u / %u us\n", (unsigned long long) count, stages[s],
+                    latency_percentile(st, s, 0.5), latency_percentile(st, s, 0.99), st->latency_max[s]);
+        }
+    }
 
     {
         uint64_t demod_cpu_millis = (uint64_t) st->demod_cpu.tv_sec * 1000UL + st->demod_cpu.tv_nsec / 1000000UL;
@@ -193,6 +264,58 @@ void reset_stats(struct stats *st) {
     *st = st_zero;
 }
 
+// Count one dequeued sample buffer in the FIFO histograms
+static int latency_bucket(unsigned latency_us) {
+    int bucket = 0;
+
+    while (bucket < FIFO_LATENCY_BUCKETS - 1 && latency_us >= (unsigned) FIFO_LATENCY_BASE_US << bucket)
+        ++bucket;
+    return bucket;
+}
+
+// Count a message in a latency histogram; a negative latency (the clock
+// was set back) counts as none
+void record_latency(struct stats *st, latency_stage_t stage, int64_t latency_us) {
+    uint32_t us = latency_us < 0 ? 0 : (latency_us > UINT32_MAX ? UINT32_MAX : (uint32_t) latency_us);
+    int bucket = 0;
+
+    while (bucket < LATENCY_BUCKETS - 1 && us >= (uint32_t) LATENCY_BASE_US << bucket)
+        ++bucket;
+    st->latency[stage][bucket]++;
+    st->latency_sum[stage] += us;
+    if (us > st->latency_max[stage])
+        st->latency_max[stage] = us;
+}
+
+// The upper limit of the bucket the given fraction of the messages fall in,
+// capped by the longest latency seen; 0 without any
+uint32_t latency_percentile(const struct stats *st, latency_stage_t stage, double fraction) {
+    uint64_t count = 0, seen = 0;
+
+    for (int i = 0; i < LATENCY_BUCKETS; ++i)
+        count += st->latency[stage][i];
+    if (!count)
+        return 0;
+
+    for (int i = 0; i < LATENCY_BUCKETS - 1; ++i) {
+        seen += st->latency[stage][i];
+        if (seen >= fraction * count) {
+            uint32_t limit = (uint32_t) LATENCY_BASE_US << i;
+            return limit < st->latency_max[stage] ? limit : st->latency_max[stage];
+        }
+    }
+    return st->latency_max[stage];
+}
+
+void record_fifo_stats(struct stats *st, const struct mag_buf *buf) {
+    st->fifo_latency[latency_bucket(buf->queueLatency)]++;
+    st->fifo_depth[buf->queueDepth < FIFO_DEPTH_BUCKETS ? buf->queueDepth : FIFO_DEPTH_BUCKETS - 1]++;
+    if (buf->receiveTime)
+        st->fill_latency[latency_bucket(buf->fillLatency)]++;
+    if (buf->dropped)
+        st->fifo_overruns++;
+}
+
 void add_stats(const struct stats *st1, const struct stats *st2, struct stats *target) {
     int i;
 
@@ -221,6 +344,15 @@ void add_stats(const struct stats *st1, const struct stats *st2, struct stats *t
 
     target->samples_processed = st1->samples_processed + st2->samples_processed;
     target->samples_dropped = st1->samples_dropped + st2->samples_dropped;
+    target->samples_gated = st1->samples_gated + st2->samples_gated;
+
+    for (i = 0; i < FIFO_LATENCY_BUCKETS; ++i) {
+        target->fifo_latency[i] = st1->fifo_latency[i] + st2->fifo_latency[i];
+        target->fill_latency[i] = st1->fill_latency[i] + st2->fill_latency[i];
+    }
+    for (i = 0; i < FIFO_DEPTH_BUCKETS; ++i)
+        target->fifo_depth[i] = st1->fifo_depth[i] + st2->fifo_depth[i];
+    target->fifo_overruns = st1->fifo_overruns + st2->fifo_overruns;
 
     add_timespecs(&st1->demod_cpu, &st2->demod_cpu, &target->demod_cpu);
     add_timespecs(&st1->reader_cpu, &st2->reader_cpu, &target->reader_cpu);
@@ -250,6 +382,14 @@ void add_stats(const struct stats *st1, const struct stats *st2, struct stats *t
     target->remote_rejected_unknown_icao = st1->remote_rejected_unknown_icao + st2->remote_rejected_unknown_icao;
     for (i = 0; i < MODES_MAX_BITERRORS + 1; ++i)
         target->remote_accepted[i] = st1->remote_accepted[i] + st2->remote_accepted[i];
+    target->remote_duplicates = st1->remote_duplicates + st2->remote_duplicates;
+    target->remote_udp_lost = st1->remote_udp_lost + st2->remote_udp_lost;
+
+    // network output:
+    target->net_sendq_disconnects = st1->net_sendq_disconnects + st2->net_sendq_disconnects;
+    target->net_sendq_dropped = st1->net_sendq_dropped + st2->net_sendq_dropped;
+    target->net_reduce_dropped = st1->net_reduce_dropped + st2->net_reduce_dropped;
+    target->net_udp_dropped = st1->net_udp_dropped + st2->net_udp_dropped;
 
     // total messages:
     target->messages_total = st1->messages_total + st2->messages_total;
@@ -279,6 +419,24 @@ void add_stats(const struct stats *st1, const struct stats *st2, struct stats *t
     target->with_positions = st1->with_positions;
     target->mlat_positions = st1->mlat_positions;
     target->tisb_positions = st1->tisb_positions;
+    // the pool never shrinks
+    target->aircraft_pool_size = st1->aircraft_pool_size > st2->aircraft_pool_size ? st1->aircraft_pool_size : st2->aircraft_pool_size;
+    if (st1->aircraft_pool_peak > st2->aircraft_pool_peak)
+        target->aircraft_pool_peak = st1->aircraft_pool_peak;
+    else
+        target->aircraft_pool_peak = st2->aircraft_pool_peak;
+    target->icao_filter_inserts = st1->icao_filter_inserts + st2->icao_filter_inserts;
+    target->icao_filter_probes = st1->icao_filter_probes + st2->icao_filter_probes;
+    target->icao_filter_max_probe = max(st1->icao_filter_max_probe, st2->icao_filter_max_probe);
+    target->icao_filter_used = max(st1->icao_filter_used, st2->icao_filter_used);
+
+    // message latency
+    for (int s = 0; s < LATENCY_STAGES; ++s) {
+        for (i = 0; i < LATENCY_BUCKETS; ++i)
+            target->latency[s][i] = st1->latency[s][i] + st2->latency[s][i];
+        target->latency_max[s] = max(st1->latency_max[s], st2->latency_max[s]);
+        target->latency_sum[s] = st1->latency_sum[s] + st2->latency_sum[s];
+    }
 
     // Longest Distance observed
     if (st1->longest_distance > st2->longest_distance)
@@ -286,3 +444,289 @@ void add_stats(const struct stats *st1, const struct stats *st2, struct stats *t
     else
         target->longest_distance = st2->longest_distance;
 }
+
+static void sub_timespecs(const struct timespec *x, const struct timespec *y, struct timespec *z) {
+    z->tv_sec = x->tv_sec - y->tv_sec;
+    z->tv_nsec = x->tv_nsec - y->tv_nsec;
+    if (z->tv_nsec < 0) {
+        z->tv_nsec += 1000000000L;
+        z->tv_sec--;
+    }
+}
+
+// Take st2 out of st1, which has had it added: the counters add_stats() adds
+// up are subtracted, the maxima, snapshots and times are those of st1
+void sub_stats(const struct stats *st1, const struct stats *st2, struct stats *target) {
+    int i;
+
+    if (target != st1)
+        *target = *st1;
+
+    target->demod_preambles -= st2->demod_preambles;
+    target->demod_rejected_bad -= st2->demod_rejected_bad;
+    target->demod_rejected_unknown_icao -= st2->demod_rejected_unknown_icao;
+    for (i = 0; i < MODES_MAX_BITERRORS + 1; ++i)
+        target->demod_accepted[i] -= st2->demod_accepted[i];
+    target->demod_modeac -= st2->demod_modeac;
+
+    for (i = 0; i < 5; i++) {
+        target->demod_preamblePhase[i] -= st2->demod_preamblePhase[i];
+        target->demod_bestPhase[i] -= st2->demod_bestPhase[i];
+    }
+
+    target->samples_processed -= st2->samples_processed;
+    target->samples_dropped -= st2->samples_dropped;
+    target->samples_gated -= st2->samples_gated;
+
+    for (i = 0; i < FIFO_LATENCY_BUCKETS; ++i) {
+        target->fifo_latency[i] -= st2->fifo_latency[i];
+        target->fill_latency[i] -= st2->fill_latency[i];
+    }
+    for (i = 0; i < FIFO_DEPTH_BUCKETS; ++i)
+        target->fifo_depth[i] -= st2->fifo_depth[i];
+    target->fifo_overruns -= st2->fifo_overruns;
+
+    sub_timespecs(&target->demod_cpu, &st2->demod_cpu, &target->demod_cpu);
+    sub_timespecs(&target->reader_cpu, &st2->reader_cpu, &target->reader_cpu);
+    sub_timespecs(&target->background_cpu, &st2->background_cpu, &target->background_cpu);
+
+    // the power sums are doubles: start again from zero rather than from
+    // the rounding errors once nothing is left
+    target->noise_power_count -= st2->noise_power_count;
+    target->noise_power_sum = target->noise_power_count ? target->noise_power_sum - st2->noise_power_sum : 0;
+    target->signal_power_count -= st2->signal_power_count;
+    target->signal_power_sum = target->signal_power_count ? target->signal_power_sum - st2->signal_power_sum : 0;
+
+    target->strong_signal_count -= st2->strong_signal_count;
+
+    target->remote_received_modeac -= st2->remote_received_modeac;
+    target->remote_received_modes -= st2->remote_received_modes;
+    target->remote_rejected_bad -= st2->remote_rejected_bad;
+    target->remote_rejected_unknown_icao -= st2->remote_rejected_unknown_icao;
+    for (i = 0; i < MODES_MAX_BITERRORS + 1; ++i)
+        target->remote_accepted[i] -= st2->remote_accepted[i];
+    target->remote_duplicates -= st2->remote_duplicates;
+    target->remote_udp_lost -= st2->remote_udp_lost;
+
+    target->net_sendq_disconnects -= st2->net_sendq_disconnects;
+    target->net_sendq_dropped -= st2->net_sendq_dropped;
+    target->net_reduce_dropped -= st2->net_reduce_dropped;
+    target->net_udp_dropped -= st2->net_udp_dropped;
+
+    target->messages_total -= st2->messages_total;
+
+    target->cpr_surface -= st2->cpr_surface;
+    target->cpr_airborne -= st2->cpr_airborne;
+    target->cpr_global_ok -= st2->cpr_global_ok;
+    target->cpr_global_bad -= st2->cpr_global_bad;
+    target->cpr_global_skipped -= st2->cpr_global_skipped;
+    target->cpr_global_range_checks -= st2->cpr_global_range_checks;
+    target->cpr_global_speed_checks -= st2->cpr_global_speed_checks;
+    target->cpr_local_ok -= st2->cpr_local_ok;
+    target->cpr_local_aircraft_relative -= st2->cpr_local_aircraft_relative;
+    target->cpr_local_receiver_relative -= st2->cpr_local_receiver_relative;
+    target->cpr_local_skipped -= st2->cpr_local_skipped;
+    target->cpr_local_range_checks -= st2->cpr_local_range_checks;
+    target->cpr_local_speed_checks -= st2->cpr_local_speed_checks;
+    target->cpr_filtered -= st2->cpr_filtered;
+
+    target->suppressed_altitude_messages -= st2->suppressed_altitude_messages;
+
+    target->unique_aircraft -= st2->unique_aircraft;
+    target->single_message_aircraft -= st2->single_message_aircraft;
+    target->icao_filter_inserts -= st2->icao_filter_inserts;
+    target->icao_filter_probes -= st2->icao_filter_probes;
+
+    for (int s = 0; s < LATENCY_STAGES; ++s) {
+        for (i = 0; i < LATENCY_BUCKETS; ++i)
+            target->latency[s][i] -= st2->latency[s][i];
+        target->latency_sum[s] -= st2->latency_sum[s];
+    }
+}
+
+// Does st reach one of the maxima of sum?
+static bool has_maximum(const struct stats *sum, const struct stats *st) {
+    if (st->peak_signal_power > 0 && st->peak_signal_power >= sum->peak_signal_power)
+        return true;
+    if (st->longest_distance > 0 && st->longest_distance >= sum->longest_distance)
+        return true;
+    if (st->aircraft_pool_size && st->aircraft_pool_size >= sum->aircraft_pool_size)
+        return true;
+    if (st->aircraft_pool_peak && st->aircraft_pool_peak >= sum->aircraft_pool_peak)
+        return true;
+    if (st->icao_filter_max_probe && st->icao_filter_max_probe >= sum->icao_filter_max_probe)
+        return true;
+    if (st->icao_filter_used && st->icao_filter_used >= sum->icao_filter_used)
+        return true;
+    for (int s = 0; s < LATENCY_STAGES; ++s) {
+        if (st->latency_max[s] && st->latency_max[s] >= sum->latency_max[s])
+            return true;
+    }
+    return false;
+}
+
+// Raise the maxima of target to those of st
+static void take_maxima(struct stats *target, const struct stats *st) {
+    if (st->peak_signal_power > target->peak_signal_power)
+        target->peak_signal_power = st->peak_signal_power;
+    if (st->longest_distance > target->longest_distance)
+        target->longest_distance = st->longest_distance;
+    if (st->aircraft_pool_size > target->aircraft_pool_size)
+        target->aircraft_pool_size = st->aircraft_pool_size;
+    if (st->aircraft_pool_peak > target->aircraft_pool_peak)
+        target->aircraft_pool_peak = st->aircraft_pool_peak;
+    if (st->icao_filter_max_probe > target->icao_filter_max_probe)
+        target->icao_filter_max_probe = st->icao_filter_max_probe;
+    if (st->icao_filter_used > target->icao_filter_used)
+        target->icao_filter_used = st->icao_filter_used;
+    for (int s = 0; s < LATENCY_STAGES; ++s) {
+        if (st->latency_max[s] > target->latency_max[s])
+            target->latency_max[s] = st->latency_max[s];
+    }
+}
+
+void stats_window_init(struct stats_window *w, int length, uint64_t now) {
+    if (!(w->ring = calloc(length, sizeof (*w->ring)))) {
+        fprintf(stderr, "Out of memory allocating a statistics window\n");
+        exit(1);
+    }
+    w->length = length;
+    w->head = 0;
+    for (int i = 0; i < length; ++i)
+        w->ring[i].start = w->ring[i].end = now;
+    reset_stats(&w->sum);
+    w->sum.start = w->sum.end = now;
+}
+
+void stats_window_free(struct stats_window *w) {
+    free(w->ring);
+    w->ring = NULL;
+    w->length = 0;
+}
+
+// Add the newest bucket to the window, in place of the oldest. Only the
+// maxima the oldest bucket held need the other buckets looked at again.
+void stats_window_push(struct stats_window *w, const struct stats *bucket) {
+    struct stats *oldest = &w->ring[w->head];
+    bool maxima = has_maximum(&w->sum, oldest);
+
+    sub_stats(&w->sum, oldest, &w->sum);
+    *oldest = *bucket;
+    w->head = (w->head + 1) % w->length;
+
+    if (maxima) {
+        w->sum.peak_signal_power = w->sum.longest_distance = 0;
+        w->sum.aircraft_pool_size = w->sum.aircraft_pool_peak = 0;
+        w->sum.icao_filter_max_probe = w->sum.icao_filter_used = 0;
+        memset(w->sum.latency_max, 0, sizeof (w->sum.latency_max));
+        for (int i = 0; i < w->length; ++i)
+            take_maxima(&w->sum, &w->ring[i]);
+    }
+
+    // add_stats() takes the snapshots of its first argument
+    add_stats(bucket, &w->sum, &w->sum);
+    w->sum.start = w->ring[w->head].start;
+}
+
+// Start the RSSI and distance sketches of the next stats_shm_publish()
+void stats_sketches_reset(void) {
+    stats_sketch_init(&Modes.stats_rssi, -64, 0.125);
+    stats_sketch_init(&Modes.stats_distance, 0, 2000);
+}
+
+// Create the shared statistics block; readsbrrd reads it, see stats_shm.h
+void stats_shm_init(void) {
+    int fd;
+    struct stats_shm *shm;
+
+    if ((fd = shm_open(STATS_SHM_NAME, O_CREAT | O_RDWR, 0644)) < 0) {
+        fprintf(stderr, "<3> Error creating stats shared memory: %s (readsbrrd won't work)\n", strerror(errno));
+        return;
+    }
+    if (ftruncate(fd, sizeof (*shm)) < 0 ||
+            (shm = mmap(NULL, sizeof (*shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        fprintf(stderr, "<3> Error mapping stats shared memory: %s (readsbrrd won't work)\n", strerror(errno));
+        close(fd);
+        return;
+    }
+    close(fd);
+
+    // a reader still mapping the block of a previous run sees it change
+    atomic_fetch_add_explicit(&shm->seq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    shm->magic = STATS_SHM_MAGIC;
+    shm->version = STATS_SHM_VERSION;
+    shm->size = sizeof (*shm);
+    memset((char *) shm + offsetof(struct stats_shm, time), 0, sizeof (*shm) - offsetof(struct stats_shm, time));
+    atomic_fetch_add_explicit(&shm->seq, 1, memory_order_release);
+
+    Modes.stats_shm = shm;
+}
+
+void stats_shm_cleanup(void) {
+    if (Modes.stats_shm)
+        munmap(Modes.stats_shm, sizeof (*Modes.stats_shm));
+    Modes.stats_shm = NULL;
+}
+
+// Publish the last minute and the totals, and start the sketches again
+void stats_shm_publish(uint64_t now) {
+    struct stats_shm *shm = Modes.stats_shm;
+    const struct stats *minute = &Modes.stats_1min.sum;
+    struct stats total;
+
+    if (!shm) {
+        stats_sketches_reset();
+        return;
+    }
+
+    add_stats(&Modes.stats_alltime, &Modes.stats_current, &total);
+
+    atomic_fetch_add_explicit(&shm->seq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    shm->time = now / 1000;
+    shm->signal = (minute->signal_power_sum > 0 && minute->signal_power_count > 0) ?
+            10 * log10(minute->signal_power_sum / minute->signal_power_count) : 0;
+    shm->noise = (minute->noise_power_sum > 0 && minute->noise_power_count > 0) ?
+            10 * log10(minute->noise_power_sum / minute->noise_power_count) : 0;
+    shm->rssi = Modes.stats_rssi;
+    shm->distance = Modes.stats_distance;
+
+    shm->local_accepted = shm->remote_accepted = 0;
+    for (int i = 0; i <= Modes.nfix_crc; ++i) {
+        shm->local_accepted += total.demod_accepted[i];
+        shm->remote_accepted += total.remote_accepted[i];
+    }
+    shm->strong_signals = total.strong_signal_count;
+    shm->positions = total.cpr_local_ok + total.cpr_global_ok;
+    shm->tracks_new = total.unique_aircraft;
+    shm->tracks_single_message = total.single_message_aircraft;
+    shm->cpu_demod = (uint64_t) total.demod_cpu.tv_sec * 1000 + total.demod_cpu.tv_nsec / 1000000;
+    shm->cpu_reader = (uint64_t) total.reader_cpu.tv_sec * 1000 + total.reader_cpu.tv_nsec / 1000000;
+    shm->cpu_background = (uint64_t) total.background_cpu.tv_sec * 1000 + total.background_cpu.tv_nsec / 1000000;
+
+    shm->aircraft_total = shm->aircraft_positions = 0;
+    shm->aircraft_mlat = shm->aircraft_tisb = shm->aircraft_gps = 0;
+    for (size_t j = 0; j < Modes.aircraft_count; j++) {
+        struct aircraft_entry *e = &Modes.aircraft_table[j];
+        struct aircraft *a = e->a;
+
+        if (e->messages < 2 || now > e->seen + 30000)
+            continue;
+        shm->aircraft_total++;
+        if (!trackDataValid(&a->position_valid) || now > a->position_valid.updated + 30000)
+            continue;
+        shm->aircraft_positions++;
+        if (a->position_valid.source == SOURCE_MLAT)
+            shm->aircraft_mlat++;
+        else if (a->position_valid.source == SOURCE_TISB)
+            shm->aircraft_tisb++;
+        else
+            shm->aircraft_gps++;
+    }
+
+    atomic_fetch_add_explicit(&shm->seq, 1, memory_order_release);
+
+    stats_sketches_reset();
+}
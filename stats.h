@@ -54,6 +54,16 @@
 #ifndef STATS_H
 #define STATS_H
 
+// Stages of processing a message goes through, for the latency histograms
+typedef enum {
+    LATENCY_RECEIVE, // received, by the SDR or from the network, to useModesMessage()
+    LATENCY_DECODE, // useModesMessage() to modesQueueOutput()
+    LATENCY_BUFFER, // modesQueueOutput() to its output buffer going on the SendQs
+    LATENCY_SEND, // going on a SendQ to the last of it written to the socket
+    LATENCY_TOTAL, // received to written to the socket
+    LATENCY_STAGES
+} latency_stage_t;
+
 struct stats {
     uint64_t start;
     uint64_t end;
@@ -66,6 +76,21 @@ struct stats {
     uint32_t demod_bestPhase[5];
     uint64_t samples_processed;
     uint64_t samples_dropped;
+    uint64_t samples_gated; // not searched for preambles, see --demod-gate
+    // sample FIFO, one count per dequeued buffer:
+    // time spent queued, bucket 0 is below FIFO_LATENCY_BASE_US and
+    // each further bucket doubles the limit; the last one is open-ended
+#define FIFO_LATENCY_BASE_US 64
+#define FIFO_LATENCY_BUCKETS 16
+    uint32_t fifo_latency[FIFO_LATENCY_BUCKETS];
+    // number of queued buffers, including the one dequeued
+#define FIFO_DEPTH_BUCKETS (MODES_MAG_BUFFERS + 1)
+    uint32_t fifo_depth[FIFO_DEPTH_BUCKETS];
+    // time from the SDR getting the samples to fifo_enqueue(), for SDRs that
+    // report it, in the same buckets as fifo_latency
+    uint32_t fill_latency[FIFO_LATENCY_BUCKETS];
+    // number of times samples were dropped as the FIFO had no free buffer
+    uint32_t fifo_overruns;
     // Mode A/C demodulator counts:
     uint32_t demod_modeac;
     // number of signals with power > -3dBFS
@@ -88,6 +113,13 @@ struct stats {
     uint32_t remote_rejected_bad;
     uint32_t remote_rejected_unknown_icao;
     uint32_t remote_accepted[MODES_MAX_BITERRORS + 1];
+    uint32_t remote_duplicates; // copies dropped by --net-dedup-window
+    uint32_t remote_udp_lost; // Beast UDP input datagrams missing from the sequence
+    // network output:
+    uint32_t net_sendq_disconnects; // clients dropped with a full SendQ
+    uint64_t net_sendq_dropped; // bytes the SendQ policy dropped
+    uint32_t net_reduce_dropped; // BeastReduce messages over --net-beast-reduce-budget
+    uint32_t net_udp_dropped; // Beast UDP output datagrams that could not be sent
     // total messages:
     uint32_t messages_total;
     // CPR decoding:
@@ -117,8 +149,48 @@ struct stats {
     uint32_t with_positions; // Aircrafts with positions
     uint32_t mlat_positions; // Positions from mlat source
     uint32_t tisb_positions; // Positions from tisb source
+    uint32_t aircraft_pool_size; // Aircraft records allocated, momentary snapshot
+    uint32_t aircraft_pool_peak; // Most aircraft records in use at once
+    // ICAO filter:
+    uint32_t icao_filter_inserts; // New entries stored
+    uint32_t icao_filter_probes; // Buckets probed to store them
+    uint32_t icao_filter_max_probe; // Longest bucket probe sequence
+    uint32_t icao_filter_used; // Most slots in use in the active table
+    // message latency per latency_stage_t: bucket 0 is below LATENCY_BASE_US
+    // and each further bucket doubles the limit, the last one is open-ended.
+    // The output stages count each output buffer once (per client for those
+    // after the SendQ), with the latency of the oldest message in it.
+#define LATENCY_BASE_US 16
+#define LATENCY_BUCKETS 20
+    uint32_t latency[LATENCY_STAGES][LATENCY_BUCKETS];
+    uint32_t latency_max[LATENCY_STAGES]; // in us
+    uint64_t latency_sum[LATENCY_STAGES]; // in us, for the metrics endpoint
+};
+
+// The statistics a thread other than the main one counts by itself, on cache
+// lines of its own so that threads counting side by side don't slow each
+// other down; the main thread adds them to its own with add_stats()
+#define STATS_CACHE_LINE 64
+
+struct stats_slot {
+    _Alignas(STATS_CACHE_LINE) struct stats st;
+};
+
+// A window of the statistics of the last length buckets, the buckets in
+// the order they were pushed: each push adds the newest bucket to sum and
+// subtracts the oldest, so the cost doesn't grow with the window length
+struct stats_window {
+    struct stats *ring; // the buckets, ring[head] is the oldest
+    int length;
+    int head;
+    struct stats sum; // of the buckets in the window
 };
 
+// The length of a bucket, stats_current is pushed to the windows this often
+#define STATS_BUCKET_MS 10000
+
+struct mag_buf;
+
 struct range_stats {
     // Maximum polar ranges
 #define POLAR_RANGE_RESOLUTION 5 // degree
@@ -127,8 +199,21 @@ struct range_stats {
 };
 
 void add_stats(const struct stats *st1, const struct stats *st2, struct stats *target);
+void sub_stats(const struct stats *st1, const struct stats *st2, struct stats *target);
 void display_stats(struct stats *st);
 void reset_stats(struct stats *st);
+void record_fifo_stats(struct stats *st, const struct mag_buf *buf);
+void record_latency(struct stats *st, latency_stage_t stage, int64_t latency_us);
+uint32_t latency_percentile(const struct stats *st, latency_stage_t stage, double fraction);
+
+void stats_sketches_reset(void);
+void stats_shm_init(void);
+void stats_shm_publish(uint64_t now);
+void stats_shm_cleanup(void);
+
+void stats_window_init(struct stats_window *w, int length, uint64_t now);
+void stats_window_free(struct stats_window *w);
+void stats_window_push(struct stats_window *w, const struct stats *bucket);
 
 void add_timespecs(const struct timespec *x, const struct timespec *y, struct timespec *z);
 
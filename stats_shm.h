@@ -0,0 +1,140 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// stats_shm.h: statistics readsb shares with readsbrrd in memory
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef STATS_SHM_H
+#define STATS_SHM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+
+// Once a minute readsb publishes the statistics readsbrrd graphs in the
+// POSIX shared memory object STATS_SHM_NAME, next to posting the stats
+// semaphore. Readers check magic, version and size, then copy the block
+// with stats_shm_read(): readsb makes seq odd while it writes the block.
+
+#define STATS_SHM_NAME "/readsbStats"
+#define STATS_SHM_MAGIC 0x52534253 // "RSBS"
+#define STATS_SHM_VERSION 1
+
+// A fixed bucket histogram of values from lo to lo + STATS_SKETCH_BINS *
+// width, to take quantiles from without keeping or sorting the values.
+// Values out of range count in the first or the last bin; min and max are
+// exact.
+
+#define STATS_SKETCH_BINS 512
+
+struct stats_sketch {
+    float lo;
+    float width;
+    float min;
+    float max;
+    uint32_t count;
+    uint32_t bins[STATS_SKETCH_BINS];
+};
+
+static inline void stats_sketch_init(struct stats_sketch *s, float lo, float width) {
+    memset(s, 0, sizeof (*s));
+    s->lo = lo;
+    s->width = width;
+}
+
+static inline void stats_sketch_add(struct stats_sketch *s, float value) {
+    int bin = (int) ((value - s->lo) / s->width);
+
+    if (bin < 0)
+        bin = 0;
+    else if (bin >= STATS_SKETCH_BINS)
+        bin = STATS_SKETCH_BINS - 1;
+    s->bins[bin]++;
+
+    if (!s->count || value < s->min)
+        s->min = value;
+    if (!s->count || value > s->max)
+        s->max = value;
+    s->count++;
+}
+
+// The value the fraction p of the values are below, interpolated within its
+// bin; 0 without any values
+static inline float stats_sketch_quantile(const struct stats_sketch *s, float p) {
+    float rank = p * s->count;
+    uint32_t seen = 0;
+
+    if (!s->count)
+        return 0;
+
+    for (int i = 0; i < STATS_SKETCH_BINS; i++) {
+        if (s->bins[i] && seen + s->bins[i] >= rank) {
+            float value = s->lo + s->width * (i + (rank - seen) / s->bins[i]);
+            return value < s->min ? s->min : (value > s->max ? s->max : value);
+        }
+        seen += s->bins[i];
+    }
+    return s->max;
+}
+
+struct stats_shm {
+    uint32_t magic; // STATS_SHM_MAGIC
+    uint32_t version; // STATS_SHM_VERSION
+    uint32_t size; // sizeof (struct stats_shm)
+    _Atomic uint32_t seq; // bumped before and after each update, odd while writing
+
+    uint64_t time; // of the update, seconds since the epoch
+
+    // the last minute
+    double signal; // mean signal power, dBFS
+    double noise; // mean noise power, dBFS
+    struct stats_sketch rssi; // of the messages, dBFS
+    struct stats_sketch distance; // of the positions, metres
+
+    // since readsb started
+    uint64_t local_accepted;
+    uint64_t remote_accepted;
+    uint64_t strong_signals;
+    uint64_t positions; // CPR decodes
+    uint64_t tracks_new;
+    uint64_t tracks_single_message;
+    uint64_t cpu_demod; // milliseconds
+    uint64_t cpu_reader;
+    uint64_t cpu_background;
+
+    // aircraft seen in the last 30 seconds
+    uint32_t aircraft_total;
+    uint32_t aircraft_positions; // with a current position
+    uint32_t aircraft_mlat; // positions by source
+    uint32_t aircraft_tisb;
+    uint32_t aircraft_gps;
+};
+
+// Copy a consistent version of the block to *to; false if readsb was
+// writing it throughout
+static inline bool stats_shm_read(const struct stats_shm *shm, struct stats_shm *to) {
+    for (int tries = 0; tries < 100; tries++) {
+        uint32_t seq = atomic_load_explicit(&((struct stats_shm *) shm)->seq, memory_order_acquire);
+        if (seq & 1)
+            continue;
+        memcpy(to, shm, sizeof (*to));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&((struct stats_shm *) shm)->seq, memory_order_relaxed) == seq)
+            return true;
+    }
+    return false;
+}
+
+#endif
@@ -61,16 +61,386 @@ uint32_t modeAC_lastcount[4096];
 uint32_t modeAC_match[4096];
 uint32_t modeAC_age[4096];
 
+// Mode A/C codes with a nonzero count, and the codes that got
+// TRACK_MODEAC_MIN_MESSAGES replies since the last trackMatchAC()
+static uint16_t modeAC_active[4096];
+static unsigned modeAC_active_count;
+static uint16_t modeAC_live[4096];
+static unsigned modeAC_live_count;
+
+// codes trackMatchAC() set a match for, so the next pass can clear them
+static uint16_t modeAC_matched[4096];
+static unsigned modeAC_matched_count;
+
+// Tracked aircraft by squawk and by Mode C altitude band, so matching only
+// looks at the aircraft that could have sent a live code. Aircraft that are
+// found to be too old to match are dropped until their next message. The
+// bands cover what modeCToModeA() accepts (-13 .. 4082) plus one either side
+// for the +/- 100ft match.
+#define MODEAC_ALT_OFFSET 14
+#define MODEAC_ALT_BANDS (4096 + 2)
+
+static struct aircraft *modeAC_squawk_index[4096];
+static struct aircraft *modeAC_alt_index[MODEAC_ALT_BANDS];
+
+//
+// Aircraft records come from a pool of slabs that are only returned to the
+// heap by trackCleanup(). Freed records go on a free list and are handed out
+// again before a new slab is allocated, so the pool settles at the busiest
+// traffic seen and new aircraft don't cost a malloc.
+//
+
+#define AIRCRAFT_POOL_SLAB 256 // records per slab
+
+static struct aircraft *aircraft_freelist;
+static struct aircraft **aircraft_slabs;
+static unsigned aircraft_slab_count;
+static uint32_t aircraft_pool_used;
+
+static struct aircraft *aircraftPoolAlloc(void) {
+    struct aircraft *a;
+
+    if (!aircraft_freelist) {
+        struct aircraft **slabs = realloc(aircraft_slabs, (aircraft_slab_count + 1) * sizeof (*slabs));
+        struct aircraft *slab = slabs ? malloc(AIRCRAFT_POOL_SLAB * sizeof (*slab)) : NULL;
+
+        if (slabs)
+            aircraft_slabs = slabs;
+        if (!slab) {
+            fprintf(stderr, "Out of memory growing the aircraft pool\n");
+            return NULL;
+        }
+        aircraft_slabs[aircraft_slab_count++] = slab;
+
+        for (unsigned i = AIRCRAFT_POOL_SLAB; i-- > 0;) {
+            slab[i].next = aircraft_freelist;
+            aircraft_freelist = &slab[i];
+        }
+    }
+
+    a = aircraft_freelist;
+    aircraft_freelist = a->next;
+
+    if (++aircraft_pool_used > Modes.stats_current.aircraft_pool_peak)
+        Modes.stats_current.aircraft_pool_peak = aircraft_pool_used;
+    Modes.stats_current.aircraft_pool_size = aircraft_slab_count * AIRCRAFT_POOL_SLAB;
+    return a;
+}
+
+static void aircraftPoolFree(struct aircraft *a) {
+    a->next = aircraft_freelist;
+    aircraft_freelist = a;
+    aircraft_pool_used--;
+}
+
+//
+//=========================================================================
+//
+// Expiry of aircraft and their data: rather than looking at every aircraft
+// every second, each aircraft sits in a slot of a timer wheel (one slot per second) for the time its next data
+// expires or it goes stale, and only the aircraft in slots that have come
+// due are looked at. The slot is not moved when new messages arrive; an
+// aircraft that turns out not to be due yet is simply put back further on.
+// All validity fields expire 70 seconds after their update (see F() in
+// trackCreateAircraft()), so an aircraft never waits longer than
+// TRACK_EXPIRE_MAX_WAIT and data that becomes valid after it was scheduled is
+// still expired in time, unless the message was timestamped more than the
+// difference in the past.
+//
+
+#define TRACK_EXPIRE_MAX_WAIT 60 // seconds
+#define TRACK_EXPIRE_SLOTS 128 // power of 2, more than TRACK_EXPIRE_MAX_WAIT
+
+static struct aircraft *expire_wheel[TRACK_EXPIRE_SLOTS];
+static uint64_t expire_wheel_second; // last second processed
+
+// Put an aircraft in the wheel slot for deadline (in milliseconds). The slot
+// is that of the second the deadline falls in, so calls later in that second
+// look at the aircraft; if one comes too early it just puts it back.
+static void trackScheduleExpiry(struct aircraft *a, uint64_t deadline) {
+    uint64_t second = deadline / 1000;
+
+    if (!expire_wheel_second)
+        expire_wheel_second = mstime() / 1000;
+    if (second <= expire_wheel_second)
+        second = expire_wheel_second + 1;
+    if (second > expire_wheel_second + TRACK_EXPIRE_MAX_WAIT)
+        second = expire_wheel_second + TRACK_EXPIRE_MAX_WAIT;
+
+    struct aircraft **slot = &expire_wheel[second & (TRACK_EXPIRE_SLOTS - 1)];
+    a->next = *slot;
+    *slot = a;
+}
+
+static void modeACCount(unsigned i) {
+    uint32_t count = ++modeAC_count[i];
+
+    if (count == 1)
+        modeAC_active[modeAC_active_count++] = i;
+    if (count - modeAC_lastcount[i] == TRACK_MODEAC_MIN_MESSAGES)
+        modeAC_live[modeAC_live_count++] = i;
+}
+
+// The aircraft indexes below are intrusive lists, one list per bucket,
+// linked through a struct aircraft_link in each aircraft
+
+enum aircraft_list {
+    LIST_SQUAWK, LIST_ALTITUDE, LIST_GRID, LIST_CHANGED
+};
+
+static inline struct aircraft_link *aircraftLink(struct aircraft *a, enum aircraft_list list) {
+    switch (list) {
+        case LIST_SQUAWK:
+            return &a->modeac_squawk;
+        case LIST_ALTITUDE:
+            return &a->modeac_alt;
+        case LIST_GRID:
+            return &a->grid;
+        default:
+            return &a->changed;
+    }
+}
+
+// Move an aircraft to another bucket of an index, key 0 takes it out of the index
+static void aircraftIndexMove(struct aircraft **index, enum aircraft_list list, struct aircraft *a, unsigned key) {
+    struct aircraft_link *link = aircraftLink(a, list);
+
+    if (link->key == key)
+        return;
+
+    if (link->key) {
+        if (link->prev)
+            aircraftLink(link->prev, list)->next = link->next;
+        else
+            index[link->key - 1] = link->next;
+        if (link->next)
+            aircraftLink(link->next, list)->prev = link->prev;
+    }
+
+    link->key = key;
+    if (key) {
+        link->prev = NULL;
+        link->next = index[key - 1];
+        if (link->next)
+            aircraftLink(link->next, list)->prev = a;
+        index[key - 1] = a;
+    }
+}
+
+// Note a change to the aircraft in the current generation, moving it to the
+// front of Modes.aircraft_changed
+
+static void trackMarkChanged(struct aircraft *a) {
+    if (a->generation == Modes.track_generation && a->changed.key)
+        return;
+
+    a->generation = Modes.track_generation;
+    aircraftIndexMove(&Modes.aircraft_changed, LIST_CHANGED, a, 0);
+    aircraftIndexMove(&Modes.aircraft_changed, LIST_CHANGED, a, 1);
+}
+
+// The FATSV due queue: a binary min-heap of aircraft ordered by fatsv_due,
+// each aircraft remembering its place in fatsv_slot (heap index + 1, 0 while
+// not queued)
+
+static struct aircraft **fatsv_heap;
+static uint32_t fatsv_heap_len;
+static uint32_t fatsv_heap_size;
+
+static inline void fatsvHeapPlace(uint32_t i, struct aircraft *a) {
+    fatsv_heap[i] = a;
+    a->fatsv_slot = i + 1;
+}
+
+static void fatsvHeapUp(uint32_t i) {
+    struct aircraft *a = fatsv_heap[i];
+
+    while (i > 0) {
+        uint32_t parent = (i - 1) / 2;
+        if (fatsv_heap[parent]->fatsv_due <= a->fatsv_due)
+            break;
+        fatsvHeapPlace(i, fatsv_heap[parent]);
+        i = parent;
+    }
+    fatsvHeapPlace(i, a);
+}
+
+static void fatsvHeapDown(uint32_t i) {
+    struct aircraft *a = fatsv_heap[i];
+
+    for (;;) {
+        uint32_t child = 2 * i + 1;
+        if (child >= fatsv_heap_len)
+            break;
+        if (child + 1 < fatsv_heap_len && fatsv_heap[child + 1]->fatsv_due < fatsv_heap[child]->fatsv_due)
+            child++;
+        if (a->fatsv_due <= fatsv_heap[child]->fatsv_due)
+            break;
+        fatsvHeapPlace(i, fatsv_heap[child]);
+        i = child;
+    }
+    fatsvHeapPlace(i, a);
+}
+
+static void fatsvHeapRemove(struct aircraft *a) {
+    uint32_t i = a->fatsv_slot - 1;
+    struct aircraft *last = fatsv_heap[--fatsv_heap_len];
+
+    a->fatsv_slot = 0;
+    if (last == a)
+        return;
+
+    fatsvHeapPlace(i, last);
+    fatsvHeapUp(i);
+    fatsvHeapDown(last->fatsv_slot - 1);
+}
+
+void trackScheduleFatsv(struct aircraft *a, uint64_t due) {
+    if (a->fatsv_slot) {
+        a->fatsv_due = due;
+        fatsvHeapUp(a->fatsv_slot - 1);
+        fatsvHeapDown(a->fatsv_slot - 1);
+        return;
+    }
+
+    if (fatsv_heap_len == fatsv_heap_size) {
+        uint32_t size = fatsv_heap_size ? fatsv_heap_size * 2 : 256;
+        struct aircraft **heap = realloc(fatsv_heap, size * sizeof (*heap));
+        if (!heap) {
+            fprintf(stderr, "Out of memory growing the FATSV queue\n");
+            exit(1);
+        }
+        fatsv_heap = heap;
+        fatsv_heap_size = size;
+    }
+
+    a->fatsv_due = due;
+    fatsv_heap[fatsv_heap_len++] = a;
+    fatsvHeapUp(fatsv_heap_len - 1);
+}
+
+struct aircraft *trackNextFatsvDue(uint64_t now) {
+    if (!fatsv_heap_len || fatsv_heap[0]->fatsv_due > now)
+        return NULL;
+
+    struct aircraft *a = fatsv_heap[0];
+    fatsvHeapRemove(a);
+    return a;
+}
+
+static void trackFieldChanged(struct aircraft *a, data_validity *d) {
+    d->generation = Modes.track_generation;
+    trackMarkChanged(a);
+}
+
+static const size_t track_field_offset[TRACK_FIELD_COUNT] = {
+    [TRACK_FIELD_CALLSIGN] = offsetof(struct aircraft, callsign_valid),
+    [TRACK_FIELD_ALTITUDE_BARO] = offsetof(struct aircraft, altitude_baro_valid),
+    [TRACK_FIELD_ALTITUDE_GEOM] = offsetof(struct aircraft, altitude_geom_valid),
+    [TRACK_FIELD_GEOM_DELTA] = offsetof(struct aircraft, geom_delta_valid),
+    [TRACK_FIELD_GS] = offsetof(struct aircraft, gs_valid),
+    [TRACK_FIELD_IAS] = offsetof(struct aircraft, ias_valid),
+    [TRACK_FIELD_TAS] = offsetof(struct aircraft, tas_valid),
+    [TRACK_FIELD_MACH] = offsetof(struct aircraft, mach_valid),
+    [TRACK_FIELD_TRACK] = offsetof(struct aircraft, track_valid),
+    [TRACK_FIELD_TRACK_RATE] = offsetof(struct aircraft, track_rate_valid),
+    [TRACK_FIELD_ROLL] = offsetof(struct aircraft, roll_valid),
+    [TRACK_FIELD_MAG_HEADING] = offsetof(struct aircraft, mag_heading_valid),
+    [TRACK_FIELD_TRUE_HEADING] = offsetof(struct aircraft, true_heading_valid),
+    [TRACK_FIELD_BARO_RATE] = offsetof(struct aircraft, baro_rate_valid),
+    [TRACK_FIELD_GEOM_RATE] = offsetof(struct aircraft, geom_rate_valid),
+    [TRACK_FIELD_NIC_A] = offsetof(struct aircraft, nic_a_valid),
+    [TRACK_FIELD_NIC_C] = offsetof(struct aircraft, nic_c_valid),
+    [TRACK_FIELD_NIC_BARO] = offsetof(struct aircraft, nic_baro_valid),
+    [TRACK_FIELD_NAC_P] = offsetof(struct aircraft, nac_p_valid),
+    [TRACK_FIELD_NAC_V] = offsetof(struct aircraft, nac_v_valid),
+    [TRACK_FIELD_SIL] = offsetof(struct aircraft, sil_valid),
+    [TRACK_FIELD_GVA] = offsetof(struct aircraft, gva_valid),
+    [TRACK_FIELD_SDA] = offsetof(struct aircraft, sda_valid),
+    [TRACK_FIELD_SQUAWK] = offsetof(struct aircraft, squawk_valid),
+    [TRACK_FIELD_EMERGENCY] = offsetof(struct aircraft, emergency_valid),
+    [TRACK_FIELD_AIRGROUND] = offsetof(struct aircraft, airground_valid),
+    [TRACK_FIELD_NAV_QNH] = offsetof(struct aircraft, nav_qnh_valid),
+    [TRACK_FIELD_NAV_ALTITUDE_MCP] = offsetof(struct aircraft, nav_altitude_mcp_valid),
+    [TRACK_FIELD_NAV_ALTITUDE_FMS] = offsetof(struct aircraft, nav_altitude_fms_valid),
+    [TRACK_FIELD_NAV_ALTITUDE_SRC] = offsetof(struct aircraft, nav_altitude_src_valid),
+    [TRACK_FIELD_NAV_HEADING] = offsetof(struct aircraft, nav_heading_valid),
+    [TRACK_FIELD_NAV_MODES] = offsetof(struct aircraft, nav_modes_valid),
+    [TRACK_FIELD_CPR_ODD] = offsetof(struct aircraft, cpr_odd_valid),
+    [TRACK_FIELD_CPR_EVEN] = offsetof(struct aircraft, cpr_even_valid),
+    [TRACK_FIELD_POSITION] = offsetof(struct aircraft, position_valid),
+    [TRACK_FIELD_ALERT] = offsetof(struct aircraft, alert_valid),
+    [TRACK_FIELD_SPI] = offsetof(struct aircraft, spi_valid),
+};
+
+uint64_t trackChangedFields(const struct aircraft *a, uint64_t since) {
+    uint64_t mask = 0;
+
+    if (a->generation <= since)
+        return 0;
+
+    for (int i = 0; i < TRACK_FIELD_COUNT; ++i) {
+        const data_validity *d = (const data_validity *) ((const char *) a + track_field_offset[i]);
+        if (d->generation > since)
+            mask |= UINT64_C(1) << i;
+    }
+    return mask;
+}
+
+static void modeACIndexUpdate(struct aircraft *a) {
+    if (a->squawk_valid.source != SOURCE_INVALID)
+        aircraftIndexMove(modeAC_squawk_index, LIST_SQUAWK, a, modeAToIndex(a->meta.squawk) + 1);
+
+    if (a->altitude_baro_valid.source != SOURCE_INVALID) {
+        int band = (a->meta.alt_baro + 49) / 100 + MODEAC_ALT_OFFSET;
+        aircraftIndexMove(modeAC_alt_index, LIST_ALTITUDE, a, (band >= 0 && band < MODEAC_ALT_BANDS) ? band + 1 : 0);
+    }
+}
+
+static void modeACIndexRemove(struct aircraft *a) {
+    aircraftIndexMove(modeAC_squawk_index, LIST_SQUAWK, a, 0);
+    aircraftIndexMove(modeAC_alt_index, LIST_ALTITUDE, a, 0);
+}
+
+// Aircraft by position, in cells of TRACK_GRID_DEGREES by TRACK_GRID_DEGREES,
+// for trackAircraftInBox() and trackAircraftInRadius(). Aircraft are moved
+// when their position is updated; those whose position has expired are
+// dropped when a query comes across them.
+
+#define TRACK_GRID_DEGREES 2
+#define TRACK_GRID_ROWS (180 / TRACK_GRID_DEGREES)
+#define TRACK_GRID_COLUMNS (360 / TRACK_GRID_DEGREES)
+
+static struct aircraft *track_grid[TRACK_GRID_ROWS * TRACK_GRID_COLUMNS];
+
+static inline int gridRow(double lat) {
+    int row = (int) floor((lat + 90.0) / TRACK_GRID_DEGREES);
+    return row < 0 ? 0 : (row >= TRACK_GRID_ROWS ? TRACK_GRID_ROWS - 1 : row);
+}
+
+static inline int gridColumn(double lon) {
+    int column = (int) floor((lon + 180.0) / TRACK_GRID_DEGREES) % TRACK_GRID_COLUMNS;
+    return column < 0 ? column + TRACK_GRID_COLUMNS : column;
+}
+
+static void gridUpdate(struct aircraft *a) {
+    unsigned cell = gridRow(a->meta.lat) * TRACK_GRID_COLUMNS + gridColumn(a->meta.lon);
+    aircraftIndexMove(track_grid, LIST_GRID, a, cell + 1);
+}
+
 //
-// Return a new aircraft structure for the linked list of tracked
-// aircraft
+// Return a new aircraft structure for the table of tracked aircraft,
+// or NULL if we are out of memory
 //
 
 static struct aircraft *trackCreateAircraft(struct modesMessage *mm) {
     static struct aircraft zeroAircraft;
-    struct aircraft *a = (struct aircraft *) malloc(sizeof (*a));
+    struct aircraft *a = aircraftPoolAlloc();
     int i;
 
+    if (!a)
+        return NULL;
+
     // Default everything to zero/NULL
     *a = zeroAircraft;
     aircraft_meta__init(&a->meta);
@@ -150,24 +520,275 @@ static struct aircraft *trackCreateAircraft(struct modesMessage *mm) {
 //
 //=========================================================================
 //
-// Return the aircraft with the specified address, or NULL if no aircraft
-// exists with this address.
+// The aircraft table: a dense array of struct aircraft_entry, so scans over
+// all aircraft walk contiguous memory and can filter on the hot fields
+// without touching the full struct aircraft, and a linear probing index from
+// address to table position. The index is kept at most half full so lookups
+// of unknown addresses (most of them, from noise) end after a probe or two.
 //
 
-static struct aircraft *trackFindAircraft(uint32_t addr) {
-    struct aircraft *a = Modes.aircrafts[addr % AIRCRAFTS_BUCKETS];
+#define AIRCRAFT_TABLE_MIN_SIZE 1024
+#define AIRCRAFT_INDEX_MIN_SLOTS 4096
+
+// Multiplicative hash; the low bits of real addresses are far from uniform
+static inline uint32_t aircraftHash(uint32_t addr) {
+    return (uint32_t) (((uint64_t) addr * 0x9E3779B97F4A7C15ULL) >> 32) & Modes.aircraft_index_mask;
+}
+
+static struct aircraft_slot *indexFind(uint32_t addr) {
+    uint32_t mask = Modes.aircraft_index_mask;
+
+    if (!Modes.aircraft_index || !addr)
+        return NULL;
+
+    for (uint32_t i = aircraftHash(addr);; i = (i + 1) & mask) {
+        struct aircraft_slot *slot = &Modes.aircraft_index[i];
+        if (slot->addr == addr)
+            return slot;
+        if (!slot->addr)
+            return NULL;
+    }
+}
+
+static void indexInsert(uint32_t addr, uint32_t pos) {
+    uint32_t mask = Modes.aircraft_index_mask;
+    uint32_t i = aircraftHash(addr);
+
+    while (Modes.aircraft_index[i].addr)
+        i = (i + 1) & mask;
+    Modes.aircraft_index[i].addr = addr;
+    Modes.aircraft_index[i].pos = pos;
+}
+
+// Remove a slot by shifting later members of its probe run back into the
+// hole, so the index never needs tombstones
+static void indexDelete(struct aircraft_slot *slot) {
+    uint32_t mask = Modes.aircraft_index_mask;
+    uint32_t hole = slot - Modes.aircraft_index;
+
+    for (uint32_t j = (hole + 1) & mask; Modes.aircraft_index[j].addr; j = (j + 1) & mask) {
+        uint32_t home = aircraftHash(Modes.aircraft_index[j].addr);
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            Modes.aircraft_index[hole] = Modes.aircraft_index[j];
+            hole = j;
+        }
+    }
+    Modes.aircraft_index[hole].addr = 0;
+}
+
+static bool indexResize(uint32_t slots) {
+    struct aircraft_slot *index = calloc(slots, sizeof (*index));
+
+    if (!index) {
+        fprintf(stderr, "Out of memory growing the aircraft index to %u slots\n", slots);
+        return false;
+    }
+
+    free(Modes.aircraft_index);
+    Modes.aircraft_index = index;
+    Modes.aircraft_index_mask = slots - 1;
+    for (uint32_t pos = 0; pos < Modes.aircraft_count; ++pos)
+        indexInsert(Modes.aircraft_table[pos].addr, pos);
+    return true;
+}
+
+static struct aircraft_entry *trackFindEntry(uint32_t addr) {
+    struct aircraft_slot *slot = indexFind(addr);
+    return (slot ? &Modes.aircraft_table[slot->pos] : NULL);
+}
+
+// Add an aircraft to the table, returns its entry or NULL if out of memory
+static struct aircraft_entry *trackAddAircraft(struct aircraft *a) {
+    if (Modes.aircraft_count == Modes.aircraft_table_size) {
+        uint32_t size = Modes.aircraft_table_size ? Modes.aircraft_table_size * 2 : AIRCRAFT_TABLE_MIN_SIZE;
+        struct aircraft_entry *table = realloc(Modes.aircraft_table, size * sizeof (*table));
+        if (!table) {
+            fprintf(stderr, "Out of memory growing the aircraft table to %u entries\n", size);
+            return NULL;
+        }
+        Modes.aircraft_table = table;
+        Modes.aircraft_table_size = size;
+    }
+
+    if (!Modes.aircraft_index || (Modes.aircraft_count + 1) * 2 > Modes.aircraft_index_mask + 1) {
+        uint32_t slots = Modes.aircraft_index ? (Modes.aircraft_index_mask + 1) * 2 : AIRCRAFT_INDEX_MIN_SLOTS;
+        if (!indexResize(slots))
+            return NULL;
+    }
+
+    uint32_t pos = Modes.aircraft_count++;
+    struct aircraft_entry *e = &Modes.aircraft_table[pos];
+    e->addr = a->meta.addr;
+    e->messages = 0;
+    e->seen = a->meta.seen;
+    e->a = a;
+    indexInsert(e->addr, pos);
+    return e;
+}
+
+// Free the aircraft at table position pos; the last entry moves into its place
+static void trackRemoveEntry(uint32_t pos) {
+    uint32_t last = --Modes.aircraft_count;
+
+    indexDelete(indexFind(Modes.aircraft_table[pos].addr));
+    modeACIndexRemove(Modes.aircraft_table[pos].a);
+    aircraftIndexMove(track_grid, LIST_GRID, Modes.aircraft_table[pos].a, 0);
+    aircraftIndexMove(&Modes.aircraft_changed, LIST_CHANGED, Modes.aircraft_table[pos].a, 0);
+    if (Modes.aircraft_table[pos].a->fatsv_slot)
+        fatsvHeapRemove(Modes.aircraft_table[pos].a);
+    if (Modes.aircraft_table[pos].a->view_slot)
+        interactiveRemoveAircraft(Modes.aircraft_table[pos].a);
+    aircraftPoolFree(Modes.aircraft_table[pos].a);
+
+    if (pos != last) {
+        Modes.aircraft_table[pos] = Modes.aircraft_table[last];
+        indexFind(Modes.aircraft_table[pos].addr)->pos = pos;
+    }
+}
+
+void trackCleanup(void) {
+    for (unsigned i = 0; i < aircraft_slab_count; ++i)
+        free(aircraft_slabs[i]);
+    free(aircraft_slabs);
+    aircraft_slabs = NULL;
+    aircraft_slab_count = 0;
+    aircraft_freelist = NULL;
+    aircraft_pool_used = 0;
+    memset(expire_wheel, 0, sizeof (expire_wheel));
+    expire_wheel_second = 0;
+
+    free(Modes.aircraft_table);
+    free(Modes.aircraft_index);
+    Modes.aircraft_table = NULL;
+    Modes.aircraft_index = NULL;
+    Modes.aircraft_count = Modes.aircraft_table_size = 0;
+    Modes.aircraft_index_mask = 0;
+    Modes.aircraft_changed = NULL;
+
+    free(fatsv_heap);
+    fatsv_heap = NULL;
+    fatsv_heap_len = fatsv_heap_size = 0;
+}
+
+// Warm restart, see state.c: the aircraft are saved as their struct aircraft,
+// behind its size, so a readsb with a different layout doesn't take them.
+// The pointers and the places in indexes and output queues are made up
+// again when they are restored; the timestamps are wall clock times and
+// stay as they were saved, so data that timed out in the meantime expires
+// as soon as the aircraft comes up in the expiry wheel.
+
+void trackSave(FILE *f) {
+    uint32_t size = sizeof (struct aircraft);
+
+    fwrite(&size, sizeof (size), 1, f);
+    for (uint32_t i = 0; i < Modes.aircraft_count; i++)
+        fwrite(Modes.aircraft_table[i].a, sizeof (struct aircraft), 1, f);
+}
+
+static void trackRestorePointers(struct aircraft *a) {
+    AircraftMeta meta_init = AIRCRAFT_META__INIT;
+    AircraftMeta__NavModes nav_modes_init = AIRCRAFT_META__NAV_MODES__INIT;
+    AircraftMeta__ValidSource valid_source_init = AIRCRAFT_META__VALID_SOURCE__INIT;
+
+    a->meta.base = meta_init.base;
+    a->nav_modes.base = nav_modes_init.base;
+    a->valid_source.base = valid_source_init.base;
+    if (a->meta.flight)
+        a->meta.flight = a->callsign;
+    if (a->meta.nav_modes)
+        a->meta.nav_modes = &a->nav_modes;
+    if (a->meta.valid_source)
+        a->meta.valid_source = &a->valid_source;
+
+    memset(&a->changed, 0, sizeof (a->changed));
+    memset(&a->modeac_squawk, 0, sizeof (a->modeac_squawk));
+    memset(&a->modeac_alt, 0, sizeof (a->modeac_alt));
+    memset(&a->grid, 0, sizeof (a->grid));
+    a->next = NULL;
+    a->fatsv_slot = 0;
+    a->view_slot = 0;
+    a->vrs_generation = a->vrs_messages = a->vrs_expires = 0;
+    a->vrs_round = a->vrs_offset = a->vrs_len = 0;
+
+    a->pb_sent = meta_init;
+    a->pb_sent_nav_modes = nav_modes_init;
+    a->pb_sent_valid_source = valid_source_init;
+    memset(a->pb_sent_callsign, 0, sizeof (a->pb_sent_callsign));
+    a->pb_streamed = false;
+
+    // generations count from 0 again
+    for (int i = 0; i < TRACK_FIELD_COUNT; i++)
+        ((data_validity *) ((char *) a + track_field_offset[i]))->generation = Modes.track_generation;
+    a->generation = Modes.track_generation;
+    a->wind_generation = ~UINT64_C(0);
+}
+
+// Add the aircraft saved by trackSave() that haven't timed out by now;
+// returns how many
+uint32_t trackRestore(const uint8_t *p, size_t len, uint64_t now) {
+    uint32_t size, restored = 0;
 
-    while (a) {
-        if (a->meta.addr == addr) return (a);
-        a = a->next;
+    if (len < sizeof (size))
+        return 0;
+    memcpy(&size, p, sizeof (size));
+    if (size != sizeof (struct aircraft)) {
+        fprintf(stderr, "Aircraft saved by a different version of readsb, not restored\n");
+        return 0;
     }
-    return (NULL);
+
+    for (size_t off = sizeof (size); off + size <= len; off += size) {
+        struct aircraft *a;
+        struct aircraft_entry *e;
+        uint64_t seen, messages;
+
+        memcpy(&seen, p + off + offsetof(struct aircraft, meta.seen), sizeof (seen));
+        memcpy(&messages, p + off + offsetof(struct aircraft, meta.messages), sizeof (messages));
+        if (seen > now || now - seen > (messages == 1 ? TRACK_AIRCRAFT_ONEHIT_TTL : TRACK_AIRCRAFT_TTL))
+            continue;
+
+        if (!(a = aircraftPoolAlloc()))
+            break;
+        memcpy(a, p + off, size);
+        if (trackFindEntry(a->meta.addr) || !(e = trackAddAircraft(a))) {
+            aircraftPoolFree(a);
+            continue;
+        }
+        trackRestorePointers(a);
+        e->messages = a->meta.messages < UINT32_MAX ? a->meta.messages : UINT32_MAX;
+
+        trackScheduleExpiry(a, now);
+        trackMarkChanged(a);
+        if (a->position_valid.source != SOURCE_INVALID)
+            gridUpdate(a);
+        if (Modes.mode_ac)
+            modeACIndexUpdate(a);
+        restored++;
+    }
+    return restored;
+}
+
+//
+//=========================================================================
+//
+// Return the aircraft with the specified address, or NULL if no aircraft
+// exists with this address.
+//
+
+struct aircraft *trackFindAircraft(uint32_t addr) {
+    struct aircraft_entry *e = trackFindEntry(addr);
+    return (e ? e->a : NULL);
 }
 
 // Should we accept some new data from the given source?
 // If so, update the validity and return 1
 
-static int accept_data(data_validity *d, datasource_t source, struct modesMessage *mm, int reduce_often) {
+// The BeastReduce interval of an aircraft: the global one unless the
+// --net-beast-reduce-budget scheduler has picked one for it
+static inline uint64_t reduceInterval(const struct aircraft *a) {
+    return a->reduce_interval ? a->reduce_interval : Modes.net_output_beast_reduce_interval;
+}
+
+static int accept_data(struct aircraft *a, data_validity *d, datasource_t source, struct modesMessage *mm, int reduce_often) {
     if (messageNow() < d->updated)
         return 0;
 
@@ -178,15 +799,17 @@ static int accept_data(data_validity *d, datasource_t source, struct modesMessag
     d->updated = messageNow();
     d->stale = messageNow() + (d->stale_interval ? d->stale_interval : 60000);
     d->expires = messageNow() + (d->expire_interval ? d->expire_interval : 70000);
+    trackFieldChanged(a, d);
 
     if (messageNow() > d->next_reduce_forward && !mm->sbs_in) {
+        uint64_t interval = reduceInterval(a);
         if (mm->msgtype == 17 || reduce_often) {
-            d->next_reduce_forward = messageNow() + Modes.net_output_beast_reduce_interval;
+            d->next_reduce_forward = messageNow() + interval;
         } else {
-            d->next_reduce_forward = messageNow() + Modes.net_output_beast_reduce_interval * 4;
+            d->next_reduce_forward = messageNow() + interval * 4;
         }
         // make sure global CPR stays possible even at high interval:
-        if (Modes.net_output_beast_reduce_interval > 7000 && mm->cpr_valid) {
+        if (interval > 7000 && mm->cpr_valid) {
             d->next_reduce_forward = messageNow() + 7000;
         }
         mm->reduce_forward = 1;
@@ -212,6 +835,7 @@ static void combine_validity(data_validity *to, const data_validity *from1, cons
     to->updated = (from1->updated > from2->updated) ? from1->updated : from2->updated; // the *later* of the two update times
     to->stale = (from1->stale < from2->stale) ? from1->stale : from2->stale; // the earlier of the two stale times
     to->expires = (from1->expires < from2->expires) ? from1->expires : from2->expires; // the earlier of the two expiry times
+    to->generation = (from1->generation > from2->generation) ? from1->generation : from2->generation; // the later of the two changes
 }
 
 static int compare_validity(const data_validity *lhs, const data_validity *rhs) {
@@ -227,55 +851,189 @@ static int compare_validity(const data_validity *lhs, const data_validity *rhs)
         return 0;
 }
 
-/**
- * Calculate bearing of two coordinates
- * @param lat0 Latitude start
- * @param lon0 Longitude start
- * @param lat1 Latitude end
- * @param lon1 Longitude end
- * @return Bearing in 0-360 degree.
- */
-static double getBearing(double lat0, double lon0, double lat1, double lon1) {
-    lat0 = lat0 * M_PI / 180.0;
-    lon0 = lon0 * M_PI / 180.0;
-    lat1 = lat1 * M_PI / 180.0;
-    lon1 = lon1 * M_PI / 180.0;
-
-    double dlon = lon1 - lon0;
-    double x = cos(lat0) * sin(dlon);
-    double y = cos(lat1) * sin(lat0) - sin(lat1) * cos(lat0) * cos(dlon);
-    double b = atan2(x, y);
-    double bearing = 180 / M_PI * b;
-    return bearing + 180;
-}
-
 //
-// CPR position updating
+// Distances and bearings
 //
 
-// Distance between points on a spherical earth.
-// This has up to 0.5% error because the earth isn't actually spherical
-// (but we don't use it in situations where that matters)
+// A point that distances and bearings are repeatedly measured from, with
+// the trig terms of its own position worked out once
+
+struct geo_ref {
+    double lat, lon; // degrees
+    double lat_rad, lon_rad;
+    double sin_lat, cos_lat;
+};
+
+static void geoRefInit(struct geo_ref *ref, double lat, double lon) {
+    ref->lat = lat;
+    ref->lon = lon;
+    ref->lat_rad = lat * M_PI / 180.0;
+    ref->lon_rad = lon * M_PI / 180.0;
+    ref->sin_lat = sin(ref->lat_rad);
+    ref->cos_lat = cos(ref->lat_rad);
+}
 
-static double greatcircle(double lat0, double lon0, double lat1, double lon1) {
-    double dlat, dlon;
+// The receiver as a reference point. It is refreshed whenever
+// Modes.receiver has moved, whichever of the places that set it did so.
 
-    lat0 = lat0 * M_PI / 180.0;
-    lon0 = lon0 * M_PI / 180.0;
-    lat1 = lat1 * M_PI / 180.0;
-    lon1 = lon1 * M_PI / 180.0;
+static struct geo_ref receiver_ref = { NAN, NAN, 0, 0, 0, 0 };
 
-    dlat = fabs(lat1 - lat0);
-    dlon = fabs(lon1 - lon0);
+static const struct geo_ref *receiverRef(void) {
+    if (Modes.receiver.latitude != receiver_ref.lat || Modes.receiver.longitude != receiver_ref.lon)
+        geoRefInit(&receiver_ref, Modes.receiver.latitude, Modes.receiver.longitude);
+    return &receiver_ref;
+}
+
+// Distance from ref to lat, lon on a spherical earth, and if bearing is
+// not NULL the bearing between them in 0-360 degrees.
+// The distance has up to 0.5% error because the earth isn't actually spherical
+// (but we don't use it in situations where that matters)
+
+static double geoRefDistance(const struct geo_ref *ref, double lat, double lon, double *bearing) {
+    double lat1 = lat * M_PI / 180.0;
+    double lon1 = lon * M_PI / 180.0;
+    double dlat = fabs(lat1 - ref->lat_rad);
+    double dlon = fabs(lon1 - ref->lon_rad);
+    double sin_lat1 = sin(lat1), cos_lat1 = cos(lat1);
+    double cos_dlon = cos(dlon);
+
+    if (bearing) {
+        double x = ref->cos_lat * sin(lon1 - ref->lon_rad);
+        double y = cos_lat1 * ref->sin_lat - sin_lat1 * ref->cos_lat * cos_dlon;
+        *bearing = 180 / M_PI * atan2(x, y) + 180;
+    }
 
     // use haversine for small distances for better numerical stability
     if (dlat < 0.001 && dlon < 0.001) {
-        double a = sin(dlat / 2) * sin(dlat / 2) + cos(lat0) * cos(lat1) * sin(dlon / 2) * sin(dlon / 2);
+        double a = sin(dlat / 2) * sin(dlat / 2) + ref->cos_lat * cos_lat1 * sin(dlon / 2) * sin(dlon / 2);
         return 6371e3 * 2 * atan2(sqrt(a), sqrt(1.0 - a));
     }
 
     // spherical law of cosines
-    return 6371e3 * acos(sin(lat0) * sin(lat1) + cos(lat0) * cos(lat1) * cos(dlon));
+    return 6371e3 * acos(ref->sin_lat * sin_lat1 + ref->cos_lat * cos_lat1 * cos_dlon);
+}
+
+// Equirectangular approximation of geoRefDistance() without any trig, for
+// range checks. Up to GEO_FAST_MAX_DISTANCE from a reference point no
+// further than GEO_FAST_MAX_LAT from the equator it is within GEO_FAST_ERROR
+// of geoRefDistance() (the worst case seen is 1.2%, at 70 degrees and
+// 1000km); otherwise it returns -1.
+
+#define GEO_FAST_MAX_LAT 70.0
+#define GEO_FAST_MAX_DISTANCE 1000e3
+#define GEO_FAST_ERROR 0.02
+
+static double geoRefDistanceFast(const struct geo_ref *ref, double lat, double lon) {
+    if (fabs(ref->lat) > GEO_FAST_MAX_LAT)
+        return -1;
+
+    double dlat = (lat - ref->lat) * M_PI / 180.0;
+    double dlon = (lon - ref->lon) * M_PI / 180.0;
+    if (dlon > M_PI)
+        dlon -= 2 * M_PI;
+    else if (dlon < -M_PI)
+        dlon += 2 * M_PI;
+
+    // cosine of the mid latitude, expanded around the reference latitude
+    double h = dlat / 2;
+    double x = dlon * (ref->cos_lat * (1 - h * h / 2) - ref->sin_lat * h);
+    double d = 6371e3 * sqrt(x * x + dlat * dlat);
+
+    return (d <= GEO_FAST_MAX_DISTANCE) ? d : -1;
+}
+
+// Is lat, lon more than range metres from ref? This gives the same answer
+// as comparing geoRefDistance() but only works that out near the limit.
+
+static bool geoRefBeyond(const struct geo_ref *ref, double lat, double lon, double range) {
+    double d = geoRefDistanceFast(ref, lat, lon);
+
+    if (d >= 0) {
+        if (d < range * (1 - GEO_FAST_ERROR))
+            return false;
+        if (d > range * (1 + GEO_FAST_ERROR))
+            return true;
+    }
+
+    return geoRefDistance(ref, lat, lon, NULL) > range;
+}
+
+//
+// CPR position updating
+//
+
+// Call fn for every aircraft in grid row row, columns column0 .. column1,
+// whose position is valid and passes the exact test
+static void gridQuery(int row, int column0, int column1, bool (*inside)(struct aircraft *a, const void *area), const void *area, track_aircraft_fn fn, void *arg) {
+    for (int column = column0; column <= column1; ++column) {
+        struct aircraft *a = track_grid[row * TRACK_GRID_COLUMNS + column], *next;
+        for (; a; a = next) {
+            next = a->grid.next;
+            if (!trackDataValid(&a->position_valid)) {
+                // drop it until its next position
+                aircraftIndexMove(track_grid, LIST_GRID, a, 0);
+                continue;
+            }
+            if (inside(a, area))
+                fn(a, arg);
+        }
+    }
+}
+
+static void gridQueryBox(double lat_min, double lon_min, double lat_max, double lon_max,
+        bool (*inside)(struct aircraft *a, const void *area), const void *area, track_aircraft_fn fn, void *arg) {
+    int column0 = gridColumn(lon_min), column1 = gridColumn(lon_max);
+
+    for (int row = gridRow(lat_min); row <= gridRow(lat_max); ++row) {
+        if (lon_min <= lon_max && lon_max - lon_min < 360.0 - TRACK_GRID_DEGREES && column0 <= column1) {
+            gridQuery(row, column0, column1, inside, area, fn, arg);
+        } else if (column0 <= column1) {
+            // all the way round
+            gridQuery(row, 0, TRACK_GRID_COLUMNS - 1, inside, area, fn, arg);
+        } else {
+            // crosses the antimeridian
+            gridQuery(row, column0, TRACK_GRID_COLUMNS - 1, inside, area, fn, arg);
+            gridQuery(row, 0, column1, inside, area, fn, arg);
+        }
+    }
+}
+
+static bool insideBox(struct aircraft *a, const void *area) {
+    const double *box = area;
+    return trackBoxContains(box[0], box[1], box[2], box[3], a->meta.lat, a->meta.lon);
+}
+
+void trackAircraftInBox(double lat_min, double lon_min, double lat_max, double lon_max, track_aircraft_fn fn, void *arg) {
+    double box[4] = { lat_min, lon_min, lat_max, lon_max };
+    gridQueryBox(lat_min, lon_min, lat_max, lon_max, insideBox, box, fn, arg);
+}
+
+struct geo_circle {
+    struct geo_ref centre;
+    double radius;
+};
+
+static bool insideRadius(struct aircraft *a, const void *area) {
+    const struct geo_circle *circle = area;
+    return !geoRefBeyond(&circle->centre, a->meta.lat, a->meta.lon, circle->radius);
+}
+
+void trackAircraftInRadius(double lat, double lon, double radius, track_aircraft_fn fn, void *arg) {
+    struct geo_circle circle = { .radius = radius };
+    geoRefInit(&circle.centre, lat, lon);
+    double dlat = radius / 6371e3 * 180.0 / M_PI;
+    double lat_min = lat - dlat, lat_max = lat + dlat;
+
+    if (lat_min <= -90.0 || lat_max >= 90.0) {
+        // takes in a pole, so every longitude
+        gridQueryBox(fmax(lat_min, -90.0), -180.0, fmin(lat_max, 90.0), 180.0, insideRadius, &circle, fn, arg);
+    } else {
+        double dlon = dlat / cos(fmax(fabs(lat_min), fabs(lat_max)) * M_PI / 180.0);
+        if (dlon >= 180.0)
+            gridQueryBox(lat_min, -180.0, lat_max, 180.0, insideRadius, &circle, fn, arg);
+        else
+            gridQueryBox(lat_min, lon - dlon, lat_max, lon + dlon, insideRadius, &circle, fn, arg);
+    }
 }
 
 static uint32_t update_polar_range(double lat, double lon) {
@@ -285,7 +1043,8 @@ static uint32_t update_polar_range(double lat, double lon) {
     if (!valid_latlon)
         return 0;
 
-    range = greatcircle(Modes.receiver.latitude, Modes.receiver.longitude, lat, lon);
+    double bearing = 0;
+    range = geoRefDistance(receiverRef(), lat, lon, Modes.stats_polar_range ? &bearing : NULL);
 
     if ((range <= Modes.maxRange || Modes.maxRange == 0) && range > Modes.stats_current.longest_distance) {
         Modes.stats_current.longest_distance = range;
@@ -293,7 +1052,7 @@ static uint32_t update_polar_range(double lat, double lon) {
 
     if (Modes.stats_polar_range) {
         // Round bearing to polarplot resolution.
-        int bucket = round(getBearing(Modes.receiver.latitude, Modes.receiver.longitude, lat, lon) / POLAR_RANGE_RESOLUTION);
+        int bucket = round(bearing / POLAR_RANGE_RESOLUTION);
         // Catch and avoid out of bounds writes
         if (bucket >= POLAR_RANGE_BUCKETS) {
             bucket = 0;
@@ -312,7 +1071,6 @@ static uint32_t update_polar_range(double lat, double lon) {
 
 static int speed_check(struct aircraft *a, double lat, double lon, int surface) {
     uint64_t elapsed;
-    double distance;
     double range;
     int speed;
     int inrange;
@@ -354,14 +1112,14 @@ static int speed_check(struct aircraft *a, double lat, double lon, int surface)
     // plus distance covered at the given speed for the elapsed time + 1 second.
     range = (surface ? 0.1e3 : 0.5e3) + ((elapsed + 1000.0) / 1000.0) * (speed * 1852.0 / 3600.0);
 
-    // find actual distance
-    distance = greatcircle(a->meta.lat, a->meta.lon, lat, lon);
-
-    inrange = (distance <= range);
+    // check the actual distance
+    struct geo_ref from;
+    geoRefInit(&from, a->meta.lat, a->meta.lon);
+    inrange = !geoRefBeyond(&from, lat, lon, range);
 #ifdef DEBUG_CPR_CHECKS
     if (!inrange) {
         fprintf(stderr, "Speed check failed: %06x: %.3f,%.3f -> %.3f,%.3f in %.1f seconds, max speed %d kt, range %.1fkm, actual %.1fkm\n",
-                a->addr, a->lat, a->lon, lat, lon, elapsed / 1000.0, speed, range / 1000.0, distance / 1000.0);
+                a->addr, a->lat, a->lon, lat, lon, elapsed / 1000.0, speed, range / 1000.0, geoRefDistance(&from, lat, lon, NULL) / 1000.0);
     }
 #endif
 
@@ -420,11 +1178,10 @@ static int doGlobalCPR(struct aircraft *a, struct modesMessage *mm, double *lat,
 
     // check max range
     if (Modes.maxRange > 0 && (Modes.bUserFlags & MODES_USER_LATLON_VALID)) {
-        double range = greatcircle(Modes.receiver.latitude, Modes.receiver.longitude, *lat, *lon);
-        if (range > Modes.maxRange) {
+        if (geoRefBeyond(receiverRef(), *lat, *lon, Modes.maxRange)) {
 #ifdef DEBUG_CPR_CHECKS
             fprintf(stderr, "Global range check failed: %06x: %.3f,%.3f, max range %.1fkm, actual %.1fkm\n",
-                    a->addr, *lat, *lon, Modes.maxRange / 1000.0, range / 1000.0);
+                    a->addr, *lat, *lon, Modes.maxRange / 1000.0, geoRefDistance(receiverRef(), *lat, *lon, NULL) / 1000.0);
 #endif
 
             Modes.stats_current.cpr_global_range_checks++;
@@ -522,8 +1279,14 @@ static int doLocalCPR(struct aircraft *a, struct modesMessage *mm, double *lat,
 
     // check range limit
     if (range_limit > 0) {
-        double range = greatcircle(reflat, reflon, *lat, *lon);
-        if (range > range_limit) {
+        struct geo_ref from;
+        const struct geo_ref *ref = receiverRef();
+
+        if (relative_to != 2) {
+            geoRefInit(&from, reflat, reflon);
+            ref = &from;
+        }
+        if (geoRefBeyond(ref, *lat, *lon, range_limit)) {
             Modes.stats_current.cpr_local_range_checks++;
             return (-1);
         }
@@ -614,7 +1377,7 @@ static void updatePosition(struct aircraft *a, struct modesMessage *mm) {
             // Nonfatal, try again later.
             Modes.stats_current.cpr_global_skipped++;
         } else {
-            if (accept_data(&a->position_valid, mm->source, mm, 1)) {
+            if (accept_data(a, &a->position_valid, mm->source, mm, 1)) {
                 Modes.stats_current.cpr_global_ok++;
 
                 if (a->pos_reliable_odd <= 0 || a->pos_reliable_even <= 0) {
@@ -640,7 +1403,7 @@ static void updatePosition(struct aircraft *a, struct modesMessage *mm) {
     if (location_result == -1) {
         location_result = doLocalCPR(a, mm, &new_lat, &new_lon, &new_nic, &new_rc);
 
-        if (location_result >= 0 && accept_data(&a->position_valid, mm->source, mm, 1)) {
+        if (location_result >= 0 && accept_data(a, &a->position_valid, mm->source, mm, 1)) {
             Modes.stats_current.cpr_local_ok++;
             mm->cpr_relative = 1;
 
@@ -672,17 +1435,19 @@ static void updatePosition(struct aircraft *a, struct modesMessage *mm) {
         a->meta.lon = new_lon;
         a->meta.nic = new_nic;
         a->meta.rc = new_rc;
+        gridUpdate(a);
 
-        double dip, ti, gv;
         // Update magnetic declination whenever position changes
         if (trackDataValid(&a->altitude_geom_valid)) {
             // Altitude given in feet but required to be in kilometer above WGS84 ellipsoid.
-            geomag_calc(a->meta.alt_geom * 0.0003048, a->meta.lat, a->meta.lon, -1.0, &a->meta.declination, &dip, &ti, &gv);
+            a->meta.declination = geomag_declination(a->meta.alt_geom * 0.0003048, a->meta.lat, a->meta.lon);
         }
 
         a->meta.distance = false;
         if (a->pos_reliable_odd >= 1 && a->pos_reliable_even >= 1 && mm->source == SOURCE_ADSB) {
             a->meta.distance = update_polar_range(new_lat, new_lon);
+            if (a->meta.distance)
+                stats_sketch_add(&Modes.stats_distance, a->meta.distance);
         }
     }
 }
@@ -993,12 +1758,13 @@ static int altitude_to_feet(int raw, altitude_unit_t unit) {
 //
 
 struct aircraft *trackUpdateFromMessage(struct modesMessage *mm) {
+    struct aircraft_entry *e;
     struct aircraft *a;
     unsigned int cpr_new = 0;
 
     if (mm->msgtype == 32) {
         // Mode A/C, just count it (we ignore SPI)
-        modeAC_count[modeAToIndex(mm->squawk)]++;
+        modeACCount(modeAToIndex(mm->squawk));
         return NULL;
     }
 
@@ -1008,25 +1774,41 @@ struct aircraft *trackUpdateFromMessage(struct modesMessage *mm) {
     }
 
     _messageNow = mm->sysTimestampMsg;
+    Modes.track_generation++;
 
     // Lookup our aircraft or create a new one
-    a = trackFindAircraft(mm->addr);
-    if (!a) { // If it's a currently unknown aircraft....
-        a = trackCreateAircraft(mm); // ., create a new record for it,
-        a->next = Modes.aircrafts[mm->addr % AIRCRAFTS_BUCKETS]; // .. and put it at the head of the list
-        Modes.aircrafts[mm->addr % AIRCRAFTS_BUCKETS] = a;
+    e = trackFindEntry(mm->addr);
+    if (!e) { // If it's a currently unknown aircraft....
+        if (!(a = trackCreateAircraft(mm))) // ., create a new record for it,
+            return NULL;
+        if (!(e = trackAddAircraft(a))) { // .. and add it to the table
+            aircraftPoolFree(a);
+            return NULL;
+        }
+        trackScheduleExpiry(a, mm->sysTimestampMsg + TRACK_AIRCRAFT_ONEHIT_TTL + 1);
+        trackMarkChanged(a);
     }
+    a = e->a;
 
     if (mm->signalLevel > 0) {
         a->signalLevel[a->signalNext] = mm->signalLevel;
         a->signalNext = (a->signalNext + 1) & 7;
+        stats_sketch_add(&Modes.stats_rssi, 10 * log10f(mm->signalLevel));
     }
     a->meta.seen = mm->sysTimestampMsg;
     a->meta.messages++;
+    e->seen = a->meta.seen;
+    if (e->messages < UINT32_MAX)
+        e->messages++;
+
+    // outputs skip aircraft seen only once, so the second message makes it new to them
+    if (e->messages == 2)
+        trackMarkChanged(a);
 
     // update addrtype, we only ever go towards "more direct" types
     if (mm->addrtype < a->meta.addr_type) {
         a->meta.addr_type = mm->addrtype;
+        trackMarkChanged(a);
     }
 
     // decide on where to stash the version
@@ -1054,13 +1836,16 @@ struct aircraft *trackUpdateFromMessage(struct modesMessage *mm) {
     }
 
     // category shouldn't change over time, don't bother with metadata
-    if (mm->category_valid) {
+    if (mm->category_valid && a->meta.category != mm->category) {
         a->meta.category = mm->category;
+        trackMarkChanged(a);
     }
 
     // operational status message
     // done early to update version / HRD / TAH
     if (mm->opstatus.valid) {
+        if (*message_version != mm->opstatus.version)
+            trackMarkChanged(a);
         *message_version = mm->opstatus.version;
 
         if (mm->opstatus.hrd != HEADING_INVALID) {
@@ -1130,7 +1915,7 @@ struct aircraft *trackUpdateFromMessage(struct modesMessage *mm) {
                 || (fpm < max_fpm && fpm > min_fpm)
                 || (good_crc && a->altitude_baro_reliable <= (ALTITUDE_BARO_RELIABLE_MAX / 2 + 2))
                 ) {
-            if (accept_data(&a->altitude_baro_valid, mm->source, mm, 1)) {
+            if (accept_data(a, &a->altitude_baro_valid, mm->source, mm, 1)) {
                 a->altitude_baro_reliable = min(ALTITUDE_BARO_RELIABLE_MAX, a->altitude_baro_reliable + (good_crc + 1));
                 /*if (abs(delta) > 2000 && delta != alt) {
                     fprintf(stderr, "Alt change B: %06x: %d   %d -> %d, min %.1f kfpm, max %.1f kfpm, actual %.1f kfpm\n",
@@ -1150,7 +1935,7 @@ struct aircraft *trackUpdateFromMessage(struct modesMessage *mm) {
         }
     }
 
-    if (mm->squawk_valid && accept_data(&a->squawk_valid, mm->source, mm, 0)) {
+    if (mm->squawk_valid && accept_data(a, &a->squawk_valid, mm->source, mm, 0)) {
         if (mm->squawk != a->meta.squawk) {
             a->modeA_hit = 0;
         }
@@ -1175,22 +1960,22 @@ struct aircraft *trackUpdateFromMessage(struct modesMessage *mm) {
                     break;
             }
 
-            if (squawk_emergency != EMERGENCY_NONE && accept_data(&a->emergency_valid, mm->source, mm, 0)) {
+            if (squawk_emergency != EMERGENCY_NONE && accept_data(a, &a->emergency_valid, mm->source, mm, 0)) {
                 a->emergency = squawk_emergency;
             }
         }
 #endif
     }
 
-    if (mm->emergency_valid && accept_data(&a->emergency_valid, mm->source, mm, 0)) {
+    if (mm->emergency_valid && accept_data(a, &a->emergency_valid, mm->source, mm, 0)) {
         a->meta.emergency = mm->emergency;
     }
 
-    if (mm->altitude_geom_valid && accept_data(&a->altitude_geom_valid, mm->source, mm, 1)) {
+    if (mm->altitude_geom_valid && accept_data(a, &a->altitude_geom_valid, mm->source, mm, 1)) {
         a->meta.alt_geom = altitude_to_feet(mm->altitude_geom, mm->altitude_geom_unit);
     }
 
-    if (mm->geom_delta_valid && accept_data(&a->geom_delta_valid, mm->source, mm, 1)) {
+    if (mm->geom_delta_valid && accept_data(a, &a->geom_delta_valid, mm->source, mm, 1)) {
         a->geom_delta = mm->geom_delta;
     }
 
@@ -1202,47 +1987,47 @@ struct aircraft *trackUpdateFromMessage(struct modesMessage *mm) {
             a->heading_type = a->adsb_tah;
         }
 
-        if (a->heading_type == HEADING_GROUND_TRACK && accept_data(&a->track_valid, mm->source, mm, 1)) {
+        if (a->heading_type == HEADING_GROUND_TRACK && accept_data(a, &a->track_valid, mm->source, mm, 1)) {
             a->meta.track = mm->heading;
-        } else if (a->heading_type == HEADING_MAGNETIC && accept_data(&a->mag_heading_valid, mm->source, mm, 1)) {
+        } else if (a->heading_type == HEADING_MAGNETIC && accept_data(a, &a->mag_heading_valid, mm->source, mm, 1)) {
             a->meta.mag_heading = mm->heading;
-        } else if (a->heading_type == HEADING_TRUE && accept_data(&a->true_heading_valid, mm->source, mm, 1)) {
+        } else if (a->heading_type == HEADING_TRUE && accept_data(a, &a->true_heading_valid, mm->source, mm, 1)) {
             a->meta.true_heading = mm->heading;
         }
     }
 
-    if (mm->track_rate_valid && accept_data(&a->track_rate_valid, mm->source, mm, 1)) {
+    if (mm->track_rate_valid && accept_data(a, &a->track_rate_valid, mm->source, mm, 1)) {
         a->meta.track_rate = mm->track_rate;
     }
 
-    if (mm->roll_valid && accept_data(&a->roll_valid, mm->source, mm, 1)) {
+    if (mm->roll_valid && accept_data(a, &a->roll_valid, mm->source, mm, 1)) {
         a->meta.roll = mm->roll;
     }
 
     if (mm->gs_valid) {
         mm->gs.selected = (*message_version == 2 ? mm->gs.v2 : mm->gs.v0);
-        if (accept_data(&a->gs_valid, mm->source, mm, 1)) {
+        if (accept_data(a, &a->gs_valid, mm->source, mm, 1)) {
             a->meta.gs = mm->gs.selected;
         }
     }
 
-    if (mm->ias_valid && accept_data(&a->ias_valid, mm->source, mm, 0)) {
+    if (mm->ias_valid && accept_data(a, &a->ias_valid, mm->source, mm, 0)) {
         a->meta.ias = mm->ias;
     }
 
-    if (mm->tas_valid && accept_data(&a->tas_valid, mm->source, mm, 0)) {
+    if (mm->tas_valid && accept_data(a, &a->tas_valid, mm->source, mm, 0)) {
         a->meta.tas = mm->tas;
     }
 
-    if (mm->mach_valid && accept_data(&a->mach_valid, mm->source, mm, 0)) {
+    if (mm->mach_valid && accept_data(a, &a->mach_valid, mm->source, mm, 0)) {
         a->meta.mach = mm->mach;
     }
 
-    if (mm->baro_rate_valid && accept_data(&a->baro_rate_valid, mm->source, mm, 1)) {
+    if (mm->baro_rate_valid && accept_data(a, &a->baro_rate_valid, mm->source, mm, 1)) {
         a->meta.baro_rate = mm->baro_rate;
     }
 
-    if (mm->geom_rate_valid && accept_data(&a->geom_rate_valid, mm->source, mm, 1)) {
+    if (mm->geom_rate_valid && accept_data(a, &a->geom_rate_valid, mm->source, mm, 1)) {
         a->meta.geom_rate = mm->geom_rate;
     }
 
@@ -1251,33 +2036,33 @@ struct aircraft *trackUpdateFromMessage(struct modesMessage *mm) {
         // If our current state is certain but new data is not, only accept the uncertain state if the certain data has gone stale
         if (mm->airground != AIRCRAFT_META__AIR_GROUND__AG_UNCERTAIN ||
                 (mm->airground == AIRCRAFT_META__AIR_GROUND__AG_UNCERTAIN && !trackDataFresh(&a->airground_valid))) {
-            if (accept_data(&a->airground_valid, mm->source, mm, 0)) {
+            if (accept_data(a, &a->airground_valid, mm->source, mm, 0)) {
                 a->meta.air_ground = mm->airground;
             }
         }
     }
 
-    if (mm->callsign_valid && accept_data(&a->callsign_valid, mm->source, mm, 0)) {
+    if (mm->callsign_valid && accept_data(a, &a->callsign_valid, mm->source, mm, 0)) {
         memcpy(a->callsign, mm->callsign, sizeof (a->callsign));
     }
 
-    if (mm->nav.mcp_altitude_valid && accept_data(&a->nav_altitude_mcp_valid, mm->source, mm, 0)) {
+    if (mm->nav.mcp_altitude_valid && accept_data(a, &a->nav_altitude_mcp_valid, mm->source, mm, 0)) {
         a->meta.nav_altitude_mcp = mm->nav.mcp_altitude;
     }
 
-    if (mm->nav.fms_altitude_valid && accept_data(&a->nav_altitude_fms_valid, mm->source, mm, 0)) {
+    if (mm->nav.fms_altitude_valid && accept_data(a, &a->nav_altitude_fms_valid, mm->source, mm, 0)) {
         a->meta.nav_altitude_fms = mm->nav.fms_altitude;
     }
 
-    if (mm->nav.altitude_source != NAV_ALT_INVALID && accept_data(&a->nav_altitude_src_valid, mm->source, mm, 0)) {
+    if (mm->nav.altitude_source != NAV_ALT_INVALID && accept_data(a, &a->nav_altitude_src_valid, mm->source, mm, 0)) {
         a->nav_altitude_src = mm->nav.altitude_source;
     }
 
-    if (mm->nav.heading_valid && accept_data(&a->nav_heading_valid, mm->source, mm, 0)) {
+    if (mm->nav.heading_valid && accept_data(a, &a->nav_heading_valid, mm->source, mm, 0)) {
         a->meta.nav_heading = mm->nav.heading;
     }
 
-    if (mm->nav.modes_valid && accept_data(&a->nav_modes_valid, mm->source, mm, 0)) {
+    if (mm->nav.modes_valid && accept_data(a, &a->nav_modes_valid, mm->source, mm, 0)) {
         if (mm->nav.modes & NAV_MODE_AUTOPILOT) {
             a->nav_modes.autopilot = true;
         }
@@ -1298,20 +2083,20 @@ struct aircraft *trackUpdateFromMessage(struct modesMessage *mm) {
         }
     }
 
-    if (mm->nav.qnh_valid && accept_data(&a->nav_qnh_valid, mm->source, mm, 0)) {
+    if (mm->nav.qnh_valid && accept_data(a, &a->nav_qnh_valid, mm->source, mm, 0)) {
         a->meta.nav_qnh = mm->nav.qnh;
     }
 
-    if (mm->alert_valid && accept_data(&a->alert_valid, mm->source, mm, 0)) {
+    if (mm->alert_valid && accept_data(a, &a->alert_valid, mm->source, mm, 0)) {
         a->meta.alert = mm->alert;
     }
 
-    if (mm->spi_valid && accept_data(&a->spi_valid, mm->source, mm, 0)) {
+    if (mm->spi_valid && accept_data(a, &a->spi_valid, mm->source, mm, 0)) {
         a->meta.spi = mm->spi;
     }
 
     // CPR, even
-    if (mm->cpr_valid && !mm->cpr_odd && accept_data(&a->cpr_even_valid, mm->source, mm, 1)) {
+    if (mm->cpr_valid && !mm->cpr_odd && accept_data(a, &a->cpr_even_valid, mm->source, mm, 1)) {
         a->cpr_even_type = mm->cpr_type;
         a->cpr_even_lat = mm->cpr_lat;
         a->cpr_even_lon = mm->cpr_lon;
@@ -1320,7 +2105,7 @@ struct aircraft *trackUpdateFromMessage(struct modesMessage *mm) {
     }
 
     // CPR, odd
-    if (mm->cpr_valid && mm->cpr_odd && accept_data(&a->cpr_odd_valid, mm->source, mm, 1)) {
+    if (mm->cpr_valid && mm->cpr_odd && accept_data(a, &a->cpr_odd_valid, mm->source, mm, 1)) {
         a->cpr_odd_type = mm->cpr_type;
         a->cpr_odd_lat = mm->cpr_lat;
         a->cpr_odd_lon = mm->cpr_lon;
@@ -1328,42 +2113,42 @@ struct aircraft *trackUpdateFromMessage(struct modesMessage *mm) {
         cpr_new = 1;
     }
 
-    if (mm->accuracy.sda_valid && accept_data(&a->sda_valid, mm->source, mm, 0)) {
+    if (mm->accuracy.sda_valid && accept_data(a, &a->sda_valid, mm->source, mm, 0)) {
         a->meta.sda = mm->accuracy.sda;
     }
 
-    if (mm->accuracy.nic_a_valid && accept_data(&a->nic_a_valid, mm->source, mm, 0)) {
+    if (mm->accuracy.nic_a_valid && accept_data(a, &a->nic_a_valid, mm->source, mm, 0)) {
         a->nic_a = mm->accuracy.nic_a;
     }
 
-    if (mm->accuracy.nic_c_valid && accept_data(&a->nic_c_valid, mm->source, mm, 0)) {
+    if (mm->accuracy.nic_c_valid && accept_data(a, &a->nic_c_valid, mm->source, mm, 0)) {
         a->nic_c = mm->accuracy.nic_c;
     }
 
-    if (mm->accuracy.nic_baro_valid && accept_data(&a->nic_baro_valid, mm->source, mm, 0)) {
+    if (mm->accuracy.nic_baro_valid && accept_data(a, &a->nic_baro_valid, mm->source, mm, 0)) {
         a->meta.nic_baro = mm->accuracy.nic_baro;
     }
 
-    if (mm->accuracy.nac_p_valid && accept_data(&a->nac_p_valid, mm->source, mm, 0)) {
+    if (mm->accuracy.nac_p_valid && accept_data(a, &a->nac_p_valid, mm->source, mm, 0)) {
         a->meta.nac_p = mm->accuracy.nac_p;
     }
 
-    if (mm->accuracy.nac_v_valid && accept_data(&a->nac_v_valid, mm->source, mm, 0)) {
+    if (mm->accuracy.nac_v_valid && accept_data(a, &a->nac_v_valid, mm->source, mm, 0)) {
         a->meta.nac_v = mm->accuracy.nac_v;
     }
 
-    if (mm->accuracy.sil_type != AIRCRAFT_META__SIL_TYPE__SIL_INVALID && accept_data(&a->sil_valid, mm->source, mm, 0)) {
+    if (mm->accuracy.sil_type != AIRCRAFT_META__SIL_TYPE__SIL_INVALID && accept_data(a, &a->sil_valid, mm->source, mm, 0)) {
         a->meta.sil = mm->accuracy.sil;
         if (a->meta.sil_type == AIRCRAFT_META__SIL_TYPE__SIL_INVALID || mm->accuracy.sil_type != AIRCRAFT_META__SIL_TYPE__SIL_UNKNOWN) {
             a->meta.sil_type = mm->accuracy.sil_type;
         }
     }
 
-    if (mm->accuracy.gva_valid && accept_data(&a->gva_valid, mm->source, mm, 0)) {
+    if (mm->accuracy.gva_valid && accept_data(a, &a->gva_valid, mm->source, mm, 0)) {
         a->meta.gva = mm->accuracy.gva;
     }
 
-    if (mm->accuracy.sda_valid && accept_data(&a->sda_valid, mm->source, mm, 0)) {
+    if (mm->accuracy.sda_valid && accept_data(a, &a->sda_valid, mm->source, mm, 0)) {
         a->meta.sda = mm->accuracy.sda;
     }
 
@@ -1383,9 +2168,10 @@ struct aircraft *trackUpdateFromMessage(struct modesMessage *mm) {
     }
 
     if (mm->sbs_in && mm->decoded_lat != 0 && mm->decoded_lon != 0) {
-        if (accept_data(&a->position_valid, mm->source, mm, 0)) {
+        if (accept_data(a, &a->position_valid, mm->source, mm, 0)) {
             a->meta.lat = mm->decoded_lat;
             a->meta.lon = mm->decoded_lon;
+            gridUpdate(a);
 
             a->pos_reliable_odd = 2;
             a->pos_reliable_even = 2;
@@ -1395,10 +2181,13 @@ struct aircraft *trackUpdateFromMessage(struct modesMessage *mm) {
 
     if (mm->msgtype == 11 && mm->IID == 0 && mm->correctedbits == 0 && messageNow() > a->next_reduce_forward_DF11) {
 
-        a->next_reduce_forward_DF11 = messageNow() + Modes.net_output_beast_reduce_interval * 4;
+        a->next_reduce_forward_DF11 = messageNow() + reduceInterval(a) * 4;
         mm->reduce_forward = 1;
     }
 
+    if (Modes.mode_ac)
+        modeACIndexUpdate(a);
+
     return (a);
 }
 
@@ -1409,64 +2198,66 @@ struct aircraft *trackUpdateFromMessage(struct modesMessage *mm) {
 // Periodically match up mode A/C results with mode S results
 
 static void trackMatchAC(uint64_t now) {
-    // clear match flags
-    for (unsigned i = 0; i < 4096; ++i) {
-        modeAC_match[i] = 0;
-    }
-
-    // scan aircraft list, look for matches
-    for (int j = 0; j < AIRCRAFTS_BUCKETS; j++) {
-        for (struct aircraft *a = Modes.aircrafts[j]; a; a = a->next) {
-            if ((now - a->meta.seen) > 5000) {
+    // clear the matches from last time
+    for (unsigned k = 0; k < modeAC_matched_count; ++k)
+        modeAC_match[modeAC_matched[k]] = 0;
+    modeAC_matched_count = 0;
+
+    // look for aircraft matching the codes that got enough replies
+    for (unsigned k = 0; k < modeAC_live_count; ++k) {
+        unsigned i = modeAC_live[k];
+        int modeC = modeAToModeC(indexToModeA(i));
+        unsigned hits = 0;
+        uint32_t addr = 0;
+
+        // match on Mode A
+        for (struct aircraft *a = modeAC_squawk_index[i], *next; a; a = next) {
+            next = a->modeac_squawk.next;
+            if ((now - a->meta.seen) > 5000 || !trackDataValid(&a->squawk_valid)) {
+                // drop it until its next message puts it back
+                aircraftIndexMove(modeAC_squawk_index, LIST_SQUAWK, a, 0);
                 continue;
             }
+            a->modeA_hit = 1;
+            addr = a->meta.addr;
+            ++hits;
+        }
 
-            // match on Mode A
-            if (trackDataValid(&a->squawk_valid)) {
-                unsigned i = modeAToIndex(a->meta.squawk);
-                if ((modeAC_count[i] - modeAC_lastcount[i]) >= TRACK_MODEAC_MIN_MESSAGES) {
-                    a->modeA_hit = 1;
-                    modeAC_match[i] = (modeAC_match[i] ? 0xFFFFFFFF : a->meta.addr);
-                }
-            }
-
-            // match on Mode C (+/- 100ft)
-            if (trackDataValid(&a->altitude_baro_valid)) {
-                int modeC = (a->meta.alt_baro + 49) / 100;
-
-                unsigned modeA = modeCToModeA(modeC);
-                unsigned i = modeAToIndex(modeA);
-                if (modeA && (modeAC_count[i] - modeAC_lastcount[i]) >= TRACK_MODEAC_MIN_MESSAGES) {
-                    a->modeC_hit = 1;
-                    modeAC_match[i] = (modeAC_match[i] ? 0xFFFFFFFF : a->meta.addr);
-                }
-
-                modeA = modeCToModeA(modeC + 1);
-                i = modeAToIndex(modeA);
-                if (modeA && (modeAC_count[i] - modeAC_lastcount[i]) >= TRACK_MODEAC_MIN_MESSAGES) {
-                    a->modeC_hit = 1;
-                    modeAC_match[i] = (modeAC_match[i] ? 0xFFFFFFFF : a->meta.addr);
-                }
-
-                modeA = modeCToModeA(modeC - 1);
-                i = modeAToIndex(modeA);
-                if (modeA && (modeAC_count[i] - modeAC_lastcount[i]) >= TRACK_MODEAC_MIN_MESSAGES) {
+        // match on Mode C (+/- 100ft)
+        if (modeC != INVALID_ALTITUDE) {
+            for (int band = modeC - 1 + MODEAC_ALT_OFFSET; band <= modeC + 1 + MODEAC_ALT_OFFSET; ++band) {
+                if (band < 0 || band >= MODEAC_ALT_BANDS)
+                    continue;
+                for (struct aircraft *a = modeAC_alt_index[band], *next; a; a = next) {
+                    next = a->modeac_alt.next;
+                    if ((now - a->meta.seen) > 5000 || !trackDataValid(&a->altitude_baro_valid)) {
+                        aircraftIndexMove(modeAC_alt_index, LIST_ALTITUDE, a, 0);
+                        continue;
+                    }
                     a->modeC_hit = 1;
-                    modeAC_match[i] = (modeAC_match[i] ? 0xFFFFFFFF : a->meta.addr);
+                    addr = a->meta.addr;
+                    ++hits;
                 }
             }
         }
+
+        if (hits) {
+            modeAC_match[i] = (hits > 1 ? 0xFFFFFFFF : addr);
+            modeAC_matched[modeAC_matched_count++] = i;
+        }
     }
+    modeAC_live_count = 0;
 
     // reset counts for next time
-    for (unsigned i = 0; i < 4096; ++i) {
-        if (!modeAC_count[i])
-            continue;
+    for (unsigned k = modeAC_active_count; k-- > 0;) {
+        unsigned i = modeAC_active[k];
 
         if ((modeAC_count[i] - modeAC_lastcount[i]) < TRACK_MODEAC_MIN_MESSAGES) {
             if (++modeAC_age[i] > 15) {
                 // not heard from for a while, clear it out
                 modeAC_lastcount[i] = modeAC_count[i] = modeAC_age[i] = 0;
+                modeAC_active[k] = modeAC_active[--modeAC_active_count];
+                continue;
             }
         } else {
             // this one is live
@@ -1488,88 +2279,180 @@ static void trackMatchAC(uint64_t now) {
 //=========================================================================
 //
 // If we don't receive new nessages within TRACK_AIRCRAFT_TTL
-// we remove the aircraft from the list.
+// we remove the aircraft from the table.
 //
 
-static void trackRemoveStaleAircraft(uint64_t now) {
-    for (int j = 0; j < AIRCRAFTS_BUCKETS; j++) {
-        struct aircraft *a = Modes.aircrafts[j];
-        struct aircraft *prev = NULL;
+// Expire the data of an aircraft that came due, then either remove it or
+// schedule it again for its next deadline
 
-        while (a) {
-            if ((now - a->meta.seen) > TRACK_AIRCRAFT_TTL ||
-                    (a->meta.messages == 1 && (now - a->meta.seen) > TRACK_AIRCRAFT_ONEHIT_TTL)) {
-                // Count aircraft where we saw only one message before reaping them.
-                // These are likely to be due to messages with bad addresses.
-                if (a->meta.messages == 1)
-                    Modes.stats_current.single_message_aircraft++;
-
-                // Remove the element from the linked list, with care
-                // if we are removing the first element
-                if (!prev) {
-                    Modes.aircrafts[j] = a->next;
-                    free(a);
-                    a = Modes.aircrafts[j];
-                } else {
-                    prev->next = a->next;
-                    free(a);
-                    a = prev->next;
-                }
-            } else {
+static void trackExpireAircraft(struct aircraft *a, uint64_t now) {
+    struct aircraft_slot *slot = indexFind(a->meta.addr);
+    struct aircraft_entry *e = &Modes.aircraft_table[slot->pos];
+    uint64_t deadline;
+
+    if ((now - e->seen) > TRACK_AIRCRAFT_TTL ||
+            (e->messages == 1 && (now - e->seen) > TRACK_AIRCRAFT_ONEHIT_TTL)) {
+        // Count aircraft where we saw only one message before reaping them.
+        // These are likely to be due to messages with bad addresses.
+        if (e->messages == 1)
+            Modes.stats_current.single_message_aircraft++;
+
+        trackRemoveEntry(slot->pos);
+        return;
+    }
 
-#define EXPIRE(_f) do { if (a->_f##_valid.source != SOURCE_INVALID && now >= a->_f##_valid.expires) { a->_f##_valid.source = SOURCE_INVALID; } } while (0)
-                EXPIRE(callsign);
-                EXPIRE(altitude_baro);
-                EXPIRE(altitude_geom);
-                EXPIRE(geom_delta);
-                EXPIRE(gs);
-                EXPIRE(ias);
-                EXPIRE(tas);
-                EXPIRE(mach);
-                EXPIRE(track);
-                EXPIRE(track_rate);
-                EXPIRE(roll);
-                EXPIRE(mag_heading);
-                EXPIRE(true_heading);
-                EXPIRE(baro_rate);
-                EXPIRE(geom_rate);
-                EXPIRE(squawk);
-                EXPIRE(airground);
-                EXPIRE(nav_qnh);
-                EXPIRE(nav_altitude_mcp);
-                EXPIRE(nav_altitude_fms);
-                EXPIRE(nav_altitude_src);
-                EXPIRE(nav_heading);
-                EXPIRE(nav_modes);
-                EXPIRE(cpr_odd);
-                EXPIRE(cpr_even);
-                EXPIRE(position);
-                EXPIRE(nic_a);
-                EXPIRE(nic_c);
-                EXPIRE(nic_baro);
-                EXPIRE(nac_p);
-                EXPIRE(sil);
-                EXPIRE(gva);
-                EXPIRE(sda);
+    deadline = e->seen + (e->messages == 1 ? TRACK_AIRCRAFT_ONEHIT_TTL : TRACK_AIRCRAFT_TTL) + 1;
+
+#define EXPIRE(_f) do { if (a->_f##_valid.source != SOURCE_INVALID) { if (now >= a->_f##_valid.expires) { a->_f##_valid.source = SOURCE_INVALID; trackFieldChanged(a, &a->_f##_valid); } else if (a->_f##_valid.expires < deadline) { deadline = a->_f##_valid.expires; } } } while (0)
+    EXPIRE(callsign);
+    EXPIRE(altitude_baro);
+    EXPIRE(altitude_geom);
+    EXPIRE(geom_delta);
+    EXPIRE(gs);
+    EXPIRE(ias);
+    EXPIRE(tas);
+    EXPIRE(mach);
+    EXPIRE(track);
+    EXPIRE(track_rate);
+    EXPIRE(roll);
+    EXPIRE(mag_heading);
+    EXPIRE(true_heading);
+    EXPIRE(baro_rate);
+    EXPIRE(geom_rate);
+    EXPIRE(squawk);
+    EXPIRE(airground);
+    EXPIRE(nav_qnh);
+    EXPIRE(nav_altitude_mcp);
+    EXPIRE(nav_altitude_fms);
+    EXPIRE(nav_altitude_src);
+    EXPIRE(nav_heading);
+    EXPIRE(nav_modes);
+    EXPIRE(cpr_odd);
+    EXPIRE(cpr_even);
+    EXPIRE(position);
+    EXPIRE(nic_a);
+    EXPIRE(nic_c);
+    EXPIRE(nic_baro);
+    EXPIRE(nac_p);
+    EXPIRE(sil);
+    EXPIRE(gva);
+    EXPIRE(sda);
 #undef EXPIRE
 
-                // reset position reliability when the position has expired
-                if (a->position_valid.source == SOURCE_INVALID) {
-                    a->pos_reliable_odd = 0;
-                    a->pos_reliable_even = 0;
-                }
+    // reset position reliability when the position has expired
+    if (a->position_valid.source == SOURCE_INVALID) {
+        a->pos_reliable_odd = 0;
+        a->pos_reliable_even = 0;
+    }
 
-                if (a->altitude_baro_valid.source == SOURCE_INVALID)
-                    a->altitude_baro_reliable = 0;
+    if (a->altitude_baro_valid.source == SOURCE_INVALID)
+        a->altitude_baro_reliable = 0;
 
-                prev = a;
-                a = a->next;
-            }
+    trackScheduleExpiry(a, deadline);
+}
+
+static void trackRemoveStaleAircraft(uint64_t now) {
+    uint64_t second = now / 1000;
+    uint64_t from = expire_wheel_second + 1;
+
+    if (!expire_wheel_second || second < expire_wheel_second) {
+        // first call or the clock went backwards, look at everything now
+        from = second - TRACK_EXPIRE_SLOTS + 1;
+    } else if (second - expire_wheel_second > TRACK_EXPIRE_SLOTS) {
+        from = second - TRACK_EXPIRE_SLOTS + 1; // every slot is due
+    }
+
+    // aircraft put back in the wheel from here on go after this second
+    expire_wheel_second = second;
+    Modes.track_generation++;
+
+    for (uint64_t s = from; s <= second; ++s) {
+        struct aircraft **slot = &expire_wheel[s & (TRACK_EXPIRE_SLOTS - 1)];
+        struct aircraft *a = *slot;
+
+        *slot = NULL;
+        while (a) {
+            struct aircraft *next = a->next;
+            trackExpireAircraft(a, now);
+            a = next;
         }
     }
 }
 
 
+//
+// --net-beast-reduce-budget: once a second, measure the BeastReduce output
+// against the budget and spread it over the aircraft. A common level scales
+// the interval of all of them, up while the output is over the budget and
+// slowly back down while it is well under; within that, aircraft new to the
+// receiver and those whose position hasn't gone out for a while get the
+// shortest interval, manoeuvring ones a medium one and the rest the longest.
+// The position is never held back further than global CPR allows.
+//
+
+#define REDUCE_NEW_MS 30000 // aircraft this young are new
+#define REDUCE_STALE_MS 15000 // a position this old downstream is stale
+#define REDUCE_MAX_INTERVAL 15000
+
+static reduce_priority_t reducePriority(struct aircraft *a, uint64_t now) {
+    reduce_priority_t priority = REDUCE_PRIORITY_CRUISE;
+    int track = a->meta.track;
+    int altitude = a->meta.alt_baro;
+
+    if (trackDataValid(&a->track_valid)) {
+        int turn = abs((track - a->reduce_track + 540) % 360 - 180);
+        if (turn >= 2 || (trackDataValid(&a->track_rate_valid) && fabs(a->meta.track_rate) >= 1))
+            priority = REDUCE_PRIORITY_MANOEUVRE;
+    }
+    if (trackDataValid(&a->altitude_baro_valid)) {
+        if (abs(altitude - a->reduce_altitude) >= 100 || (trackDataValid(&a->baro_rate_valid) && abs(a->meta.baro_rate) >= 500))
+            priority = REDUCE_PRIORITY_MANOEUVRE;
+    }
+    a->reduce_track = track;
+    a->reduce_altitude = altitude;
+
+    if (trackDataValid(&a->position_valid) && now > a->reduce_position_forwarded + REDUCE_STALE_MS)
+        priority = REDUCE_PRIORITY_STALE;
+    if (!a->reduce_interval || now < a->first_message.sysTimestampMsg + REDUCE_NEW_MS)
+        priority = REDUCE_PRIORITY_NEW;
+    return priority;
+}
+
+static void trackReduceSchedule(uint64_t now) {
+    static const double weight[] = { 8, 8, 3, 1 }; // by reduce_priority_t
+    static double level = 1;
+    static uint64_t last, last_bytes;
+    double budget = Modes.net_output_beast_reduce_budget;
+    double base = Modes.net_output_beast_reduce_interval ? Modes.net_output_beast_reduce_interval : 100;
+
+    if (last && now > last) {
+        double rate = (Modes.beast_reduce_out.bytes - last_bytes) * 1000.0 / (now - last);
+        if (rate > 0.9 * budget)
+            level *= fmin(4, rate / (0.8 * budget));
+        else if (rate < 0.7 * budget)
+            level /= 1.25;
+        level = fmax(1, fmin(level, REDUCE_MAX_INTERVAL / base));
+    }
+    last = now;
+    last_bytes = Modes.beast_reduce_out.bytes;
+
+    for (uint32_t j = 0; j < Modes.aircraft_count; j++) {
+        struct aircraft *a = Modes.aircraft_table[j].a;
+        a->reduce_priority = reducePriority(a, now);
+        uint64_t interval = fmax(base, fmin(base * level / weight[a->reduce_priority], REDUCE_MAX_INTERVAL));
+        a->reduce_interval = interval;
+
+        // a shorter interval takes effect now, not when the last one ends
+        data_validity *pulled[] = { &a->cpr_odd_valid, &a->cpr_even_valid, &a->altitude_baro_valid, &a->gs_valid, &a->track_valid };
+        for (unsigned k = 0; k < sizeof (pulled) / sizeof (pulled[0]); k++) {
+            if (pulled[k]->next_reduce_forward > now + interval)
+                pulled[k]->next_reduce_forward = now + interval;
+        }
+        if (a->next_reduce_forward_DF11 > now + interval * 4)
+            a->next_reduce_forward_DF11 = now + interval * 4;
+    }
+}
+
 //
 // Entry point for periodic updates
 //
@@ -1582,8 +2465,13 @@ void trackPeriodicUpdate() {
     if (now >= next_update) {
         next_update = now + 1000;
         trackRemoveStaleAircraft(now);
+        if (aircraft_pool_used > Modes.stats_current.aircraft_pool_peak)
+            Modes.stats_current.aircraft_pool_peak = aircraft_pool_used;
+        Modes.stats_current.aircraft_pool_size = aircraft_slab_count * AIRCRAFT_POOL_SLAB;
         if (Modes.mode_ac) {
             trackMatchAC(now);
         }
+        if (Modes.net_output_beast_reduce_budget)
+            trackReduceSchedule(now);
     }
 }
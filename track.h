@@ -82,10 +82,74 @@ typedef struct {
     uint64_t stale; /* when it goes stale */
     uint64_t expires; /* when it expires */
     uint64_t next_reduce_forward; /* when to next forward the data for reduced beast output */
+    uint64_t generation; /* Modes.track_generation when it was last updated or expired */
     datasource_t source; /* where the data came from */
     uint32_t padding;
 } data_validity;
 
+/* One bit per data_validity of struct aircraft in the mask returned by
+ * trackChangedFields(), test with TRACK_CHANGED(CALLSIGN) and so on
+ */
+enum track_field {
+    TRACK_FIELD_CALLSIGN,
+    TRACK_FIELD_ALTITUDE_BARO,
+    TRACK_FIELD_ALTITUDE_GEOM,
+    TRACK_FIELD_GEOM_DELTA,
+    TRACK_FIELD_GS,
+    TRACK_FIELD_IAS,
+    TRACK_FIELD_TAS,
+    TRACK_FIELD_MACH,
+    TRACK_FIELD_TRACK,
+    TRACK_FIELD_TRACK_RATE,
+    TRACK_FIELD_ROLL,
+    TRACK_FIELD_MAG_HEADING,
+    TRACK_FIELD_TRUE_HEADING,
+    TRACK_FIELD_BARO_RATE,
+    TRACK_FIELD_GEOM_RATE,
+    TRACK_FIELD_NIC_A,
+    TRACK_FIELD_NIC_C,
+    TRACK_FIELD_NIC_BARO,
+    TRACK_FIELD_NAC_P,
+    TRACK_FIELD_NAC_V,
+    TRACK_FIELD_SIL,
+    TRACK_FIELD_GVA,
+    TRACK_FIELD_SDA,
+    TRACK_FIELD_SQUAWK,
+    TRACK_FIELD_EMERGENCY,
+    TRACK_FIELD_AIRGROUND,
+    TRACK_FIELD_NAV_QNH,
+    TRACK_FIELD_NAV_ALTITUDE_MCP,
+    TRACK_FIELD_NAV_ALTITUDE_FMS,
+    TRACK_FIELD_NAV_ALTITUDE_SRC,
+    TRACK_FIELD_NAV_HEADING,
+    TRACK_FIELD_NAV_MODES,
+    TRACK_FIELD_CPR_ODD,
+    TRACK_FIELD_CPR_EVEN,
+    TRACK_FIELD_POSITION,
+    TRACK_FIELD_ALERT,
+    TRACK_FIELD_SPI,
+    TRACK_FIELD_COUNT
+};
+
+#define TRACK_CHANGED(field) (UINT64_C(1) << TRACK_FIELD_##field)
+
+// How much of the --net-beast-reduce-budget an aircraft gets, most first;
+// see trackReduceSchedule()
+typedef enum {
+    REDUCE_PRIORITY_NEW = 0, // appeared recently, or not scheduled yet
+    REDUCE_PRIORITY_STALE, // its position has not been forwarded for a while
+    REDUCE_PRIORITY_MANOEUVRE, // turning, climbing or descending
+    REDUCE_PRIORITY_CRUISE
+} reduce_priority_t;
+
+/* Link in one of the aircraft indexes: Mode A/C matching (see trackMatchAC())
+ * and the position grid */
+struct aircraft_link {
+    struct aircraft *next;
+    struct aircraft *prev;
+    unsigned key; // index bucket + 1, 0 while not indexed
+};
+
 /* Structure used to describe the state of one tracked aircraft */
 struct aircraft {
     // Aircraft metadata that is shared with webapp.
@@ -95,6 +159,12 @@ struct aircraft {
     // Remaining variables are all readsb internal use.
     uint64_t fatsv_last_emitted; // time (millis) aircraft was last FA emitted
     uint64_t fatsv_last_force_emit; // time (millis) we last emitted only-on-change data
+    uint64_t fatsv_generation; // generation of the aircraft when it was last FA emitted
+    uint64_t fatsv_due; // when the FATSV output next looks at it, see trackScheduleFatsv()
+    uint32_t fatsv_slot; // place in the FATSV due queue + 1, 0 while not queued
+    uint32_t view_slot; // place in the interactive view + 1, 0 while not in it
+    uint64_t wind_generation; // generation of the aircraft when compute_wind() last ran
+    heading_type_t wind_heading_type; // heading_type at that time
     double signalLevel[8]; // Last 8 Signal Amplitudes
     int signalNext; // next index of signalLevel to use
     int altitude_baro_reliable;
@@ -108,6 +178,12 @@ struct aircraft {
     unsigned cpr_even_nic;
     unsigned cpr_even_rc;
     uint64_t next_reduce_forward_DF11;
+    // BeastReduce scheduling with --net-beast-reduce-budget
+    uint32_t reduce_interval; // chosen by trackReduceSchedule(), 0 for --net-beast-reduce-interval
+    reduce_priority_t reduce_priority;
+    uint64_t reduce_position_forwarded; // when a position message was last forwarded
+    int reduce_track; // track and altitude at the last schedule, to see it manoeuvre
+    int reduce_altitude;
     data_validity callsign_valid;
     data_validity altitude_baro_valid;
     data_validity altitude_geom_valid;
@@ -158,13 +234,33 @@ struct aircraft {
     int adsb_version; // ADS-B version (from ADS-B operational status); -1 means no ADS-B messages seen
     int adsr_version; // As above, for ADS-R messages
     int tisb_version; // As above, for TIS-B messages
+    struct commb_history commb_history; // Comm-B registers recently replied with
     heading_type_t adsb_hrd; // Heading Reference Direction setting (from ADS-B operational status)
     heading_type_t adsb_tah; // Track Angle / Heading setting (from ADS-B operational status)
     heading_type_t heading_type; // Type of indicated heading, mag or true
     unsigned nic_a : 1; // NIC supplement A from opstatus
     unsigned nic_c : 1; // NIC supplement C from opstatus
+    uint64_t generation; // Modes.track_generation of the last change, see trackChangedFields()
+    struct aircraft_link changed; // Modes.aircraft_changed list
     int modeA_hit; // did our squawk match a possible mode A reply in the last check period?
     int modeC_hit; // did our altitude match a possible mode C reply in the last check period?
+    struct aircraft_link modeac_squawk; // Mode A/C matching index by squawk
+    struct aircraft_link modeac_alt; // Mode A/C matching index by altitude
+    struct aircraft_link grid; // Position grid cell
+    // The record last written for the aircraft by the VRS output, see writeVRS()
+    uint64_t vrs_generation; // its generation and
+    uint64_t vrs_messages; // message count then
+    uint64_t vrs_expires; // when the first data valid then and shown expires
+    uint32_t vrs_round; // round of the arena the record is kept in
+    uint32_t vrs_offset; // its place there
+    uint32_t vrs_len; // 0 without a record
+    // The state last sent for the aircraft by the protocol buffer stream
+    // output, see writePbStream(); its pointers are set when it is used
+    AircraftMeta pb_sent;
+    AircraftMeta__NavModes pb_sent_nav_modes;
+    AircraftMeta__ValidSource pb_sent_valid_source;
+    char pb_sent_callsign[12];
+    bool pb_streamed; // in the collection the clients were last sent
     int fatsv_emitted_altitude_baro; // last FA emitted altitude
     int fatsv_emitted_altitude_geom; //      -"-         GNSS altitude
     int fatsv_emitted_baro_rate; //      -"-         barometric rate
@@ -201,7 +297,26 @@ struct aircraft {
     unsigned fatsv_emitted_nic_baro; //      -"-         NICbaro
     AircraftMeta__Emergency fatsv_emitted_emergency; //      -"-         emergency/priority status
     struct modesMessage first_message; // A copy of the first message we received for this aircraft.
-    struct aircraft *next; // Next aircraft in our linked list
+    struct aircraft *next; // Next aircraft in the same expiry slot, or next free record in the pool
+};
+
+/* Tracked aircraft live in a dense array of small entries holding the fields
+ * every message and every table scan looks at, with the full struct aircraft
+ * only behind a pointer. An open-addressing index maps an address to its
+ * entry. Entries move when others are removed, so don't keep pointers or
+ * positions across a call to trackPeriodicUpdate().
+ */
+struct aircraft_entry {
+    uint32_t addr; // same as a->meta.addr
+    uint32_t messages; // a->meta.messages, saturated at UINT32_MAX
+    uint64_t seen; // same as a->meta.seen
+    struct aircraft *a;
+};
+
+/* One slot of the address index, addr 0 marks an empty slot */
+struct aircraft_slot {
+    uint32_t addr;
+    uint32_t pos; // position in Modes.aircraft_table
 };
 
 /* Mode A/C tracking is done separately, not via the aircraft list,
@@ -240,9 +355,61 @@ trackDataAge(const data_validity *v) {
 struct modesMessage;
 struct aircraft *trackUpdateFromMessage(struct modesMessage *mm);
 
+/* Return the aircraft with the given address, or NULL if it is not tracked */
+struct aircraft *trackFindAircraft(uint32_t addr);
+
 /* Call periodically */
 void trackPeriodicUpdate();
 
+/* Write all tracked aircraft to a state file, and add those saved there that
+ * haven't timed out by now back to the table (see state.c); trackRestore()
+ * returns how many it added.
+ */
+void trackSave(FILE *f);
+uint32_t trackRestore(const uint8_t *p, size_t len, uint64_t now);
+
+/* Free all tracked aircraft and the aircraft table */
+void trackCleanup(void);
+
+/* Every change to an aircraft is tagged with Modes.track_generation, which
+ * only increases. Modes.aircraft_changed lists all aircraft, most recently
+ * changed first, so a consumer that remembers the generation it last looked
+ * at (its cursor) can visit just the aircraft changed since then:
+ *
+ *   for (a = Modes.aircraft_changed; a && a->generation > cursor; a = a->changed.next)
+ *
+ * and then set its cursor to Modes.track_generation. trackChangedFields()
+ * returns the TRACK_CHANGED() bits of the fields updated or expired after
+ * the given generation.
+ */
+uint64_t trackChangedFields(const struct aircraft *a, uint64_t since);
+
+/* The FATSV output keeps aircraft with changes to report in a queue ordered
+ * by when they are next due: trackScheduleFatsv() queues an aircraft (or
+ * moves it if already queued) and trackNextFatsvDue() takes out the first one
+ * due by now, NULL if there is none. Aircraft leave the queue when removed.
+ */
+void trackScheduleFatsv(struct aircraft *a, uint64_t due);
+struct aircraft *trackNextFatsvDue(uint64_t now);
+
+/* Is lat, lon inside the box? A box with lon_min > lon_max crosses the antimeridian */
+static inline bool
+trackBoxContains(double lat_min, double lon_min, double lat_max, double lon_max, double lat, double lon) {
+    if (lat < lat_min || lat > lat_max)
+        return false;
+    if (lon_min <= lon_max)
+        return (lon >= lon_min && lon <= lon_max);
+    return (lon >= lon_min || lon <= lon_max);
+}
+
+/* Call fn for every aircraft with a valid position inside the box (see
+ * trackBoxContains()), or within radius metres of lat, lon. fn must not
+ * add or remove aircraft.
+ */
+typedef void (*track_aircraft_fn)(struct aircraft *a, void *arg);
+void trackAircraftInBox(double lat_min, double lon_min, double lat_max, double lon_max, track_aircraft_fn fn, void *arg);
+void trackAircraftInRadius(double lat, double lon, double radius, track_aircraft_fn fn, void *arg);
+
 /* Convert from a (hex) mode A value to a 0-4095 index */
 static inline unsigned
 modeAToIndex(unsigned modeA) {
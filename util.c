@@ -59,7 +59,7 @@
 uint64_t _messageNow = 0;
 
 uint64_t mstime(void) {
-    if (Modes.sdr_type == SDR_IFILE) {
+    if (Modes.sdr_type == SDR_IFILE || Modes.sdr_type == SDR_REPLAY) {
         return Modes.ifile_now;
     }
 
@@ -72,6 +72,13 @@ uint64_t mstime(void) {
     return mst;
 }
 
+uint64_t microtime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return ((uint64_t) tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
 int64_t receiveclock_ns_elapsed(uint64_t t1, uint64_t t2) {
     return (t2 - t1) * 1000U / 12U;
 }
@@ -131,4 +138,158 @@ void set_thread_name(const char *name) {
 #else
     MODES_NOTUSED(name);
 #endif
-}
\ No newline at end of file
+}
+//
+// Thread placement. Threads inherit the CPU affinity of the thread that
+// creates them, so each one is moved by thread_place() either to the CPUs
+// given for its role with --cpu-affinity or back to those readsb was started
+// with, instead of keeping whatever the main thread was pinned to.
+//
+
+static const char *thread_role_names[THREAD_ROLE_COUNT] = {
+    [THREAD_MAIN] = "main",
+    [THREAD_READER] = "reader",
+    [THREAD_DEMOD] = "demod",
+    [THREAD_NET_IO] = "net-io",
+    [THREAD_DECODE] = "decode",
+    [THREAD_WRITER] = "writer",
+};
+
+#define THREAD_PLACED_MAX 64
+
+struct thread_placement {
+    thread_role_t role;
+    cpu_set_t cpus; // effective affinity
+    int policy;
+    int priority;
+};
+
+static cpu_set_t thread_startup_cpus;
+static bool thread_startup_known;
+static struct thread_placement thread_placed[THREAD_PLACED_MAX];
+static unsigned thread_placed_count;
+
+// Parse a list like 0-3,8,10-11 into set
+static bool parse_cpu_list(const char *s, cpu_set_t *set) {
+    CPU_ZERO(set);
+    while (*s) {
+        char *end;
+        long first = strtol(s, &end, 10), last = first;
+
+        if (end == s || first < 0)
+            return false;
+        if (*end == '-') {
+            s = end + 1;
+            last = strtol(s, &end, 10);
+            if (end == s || last < first)
+                return false;
+        }
+        if (last >= CPU_SETSIZE)
+            return false;
+        for (long cpu = first; cpu <= last; cpu++)
+            CPU_SET(cpu, set);
+        if (*end == ',')
+            end++;
+        else if (*end)
+            return false;
+        s = end;
+    }
+    return CPU_COUNT(set) > 0;
+}
+
+// The inverse, truncated to fit len
+static void format_cpu_list(const cpu_set_t *set, char *buf, size_t len) {
+    size_t used = 0;
+
+    buf[0] = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE && used < len; cpu++) {
+        int last = cpu;
+
+        if (!CPU_ISSET(cpu, set))
+            continue;
+        while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, set))
+            last++;
+        if (last > cpu)
+            used += snprintf(buf + used, len - used, "%s%d-%d", used ? "," : "", cpu, last);
+        else
+            used += snprintf(buf + used, len - used, "%s%d", used ? "," : "", cpu);
+        cpu = last;
+    }
+}
+
+bool thread_parse_affinity(const char *arg) {
+    const char *colon = strchr(arg, ':');
+
+    if (!colon)
+        return false;
+    for (int role = 0; role < THREAD_ROLE_COUNT; role++) {
+        if (strlen(thread_role_names[role]) == (size_t) (colon - arg) && !strncmp(arg, thread_role_names[role], colon - arg))
+            return parse_cpu_list(colon + 1, &Modes.thread_cpus[role]);
+    }
+    return false;
+}
+
+void thread_place(pthread_t thread, thread_role_t role) {
+    const cpu_set_t *cpus = &Modes.thread_cpus[role];
+    struct sched_param param;
+    int err, policy;
+
+    if (!thread_startup_known) {
+        // placing starts from the main thread, before anything pinned it
+        pthread_getaffinity_np(pthread_self(), sizeof (thread_startup_cpus), &thread_startup_cpus);
+        thread_startup_known = true;
+    }
+    if (!CPU_COUNT(cpus))
+        cpus = &thread_startup_cpus;
+    if ((err = pthread_setaffinity_np(thread, sizeof (*cpus), cpus)))
+        fprintf(stderr, "%s thread: can't set the CPU affinity: %s\n", thread_role_names[role], strerror(err));
+
+    if (role == THREAD_READER && Modes.reader_priority) {
+        param.sched_priority = Modes.reader_priority;
+        if ((err = pthread_setschedparam(thread, SCHED_FIFO, &param)))
+            fprintf(stderr, "reader thread: can't set SCHED_FIFO priority %d: %s\n", Modes.reader_priority, strerror(err));
+    }
+
+    if (thread_placed_count == THREAD_PLACED_MAX)
+        return;
+    struct thread_placement *p = &thread_placed[thread_placed_count++];
+    p->role = role;
+    if (pthread_getaffinity_np(thread, sizeof (p->cpus), &p->cpus))
+        CPU_ZERO(&p->cpus);
+    if (pthread_getschedparam(thread, &policy, &param)) {
+        policy = SCHED_OTHER;
+        param.sched_priority = 0;
+    }
+    p->policy = policy;
+    p->priority = param.sched_priority;
+}
+
+void thread_report_placement(void) {
+    char line[1024];
+    size_t used = 0;
+
+    // one entry per run of threads of the same role placed alike, such as
+    // the demodulator workers
+    for (unsigned i = 0; i < thread_placed_count && used < sizeof (line);) {
+        const struct thread_placement *p = &thread_placed[i];
+        unsigned n = 1;
+        char cpus[256];
+
+        while (i + n < thread_placed_count && thread_placed[i + n].role == p->role &&
+                CPU_EQUAL(&thread_placed[i + n].cpus, &p->cpus) && thread_placed[i + n].policy == p->policy)
+            n++;
+
+        format_cpu_list(&p->cpus, cpus, sizeof (cpus));
+        used += snprintf(line + used, sizeof (line) - used, "%s%s", used ? ", " : "", thread_role_names[p->role]);
+        if (n > 1 && used < sizeof (line))
+            used += snprintf(line + used, sizeof (line) - used, " x%u", n);
+        if (used < sizeof (line))
+            used += snprintf(line + used, sizeof (line) - used, " on %s", cpus[0] ? cpus : "?");
+        if (p->policy == SCHED_FIFO && used < sizeof (line))
+            used += snprintf(line + used, sizeof (line) - used, " SCHED_FIFO %d", p->priority);
+        i += n;
+    }
+
+    if (thread_placed_count)
+        fprintf(stderr, "Threads: %s\n", line);
+}
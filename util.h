@@ -25,10 +25,15 @@
 #define UTIL_H
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
 
 /* Returns system time in milliseconds */
 uint64_t mstime(void);
 
+/* Returns system time in microseconds, the real one also when reading a file */
+uint64_t microtime(void);
+
 /* Returns the time for the current message we're dealing with */
 extern uint64_t _messageNow;
 
@@ -66,4 +71,27 @@ void update_cpu_timing(struct timespec *start_time, struct timespec *add_to);
 /* set current thread name, if supported */
 void set_thread_name(const char *name);
 
+/* The kinds of threads --cpu-affinity places */
+typedef enum {
+    THREAD_MAIN, // demodulation, decoding and the background work
+    THREAD_READER, // SDR and Beast serial readers, and their helpers
+    THREAD_DEMOD, // demodulator workers, see --demod-threads
+    THREAD_NET_IO, // the network I/O thread
+    THREAD_DECODE, // network input decoding workers, see --net-ingest-threads
+    THREAD_WRITER, // the aircraft.pb writer
+    THREAD_ROLE_COUNT
+} thread_role_t;
+
+/* Parse a --cpu-affinity argument, <role>:<cpu list> */
+bool thread_parse_affinity(const char *arg);
+
+/* Move a thread just created (or the calling thread, for THREAD_MAIN) to
+ * the CPUs configured for its role, or those readsb started with, and give
+ * reader threads the --reader-priority; remembered for
+ * thread_report_placement() */
+void thread_place(pthread_t thread, thread_role_t role);
+
+/* Print where the threads placed so far ended up */
+void thread_report_placement(void);
+
 #endif
@@ -129,10 +129,11 @@ static void view1090Init(void) {
     }
 
     // Prepare error correction tables
-    modesChecksumInit(Modes.nfix_crc);
+    modesChecksumInit(Modes.nfix_crc, NULL);
     icaoFilterInit();
     modeACInit();
     interactiveInit();
+    stats_sketches_reset();
 }
 
 static error_t parse_opt(int key, char *arg, struct argp_state *state) {
@@ -166,6 +167,13 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
         case OptInteractiveTTL:
             Modes.interactive_display_ttl = (uint64_t) (1000 * atof(arg));
             break;
+        case OptInteractiveSort:
+            if (!interactiveParseSort(arg)) {
+                fprintf(stderr, "--interactive-sort: Unknown order: %s\n", arg);
+                fprintf(stderr, "Valid orders: none, distance, seen, signal\n");
+                return 1;
+            }
+            break;
         case OptLat:
             Modes.receiver.latitude = atof(arg);
             break;
@@ -219,13 +227,6 @@ int main(int argc, char **argv) {
     con->port = bo_connect_port;
     con->service = s;
 
-    con->mutex = malloc(sizeof (pthread_mutex_t));
-    if (!con->mutex || pthread_mutex_init(con->mutex, NULL)) {
-        fprintf(stderr, "Unable to initialize connector mutex!\n");
-        exit(1);
-    }
-    pthread_mutex_lock(con->mutex);
-
     serviceConnect(con);
     uint64_t timeout = mstime() + 10 * 1000;
     int counter = 0;
@@ -258,7 +259,6 @@ int main(int argc, char **argv) {
 
     // Keep going till the user does something that stops us
     while (!Modes.exit) {
-        struct timespec r = {0, 100 * 1000 * 1000};
         icaoFilterExpire();
         trackPeriodicUpdate();
         modesNetPeriodicWork();
@@ -273,28 +273,16 @@ int main(int argc, char **argv) {
             continue;
         }
 
-        nanosleep(&r, NULL);
+        modesNetWait(100);
     }
 
-    /* Go through tracked aircraft chain and free up any used memory */
-    for (int j = 0; j < AIRCRAFTS_BUCKETS; j++) {
-        struct aircraft *a = Modes.aircrafts[j], *n;
-        while (a) {
-            n = a->next;
-            if (a) free(a);
-            a = n;
-        }
-    }
+    /* Free up the tracked aircraft */
+    trackCleanup();
+    geomag_cleanup();
     // Free local service and client
     if (s) free(s);
-    if (con->addr_info) {
-        freeaddrinfo(con->addr_info);
-        con->addr_info = NULL;
-    }
-    pthread_mutex_unlock(con->mutex);
-    pthread_mutex_destroy(con->mutex);
-    free(con->mutex);
     free(con);
+    resolveCleanup();
 
 exit:
     interactiveCleanup();
@@ -4,7 +4,6 @@ self.importScripts("readsb-pb.js");
 var READSB;
 (function (READSB) {
     let AircraftTraceCollector = null;
-    const PositionHistoryBuffer = [];
     self.onmessage = (ev) => {
         const msg = ev.data;
         switch (msg.type) {
@@ -22,65 +21,62 @@ var READSB;
         }
     };
     function StartLoadHistory(historySize) {
-        let loaded = 0;
         if (historySize > 0) {
-            for (let i = 0; i < historySize; i++) {
-                fetch(`../../../data/history_${i}.pb`, {
-                    cache: "no-cache",
-                    method: "GET",
-                    mode: "cors",
-                })
-                    .then((res) => {
-                    if (res.status >= 200 && res.status < 400) {
-                        return Promise.resolve(res);
-                    }
-                    else {
-                        return Promise.reject(res.statusText);
-                    }
-                })
-                    .then((res) => {
-                    return res.arrayBuffer();
-                }, (res) => {
-                    loaded++;
-                    console.error(`Failed to load history chunk: ${res.message}`);
-                })
-                    .then((pb) => {
-                    if (loaded < 0) {
-                        return;
-                    }
-                    loaded++;
-                    const pbf = new Pbf(pb);
-                    const data = READSB.AircraftsUpdate.read(pbf);
-                    pbf.destroy();
-                    PositionHistoryBuffer.push(data);
-                    if (loaded >= historySize) {
-                        loaded = -1;
-                        DoneLoadHistory();
-                    }
-                })
-                    .catch((error) => {
-                    if (loaded < 0) {
-                        return;
-                    }
-                    console.error(error.stack);
-                    self.close();
-                });
-            }
+            fetch(`../../../data/history.pb`, {
+                cache: "no-cache",
+                method: "GET",
+                mode: "cors",
+            })
+                .then((res) => {
+                if (res.status >= 200 && res.status < 400) {
+                    return Promise.resolve(res);
+                }
+                else {
+                    return Promise.reject(res.statusText);
+                }
+            })
+                .then((res) => {
+                return res.arrayBuffer();
+            })
+                .then((pb) => {
+                const pbf = new Pbf(pb);
+                const data = READSB.HistoryUpdate.read(pbf);
+                pbf.destroy();
+                DoneLoadHistory(data);
+            })
+                .catch((error) => {
+                console.error(`Failed to load history: ${error}`);
+                self.close();
+            });
         }
     }
-    function DoneLoadHistory() {
-        if (PositionHistoryBuffer.length > 0) {
-            PositionHistoryBuffer.sort((x, y) => x.now - y.now);
-            for (const h of PositionHistoryBuffer) {
-                h.history.forEach((ac, i) => {
-                    if ((ac.lat !== null) && (ac.lon !== null) && (ac.alt_baro !== null)) {
-                        const pos = new Array(ac.lat, ac.lon, ac.alt_baro);
-                        const msg = { type: "Update", data: [ac.addr.toString(16).padStart(6, "0"), pos, h.now] };
-                        AircraftTraceCollector.postMessage(msg);
-                    }
-                });
+    function DoneLoadHistory(h) {
+        const times = [];
+        let time = 0;
+        for (const t of h.times) {
+            time += t;
+            times.push(time);
+        }
+        const updates = [];
+        for (const track of h.tracks) {
+            const icao = track.addr.toString(16).padStart(6, "0");
+            let sample = 0;
+            let lat = 0;
+            let lon = 0;
+            let alt = 0;
+            for (let i = 0; i + 3 < track.points.length; i += 4) {
+                sample += track.points[i];
+                lat += track.points[i + 1];
+                lon += track.points[i + 2];
+                alt += track.points[i + 3];
+                const pos = new Array(lat / 1e5, lon / 1e5, alt === -400 ? -9999 : alt * 25);
+                updates.push({ sample, data: [icao, pos, times[sample]] });
             }
         }
+        updates.sort((x, y) => x.sample - y.sample);
+        for (const u of updates) {
+            AircraftTraceCollector.postMessage({ type: "Update", data: u.data });
+        }
         self.close();
     }
 })(READSB || (READSB = {}));
@@ -22,7 +22,6 @@ self.importScripts("readsb-pb.js");
 
 namespace READSB {
     let AircraftTraceCollector: MessagePort = null; // Message port to trace collector worker
-    const PositionHistoryBuffer: IAircraftsUpdate[] = [];
 
     /**
      * Handle incoming messages from web frontend or trace collector worker.
@@ -49,70 +48,68 @@ namespace READSB {
      * @param historySize Size of aircraft history.
      */
     function StartLoadHistory(historySize: number) {
-        let loaded = 0;
         if (historySize > 0) {
-            for (let i = 0; i < historySize; i++) {
-                fetch(`../../../data/history_${i}.pb`, {
-                    cache: "no-cache",
-                    method: "GET",
-                    mode: "cors",
+            fetch(`../../../data/history.pb`, {
+                cache: "no-cache",
+                method: "GET",
+                mode: "cors",
+            })
+                .then((res: Response) => {
+                    if (res.status >= 200 && res.status < 400) {
+                        return Promise.resolve(res);
+                    } else {
+                        return Promise.reject(res.statusText);
+                    }
                 })
-                    .then((res: Response) => {
-                        if (res.status >= 200 && res.status < 400) {
-                            return Promise.resolve(res);
-                        } else {
-                            return Promise.reject(res.statusText);
-                        }
-                    })
-                    .then((res) => {
-                        return res.arrayBuffer();
-                    }, (res) => {
-                        loaded++;
-                        console.error(`Failed to load history chunk: ${res.message}`);
-                    })
-                    .then((pb: ArrayBuffer) => {
-                        if (loaded < 0) {
-                            return;
-                        }
-                        loaded++;
-                        const pbf = new Pbf(pb);
-                        const data = READSB.AircraftsUpdate.read(pbf);
-                        pbf.destroy();
-                        PositionHistoryBuffer.push(data);
-                        if (loaded >= historySize) {
-                            loaded = -1;
-                            DoneLoadHistory();
-                        }
-                    })
-                    .catch((error) => {
-                        if (loaded < 0) {
-                            return;
-                        }
-                        console.error(error.stack);
-                        self.close();
-                    });
-            }
+                .then((res) => {
+                    return res.arrayBuffer();
+                })
+                .then((pb: ArrayBuffer) => {
+                    const pbf = new Pbf(pb);
+                    const data = READSB.HistoryUpdate.read(pbf);
+                    pbf.destroy();
+                    DoneLoadHistory(data);
+                })
+                .catch((error) => {
+                    console.error(`Failed to load history: ${error}`);
+                    self.close();
+                });
         }
     }
 
     /**
      * Forward history data to aircraft trace collector.
+     * @param h Aircraft history, delta coded as described in readsb.proto.
      */
-    function DoneLoadHistory() {
-        if (PositionHistoryBuffer.length > 0) {
-            // Sort history by timestamp
-            PositionHistoryBuffer.sort((x, y) => x.now - y.now);
-            // Process history
-            for (const h of PositionHistoryBuffer) {
-                h.history.forEach((ac: IAircraftHistory, i: number) => {
-                    if ((ac.lat !== null) && (ac.lon !== null) && (ac.alt_baro !== null)) {
-                        const pos = new Array(ac.lat, ac.lon, ac.alt_baro);
-                        const msg = { type: "Update", data: [ac.addr.toString(16).padStart(6, "0"), pos, h.now] };
-                        AircraftTraceCollector.postMessage(msg);
-                    }
-                });
+    function DoneLoadHistory(h: IHistoryUpdate) {
+        // Sample times from their differences
+        const times: number[] = [];
+        let time = 0;
+        for (const t of h.times) {
+            time += t;
+            times.push(time);
+        }
+        // Positions from their differences, in the order they were taken
+        const updates: Array<{ sample: number, data: any[] }> = [];
+        for (const track of h.tracks) {
+            const icao = track.addr.toString(16).padStart(6, "0");
+            let sample = 0;
+            let lat = 0;
+            let lon = 0;
+            let alt = 0;
+            for (let i = 0; i + 3 < track.points.length; i += 4) {
+                sample += track.points[i];
+                lat += track.points[i + 1];
+                lon += track.points[i + 2];
+                alt += track.points[i + 3];
+                const pos = new Array(lat / 1e5, lon / 1e5, alt === -400 ? -9999 : alt * 25);
+                updates.push({ sample, data: [icao, pos, times[sample]] });
             }
         }
+        updates.sort((x, y) => x.sample - y.sample);
+        for (const u of updates) {
+            AircraftTraceCollector.postMessage({ type: "Update", data: u.data });
+        }
         // Job done, self terminated.
         self.close();
     }
@@ -721,6 +721,70 @@ var READSB;
             }
         },
     };
+    READSB.HistoryTrack = {
+        read(pbf, end) {
+            return pbf.readFields(this._readField, {
+                addr: null,
+                points: [],
+            }, end);
+        },
+        _readField(tag, obj, pbf) {
+            if (tag === 1) {
+                obj.addr = pbf.readVarint();
+            }
+            else if (tag === 2) {
+                pbf.readPackedSVarint(obj.points);
+            }
+        },
+        write(obj, pbf) {
+            if (obj.addr) {
+                pbf.writeVarintField(1, obj.addr);
+            }
+            if (obj.points) {
+                pbf.writePackedSVarint(2, obj.points);
+            }
+        },
+    };
+    READSB.HistoryUpdate = {
+        read(pbf, end) {
+            return pbf.readFields(this._readField, {
+                now: 0,
+                cursor: 0,
+                times: [],
+                tracks: [],
+            }, end);
+        },
+        _readField(tag, obj, pbf) {
+            if (tag === 1) {
+                obj.now = pbf.readVarint();
+            }
+            else if (tag === 2) {
+                obj.cursor = pbf.readVarint();
+            }
+            else if (tag === 3) {
+                pbf.readPackedSVarint(obj.times);
+            }
+            else if (tag === 4) {
+                obj.tracks.push(READSB.HistoryTrack.read(pbf, pbf.readVarint() + pbf.pos));
+            }
+        },
+        write(obj, pbf) {
+            if (obj.now) {
+                pbf.writeVarintField(1, obj.now);
+            }
+            if (obj.cursor) {
+                pbf.writeVarintField(2, obj.cursor);
+            }
+            if (obj.times) {
+                pbf.writePackedSVarint(3, obj.times);
+            }
+            if (obj.tracks) {
+                for (const t of obj.tracks) {
+                    pbf.writeMessage(4, READSB.HistoryTrack.write, t);
+                }
+            }
+        },
+    };
     READSB.Receiver = {
         read(pbf, end) {
             return pbf.readFields(this._readField, {
@@ -373,6 +373,52 @@ namespace READSB {
         },
     };
 
+    export const HistoryTrack = {
+        read(pbf: Pbf, end?: number): IHistoryTrack {
+            return pbf.readFields(this._readField,
+                {
+                    addr: null,
+                    points: [],
+                }, end);
+        },
+        _readField(tag: number, obj: any, pbf: Pbf): void {
+            if (tag === 1) { obj.addr = pbf.readVarint(); }
+            else if (tag === 2) { pbf.readPackedSVarint(obj.points); }
+        },
+        write(obj: IHistoryTrack, pbf: Pbf): void {
+            if (obj.addr) { pbf.writeVarintField(1, obj.addr); }
+            if (obj.points) { pbf.writePackedSVarint(2, obj.points); }
+        },
+    };
+
+    export const HistoryUpdate = {
+        read(pbf: Pbf, end?: number): IHistoryUpdate {
+            return pbf.readFields(this._readField,
+                {
+                    now: 0,
+                    cursor: 0,
+                    times: [],
+                    tracks: [],
+                }, end);
+        },
+        _readField(tag: number, obj: any, pbf: Pbf): void {
+            if (tag === 1) { obj.now = pbf.readVarint(); }
+            else if (tag === 2) { obj.cursor = pbf.readVarint(); }
+            else if (tag === 3) { pbf.readPackedSVarint(obj.times); }
+            else if (tag === 4) { obj.tracks.push(HistoryTrack.read(pbf, pbf.readVarint() + pbf.pos)); }
+        },
+        write(obj: IHistoryUpdate, pbf: Pbf) {
+            if (obj.now) { pbf.writeVarintField(1, obj.now); }
+            if (obj.cursor) { pbf.writeVarintField(2, obj.cursor); }
+            if (obj.times) { pbf.writePackedSVarint(3, obj.times); }
+            if (obj.tracks) {
+                for (const t of obj.tracks) {
+                    pbf.writeMessage(4, HistoryTrack.write, t);
+                }
+            }
+        },
+    };
+
     export const Receiver = {
         read(pbf: Pbf, end?: number): IReceiver {
             return pbf.readFields(this._readField,
@@ -127,6 +127,18 @@ declare namespace READSB {
         history?: IAircraftHistory[];
     }
 
+    export interface IHistoryTrack {
+        addr?: number;
+        points?: number[];
+    }
+
+    export interface IHistoryUpdate {
+        now?: number;
+        cursor?: number;
+        times?: number[];
+        tracks?: IHistoryTrack[];
+    }
+
     export interface IReceiver {
         version?: string;
         refresh?: number;